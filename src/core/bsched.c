@@ -33,7 +33,13 @@
 
 #include "common.h"
 
+#if defined(I_LINUX_ERRQUEUE) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY)
+#include <linux/errqueue.h>
+#define USE_ZEROCOPY
+#endif
+
 #include "bsched.h"
+#include "gnet_stats.h"
 #include "inet.h"
 #include "sockets.h"
 #include "uploads.h"
@@ -41,13 +47,19 @@
 #include "if/core/wrap.h"		/* For wrapped_io_t */
 #include "if/gnet_property_priv.h"
 
+#include "lib/compat_poll.h"
 #include "lib/compat_sendfile.h"
 #include "lib/entropy.h"
+#include "lib/eslist.h"
+#include "lib/fd.h"
 #include "lib/halloc.h"
+#include "lib/hevset.h"
 #include "lib/hstrfn.h"
+#include "lib/htable.h"
+#include "lib/htb.h"
 #include "lib/inputevt.h"
 #include "lib/parse.h"
-#include "lib/plist.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
 #include "lib/stringify.h"
 #include "lib/vmm.h"
@@ -113,12 +125,21 @@ enum bsched_magic {
  * of the period, any amount of bandwidth that has been unused will be
  * given as "stolen" bandwidth to some of the schedulers stealing from us.
  * Priority is given to schedulers that used up all their bandwidth.
+ *
+ * Within a scheduler, bandwidth can also be distributed through hierarchical
+ * token buckets: each scheduler is the root class for its traffic type, with
+ * one sub-class per network (/24 for IPv4, /64 for IPv6) and, below these,
+ * one sub-class per host.  Sources connected to the same host share the host
+ * class, hosts of the same network share the network class, so that a peer
+ * cannot grab more bandwidth merely by opening more connections.
  */
 
 struct bsched {
 	enum bsched_magic magic;
 	tm_t last_period;			/**< Last time we ran our period */
-	plist_t *sources;			/**< List of bio_source_t */
+	elist_t sources;			/**< List of bio_source_t */
+	elist_t idle;				/**< Sources whose callback is not listening */
+	elist_t listening;			/**< Sources whose callback is listening */
 	pslist_t *stealers;			/**< List of bsched_t stealing bw */
 	char *name;					/**< Name, for tracing purposes */
 	int count;					/**< Amount of sources */
@@ -141,9 +162,15 @@ struct bsched {
 	int64 bw_unwritten;			/**< Data that we could not write */
 	int64 bw_capped;			/**< Bandwidth we refused to sources */
 	int64 bw_urgent;			/**< Urgent b/w required in stealing */
+	int64 bw_allocated;			/**< Bandwidth credit allocated to sources */
+	uint32 timeslice;			/**< Amount of timeslices begun */
+	uint32 active_gen;			/**< Generation of active sources */
 	int last_used;				/**< Nb of active sources last period */
 	int current_used;			/**< Nb of active sources this period */
 	uint io_favours;			/**< Amount of sources wanting favours */
+	htb_class_t *htb;			/**< Root of token bucket classes */
+	hevset_t *nets;				/**< Network classes (struct bsched_peer) */
+	hevset_t *hosts;			/**< Host classes (struct bsched_peer) */
 	unsigned looped:1;			/**< True when looped once over sources */
 };
 
@@ -186,6 +213,130 @@ bio_check(const bio_source_t * const bio)
 	g_assert(BIO_SOURCE_MAGIC == bio->magic);
 }
 
+enum bsched_peer_magic { BSCHED_PEER_MAGIC = 0x2e6b90d1 };
+
+/**
+ * Token bucket class of a remote host or network, within a scheduler.
+ */
+struct bsched_peer {
+	host_addr_t addr;			/**< Host or network address (embedded key) */
+	enum bsched_peer_magic magic;
+	htb_class_t *class;			/**< Token bucket class */
+	struct bsched_peer *net;	/**< Network of host, NULL for networks */
+	int refcnt;					/**< Sources for hosts, hosts for networks */
+};
+
+static inline void
+bsched_peer_check(const struct bsched_peer * const bp)
+{
+	g_assert(bp != NULL);
+	g_assert(BSCHED_PEER_MAGIC == bp->magic);
+}
+
+/**
+ * Get a reference on the peer class for the address, creating it as a
+ * sub-class of `parent' if needed.
+ */
+static struct bsched_peer *
+bsched_peer_get(hevset_t *set, const host_addr_t addr, htb_class_t *parent)
+{
+	struct bsched_peer *bp;
+
+	bp = hevset_lookup(set, &addr);
+
+	if (NULL == bp) {
+		WALLOC0(bp);
+		bp->magic = BSCHED_PEER_MAGIC;
+		bp->addr = addr;
+		bp->class = htb_class_make(parent);
+		hevset_insert(set, bp);
+	}
+
+	bsched_peer_check(bp);
+	bp->refcnt++;
+
+	return bp;
+}
+
+/**
+ * Release a reference on the peer class, freeing it when no longer used.
+ */
+static void
+bsched_peer_release(bsched_t *bs, struct bsched_peer *bp)
+{
+	struct bsched_peer *net;
+
+	bsched_peer_check(bp);
+	g_assert(bp->refcnt > 0);
+
+	if (--bp->refcnt != 0)
+		return;
+
+	net = bp->net;
+	hevset_remove(NULL == net ? bs->nets : bs->hosts, &bp->addr);
+	htb_class_free_null(&bp->class);
+	bp->magic = 0;
+	WFREE(bp);
+
+	if (net != NULL)
+		bsched_peer_release(bs, net);
+}
+
+/**
+ * Attach the source to the class of the host it is connected to.
+ *
+ * Sources which are not connected to a remote host, such as UDP sockets,
+ * are left without a peer class and use the scheduler root class.
+ */
+static void
+bsched_peer_attach(bsched_t *bs, bio_source_t *bio)
+{
+	socket_addr_t sa;
+	host_addr_t addr;
+	struct bsched_peer *host;
+	int fd;
+
+	g_assert(NULL == bio->peer);
+
+	fd = bio->wio->fd(bio->wio);
+
+	if (!is_valid_fd(fd) || 0 != socket_addr_getpeername(&sa, fd))
+		return;
+
+	addr = socket_addr_get_addr(&sa);
+
+	if (!host_addr_is_ipv4(addr) && !host_addr_is_ipv6(addr))
+		return;
+
+	host = hevset_lookup(bs->hosts, &addr);
+
+	if (NULL == host) {
+		struct bsched_peer *net;
+
+		net = bsched_peer_get(bs->nets,
+			host_addr_mask_net(addr, 8, 64), bs->htb);
+		host = bsched_peer_get(bs->hosts, addr, net->class);
+		host->net = net;
+	} else {
+		bsched_peer_check(host);
+		host->refcnt++;
+	}
+
+	bio->peer = host;
+}
+
+/**
+ * Detach the source from its peer class, if any.
+ */
+static void
+bsched_peer_detach(bsched_t *bs, bio_source_t *bio)
+{
+	if (bio->peer != NULL) {
+		bsched_peer_release(bs, bio->peer);
+		bio->peer = NULL;
+	}
+}
+
 /**
  * Create a new bandwidth scheduler.
  *
@@ -222,6 +373,14 @@ bsched_make(const char *name, uint type, uint32 mode,
 	bs->period_ema = period;
 	bs->bw_per_second = bandwidth;
 	bs->bw_max = (int64) (bandwidth / 1000.0 * period);
+	elist_init(&bs->sources, offsetof(bio_source_t, lk));
+	elist_init(&bs->idle, offsetof(bio_source_t, evlk));
+	elist_init(&bs->listening, offsetof(bio_source_t, evlk));
+	bs->htb = htb_root_make();
+	bs->nets = hevset_create_any(offsetof(struct bsched_peer, addr),
+		host_addr_hash_func, host_addr_hash_func2, host_addr_eq_func);
+	bs->hosts = hevset_create_any(offsetof(struct bsched_peer, addr),
+		host_addr_hash_func, host_addr_hash_func2, host_addr_eq_func);
 
 	return bs;
 }
@@ -246,20 +405,28 @@ bsched_get(bsched_bws_t bws)
 static void
 bsched_free(bsched_t *bs)
 {
-	plist_t *iter;
+	bio_source_t *bio;
 
 	bsched_check(bs);
 
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
-
+	ELIST_FOREACH_DATA(&bs->sources, bio) {
 		bio_check(bio);
 		g_assert(bsched_get(bio->bws) == bs);
+		bsched_peer_detach(bs, bio);
 		bio->bws = BSCHED_BWS_INVALID;	/* Mark orphan source */
+		bio->flags &= ~(BIO_F_IDLE | BIO_F_LISTENING);
 	}
 
-	plist_free_null(&bs->sources);
+	g_assert(0 == hevset_count(bs->nets));
+	g_assert(0 == hevset_count(bs->hosts));
+
+	elist_discard(&bs->listening);
+	elist_discard(&bs->idle);
+	elist_discard(&bs->sources);
 	pslist_free_null(&bs->stealers);
+	hevset_free_null(&bs->nets);
+	hevset_free_null(&bs->hosts);
+	htb_class_free_null(&bs->htb);
 	HFREE_NULL(bs->name);
 	bs->magic = 0;
 	WFREE(bs);
@@ -586,6 +753,12 @@ bsched_correct_init(void)
 	bsched_set_bandwidth(BSCHED_BWS_DHT_IN, 0);
 }
 
+#ifdef USE_ZEROCOPY
+static htable_t *bio_zc_sockets;	/**< wrap_io_t -> struct bio_zerocopy */
+
+static void bio_zc_free_kv(const void *key, void *value, void *data);
+#endif
+
 /**
  * Initialize global bandwidth schedulers.
  */
@@ -606,6 +779,10 @@ bsched_init(void)
 		bsched_config_steal_gnet();
 
 	bsched_set_peermode(GNET_PROPERTY(current_peermode));
+
+#ifdef USE_ZEROCOPY
+	bio_zc_sockets = htable_create(HASH_KEY_SELF, 0);
+#endif
 }
 
 /**
@@ -629,6 +806,13 @@ bsched_close(void)
 	for (i = 0; i < NUM_BSCHED_BWS; i++) {
 		bws_set[i] = NULL;
 	}
+
+#ifdef USE_ZEROCOPY
+	if (bio_zc_sockets != NULL) {
+		htable_foreach(bio_zc_sockets, bio_zc_free_kv, NULL);
+		htable_free_null(&bio_zc_sockets);
+	}
+#endif
 }
 
 /**
@@ -801,6 +985,399 @@ bio_bw_per_second(const bio_source_t *bio)
 	return bs->bw_per_second;
 }
 
+#ifdef USE_ZEROCOPY
+/**
+ * A buffer pinned by a zero-copy transmission.
+ *
+ * With MSG_ZEROCOPY, the kernel transmits data directly from our buffer,
+ * which must therefore remain untouched until the kernel notifies, through
+ * the socket error queue, that it is done with it.  Each send() call gets
+ * a sequence number and completions are reported for ranges of these.
+ */
+struct bio_zc_pin {
+	uint32 seq;				/**< Sequence number of the send() call */
+	size_t len;				/**< Amount of data sent from the buffer */
+	pdata_t *db;			/**< Referenced buffer, pinned until completion */
+	slink_t lk;				/**< Embedded link in pending list */
+};
+
+/**
+ * Zero-copy transmission state of a socket.
+ *
+ * Sequence numbers are allocated by the kernel for each socket, and the
+ * completions for data sent through an I/O source can arrive after that
+ * source was removed, when the connection is kept alive to serve another
+ * request.  Therefore, the state is attached to the socket, through its
+ * wrapped I/O object, and is only discarded when the socket is closed.
+ */
+struct bio_zerocopy {
+	eslist_t pending;		/**< Pinned buffers, in sequence order */
+	uint32 next;			/**< Sequence number of next zero-copy send */
+	bool disabled;			/**< Zero-copy not possible on this socket */
+};
+
+static size_t bio_zc_pinned;	/**< Total amount of pinned buffers */
+
+static void bio_enable(bio_source_t *bio);
+
+/**
+ * Release pinned buffers up to the given sequence number, inclusive.
+ *
+ * @param zc		the zero-copy state
+ * @param hi		last sequence number acknowledged by the kernel
+ * @param copied	whether the kernel had to copy the data after all
+ */
+static void
+bio_zc_release(struct bio_zerocopy *zc, uint32 hi, bool copied)
+{
+	struct bio_zc_pin *pin;
+
+	while (NULL != (pin = eslist_head(&zc->pending))) {
+		if ((int32) (pin->seq - hi) > 0)
+			break;
+
+		eslist_shift(&zc->pending);
+		gnet_stats_count_general(copied ?
+			GNR_ZEROCOPY_COPIED_BYTES : GNR_ZEROCOPY_BYTES, pin->len);
+		pdata_unref(pin->db);
+		WFREE(pin);
+		bio_zc_pinned--;
+	}
+
+	gnet_stats_set_general(GNR_ZEROCOPY_PINNED_BUFFERS, bio_zc_pinned);
+}
+
+/**
+ * Read zero-copy completion notifications from the socket error queue,
+ * releasing the buffers the kernel no longer needs.
+ *
+ * @param zc		the zero-copy state of the socket
+ * @param fd		the socket file descriptor
+ *
+ * @return TRUE if the error queue held other errors than completions.
+ */
+static bool
+bio_zc_reap(struct bio_zerocopy *zc, int fd)
+{
+	bool other = FALSE;
+
+	while (0 != eslist_count(&zc->pending)) {
+		char control[CMSG_SPACE(sizeof(struct sock_extended_err) +
+			sizeof(struct sockaddr_in6))];
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+
+		ZERO(&msg);
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof control;
+
+		if (-1 == recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT))
+			break;
+
+		for (
+			cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg != NULL;
+			cmsg = CMSG_NXTHDR(&msg, cmsg)
+		) {
+			const struct sock_extended_err *ee;
+
+			if (
+				!(IPPROTO_IP == cmsg->cmsg_level &&
+					IP_RECVERR == cmsg->cmsg_type) &&
+				!(IPPROTO_IPV6 == cmsg->cmsg_level &&
+					IPV6_RECVERR == cmsg->cmsg_type)
+			)
+				continue;
+
+			ee = (const void *) CMSG_DATA(cmsg);
+
+			if (0 != ee->ee_errno || SO_EE_ORIGIN_ZEROCOPY != ee->ee_origin) {
+				other = TRUE;
+				continue;
+			}
+
+			bio_zc_release(zc, ee->ee_data,
+				booleanize(ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED));
+		}
+	}
+
+	return other;
+}
+
+/**
+ * Process an exception condition reported on a socket using zero-copy.
+ *
+ * Completion notifications make the socket report an error condition, which
+ * I/O callbacks would take as a connection failure.  We process the
+ * notifications and check whether the socket still has an error pending
+ * afterwards.
+ *
+ * @return TRUE if the exception is genuine.
+ */
+static bool
+bio_zc_exception(struct bio_zerocopy *zc, int fd)
+{
+	struct pollfd pfd;
+
+	if (bio_zc_reap(zc, fd))
+		return TRUE;
+
+	pfd.fd = fd;
+	pfd.events = 0;
+	pfd.revents = 0;
+
+	return 1 == compat_poll(&pfd, 1, 0) && 0 != (pfd.revents & POLLERR);
+}
+
+/**
+ * Input event handler for sources using zero-copy transmission.
+ *
+ * Exceptions caused by completion notifications only are not passed along
+ * to the I/O callback.
+ */
+static void
+bio_zc_event(void *data, int source, inputevt_cond_t cond)
+{
+	bio_source_t *bio = data;
+
+	bio_check(bio);
+	g_assert(bio->io_callback != NULL);
+
+	if ((cond & INPUT_EVENT_EXCEPTION) && !bio_zc_exception(bio->zc, source)) {
+		cond &= ~(uint) INPUT_EVENT_EXCEPTION;
+		if (INPUT_EVENT_NONE == cond)
+			return;
+	}
+
+	(*bio->io_callback)(bio->io_arg, source, cond);
+}
+
+/**
+ * Attach the zero-copy state of the socket to a new I/O source, if the
+ * socket already used zero-copy transmissions.
+ */
+static void
+bio_zc_attach(bio_source_t *bio)
+{
+	if G_UNLIKELY(NULL == bio_zc_sockets)
+		return;
+
+	bio->zc = htable_lookup(bio_zc_sockets, bio->wio);
+}
+
+/**
+ * Enable zero-copy transmissions on the I/O source, the first time.
+ *
+ * @return whether zero-copy transmissions can be used.
+ */
+static bool
+bio_zc_setup(bio_source_t *bio)
+{
+	struct bio_zerocopy *zc;
+	int on = 1;
+
+	if G_LIKELY(bio->zc != NULL)
+		return !bio->zc->disabled;
+
+	if G_UNLIKELY(NULL == bio_zc_sockets)
+		return FALSE;
+
+	WALLOC0(zc);
+	eslist_init(&zc->pending, offsetof(struct bio_zc_pin, lk));
+	htable_insert(bio_zc_sockets, bio->wio, zc);
+	bio->zc = zc;
+
+	if (
+		-1 == setsockopt(bio->wio->fd(bio->wio),
+			SOL_SOCKET, SO_ZEROCOPY, &on, sizeof on)
+	) {
+		if (GNET_PROPERTY(bsched_debug)) {
+			g_debug("BSCHED %s(fd=%d): cannot enable zero-copy: %m",
+				G_STRFUNC, bio->wio->fd(bio->wio));
+		}
+		zc->disabled = TRUE;
+		return FALSE;
+	}
+
+	/*
+	 * Re-install the I/O callback so that events go through bio_zc_event().
+	 */
+
+	if (bio->io_tag != 0) {
+		inputevt_remove(&bio->io_tag);
+		bio_enable(bio);
+	}
+
+	return TRUE;
+}
+
+/**
+ * Detach the zero-copy state of the socket when the I/O source is removed.
+ *
+ * Buffers still pinned remain referenced by the socket state until the
+ * kernel reports their completion or until the socket is closed.
+ */
+static void
+bio_zc_detach(bio_source_t *bio)
+{
+	if (NULL == bio->zc)
+		return;
+
+	bio_zc_reap(bio->zc, bio->wio->fd(bio->wio));
+	bio->zc = NULL;
+}
+
+/**
+ * Free zero-copy state, releasing buffers still pinned.
+ */
+static void
+bio_zc_free(struct bio_zerocopy *zc)
+{
+	bio_zc_release(zc, zc->next - 1, FALSE);
+	g_assert(0 == eslist_count(&zc->pending));
+	WFREE(zc);
+}
+
+/**
+ * Hash table iterator to free zero-copy states.
+ */
+static void
+bio_zc_free_kv(const void *unused_key, void *value, void *unused_data)
+{
+	(void) unused_key;
+	(void) unused_data;
+
+	bio_zc_free(value);
+}
+#else	/* !USE_ZEROCOPY */
+#define bio_zc_attach(b)	(void) (b)
+#define bio_zc_detach(b)	(void) (b)
+#endif	/* USE_ZEROCOPY */
+
+/**
+ * Check whether zero-copy transmissions were enabled on the socket.
+ *
+ * When they were, exception conditions reported on the socket must be
+ * checked with bio_zerocopy_exception() before being acted upon, even
+ * when no I/O source is attached to the socket any longer.
+ */
+bool
+bio_zerocopy_enabled(const wrap_io_t *wio)
+{
+#ifdef USE_ZEROCOPY
+	const struct bio_zerocopy *zc;
+
+	if G_UNLIKELY(NULL == bio_zc_sockets)
+		return FALSE;
+
+	zc = htable_lookup(bio_zc_sockets, wio);
+	return zc != NULL && !zc->disabled;
+#else
+	(void) wio;
+	return FALSE;
+#endif
+}
+
+/**
+ * Process an exception condition reported on the socket, collecting the
+ * zero-copy completion notifications that may have caused it.
+ *
+ * @return TRUE if the exception is genuine, FALSE if it was only caused by
+ * completion notifications.
+ */
+bool
+bio_zerocopy_exception(wrap_io_t *wio)
+{
+#ifdef USE_ZEROCOPY
+	struct bio_zerocopy *zc;
+
+	wrap_io_check(wio);
+
+	if G_UNLIKELY(NULL == bio_zc_sockets)
+		return TRUE;
+
+	zc = htable_lookup(bio_zc_sockets, wio);
+	if (NULL == zc || zc->disabled)
+		return TRUE;
+
+	return bio_zc_exception(zc, wio->fd(wio));
+#else
+	(void) wio;
+	return TRUE;
+#endif
+}
+
+/**
+ * Discard the zero-copy state of a socket about to be closed.
+ *
+ * Buffers still pinned are released: the kernel holds its own reference on
+ * the memory pages so this is safe, and if we reuse the memory before the
+ * data is transmitted, only the peer of the connection we are closing can
+ * see it.
+ *
+ * No I/O source must be attached to the socket any longer.
+ */
+void
+bio_zerocopy_close(wrap_io_t *wio)
+{
+#ifdef USE_ZEROCOPY
+	struct bio_zerocopy *zc;
+
+	if G_UNLIKELY(NULL == bio_zc_sockets)
+		return;
+
+	zc = htable_lookup(bio_zc_sockets, wio);
+	if (NULL == zc)
+		return;
+
+	wrap_io_check(wio);
+	htable_remove(bio_zc_sockets, wio);
+	bio_zc_reap(zc, wio->fd(wio));
+	bio_zc_free(zc);
+#else
+	(void) wio;
+#endif
+}
+
+/**
+ * Move source to the list matching the state of its I/O callback.
+ *
+ * Sources with a callback are either listening for I/O events, or idle when
+ * they are passive or were disabled for lack of bandwidth.  Keeping both
+ * lists lets us disable or revive them without going through all the
+ * sources of the scheduler.
+ */
+static void
+bio_evlist_update(bio_source_t *bio)
+{
+	bsched_t *bs;
+	uint32 flag = 0;
+
+	if (BSCHED_BWS_INVALID == bio->bws)
+		return;
+
+	if (bio->io_callback != NULL)
+		flag = 0 == bio->io_tag ? BIO_F_IDLE : BIO_F_LISTENING;
+
+	if (flag == (bio->flags & (BIO_F_IDLE | BIO_F_LISTENING)))
+		return;
+
+	bs = bsched_get(bio->bws);
+
+	if (bio->flags & BIO_F_IDLE)
+		elist_remove(&bs->idle, bio);
+	else if (bio->flags & BIO_F_LISTENING)
+		elist_remove(&bs->listening, bio);
+
+	bio->flags &= ~(BIO_F_IDLE | BIO_F_LISTENING);
+	bio->flags |= flag;
+
+	if (BIO_F_IDLE == flag)
+		elist_append(&bs->idle, bio);
+	else if (BIO_F_LISTENING == flag)
+		elist_append(&bs->listening, bio);
+}
+
 /**
  * Trigger the "passive" callback to signify that a new timeslice has begun
  * and that I/Os can resume on the source.
@@ -830,11 +1407,19 @@ bio_enable(bio_source_t *bio)
 	g_assert(0 == (bio->flags & BIO_F_PASSIVE));
 	wrap_io_check(bio->wio);
 
+#ifdef USE_ZEROCOPY
+	if (bio->zc != NULL && !bio->zc->disabled) {
+		bio->io_tag = inputevt_add(bio->wio->fd(bio->wio),
+				INPUT_EVENT_WX, bio_zc_event, bio);
+	} else
+#endif
 	bio->io_tag = inputevt_add(bio->wio->fd(bio->wio),
 			(bio->flags & BIO_F_READ) ? INPUT_EVENT_RX : INPUT_EVENT_WX,
 			bio->io_callback, bio->io_arg);
 
 	g_assert(bio->io_tag);
+
+	bio_evlist_update(bio);
 }
 
 /**
@@ -866,6 +1451,7 @@ bio_disable(bio_source_t *bio)
 	g_assert(0 == (bio->flags & BIO_F_PASSIVE));
 
 	inputevt_remove(&bio->io_tag);
+	bio_evlist_update(bio);
 }
 
 /**
@@ -888,6 +1474,8 @@ bio_add_callback(bio_source_t *bio, inputevt_handler_t callback, void *arg)
 
 	if (!(bsched_get(bio->bws)->flags & BS_F_NOBW))
 		bio_enable(bio);
+	else
+		bio_evlist_update(bio);
 }
 
 /**
@@ -912,6 +1500,7 @@ bio_add_passive_callback(bio_source_t *bio, inputevt_handler_t cb, void *arg)
 	bio->io_callback = cb;
 	bio->io_arg = arg;
 	bio->flags |= BIO_F_PASSIVE;		/* Don't call bio_enable() */
+	bio_evlist_update(bio);
 }
 
 /**
@@ -929,6 +1518,7 @@ bio_remove_callback(bio_source_t *bio)
 	bio->flags &= ~BIO_F_PASSIVE;
 	bio->io_callback = NULL;
 	bio->io_arg = NULL;
+	bio_evlist_update(bio);
 }
 
 
@@ -938,16 +1528,13 @@ bio_remove_callback(bio_source_t *bio)
 static void
 bsched_no_more_bandwidth(bsched_t *bs)
 {
-	plist_t *iter;
+	bio_source_t *bio;
 
 	bsched_check(bs);
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
 
+	while (NULL != (bio = elist_head(&bs->listening))) {
 		bio_check(bio);
-
-		if (bio->io_tag)
-			bio_disable(bio);
+		bio_disable(bio);		/* Moves it to the idle list */
 	}
 
 	bs->flags |= BS_F_NOBW;
@@ -955,39 +1542,103 @@ bsched_no_more_bandwidth(bsched_t *bs)
 
 /**
  * Remove activation indication on all the sources.
+ *
+ * A source is active when its recorded generation matches the one of the
+ * scheduler, so we only need to start a new generation.
  */
 static void
 bsched_clear_active(bsched_t *bs)
 {
-	plist_t *iter;
-
 	bsched_check(bs);
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
 
-		bio_check(bio);
-		bio->flags &= ~BIO_F_ACTIVE;
+	bs->active_gen++;
+}
+
+/**
+ * Account for the timeslices a source missed since it was last used.
+ *
+ * Per-source statistics are only updated when the source is used or
+ * queried, so that beginning a new timeslice does not need to go through
+ * all the sources.  The bandwidth recorded for the timeslice during which
+ * the source was last used is folded into the EMAs, which then decay as
+ * if the source had used nothing during the following timeslices.
+ */
+static void
+bio_timeslice_fold(bio_source_t *bio, const bsched_t *bs)
+{
+	uint32 missed = bs->timeslice - bio->timeslice - 1;
+	uint64 actual;
+
+	/*
+	 * Fast EMA of bandwidth is computed on the last n=3 terms.
+	 * The smoothing factor, sm=2/(n+1), is therefore 0.5, which is easy
+	 * to compute.  The short period gives us a good estimation of the
+	 * "instantaneous bandwidth" used.
+	 *
+	 * Slow EMA of bandwidth is computed on the last n=127 terms, which at
+	 * one computation per second, means an average of the last two minutes.
+	 * This value is smoother and therefore more suited to use for the
+	 * remaining time estimates.
+	 *
+	 * Because we use integer arithmetic (and therefore loose important
+	 * decimals), the actual values are shifted by BIO_EMA_SHIFT.
+	 * The fields storing the EMAs should therefore only be accessed via
+	 * bio_avg_bps(), which performs the shift in the other way to
+	 * re-establish proper scaling.
+	 */
+
+	actual = bio->bw_actual << BIO_EMA_SHIFT;
+	bio->bw_fast_ema += (actual >> 1) - (bio->bw_fast_ema >> 1);
+	bio->bw_slow_ema += (actual >> 6) - (bio->bw_slow_ema >> 6);
+	bio->bw_last_bps = 0 == missed ?
+		(int64) (bio->bw_actual * 1000.0 / bs->period) : 0;
+	bio->bw_actual = 0;
+
+	/*
+	 * With integer arithmetic, the EMAs stop decaying after a while, so
+	 * we do not need to loop for each missed timeslice.
+	 */
+
+	while (
+		missed-- != 0 &&
+		0 != ((bio->bw_fast_ema >> 1) | (bio->bw_slow_ema >> 6))
+	) {
+		bio->bw_fast_ema -= bio->bw_fast_ema >> 1;
+		bio->bw_slow_ema -= bio->bw_slow_ema >> 6;
 	}
+
+	bio->flags &= ~BIO_F_USED;
+	bio->timeslice = bs->timeslice;
+}
+
+/**
+ * Make sure source statistics refer to the current timeslice.
+ */
+static inline void
+bio_timeslice_sync(bio_source_t *bio, const bsched_t *bs)
+{
+	if G_UNLIKELY(bio->timeslice != bs->timeslice)
+		bio_timeslice_fold(bio, bs);
 }
 
 /**
  * Called whenever a new scheduling timeslice begins.
  *
- * Re-enable all sources and flag that we have bandwidth.
- * Update the per-source bandwidth statistics.
+ * Re-enable all disabled sources and flag that we have bandwidth.
+ * Starts a new timeslice for the per-source bandwidth statistics.
  * Clears all activation indication on all sources.
+ *
+ * This only deals with the sources that have to be re-enabled, the other
+ * per-source updates being deferred until the source is used again.
  */
 static void
 bsched_begin_timeslice(bsched_t *bs)
 {
-	plist_t *iter, *last = NULL;
+	bio_source_t *bio, *next;
 	pslist_t *trigger = NULL;
-	double norm_factor;
-	int count;
 	int64 bw_max;
 
 	bsched_check(bs);
-
 	/*
 	 * When the BS_F_STOLEN_IGN flag is set, stolen bandwidth can be given
 	 * to this scheduler but we ignore it.  The reason is that application
@@ -1025,82 +1676,46 @@ bsched_begin_timeslice(bsched_t *bs)
 		}
 	}
 
-	norm_factor = 1000.0 / bs->period;
-	bs->io_favours = 0;
-	bw_max = bs->bw_max;
-	count = 0;
-
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
-		uint64 actual;
-
-		bio_check(bio);
+	/*
+	 * Give the root token bucket its quantum for the period.  Sub-classes
+	 * get refilled lazily, the first time they are used in the period.
+	 */
 
-		last = iter;		/* Remember last seen source for rotation */
-		count++;			/* Count them for assertion */
+	htb_root_refill(bs->htb, bs->bw_max + bs->bw_stolen);
 
-		bio->flags &= ~(BIO_F_ACTIVE | BIO_F_USED);
+	bs->timeslice++;
+	bs->active_gen++;
 
-		if (bio->io_tag == 0 && bio->io_callback) {
-			if (bio->flags & BIO_F_PASSIVE)
-				trigger = pslist_prepend(trigger, bio);
-			else
-				bio_enable(bio);
-		}
+	/*
+	 * Rotate idle sources, since we don't know how glib handles callbacks
+	 * on the registered sources.  We don't want to always have the same
+	 * sources get most of the bandwidth because they simply get added
+	 * first as I/O sources.
+	 */
 
-		if (bio->flags & BIO_F_FAVOUR)
-			bs->io_favours++;
+	elist_rotate_left(&bs->idle);
 
-		/*
-		 * Pre-allocated banwdwidth is substracted from the available maximum
-		 * to not fully starve other sources and not cause over-spending.
-		 */
+	for (bio = elist_head(&bs->idle); bio != NULL; bio = next) {
+		bio_check(bio);
+		g_assert(0 == bio->io_tag);
+		g_assert(bio->io_callback != NULL);
 
-		bw_max -= MIN(bw_max, bio->bw_allocated);
+		next = elist_next_data(&bs->idle, bio);
 
-		/*
-		 * Fast EMA of bandwidth is computed on the last n=3 terms.
-		 * The smoothing factor, sm=2/(n+1), is therefore 0.5, which is easy
-		 * to compute.  The short period gives us a good estimation of the
-		 * "instantaneous bandwidth" used.
-		 *
-		 * Slow EMA of bandwidth is computed on the last n=127 terms, which at
-		 * one computation per second, means an average of the last two minutes.
-		 * This value is smoother and therefore more suited to use for the
-		 * remaining time estimates.
-		 *
-		 * Because we use integer arithmetic (and therefore loose important
-		 * decimals), the actual values are shifted by BIO_EMA_SHIFT.
-		 * The fields storing the EMAs should therefore only be accessed via
-		 * the macros, which perform the shift in the other way to
-		 * re-establish proper scaling.
-		 */
-
-		actual = bio->bw_actual << BIO_EMA_SHIFT;
-		bio->bw_fast_ema += (actual >> 1) - (bio->bw_fast_ema >> 1);
-		bio->bw_slow_ema += (actual >> 6) - (bio->bw_slow_ema >> 6);
-		bio->bw_last_bps = (int64) (bio->bw_actual * norm_factor);
-		bio->bw_actual = 0;
+		if (bio->flags & BIO_F_PASSIVE)
+			trigger = pslist_prepend(trigger, bio);
+		else
+			bio_enable(bio);	/* Moves it to the listening list */
 	}
 
-	g_assert(bs->count == count);	/* All sources are there */
-
 	/*
-	 * Rotate sources, since we don't know how glib handles callbacks on
-	 * the registered sources.  We don't want to always have the same
-	 * sources get most of the bandwidth because they simply get added
-	 * first as I/O sources.
+	 * Pre-allocated banwdwidth is substracted from the available maximum
+	 * to not fully starve other sources and not cause over-spending.
 	 */
 
-	if (last != NULL && last != bs->sources) {
-		bio_source_t *bio;
+	bw_max = bs->bw_max - MIN(bs->bw_max, bs->bw_allocated);
 
-		g_assert(bs->sources != NULL);
-		bio = bs->sources->data;
-		bio_check(bio);
-		bs->sources = plist_remove(bs->sources, bio);
-		bs->sources = plist_insert_after(bs->sources, last, bio);
-	}
+	g_assert(UNSIGNED(bs->count) == elist_count(&bs->sources));
 
 	bs->flags &= ~(BS_F_NOBW|BS_F_FROZEN_SLOT|BS_F_CHANGED_BW|BS_F_CLEARED);
 
@@ -1186,9 +1801,12 @@ bsched_bio_add(bsched_t *bs, bio_source_t *bio)
 	bsched_check(bs);
 	bio_check(bio);
 
-	bs->sources = plist_append(bs->sources, bio);
+	elist_append(&bs->sources, bio);
 	bs->count++;
 
+	bio->timeslice = bs->timeslice;
+	bio->active_gen = bs->active_gen - 1;	/* Not active yet */
+
 	bs->bw_slot = (bs->bw_max + bs->bw_stolen) / bs->count;
 
 	/*
@@ -1211,8 +1829,24 @@ bsched_bio_remove(bsched_bws_t bws, bio_source_t *bio)
 	bs = bsched_get(bws);
 	bio_check(bio);
 
-	bs->sources = plist_remove(bs->sources, bio);
+	if (bio->flags & BIO_F_IDLE)
+		elist_remove(&bs->idle, bio);
+	else if (bio->flags & BIO_F_LISTENING)
+		elist_remove(&bs->listening, bio);
+
+	bio->flags &= ~(BIO_F_IDLE | BIO_F_LISTENING);
+
+	if (bio->timeslice == bs->timeslice && (bio->flags & BIO_F_USED))
+		bs->current_used--;
+
+	if (bio->flags & BIO_F_FAVOUR)
+		bs->io_favours--;
+
+	bs->bw_allocated -= bio->bw_allocated;
+
+	elist_remove(&bs->sources, bio);
 	bs->count--;
+	bsched_peer_detach(bs, bio);
 
 	if (bs->count)
 		bs->bw_slot = (bs->bw_max + bs->bw_stolen) / bs->count;
@@ -1268,9 +1902,15 @@ bsched_source_add(
 	 */
 
 	bsched_bio_add(bs, bio);
+	bsched_peer_attach(bs, bio);
+
+	if (flags & BIO_F_WRITE)
+		bio_zc_attach(bio);
 
 	if (!(bs->flags & BS_F_NOBW) && bio->io_callback)
 		bio_enable(bio);
+	else
+		bio_evlist_update(bio);
 
 	return bio;
 }
@@ -1289,6 +1929,7 @@ bsched_source_remove(bio_source_t *bio)
 		bio->bws = BSCHED_BWS_INVALID;
 	}
 	inputevt_remove(&bio->io_tag);
+	bio_zc_detach(bio);
 	bio->magic = 0;
 	WFREE(bio);
 }
@@ -1337,6 +1978,73 @@ bsched_set_bandwidth(bsched_bws_t bws, int64 bandwidth)
 }
 
 
+/**
+ * Compute the bandwidth available for a source from the token buckets.
+ *
+ * The source can use the tokens of its host class, which gets a fair share
+ * of its network class, which itself gets a fair share of the scheduler
+ * root class.  Tokens left unclaimed at a level can be borrowed by the
+ * classes below it.  Favoured sources, and those which are not attached to
+ * a peer, draw directly from the root class.
+ *
+ * @param bs	the scheduler of the source
+ * @param bio	the source
+ * @param len	amount of bytes requested by the application
+ * @param used	whether the source was already used this period
+ *
+ * @return the amount of bytes the source can use.
+ */
+static int64
+bw_available_htb(bsched_t *bs, bio_source_t *bio, int len, bool used)
+{
+	int64 available, result;
+
+	/*
+	 * Not all the traffic goes through the token buckets: UDP traffic and
+	 * the TCP overhead are only accounted for at the scheduler level.
+	 */
+
+	available = bs->bw_max + bs->bw_stolen - bs->bw_actual;
+
+	if (available <= 0) {
+		bsched_no_more_bandwidth(bs);
+		return 0;
+	}
+
+	if (used && (bs->flags & BS_F_UNIFORM_BW))
+		return 0;
+
+	if ((bio->flags & BIO_F_FAVOUR) || NULL == bio->peer)
+		result = htb_available(bs->htb, len);
+	else
+		result = htb_available(bio->peer->class, len);
+
+	if (0 != bio->bw_allocated)
+		result = MAX(result, MIN(bio->bw_allocated, len));
+
+	result = MIN(result, available);
+
+	if (GNET_PROPERTY(bsched_debug) > 8) {
+		g_debug("BSCHED %s: \"%s\" [fd #%d] len=%d, avail=%s => %s",
+			G_STRFUNC, bs->name, bio->wio->fd(bio->wio), len,
+			int64_to_string(available), int64_to_string2(result));
+	}
+
+	/*
+	 * When the source has exhausted what it could get, disable it until the
+	 * next period, when bsched_begin_timeslice() will re-enable it.
+	 */
+
+	if (0 == result) {
+		if (htb_tokens(bs->htb) <= 0)
+			bsched_no_more_bandwidth(bs);
+		else if (bio->io_tag != 0 && !(bio->flags & BIO_F_PASSIVE))
+			bio_disable(bio);
+	}
+
+	return result;
+}
+
 /**
  * @param `bio' no brief description.
  * @param `len' is the amount of bytes requested by the application.
@@ -1358,6 +2066,7 @@ bw_available(bio_source_t *bio, int len)
 	wrap_io_check(bio->wio);	/* Make sure socket still allocated */
 
 	bs = bsched_get(bio->bws);
+	bio_timeslice_sync(bio, bs);
 
 	if (!(bs->flags & BS_F_ENABLED))		/* Scheduler disabled */
 		return len;							/* Use amount requested */
@@ -1385,10 +2094,10 @@ bw_available(bio_source_t *bio, int len)
 	 * The BIO_F_USED flag is set only once during a period, and is used
 	 * to identify sources that already triggered.
 	 *
-	 * The BIO_F_ACTIVE flag is used to mark a source as being used as well,
-	 * but can be cleared during a period, when we redistribute bandwidth
-	 * among the slots.  So the flag is set when the source was already
-	 * used since we recomputed the bandwidth per slot.
+	 * The activation generation is used to mark a source as being used as
+	 * well, but a new generation can start during a period, when we
+	 * redistribute bandwidth among the slots.  So the source is active when
+	 * it was already used since we recomputed the bandwidth per slot.
 	 *
 	 * The BIO_F_FAVOUR flag marks sources we want to favour during b/w
 	 * distribution: they are allowed to use all the available bandwidth
@@ -1396,7 +2105,7 @@ bw_available(bio_source_t *bio, int len)
 	 */
 
 	used = bio->flags & BIO_F_USED;
-	active = bio->flags & BIO_F_ACTIVE;
+	active = bio->active_gen == bs->active_gen;
 	favoured = bio->flags & BIO_F_FAVOUR;
 
 	if (!used) {
@@ -1404,7 +2113,7 @@ bw_available(bio_source_t *bio, int len)
 		bio->flags |= BIO_F_USED;
 	}
 
-	bio->flags |= BIO_F_ACTIVE;
+	bio->active_gen = bs->active_gen;
 
 	/*
 	 * Set the `looped' flag the first time when we encounter a source that
@@ -1416,6 +2125,11 @@ bw_available(bio_source_t *bio, int len)
 	if (!bs->looped && used)
 		bs->looped = TRUE;
 
+	if (GNET_PROPERTY(bsched_htb)) {
+		result = bw_available_htb(bs, bio, len, used);
+		goto done;
+	}
+
 	/*
 	 * If source was already active, recompute the per-slot value since
 	 * we already looped once through all the sources.  This prevents the
@@ -1615,6 +2329,7 @@ bw_available(bio_source_t *bio, int len)
 	 * enough" during the period.
 	 */
 
+done:
 	if (result < len)
 		bs->bw_capped += len - result;
 
@@ -1674,13 +2389,69 @@ bsched_bw_update(bsched_t *bs, ssize_t used, size_t requested)
 		bsched_no_more_bandwidth(bs);
 }
 
+/**
+ * Set the bandwidth credit allocated to source, keeping track of the total
+ * credit allocated in its scheduler.
+ */
+static void
+bio_set_allocated(bio_source_t *bio, int64 amount)
+{
+	if (BSCHED_BWS_INVALID != bio->bws)
+		bsched_get(bio->bws)->bw_allocated += amount - bio->bw_allocated;
+
+	bio->bw_allocated = amount;
+}
+
 static inline ALWAYS_INLINE void
 bio_bw_update(bio_source_t *bio, ssize_t used)
 {
+	bsched_t *bs = NULL;
+
+	if (BSCHED_BWS_INVALID != bio->bws) {
+		bs = bsched_get(bio->bws);
+		bio_timeslice_sync(bio, bs);
+	}
+
 	bio->bw_actual += used;
 
-	if G_UNLIKELY(0 != bio->bw_allocated)
-		bio->bw_allocated -= MIN(bio->bw_allocated, used);
+	if (bio->peer != NULL)
+		htb_consume(bio->peer->class, used);
+	else if (bs != NULL)
+		htb_consume(bs->htb, used);
+
+	if G_UNLIKELY(0 != bio->bw_allocated) {
+		bio_set_allocated(bio,
+			bio->bw_allocated - MIN(bio->bw_allocated, used));
+	}
+}
+
+/**
+ * @return the bandwidth used by source during the last timeslice, in bytes
+ * per second.
+ */
+int64
+bio_bps(bio_source_t *bio)
+{
+	bio_check(bio);
+
+	if (BSCHED_BWS_INVALID != bio->bws)
+		bio_timeslice_sync(bio, bsched_get(bio->bws));
+
+	return bio->bw_last_bps;
+}
+
+/**
+ * @return the average bandwidth used by source, in bytes per second.
+ */
+int64
+bio_avg_bps(bio_source_t *bio)
+{
+	bio_check(bio);
+
+	if (BSCHED_BWS_INVALID != bio->bws)
+		bio_timeslice_sync(bio, bsched_get(bio->bws));
+
+	return bio->bw_slow_ema >> BIO_EMA_SHIFT;
 }
 
 /**
@@ -1699,11 +2470,20 @@ bio_set_favour(bio_source_t *bio, bool on)
 
 	if (on) {
 		bio->flags |= BIO_F_FAVOUR;
-		bio->bw_allocated = 0;
+		bio_set_allocated(bio, 0);
 	} else {
 		bio->flags &= ~BIO_F_FAVOUR;
 	}
 
+	if (old != on && BSCHED_BWS_INVALID != bio->bws) {
+		bsched_t *bs = bsched_get(bio->bws);
+
+		if (on)
+			bs->io_favours++;
+		else
+			bs->io_favours--;
+	}
+
 	return old;
 }
 
@@ -1717,7 +2497,7 @@ bio_add_allocated(bio_source_t *bio, unsigned bw)
 {
 	bio_check(bio);
 
-	bio->bw_allocated = uint_saturate_add(bio->bw_allocated, bw);
+	bio_set_allocated(bio, uint_saturate_add(bio->bw_allocated, bw));
 
 	return bio->bw_allocated;
 }
@@ -1904,6 +2684,104 @@ bio_writev(bio_source_t *bio, iovec_t *iov, int iovcnt)
 	return r;
 }
 
+/**
+ * Write at most `len' bytes from `data' to source's fd, as bandwidth permits,
+ * transmitting directly from the buffer when the amount is large enough.
+ *
+ * The data must lie within the `db' buffer, on which a reference is kept
+ * until the kernel has sent the data out when zero-copy is used.  Callers
+ * must not modify the buffer while it is referenced elsewhere: when they
+ * need to refill it and its reference count is not 1, they must use a new
+ * buffer.
+ *
+ * Zero-copy can only be used when writes on the source go straight to the
+ * socket, i.e. not through a TLS layer.
+ *
+ * If we cannot write anything due to bandwidth constraints, return -1 with
+ * errno set to EAGAIN.
+ */
+ssize_t
+bio_write_zerocopy(bio_source_t *bio, pdata_t *db, const void *data,
+	size_t len)
+{
+#ifdef USE_ZEROCOPY
+	size_t available, amount, min;
+	ssize_t r;
+	struct bio_zc_pin *pin;
+
+	bio_check(bio);
+	pdata_check(db);
+	g_assert(bio->flags & BIO_F_WRITE);
+	g_assert(ptr_diff(data, pdata_start(db)) + len <= pdata_len(db));
+
+	min = GNET_PROPERTY(zerocopy_min_size);
+
+	if (0 == min || len < min || !bio_zc_setup(bio))
+		return bio_write(bio, data, len);
+
+	available = bw_available(bio, len);
+
+	if (available == 0) {
+		errno = VAL_EAGAIN;
+		return -1;
+	}
+
+	amount = len > available ? available : len;
+
+	if (GNET_PROPERTY(bsched_debug) > 7)
+		g_debug("BSCHED %s(wio=%d, len=%zu) available=%zu",
+			G_STRFUNC, bio->wio->fd(bio->wio), len, available);
+
+	/*
+	 * Collect completions before sending, to release buffers as early as
+	 * possible.  Small amounts are not worth the page pinning overhead.
+	 * When the kernel cannot pin more memory for this socket, it returns
+	 * ENOBUFS and we fall back to a regular copying write.
+	 */
+
+	bio_zc_reap(bio->zc, bio->wio->fd(bio->wio));
+
+	if (amount < min) {
+		r = bio->wio->write(bio->wio, data, amount);
+	} else {
+		r = send(bio->wio->fd(bio->wio), data, amount, MSG_ZEROCOPY);
+		if ((ssize_t) -1 == r && ENOBUFS == errno) {
+			r = bio->wio->write(bio->wio, data, amount);
+		} else if (r >= 0) {
+			/*
+			 * Each successful zero-copy send() consumes a sequence number,
+			 * even when nothing was written.
+			 */
+
+			WALLOC0(pin);
+			pin->seq = bio->zc->next++;
+			pin->len = r;
+			pin->db = db;
+			pdata_addref(db);
+			eslist_append(&bio->zc->pending, pin);
+			bio_zc_pinned++;
+			gnet_stats_set_general(GNR_ZEROCOPY_PINNED_BUFFERS, bio_zc_pinned);
+		}
+	}
+
+	if ((ssize_t) -1 == r && 0 == errno) {
+		g_warning("wio->write(fd=%d, len=%zu) returned -1 with errno = 0, "
+			"assuming EAGAIN", bio->wio->fd(bio->wio), len);
+		errno = VAL_EAGAIN;
+	}
+
+	if (r > 0) {
+		bsched_bw_update(bsched_get(bio->bws), r, amount);
+		bio_bw_update(bio, r);
+	}
+
+	return r;
+#else	/* !USE_ZEROCOPY */
+	pdata_check(db);
+	return bio_write(bio, data, len);
+#endif	/* USE_ZEROCOPY */
+}
+
 /**
  * Send UDP datagram to specified destination `to'.
  *
@@ -2660,14 +3538,12 @@ bws_can_connect(enum socket_type type)
 static void
 bsched_heartbeat(bsched_t *bs, tm_t *tv)
 {
-	plist_t *iter;
 	int delay;
 	int64 overused;
 	int64 theoric;
 	int64 correction;
 	int64 last_bw_max;
 	int64 last_capped;
-	int64 last_used;
 	time_delta_t elapsed;
 
 	bsched_check(bs);
@@ -2802,22 +3678,14 @@ bsched_heartbeat(bsched_t *bs, tm_t *tv)
 	 * bandwidth per slot that triggers in case we don't have the opportunity
 	 * to loop through all the sources more than once before the end of
 	 * the slot.
+	 *
+	 * Sources used this period that were since removed are no longer
+	 * accounted for in bs->current_used.
 	 */
 
-	last_used = 0;
-
-	PLIST_FOREACH(bs->sources, iter) {
-		bio_source_t *bio = iter->data;
-
-		bio_check(bio);
-
-		if (bio->flags & BIO_F_USED)
-			last_used++;
-	}
-
-	g_assert(last_used <= bs->current_used);	/* May have removed a source */
+	g_assert(bs->current_used <= bs->count);
 
-	bs->last_used = last_used;
+	bs->last_used = bs->current_used;
 
 	if (GNET_PROPERTY(bsched_debug) > 4) {
 		g_debug("BSCHED %s(%s): delay=%d (EMA=%s), b/w=%s (EMA=%s), "
@@ -2916,11 +3784,11 @@ bsched_stealbeat(bsched_t *bs)
 
 	if (bs->flags & BS_F_WRITE) {
 		int half_contribution = bs->count ? bs->bw_max / (2 * bs->count) : 0;
-		plist_t *bl;
-
-		for (bl = bs->sources; bl && underused > 0; bl = plist_next(bl)) {
-			bio_source_t *bio = (bio_source_t *) bl->data;
+		bio_source_t *bio;
 
+		ELIST_FOREACH_DATA(&bs->sources, bio) {
+			if (underused <= 0)
+				break;
 			if (bio->io_callback != NULL && !(bio->flags & BIO_F_USED))
 				underused -= half_contribution;
 		}
@@ -43,6 +43,8 @@
 #include "if/core/bsched.h"
 #include "if/core/sockets.h"
 
+struct pdata;
+
 typedef struct sendfile_ctx {
 	void *map;
 	fileoffset_t map_start, map_end;
@@ -75,6 +77,11 @@ bool bio_set_favour(bio_source_t *bio, bool on);
 unsigned bio_add_allocated(bio_source_t *bio, unsigned bw);
 ssize_t bio_write(bio_source_t *bio, const void *data, size_t len);
 ssize_t bio_writev(bio_source_t *bio, iovec_t *iov, int iovcnt);
+ssize_t bio_write_zerocopy(bio_source_t *bio, struct pdata *db,
+	const void *data, size_t len);
+bool bio_zerocopy_enabled(const wrap_io_t *wio);
+bool bio_zerocopy_exception(wrap_io_t *wio);
+void bio_zerocopy_close(wrap_io_t *wio);
 ssize_t bio_sendto(bio_source_t *bio, const gnet_host_t *to,
 	const void *data, size_t len);
 ssize_t bio_sendfile(sendfile_ctx_t *ctx, bio_source_t *bio, int in_fd,
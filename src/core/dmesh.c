@@ -58,8 +58,11 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/bstr.h"
 #include "lib/concat.h"
 #include "lib/cq.h"
+#include "lib/dbmw.h"
+#include "lib/dbstore.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/file.h"
@@ -72,9 +75,12 @@
 #include "lib/hstrfn.h"
 #include "lib/htable.h"
 #include "lib/parse.h"
+#include "lib/path.h"
+#include "lib/pmsg.h"
 #include "lib/pslist.h"
 #include "lib/shuffle.h"
 #include "lib/str.h"
+#include "lib/stringify.h"
 #include "lib/strtok.h"
 #include "lib/timestamp.h"
 #include "lib/tm.h"
@@ -94,12 +100,42 @@ dmesh_url_error_t dmesh_url_errno;	/**< Error from dmesh_url_parse() */
  */
 static hikset_t *mesh = NULL;
 
-struct dmesh {				/**< A download mesh bucket */
-	list_t *entries;		/**< The download mesh entries, dmesh_entry data */
-	htable_t *by_host;		/**< Entries indexed by host (IP:port) */
-	htable_t *by_guid;		/**< Entries indexed by GUID (firewalled entries) */
+#define MAX_LIFETIME	43200		/**< half a day */
+#define MAX_LIBLIFETIME	3600		/**< 1 hour for shared/seeded files */
+#define MAX_ENTRIES		256			/**< Max amount of entries kept per SHA1 */
+
+#define MIN_BAD_REPORT	3			/**< Don't ban before that many X-Nalt */
+
+/**
+ * A download mesh bucket.
+ *
+ * Entries are kept packed in an array, by order of insertion, so that the
+ * oldest entry is always the first one.  To be able to quickly locate an
+ * entry by host (IP:port) or by GUID for firewalled entries, we also keep
+ * a sorted index of entry positions, where all the regular entries come
+ * before the firewalled ones.
+ *
+ * Since there are at most MAX_ENTRIES per bucket, positions fit in a byte.
+ *
+ * Buckets are persisted in a database and loaded on demand: the `dirty'
+ * flag records whether the bucket was modified since it was last written.
+ */
+struct dmesh {
+	const sha1_t *sha1;		/**< The SHA1 of this mesh (embedded key) */
+	struct dmesh_entry *entries;	/**< Packed entries, oldest first */
+	uint8 *index;			/**< Entry positions, sorted by host or GUID */
 	time_t last_update;		/**< Timestamp of last insert/expire in the mesh */
-	const sha1_t *sha1;		/**< The SHA1 of this mesh */
+	uint16 count;			/**< Amount of entries */
+	uint16 capacity;		/**< Amount of entries allocated */
+	uint8 dirty;			/**< Whether bucket needs to be persisted */
+};
+
+/**
+ * Networks which reported an entry as bad, allocated on the first report.
+ */
+struct dmesh_bad {
+	host_addr_t net[MIN_BAD_REPORT - 1];	/**< Reporting networks */
+	uint8 count;							/**< Amount of reports */
 };
 
 struct dmesh_entry {
@@ -109,25 +145,60 @@ struct dmesh_entry {
 		dmesh_urlinfo_t url;	/**< URL info */
 		dmesh_fwinfo_t fwh;		/**< Firewalled host */
 	} e;
-	hash_list_t *bad;		/**< Keeps track of IPs reporting entry as bad */
+	struct dmesh_bad *bad;	/**< Keeps track of nets reporting entry as bad */
 	uint8 good;				/**< Whether marked as being a good entry */
 	uint8 fw_entry;			/**< Whether entry is that of a firewalled host */
 };
 
-#define MAX_LIFETIME	43200		/**< half a day */
-#define MAX_LIBLIFETIME	3600		/**< 1 hour for shared/seeded files */
-#define MAX_ENTRIES		256			/**< Max amount of entries kept per SHA1 */
-
-#define MIN_BAD_REPORT	3			/**< Don't ban before that many X-Nalt */
+#define DM_MIN_CAPACITY	4			/**< Initial amount of entries allocated */
 #define DMESH_CALLOUT	5000		/**< Callout heartbeat every 5 seconds */
 #define DMESH_BAN_VETO	300			/**< 5 minutes, to keep banned entry */
 #define EXPIRE_DELAY	600			/**< 10 minutes after last update */
 
 #define FW_MAX_PROXIES	4			/**< At most 4 push-proxies */
 
-static const char dmesh_file[] = "dmesh";
+static const char dmesh_file[] = "dmesh";	/**< Legacy text persistence */
 static cqueue_t *dmesh_cq;			/**< Download mesh callout queue */
 
+/**
+ * DBM wrapper to persist the mesh buckets, keyed by SHA1.
+ */
+static dbmw_t *db_dmesh;
+static char db_dmesh_base[] = "download_mesh";
+static char db_dmesh_what[] = "Download mesh";
+
+#define DMESH_DB_VERSION	0
+#define DMESH_DB_NAMELEN	255		/**< Longer names are not persisted */
+#define DMESH_DB_CACHE		0		/**< No write-back cache */
+#define DMESH_PRUNE_PERIOD	(3600 * 1000)	/**< 1 hour, in ms */
+#define DMESH_EVICT_DELAY	3600	/**< Unload clean buckets after 1 hour */
+
+#define DMESH_DB_F_FW		(1U << 0)	/**< Firewalled entry */
+#define DMESH_DB_F_GOOD		(1U << 1)	/**< Entry flagged as good */
+
+/*
+ * Maximum size of a serialized entry: flags, two timestamps, then for URL
+ * entries the address, port, index and name (the largest variant, since
+ * firewalled entries have a GUID and at most FW_MAX_PROXIES hosts).
+ */
+#define DMESH_DB_ENTRY_SIZE	(1 + 4 + 4 + 17 + 2 + 4 + 10 + DMESH_DB_NAMELEN)
+
+/**
+ * A download mesh bucket, as persisted in the database.
+ * The structure is serialized first, not written as-is.
+ *
+ * When written, the entries are those of the in-core bucket and are not
+ * owned by the structure.  When read, the entries are allocated and are
+ * taken over by the bucket we load.
+ */
+struct dmesh_dbdata {
+	struct dmesh_entry *entries;	/**< Entries of the bucket */
+	uint16 count;					/**< Amount of entries */
+	bool owned;						/**< Whether entries were allocated */
+};
+
+static cperiodic_t *dmesh_prune_ev;
+
 /**
  * If we get a "bad" URL into the mesh ("bad" = gives 404 or other error when
  * trying to download it), we must remember it for some time and prevent it
@@ -163,6 +234,8 @@ static htable_t *ban_mesh_by_sha1 = NULL;
 
 static const char dmesh_ban_file[] = "dmesh_ban";
 
+static void dmesh_db_open(void);
+static void dmesh_dispose(const struct sha1 *sha1);
 static void dmesh_retrieve(void);
 static void dmesh_ban_retrieve(void);
 static char *dmesh_urlinfo_to_string(const dmesh_urlinfo_t *info);
@@ -210,15 +283,16 @@ dmesh_init(void)
 		urlinfo_hash, urlinfo_eq);
 	ban_mesh_by_sha1 = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
 	dmesh_cq = cq_main_submake("dmesh", DMESH_CALLOUT);
+	dmesh_db_open();
 	dmesh_retrieve();
 	dmesh_ban_retrieve();
 }
 
 /**
- * Free download mesh entry.
+ * Free data held by download mesh entry.
  */
 static void
-dmesh_entry_free(struct dmesh_entry *dme)
+dmesh_entry_clear(struct dmesh_entry *dme)
 {
 	g_assert(dme);
 
@@ -229,8 +303,7 @@ dmesh_entry_free(struct dmesh_entry *dme)
 		if (dme->e.url.name)
 			atom_str_free(dme->e.url.name);
 	}
-	hash_list_free_all(&dme->bad, wfree_host_addr1);
-	WFREE(dme);
+	WFREE_NULL(dme->bad, sizeof *dme->bad);
 }
 
 /**
@@ -585,13 +658,8 @@ dm_alloc(const struct sha1 *sha1)
 {
 	struct dmesh *dm;
 
-	WALLOC(dm);
-	dm->last_update = 0;
-	dm->entries = list_new();
+	WALLOC0(dm);
 	dm->sha1 = atom_sha1_get(sha1);
-	dm->by_host = htable_create_any(packed_host_hash_func,
-		packed_host_hash_func2, packed_host_eq_func);
-	dm->by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 
 	return dm;
 }
@@ -602,37 +670,161 @@ dm_alloc(const struct sha1 *sha1)
 static void
 dm_free(struct dmesh *dm)
 {
-	list_free_all(&dm->entries,
-		cast_to_list_destroy((func_ptr_t) dmesh_entry_free));
-
-	/*
-	 * Values in the dme->by_host table were the dmesh_entry structures
-	 * we just disposed of above, so we only need to get rid of the keys.
-	 */
-
-	htable_foreach_key(dm->by_host, wfree_packed_host, NULL);
-	htable_free_null(&dm->by_host);
+	uint i;
 
-	/* Keys were GUID in the dmesh_entry, no need to free them */
-	htable_free_null(&dm->by_guid);
+	for (i = 0; i < dm->count; i++)
+		dmesh_entry_clear(&dm->entries[i]);
 
+	WFREE_ARRAY_NULL(dm->entries, dm->capacity);
+	WFREE_ARRAY_NULL(dm->index, dm->capacity);
 	atom_sha1_free_null(&dm->sha1);
 	WFREE(dm);
 }
 
+/**
+ * Compare two entries for the purpose of sorting the index.
+ *
+ * Regular entries are sorted by address and port, firewalled ones by GUID,
+ * and all the regular entries come before the firewalled ones.
+ */
+static int
+dm_entry_cmp(const struct dmesh_entry *a, const struct dmesh_entry *b)
+{
+	int r;
+
+	r = CMP(a->fw_entry, b->fw_entry);
+	if (0 != r)
+		return r;
+
+	if (a->fw_entry)
+		return memcmp(a->e.fwh.guid, b->e.fwh.guid, GUID_RAW_SIZE);
+
+	r = CMP(host_addr_net(a->e.url.addr), host_addr_net(b->e.url.addr));
+	if (0 == r)
+		r = host_addr_cmp(a->e.url.addr, b->e.url.addr);
+
+	return 0 != r ? r : CMP(a->e.url.port, b->e.url.port);
+}
+
+/**
+ * Look in the index for the entry matching the key.
+ *
+ * @param dm		the mesh bucket
+ * @param key		the entry we're looking for (only keys are filled)
+ * @param slot		if non-NULL, written with the index slot of the entry,
+ *					or where it should be inserted if not found
+ *
+ * @return the entry found, NULL if none matches.
+ */
+static struct dmesh_entry *
+dm_index_lookup(const struct dmesh *dm,
+	const struct dmesh_entry *key, uint *slot)
+{
+	uint lo = 0, hi = dm->count;
+
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+		struct dmesh_entry *dme = &dm->entries[dm->index[mid]];
+		int c = dm_entry_cmp(key, dme);
+
+		if (0 == c) {
+			if (slot != NULL)
+				*slot = mid;
+			return dme;
+		} else if (c < 0) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+
+	if (slot != NULL)
+		*slot = lo;
+
+	return NULL;
+}
+
+/**
+ * Lookup regular entry by host.
+ */
+static struct dmesh_entry *
+dm_lookup_host(const struct dmesh *dm, const host_addr_t addr, uint16 port)
+{
+	struct dmesh_entry key;
+
+	key.fw_entry = FALSE;
+	key.e.url.addr = addr;
+	key.e.url.port = port;
+
+	return dm_index_lookup(dm, &key, NULL);
+}
+
+/**
+ * Lookup firewalled entry by GUID.
+ */
+static struct dmesh_entry *
+dm_lookup_guid(const struct dmesh *dm, const struct guid *guid)
+{
+	struct dmesh_entry key;
+
+	key.fw_entry = TRUE;
+	key.e.fwh.guid = guid;
+
+	return dm_index_lookup(dm, &key, NULL);
+}
+
+/**
+ * Append new entry to the mesh bucket.
+ *
+ * The entry is copied into the bucket and its data are now owned by the
+ * bucket.  There must not be any entry with the same key already.
+ *
+ * @return the entry within the bucket.
+ */
+static struct dmesh_entry *
+dm_append(struct dmesh *dm, const struct dmesh_entry *entry)
+{
+	uint slot;
+	struct dmesh_entry *dme;
+
+	g_assert(dm->count < MAX_ENTRIES);
+
+	dme = dm_index_lookup(dm, entry, &slot);
+	g_assert(NULL == dme);
+
+	if (dm->count == dm->capacity) {
+		uint n = 0 == dm->capacity ? DM_MIN_CAPACITY : 2 * dm->capacity;
+
+		n = MIN(n, MAX_ENTRIES);
+		WREALLOC_ARRAY(dm->entries, dm->capacity, n);
+		WREALLOC_ARRAY(dm->index, dm->capacity, n);
+		dm->capacity = n;
+	}
+
+	g_assert(dm->count < dm->capacity);
+
+	dme = &dm->entries[dm->count];
+	*dme = *entry;
+
+	memmove(&dm->index[slot + 1], &dm->index[slot],
+		(dm->count - slot) * sizeof dm->index[0]);
+	dm->index[slot] = dm->count++;
+
+	return dme;
+}
+
 /**
  * Remove specified entry from mesh bucket and reclaim it.
  */
 static void
 dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 {
-	struct packed_host packed;
-	const void *key;
-	void *value;
-	bool found;
+	uint slot, pos, i;
+	struct dmesh_entry *found;
 
 	g_assert(dm);
-	g_assert(list_length(dm->entries) > 0);
+	g_assert(dm->count > 0);
+	g_assert(dme >= dm->entries && dme < &dm->entries[dm->count]);
 
 	if (GNET_PROPERTY(dmesh_debug) > 1) {
 		g_debug("dmesh %sentry removed for urn:sha1:%s at %s",
@@ -642,32 +834,30 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 				host_addr_port_to_string(dme->e.url.addr, dme->e.url.port));
 	}
 
-	if (dme->fw_entry) {
-		found = htable_lookup_extended(dm->by_guid,
-					dme->e.fwh.guid, &key, &value);
-	} else {
-		packed = host_pack(dme->e.url.addr, dme->e.url.port);
-		found = htable_lookup_extended(dm->by_host,
-					&packed, &key, &value);
-	}
+	found = dm_index_lookup(dm, dme, &slot);
 
-	g_assert(found);
-	g_assert(value == (void *) dme);
+	g_assert(found == dme);
 
-	found = list_remove(dm->entries, dme);		/* Remove from list... */
+	/*
+	 * Remove from the index, then from the entry array, shifting down
+	 * the positions of all the entries that were after the removed one.
+	 */
 
-	g_assert(found);
+	pos = dme - dm->entries;
+	dmesh_entry_clear(dme);
 
-	/* ...and from the proper hash table */
+	dm->count--;
+	memmove(&dm->index[slot], &dm->index[slot + 1],
+		(dm->count - slot) * sizeof dm->index[0]);
+	memmove(&dm->entries[pos], &dm->entries[pos + 1],
+		(dm->count - pos) * sizeof dm->entries[0]);
 
-	if (dme->fw_entry) {
-		htable_remove(dm->by_guid, dme->e.fwh.guid);
-	} else {
-		htable_remove(dm->by_host, &packed);
-		wfree_packed_host(deconstify_pointer(key), NULL);
+	for (i = 0; i < dm->count; i++) {
+		if (dm->index[i] > pos)
+			dm->index[i]--;
 	}
 
-	dmesh_entry_free(dme);
+	dm->dirty = TRUE;
 }
 
 /**
@@ -676,35 +866,18 @@ dm_remove_entry(struct dmesh *dm, struct dmesh_entry *dme)
 static void
 dm_remove(struct dmesh *dm, const host_addr_t addr, uint16 port)
 {
-	struct packed_host packed;
 	struct dmesh_entry *dme;
-	const void *key;
-	void *value;
-	bool found;
 
 	g_assert(dm);
 
-	packed = host_pack(addr, port);
-	found = htable_lookup_extended(dm->by_host, &packed, &key, &value);
+	dme = dm_lookup_host(dm, addr, port);
 
-	if (!found)
+	if (NULL == dme)
 		return;
 
-	if (GNET_PROPERTY(dmesh_debug) > 1) {
-		g_debug("dmesh entry removed for urn:sha1:%s at %s",
-			sha1_base32(dm->sha1), host_addr_port_to_string(addr, port));
-	}
-
-	dme = value;
-	found = list_remove(dm->entries, dme);		/* Remove from list */
-
-	g_assert(found);
 	g_assert(!dme->fw_entry);
 
-	htable_remove(dm->by_host, &packed);	/* And from hash table */
-	wfree_packed_host(deconstify_pointer(key), NULL);
-
-	dmesh_entry_free(dme);
+	dm_remove_entry(dm, dme);
 }
 
 /**
@@ -745,51 +918,508 @@ dm_lifetime(const struct dmesh *dm)
 static void
 dm_expire(struct dmesh *dm)
 {
-	pslist_t *expired = NULL;
-	pslist_t *sl;
+	uint16 remap[MAX_ENTRIES];
 	time_t now = tm_time();
 	long agemax;
-	list_iter_t *iter;
+	uint i, j, n;
 
 	agemax = dm_lifetime(dm);
 
-	iter = list_iter_before_head(dm->entries);
+	/*
+	 * Compact the entries, skipping expired ones, and remember where each
+	 * kept entry moved to so that we can fix the index afterwards.
+	 */
+
+	for (i = j = 0; i < dm->count; i++) {
+		struct dmesh_entry *dme = &dm->entries[i];
+
+		if (delta_time(now, dme->stamp) > agemax) {
+			/*
+			 * Remove the entry.
+			 *
+			 * XXX instead of removing, maybe we can schedule a HEAD refresh
+			 * XXX to see whether the entry is still valid?
+			 */
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+			if (GNET_PROPERTY(dmesh_debug) > 4)
+				g_debug("MESH %s: EXPIRED \"%s\", age=%u",
+					sha1_base32(dm->sha1),
+					dme->fw_entry ?
+						dmesh_fwinfo_to_string(&dme->e.fwh) :
+						dmesh_urlinfo_to_string(&dme->e.url),
+					(unsigned) delta_time(now, dme->stamp));
 
-		if (delta_time(now, dme->stamp) <= agemax)
+			dmesh_entry_clear(dme);
+			remap[i] = MAX_ENTRIES;		/* Entry removed */
 			continue;
+		}
 
-		/*
-		 * Remove the entry.
-		 *
-		 * XXX instead of removing, maybe we can schedule a HEAD refresh
-		 * XXX to see whether the entry is still valid?
-		 */
+		remap[i] = j;
+		if (i != j)
+			dm->entries[j] = *dme;
+		j++;
+	}
 
-		if (GNET_PROPERTY(dmesh_debug) > 4)
-			g_debug("MESH %s: EXPIRED \"%s\", age=%u",
-				sha1_base32(dm->sha1),
-				dme->fw_entry ?
-					dmesh_fwinfo_to_string(&dme->e.fwh) :
-					dmesh_urlinfo_to_string(&dme->e.url),
-				(unsigned) delta_time(now, dme->stamp));
+	/*
+	 * The index order is not changed by removals: drop the expired entries
+	 * and translate the positions of the kept ones.
+	 */
 
-		expired = pslist_prepend(expired, dme);
+	if (j != dm->count) {
+		for (i = n = 0; i < dm->count; i++) {
+			uint16 pos = remap[dm->index[i]];
+
+			if (pos != MAX_ENTRIES)
+				dm->index[n++] = pos;
+		}
+
+		g_assert(n == j);
+		dm->count = j;
+		dm->dirty = TRUE;
 	}
 
-	list_iter_free(&iter);
+	dm->last_update = tm_time();
+}
+
+/**
+ * Can entry be persisted?
+ *
+ * URL entries with very long names are not persisted, to bound the size
+ * of the serialized buckets.
+ */
+static bool
+dm_db_storable(const struct dmesh_entry *dme)
+{
+	if (dme->fw_entry || URN_INDEX == dme->e.url.idx)
+		return TRUE;
+
+	return vstrlen(dme->e.url.name) <= DMESH_DB_NAMELEN;
+}
 
-	PSLIST_FOREACH(expired, sl) {
-		struct dmesh_entry *dme = sl->data;
+/**
+ * Collect the push-proxies of a firewalled entry that can be persisted.
+ *
+ * @return the amount of hosts filled in `hv'.
+ */
+static uint
+dm_db_proxies(const struct dmesh_entry *dme,
+	const gnet_host_t *hv[FW_MAX_PROXIES])
+{
+	hash_list_iter_t *iter;
+	uint n = 0;
 
-		dm_remove_entry(dm, dme);
+	if (NULL == dme->e.fwh.proxies)
+		return 0;
+
+	iter = hash_list_iterator(dme->e.fwh.proxies);
+
+	while (hash_list_iter_has_next(iter) && n < FW_MAX_PROXIES) {
+		const gnet_host_t *host = hash_list_iter_next(iter);
+		host_addr_t addr = gnet_host_get_addr(host);
+
+		if (host_addr_is_ipv4(addr) || host_addr_is_ipv6(addr))
+			hv[n++] = host;
 	}
 
-	pslist_free(expired);
+	hash_list_iter_release(&iter);
+
+	return n;
+}
 
-	dm->last_update = tm_time();
+/**
+ * Serialization routine for a mesh bucket.
+ */
+static void
+serialize_dmesh(pmsg_t *mb, const void *data)
+{
+	const struct dmesh_dbdata *dd = data;
+	uint i, n;
+
+	for (i = n = 0; i < dd->count; i++) {
+		if (dm_db_storable(&dd->entries[i]))
+			n++;
+	}
+
+	pmsg_write_u8(mb, DMESH_DB_VERSION);
+	pmsg_write_be16(mb, n);
+
+	for (i = 0; i < dd->count; i++) {
+		const struct dmesh_entry *dme = &dd->entries[i];
+		uint8 flags = 0;
+
+		if (!dm_db_storable(dme))
+			continue;
+
+		if (dme->fw_entry)
+			flags |= DMESH_DB_F_FW;
+		if (dme->good)
+			flags |= DMESH_DB_F_GOOD;
+
+		pmsg_write_u8(mb, flags);
+		pmsg_write_time(mb, dme->stamp);
+		pmsg_write_time(mb, dme->inserted);
+
+		if (dme->fw_entry) {
+			const gnet_host_t *hv[FW_MAX_PROXIES];
+			uint j, np = dm_db_proxies(dme, hv);
+
+			pmsg_write(mb, dme->e.fwh.guid, GUID_RAW_SIZE);
+			pmsg_write_u8(mb, np);
+
+			for (j = 0; j < np; j++) {
+				pmsg_write_ipv4_or_ipv6_addr(mb, gnet_host_get_addr(hv[j]));
+				pmsg_write_be16(mb, gnet_host_get_port(hv[j]));
+			}
+		} else {
+			pmsg_write_ipv4_or_ipv6_addr(mb, dme->e.url.addr);
+			pmsg_write_be16(mb, dme->e.url.port);
+			pmsg_write_be32(mb, dme->e.url.idx);
+
+			/* The name of URN_INDEX entries is derived from the key */
+
+			if (URN_INDEX != dme->e.url.idx)
+				pmsg_write_string(mb, dme->e.url.name, (size_t) -1);
+		}
+	}
+}
+
+/**
+ * Deserialize one mesh entry.
+ *
+ * @return TRUE if OK, FALSE on error with the entry cleared.
+ */
+static bool
+deserialize_dmesh_entry(bstr_t *bs, struct dmesh_entry *dme)
+{
+	uint8 flags;
+
+	ZERO(dme);
+
+	bstr_read_u8(bs, &flags);
+	bstr_read_time(bs, &dme->stamp);
+	bstr_read_time(bs, &dme->inserted);
+
+	dme->fw_entry = booleanize(flags & DMESH_DB_F_FW);
+	dme->good = booleanize(flags & DMESH_DB_F_GOOD);
+
+	if (dme->fw_entry) {
+		guid_t guid;
+		uint8 n;
+
+		if (!bstr_read(bs, VARLEN(guid)) || !bstr_read_u8(bs, &n))
+			goto error;
+
+		dme->e.fwh.guid = atom_guid_get(&guid);
+
+		while (n-- != 0) {
+			host_addr_t addr;
+			uint16 port;
+			gnet_host_t host;
+
+			if (
+				!bstr_read_packed_ipv4_or_ipv6_addr(bs, &addr) ||
+				!bstr_read_be16(bs, &port)
+			)
+				goto error;
+
+			if (NULL == dme->e.fwh.proxies) {
+				dme->e.fwh.proxies =
+					hash_list_new(gnet_host_hash, gnet_host_equal);
+			}
+
+			gnet_host_set(&host, addr, port);
+			if (!hash_list_contains(dme->e.fwh.proxies, &host))
+				hash_list_append(dme->e.fwh.proxies, gnet_host_dup(&host));
+		}
+	} else {
+		uint32 idx;
+
+		if (
+			!bstr_read_packed_ipv4_or_ipv6_addr(bs, &dme->e.url.addr) ||
+			!bstr_read_be16(bs, &dme->e.url.port) ||
+			!bstr_read_be32(bs, &idx)
+		)
+			goto error;
+
+		dme->e.url.idx = idx;
+
+		/* The name of URN_INDEX entries is filled when loading the bucket */
+
+		if (URN_INDEX != idx) {
+			char *name;
+
+			if (!bstr_read_string(bs, NULL, &name))
+				goto error;
+
+			dme->e.url.name = atom_str_get(name);
+			hfree(name);
+		}
+	}
+
+	return TRUE;
+
+error:
+	dmesh_entry_clear(dme);
+	return FALSE;
+}
+
+/**
+ * Deserialization routine for a mesh bucket.
+ */
+static void
+deserialize_dmesh(bstr_t *bs, void *valptr, size_t len)
+{
+	struct dmesh_dbdata *dd = valptr;
+	uint8 version;
+	uint16 n;
+	uint i;
+
+	g_assert(sizeof *dd == len);
+
+	ZERO(dd);
+	dd->owned = TRUE;
+
+	bstr_read_u8(bs, &version);
+	if (!bstr_read_be16(bs, &n) || 0 == n)
+		return;
+
+	WALLOC_ARRAY(dd->entries, n);
+
+	for (i = 0; i < n; i++) {
+		if (!deserialize_dmesh_entry(bs, &dd->entries[i]))
+			break;
+	}
+
+	/*
+	 * On errors, the value free routine is not called so we must release
+	 * the entries we got so far.
+	 */
+
+	if (i != n) {
+		uint j;
+
+		for (j = 0; j < i; j++)
+			dmesh_entry_clear(&dd->entries[j]);
+
+		WFREE_ARRAY_NULL(dd->entries, n);
+		return;
+	}
+
+	dd->count = n;
+}
+
+/**
+ * Free routine for a mesh bucket, to release internally allocated memory,
+ * not the structure itself.
+ */
+static void
+free_dmesh(void *valptr, size_t len)
+{
+	struct dmesh_dbdata *dd = valptr;
+	uint i;
+
+	g_assert(sizeof *dd == len);
+
+	if (!dd->owned)
+		return;			/* Entries belong to an in-core bucket */
+
+	for (i = 0; i < dd->count; i++)
+		dmesh_entry_clear(&dd->entries[i]);
+
+	WFREE_ARRAY_NULL(dd->entries, dd->count);
+	dd->count = 0;
+}
+
+/**
+ * Persist the mesh bucket, if modified.
+ */
+static void
+dm_write(struct dmesh *dm)
+{
+	struct dmesh_dbdata dd;
+
+	if (!dm->dirty)
+		return;
+
+	dd.entries = dm->entries;
+	dd.count = dm->count;
+	dd.owned = FALSE;
+
+	/*
+	 * Since the entries are not copied, the data must be serialized now
+	 * and not cached by the DBM wrapper.
+	 */
+
+	dbmw_write_nocache(db_dmesh, dm->sha1, VARLEN(dd));
+	dm->dirty = FALSE;
+}
+
+/**
+ * Load mesh bucket for given SHA1 from the database, if persisted.
+ *
+ * @return the bucket, inserted in the mesh, or NULL if none was found.
+ */
+static struct dmesh *
+dm_load(const struct sha1 *sha1)
+{
+	struct dmesh_dbdata *dd;
+	struct dmesh *dm;
+	uint i;
+
+	dd = dbmw_read(db_dmesh, sha1, NULL);
+
+	if (NULL == dd) {
+		if (dbmw_has_ioerr(db_dmesh)) {
+			s_warning_once_per(LOG_PERIOD_MINUTE,
+				"DBMW \"%s\" I/O error", dbmw_name(db_dmesh));
+		}
+		return NULL;
+	}
+
+	g_assert(dd->owned);
+
+	/*
+	 * Take over the deserialized entries: duplicates, which should not
+	 * happen, and entries in excess are dropped.
+	 */
+
+	dm = dm_alloc(sha1);
+
+	for (i = 0; i < dd->count; i++) {
+		struct dmesh_entry *dme = &dd->entries[i];
+
+		if (!dme->fw_entry && NULL == dme->e.url.name) {
+			dmesh_urlinfo_t info;
+
+			dmesh_fill_info(&info, sha1,
+				dme->e.url.addr, dme->e.url.port, URN_INDEX, NULL);
+			dme->e.url.name = atom_str_get(info.name);
+		}
+
+		if (
+			dm->count < MAX_ENTRIES - 1 &&
+			NULL == dm_index_lookup(dm, dme, NULL)
+		)
+			dm_append(dm, dme);
+		else
+			dmesh_entry_clear(dme);
+	}
+
+	WFREE_ARRAY_NULL(dd->entries, dd->count);
+	dd->count = 0;
+
+	hikset_insert(mesh, dm);
+
+	if (GNET_PROPERTY(dmesh_debug) > 2) {
+		g_debug("MESH %s: loaded %u entr%s",
+			sha1_base32(sha1), dm->count, plural_y(dm->count));
+	}
+
+	dm_expire(dm);
+
+	if (0 == dm->count) {
+		dmesh_dispose(sha1);
+		return NULL;
+	}
+
+	return dm;
+}
+
+/**
+ * Lookup mesh bucket for given SHA1, loading it from the database if needed.
+ *
+ * @return the bucket, NULL if we have no entries for that SHA1.
+ */
+static struct dmesh *
+dm_find(const struct sha1 *sha1)
+{
+	struct dmesh *dm;
+
+	dm = hikset_lookup(mesh, sha1);
+
+	if G_LIKELY(dm != NULL)
+		return dm;
+
+	return dm_load(sha1);
+}
+
+/**
+ * @return whether we have mesh entries for given SHA1, without loading them.
+ */
+static bool
+dm_exists(const struct sha1 *sha1)
+{
+	return hikset_contains(mesh, sha1) || dbmw_exists(db_dmesh, sha1);
+}
+
+/**
+ * DBMW foreach iterator to remove buckets whose entries are all expired.
+ */
+static bool
+dmesh_prune_expired(void *key, void *value, size_t u_len, void *u_data)
+{
+	const struct dmesh_dbdata *dd = value;
+	time_t now = tm_time();
+	uint i;
+
+	(void) u_len;
+	(void) u_data;
+
+	if (hikset_contains(mesh, key))
+		return FALSE;		/* Loaded, will be expired and written back */
+
+	for (i = 0; i < dd->count; i++) {
+		if (delta_time(now, dd->entries[i].stamp) <= MAX_LIFETIME)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Callout queue periodic event to prune expired buckets from the database.
+ */
+static bool
+dmesh_periodic_prune(void *unused_obj)
+{
+	size_t pruned;
+
+	(void) unused_obj;
+
+	pruned = dbmw_foreach_remove(db_dmesh, dmesh_prune_expired, NULL);
+
+	if (GNET_PROPERTY(dmesh_debug)) {
+		g_debug("MESH pruned %zu expired bucket%s (%zu remaining)",
+			pruned, plural(pruned), dbmw_count(db_dmesh));
+	}
+
+	return TRUE;		/* Keep calling */
+}
+
+/**
+ * Open the database holding the persisted mesh buckets.
+ */
+static void G_COLD
+dmesh_db_open(void)
+{
+	dbstore_kv_t kv = {
+		SHA1_RAW_SIZE, NULL, sizeof(struct dmesh_dbdata),
+		1 + 2 + MAX_ENTRIES * DMESH_DB_ENTRY_SIZE
+	};
+	dbstore_packing_t packing = {
+		serialize_dmesh, deserialize_dmesh, free_dmesh
+	};
+
+	g_assert(NULL == db_dmesh);
+
+	db_dmesh = dbstore_open(db_dmesh_what, settings_gnet_db_dir(),
+		db_dmesh_base, kv, packing, DMESH_DB_CACHE,
+		sha1_hash, sha1_eq, FALSE);
+
+	dbmw_set_map_wal(db_dmesh, TRUE);		/* Frequently updated database */
+
+	dmesh_prune_ev = cq_periodic_main_add(
+		DMESH_PRUNE_PERIOD, dmesh_periodic_prune, NULL);
 }
 
 /**
@@ -806,10 +1436,11 @@ dmesh_dispose(const struct sha1 *sha1)
 
 	dm = value;
 	g_assert(found);
-	g_assert(list_length(dm->entries) == 0);
+	g_assert(0 == dm->count);
 
 	hikset_remove(mesh, sha1);
 	dm_free(dm);
+	dbmw_delete(db_dmesh, sha1);
 
 	entropy_harvest_single(PTRLEN(sha1));
 }
@@ -836,7 +1467,7 @@ dmesh_remove(const struct sha1 *sha1, const host_addr_t addr, uint16 port,
 	 * Lookup SHA1 in the mesh to see if we already have entries for it.
 	 */
 
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 
 	if (dm == NULL)				/* Nothing for this SHA1 key */
 		return FALSE;
@@ -847,7 +1478,7 @@ dmesh_remove(const struct sha1 *sha1, const host_addr_t addr, uint16 port,
 	 * If there is nothing left, clear the mesh entry.
 	 */
 
-	if (list_length(dm->entries) == 0)
+	if (0 == dm->count)
 		dmesh_dispose(sha1);
 
     return TRUE;
@@ -865,7 +1496,7 @@ dmesh_count(const struct sha1 *sha1)
 
 	g_assert(sha1);
 
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 
 	/*
 	 * If we have an entry and the last update was done more than
@@ -876,13 +1507,13 @@ dmesh_count(const struct sha1 *sha1)
 	if (NULL != dm && delta_time(tm_time(), dm->last_update) > EXPIRE_DELAY) {
 		dm_expire(dm);
 
-		if (list_length(dm->entries) == 0) {
+		if (0 == dm->count) {
 			dmesh_dispose(sha1);
 			dm = NULL;
 		}
 	}
 
-	return dm ? list_length(dm->entries) : 0;
+	return dm ? dm->count : 0;
 }
 
 /**
@@ -903,7 +1534,7 @@ dmesh_get(const struct sha1 *sha1)
 	 * than the one we're trying to add).
 	 */
 
-	dm =  hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 	if (dm == NULL) {
 		dm = dm_alloc(sha1);
 		hikset_insert(mesh, dm);
@@ -911,6 +1542,8 @@ dmesh_get(const struct sha1 *sha1)
 		dm_expire(dm);
 	}
 
+	dm->dirty = TRUE;		/* Caller is about to update the bucket */
+
 	return dm;
 }
 
@@ -935,7 +1568,6 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	uint16 port = info->port;
 	uint idx = info->idx;
 	const char *name = info->name;
-	struct packed_host packed;
 	const char *reason = NULL;
 
 	g_return_val_if_fail(sha1, FALSE);
@@ -998,8 +1630,7 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme) {
 		/*
@@ -1025,43 +1656,39 @@ dmesh_raw_add(const struct sha1 *sha1, const dmesh_urlinfo_t *info,
 			g_debug("dmesh entry reused for urn:sha1:%s at %s",
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 	} else {
+		struct dmesh_entry entry;
+
 		/*
-		 * Allocate new entry.
+		 * Create new entry.
 		 */
 
-		WALLOC(dme);
-
-		dme->inserted = now;
-		dme->stamp = stamp;
-		dme->e.url.addr = addr;
-		dme->e.url.port = port;
-		dme->e.url.idx = idx;
-		dme->e.url.name = atom_str_get(name);
-		dme->bad = NULL;
-		dme->good = FALSE;
-		dme->fw_entry = FALSE;
+		entry.inserted = now;
+		entry.stamp = stamp;
+		entry.e.url.addr = addr;
+		entry.e.url.port = port;
+		entry.e.url.idx = idx;
+		entry.e.url.name = atom_str_get(name);
+		entry.bad = NULL;
+		entry.good = FALSE;
+		entry.fw_entry = FALSE;
 
 		entropy_harvest_many(name, vstrlen(name),
-			VARLEN(dme), PTRLEN(sha1), NULL);
+			VARLEN(entry), PTRLEN(sha1), NULL);
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
 			g_debug("dmesh entry created for urn:sha1:%s at %s",
 				sha1_base32(sha1), host_addr_port_to_string(addr, port));
 
 		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by host.
+		 * We insert new entries at the tail of the bucket, the oldest
+		 * entry being dropped when the bucket is full.
 		 */
 
-		list_append(dm->entries, dme);
+		dm_append(dm, &entry);
 		dm->last_update = now;
 
-		htable_insert(dm->by_host, walloc_packed_host(addr, port), dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
+		if (MAX_ENTRIES == dm->count)
+			dm_remove_entry(dm, &dm->entries[0]);
 	}
 
 	/*
@@ -1133,7 +1760,7 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 	 * See whether we knew something about this host already.
 	 */
 
-	dme = htable_lookup(dm->by_guid, info->guid);
+	dme = dm_lookup_guid(dm, info->guid);
 
 	if (dme) {
 		/*
@@ -1161,41 +1788,37 @@ dmesh_raw_fw_add(const struct sha1 *sha1, const dmesh_fwinfo_t *info,
 				sha1_base32(sha1), guid_hex_str(info->guid),
 				info->proxies ? "new" : "no new");
 	} else {
+		struct dmesh_entry entry;
+
 		/*
-		 * Allocate new entry.
+		 * Create new entry.
 		 */
 
-		WALLOC(dme);
-
-		dme->inserted = now;
-		dme->stamp = stamp;
-		dme->e.fwh.guid = atom_guid_get(info->guid);
-		dme->e.fwh.proxies = info->proxies;
-		dme->bad = NULL;
-		dme->good = FALSE;
-		dme->fw_entry = TRUE;
+		entry.inserted = now;
+		entry.stamp = stamp;
+		entry.e.fwh.guid = atom_guid_get(info->guid);
+		entry.e.fwh.proxies = info->proxies;
+		entry.bad = NULL;
+		entry.good = FALSE;
+		entry.fw_entry = TRUE;
 
 		entropy_harvest_many(PTRLEN(info->guid),
-			VARLEN(dme), PTRLEN(sha1), NULL);
+			VARLEN(entry), PTRLEN(sha1), NULL);
 
 		if (GNET_PROPERTY(dmesh_debug) > 1)
 			g_debug("dmesh entry created for urn:sha1:%s for %s",
 				sha1_base32(sha1), guid_hex_str(info->guid));
 
 		/*
-		 * We insert new entries at the tail of the list, and record them
-		 * into the hash table indexed by GUID.
+		 * We insert new entries at the tail of the bucket, the oldest
+		 * entry being dropped when the bucket is full.
 		 */
 
-		list_append(dm->entries, dme);
+		dm_append(dm, &entry);
 		dm->last_update = now;
 
-		htable_insert(dm->by_guid, dme->e.fwh.guid, dme);
-
-		if (list_length(dm->entries) == MAX_ENTRIES) {
-			struct dmesh_entry *oldest = list_head(dm->entries);
-			dm_remove_entry(dm, oldest);
-		}
+		if (MAX_ENTRIES == dm->count)
+			dm_remove_entry(dm, &dm->entries[0]);
 	}
 
 	/*
@@ -1309,21 +1932,21 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	host_addr_t addr, uint16 port)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
+	struct dmesh_bad *bad;
 	host_addr_t net;
+	uint i;
 
 	/*
 	 * Lookup SHA1 in the mesh to see if we already have entries for it.
 	 */
 
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 
 	if (dm == NULL)				/* Nothing for this SHA1 key */
 		return;
 
-	packed = host_pack(addr, port);
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL)
 		return;
@@ -1332,7 +1955,9 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 	g_assert(host_addr_equiv(dme->e.url.addr, addr));
 
 	if (dme->bad == NULL)
-		dme->bad = hash_list_new(host_addr_hash_func, host_addr_eq_func);
+		WALLOC0(dme->bad);
+
+	bad = dme->bad;
 
 	/*
 	 * If this host already reported this network as being bad, ignore.
@@ -1341,15 +1966,17 @@ dmesh_negative_alt(const struct sha1 *sha1, host_addr_t reporter,
 
 	net = host_addr_mask_net(reporter, 16, 64);
 
-	if (hash_list_contains(dme->bad, &net))
-		return;
+	for (i = 0; i < bad->count; i++) {
+		if (host_addr_equiv(bad->net[i], net))
+			return;
+	}
 
 	/*
 	 * Evict the entry only when there is enough evidence.
 	 */
 
-	if (hash_list_length(dme->bad) + 1 < MIN_BAD_REPORT) {
-		hash_list_append(dme->bad, WCOPY(&net));
+	if (bad->count + 1 < MIN_BAD_REPORT) {
+		bad->net[bad->count++] = net;
 	} else {
 		/* Add entry to the banned mesh if not a firewalled source */
 
@@ -1368,18 +1995,15 @@ dmesh_good_mark(const struct sha1 *sha1,
 	host_addr_t addr, uint16 port, bool good)
 {
 	struct dmesh *dm;
-	struct packed_host packed;
 	struct dmesh_entry *dme;
 	bool retried = FALSE;
 
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	packed = host_pack(addr, port);
-
 retry:
-	dme = htable_lookup(dm->by_host, &packed);
+	dme = dm_lookup_host(dm, addr, port);
 
 	if (dme == NULL) {
 		/*
@@ -1412,7 +2036,7 @@ retry:
 	 */
 
 	if (good) {
-		hash_list_free_all(&dme->bad, wfree_host_addr1);
+		WFREE_NULL(dme->bad, sizeof *dme->bad);
 	}
 
 	/*
@@ -1433,6 +2057,7 @@ retry:
 	}
 
 	dme->good = good;
+	dm->dirty = TRUE;
 }
 
 /**
@@ -1445,11 +2070,11 @@ dmesh_good_fw_mark(const struct sha1 *sha1,
 	struct dmesh *dm;
 	struct dmesh_entry *dme;
 
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 	if (dm == NULL)
 		return;			/* Weird, but it doesn't matter */
 
-	dme = htable_lookup(dm->by_guid, guid);
+	dme = dm_lookup_guid(dm, guid);
 
 	if (dme == NULL)
 		return;
@@ -1463,7 +2088,7 @@ dmesh_good_fw_mark(const struct sha1 *sha1,
 	 */
 
 	if (good) {
-		hash_list_free_all(&dme->bad, wfree_host_addr1);
+		WFREE_NULL(dme->bad, sizeof *dme->bad);
 	}
 #endif
 
@@ -1485,6 +2110,7 @@ dmesh_good_fw_mark(const struct sha1 *sha1,
 	}
 
 	dme->good = good;
+	dm->dirty = TRUE;
 }
 
 /**
@@ -1670,109 +2296,6 @@ dmesh_entry_compact(const struct dmesh_entry *dme, char *buf, size_t size)
 	return rw < size ? rw : (size_t) -1;
 }
 
-/**
- * Format dmesh_entry in the provided buffer, as an URL with an appended
- * timestamp in ISO format, GMT time.
- *
- * @return length of formatted entry, -1 if the URL would be larger than
- * the buffer.
- */
-static size_t
-dmesh_entry_url_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
-{
-	size_t rw;
-	bool quoting;
-
-	g_assert(!dme->fw_entry);
-	g_assert(size > 0);
-	g_assert(size <= INT_MAX);
-
-	/*
-	 * Format the URL info first.
-	 */
-
-	rw = dmesh_urlinfo_to_string_buf(&dme->e.url, buf, size, &quoting);
-	if ((size_t) -1 == rw)
-		return (size_t) -1;
-
-	/*
-	 * If quoting is required, we need to surround the already formatted
-	 * string into "quotes".
-	 */
-
-	if (quoting) {
-		if (rw + 2 >= size)		/* Not enough room for 2 quotes */
-			return (size_t) -1;
-
-		g_memmove(buf + 1, buf, rw);
-		buf[0] = '"';
-		buf[++rw] = '"';
-		buf[++rw] = '\0';
-	}
-
-	/*
-	 * Append timestamp.
-	 */
-
-	rw += concat_strings(&buf[rw], size - rw,
-			" ", timestamp_utc_to_string(dme->stamp), NULL_PTR);
-
-	return rw < size ? rw : (size_t) -1;
-}
-
-/**
- * Format dmesh_entry in the provided buffer, as a firewalled location
- * with an appended timestamp in ISO format, GMT time.
- *
- * @return length of formatted entry, -1 if the entry would be larger than
- * the buffer.
- */
-static size_t
-dmesh_entry_fw_stamp(const struct dmesh_entry *dme, char *buf, size_t size)
-{
-	size_t rw;
-
-	g_assert(dme->fw_entry);
-	g_assert(size > 0);
-	g_assert(size <= INT_MAX);
-
-	/*
-	 * Format the firewalled host info first.
-	 */
-
-	rw = dmesh_fwinfo_to_string_buf(&dme->e.fwh, buf, size);
-	if ((size_t) -1 == rw)
-		return (size_t) -1;
-
-	/*
-	 * Append timestamp.
-	 */
-
-	rw += concat_strings(&buf[rw], size - rw,
-			";", timestamp_utc_to_string(dme->stamp), NULL_PTR);
-
-	return rw < size ? rw : (size_t) -1;
-}
-
-/**
- * Format the `dme' mesh entry as "URL timestamp" or as FW host info.
- *
- * @return pointer to static string.
- */
-static const char *
-dmesh_entry_to_string(const struct dmesh_entry *dme)
-{
-	static char str[1024];
-
-	if (dme->fw_entry) {
-		dmesh_entry_fw_stamp(dme, ARYLEN(str));
-	} else {
-		dmesh_entry_url_stamp(dme, ARYLEN(str));
-	}
-
-	return str;
-}
-
 /**
  * Fill supplied vector `hvec' whose size is `hcnt' with some alternate
  * locations for a given SHA1 key, that can be requested by hash directly.
@@ -1788,13 +2311,13 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	int i;
 	int j;
 	bool complete_file;
-	list_iter_t *iter;
+	uint k;
 
 	/*
 	 * Fetch the mesh entry for this SHA1.
 	 */
 
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 	if (dm == NULL)						/* SHA1 unknown */
 		return 0;
 
@@ -1804,10 +2327,9 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 
 	i = 0;
 	complete_file = sha1_of_finished_file(sha1);
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (k = 0; k < dm->count; k++) {
+		struct dmesh_entry *dme = &dm->entries[k];
 
 		if (dme->fw_entry || dme->e.url.idx != URN_INDEX)
 			continue;
@@ -1840,12 +2362,11 @@ dmesh_fill_alternate(const struct sha1 *sha1, gnet_host_t *hvec, int hcnt)
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		return 0;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass: choose at most `hcnt' entries at random.
@@ -1974,7 +2495,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	size_t maxlinelen = 0;
 	header_fmt_t *fmt;
 	bool added;
-	list_iter_t *iter;
+	uint k;
 	bool complete_file;
 	bool can_share_partials;
 
@@ -2070,7 +2591,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	}
 
 	/* Find mesh entry for this SHA1 */
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 
 	/*
 	 * Start filling the buffer.
@@ -2140,7 +2661,7 @@ dmesh_alternate_location(const struct sha1 *sha1,
 
 	dm_expire(dm);
 
-	if (list_length(dm->entries) == 0) {
+	if (0 == dm->count) {
 		dmesh_dispose(sha1);
 		goto nomore;
 	}
@@ -2159,11 +2680,10 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 */
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 	complete_file = sha1_of_finished_file(sha1);
 
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (k = 0; k < dm->count; k++) {
+		struct dmesh_entry *dme = &dm->entries[k];
 
 		if (dme->fw_entry)
 			continue;
@@ -2206,12 +2726,11 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	}
 
 	nselected = i;
-	list_iter_free(&iter);
 
 	if (nselected == 0)
 		goto nomore;
 
-	g_assert(UNSIGNED(nselected) <= list_length(dm->entries));
+	g_assert(UNSIGNED(nselected) <= dm->count);
 
 	/*
 	 * Second pass.
@@ -2292,10 +2811,8 @@ dmesh_alternate_location(const struct sha1 *sha1,
 	 * to have firewalled ones.
 	 */
 
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (k = 0; k < dm->count; k++) {
+		struct dmesh_entry *dme = &dm->entries[k];
 		sequence_t *proxies;
 		host_addr_t servent_addr;
 		uint16 servent_port;
@@ -2367,8 +2884,6 @@ dmesh_alternate_location(const struct sha1 *sha1,
 		}
 	}
 
-	list_iter_free(&iter);
-
 	/* FALL THROUGH */
 
 nomore:
@@ -2948,22 +3463,21 @@ static int
 dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 {
 	struct dmesh *dm;
-	list_iter_t *iter;
+	uint k;
 	int i;
 
 	g_assert(sha1);
 	g_assert(buf);
 	g_assert(count > 0);
 
-	dm = hikset_lookup(mesh, sha1);
+	dm = dm_find(sha1);
 	if (dm == NULL)					/* SHA1 unknown */
 		return 0;
 
 	i = 0;
-	iter = list_iter_before_head(dm->entries);
 
-	while (list_iter_has_next(iter) && i < count) {
-		struct dmesh_entry *dme = list_iter_next(iter);
+	for (k = 0; k < dm->count && i < count; k++) {
+		struct dmesh_entry *dme = &dm->entries[k];
 		dmesh_urlinfo_t *from;
 
 		if (dme->fw_entry)
@@ -2975,8 +3489,6 @@ dmesh_alt_loc_fill(const struct sha1 *sha1, dmesh_urlinfo_t *buf, int count)
 		buf[i++] = *from;
 	}
 
-	list_iter_free(&iter);
-
 	return i;
 }
 
@@ -3171,7 +3683,7 @@ dmesh_check_results_set(gnet_results_set_t *rs)
 		 * sharing this SHA1.
 		 */
 
-		has = hikset_contains(mesh, rc->sha1);
+		has = dm_exists(rc->sha1);
 
 		if (!has) {
 			shared_file_t *sf = shared_file_by_sha1(rc->sha1);
@@ -3262,32 +3774,6 @@ dmesh_multiple_downloads(const struct sha1 *sha1,
 	}
 }
 
-/**
- * Store key/value pair in file.
- */
-static void
-dmesh_store_kv(void *value, void *udata)
-{
-	const struct dmesh *dm = value;
-	FILE *out = udata;
-	list_iter_t *iter;
-
-	fprintf(out, "%s\n", sha1_base32(dm->sha1));
-
-	iter = list_iter_before_head(dm->entries);
-
-	while (list_iter_has_next(iter)) {
-		const struct dmesh_entry *dme = list_iter_next(iter);
-		fprintf(out, "%s\n", dmesh_entry_to_string(dme));
-	}
-
-	list_iter_free(&iter);
-
-	fputs("\n", out);
-}
-
-/* XXX add dmesh_store_if_dirty() and export that only */
-
 typedef void (*header_func_t)(FILE *out);
 
 /**
@@ -3315,37 +3801,55 @@ dmesh_store_hikset(const char *what, hikset_t *hash, const char *file,
 }
 
 /**
- * Prints header to dmesh store file.
+ * Hash set iterator to write back modified mesh buckets, and drop from
+ * memory unmodified buckets which have not been updated for a while.
+ *
+ * @return TRUE if the bucket was freed and must be removed from the mesh.
  */
-static void
-dmesh_header_print(FILE *out)
+static bool
+dmesh_store_kv(void *value, void *udata)
 {
-	file_config_preamble(out, "Download mesh");
+	struct dmesh *dm = value;
+	size_t *written = udata;
 
-	fputs(	"#\n# Format is:\n"
-			"#   SHA1\n"
-			"#   URL1 timestamp1\n"
-			"#   URL2 timestamp2\n"
-			"#   FWALT timestamp\n"
-			"#   <blank line>\n"
-			"#\n\n",
-			out);
+	if (dm->dirty) {
+		dm_write(dm);
+		(*written)++;
+		return FALSE;
+	}
+
+	if (delta_time(tm_time(), dm->last_update) > DMESH_EVICT_DELAY) {
+		dm_free(dm);
+		return TRUE;
+	}
+
+	return FALSE;
 }
 
 /**
- * Store download mesh onto file.
- * The download mesh is normally stored in ~/.gtk-gnutella/dmesh.
+ * Store modified download mesh buckets into the database.
  */
 void
 dmesh_store(void)
 {
-	dmesh_store_hikset("download mesh",
-		mesh, dmesh_file, dmesh_header_print, dmesh_store_kv);
+	size_t written = 0, evicted;
+
+	evicted = hikset_foreach_remove(mesh, dmesh_store_kv, &written);
+
+	if (written != 0)
+		dbstore_sync_flush(db_dmesh);
+
+	if (GNET_PROPERTY(dmesh_debug) > 1) {
+		g_debug("MESH stored %zu bucket%s, unloaded %zu (%zu loaded)",
+			written, plural(written), evicted, hikset_count(mesh));
+	}
 }
 
 /**
- * Retrieve download mesh and add entries that have not expired yet.
- * The mesh is normally retrieved from ~/.gtk-gnutella/dmesh.
+ * Import the download mesh from the legacy text file, if still present,
+ * adding entries that have not expired yet in the database.
+ *
+ * The file, normally ~/.gtk-gnutella/dmesh, is removed once imported.
  */
 static void G_COLD
 dmesh_retrieve(void)
@@ -3357,6 +3861,7 @@ dmesh_retrieve(void)
 	bool skip = FALSE, truncated = FALSE;
 	int line = 0;
 	file_path_t fp[1];
+	char *path;
 
 	file_path_set(fp, settings_config_dir(), dmesh_file);
 	f = file_config_open_read("download mesh", fp, N_ITEMS(fp));
@@ -3419,6 +3924,13 @@ dmesh_retrieve(void)
 
 	fclose(f);
 	dmesh_store();			/* Persist what we have retrieved */
+
+	path = make_pathname(settings_config_dir(), dmesh_file);
+
+	if (-1 == unlink(path) && ENOENT != errno)
+		g_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, path);
+
+	HFREE_NULL(path);
 }
 
 /**
@@ -3559,6 +4071,10 @@ dmesh_close(void)
 	hikset_foreach(mesh, dmesh_free_kv, NULL);
 	hikset_free_null(&mesh);
 
+	cq_periodic_remove(&dmesh_prune_ev);
+	dbstore_close(db_dmesh, settings_gnet_db_dir(), db_dmesh_base);
+	db_dmesh = NULL;
+
 	/*
 	 * Construct a list of banned mesh entries to remove, then manually
 	 * expire all the entries, which will remove entries from `ban_mesh'
@@ -115,7 +115,6 @@
 #include "lib/magnet.h"
 #include "lib/palloc.h"
 #include "lib/parse.h"
-#include "lib/plist.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sequence.h"
@@ -180,6 +179,7 @@ static void download_add_to_list(struct download *d, enum dl_list idx);
 static bool download_send_push_request(struct download *d, bool, bool);
 static bool download_read(struct download *d, pmsg_t *mb);
 static bool download_ignore_data(struct download *d, pmsg_t *mb);
+static void download_write_request(void *, int, inputevt_cond_t);
 static void download_reply(struct download *d, header_t *header, bool ok);
 static void download_push_ready(struct download *d, getline_t *empty);
 static void download_push(struct download *d, bool on_timeout);
@@ -415,20 +415,21 @@ server_host_info(const struct dl_server *server)
  * This `dl_key' is inserted in the `dl_by_host' hash table were we find a
  * `dl_server' structure describing all the downloads for the given host.
  *
- * All `dl_server' structures are also inserted in the `dl_by_time' struct,
- * where hosts are sorted based on their retry time.
+ * All `dl_server' structures are also inserted in one of the two scheduling
+ * trees: `dl_by_time' holds the hosts we cannot retry yet, sorted based on
+ * their retry time, and `dl_by_score' holds the hosts which are due for a
+ * retry, sorted by decreasing scheduling score so that the most promising
+ * sources are started first.
  */
 
 static hikset_t *dl_by_host;
 
-#define DHASH_SIZE	(1UL << 10)	/**< Hash list size, must be a power of 2 */
-#define DHASH_MASK 	(DHASH_SIZE - 1)
-#define DL_HASH(x)	((x) & DHASH_MASK)
+static erbtree_t dl_by_time;	/**< Servers not due yet, by retry time */
+static erbtree_t dl_by_score;	/**< Servers due for a retry, by score */
 
-static struct {
-	plist_t *servers[DHASH_SIZE];	/**< Lists of servers, by retry time */
-	int change[DHASH_SIZE];			/**< Counts changes to the list */
-} dl_by_time;
+#define DL_SCHED_UNKNOWN_BPS	(4 * 1024)	/**< Assumed speed of new hosts */
+#define DL_SCHED_MAX_FAILURES	16			/**< Cap on failure penalty */
+#define DL_SCHED_ETA_UNIT		60			/**< PARQ ETA penalty unit (secs) */
 
 /**
  * To handle download meshes, where we only know the IP/port of the host and
@@ -567,22 +568,97 @@ download_pipeline_alloc(void)
 }
 
 /**
- * Free pipelined request descriptor and nullify holding pointer.
+ * Free pipelined request descriptor, along with the requests sent after it,
+ * and nullify holding pointer.
  */
 static void
 download_pipeline_free_null(struct dl_pipeline **dp_ptr)
 {
 	struct dl_pipeline *dp = *dp_ptr;
 
-	if (dp != NULL) {
+	while (dp != NULL) {
+		struct dl_pipeline *next = dp->next;
+
 		dl_pipeline_check(dp);
 
 		pmsg_free_null(&dp->req);
 		pmsg_free_null(&dp->extra);
 		dp->magic = 0;
 		WFREE(dp);
-		*dp_ptr = NULL;
+		dp = next;
 	}
+
+	*dp_ptr = NULL;
+}
+
+/**
+ * @return the last pipelined request of the download, NULL if none.
+ */
+static struct dl_pipeline *
+download_pipeline_last(const struct download *d)
+{
+	struct dl_pipeline *dp = d->pipeline;
+
+	while (dp != NULL && dp->next != NULL)
+		dp = dp->next;
+
+	return dp;
+}
+
+/**
+ * Append new pipelined request to the download, to be sent after all the
+ * ones already pipelined.
+ *
+ * @return the new pipelined request, in the GTA_DL_PIPE_SELECTED state.
+ */
+static struct dl_pipeline *
+download_pipeline_append(struct download *d)
+{
+	struct dl_pipeline *dp, *last;
+
+	dp = download_pipeline_alloc();
+	last = download_pipeline_last(d);
+
+	if (NULL == last)
+		d->pipeline = dp;
+	else
+		last->next = dp;
+
+	return dp;
+}
+
+/**
+ * Discard the last pipelined request of the download, which was not sent.
+ */
+static void
+download_pipeline_cancel(struct download *d)
+{
+	struct dl_pipeline **dp_ptr = &d->pipeline;
+
+	g_assert(*dp_ptr != NULL);
+
+	while ((*dp_ptr)->next != NULL)
+		dp_ptr = &(*dp_ptr)->next;
+
+	g_assert(GTA_DL_PIPE_SELECTED == (*dp_ptr)->status);
+
+	download_pipeline_free_null(dp_ptr);
+}
+
+/**
+ * Remove the first pipelined request of the download, whose reply is now
+ * going to be processed as the reply to the download's request.
+ */
+static void
+download_pipeline_shift(struct download *d)
+{
+	struct dl_pipeline *dp = d->pipeline;
+
+	dl_pipeline_check(dp);
+
+	d->pipeline = dp->next;
+	dp->next = NULL;
+	download_pipeline_free_null(&dp);
 }
 
 /**
@@ -592,7 +668,8 @@ static bool
 download_pipeline_can_initiate(const struct download *d)
 {
 	fileinfo_t *fi;
-	unsigned avg_bps, s;
+	const struct dl_pipeline *dp;
+	unsigned avg_bps, s, depth;
 	unsigned threshold;
 	filesize_t downloaded, remain;
 
@@ -603,8 +680,10 @@ download_pipeline_can_initiate(const struct download *d)
 	fi = d->file_info;
 	file_info_check(fi);
 
-	if (download_pipelining(d))
-		return FALSE;				/* Only one pipelined request at a time */
+	depth = download_pipeline_depth(d);
+
+	if (depth >= GNET_PROPERTY(dl_pipeline_depth))
+		return FALSE;				/* Pipeline is full */
 
 	if (!fi->file_size_known)
 		return FALSE;				/* Must know upper boundary */
@@ -630,6 +709,20 @@ download_pipeline_can_initiate(const struct download *d)
 	if (d->server->attrs & DLS_A_NO_PIPELINE)
 		return FALSE;				/* Server seems to choke on pipelining */
 
+	/*
+	 * Only pipeline a request behind other pipelined requests once the
+	 * previous one was fully sent, and if the server already proved it
+	 * could cope with pipelining.
+	 */
+
+	if (depth != 0) {
+		if (!(d->server->attrs & DLS_A_PIPELINING))
+			return FALSE;
+
+		if (download_pipeline_last(d)->status != GTA_DL_PIPE_SENT)
+			return FALSE;
+	}
+
 	/*
 	 * If we have a pending THEX download, do not use pipelining so that
 	 * we can switch to the THEX download once the current chunk is done
@@ -654,7 +747,8 @@ download_pipeline_can_initiate(const struct download *d)
 	}
 
 	/*
-	 * We must be close to the end of the current request to not commit the
+	 * We must be close to the end of the data already requested, that of
+	 * the current request and of the pipelined ones, to not commit the
 	 * next chunk too early.
 	 */
 
@@ -665,37 +759,112 @@ download_pipeline_can_initiate(const struct download *d)
 		remain = d->chunk.size + d->chunk.overlap;
 	}
 
+	for (dp = d->pipeline; dp != NULL; dp = dp->next)
+		remain += dp->chunk.size + dp->chunk.overlap;
+
 	avg_bps = download_speed_avg(d);
 	s = remain / (avg_bps ? avg_bps : 1);
 
 	g_assert(dl_server_valid(d->server));
 
-	threshold = MAX(DOWNLOAD_PIPELINE_MSECS, GNET_PROPERTY(dl_http_latency));
-	threshold = MAX(threshold, d->server->latency);
+	/*
+	 * Keep ``dl_pipeline_chunk_factor'' round-trips worth of data requested
+	 * ahead of reception: chunks are sized so that the allowed amount of
+	 * pipelined requests covers that (see download_pipeline_chunksize()).
+	 */
+
+	threshold = MAX(GNET_PROPERTY(dl_http_latency), d->server->latency);
+	threshold = uint_saturate_mult(threshold,
+		GNET_PROPERTY(dl_pipeline_chunk_factor));
+	threshold = MAX(threshold, DOWNLOAD_PIPELINE_MSECS);
 
 	return uint_saturate_mult(s, 1000) <= threshold;
 }
 
 /**
- * Take ownership of pipelined chunk after cloning.
+ * Compute the minimum chunk size that should be requested from the source
+ * when HTTP pipelining is enabled.
+ *
+ * We want ``dl_pipeline_chunk_factor'' times the bandwidth-delay product
+ * of the source (its average throughput times its measured HTTP latency)
+ * to be requested ahead of reception, to keep high-latency links busy
+ * between requests.  That amount is spread over the requests we may
+ * pipeline to the source: a single one until the server has proven it
+ * supports pipelining, up to ``dl_pipeline_depth'' afterwards.
+ *
+ * @return the minimum chunk size, 0 when there is no suggestion to make.
+ */
+filesize_t
+download_pipeline_chunksize(const struct download *d)
+{
+	filesize_t size;
+	unsigned avg_bps, rtt, depth;
+
+	download_check(d);
+
+	if (!GNET_PROPERTY(enable_http_pipelining))
+		return 0;
+
+	if (NULL == d->server || (d->server->attrs & DLS_A_NO_PIPELINE))
+		return 0;
+
+	avg_bps = download_speed_avg(d);
+	if (0 == avg_bps)
+		return 0;				/* No throughput measurement yet */
+
+	rtt = MAX(GNET_PROPERTY(dl_http_latency), d->server->latency);
+	size = (filesize_t) avg_bps * rtt / 1000;
+	size *= GNET_PROPERTY(dl_pipeline_chunk_factor);
+
+	depth = (d->server->attrs & DLS_A_PIPELINING) ?
+		GNET_PROPERTY(dl_pipeline_depth) : 1;
+
+	return (size + depth - 1) / depth;
+}
+
+/**
+ * Take ownership of pipelined chunks after cloning.
  */
 static void
 download_pipeline_update_chunk(const struct download *d)
 {
-	struct dl_pipeline *dp;
+	filesize_t below = MAX_INT_VAL(filesize_t);
 
 	download_check(d);
-	dp = d->pipeline;
-	dl_pipeline_check(dp);
-	g_assert(dp->status != GTA_DL_PIPE_SELECTED);
+	g_assert(download_pipelining(d));
 
 	/*
-	 * With aggressive swarming, the pipelined chunk could be completed,
-	 * in which case we shall ignore data later on when detecting we're
-	 * bumping into a DONE chunk.
+	 * Changing the owner of a chunk clears the other chunks of the old owner
+	 * lying after it, so we must process pipelined chunks by decreasing
+	 * offsets.
 	 */
 
-	file_info_new_chunk_owner(d, dp->chunk.start, dp->chunk.end);
+	for (;;) {
+		const struct dl_pipeline *dp, *next = NULL;
+
+		for (dp = d->pipeline; dp != NULL; dp = dp->next) {
+			dl_pipeline_check(dp);
+			g_assert(dp->status != GTA_DL_PIPE_SELECTED);
+
+			if (
+				dp->chunk.start < below &&
+				(NULL == next || dp->chunk.start > next->chunk.start)
+			)
+				next = dp;
+		}
+
+		if (NULL == next)
+			break;
+
+		/*
+		 * With aggressive swarming, the pipelined chunk could be completed,
+		 * in which case we shall ignore data later on when detecting we're
+		 * bumping into a DONE chunk.
+		 */
+
+		file_info_new_chunk_owner(d, next->chunk.start, next->chunk.end);
+		below = next->chunk.start;
+	}
 }
 
 /**
@@ -1140,8 +1309,24 @@ static int
 dl_server_retry_cmp(const void *p, const void *q)
 {
 	const struct dl_server *a = p, *b = q;
+	int c;
 
-	return CMP(a->retry_after, b->retry_after);
+	c = CMP(a->retry_after, b->retry_after);
+	return 0 != c ? c : CMP(pointer_to_ulong(a), pointer_to_ulong(b));
+}
+
+/**
+ * Compare two `dl_server' structures based on the `sched_score' field,
+ * highest scores coming first.
+ */
+static int
+dl_server_score_cmp(const void *p, const void *q)
+{
+	const struct dl_server *a = p, *b = q;
+	int c;
+
+	c = CMP(b->sched_score, a->sched_score);
+	return 0 != c ? c : CMP(pointer_to_ulong(a), pointer_to_ulong(b));
 }
 
 /**
@@ -1310,6 +1495,10 @@ download_init(void)
 {
 	dl_by_host = hikset_create_any(
 		offsetof(struct dl_server, key), dl_key_hash, dl_key_eq);
+	erbtree_init(&dl_by_time, dl_server_retry_cmp,
+		offsetof(struct dl_server, sched_node));
+	erbtree_init(&dl_by_score, dl_server_score_cmp,
+		offsetof(struct dl_server, sched_node));
 	dl_by_addr = htable_create_any(dl_addr_hash, NULL, dl_addr_eq);
 	dl_by_guid = htable_create(HASH_KEY_FIXED, GUID_RAW_SIZE);
 	dl_by_id = hikset_create(
@@ -1761,27 +1950,105 @@ buffers_strip_trailing(struct download *d, size_t amount)
 static void
 dl_by_time_insert(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
-
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_insert_sorted(dl_by_time.servers[idx],
-		server, dl_server_retry_cmp);
+	server->sched_due = FALSE;
+	erbtree_insert(&dl_by_time, &server->sched_node);
 }
 
 /**
- * Remove server from the `dl_by_time' structure.
+ * Remove server from the scheduling tree where it currently sits.
  */
 static void
 dl_by_time_remove(struct dl_server *server)
 {
-	uint idx = DL_HASH(server->retry_after);
+	g_assert(dl_server_valid(server));
+
+	erbtree_remove(server->sched_due ? &dl_by_score : &dl_by_time,
+		&server->sched_node);
+	server->sched_due = FALSE;
+}
+
+/**
+ * Compute the scheduling score of a server which is due for a retry.
+ *
+ * The score is based on the measured throughput of the server, halved for
+ * each recent failure and reduced by the PARQ ETA we were last given for
+ * the first waiting download on that server.  It is doubled when that
+ * download concerns a rare file, to get its data before the partial
+ * sources are gone.
+ *
+ * @return the score, highest values being scheduled first.
+ */
+static uint64
+dl_server_sched_score(const struct dl_server *server)
+{
+	const struct download *d;
+	uint64 score;
+
+	score = 0 == server->speed_avg ? DL_SCHED_UNKNOWN_BPS : server->speed_avg;
+	score <<= DL_SCHED_MAX_FAILURES;		/* Room for the penalties */
+	score >>= MIN(server->failures, DL_SCHED_MAX_FAILURES);
+
+	d = NULL == server->list[DL_LIST_WAITING] ?
+		NULL : list_head(server->list[DL_LIST_WAITING]);
+
+	if (d != NULL) {
+		int eta;
+
+		download_check(d);
+
+		eta = get_parq_dl_eta(d);
+		if (eta > 0)
+			score /= 1 + eta / DL_SCHED_ETA_UNIT;
+
+		if (d->sha1 != NULL && download_sha1_is_rare(d->sha1))
+			score *= 2;
+	}
+
+	return score;
+}
+
+/**
+ * Move all the servers whose retry time has come from the `dl_by_time'
+ * structure to the `dl_by_score' one, computing their scheduling score.
+ */
+static void
+dl_sched_promote(time_t now)
+{
+	struct dl_server *server;
+
+	while (NULL != (server = erbtree_head(&dl_by_time))) {
+		g_assert(dl_server_valid(server));
+		g_assert(!server->sched_due);
 
+		if (delta_time(now, server->retry_after) < 0)
+			break;		/* Tree is sorted */
+
+		erbtree_remove(&dl_by_time, &server->sched_node);
+		server->sched_score = dl_server_sched_score(server);
+		server->sched_due = TRUE;
+		erbtree_insert(&dl_by_score, &server->sched_node);
+	}
+}
+
+/**
+ * Recompute the scheduling score of a server whose throughput or failure
+ * count changed, re-keying it in the `dl_by_score' tree if it is due.
+ *
+ * Servers not due yet are scored when dl_sched_promote() moves them.
+ */
+static void
+dl_sched_rescore(struct dl_server *server)
+{
 	g_assert(dl_server_valid(server));
 
-	dl_by_time.change[idx]++;
-	dl_by_time.servers[idx] = plist_remove(dl_by_time.servers[idx], server);
+	if (!server->sched_due)
+		return;
+
+	erbtree_remove(&dl_by_score, &server->sched_node);
+	server->sched_score = dl_server_sched_score(server);
+	erbtree_insert(&dl_by_score, &server->sched_node);
 }
 
 /**
@@ -3940,6 +4207,18 @@ download_clone(struct download *d)
 		d->bio = NULL;		/* I/O source kept as well */
 		d->out_file = NULL;	/* Keep file opened when pipelining */
 		rx_change_owner(cd->rx, cd);
+
+		/*
+		 * If the last pipelined request is not fully sent yet, the I/O
+		 * callback flushing it must now be invoked on the clone.
+		 */
+
+		if (GTA_DL_PIPE_SENDING == download_pipeline_last(cd)->status) {
+			g_assert(s != NULL && s->gdk_tag != 0);
+			socket_evt_clear(s);
+			socket_evt_set(s, INPUT_EVENT_WX, download_write_request, cd);
+		}
+
 		switch (cd->pipeline->status) {
 		case GTA_DL_PIPE_SENDING:
 			download_set_status(cd, GTA_DL_REQ_SENDING);
@@ -4068,6 +4347,22 @@ download_server_retry_after(struct dl_server *server, time_t now, int hold)
 	}
 }
 
+/**
+ * Record a failure to reach the server or to get data from it, such as a
+ * timeout or a refused connection.  Each failure halves the scheduling
+ * score of the server, until it serves us a chunk again.
+ */
+static void
+download_server_failed(struct dl_server *server)
+{
+	g_assert(dl_server_valid(server));
+
+	if (server->failures < MAX_INT_VAL(uint8)) {
+		server->failures++;
+		dl_sched_rescore(server);
+	}
+}
+
 /**
  * Reclaim download's server if it is no longer holding anything.
  * If `delayed' is true, we're performing a batch free of downloads.
@@ -4339,6 +4634,9 @@ download_switchable(struct download *d, const header_t *header)
 	if (!d->keep_alive)
 		return FALSE;
 
+	if (download_pipelining(d))
+		return FALSE;			/* Replies to pipelined requests will follow */
+
 	buf = header_get(header, "Content-Length");
 	if (!buf)
 		return FALSE;
@@ -4674,6 +4972,8 @@ download_stop_v(struct download *d, download_status_t new_status,
 			else
 				server->speed_avg += (avg >> 1) - (server->speed_avg >> 1);
 		}
+		server->failures = 0;	/* Source is serving us fine */
+		dl_sched_rescore(server);
 		d->data_timeouts = 0;	/* Got a full chunk all right */
 
 		/*
@@ -5663,8 +5963,11 @@ download_start_prepare_running(struct download *d)
 	d->keep_alive = FALSE;	/* Until proven otherwise by server's reply */
 	d->got_giv = FALSE;		/* Don't know yet, assume no GIV */
 
-	if (d->socket == NULL)
+	if (d->socket == NULL) {
 		d->served_reqs = 0;		/* No request served yet, since not connected */
+		d->pipelined_reqs = 0;
+		d->pipelined_ahead = 0;
+	}
 
 	d->flags &= ~DL_F_OVERLAPPED;		/* Clear overlapping indication */
 	d->flags &= ~DL_F_SHRUNK_REPLY;		/* Clear server shrinking indication */
@@ -6568,20 +6871,28 @@ static void
 download_pickup_queued(void)
 {
 	time_t now = tm_time();
-	uint i;
+	struct dl_server *server;
 
 	/*
-	 * To select downloads, we iterate over the sorted `dl_by_time' list and
-	 * look for something we could schedule.
+	 * To select downloads, we first move the servers whose retry time has
+	 * come to the `dl_by_score' tree, then pop them from it, best sources
+	 * first, looking for something we could schedule.
 	 *
 	 * Note that we jump from one host to the other, even if we have multiple
 	 * things to schedule on the same host: It's better to spread load among
 	 * all hosts first.
 	 */
 
-	for (i = 0; i < DHASH_SIZE; i++) {
-		plist_t *l;
-		int last_change;
+	dl_sched_promote(now);
+
+	while (NULL != (server = erbtree_head(&dl_by_score))) {
+		list_iter_t *iter;
+		struct download *d;
+		uint n;
+		bool only_special = FALSE;
+
+		g_assert(dl_server_valid(server));
+		g_assert(server->sched_due);
 
 		if (download_queue_is_frozen())
 			break;
@@ -6592,155 +6903,128 @@ download_pickup_queued(void)
 		if (!bws_can_connect(SOCK_TYPE_DOWNLOAD))
 			break;
 
-	retry:
-		l = dl_by_time.servers[i];
-		last_change = dl_by_time.change[i];
+		/*
+		 * Pop the server by moving it back to the `dl_by_time' tree, where
+		 * it always sits in a valid scheduling tree whatever download_start()
+		 * does to it.  Its retry time has come, so the next call will promote
+		 * it again, with a refreshed score.
+		 */
 
-		for (/* NOTHING */; NULL != l; l = plist_next(l)) {
-			struct dl_server *server = l->data;
-			list_iter_t *iter;
-			struct download *d;
-			uint n;
-			bool only_special = FALSE;
+		dl_by_time_remove(server);
+		dl_by_time_insert(server);
 
-			g_assert(dl_server_valid(server));
+		if (server_list_length(server, DL_LIST_WAITING) == 0)
+			continue;
 
-			if (count_running_downloads() >= GNET_PROPERTY(max_downloads))
-				break;
+		if (
+			count_running_on_server(server)
+				>= GNET_PROPERTY(max_host_downloads)
+		) {
+			download_list_send_head_ping(server->list[DL_LIST_WAITING]);
 
 			/*
-			 * List is sorted, so as soon as we go beyond the current time,
-			 * we can stop.
+			 * Normally, special downloads are served by remote servents
+			 * regardless of the amount of upload slots or per host
+			 * restrictions (since these downloads are small, usually).
+			 *
+			 * Hence, allow such special downloads to be scheduled even
+			 * if we reached the configured local maximum.
 			 */
 
-			if (delta_time(now, server->retry_after) < 0)
-				break;
-
-			if (server_list_length(server, DL_LIST_WAITING) == 0)
-				continue;
-
-			if (
-				count_running_on_server(server)
-					>= GNET_PROPERTY(max_host_downloads)
-			) {
-				download_list_send_head_ping(server->list[DL_LIST_WAITING]);
-
-				/*
-				 * Normally, special downloads are served by remote servents
-				 * regardless of the amount of upload slots or per host
-				 * restrictions (since these downloads are small, usually).
-				 *
-				 * Hence, allow such special downloads to be scheduled even
-				 * if we reached the configured local maximum.
-				 */
-
-				only_special = TRUE;
-			}
-
-			/*
-			 * Avoid hammering servers.  In case we have multiple files queued
-			 * on that server, we must not issue all the requests in a short
-			 * period of time as this can be frowned upon.
-			 */
+			only_special = TRUE;
+		}
 
-			if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY)
-				continue;
+		/*
+		 * Avoid hammering servers.  In case we have multiple files queued
+		 * on that server, we must not issue all the requests in a short
+		 * period of time as this can be frowned upon.
+		 */
 
-			/*
-			 * OK, select a download within the waiting list, but do not
-			 * remove it yet.  This will be done by download_start().
-			 */
+		if (delta_time(now, server->last_connect) < DOWNLOAD_CONNECT_DELAY)
+			continue;
 
-			g_assert(server->list[DL_LIST_WAITING]);	/* Since count != 0 */
+		/*
+		 * OK, select a download within the waiting list, but do not
+		 * remove it yet.  This will be done by download_start().
+		 */
 
-			n = 0;
-			d = NULL;
-			iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
-			while (list_iter_has_next(iter)) {
-				struct download *cur;
+		g_assert(server->list[DL_LIST_WAITING]);	/* Since count != 0 */
 
-				cur = list_iter_next(iter);
-				download_check(cur);
+		n = 0;
+		d = NULL;
+		iter = list_iter_before_head(server->list[DL_LIST_WAITING]);
+		while (list_iter_has_next(iter)) {
+			struct download *cur;
 
-				if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
-					continue;
+			cur = list_iter_next(iter);
+			download_check(cur);
 
-				if (only_special && !download_is_special(cur))
-					continue;
+			if (cur->flags & (DL_F_SUSPENDED | DL_F_PAUSED))
+				continue;
 
-				if (download_has_enough_active_sources(cur)) {
-					download_send_head_ping(cur);
-					continue;
-				}
+			if (only_special && !download_is_special(cur))
+				continue;
 
-				if (
-					delta_time(now, cur->last_update) <=
-						(time_delta_t) cur->timeout_delay
-				) {
-					download_send_head_ping(cur);
-					continue;
-				}
+			if (download_has_enough_active_sources(cur)) {
+				download_send_head_ping(cur);
+				continue;
+			}
 
-				/* Note that we skip over paused and suspended downloads */
-				if (delta_time(now, cur->retry_after) < 0)
-					break;	/* List is sorted */
+			if (
+				delta_time(now, cur->last_update) <=
+					(time_delta_t) cur->timeout_delay
+			) {
+				download_send_head_ping(cur);
+				continue;
+			}
 
-				if (d) {
-					if ((NULL != d->thex) == (NULL != cur->thex)) {
-						/*
-						 * Pick the download with the most progress. Otherwise
-						 * we easily end up with dozens of partials from the
-						 * the server.
-						 */
+			/* Note that we skip over paused and suspended downloads */
+			if (delta_time(now, cur->retry_after) < 0)
+				break;	/* List is sorted */
 
-						if (
-							download_total_progress(d)
-								>= download_total_progress(cur)
-						) {
-							download_send_head_ping(cur);
-							continue;
-						}
-					}
+			if (d) {
+				if ((NULL != d->thex) == (NULL != cur->thex)) {
+					/*
+					 * Pick the download with the most progress. Otherwise
+					 * we easily end up with dozens of partials from the
+					 * the server.
+					 */
 
-					/* Give priority to THEX downloads */
-					if (d->thex && NULL == cur->thex) {
+					if (
+						download_total_progress(d)
+							>= download_total_progress(cur)
+					) {
 						download_send_head_ping(cur);
 						continue;
 					}
 				}
 
-				if (d)
-					download_send_head_ping(d);
-
-				d = cur;
-
-				/*
-				 * If there are a lot of downloads queued at a single server we
-				 * might spend a lot of time scanning the queue of a download
-				 * to pick. Thus limit the amount of items we're going to take
-				 * into account.
-				 */
-
-				if (n++ > 100)
-					break;
+				/* Give priority to THEX downloads */
+				if (d->thex && NULL == cur->thex) {
+					download_send_head_ping(cur);
+					continue;
+				}
 			}
-			list_iter_free(&iter);
 
-			if (d) {
-				download_start(d, FALSE);
-			}
+			if (d)
+				download_send_head_ping(d);
 
+			d = cur;
 
 			/*
-			 * It's possible that download_start() ended-up changing the
-			 * dl_by_time list we're iterating over.  That's why all changes
-			 * to that list update the dl_by_time_change variable, which we
-			 * snapshot upon entry into the loop.
-			 *		--RAM, 24/08/2002.
+			 * If there are a lot of downloads queued at a single server we
+			 * might spend a lot of time scanning the queue of a download
+			 * to pick. Thus limit the amount of items we're going to take
+			 * into account.
 			 */
 
-			if (last_change != dl_by_time.change[i])
-				goto retry;
+			if (n++ > 100)
+				break;
+		}
+		list_iter_free(&iter);
+
+		if (d) {
+			download_start(d, FALSE);
 		}
 	}
 }
@@ -6996,6 +7280,12 @@ download_push(struct download *d, bool on_timeout)
 	}
 
 attempt_retry:
+	/*
+	 * We could not connect to the server, directly or through a PUSH.
+	 */
+
+	download_server_failed(d->server);
+
 	/*
 	 * If we're aborting a download flagged with "Push ignore" due to a
 	 * timeout reason, chances are great that this host is indeed firewalled!
@@ -11925,9 +12215,15 @@ http_version_nofix:
 	 * We can make another request with a range that the remote
 	 * servent has if the reply was a keep-alive one.  Both 503 or 416
 	 * replies are possible with PFSP.
+	 *
+	 * This cannot be done whilst we have pipelined requests pending, since
+	 * their replies would come before the one to the new request.
 	 */
 
-	if (d->ranges != NULL && d->keep_alive && d->file_info->use_swarming) {
+	if (
+		d->ranges != NULL && d->keep_alive && d->file_info->use_swarming &&
+		!download_pipelining(d)
+	) {
 		switch (ack_code) {
 		case 503:				/* Range not available, maybe */
 		case 416:				/* Range not satisfiable */
@@ -12782,6 +13078,18 @@ http_version_nofix:
 			return;
 		}
 		pipelined_response = TRUE;
+		d->pipelined_reqs++;
+		d->pipelined_ahead += 1 + download_pipeline_depth(d);
+
+		if (GNET_PROPERTY(download_debug) > 1) {
+			g_debug("%s(): pipelined reply #%u for \"%s\" from %s "
+				"(pipeline occupancy %u%%, average depth %.1f, %u pending)",
+				G_STRFUNC, d->served_reqs + 1, download_basename(d),
+				download_host_info(d),
+				d->pipelined_reqs * 100 / (d->served_reqs + 1),
+				d->pipelined_ahead / (double) d->pipelined_reqs,
+				download_pipeline_depth(d));
+		}
 		goto rx_stack_setup;	/* Avoid indenting following code */
 	}
 
@@ -13109,9 +13417,12 @@ download_ignore_data(struct download *d, pmsg_t *mb)
 
 /**
  * Called when the whole HTTP request has been sent out.
+ *
+ * @param d		the download
+ * @param dp	the pipelined request that was sent, NULL for the main request
  */
 static void
-download_request_sent(struct download *d)
+download_request_sent(struct download *d, struct dl_pipeline *dp)
 {
 	/*
 	 * Update status and GUI.
@@ -13122,15 +13433,25 @@ download_request_sent(struct download *d)
 	d->last_update = tm_time();
 	tm_now(&d->header_sent);
 
-	if (download_pipelining(d)) {
-		g_assert(DOWNLOAD_IS_ACTIVE(d));
-		dl_pipeline_check(d->pipeline);
-		d->pipeline->status = GTA_DL_PIPE_SENT;
-		return;		/* We're still processing reception of previous request */
-	} else {
-		download_set_status(d, GTA_DL_REQ_SENT);
+	if (dp != NULL) {
+		dl_pipeline_check(dp);
+		g_assert(GTA_DL_PIPE_SENDING == dp->status);
+		dp->status = GTA_DL_PIPE_SENT;
+
+		/*
+		 * Unless the reply to an earlier pipelined request was waiting for
+		 * this request to be flushed, we're still processing reception of
+		 * the previous request.
+		 */
+
+		if (GTA_DL_REQ_SENDING != d->status) {
+			g_assert(DOWNLOAD_IS_ACTIVE(d));
+			return;
+		}
 	}
 
+	download_set_status(d, GTA_DL_REQ_SENT);
+
 	/*
 	 * Now prepare to read the status line and the headers.
 	 */
@@ -13147,6 +13468,7 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 {
 	struct download *d = data;
 	struct gnutella_socket *s;
+	struct dl_pipeline *dp;
 	pmsg_t *r;
 	ssize_t sent;
 	int rw;
@@ -13155,13 +13477,19 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 	(void) unused_source;
 	download_check(d);
 
+	/*
+	 * When no main request is pending, we are flushing the last pipelined
+	 * request: the ones before it were fully sent already.
+	 */
+
 	s = d->socket;
-	r = download_pipelining(d) ? d->pipeline->req : d->req;
+	dp = NULL == d->req ? download_pipeline_last(d) : NULL;
+	r = dp != NULL ? dp->req : d->req;
 
 	g_assert(s->gdk_tag);		/* I/O callback still registered */
 	pmsg_check(r);
-	g_assert(d->pipeline != NULL || GTA_DL_REQ_SENDING == d->status);
-	g_assert(NULL == d->pipeline || GTA_DL_PIPE_SENDING == d->pipeline->status);
+	g_assert(dp != NULL || GTA_DL_REQ_SENDING == d->status);
+	g_assert(NULL == dp || GTA_DL_PIPE_SENDING == dp->status);
 
 	if (cond & INPUT_EVENT_EXCEPTION) {
 		const char *msg = _("Could not send whole HTTP request");
@@ -13207,7 +13535,7 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 		return;
 	} else if (GNET_PROPERTY(download_trace) & SOCK_TRACE_OUT) {
 		g_debug("----Sent Request (%s%s) completely to %s (%zu bytes):",
-			download_pipelining(d) ? "pipelined " : "",
+			dp != NULL ? "pipelined " : "",
 			d->keep_alive ? "follow-up" : "initial",
 			host_addr_port_to_string(download_addr(d), download_port(d)),
 			pmsg_phys_len(r));
@@ -13220,20 +13548,20 @@ download_write_request(void *data, int unused_source, inputevt_cond_t cond)
 
 	if (GNET_PROPERTY(download_debug)) {
 		g_debug("flushed partially written %sHTTP request to %s (%zu bytes)",
-			download_pipelining(d) ? "pipelined " : "",
+			dp != NULL ? "pipelined " : "",
 			host_addr_port_to_string(download_addr(d), download_port(d)),
 			pmsg_phys_len(r));
     }
 
 	socket_evt_clear(s);
 
-	if (download_pipelining(d)) {
-		pmsg_free_null(&d->pipeline->req);
+	if (dp != NULL) {
+		pmsg_free_null(&dp->req);
 	} else {
 		pmsg_free_null(&d->req);
 	}
 
-	download_request_sent(d);
+	download_request_sent(d, dp);
 }
 
 /**
@@ -13255,6 +13583,7 @@ download_send_request(struct download *d)
 	ssize_t sent;
 	size_t maxsize = sizeof request_buf - 3;
 	struct dl_chunk *req = NULL;
+	struct dl_pipeline *pipelined = NULL;
 
 	download_check(d);
 
@@ -13267,19 +13596,21 @@ download_send_request(struct download *d)
 	g_assert(fi->lifecount <= fi->refcount);
 
 	/*
-	 * If we have a pipelined request, we're sending (or have already sent
-	 * earlier) an HTTP request ahead of time.
+	 * If we have pipelined requests, we're sending (or have already sent
+	 * earlier) HTTP requests ahead of time.
 	 *
 	 * The first time we see a pipelined request, it must be in the
-	 * GTA_DL_PIPE_SELECTED state and we're called to send it ahead of time,
-	 * whilst another HTTP request is currently being processed (data received).
+	 * GTA_DL_PIPE_SELECTED state at the tail of the pipeline and we're called
+	 * to send it ahead of time, whilst another HTTP request is currently
+	 * being processed (data received).
 	 *
-	 * The second time we're called, it would be to send a new request but
-	 * the pipelined request may have been incompletely sent (in the
-	 * GTA_DL_PIPE_SENDING state).  In that case, we act as if we had just
-	 * selected a new request to send and move the download to the
-	 * GTA_DL_REQ_SENDING state so that it continues to wait for the full
-	 * request flush to the server.
+	 * The second time we're called, it would be to send a new request and
+	 * we consume the head of the pipeline, which was the first request sent.
+	 * That pipelined request may have been incompletely sent (in the
+	 * GTA_DL_PIPE_SENDING state), in which case it is the only one.  We then
+	 * act as if we had just selected a new request to send and move the
+	 * download to the GTA_DL_REQ_SENDING state so that it continues to wait
+	 * for the full request flush to the server.
 	 *
 	 * Or the second time the request can be in the GTA_DL_PIPE_SENT state,
 	 * meaning we already sent the pipelined request the first time and so the
@@ -13291,26 +13622,37 @@ download_send_request(struct download *d)
 	 */
 
 	if (download_pipelining(d)) {
-		struct dl_pipeline *dp = d->pipeline;
+		struct dl_pipeline *dp = download_pipeline_last(d);
 		dl_pipeline_status_t status;
 
 		dl_pipeline_check(dp);
 
-		status = dp->status;
-
-		switch (status) {
-		case GTA_DL_PIPE_SELECTED:	/* Sending new pipelined request */
+		if (GTA_DL_PIPE_SELECTED == dp->status) {
+			/* Sending new pipelined request */
+			pipelined = dp;
 			req = &dp->chunk;
 			d->flags |= DL_F_PIPELINED;	/* Suppress HTTP latency computation */
 			goto picked;
+		}
+
+		dp = d->pipeline;
+		dl_pipeline_check(dp);
+
+		status = dp->status;
+
+		switch (status) {
+		case GTA_DL_PIPE_SELECTED:
+			break;					/* Only possible at the tail, see above */
 		case GTA_DL_PIPE_SENDING:	/* Partially sent already */
 			g_assert(dp->req != NULL);	/* Buffered request to flush */
+			g_assert(NULL == dp->next);	/* Nothing sent after it yet */
 			g_assert(NULL == d->req);	/* Was processing previous request */
 			g_assert(s->gdk_tag != 0);	/* Event: download_write_request() */
 			/* FALL THROUGH */
 		case GTA_DL_PIPE_SENT:		/* Fully sent already */
 			d->chunk = dp->chunk;	/* Struct copy */
 			d->flags &= ~DL_F_REPLIED;	/* Will be set if we get a reply */
+			d->flags |= DL_F_PIPELINED;	/* Suppress HTTP latency computation */
 			fi_src_info_changed(d);
 			if (GTA_DL_PIPE_SENDING == status) {
 				download_set_status(d, GTA_DL_REQ_SENDING);
@@ -13330,22 +13672,37 @@ download_send_request(struct download *d)
 			d->server->attrs |= DLS_A_PIPELINING;
 
 			/*
-			 * Before discarding the pipeline structure (because we're now
+			 * Before discarding the head of the pipeline (because we're now
 			 * going to process the reply to the pipelined request soon),
 			 * propagate back to the socket buffer any data that was sent by
 			 * the remote server after it completed the sending of the previous
 			 * chunk.
 			 *
-			 * A NULL pipeline structure will signal download_request_sent()
+			 * A NULL pipeline request will signal download_request_sent()
 			 * that it can parse the HTTP reply.
 			 */
 
 			download_pipeline_read(d);
-			download_pipeline_free_null(&d->pipeline);
+			download_pipeline_shift(d);
 			if (GTA_DL_PIPE_SENDING == status)
 				return;
-			else
-				goto fully_sent;
+
+			/*
+			 * If a request pipelined after this one is still being flushed,
+			 * we cannot start reading the reply until the I/O callback
+			 * is done: download_request_sent() will then wait for it.
+			 */
+
+			if (
+				download_pipelining(d) &&
+				GTA_DL_PIPE_SENDING == download_pipeline_last(d)->status
+			) {
+				g_assert(s->gdk_tag != 0);	/* download_write_request() */
+				download_set_status(d, GTA_DL_REQ_SENDING);
+				return;
+			}
+
+			goto fully_sent;
 		}
 
 		g_error("%s(): impossible state %d of HTTP pipelined "
@@ -13438,9 +13795,9 @@ picked:
 
 	d->last_update = tm_time();
 
-	if (download_pipelining(d)) {
+	if (pipelined != NULL) {
 		g_assert(DOWNLOAD_IS_ACTIVE(d));
-		d->pipeline->status = GTA_DL_PIPE_SENDING;
+		pipelined->status = GTA_DL_PIPE_SENDING;
 		fi_src_status_changed(d);
 	} else {
 		download_set_status(d, GTA_DL_REQ_SENDING);
@@ -13451,7 +13808,7 @@ picked:
 	 */
 
 	if ((DLS_A_FOOBAR & d->server->attrs) && 0 == d->served_reqs) {
-		g_assert(!download_pipelining(d));
+		g_assert(NULL == pipelined);
 		d->flags |= DL_F_PREFIX_HEAD;
 		method = "HEAD";
 	} else {
@@ -13488,7 +13845,7 @@ picked:
 	 */
 
 	if (rw >= MAX_LINE_SIZE) {
-		g_assert(!download_pipelining(d));	/* Can't happen if we pipeline */
+		g_assert(NULL == pipelined);	/* Can't happen if we pipeline */
 		download_stop(d, GTA_DL_ERROR, "URL too large");
 		return;
 	}
@@ -13612,7 +13969,7 @@ picked:
 				uint64_to_string(req->start - req->overlap));
 	}
 
-	if (!download_pipelining(d)) {
+	if (NULL == pipelined) {
 		fi_src_info_changed(d);		/* Now that we know d->chunk.end */
 	}
 
@@ -13793,13 +14150,13 @@ picked:
 		 */
 
 		g_message("partial HTTP %s write to %s: wrote %u out of %u bytes",
-			download_pipelining(d) ? "pipelined request" : "request",
+			pipelined != NULL ? "pipelined request" : "request",
 			host_addr_port_to_string(download_addr(d), download_port(d)),
 			(uint) sent, (uint) rw);
 
-		if (download_pipelining(d)) {
-			g_assert(NULL == d->pipeline->req);
-			d->pipeline->req = http_pmsg_alloc(request_buf, rw, sent);
+		if (pipelined != NULL) {
+			g_assert(NULL == pipelined->req);
+			pipelined->req = http_pmsg_alloc(request_buf, rw, sent);
 		} else {
 			g_assert(NULL == d->req);
 			d->req = http_pmsg_alloc(request_buf, rw, sent);
@@ -13815,7 +14172,7 @@ picked:
 		return;
 	} else if (GNET_PROPERTY(download_trace) & SOCK_TRACE_OUT) {
 		g_debug("----Sent Request (%s%s%s%s%s%s%s) to %s (%u bytes):",
-			download_pipelining(d) ? "pipelined " : "",
+			pipelined != NULL ? "pipelined " : "",
 			d->keep_alive ? "follow-up" : "initial",
 			(d->server->attrs & DLS_A_NO_HTTP_1_1) ? "" : ", HTTP/1.1",
 			(d->server->attrs & DLS_A_PUSH_IGN) ? ", ign-push" : "",
@@ -13830,7 +14187,7 @@ picked:
 	}
 
 fully_sent:
-	download_request_sent(d);
+	download_request_sent(d, pipelined);
 }
 
 /**
@@ -17045,14 +17402,16 @@ download_timer(time_t now)
 				GNET_PROPERTY(enable_http_pipelining) &&
 				download_pipeline_can_initiate(d)
 			) {
-				g_assert(!download_pipelining(d));
+				struct dl_pipeline *dp;
+				bool picked = TRUE;
+
 				g_assert(DOWNLOAD_IS_ACTIVE(d));
 
-				d->pipeline = download_pipeline_alloc();
+				dp = download_pipeline_append(d);
 
 				if (
 					NULL == d->ranges ||
-					!download_pick_available(d, &d->pipeline->chunk)
+					!download_pick_available(d, &dp->chunk)
 				) {
 					/*
 					 * File info code may determine that a download file is
@@ -17072,23 +17431,25 @@ download_timer(time_t now)
 					 * we'll get an updated range list from the server.
 					 */
 
-					if (!download_pick_chunk(d, &d->pipeline->chunk, FALSE)) {
+					if (!download_pick_chunk(d, &dp->chunk, FALSE)) {
 						d->flags |= DL_F_NO_PIPELINE;
-						download_pipeline_free_null(&d->pipeline);
+						picked = FALSE;
+						if (DOWNLOAD_IS_ACTIVE(d))
+							download_pipeline_cancel(d);	/* Not requeued */
 					}
 				}
 
 				if (DOWNLOAD_IS_ACTIVE(d)) {
-					if (download_pipelining(d)) {
+					if (picked)
 						download_send_request(d);
-					}
 				} else {
 					g_assert(!download_pipelining(d));
 					continue;		/* Was requeued */
 				}
 
 				g_assert(!download_pipelining(d) ||
-					d->pipeline->status != GTA_DL_PIPE_SELECTED);
+					download_pipeline_last(d)->status !=
+						GTA_DL_PIPE_SELECTED);
 			}
 
 			/* FALL THROUGH */
@@ -17143,8 +17504,10 @@ download_timer(time_t now)
 			}
 
 			if (delta_time(now, d->last_update) > timeout) {
-				if (DOWNLOAD_IS_ACTIVE(d))
+				if (DOWNLOAD_IS_ACTIVE(d)) {
 					d->data_timeouts++;
+					download_server_failed(d->server);
+				}
 
 				/*
 				 * When the 'timeout' has expired, first check whether the
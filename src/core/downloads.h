@@ -138,6 +138,7 @@ bool download_is_active(const struct download *);
 bool download_is_completed_filename(const char *name);
 
 bool download_sha1_is_rare(const struct sha1 *sha1);
+filesize_t download_pipeline_chunksize(const struct download *d);
 
 bool download_remove(struct download *d);
 void download_abort(struct download *d);
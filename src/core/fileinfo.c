@@ -69,10 +69,10 @@
 #include "lib/ascii.h"
 #include "lib/atoms.h"
 #include "lib/base32.h"
+#include "lib/chunkset.h"
 #include "lib/concat.h"
 #include "lib/crash.h"
 #include "lib/cstr.h"
-#include "lib/eclist.h"
 #include "lib/endian.h"
 #include "lib/entropy.h"
 #include "lib/fd.h"
@@ -93,7 +93,6 @@
 #include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
-#include "lib/rbtree.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
 #include "lib/tigertree.h"
@@ -136,17 +135,18 @@ enum dl_file_chunk_magic { DL_FILE_CHUNK_MAGIC = 0x563b483d };
 /**
  * Download file chunks.
  *
- * These are linked to form the chunklist, the list of all the chunks defined
- * for the file and which are either completed, reserved, or empty (not yet
- * downloaded).
+ * These form the chunklist, the set of all the chunks defined for the file
+ * and which are either completed, reserved, or empty (not yet downloaded).
+ *
+ * The chunklist is a chunk set, indexing the chunks by file offset and
+ * keeping track of the empty ones, the "holes", so that we do not have to
+ * linearily scan it to locate a position or find something to download.
  */
 struct dl_file_chunk {
 	enum dl_file_chunk_magic magic;
 	enum dl_chunk_status status;	/**< Status of range */
-	filesize_t from;				/**< Range offset start (byte included) */
-	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
 	const download_t *download;		/**< Download which "reserved" range */
-	slink_t lk;						/**< Embedded one-way link */
+	chunk_t range;					/**< Range, hole if status is EMPTY */
 };
 
 static inline void
@@ -156,29 +156,6 @@ dl_file_chunk_check(const struct dl_file_chunk * const fc)
 	g_assert(DL_FILE_CHUNK_MAGIC == fc->magic);
 }
 
-enum dl_avail_chunk_magic { DL_AVAIL_CHUNK_MAGIC = 0x3e69cf33 };
-
-/**
- * Available chunks.
- *
- * For each chunk of the file, we compute the amount of sources that can
- * serve the chunk, allowing us to pick the rarest chunk when downloading.
- */
-struct dl_avail_chunk {
-	enum dl_avail_chunk_magic magic;
-	filesize_t from;				/**< Range offset start (byte included) */
-	filesize_t to;					/**< Range offset end (byte EXCLUDED) */
-	size_t sources;					/**< Amount of sources offering chunk */
-	slink_t lk;						/**< Embedded one-way link */
-};
-
-static inline void
-dl_avail_chunk_check(const struct dl_avail_chunk * const ac)
-{
-	g_assert(ac != NULL);
-	g_assert(DL_AVAIL_CHUNK_MAGIC == ac->magic);
-}
-
 /*
  * File information is uniquely describing an output file in the download
  * directory.  There is a many-to-one relationship between downloads and
@@ -213,7 +190,10 @@ static hikset_t *fi_by_guid;
 
 static const char file_info_file[] = "fileinfo";
 static const char file_info_what[] = "fileinfo database";
+static const char file_info_journal_file[] = "fileinfo.journal";
 static bool fileinfo_dirty = FALSE;
+static hikset_t *fi_journal_pending;	/**< Entries to append to journal */
+static filesize_t fi_journal_size;		/**< Current journal file size */
 static bool can_swarm = FALSE;		/**< Set by file_info_retrieve() */
 static bool can_publish_partial_sha1;
 
@@ -242,6 +222,23 @@ enum dl_file_info_field {
 #define FI_STORE_DELAY		60	/**< Max delay (secs) for flushing fileinfo */
 #define FI_TRAILER_INT		6	/**< Amount of uint32 in the trailer */
 
+/*
+ * The "fileinfo" text database is a snapshot, only rewritten when entries are
+ * added, removed or structurally changed.  In-between snapshots, the changing
+ * state of each entry (chunks, progress, generation) is appended to a binary
+ * journal as self-contained per-fileinfo records, so that periodic saves are
+ * proportional to what changed.  The journal is replayed on startup and gets
+ * compacted (folded into a new snapshot) once it grows past FI_JOURNAL_MAX.
+ *
+ * Each record is: magic, payload length, payload, payload checksum.
+ * A torn or corrupted record ends the replay.
+ */
+#define FI_JOURNAL_MAGIC	0x464A524EU		/**< "FJRN" */
+#define FI_JOURNAL_MAX		(1024 * 1024)	/**< Compaction threshold */
+
+#define FI_JOURNAL_F_PAUSED	(1U << 0)	/**< Download was paused */
+#define FI_JOURNAL_F_CHA1	(1U << 1)	/**< Computed SHA1 follows */
+
 /**
  * Update the minimum download chunksize.
  *
@@ -675,38 +672,341 @@ dl_file_chunk_free(struct dl_file_chunk **fc_ptr)
 	}
 }
 
-static struct dl_avail_chunk *
-dl_avail_chunk_alloc(void)
+/*
+ * Source availability.
+ *
+ * To pick the rarest chunks first, the file is cut into at most
+ * FI_AVAIL_SLICES slices and we count, for each slice, the amount of partial
+ * sources offering it entirely.  Sources offering the whole file are only
+ * counted globally.
+ *
+ * Each partial source remembers, in a bitmap, the slices for which it was
+ * counted, so that its contribution can be withdrawn when its ranges change
+ * or when it goes away, without having to recompute everything from the
+ * ranges of all the other sources.
+ */
+
+#define FI_AVAIL_SLICES		4096	/**< Maximum amount of slices per file */
+#define FI_AVAIL_MIN_SHIFT	16		/**< Slices are at least 64 KiB long */
+
+/**
+ * Allocate the slice counters for the file.
+ */
+static void
+fi_avail_setup(fileinfo_t *fi)
 {
-	struct dl_avail_chunk *ac;
+	uint8 shift = FI_AVAIL_MIN_SHIFT;
 
-	WALLOC0(ac);
-	ac->magic = DL_AVAIL_CHUNK_MAGIC;
-	return ac;
+	g_assert(NULL == fi->avail);
+	g_assert(fi->size != 0);
+
+	while ((fi->size - 1) >> shift >= FI_AVAIL_SLICES)
+		shift++;
+
+	fi->avail_shift = shift;
+	fi->avail_slices = ((fi->size - 1) >> shift) + 1;
+	HALLOC0_ARRAY(fi->avail, fi->avail_slices);
 }
 
-static struct dl_avail_chunk *
-dl_avail_chunk_new(filesize_t from, filesize_t to, size_t sources)
+/**
+ * Withdraw the contribution of source `d' from the availability counts.
+ */
+static void
+fi_avail_uncount(fileinfo_t *fi, download_t *d)
 {
-	struct dl_avail_chunk *ac;
+	if (d->avail_whole) {
+		g_assert(fi->avail_whole > 0);
+		fi->avail_whole--;
+		d->avail_whole = FALSE;
+	}
 
-	g_assert(from < to);
-	g_assert(size_is_positive(sources));
+	if (d->avail != NULL) {
+		size_t i;
+
+		g_assert(fi->avail != NULL);
+		g_assert(fi->avail_partial > 0);
+
+		for (i = 0; i < fi->avail_slices; i++) {
+			if (bit_array_get(d->avail, i)) {
+				g_assert(fi->avail[i] > 0);
+				fi->avail[i]--;
+			}
+		}
+
+		fi->avail_partial--;
+		HFREE_NULL(d->avail);
+	}
+}
+
+/**
+ * Count the slices offered by source `d' in the availability counts.
+ */
+static void
+fi_avail_count(fileinfo_t *fi, download_t *d)
+{
+	const http_range_t *r;
+	filesize_t mask;
+	size_t n = 0;
+
+	g_assert(NULL == d->avail);
+	g_assert(!d->avail_whole);
+
+	if (!fi->file_size_known || 0 == fi->size)
+		return;
+
+	if (!fi->use_swarming || !(d->flags & DL_F_PARTIAL)) {
+		d->avail_whole = TRUE;
+		fi->avail_whole++;
+		return;
+	}
+
+	if (NULL == d->ranges)
+		return;		/* Partial file with no known ranges, ignore */
+
+	if (NULL == fi->avail)
+		fi_avail_setup(fi);
+
+	bit_array_resize(&d->avail, 0, fi->avail_slices);
+	mask = ((filesize_t) 1 << fi->avail_shift) - 1;
+
+	HTTP_RANGE_FOREACH(d->ranges, r) {
+		filesize_t end = MIN(r->end + 1, fi->size);
+		size_t i, last;
+
+		/*
+		 * Only count slices entirely covered by the range.  The last
+		 * slice of the file can be shorter than the others.
+		 */
+
+		i = (r->start + mask) >> fi->avail_shift;
+		last = fi->size == end ? fi->avail_slices : end >> fi->avail_shift;
+
+		for (/* empty */; i < last; i++) {
+			if (!bit_array_get(d->avail, i)) {
+				bit_array_set(d->avail, i);
+				fi->avail[i]++;
+				n++;
+			}
+		}
+	}
+
+	if (0 == n)
+		HFREE_NULL(d->avail);
+	else
+		fi->avail_partial++;
+}
+
+/**
+ * Recount the contribution of source `d', whose ranges changed.
+ */
+static void
+fi_avail_update(fileinfo_t *fi, download_t *d)
+{
+	fi_avail_uncount(fi, d);
+	fi_avail_count(fi, d);
+}
+
+/**
+ * Discard all the availability information.
+ */
+static void
+fi_avail_free(fileinfo_t *fi)
+{
+	pslist_t *sl;
+
+	PSLIST_FOREACH(fi->sources, sl) {
+		fi_avail_uncount(fi, sl->data);
+	}
+
+	g_assert(0 == fi->avail_whole);
+	g_assert(0 == fi->avail_partial);
+
+	HFREE_NULL(fi->avail);
+	fi->avail_slices = 0;
+}
+
+/**
+ * Recompute availability information from scratch, when the size of the
+ * file changes since slices are then no longer meaningful.
+ */
+static void
+fi_avail_reset(fileinfo_t *fi)
+{
+	pslist_t *sl;
+
+	fi_avail_free(fi);
+
+	PSLIST_FOREACH(fi->sources, sl) {
+		fi_avail_count(fi, sl->data);
+	}
+}
+
+/**
+ * Append chunk at the tail of the chunklist.
+ */
+static void
+fi_chunk_append(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	dl_file_chunk_check(fc);
+
+	fc->range.hole = DL_CHUNK_EMPTY == fc->status;
+	chunkset_append(&fi->chunks, fc);
+}
+
+/**
+ * Remove the chunk following `fc' in the chunklist.
+ *
+ * @return the removed chunk, which the caller must free.
+ */
+static inline struct dl_file_chunk *
+fi_chunk_remove_after(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	return chunkset_remove_after(&fi->chunks, fc);
+}
+
+/**
+ * Change the status of a chunk from the chunklist.
+ *
+ * This must be used instead of a plain assignment to keep the "holes"
+ * index in sync.
+ */
+static void
+fi_chunk_set_status(fileinfo_t *fi,
+	struct dl_file_chunk *fc, enum dl_chunk_status status)
+{
+	dl_file_chunk_check(fc);
+
+	chunkset_set_hole(&fi->chunks, fc, DL_CHUNK_EMPTY == status);
+	fc->status = status;
+}
+
+/**
+ * @return the chunk containing the byte at offset `pos', NULL if none.
+ */
+static inline struct dl_file_chunk *
+fi_chunk_lookup(const fileinfo_t *fi, filesize_t pos)
+{
+	return chunkset_lookup(&fi->chunks, pos);
+}
+
+/**
+ * @return the chunk following `fc' in the chunklist, NULL if none.
+ */
+static inline struct dl_file_chunk *
+fi_chunk_next(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	return chunkset_next(&fi->chunks, fc);
+}
+
+/**
+ * @return the first empty chunk at or after `fc', NULL if none.
+ */
+static const struct dl_file_chunk *
+fi_hole_from(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	/*
+	 * Chunk pickers return either an empty chunk or the head of the
+	 * chunklist, so we normally do not have to iterate here.
+	 */
+
+	while (fc != NULL && DL_CHUNK_EMPTY != fc->status) {
+		if (fc == chunkset_head(&fi->chunks))
+			return chunkset_hole_first(&fi->chunks);
+		fc = fi_chunk_next(fi, fc);
+	}
+
+	return fc;
+}
+
+/**
+ * @return the empty chunk following `fc' in the "holes" index, NULL if none.
+ */
+static inline const struct dl_file_chunk *
+fi_hole_next(const fileinfo_t *fi, const struct dl_file_chunk *fc)
+{
+	g_assert(DL_CHUNK_EMPTY == fc->status);
+
+	return chunkset_hole_next(&fi->chunks, fc);
+}
+
+/**
+ * Split chunk at the given offset.
+ *
+ * The chunk [from, to[ becomes [from, offset[ and a new chunk [offset, to[
+ * bearing the same status and owner is inserted right after it.
+ *
+ * @return the new upper chunk.
+ */
+static struct dl_file_chunk *
+fi_chunk_split(fileinfo_t *fi, struct dl_file_chunk *fc, filesize_t offset)
+{
+	struct dl_file_chunk *nfc;
+
+	dl_file_chunk_check(fc);
+	g_assert(offset > fc->range.from && offset < fc->range.to);
+
+	nfc = dl_file_chunk_alloc();
+	nfc->status = fc->status;
+	nfc->download = fc->download;
+
+	chunkset_split(&fi->chunks, fc, offset, nfc);
+
+	return nfc;
+}
+
+/**
+ * Merge the chunk following `fc' into `fc'.
+ */
+static void
+fi_chunk_merge_next(fileinfo_t *fi, struct dl_file_chunk *fc)
+{
+	struct dl_file_chunk *nfc;
 
-	ac = dl_avail_chunk_alloc();
-	ac->from = from;
-	ac->to = to;
-	ac->sources = sources;
-	return ac;
+	nfc = chunkset_merge_next(&fi->chunks, fc);
+	g_assert(fc->status == nfc->status);
+
+	dl_file_chunk_free(&nfc);
+}
+
+/**
+ * Can two adjacent chunks be merged?
+ *
+ * Never merge adjacent busy chunks: they correspond to reserved parts of
+ * the file that will be served by different HTTP requests.
+ */
+static inline bool
+fi_chunk_mergeable(const struct dl_file_chunk *fc1,
+	const struct dl_file_chunk *fc2)
+{
+	return fc1->status == fc2->status && DL_CHUNK_BUSY != fc2->status;
 }
 
+/**
+ * Merge adjacent chunks sharing the same status, locally around [from, to[.
+ *
+ * This is the local version of file_info_merge_adjacent(), used after the
+ * status of the range was changed: only the chunks overlapping the range and
+ * their immediate neighbours can need merging when the list was already tidy.
+ * Contrary to file_info_merge_adjacent(), fi->done is not recomputed.
+ */
 static void
-dl_avail_chunk_free(void *p)
+fi_chunk_coalesce(fileinfo_t *fi, filesize_t from, filesize_t to)
 {
-	struct dl_avail_chunk *ac = p;
-	dl_avail_chunk_check(ac);
-	ac->magic = 0;
-	WFREE(ac);
+	struct dl_file_chunk *fc;
+
+	fc = fi_chunk_lookup(fi, 0 == from ? 0 : from - 1);
+
+	while (fc != NULL && fc->range.from < to) {
+		struct dl_file_chunk *next = fi_chunk_next(fi, fc);
+
+		if (DL_CHUNK_DONE == fc->status)
+			fc->download = NULL;			/* Done, no longer reserved */
+
+		if (next != NULL && fi_chunk_mergeable(fc, next))
+			fi_chunk_merge_next(fi, fc);	/* Stay on `fc', it grew */
+		else
+			fc = next;
+	}
 }
 
 /**
@@ -731,7 +1031,6 @@ static bool
 file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 {
 	const struct dl_file_chunk *fc;
-	filesize_t last = 0;
 
 	/*
 	 * This routine ends up being a CPU hog when all the asserts using it
@@ -743,22 +1042,45 @@ file_info_check_chunklist(const fileinfo_t *fi, bool assertion)
 
 	file_info_check(fi);
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	if (!chunkset_check(&fi->chunks))
+		return FALSE;
+
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		dl_file_chunk_check(fc);
-		if (last != fc->from || fc->from >= fc->to)
+		if (fc->range.hole != (DL_CHUNK_EMPTY == fc->status))
 			return FALSE;
 
-		last = fc->to;
 		if (!fi->file_size_known || 0 == fi->size)
 			continue;
 
-		if (fc->from >= fi->size || fc->to > fi->size)
+		if (fc->range.from >= fi->size || fc->range.to > fi->size)
 			return FALSE;
 	}
 
 	return TRUE;
 }
 
+/**
+ * Record that the persisted state of `fi' changed and needs to be appended
+ * to the fileinfo journal at the next flush.
+ */
+static void
+fi_journal_record(fileinfo_t *fi)
+{
+	file_info_check(fi);
+
+	/*
+	 * Entries not hashed yet will be part of the next snapshot anyway,
+	 * since file_info_hash_insert() marks the database as dirty.
+	 */
+
+	if (!fi->hashed || (FI_F_TRANSIENT & fi->flags))
+		return;
+
+	if (!hikset_contains(fi_journal_pending, fi->guid))
+		hikset_insert_key(fi_journal_pending, &fi->guid);
+}
+
 /**
  * Store a binary record of the file metainformation at the end of the
  * supplied file descriptor, opened for writing.
@@ -770,7 +1092,7 @@ static void
 file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 {
 	const pslist_t *sl;
-	const slink_t *cl;
+	const struct dl_file_chunk *fc;
 	uint32 checksum = 0;
 	uint32 length;
 
@@ -822,19 +1144,18 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, cl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		uint32 from_hi, to_hi;
 		uint32 chunk[5];
 
 		dl_file_chunk_check(fc);
-		from_hi = (uint64) fc->from >> 32;
-		to_hi = (uint64) fc->to >> 32;
+		from_hi = (uint64) fc->range.from >> 32;
+		to_hi = (uint64) fc->range.to >> 32;
 
 		chunk[0] = htonl(from_hi),
-		chunk[1] = htonl((uint32) fc->from),
+		chunk[1] = htonl((uint32) fc->range.from),
 		chunk[2] = htonl(to_hi),
-		chunk[3] = htonl((uint32) fc->to),
+		chunk[3] = htonl((uint32) fc->range.to),
 		chunk[4] = htonl(fc->status);
 		FIELD_ADD(FILE_INFO_FIELD_CHUNK, sizeof chunk, chunk, &checksum);
 	}
@@ -863,7 +1184,7 @@ file_info_fd_store_binary(fileinfo_t *fi, const file_object_t *fo)
 	}
 
 	fi->dirty = FALSE;
-	fileinfo_dirty = TRUE;
+	fi_journal_record(fi);
 
 	entropy_harvest_time();
 }
@@ -922,6 +1243,7 @@ file_info_got_tth_internal(fileinfo_t *fi, const struct tth *tth, bool update)
 	g_return_if_fail(tth);
 	g_return_if_fail(NULL == fi->tth);
 	fi->tth = atom_tth_get(tth);
+	fileinfo_dirty = TRUE;
 
 	/* Update the GUI, if requested */
 	if (update)
@@ -1133,22 +1455,7 @@ file_info_chunklist_free(fileinfo_t *fi)
 {
 	file_info_check(fi);
 
-	eslist_wfree(&fi->chunklist, sizeof(struct dl_file_chunk));
-}
-
-/**
- * Frees the chunklist and all its elements of a fileinfo struct. Note that
- * the consistency of the list isn't checked to explicitely allow freeing
- * inconsistent chunklists.
- *
- * @param fi the fileinfo struct.
- */
-static void
-file_info_available_free(fileinfo_t *fi)
-{
-	file_info_check(fi);
-
-	eslist_wfree(&fi->available, sizeof(struct dl_avail_chunk));
+	chunkset_wfree(&fi->chunks, sizeof(struct dl_file_chunk));
 }
 
 /**
@@ -1161,7 +1468,7 @@ fi_downloading_free(fileinfo_t *fi)
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
 	file_info_chunklist_free(fi);
-	file_info_available_free(fi);
+	fi_avail_free(fi);
 
 	http_rangeset_free_null(&fi->seen_on_network);
 	fi_tigertree_free(fi);
@@ -1303,10 +1610,10 @@ fi_extend_chunklist(fileinfo_t *fi, filesize_t size)
 	g_assert(fi->size < size);
 
 	fc = dl_file_chunk_alloc();
-	fc->from = fi->size;
-	fc->to = size;
+	fc->range.from = fi->size;
+	fc->range.to = size;
 	fc->status = DL_CHUNK_EMPTY;
-	eslist_append(&fi->chunklist, fc);
+	fi_chunk_append(fi, fc);
 
 	/*
 	 * Don't remove/re-insert `fi' from hash tables: when this routine is
@@ -1383,6 +1690,7 @@ fi_alias(fileinfo_t *fi, const char *name, bool record)
 		fi->alias = pslist_append_const(fi->alias, atom_str_get(name));
 
 		if (record) {
+			fileinfo_dirty = TRUE;
 			if (NULL != list) {
 				pslist_append(list, fi);
 			} else {
@@ -1909,8 +2217,7 @@ file_info_allocate(void)
 
 	WALLOC0(fi);
 	fi->magic = FI_MAGIC;
-	eslist_init(&fi->chunklist, offsetof(struct dl_file_chunk, lk));
-	eslist_init(&fi->available, offsetof(struct dl_avail_chunk, lk));
+	chunkset_init(&fi->chunks, offsetof(struct dl_file_chunk, range));
 
 	return fi;
 }
@@ -2147,12 +2454,12 @@ G_STMT_START {				\
 			 	 	 */
 
 			   		if (1 == version) {
-						fc->from = tmpchunk[0];
-						fc->to = tmpchunk[1];
+						fc->range.from = tmpchunk[0];
+						fc->range.to = tmpchunk[1];
 						fc->status = tmpchunk[2];
 					} else {
-						fc->from = ntohl(tmpchunk[0]);
-						fc->to = ntohl(tmpchunk[1]);
+						fc->range.from = ntohl(tmpchunk[0]);
+						fc->range.to = ntohl(tmpchunk[1]);
 						fc->status = ntohl(tmpchunk[2]);
 					}
 				} else {
@@ -2161,17 +2468,38 @@ G_STMT_START {				\
 					g_assert(version >= 6);
 					hi = ntohl(tmpchunk[0]);
 					lo = ntohl(tmpchunk[1]);
-					fc->from = UINT64_VALUE(hi, lo);
+					fc->range.from = UINT64_VALUE(hi, lo);
 					hi = ntohl(tmpchunk[2]);
 					lo = ntohl(tmpchunk[3]);
-					fc->to = UINT64_VALUE(hi, lo);
+					fc->range.to = UINT64_VALUE(hi, lo);
 					fc->status = ntohl(tmpchunk[4]);
 				}
 
 				if (DL_CHUNK_BUSY == fc->status)
 					fc->status = DL_CHUNK_EMPTY;
 
-				eslist_append(&fi->chunklist, fc);
+				/*
+				 * Chunks are indexed as we append them, so make sure
+				 * they are contiguous: the chunktree cannot hold
+				 * overlapping chunks.
+				 */
+
+				{
+					const struct dl_file_chunk *prev;
+
+					prev = chunkset_tail(&fi->chunks);
+					if (
+						fc->range.from >= fc->range.to ||
+						fc->range.from != (NULL == prev ? 0 : prev->range.to)
+					) {
+						dl_file_chunk_free(&fc);
+						file_info_chunklist_free(fi);
+						BAILOUT("File contains inconsistent chunk list");
+						/* NOT REACHED */
+					}
+				}
+
+				fi_chunk_append(fi, fc);
 			}
 			break;
 		default:
@@ -2263,7 +2591,7 @@ eof:
 static void
 file_info_store_one(FILE *f, fileinfo_t *fi)
 {
-	slink_t *cl;
+	const struct dl_file_chunk *fc;
 	pslist_t *sl;
 	char *path;
 
@@ -2368,13 +2696,12 @@ persist:
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, cl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, cl);
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 
 		dl_file_chunk_check(fc);
 		fprintf(f, "CHNK %s %s %u\n",
-			filesize_to_string(fc->from), filesize_to_string2(fc->to),
-			(uint) fc->status);
+			filesize_to_string(fc->range.from),
+			filesize_to_string2(fc->range.to), (uint) fc->status);
 	}
 	fprintf(f, "\n");
 }
@@ -2392,63 +2719,238 @@ file_info_store_list(void *value, void *user_data)
 }
 
 /**
- * Stores the list of output files and their metainfo to the
- * configdir/fileinfo database.
+ * Fill the trailer buffer with a journal record describing the current
+ * state of `fi'.
  */
-void
-file_info_store(void)
+static void
+file_info_journal_fill(const fileinfo_t *fi)
 {
-	FILE *f;
-	file_path_t fp;
+	const struct dl_file_chunk *fc;
+	uint32 checksum = 0;
+	uint32 flags = 0;
+	size_t length;
 
-	file_path_set(&fp, settings_config_dir(), file_info_file);
-	f = file_config_open_write(file_info_what, &fp);
+	file_info_check(fi);
 
-	if (!f)
-		return;
+	length = GUID_RAW_SIZE + 9 * sizeof(uint32) +
+		chunkset_count(&fi->chunks) * 5 * sizeof(uint32);
 
-	file_config_preamble(f, "Fileinfo database");
+	if (FI_F_PAUSED & fi->flags)
+		flags |= FI_JOURNAL_F_PAUSED;
 
-	fputs(
-		"#\n"
-		"# Format is:\n"
-		"#	NAME <file name>\n"
-		"#	PATH <path>\n"
-		"#	GUID <file ID>\n"
-		"#	GENR <generation number>\n"
-		"#	ALIA <alias file name>\n"
-		"#	SIZE <size>\n"
-		"#	SHA1 <server sha1>\n"
-		"#	TTH  <server tth>\n"
-		"#	CHA1 <computed sha1> [when done only]\n"
-		"#	DONE <bytes done>\n"
-		"#	TIME <last update stamp>\n"
-		"#	CTIM <entry creation time>\n"
-		"#	NTIM <time when new source was seen>\n"
-		"#	PAUS <boolean; paused> [when TRUE only]\n"
-		"#	SEED <boolean; file seeded> [when TRUE only]\n"
-		"#	FSKN <boolean; file_size_known> [when FALSE only]\n"
-		"#	SWRM <boolean; use_swarming> [when FALSE only]\n"
-		"#	CHNK <start> <end+1> <0=hole, 1=busy, 2=done>\n"
-		"#	<blank line>\n"
+	if (fi->cha1 != NULL) {
+		flags |= FI_JOURNAL_F_CHA1;
+		length += SHA1_RAW_SIZE;
+	}
+
+	g_assert(length <= MAX_INT_VAL(uint32));
+
+	TBUF_INIT_WRITE();
+	TBUF_PUT_UINT32(htonl(FI_JOURNAL_MAGIC));
+	TBUF_PUT_UINT32(htonl(length));
+
+	WRITE_STR((const char *) fi->guid, GUID_RAW_SIZE, &checksum);
+	WRITE_UINT32(fi->generation, &checksum);
+	WRITE_UINT32((uint64) fi->size >> 32, &checksum);
+	WRITE_UINT32(fi->size, &checksum);
+	WRITE_UINT32((uint64) fi->done >> 32, &checksum);
+	WRITE_UINT32(fi->done, &checksum);
+	WRITE_UINT32(fi->stamp, &checksum);
+	WRITE_UINT32(fi->ntime, &checksum);
+	WRITE_UINT32(flags, &checksum);
+
+	if (fi->cha1 != NULL)
+		WRITE_STR((const char *) fi->cha1, SHA1_RAW_SIZE, &checksum);
+
+	WRITE_UINT32(chunkset_count(&fi->chunks), &checksum);
+
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
+
+		dl_file_chunk_check(fc);
+		WRITE_UINT32((uint64) fc->range.from >> 32, &checksum);
+		WRITE_UINT32(fc->range.from, &checksum);
+		WRITE_UINT32((uint64) fc->range.to >> 32, &checksum);
+		WRITE_UINT32(fc->range.to, &checksum);
+		WRITE_UINT32(fc->status, &checksum);
+	}
+
+	g_assert(TBUF_WRITTEN_LEN() == length + 2 * sizeof(uint32));
+
+	TBUF_PUT_UINT32(htonl(checksum));
+}
+
+struct fi_journal_ctx {
+	const char *path;		/**< Journal pathname, for logging */
+	int fd;					/**< Journal file, opened for appending */
+	bool ok;				/**< Whether all the writes succeeded */
+};
+
+/**
+ * hikset_foreach_remove() callback to append the pending entry to the
+ * journal, removing it from the set when successfully written.
+ */
+static bool
+file_info_journal_append(void *value, void *data)
+{
+	fileinfo_t *fi = value;
+	struct fi_journal_ctx *ctx = data;
+	size_t len;
+	ssize_t r;
+
+	file_info_check(fi);
+
+	if (!ctx->ok)
+		return FALSE;		/* Keep entry, will be part of next snapshot */
+
+	file_info_journal_fill(fi);
+	len = TBUF_WRITTEN_LEN();
+	r = write(ctx->fd, tbuf.arena, len);
+
+	if ((ssize_t) -1 == r) {
+		g_warning("%s(): cannot append to \"%s\": %m", G_STRFUNC, ctx->path);
+		ctx->ok = FALSE;
+		return FALSE;
+	} else if ((size_t) r != len) {
+		g_warning("%s(): partial write to \"%s\"", G_STRFUNC, ctx->path);
+		ctx->ok = FALSE;
+	}
+
+	fi_journal_size += r;
+	return TRUE;
+}
+
+/**
+ * Append the state of all the entries changed since the last flush to
+ * the fileinfo journal.
+ *
+ * @return TRUE if all the records were written.
+ */
+static bool
+file_info_journal_flush(void)
+{
+	struct fi_journal_ctx ctx;
+	char *path;
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+
+	ctx.path = path;
+	ctx.ok = TRUE;
+	ctx.fd = file_create(path, O_WRONLY | O_APPEND, S_IRUSR | S_IWUSR);
+
+	if (-1 == ctx.fd) {
+		ctx.ok = FALSE;
+	} else {
+		hikset_foreach_remove(fi_journal_pending,
+			file_info_journal_append, &ctx);
+		fd_close(&ctx.fd);
+	}
+
+	if (GNET_PROPERTY(fileinfo_debug) > 1) {
+		g_debug("FILEINFO journal now %s bytes%s",
+			filesize_to_string(fi_journal_size),
+			ctx.ok ? "" : " (write error)");
+	}
+
+	HFREE_NULL(path);
+	return ctx.ok;
+}
+
+/**
+ * Discard the fileinfo journal, once a new snapshot has been written.
+ */
+static void
+file_info_journal_clear(void)
+{
+	char *path;
+
+	hikset_clear(fi_journal_pending);
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+
+	/*
+	 * Should we fail to unlink the journal, its records will carry a
+	 * generation number that is not newer than the snapshot and will
+	 * therefore be ignored at replay time.
+	 */
+
+	if (-1 == unlink(path) && ENOENT != errno)
+		g_warning("%s(): cannot unlink \"%s\": %m", G_STRFUNC, path);
+	else
+		fi_journal_size = 0;
+
+	HFREE_NULL(path);
+}
+
+/**
+ * Stores the list of output files and their metainfo to the
+ * configdir/fileinfo database.
+ *
+ * This writes a full snapshot, superseding the journal.
+ */
+void
+file_info_store(void)
+{
+	FILE *f;
+	file_path_t fp;
+
+	file_path_set(&fp, settings_config_dir(), file_info_file);
+	f = file_config_open_write(file_info_what, &fp);
+
+	if (!f)
+		return;
+
+	file_config_preamble(f, "Fileinfo database");
+
+	fputs(
+		"#\n"
+		"# Format is:\n"
+		"#	NAME <file name>\n"
+		"#	PATH <path>\n"
+		"#	GUID <file ID>\n"
+		"#	GENR <generation number>\n"
+		"#	ALIA <alias file name>\n"
+		"#	SIZE <size>\n"
+		"#	SHA1 <server sha1>\n"
+		"#	TTH  <server tth>\n"
+		"#	CHA1 <computed sha1> [when done only]\n"
+		"#	DONE <bytes done>\n"
+		"#	TIME <last update stamp>\n"
+		"#	CTIM <entry creation time>\n"
+		"#	NTIM <time when new source was seen>\n"
+		"#	PAUS <boolean; paused> [when TRUE only]\n"
+		"#	SEED <boolean; file seeded> [when TRUE only]\n"
+		"#	FSKN <boolean; file_size_known> [when FALSE only]\n"
+		"#	SWRM <boolean; use_swarming> [when FALSE only]\n"
+		"#	CHNK <start> <end+1> <0=hole, 1=busy, 2=done>\n"
+		"#	<blank line>\n"
 		"#\n\n",
 		f
 	);
 
 	hikset_foreach(fi_by_outname, file_info_store_list, f);
 
-	file_config_close(f, &fp);
+	if (file_config_close(f, &fp))
+		file_info_journal_clear();
+
 	fileinfo_dirty = FALSE;
 }
 
 /**
  * Store global file information cache if dirty.
+ *
+ * When only the state of some entries changed, it is appended to the journal
+ * instead of rewriting the whole database.  A new snapshot is written once
+ * the journal grows too large.
  */
 void
 file_info_store_if_dirty(void)
 {
-	if (fileinfo_dirty)
+	if (fileinfo_dirty || fi_journal_size >= FI_JOURNAL_MAX) {
 		file_info_store();
+	} else if (0 != hikset_count(fi_journal_pending)) {
+		if (!file_info_journal_flush())
+			fileinfo_dirty = TRUE;		/* Will write snapshot next time */
+	}
 }
 
 /*
@@ -2649,6 +3151,7 @@ file_info_close(void)
 	htable_free_null(&fi_by_namesize);
 	hikset_free_null(&fi_by_guid);
 	hikset_free_null(&fi_by_outname);
+	hikset_free_null(&fi_journal_pending);
 
 	HFREE_NULL(tbuf.arena);
 }
@@ -2725,6 +3228,8 @@ file_info_hash_insert(fileinfo_t *fi)
 		file_info_hash_insert_name_size(fi);
 	}
 
+	fileinfo_dirty = TRUE;		/* New entry needs to be in the snapshot */
+
 transient:
 	/*
 	 * Obviously, GUID entries must be unique as well.
@@ -2799,7 +3304,10 @@ file_info_hash_remove(fileinfo_t *fi)
 	if (fi->file_size_known)
 		file_info_hash_remove_name_size(fi);
 
+	fileinfo_dirty = TRUE;		/* Entry must go from the snapshot */
+
 transient:
+	hikset_remove(fi_journal_pending, fi->guid);
 	hikset_remove(fi_by_guid, fi->guid);
 
 	fi->hashed = FALSE;
@@ -2951,6 +3459,7 @@ file_info_got_sha1(fileinfo_t *fi, const struct sha1 *sha1)
 	if (NULL == xfi) {
 		fi->sha1 = atom_sha1_get(sha1);
 		hikset_insert_key(fi_by_sha1, &fi->sha1);
+		fileinfo_dirty = TRUE;
 
 		if (can_publish_partial_sha1)
 			publisher_add(fi->sha1);
@@ -3005,6 +3514,7 @@ file_info_got_sha1(fileinfo_t *fi, const struct sha1 *sha1)
 		fi->sha1 = atom_sha1_get(sha1);
 		file_info_reparent_all(xfi, fi);	/* All `xfi' replaced by `fi' */
 		hikset_insert_key(fi_by_sha1, &fi->sha1);
+		fileinfo_dirty = TRUE;
 	} else {
 		g_assert(0 == fi->done);
 		file_info_reparent_all(fi, xfi);	/* All `fi' replaced by `xfi' */
@@ -3135,10 +3645,10 @@ fi_reset_chunks(fileinfo_t *fi)
 
 		file_info_chunklist_free(fi);
 		fc = dl_file_chunk_alloc();
-		fc->from = 0;
-		fc->to = fi->size;
+		fc->range.from = 0;
+		fc->range.to = fi->size;
 		fc->status = DL_CHUNK_EMPTY;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->generation = 0;		/* Restarting from scratch... */
@@ -3156,25 +3666,366 @@ fi_copy_chunks(fileinfo_t *fi, fileinfo_t *trailer)
 
 	file_info_check(fi);
 	file_info_check(trailer);
-	g_assert(0 == eslist_count(&fi->chunklist));
+	g_assert(0 == chunkset_count(&fi->chunks));
 	g_assert(file_info_check_chunklist(trailer, TRUE));
 
 	fi->generation = trailer->generation;
 	if (trailer->cha1)
 		fi->cha1 = atom_sha1_get(trailer->cha1);
 
-	ESLIST_FOREACH_DATA(&trailer->chunklist, fc) {
+	CHUNKSET_FOREACH(&trailer->chunks, fc) {
+		struct dl_file_chunk *nfc;
+
 		dl_file_chunk_check(fc);
-		g_assert(fc->from <= fc->to);
+		g_assert(fc->range.from <= fc->range.to);
 
-		eslist_append(&fi->chunklist, WCOPY(fc));
+		nfc = dl_file_chunk_alloc();	/* Embedded links must be cleared */
+		nfc->range.from = fc->range.from;
+		nfc->range.to = fc->range.to;
+		nfc->status = fc->status;
+		nfc->download = fc->download;
+		fi_chunk_append(fi, nfc);
 	}
 
 	file_info_merge_adjacent(fi); /* Recalculates also fi->done */
 }
 
+/**
+ * A journaled chunk.
+ */
+struct fi_jchunk {
+	filesize_t from;			/**< Range offset start (byte included) */
+	filesize_t to;				/**< Range offset end (byte EXCLUDED) */
+	enum dl_chunk_status status;
+};
+
+/**
+ * A journal record, as read back from disk.
+ */
+struct fi_jrec {
+	const struct guid *guid;	/**< Fileinfo GUID (atom) */
+	filesize_t size;			/**< File size */
+	filesize_t done;			/**< Bytes done */
+	time_t stamp;				/**< Last update stamp */
+	time_t ntime;				/**< Last time a new source was seen */
+	struct sha1 cha1;			/**< Computed SHA1, if FI_JOURNAL_F_CHA1 */
+	uint32 generation;			/**< Generation number */
+	uint32 flags;				/**< FI_JOURNAL_F_* flags */
+	uint32 count;				/**< Amount of chunks */
+	struct fi_jchunk *chunks;	/**< Chunk list */
+};
+
+static void
+fi_jrec_free(struct fi_jrec **rec_ptr)
+{
+	struct fi_jrec *rec = *rec_ptr;
+
+	if (rec != NULL) {
+		atom_guid_free_null(&rec->guid);
+		HFREE_NULL(rec->chunks);
+		WFREE(rec);
+		*rec_ptr = NULL;
+	}
+}
+
+static void
+fi_jrec_free_kv(void *value, void *unused_data)
+{
+	struct fi_jrec *rec = value;
+
+	(void) unused_data;
+	fi_jrec_free(&rec);
+}
+
+/**
+ * Parse journal record payload of `length' bytes, at the current read
+ * position of the trailer buffer, updating the running checksum.
+ *
+ * @return the allocated record, NULL if the payload is invalid.
+ */
+static struct fi_jrec *
+file_info_journal_parse(uint32 length, uint32 *checksum)
+{
+	const char *start = tbuf.rptr;
+	struct fi_jrec *rec;
+	struct guid guid;
+	size_t fixed = GUID_RAW_SIZE + 9 * sizeof(uint32);
+	uint32 hi, lo, i;
+	filesize_t last = 0;
+
+	if (length < fixed)
+		return NULL;
+
+	if (!READ_STR((char *) &guid, GUID_RAW_SIZE, checksum))
+		return NULL;
+
+	WALLOC0(rec);
+	rec->guid = atom_guid_get(&guid);
+
+	if (
+		!READ_UINT32(&rec->generation, checksum) ||
+		!READ_UINT32(&hi, checksum) || !READ_UINT32(&lo, checksum)
+	)
+		goto bad;
+	rec->size = ((uint64) hi << 32) | lo;
+
+	if (!READ_UINT32(&hi, checksum) || !READ_UINT32(&lo, checksum))
+		goto bad;
+	rec->done = ((uint64) hi << 32) | lo;
+
+	if (!READ_UINT32(&lo, checksum))
+		goto bad;
+	rec->stamp = lo;
+
+	if (!READ_UINT32(&lo, checksum))
+		goto bad;
+	rec->ntime = lo;
+
+	if (!READ_UINT32(&rec->flags, checksum))
+		goto bad;
+
+	if (FI_JOURNAL_F_CHA1 & rec->flags) {
+		fixed += SHA1_RAW_SIZE;
+		if (length < fixed)
+			goto bad;
+		if (!READ_STR((char *) &rec->cha1, SHA1_RAW_SIZE, checksum))
+			goto bad;
+	}
+
+	if (!READ_UINT32(&rec->count, checksum))
+		goto bad;
+
+	if ((uint64) rec->count * 5 * sizeof(uint32) != length - fixed)
+		goto bad;
+
+	if (rec->count != 0)
+		HALLOC_ARRAY(rec->chunks, rec->count);
+
+	/*
+	 * Chunks must be contiguous and cover the whole file, since they will
+	 * be put back as-is into the fileinfo chunklist.
+	 */
+
+	for (i = 0; i < rec->count; i++) {
+		struct fi_jchunk *jc = &rec->chunks[i];
+		uint32 status;
+
+		if (!READ_UINT32(&hi, checksum) || !READ_UINT32(&lo, checksum))
+			goto bad;
+		jc->from = ((uint64) hi << 32) | lo;
+
+		if (!READ_UINT32(&hi, checksum) || !READ_UINT32(&lo, checksum))
+			goto bad;
+		jc->to = ((uint64) hi << 32) | lo;
+
+		if (!READ_UINT32(&status, checksum) || status > DL_CHUNK_DONE)
+			goto bad;
+		jc->status = status;
+
+		if (jc->from != last || jc->from >= jc->to || jc->to > rec->size)
+			goto bad;
+
+		last = jc->to;
+	}
+
+	if (rec->count != 0 && last != rec->size)
+		goto bad;
+
+	g_assert(ptr_diff(tbuf.rptr, start) == length);
+
+	return rec;
+
+bad:
+	fi_jrec_free(&rec);
+	return NULL;
+}
+
+/**
+ * Load the fileinfo journal, keeping only the last record for each entry.
+ *
+ * @return set of journal records indexed by GUID, NULL if there is no
+ * journal.
+ */
+static hikset_t *
+file_info_journal_load(void)
+{
+	hikset_t *records = NULL;
+	filestat_t sb;
+	size_t size, offset = 0;
+	char *path;
+	int fd;
+
+	path = make_pathname(settings_config_dir(), file_info_journal_file);
+	fd = file_open_missing(path, O_RDONLY);
+
+	if (-1 == fd)
+		goto done;
+
+	if (-1 == fstat(fd, &sb)) {
+		g_warning("%s(): cannot stat \"%s\": %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	fi_journal_size = sb.st_size;
+
+	if (0 == sb.st_size)
+		goto done;
+
+	/*
+	 * The journal is compacted as soon as it reaches FI_JOURNAL_MAX bytes,
+	 * so anything much larger than that is suspicious.
+	 */
+
+	if (sb.st_size > 16 * FI_JOURNAL_MAX) {
+		g_warning("%s(): ignoring oversized \"%s\" (%s bytes)",
+			G_STRFUNC, path, filesize_to_string(sb.st_size));
+		goto done;
+	}
+
+	size = sb.st_size;
+
+	if ((ssize_t) size != tbuf_read(fd, size)) {
+		g_warning("%s(): cannot read \"%s\": %m", G_STRFUNC, path);
+		goto done;
+	}
+
+	records = hikset_create(offsetof(struct fi_jrec, guid),
+		HASH_KEY_FIXED, GUID_RAW_SIZE);
+
+	while (size - offset >= 3 * sizeof(uint32)) {
+		struct fi_jrec *rec, *old;
+		uint32 magic, length, stored, checksum = 0, unused = 0;
+
+		if (
+			!READ_UINT32(&magic, &unused) || FI_JOURNAL_MAGIC != magic ||
+			!READ_UINT32(&length, &unused) ||
+			length > size - offset - 3 * sizeof(uint32)
+		)
+			break;
+
+		rec = file_info_journal_parse(length, &checksum);
+		if (NULL == rec)
+			break;
+
+		if (!READ_UINT32(&stored, &unused) || stored != checksum) {
+			fi_jrec_free(&rec);
+			break;
+		}
+
+		offset += length + 3 * sizeof(uint32);
+
+		old = hikset_lookup(records, rec->guid);
+		if (old != NULL) {
+			hikset_remove(records, old->guid);
+			fi_jrec_free(&old);
+		}
+		hikset_insert_key(records, &rec->guid);
+	}
+
+	/*
+	 * A torn record at the end is expected if we crashed whilst appending.
+	 */
+
+	if (offset != size) {
+		g_warning("%s(): ignoring last %zu bytes of \"%s\"",
+			G_STRFUNC, size - offset, path);
+	}
+
+	if (GNET_PROPERTY(fileinfo_debug)) {
+		g_debug("FILEINFO loaded %zu journaled entr%s from %zu bytes",
+			PLURAL_Y(hikset_count(records)), offset);
+	}
+
+done:
+	fd_close(&fd);
+	HFREE_NULL(path);
+	return records;
+}
+
+/**
+ * Free the set of journal records.
+ */
+static void
+file_info_journal_free(hikset_t **records_ptr)
+{
+	hikset_t *records = *records_ptr;
+
+	if (records != NULL) {
+		hikset_foreach(records, fi_jrec_free_kv, NULL);
+		hikset_free_null(records_ptr);
+	}
+}
+
+/**
+ * Supersede the state of `fi' as read from the fileinfo database with the
+ * one recorded in the journal, if more recent.
+ */
+static void
+file_info_journal_apply(const hikset_t *records, fileinfo_t *fi)
+{
+	const struct fi_jrec *rec;
+	uint32 i;
+
+	file_info_check(fi);
+
+	if (NULL == records || NULL == fi->guid)
+		return;
+
+	rec = hikset_lookup(records, fi->guid);
+
+	if (NULL == rec || rec->generation <= fi->generation)
+		return;
+
+	/*
+	 * A size change forces a new snapshot, so the journal cannot possibly
+	 * hold a more recent state for a different size.
+	 */
+
+	if (rec->size != fi->size) {
+		g_warning("ignoring journaled state for \"%s\": "
+			"size is %s, expected %s", fi->pathname,
+			filesize_to_string(rec->size), filesize_to_string2(fi->size));
+		return;
+	}
+
+	file_info_chunklist_free(fi);
+
+	for (i = 0; i < rec->count; i++) {
+		const struct fi_jchunk *jc = &rec->chunks[i];
+		struct dl_file_chunk *fc;
+
+		fc = dl_file_chunk_alloc();
+		fc->range.from = jc->from;
+		fc->range.to = jc->to;
+		fc->status = DL_CHUNK_BUSY == jc->status ? DL_CHUNK_EMPTY : jc->status;
+		fi_chunk_append(fi, fc);
+	}
+
+	fi->generation = rec->generation;
+	fi->done = rec->done;
+	fi->stamp = rec->stamp;
+	fi->ntime = rec->ntime;
+
+	if (FI_JOURNAL_F_PAUSED & rec->flags)
+		fi->flags |= FI_F_PAUSED;
+	else
+		fi->flags &= ~FI_F_PAUSED;
+
+	if ((FI_JOURNAL_F_CHA1 & rec->flags) && NULL == fi->cha1)
+		fi->cha1 = atom_sha1_get(&rec->cha1);
+
+	if (GNET_PROPERTY(fileinfo_debug) > 1) {
+		g_debug("FILEINFO replayed journal for \"%s\": generation %u, "
+			"%s bytes done", fi->pathname, fi->generation,
+			filesize_to_string(fi->done));
+	}
+}
+
 /**
  * Loads the fileinfo database from disk, and saves a copy in fileinfo.orig.
+ *
+ * The database snapshot is then updated with the more recent state held
+ * in the fileinfo journal.
  */
 void G_COLD
 file_info_retrieve(void)
@@ -3188,6 +4039,7 @@ file_info_retrieve(void)
 	const char *old_filename = NULL;	/* In case we must rename the file */
 	const char *path = NULL;
 	const char *filename = NULL;
+	hikset_t *journal;
 
 	/*
 	 * We have a complex interaction here: each time a new entry within the
@@ -3208,6 +4060,8 @@ file_info_retrieve(void)
 	if (!f)
 		return;
 
+	journal = file_info_journal_load();
+
 	while (fgets(ARYLEN(line), f)) {
 		int error;
 		bool truncated = FALSE, damaged;
@@ -3271,6 +4125,8 @@ file_info_retrieve(void)
 				goto reset;
 			}
 
+			file_info_journal_apply(journal, fi);
+
 			if (0 == fi->size) {
 				fi->file_size_known = FALSE;
 			}
@@ -3365,7 +4221,7 @@ file_info_retrieve(void)
 			 *		--RAM, 31/12/2003
 			 */
 
-			if (0 == eslist_count(&fi->chunklist)) {
+			if (0 == chunkset_count(&fi->chunks)) {
 				if (fi->file_size_known)
 					g_warning("no CHNK info for \"%s\"", fi->pathname);
 				fi_reset_chunks(fi);
@@ -3458,7 +4314,7 @@ file_info_retrieve(void)
 
 			if (dfi != NULL && reload_chunks) {
 				fi_copy_chunks(fi, dfi);
-				if (0 != eslist_count(&fi->chunklist)) {
+				if (0 != chunkset_count(&fi->chunks)) {
 					g_message("recovered %s downloaded bytes "
 						"from trailer of \"%s\"",
 						filesize_to_string(fi->done), fi->pathname);
@@ -3790,18 +4646,19 @@ file_info_retrieve(void)
 					struct dl_file_chunk *fc, *prev;
 
 					fc = dl_file_chunk_alloc();
-					fc->from = from;
-					fc->to = to;
+					fc->range.from = from;
+					fc->range.to = to;
 					if (DL_CHUNK_BUSY == status)
 						status = DL_CHUNK_EMPTY;
 					fc->status = status;
-					prev = eslist_tail(&fi->chunklist);
-					if (fc->from != (prev ? prev->to : 0)) {
+					prev = chunkset_tail(&fi->chunks);
+					if (fc->range.from != (prev ? prev->range.to : 0)) {
 						g_warning("chunklist is inconsistent (fi->size=%s)",
 							filesize_to_string(fi->size));
 						damaged = TRUE;
+						dl_file_chunk_free(&fc);
 					} else {
-						eslist_append(&fi->chunklist, fc);
+						fi_chunk_append(fi, fc);
 					}
 				}
 			}
@@ -3831,6 +4688,7 @@ file_info_retrieve(void)
 	}
 	atom_str_free_null(&filename);
 	atom_str_free_null(&path);
+	file_info_journal_free(&journal);
 
 	fclose(f);
 }
@@ -3942,11 +4800,11 @@ file_info_create(const char *file, const char *path, filesize_t size,
 			G_STRFUNC, fi->pathname, filesize_to_string(st.st_size));
 
 		fc = dl_file_chunk_alloc();
-		fc->from = 0;
-		fi->size = fc->to = st.st_size;
+		fc->range.from = 0;
+		fi->size = fc->range.to = st.st_size;
 		fc->status = DL_CHUNK_DONE;
 		fi->modified = st.st_mtime;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 		fi->dirty = TRUE;
 	}
 
@@ -4380,8 +5238,7 @@ file_info_set_discard(fileinfo_t *fi, bool state)
 void
 file_info_merge_adjacent(fileinfo_t *fi)
 {
-	slink_t *sl, *next;
-	struct dl_file_chunk *fc1, *fc2;
+	struct dl_file_chunk *fc, *next, *fc1, *fc2;
 	filesize_t done;
 
 	file_info_check(fi);
@@ -4390,36 +5247,26 @@ file_info_merge_adjacent(fileinfo_t *fi)
 	done = 0;
 	fc2 = NULL;
 
-	for (sl = eslist_first(&fi->chunklist); sl != NULL; sl = next) {
+	for (fc = chunkset_head(&fi->chunks); fc != NULL; fc = next) {
 		fc1 = fc2;					/* fc1 = previous chunk in list */
-		fc2 = eslist_data(&fi->chunklist, sl);	/* fc2 = current chunk */
-		next = eslist_next(sl);
+		fc2 = fc;					/* fc2 = current chunk */
+		next = fi_chunk_next(fi, fc);
 
 		if (fc2->download != NULL)
 			download_check(fc2->download);
 
 		if (DL_CHUNK_DONE == fc2->status) {
 			fc2->download = NULL;			/* Done, no longer reserved */
-			done += fc2->to - fc2->from;
+			done += fc2->range.to - fc2->range.from;
 		}
 
 		if (NULL == fc1)
 			continue;
 
-		g_assert(fc1->to == fc2->from);
+		g_assert(fc1->range.to == fc2->range.from);
 
-		/*
-		 * Never merge adjacent busy chunks: they correspond to reserved
-		 * parts of the file that will be served by different HTTP requests.
-		 */
-
-		if (fc1->status == fc2->status && DL_CHUNK_BUSY != fc2->status) {
-			void *removed;
-
-			fc1->to = fc2->to;
-			removed = eslist_remove_after(&fi->chunklist, fc1);
-			g_assert(removed == fc2);
-			dl_file_chunk_free(&fc2);
+		if (fi_chunk_mergeable(fc1, fc2)) {
+			fi_chunk_merge_next(fi, fc1);
 			fc2 = fc1;					/* new current chunk */
 		}
 	}
@@ -4428,7 +5275,7 @@ file_info_merge_adjacent(fileinfo_t *fi)
 	 * When file size is unknown, there may be no chunklist.
 	 */
 
-	if (0 != eslist_count(&fi->chunklist))
+	if (0 != chunkset_count(&fi->chunks))
 		fi->done = done;
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
@@ -4453,6 +5300,7 @@ file_info_size_unknown(fileinfo_t *fi)
 	}
 
 	fi->file_size_known = FALSE;
+	fi_avail_reset(fi);
 	fi_event_trigger(fi, EV_FI_INFO_CHANGED);
 
 }
@@ -4480,28 +5328,28 @@ file_info_size_known(struct download *d, filesize_t size)
 	 */
 
 	if (fi->done) {
-		struct dl_file_chunk *fc = eslist_head(&fi->chunklist);
+		struct dl_file_chunk *fc = chunkset_head(&fi->chunks);
 
 		if (NULL == fc) {
 			fc = dl_file_chunk_alloc();
-			fc->from = 0;
-			fc->to = fi->done;			/* Byte at that offset is excluded */
+			fc->range.from = 0;
+			fc->range.to = fi->done;	/* Byte at that offset is excluded */
 			fc->status = DL_CHUNK_DONE;
 
-			eslist_append(&fi->chunklist, fc);
+			fi_chunk_append(fi, fc);
 		} else {
-			fc->to = fi->done;
-
 			/*
 			 * Remove subsequent chunks.
 			 */
 
-			while (NULL != eslist_next(&fc->lk)) {
+			while (NULL != fi_chunk_next(fi, fc)) {
 				struct dl_file_chunk *fcn;
 
-				fcn = eslist_remove_after(&fi->chunklist, fc);
+				fcn = fi_chunk_remove_after(fi, fc);
 				dl_file_chunk_free(&fcn);
 			}
+
+			fc->range.to = fi->done;
 		}
 	}
 
@@ -4514,11 +5362,11 @@ file_info_size_known(struct download *d, filesize_t size)
 		struct dl_file_chunk *fc;
 
 		fc = dl_file_chunk_alloc();
-		fc->from = fi->done;
-		fc->to = size;				/* Byte at that offset is excluded */
+		fc->range.from = fi->done;
+		fc->range.to = size;			/* Byte at that offset is excluded */
 		fc->status = DL_CHUNK_BUSY;
 		fc->download = d;
-		eslist_append(&fi->chunklist, fc);
+		fi_chunk_append(fi, fc);
 	}
 
 	fi->file_size_known = TRUE;
@@ -4526,6 +5374,7 @@ file_info_size_known(struct download *d, filesize_t size)
 	fi->size = MAX(size, fi->done);
 	fi->dirty = TRUE;
 	fileinfo_dirty = TRUE;
+	fi_avail_reset(fi);
 
 	if (0 == (FI_F_TRANSIENT & fi->flags)) {
 		file_info_hash_insert_name_size(fi);
@@ -4547,12 +5396,11 @@ void
 file_info_update(const struct download *d, filesize_t from, filesize_t to,
 		enum dl_chunk_status status)
 {
-	struct dl_file_chunk *fc, *nfc, *prevfc;
-	slink_t *sl;
+	struct dl_file_chunk *fc;
 	fileinfo_t *fi;
-	bool found = FALSE;
-	int n, againcount = 0;
-	bool need_merging;
+	filesize_t start = from;
+	bool need_merging = FALSE;
+	bool inner = FALSE;
 	const struct download *newval;
 
 	download_check(d);
@@ -4563,16 +5411,13 @@ file_info_update(const struct download *d, filesize_t from, filesize_t to,
 
 	switch (status) {
 	case DL_CHUNK_DONE:
-		need_merging = FALSE;
 		newval = d;
 		goto status_ok;
 	case DL_CHUNK_BUSY:
-		need_merging = TRUE;
 		newval = d;
 		g_assert(fi->lifecount > 0);
 		goto status_ok;
 	case DL_CHUNK_EMPTY:
-		need_merging = TRUE;
 		newval = NULL;
 		goto status_ok;
 	}
@@ -4585,7 +5430,7 @@ status_ok:
 	 * Simply update the downloaded amount if the chunk is marked as done.
 	 */
 
-	if (!fi->file_size_known && 0 == eslist_count(&fi->chunklist)) {
+	if (!fi->file_size_known && 0 == chunkset_count(&fi->chunks)) {
 		g_assert(!fi->use_swarming);
 
 		if (status == DL_CHUNK_DONE) {
@@ -4605,17 +5450,23 @@ status_ok:
 		fi->dirty = TRUE;
 	}
 
-again:
+	/*
+	 * Locate the chunk holding `from' and split it there if needed.
+	 *
+	 * When [from, to] lies strictly within a chunk, we will split that
+	 * same chunk again at `to' below: remember it through `inner'.
+	 */
 
-	/* I think the algorithm is safe now, but hey... */
-	if (++againcount > 10) {
-		g_error("%s(%s, %s, %d) is looping for \"%s\"! Man battle stations!",
-			G_STRFUNC, filesize_to_string(from), filesize_to_string2(to),
-			status, d->file_name);
-		return;
+	fc = fi_chunk_lookup(fi, from);
+
+	if (fc != NULL && fc->range.from < from) {
+		fc = fi_chunk_split(fi, fc, from);
+		inner = TRUE;
 	}
 
 	/*
+	 * Update all the chunks covering [from, to].
+	 *
 	 * Update fi->done, accurately.
 	 *
 	 * We don't blindly update fi->done with (to - from) when DL_CHUNK_DONE
@@ -4624,153 +5475,39 @@ again:
 	 *		--RAM, 04/11/2002
 	 */
 
-	for (
-		n = 0, prevfc = NULL, sl = eslist_first(&fi->chunklist);
-		sl != NULL;
-		n++, prevfc = fc, sl = eslist_next(sl)
-	) {
-		fc = eslist_data(&fi->chunklist, sl);
-
+	while (fc != NULL && fc->range.from < to) {
 		dl_file_chunk_check(fc);
 
-		if (fc->to <= from) continue;
-		if (fc->from >= to) break;
-
-		if (fc->from == from && fc->to == to) {
+		if (fc->range.to > to) {
+			struct dl_file_chunk *nfc = fi_chunk_split(fi, fc, to);
 
-			if (prevfc && prevfc->status == status)
-				need_merging = TRUE;
-			else if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += to - from;
-			fc->status = status;
-			fc->download = newval;
-			found = TRUE;
-			g_assert(file_info_check_chunklist(fi, TRUE));
-			break;
-
-		} else if (fc->from == from && fc->to < to) {
-
-			if (prevfc && prevfc->status == status)
-				need_merging = TRUE;
-			else if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += fc->to - from;
-			fc->status = status;
-			fc->download = newval;
-			from = fc->to;
-			g_assert(file_info_check_chunklist(fi, TRUE));
-			continue;
-
-		} else if (fc->from == from && fc->to > to) {
-
-			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;		/* Writing to completed chunk! */
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += to - from;
-
-			if (
-				DL_CHUNK_DONE == status &&
-				NULL != prevfc &&
-				prevfc->status == status
-			) {
-				g_assert(prevfc->to == fc->from);
-				prevfc->to = to;
-				fc->from = to;
-				g_assert(file_info_check_chunklist(fi, TRUE));
-			} else {
-				nfc = dl_file_chunk_alloc();
-				nfc->from = to;
-				nfc->to = fc->to;
-				nfc->status = fc->status;
-				nfc->download = fc->download;
-
-				fc->to = to;
-				fc->status = status;
-				fc->download = newval;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
-				g_assert(file_info_check_chunklist(fi, TRUE));
-			}
-
-			found = TRUE;
-			break;
-
-		} else if (fc->from < from && fc->to >= to) {
-
-			/*
-			 * New chunk [from, to] lies within ]fc->from, fc->to].
-			 */
-
-			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += to - from;
-
-			if (fc->to > to) {
-				nfc = dl_file_chunk_alloc();
-				nfc->from = to;
-				nfc->to = fc->to;
-				nfc->status = fc->status;
-				nfc->download = fc->download;
-				eslist_insert_after(&fi->chunklist, fc, nfc);
-
-				if (DL_CHUNK_BUSY == nfc->status) {
-					/*
-					 * Reserved chunk being aggressively stolen, hence its
-					 * upper-part ]to, fc->to] cannot be linearily downloaded.
-					 * Make it free so that the source owning the original
-					 * chunk is not suddenly seen as reserving two chunks!
-					 */
-					nfc->status = DL_CHUNK_EMPTY;
-					nfc->download = NULL;
-				}
+			if (inner && DL_CHUNK_BUSY == nfc->status) {
+				/*
+				 * Reserved chunk being aggressively stolen, hence its
+				 * upper-part ]to, fc->range.to] cannot be linearily downloaded.
+				 * Make it free so that the source owning the original
+				 * chunk is not suddenly seen as reserving two chunks!
+				 */
+				fi_chunk_set_status(fi, nfc, DL_CHUNK_EMPTY);
+				nfc->download = NULL;
 			}
+		}
 
-			nfc = dl_file_chunk_alloc();
-			nfc->from = from;
-			nfc->to = to;
-			nfc->status = status;
-			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
-
-			fc->to = from;
-
-			found = TRUE;
-			g_assert(file_info_check_chunklist(fi, TRUE));
-			break;
-
-		} else if (fc->from < from && fc->to < to) {
-
-			filesize_t tmp;
-
-			if (DL_CHUNK_DONE == fc->status)
-				need_merging = TRUE;
-
-			if (DL_CHUNK_DONE == status)
-				fi->done += fc->to - from;
-
-			nfc = dl_file_chunk_alloc();
-			nfc->from = from;
-			nfc->to = fc->to;
-			nfc->status = status;
-			nfc->download = newval;
-			eslist_insert_after(&fi->chunklist, fc, nfc);
+		if (DL_CHUNK_DONE == fc->status)
+			need_merging = TRUE;		/* Writing to completed chunk! */
+		else if (DL_CHUNK_DONE == status)
+			fi->done += fc->range.to - fc->range.from;
 
-			tmp = fc->to;
-			fc->to = from;
-			from = tmp;
-			g_assert(file_info_check_chunklist(fi, TRUE));
-			goto again;
-		}
+		fi_chunk_set_status(fi, fc, status);
+		fc->download = newval;
+		from = fc->range.to;
+		fc = fi_chunk_next(fi, fc);
+		inner = FALSE;
 	}
 
-	if (!found) {
+	if (from < to) {
+		struct dl_file_chunk *c;
+
 		/* Should never happen. */
 		g_critical("%s(): didn't find matching chunk for <%s-%s> (%u) "
 			"for \"%s\" (%s%s bytes)",
@@ -4779,15 +5516,22 @@ again:
 			fi->file_size_known ? "" : "unknown size, currently ",
 			filesize_to_string3(fi->size));
 
-		ESLIST_FOREACH(&fi->chunklist, sl) {
-			fc = eslist_data(&fi->chunklist, sl);
-			g_warning("... %s %s %u", filesize_to_string(fc->from),
-				filesize_to_string2(fc->to), fc->status);
+		CHUNKSET_FOREACH(&fi->chunks, c) {
+			g_warning("... %s %s %u", filesize_to_string(c->range.from),
+				filesize_to_string2(c->range.to), c->status);
 		}
 	}
 
+	/*
+	 * When we overwrote a completed chunk, recompute fi->done from scratch,
+	 * merging the whole chunklist.  Otherwise, only the chunks around the
+	 * updated range can need merging.
+	 */
+
 	if (need_merging)
 		file_info_merge_adjacent(fi);		/* Also updates fi->done */
+	else
+		fi_chunk_coalesce(fi, start, to);
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
@@ -4827,7 +5571,7 @@ file_info_clear_download(struct download *d, bool lifecount)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		dl_file_chunk_check(fc);
 
 		if (DL_CHUNK_BUSY == fc->status) {
@@ -4840,7 +5584,7 @@ file_info_clear_download(struct download *d, bool lifecount)
 		if (fc->download == d) {
 		    fc->download = NULL;
 		    if (DL_CHUNK_BUSY == fc->status)
-				fc->status = DL_CHUNK_EMPTY;
+				fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 		}
 	}
 	file_info_merge_adjacent(fi);
@@ -4876,7 +5620,7 @@ file_info_reset(fileinfo_t *fi)
 	fi->flags &= ~(FI_F_STRIPPED | FI_F_UNLINKED);
 
 restart:
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
  		struct download *d;
 
 		dl_file_chunk_check(fc);
@@ -4892,10 +5636,10 @@ restart:
 		}
 	}
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		dl_file_chunk_check(fc);
 		g_assert(NULL == fc->download);
-		fc->status = DL_CHUNK_EMPTY;
+		fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 	}
 
 	file_info_merge_adjacent(fi);
@@ -4915,11 +5659,11 @@ file_info_chunk_status(fileinfo_t *fi, filesize_t from, filesize_t to)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
+	fc = fi_chunk_lookup(fi, from);
 
-		if (from >= fc->from && to <= fc->to)
-			return fc->status;
+	if (fc != NULL && to <= fc->range.to) {
+		dl_file_chunk_check(fc);
+		return fc->status;
 	}
 
 	/*
@@ -4947,48 +5691,39 @@ file_info_new_chunk_owner(const struct download *d,
 {
 	fileinfo_t *fi;
 	const struct download *old = NULL;
-	const slink_t *sl;
+	struct dl_file_chunk *fc;
 
 	download_check(d);
 	fi = d->file_info;
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
-		dl_file_chunk_check(fc);
+	/*
+	 * We're looking for the first busy chunk intersecting with [from, to],
+	 * which happens when one of the segment bounds lies within the chunk.
+	 */
 
-		/*
-		 * We're looking for the first busy chunk intersecting with [from, to],
-		 * which happens when one of the segment bounds lies within the chunk.
-		 */
+	fc = fi_chunk_lookup(fi, from);
 
-		if (DL_CHUNK_BUSY != fc->status)
-			continue;
+	if (NULL == fc || DL_CHUNK_BUSY != fc->status)
+		fc = fi_chunk_lookup(fi, to);
 
-		if (
-			(from >= fc->from && from < fc->to) ||
-			(to >= fc->from && to < fc->to)
-		) {
-			g_assert(fc->download != NULL);
-			download_check(fc->download);
-			g_assert(fc->download != d);
+	if (fc != NULL && DL_CHUNK_BUSY == fc->status) {
+		dl_file_chunk_check(fc);
+		g_assert(fc->download != NULL);
+		download_check(fc->download);
+		g_assert(fc->download != d);
 
-			old = fc->download;
-			fc->download = d;
-			break;
-		}
+		old = fc->download;
+		fc->download = d;
 	}
 
 	if (old != NULL) {
-		for (sl = eslist_next(sl); sl != NULL; sl = eslist_next(sl)) {
-			struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
+		while (NULL != (fc = fi_chunk_next(fi, fc))) {
 			dl_file_chunk_check(fc);
 
 			if (DL_CHUNK_BUSY == fc->status && fc->download == old) {
-				fc->status = DL_CHUNK_EMPTY;
+				fi_chunk_set_status(fi, fc, DL_CHUNK_EMPTY);
 				fc->download = NULL;
 			}
 		}
@@ -5007,10 +5742,11 @@ file_info_pos_status(fileinfo_t *fi, filesize_t pos)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	fc = fi_chunk_lookup(fi, pos);
+
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
-		if (pos >= fc->from && pos < fc->to)
-			return fc->status;
+		return fc->status;
 	}
 
 	if (pos > fi->size) {
@@ -5068,7 +5804,7 @@ fi_busy_count(fileinfo_t *fi, const struct download *d)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		dl_file_chunk_check(fc);
 		if (fc->download != NULL) {
 			download_check(d);
@@ -5085,23 +5821,6 @@ fi_busy_count(fileinfo_t *fi, const struct download *d)
 	return count;
 }
 
-/**
- * Compares two offered ranges so that two ranges are equal when they overlap.
- */
-static int
-fi_chunk_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_file_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping chunks are equal */
-}
-
 /**
  * Select a chunk randomly among the rarest chunks offered on the network.
  *
@@ -5121,17 +5840,16 @@ fi_chunk_overlap_cmp(const void *a, const void *b)
 static const struct dl_file_chunk *
 fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 {
-	rbtree_t *missing;
-	http_rangeset_t *offered;
+	const bit_array_t *offered;
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *first, *candidate = NULL;
-	uint32 rarest_count = 0;
-	const struct dl_avail_chunk *rarest = NULL, *fa;
+	uint32 rarest = 0, rarest_count = 0;
+	size_t slice = 0;
 
 	file_info_check(fi);
-	g_assert(0 != eslist_count(&fi->chunklist));
+	g_assert(0 != chunkset_count(&fi->chunks));
 
-	first = eslist_head(&fi->chunklist);		/* First chunk */
+	first = chunkset_head(&fi->chunks);		/* First chunk */
 	dl_file_chunk_check(first);
 
 	if (!fi->file_size_known)
@@ -5142,111 +5860,97 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		 * See whether chunks up to ``pfsp_first_chunk'' bytes are free.
 		 */
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-			if (fc->from >= GNET_PROPERTY(pfsp_first_chunk))
-				break;
-
-			if (DL_CHUNK_EMPTY == fc->status) {
-				if (GNET_PROPERTY(download_debug)) {
-					g_debug("%s(): less than %u bytes, using first chunk",
-						G_STRFUNC, GNET_PROPERTY(pfsp_first_chunk));
-				}
+		fc = chunkset_hole_first(&fi->chunks);
 
-				candidate = first;
-				goto done;
+		if (fc != NULL && fc->range.from < GNET_PROPERTY(pfsp_first_chunk)) {
+			if (GNET_PROPERTY(download_debug)) {
+				g_debug("%s(): less than %u bytes, using first chunk",
+					G_STRFUNC, GNET_PROPERTY(pfsp_first_chunk));
 			}
+
+			candidate = first;
+			goto done;
 		}
 	}
 
 	/*
-	 * The `missing' red-black tree contains the file chunks that are still
-	 * empty and need to be downloaded.
+	 * The "holes" tree contains the file chunks that are still empty and
+	 * need to be downloaded.
 	 *
-	 * The `offered' set contains the HTTP ranges offered by the source,
-	 * if any given.  If NULL, it means the source covers the whole file.
+	 * The `offered' bitmap contains the slices offered by the source, if
+	 * any given.  If NULL, it means the source covers the whole file.
 	 */
 
-	missing = rbtree_create(fi_chunk_overlap_cmp);
-	offered = NULL == d ? NULL : d->ranges;
-
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
+	offered = NULL == d ? NULL : d->avail;
 
-		if (DL_CHUNK_EMPTY == fc->status) {
-			rbtree_insert(missing, fc);
-		}
+	if (d != NULL && NULL == offered && !d->avail_whole) {
+		candidate = first;		/* Source offers nothing we counted */
+		goto done;
 	}
 
+	g_assert(fi->avail != NULL);
+
 	/*
-	 * Find the first missing chunk that is also offered, starting with the
-	 * rarest available chunk: the fi->available list is sorted by increasing
-	 * source count.
+	 * Look at the slices overlapping with missing chunks and offered by
+	 * the source, retaining one among the slices offered by the least
+	 * amount of sources.
 	 */
 
-	ESLIST_FOREACH_DATA(&fi->available, fa) {
-		struct dl_file_chunk *dfc;
-		struct dl_file_chunk crange;
+	for (
+		fc = chunkset_hole_first(&fi->chunks);
+		fc != NULL;
+		fc = fi_hole_next(fi, fc)
+	) {
+		size_t i, last;
 
-		dl_avail_chunk_check(fa);
+		dl_file_chunk_check(fc);
+		g_assert(fc->download == NULL);		/* Chunk is empty */
 
-		/*
-		 * If we have already found a candidate and this chunk has more
-		 * sources, we're done.
-		 */
+		i = fc->range.from >> fi->avail_shift;
+		last = (fc->range.to - 1) >> fi->avail_shift;
 
-		if (rarest != NULL && fa->sources > rarest->sources)
-			break;
+		for (/* empty */; i <= last; i++) {
+			uint32 count;
 
-		if (
-			offered != NULL &&
-			!http_rangeset_contains(offered, fa->from, fa->to - 1)
-		)
-			continue;		/* Range not offered */
+			if (offered != NULL && !bit_array_get(offered, i))
+				continue;		/* Slice not offered */
 
-		crange.from = fa->from;
-		crange.to = fa->to;
+			count = fi->avail_whole + fi->avail[i];
 
-		dfc = rbtree_lookup(missing, &crange);
+			if (0 == count)
+				continue;		/* Not fully offered by anyone */
 
-		if (dfc != NULL) {
-			/* Rare range overlaps with missing range */
+			if (rarest_count != 0 && count > rarest)
+				continue;		/* Not the rarest */
 
-			if (
-				GNET_PROPERTY(fileinfo_debug) > 2 ||
-				GNET_PROPERTY(download_debug) > 1
-			) {
-				g_debug("%s(): possible rarest candidate #%u for \"%s\" is "
-					"[%s, %s] (%zu source%s)",
-					G_STRFUNC, rarest_count + 1, fi->pathname,
-					filesize_to_string(fa->from), filesize_to_string2(fa->to),
-					fa->sources, plural(fa->sources));
+			if (0 == rarest_count || count < rarest) {
+				rarest = count;
+				rarest_count = 0;
+			} else if (!GNET_PROPERTY(pfsp_server)) {
+				/*
+				 * If we're not a PFSP server, we retain the first candidate
+				 * among the rarest.
+				 */
+
+				continue;
 			}
 
 			/*
 			 * If this is not the first rarest candidate we see, then randomly
 			 * select it, maybe.
 			 *
-			 * The second rarest chunk has exactly 1/2 chance to supersede
+			 * The second rarest slice has exactly 1/2 chance to supersede
 			 * the candidate, the third has 1/3 chance, etc...  This allows
 			 * us to randomly select a candidate without knowing beforehand how
 			 * many we will find, whilst retaining an equal probability for
-			 * all the chunks to be selected.
+			 * all the slices to be selected.
 			 */
 
-			g_assert(dfc->download == NULL);	/* Chunk is empty */
-
 			if (++rarest_count > 1 && 0 != random_value(rarest_count - 1))
 				continue;
 
-			rarest = fa;
-			candidate = dfc;
-
-			/*
-			 * If we're not a PFSP server, we retain the first candidate we see.
-			 */
-
-			if (!GNET_PROPERTY(pfsp_server))
-				break;
+			slice = i;
+			candidate = fc;
 		}
 	}
 
@@ -5256,7 +5960,7 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	 * chunk is larger than the targeted size.
 	 */
 
-	if (rarest != NULL) {
+	if (rarest_count != 0) {
 		struct dl_file_chunk *dfc = deconstify_pointer(candidate);
 		struct dl_file_chunk *nfc;
 		filesize_t start, end;
@@ -5264,22 +5968,24 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 		g_assert(candidate != NULL);
 
 		/*
-		 * [start, end] is the intersection of the rarest chunk we selected
+		 * [start, end] is the intersection of the rarest slice we selected
 		 * with the candidate chunk (missing part to be downloaded still).
 		 */
 
-		start = MAX(rarest->from, candidate->from);
-		end = MIN(rarest->to, candidate->to);
+		start = (filesize_t) slice << fi->avail_shift;
+		end = start + ((filesize_t) 1 << fi->avail_shift);
+		start = MAX(start, candidate->range.from);
+		end = MIN(end, candidate->range.to);
 
 		if (
 			GNET_PROPERTY(fileinfo_debug) > 2 ||
 			GNET_PROPERTY(download_debug) > 1
 		) {
 			g_debug("%s(): rarest intersection chunk for \"%s\" is "
-				"[%s, %s] (%zu source%s)",
+				"[%s, %s] (%u source%s, %u candidate%s)",
 				G_STRFUNC, fi->pathname,
 				filesize_to_string(start), filesize_to_string2(end),
-				rarest->sources, plural(rarest->sources));
+				PLURAL(rarest), PLURAL(rarest_count));
 		}
 
 		g_assert(start < end);		/* Because the two MUST overlap */
@@ -5293,7 +5999,8 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			offset &= ~file_info_align_mask;	/* Align on natural boundary */
 			offset = MAX(offset, start);
 
-			g_assert(offset >= candidate->from && offset <= candidate->to);
+			g_assert(offset >= candidate->range.from);
+			g_assert(offset <= candidate->range.to);
 
 			start = offset;		/* Randomly selected starting point */
 
@@ -5306,19 +6013,13 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 			}
 		}
 
-		if (start > dfc->from && start < dfc->to) {
+		if (start > dfc->range.from && start < dfc->range.to) {
 			/*
 			 * dfc was [from, to[.  It becomes [from, start[.
 			 * nfc is [start, to[ and is inserted after fc.
 			 */
 
-			nfc = dl_file_chunk_alloc();
-			nfc->from = start;
-			nfc->to = dfc->to;
-			nfc->status = dfc->status;
-			dfc->to = start;
-
-			eslist_insert_after(&fi->chunklist, dfc, nfc);
+			nfc = fi_chunk_split(fi, dfc, start);
 			candidate = nfc;
 
 			if (
@@ -5326,8 +6027,8 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 				GNET_PROPERTY(download_debug) > 1
 			) {
 				g_debug("%s(): selected chunk is [%s, %s]",
-					G_STRFUNC, filesize_to_string(nfc->from),
-					filesize_to_string2(nfc->to));
+					G_STRFUNC, filesize_to_string(nfc->range.from),
+					filesize_to_string2(nfc->range.to));
 			}
 		}
 	}
@@ -5340,13 +6041,11 @@ fi_pick_rarest_chunk(fileinfo_t *fi, const download_t *d, filesize_t size)
 	if (NULL == candidate)
 		candidate = first;
 
-	rbtree_free_null(&missing);
-
 done:
 	if (GNET_PROPERTY(fileinfo_debug) || GNET_PROPERTY(download_debug)) {
 		g_debug("%s(): returning [%s, %s] (%u) for \"%s\"",
-			G_STRFUNC, filesize_to_string(candidate->from),
-			filesize_to_string2(candidate->to), candidate->status,
+			G_STRFUNC, filesize_to_string(candidate->range.from),
+			filesize_to_string2(candidate->range.to), candidate->status,
 			fi->pathname);
 	}
 
@@ -5369,58 +6068,60 @@ static const struct dl_file_chunk *
 fi_pick_chunk(fileinfo_t *fi)
 {
 	filesize_t offset = 0, empty = 0;
-	slink_t *sl;
+	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *candidate = NULL;
 
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	if (GNET_PROPERTY(pfsp_first_chunk) > 0) {
-		const struct dl_file_chunk *fc;
+	/*
+	 * All the chunks we can select from are empty ones, hence we only need
+	 * to iterate over the "holes" tree.
+	 */
 
+	if (GNET_PROPERTY(pfsp_first_chunk) > 0) {
 		/*
 		 * Check whether first chunks cover at least "pfsp_first_chunk" bytes
 		 * long.  If not, return that first chunk.
 		 */
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-			dl_file_chunk_check(fc);
-
-			if (fc->from >= GNET_PROPERTY(pfsp_first_chunk))
-				break;		/* Already past the first "pfsp_first_chunk" bytes */
+		fc = chunkset_hole_first(&fi->chunks);
 
-			if (DL_CHUNK_EMPTY == fc->status)
-				return fc;
+		if (fc != NULL && fc->range.from < GNET_PROPERTY(pfsp_first_chunk)) {
+			dl_file_chunk_check(fc);
+			return fc;
 		}
 	}
 
 	if (GNET_PROPERTY(pfsp_last_chunk) > 0) {
-		const struct dl_file_chunk *fc;
 		filesize_t last_chunk_offset;
 
 		/*
 		 * Scan for the first gap within the last "pfsp_last_chunk" bytes
 		 * and set "offset" to the start of it, to download the trailing chunk
 		 * if available.
+		 *
+		 * We walk the holes backwards from the tail of the file, stopping
+		 * as soon as we reach a hole lying before that trailing part.
 		 */
 
 		last_chunk_offset = fi->size > GNET_PROPERTY(pfsp_last_chunk)
 			? fi->size - GNET_PROPERTY(pfsp_last_chunk)
 			: 0;
 
-		ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+		for (
+			fc = chunkset_hole_last(&fi->chunks);
+			fc != NULL && fc->range.to > last_chunk_offset;
+			fc = chunkset_hole_prev(&fi->chunks, fc)
+		) {
 			dl_file_chunk_check(fc);
+			candidate = fc;		/* Earliest hole in trailing part so far */
+		}
 
-			if (DL_CHUNK_EMPTY != fc->status)
-				continue;
-
-			if (fc->to <= last_chunk_offset)
-				continue;
-
-			offset = fc->from < last_chunk_offset
+		if (candidate != NULL) {
+			offset = candidate->range.from < last_chunk_offset
 				? last_chunk_offset
-				: fc->from;
-			candidate = fc;
+				: candidate->range.from;
 			goto selected;
 		}
 	}
@@ -5433,15 +6134,13 @@ fi_pick_chunk(fileinfo_t *fi)
 	 * where this random number falls into.
 	 */
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
-
+	for (
+		fc = chunkset_hole_first(&fi->chunks);
+		fc != NULL;
+		fc = fi_hole_next(fi, fc)
+	) {
 		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_EMPTY != fc->status)
-			continue;
-
-		empty += fc->to - fc->from;		/* Sums "empty" data */
+		empty += fc->range.to - fc->range.from;		/* Sums "empty" data */
 	}
 
 	/*
@@ -5453,7 +6152,7 @@ fi_pick_chunk(fileinfo_t *fi)
 	 */
 
 	if G_UNLIKELY(0 == empty)
-		return eslist_head(&fi->chunklist);
+		return chunkset_head(&fi->chunks);
 
 	/*
 	 * The random offset chosen among the amount of empty data is going to
@@ -5467,16 +6166,16 @@ fi_pick_chunk(fileinfo_t *fi)
 
 	offset = get_random_file_offset(empty);
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	for (
+		fc = chunkset_hole_first(&fi->chunks);
+		fc != NULL;
+		fc = fi_hole_next(fi, fc)
+	) {
 		filesize_t len;
 
 		dl_file_chunk_check(fc);
 
-		if (DL_CHUNK_EMPTY != fc->status)
-			continue;
-
-		len = fc->to - fc->from;
+		len = fc->range.to - fc->range.from;
 
 		if (offset < len) {
 			filesize_t aligned;
@@ -5485,7 +6184,7 @@ fi_pick_chunk(fileinfo_t *fi)
 			 * Found our chunk.
 			 */
 
-			offset += fc->from;			/* Absolute file offset */
+			offset += fc->range.from;			/* Absolute file offset */
 
 			/*
 			 * Try to align the starting offset to a natural boundary.
@@ -5502,7 +6201,7 @@ fi_pick_chunk(fileinfo_t *fi)
 			 */
 
 			aligned = offset & ~file_info_align_mask;
-			offset = MAX(aligned, fc->from);
+			offset = MAX(aligned, fc->range.from);
 
 			candidate = fc;
 			goto selected;
@@ -5521,7 +6220,7 @@ selected:
 
 	dl_file_chunk_check(candidate);
 	g_assert(DL_CHUNK_EMPTY == candidate->status);
-	g_assert(offset >= candidate->from && offset < candidate->to);
+	g_assert(offset >= candidate->range.from && offset < candidate->range.to);
 	g_assert(NULL == candidate->download);	/* Chunk is empty */
 
 	/*
@@ -5529,25 +6228,14 @@ selected:
 	 * the specified offset.
 	 */
 
-	if (offset != candidate->from) {
-		struct dl_file_chunk *fc, *nfc;
-
+	if (offset != candidate->range.from) {
 		/*
 		 * candidate was [from, to[.  It becomes [from, offset[.
-		 * nfc is [offset, to[ and is inserted after candidate, then
+		 * The new chunk [offset, to[ is inserted after candidate, then
 		 * becomes the candidate.
 		 */
 
-		fc = deconstify_pointer(candidate);
-
-		nfc = dl_file_chunk_alloc();
-		nfc->from = offset;
-		nfc->to = fc->to;
-		nfc->status = DL_CHUNK_EMPTY;
-		fc->to = nfc->from;
-
-		eslist_insert_after(&fi->chunklist, fc, nfc);
-		candidate = nfc;
+		candidate = fi_chunk_split(fi, deconstify_pointer(candidate), offset);
 	}
 
 	g_assert(file_info_check_chunklist(fi, TRUE));
@@ -5556,10 +6244,10 @@ selected:
 }
 
 /**
- * Compute chunksize to be used for the current request.
+ * Compute chunksize to be used for the current request made by download.
  */
 static filesize_t
-fi_chunksize(fileinfo_t *fi)
+fi_chunksize(fileinfo_t *fi, const struct download *d)
 {
 	filesize_t chunksize;
 	int src_count;
@@ -5585,6 +6273,15 @@ fi_chunksize(fileinfo_t *fi)
 	src_count = MAX(1, src_count);
 	chunksize = (fi->size - fi->done) / src_count;
 
+	/*
+	 * When pipelining, the chunk must last long enough for the next request
+	 * to be issued before its end, or the link will be idle during the
+	 * round-trip: make it cover the bandwidth-delay product of the source,
+	 * times the configured chunk factor.
+	 */
+
+	chunksize = MAX(chunksize, download_pipeline_chunksize(d));
+
 	/*
 	 * Finally trim the computed value so it falls between the boundaries
 	 * they want to enforce.
@@ -5643,13 +6340,13 @@ fi_missing_coverage(const struct download *d)
 		return available ? (available * 1.0) / (fi->size * 1.0) : 1.0;
 	}
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		const http_range_t *r;
 
 		if (DL_CHUNK_EMPTY != fc->status)
 			continue;
 
-		missing_size += fc->to - fc->from;
+		missing_size += fc->range.to - fc->range.from;
 
 		/*
 		 * Look whether this empty chunk intersects with one of the
@@ -5659,7 +6356,8 @@ fi_missing_coverage(const struct download *d)
 		 * (r->end) is part of the range.
 		 */
 
-		r = http_rangeset_lookup_first(ranges, fc->from, fc->to - 1);
+		r = http_rangeset_lookup_first(ranges,
+				fc->range.from, fc->range.to - 1);
 
 		while (r != NULL) {
 			filesize_t start, end;
@@ -5668,9 +6366,9 @@ fi_missing_coverage(const struct download *d)
 			 * Compute the intersection between range and chunk.
 			 */
 
-			start = MAX(r->start, fc->from);
+			start = MAX(r->start, fc->range.from);
 			end = r->end + 1;
-			end = MIN(end, fc->to);
+			end = MIN(end, fc->range.to);
 
 			if (start >= end)
 				break;					/* No longer intersecting */
@@ -5700,7 +6398,7 @@ fi_find_largest(const fileinfo_t *fi, const struct download *d)
 	const struct dl_file_chunk *fc;
 	const struct dl_file_chunk *largest = NULL;
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		dl_file_chunk_check(fc);
 
 		if (DL_CHUNK_BUSY != fc->status)
@@ -5718,7 +6416,8 @@ fi_find_largest(const fileinfo_t *fi, const struct download *d)
 
 		if (
 			largest == NULL ||
-			(fc->to - fc->from) > (largest->to - largest->from)
+			(fc->range.to - fc->range.from) >
+				(largest->range.to - largest->range.from)
 		)
 			largest = fc;
 	}
@@ -5739,7 +6438,7 @@ fi_find_slowest(const fileinfo_t *fi, const struct download *d)
 	const struct dl_file_chunk *slowest = NULL;
 	uint slowest_speed_avg = MAX_INT_VAL(uint);
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		uint speed_avg;
 
 		dl_file_chunk_check(fc);
@@ -5763,7 +6462,8 @@ fi_find_slowest(const fileinfo_t *fi, const struct download *d)
 			speed_avg < slowest_speed_avg ||
 			(
 				speed_avg == slowest_speed_avg &&
-				(fc->to - fc->from) > (slowest->to - slowest->from)
+				(fc->range.to - fc->range.from) >
+					(slowest->range.to - slowest->range.from)
 			)
 		) {
 			slowest = fc;
@@ -5816,7 +6516,7 @@ fi_find_aggressive_candidate(
 
 	fc = fi_find_largest(fi, d);
 
-	if (fc != NULL && fc->to - fc->from < minchunk)
+	if (fc != NULL && fc->range.to - fc->range.from < minchunk)
 		fc = NULL;
 
 	/*
@@ -5895,14 +6595,14 @@ fi_find_aggressive_candidate(
 
 	g_assert(fc->download != NULL && fc->download != d);
 
-	if (fc->to - fc->from >= 2 * FI_MIN_CHUNK_SPLIT) {
+	if (fc->range.to - fc->range.from >= 2 * FI_MIN_CHUNK_SPLIT) {
 		/* Start in the middle of the selected range */
-		*from = (fc->from + fc->to - 1) / 2;
-		*to = fc->to;		/* 'to' is NOT in the range */
+		*from = (fc->range.from + fc->range.to - 1) / 2;
+		*to = fc->range.to;		/* 'to' is NOT in the range */
 	} else {
 		/* Range too small, grab everything */
-		*from = fc->from;
-		*to = fc->to;
+		*from = fc->range.from;
+		*to = fc->range.to;
 	}
 
 	*chunk = fc;
@@ -5939,8 +6639,8 @@ file_info_reserve(const struct download *d,
 
 	g_assert(to >= from);
 	if (chunk != NULL) {
-		g_assert(from >= chunk->from);
-		g_assert(to <= chunk->to);
+		g_assert(from >= chunk->range.from);
+		g_assert(to <= chunk->range.to);
 		g_assert(chunk->download != NULL);
 		g_assert(chunk->download != d);
 		g_assert(DL_CHUNK_BUSY == chunk->status);
@@ -5965,7 +6665,7 @@ file_info_reserve(const struct download *d,
 	if (GNET_PROPERTY(fileinfo_debug) > 2) {
 		int new_busy = fi_busy_count(fi, d);
 		g_assert(busy + 1 == new_busy);
-		g_assert(new_busy <= 1 + (download_pipelining(d) ? 1 : 0));
+		g_assert(new_busy <= 1 + download_pipeline_depth(d));
 		if (chunk != NULL) {
 			int updated_busy = fi_busy_count(fi, old_d);
 			g_assert(updated_busy <= old_busy);
@@ -5976,6 +6676,42 @@ file_info_reserve(const struct download *d,
 	g_assert(file_info_check_chunklist(d->file_info, TRUE));
 }
 
+/**
+ * Count busy chunks, along with the amount of busy chunks held by pipelining
+ * downloads.
+ *
+ * This is only needed when there are no empty chunks left, to determine
+ * whether we can be aggressive.
+ *
+ * @param fi		the fileinfo
+ * @param d			if non-NULL, chunks of that download are not counted
+ *					as pipelined
+ * @param busy		where amount of busy chunks is written
+ * @param pipelined	where amount of pipelined busy chunks is written
+ */
+static void
+fi_busy_chunks(const fileinfo_t *fi, const struct download *d,
+	uint *busy, uint *pipelined)
+{
+	const struct dl_file_chunk *fc;
+
+	*busy = *pipelined = 0;
+
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
+		dl_file_chunk_check(fc);
+
+		if (DL_CHUNK_BUSY != fc->status)
+			continue;
+
+		g_assert(fc->download != NULL);
+		download_check(fc->download);
+
+		(*busy)++;
+		if (fc->download != d && download_pipelining(fc->download))
+			(*pipelined)++;
+	}
+}
+
 /**
  * Finds a range to download, and stores it in *from and *to.
  *
@@ -5990,14 +6726,12 @@ file_info_reserve(const struct download *d,
 enum dl_chunk_status
 file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 {
-	slink_t *sl;
 	fileinfo_t *fi = d->file_info;
 	filesize_t chunksize;
 	unsigned busy = 0;
 	unsigned pipelined = 0;
-	int reserved;
-	eclist_t cklist;
 	const struct dl_file_chunk *chunk = NULL;
+	const struct dl_file_chunk *fc;
 
 	file_info_check(fi);
 	g_assert(fi->refcount > 0);
@@ -6006,15 +6740,21 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 
 	/*
 	 * No reservation for `d' yet unless we're pipelining, in which
-	 * case we must have exactly 1 already (the current running request),
-	 * excepted in the case of aggressive swarming where parts of our chunk
-	 * could have been stolen and completed already (in which case we'll
-	 * have none)..
+	 * case we must have 1 already for the current running request plus
+	 * 1 for each request pipelined before the one being picked, excepted
+	 * in the case of aggressive swarming where parts of our chunks could
+	 * have been stolen and completed already (in which case we'll have
+	 * fewer)..
+	 *
+	 * Counting requires a full chunklist traversal, so only check this when
+	 * debugging.
 	 */
 
-	reserved = fi_busy_count(fi, d);
-	g_assert(reserved >= 0);
-	g_assert(reserved <= (download_pipelining(d) ? 1 : 0));
+	if (GNET_PROPERTY(fileinfo_debug) > 2) {
+		int reserved = fi_busy_count(fi, d);
+		g_assert(reserved >= 0);
+		g_assert(reserved <= download_pipeline_depth(d));
+	}
 
 	/*
 	 * Ensure the file has not disappeared.
@@ -6049,7 +6789,7 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	 *		--RAM, 2005-10-27
 	 */
 
-	chunksize = fi_chunksize(fi);
+	chunksize = fi_chunksize(fi, d);
 
 	if (
 		GNET_PROPERTY(pfsp_server) && d->served_reqs == 0 &&
@@ -6083,43 +6823,43 @@ file_info_find_hole(const struct download *d, filesize_t *from, filesize_t *to)
 	 *		--RAM, 2012-12-01
 	 */
 
-	if (eslist_count(&fi->available) > 1) {
+	if (fi->avail_partial != 0) {
 		chunk = fi_pick_rarest_chunk(fi, NULL, chunksize);
 	} else {
 		chunk = GNET_PROPERTY(pfsp_server) ?
-			fi_pick_chunk(fi) : eslist_head(&fi->chunklist);
+			fi_pick_chunk(fi) : chunkset_head(&fi->chunks);
 	}
 
 	/*
-	 * Iteration is done using a "circular" list illusion, to be able to
-	 * nicely iterate even if we don't start from the head.
+	 * The first empty chunk at or after the one we picked is the one we
+	 * want to download, since we stop at the first empty chunk we see.
+	 * If there is none, we would have wrapped around to the first hole
+	 * in the file.
 	 */
 
-	eclist_init(&cklist, &fi->chunklist, chunk);
-	chunk = NULL;		/* Will be set if we pick a chunk aggressively */
+	fc = fi_hole_from(fi, chunk);
+	if (NULL == fc)
+		fc = chunkset_hole_first(&fi->chunks);
 
-	ECLIST_FOREACH(&cklist, sl) {
-		const struct dl_file_chunk *fc = eclist_data(&cklist, sl);
+	chunk = NULL;		/* Will be set if we pick a chunk aggressively */
 
+	if (fc != NULL) {
 		dl_file_chunk_check(fc);
+		g_assert(DL_CHUNK_EMPTY == fc->status);
 
-		if (DL_CHUNK_EMPTY != fc->status) {
-			if (DL_CHUNK_BUSY == fc->status) {
-				g_assert(fc->download != NULL);
-				download_check(fc->download);
-				if (fc->download != d && download_pipelining(fc->download))
-					pipelined++;
-			}
-			continue;
-		}
-
-		*from = fc->from;
-		*to = fc->to;
-		if ((fc->to - fc->from) > chunksize)
-			*to = fc->from + chunksize;
+		*from = fc->range.from;
+		*to = fc->range.to;
+		if ((fc->range.to - fc->range.from) > chunksize)
+			*to = fc->range.from + chunksize;
 		goto selected;
 	}
 
+	{
+		uint unused_busy;
+
+		fi_busy_chunks(fi, d, &unused_busy, &pipelined);
+	}
+
 	busy -= pipelined;
 	g_assert(fi->lifecount > (int32) busy); /* Or we'd found a chunk before */
 
@@ -6159,13 +6899,12 @@ file_info_find_available_hole(
 	const struct download *d, http_rangeset_t *ranges,
 	filesize_t *from, filesize_t *to)
 {
-	slink_t *sl;
 	fileinfo_t *fi;
 	filesize_t chunksize = 0;
-	eclist_t cklist;
 	uint busy = 0;
 	uint pipelined = 0;
 	const struct dl_file_chunk *chunk = NULL;
+	const struct dl_file_chunk *fc, *first;
 
 	download_check(d);
 	g_assert(ranges != NULL);
@@ -6198,36 +6937,30 @@ file_info_find_available_hole(
 	 *		--RAM, 2012-12-01
 	 */
 
-	if (eslist_count(&fi->available) > 1) {
-		chunksize = fi_chunksize(fi);
+	if (fi->avail_partial != 0) {
+		chunksize = fi_chunksize(fi, d);
 		chunk = fi_pick_rarest_chunk(fi, d, chunksize);
 	} else {
 		chunk = GNET_PROPERTY(pfsp_server) ?
-			fi_pick_chunk(fi) : eslist_head(&fi->chunklist);
+			fi_pick_chunk(fi) : chunkset_head(&fi->chunks);
 	}
 
 	/*
-	 * Iteration is done using a "circular" list illusion, to be able to
-	 * nicely iterate even if we don't start from the head.
+	 * Iteration over the empty chunks is done in a "circular" way, to be
+	 * able to nicely iterate even if we don't start from the first hole.
 	 */
 
-	eclist_init(&cklist, &fi->chunklist, chunk);
+	first = fi_hole_from(fi, chunk);
+	if (NULL == first)
+		first = chunkset_hole_first(&fi->chunks);
+
 	chunk = NULL;		/* Will be set if we pick a chunk aggressively */
 
-	ECLIST_FOREACH(&cklist, sl) {
-		const struct dl_file_chunk *fc = eclist_data(&cklist, sl);
+	for (fc = first; fc != NULL; /* empty */) {
 		const http_range_t *r;
 
-		if (DL_CHUNK_EMPTY != fc->status) {
-			if (DL_CHUNK_BUSY == fc->status) {
-				busy++;		/* Will be used by aggresive code below */
-				g_assert(fc->download != NULL);
-				download_check(fc->download);
-				if (download_pipelining(fc->download))
-					pipelined++;
-			}
-			continue;
-		}
+		dl_file_chunk_check(fc);
+		g_assert(DL_CHUNK_EMPTY == fc->status);
 
 		/*
 		 * Look whether this empty chunk intersects with one of the
@@ -6237,7 +6970,7 @@ file_info_find_available_hole(
 		 * (r->end) is part of the range.
 		 */
 
-		r = http_rangeset_lookup(ranges, fc->from, fc->to - 1);
+		r = http_rangeset_lookup(ranges, fc->range.from, fc->range.to - 1);
 
 		if (r != NULL) {
 			filesize_t start, end;
@@ -6246,9 +6979,9 @@ file_info_find_available_hole(
 			 * Intersect range and chunk, [start, end[ is the result.
 			 */
 
-			start = MAX(r->start, fc->from);
+			start = MAX(r->start, fc->range.from);
 			end = r->end + 1;
-			end = MIN(end, fc->to);
+			end = MIN(end, fc->range.to);
 
 			g_assert(start < end);		/* Intersection is non-empty */
 
@@ -6256,8 +6989,15 @@ file_info_find_available_hole(
 			*to = end;
 			goto found;
 		}
+
+		fc = fi_hole_next(fi, fc);
+		if (NULL == fc)
+			fc = chunkset_hole_first(&fi->chunks);		/* Wrap around */
+		if (fc == first)
+			break;								/* Went full circle */
 	}
 
+	fi_busy_chunks(fi, NULL, &busy, &pipelined);
 	busy -= pipelined;
 
 	if (GNET_PROPERTY(use_aggressive_swarming)) {
@@ -6293,7 +7033,7 @@ file_info_find_available_hole(
 
 found:
 	if (0 == chunksize)
-		chunksize = fi_chunksize(fi);
+		chunksize = fi_chunksize(fi, d);
 
 	if ((*to - *from) > chunksize)
 		*to = *from + chunksize;
@@ -6679,12 +7419,12 @@ fi_get_chunks(gnet_fi_t fih)
     file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		gnet_fi_chunks_t *chunk;
 
 		WALLOC(chunk);
-		chunk->from   = fc->from;
-		chunk->to     = fc->to;
+		chunk->from   = fc->range.from;
+		chunk->to     = fc->range.to;
 		chunk->status = fc->status;
 		chunk->old    = TRUE;
 
@@ -6841,6 +7581,7 @@ file_info_add_source(fileinfo_t *fi, struct download *d)
 	}
 
 	src_event_trigger(d, EV_SRC_ADDED);
+	fi_avail_count(fi, d);
 
 	/*
 	 * Source was added, but we do not need to call fi_update_seen_on_network().
@@ -6877,6 +7618,7 @@ file_info_remove_source(fileinfo_t *fi, struct download *d)
 	 */
 
 	src_event_trigger(d, EV_SRC_REMOVED);
+	fi_avail_uncount(fi, d);
 	fi->sources = pslist_remove(fi->sources, d);
 
 	idtable_free_id(src_handle_map, d->src_handle);
@@ -6931,6 +7673,14 @@ file_info_cloned_source(fileinfo_t *fi, download_t *d, download_t *cd)
 	fi->sources = pslist_prepend(fi->sources, cd);
 	src_event_trigger(cd, EV_SRC_ADDED);
 
+	/*
+	 * The availability counted for the original download now belongs to
+	 * the clone, which got a copy of its bitmap.
+	 */
+
+	d->avail = NULL;
+	d->avail_whole = FALSE;
+
 	/*
 	 * Do not mark fileinfo dirty, we're just increasing counters.
 	 */
@@ -7344,7 +8094,7 @@ file_info_available_ranges(const fileinfo_t *fi, char *buf, size_t size)
 	header_fmt_t *fmt, *fmta = NULL;
 	bool is_first = TRUE;
 	char range[2 * UINT64_DEC_BUFLEN + sizeof(" bytes ")];
-	slink_t *sl;
+	const struct dl_file_chunk *fc;
 	int count;
 	int nleft;
 	int i;
@@ -7357,8 +8107,7 @@ file_info_available_ranges(const fileinfo_t *fi, char *buf, size_t size)
 
 	fmt = header_fmt_make(x_available_ranges, ", ", size, size);
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 
 		dl_file_chunk_check(fc);
 		if (DL_CHUNK_DONE != fc->status)
@@ -7366,14 +8115,15 @@ file_info_available_ranges(const fileinfo_t *fi, char *buf, size_t size)
 
 		str_bprintf(ARYLEN(range), "%s%s-%s",
 			is_first ? "bytes " : "",
-			filesize_to_string(fc->from), filesize_to_string2(fc->to - 1));
+			filesize_to_string(fc->range.from),
+			filesize_to_string2(fc->range.to - 1));
 
 		if (!header_fmt_append_value(fmt, range))
 			break;
 		is_first = FALSE;
 	}
 
-	if (NULL == sl)
+	if (NULL == fc)
 		goto emit;
 
 	/*
@@ -7410,8 +8160,7 @@ file_info_available_ranges(const fileinfo_t *fi, char *buf, size_t size)
 	 */
 
 	count = 0;
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		dl_file_chunk_check(fc);
 		if (DL_CHUNK_DONE == fc->status)
 			count++;
@@ -7426,8 +8175,7 @@ file_info_available_ranges(const fileinfo_t *fi, char *buf, size_t size)
 	HALLOC_ARRAY(fc_ary, count);
 	i = 0;
 
-	ESLIST_FOREACH(&fi->chunklist, sl) {
-		const struct dl_file_chunk *fc = eslist_data(&fi->chunklist, sl);
+	CHUNKSET_FOREACH(&fi->chunks, fc) {
 		dl_file_chunk_check(fc);
 
 		if (DL_CHUNK_DONE == fc->status)
@@ -7453,7 +8201,8 @@ file_info_available_ranges(const fileinfo_t *fi, char *buf, size_t size)
 
 		str_bprintf(ARYLEN(range), "%s%s-%s",
 			is_first ? "bytes " : "",
-			filesize_to_string(fc->from), filesize_to_string2(fc->to - 1));
+			filesize_to_string(fc->range.from),
+			filesize_to_string2(fc->range.to - 1));
 
 		if (header_fmt_append_value(fmt, range))
 			is_first = FALSE;
@@ -7510,14 +8259,10 @@ file_info_restrict_range(fileinfo_t *fi, filesize_t start, filesize_t *end)
 	file_info_check(fi);
 	g_assert(file_info_check_chunklist(fi, TRUE));
 
-	ESLIST_FOREACH_DATA(&fi->chunklist, fc) {
-		dl_file_chunk_check(fc);
-
-		if (DL_CHUNK_DONE != fc->status)
-			continue;
+	fc = fi_chunk_lookup(fi, start);
 
-		if (start < fc->from || start >= fc->to)
-			continue;		/* `start' is not in the range */
+	if (fc != NULL && DL_CHUNK_DONE == fc->status) {
+		dl_file_chunk_check(fc);
 
 		/*
 		 * We found an available chunk within which `start' falls.
@@ -7525,8 +8270,8 @@ file_info_restrict_range(fileinfo_t *fi, filesize_t start, filesize_t *end)
 		 * shrink the end.
 		 */
 
-		if (*end >= fc->to)
-			*end = fc->to - 1;
+		if (*end >= fc->range.to)
+			*end = fc->range.to - 1;
 
 		return TRUE;
 	}
@@ -7606,440 +8351,6 @@ file_info_get_file_url(gnet_fi_t handle)
 	return fi->done > 0 ? url_from_absolute_path(fi->pathname) : NULL;
 }
 
-/**
- * Compares two available ranges.
- *
- * Our relative order is a lexicographic order on (start, length), and
- * two chunks are identical only when they start on the same position are
- * have the same length.
- */
-static int
-fi_avail_cmp(const void *a, const void *b)
-{
-	const struct dl_avail_chunk *ca = a, *cb = b;
-
-	if (ca->from == cb->from) {
-		size_t la = ca->to - ca->from;
-		size_t lb = cb->to - cb->from;
-
-		return CMP(la, lb);
-	}
-
-	return CMP(ca->from, cb->from);
-}
-
-/**
- * Compares two available ranges so that two ranges are equal when they
- * overlap.
- */
-static int
-fi_overlap_cmp(const void *a, const void *b)
-{
-	const struct dl_avail_chunk *ca = a, *cb = b;
-
-	if (ca->to <= cb->from)
-		return -1;
-
-	if (cb->to <= ca->from)
-		return +1;
-
-	return 0;		/* Overlapping ranges are equal */
-}
-
-/**
- * Compares two available ranges on the amount of sources that provide them.
- */
-static int
-fi_avail_source_cmp(const void *a, const void *b)
-{
-	const struct dl_avail_chunk *ca = a, *cb = b;
-	int c;
-
-	c = CMP(ca->sources, cb->sources);
-	return 0 == c ? CMP(ca->from, cb->from) : c;
-}
-
-/**
- * Count one more source offering chunk [from, to[.
- *
- * @param rbt		the red-black tree where we store available chunks
- * @param from		start of chunk
- * @param to		first byte beyond chunk
- */
-static void
-fi_count_source(rbtree_t *rbt, filesize_t from, filesize_t to)
-{
-	struct dl_avail_chunk *ac;
-	struct dl_avail_chunk key;
-
-	key.from = from;
-	key.to = to;
-
-	ac = rbtree_lookup(rbt, &key);
-	if (NULL == ac) {
-		ac = dl_avail_chunk_new(from, to, 1);
-		rbtree_insert(rbt, ac);
-	} else {
-		ac->sources++;
-	}
-}
-
-/**
- * Spread offered chunk `ac' to the list of available chunks held in the
- * red-black tree, updating the amount of sources offering each range of
- * the file.
- *
- * This is an important step in our computation of the rarest chunks offered
- * on the network.
- *
- * @param arbt		red-black tree listing available chunks with source count
- * @param ac		the offered chunk we're adding to the existing set
- */
-static void
-fi_update_available_forward(rbtree_t *arbt, const struct dl_avail_chunk *ac)
-{
-	filesize_t from;					/* Starting point of added chunk */
-
-	dl_avail_chunk_check(ac);
-
-	from = ac->from;
-
-	do {
-		struct dl_avail_chunk key;
-		struct dl_avail_chunk *avc;		/* Available chunk */
-		rbnode_t *node;					/* Tree node for faster iteration */
-
-		key.from = from;
-		key.to = ac->to;
-
-		avc = rbtree_lookup_node(arbt, &key, &node);
-
-		if (NULL == avc) {
-			struct dl_avail_chunk *anew;
-
-			/* Chunk overlaps with nothing -> new entry and we're done */
-
-			anew = dl_avail_chunk_new(from, ac->to, ac->sources);
-			rbtree_insert(arbt, anew);
-			break;
-		}
-
-		/*
-		 * Chunk `avc' overlaps with `ac'.
-		 * There are six main configurations possible, with case #0 being
-		 * handled flexibly (i.e. it can start / end on the same boundaries):
-		 *
-		 *   #0:         [=avc=]
-		 *              [---ac--]
-		 *
-		 *   #1:           [====avc====]
-		 *              [---ac--]
-		 *
-		 *   #2:       [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #3:     [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #4:   [====avc====]
-		 *             [---ac--]
-		 *
-		 *   #5: [====avc====]
-		 *             [---ac--]
-		 *
-		 * We want to find the first available chunk which overlaps with `ac'.
-		 */
-
-		 for (;;) {
-			struct dl_avail_chunk *prev;
-			rbnode_t *pnode = node;
-
-			prev = rbtree_prev_node(arbt, &pnode);
-			if (NULL == prev)
-				break;		/* No other available chunk before `avc' */
-
-			if (prev->to <= from)
-				break;		/* No overlap with `ac' */
-
-			avc = prev;
-			node = pnode;
-		}
-
-		/*
-		 * Handle cases #0 and #1 by creating a new available chunk at
-		 * the beginning, then handling the overlapping part.
-		 */
-
-		if (from < avc->from) {
-			struct dl_avail_chunk *anew;
-
-			g_assert(avc->from < ac->to);	/* Overlaps with `ac' */
-
-			anew = dl_avail_chunk_new(from, avc->from, ac->sources);
-			rbtree_insert(arbt, anew);
-			from = avc->from;
-		}
-
-		/*
-		 * Handle cases #2, #3, #4 and #5 by splitting the existing available
-		 * chunk up to the start of the offered chunk `ac', and anything
-		 * following the end of `ac'.
-		 */
-
-		if (avc->from <= from) {
-			struct dl_avail_chunk *anew;
-			filesize_t to = MIN(avc->to, ac->to);	/* Upper intersection */
-			filesize_t avc_to = avc->to;
-			size_t sources = avc->sources;
-
-			g_assert(avc->to > from);			/* Overlaps with `ac' */
-
-			if (avc->from == from) {
-				/* Case #2, or case #0 with matching start */
-				avc->sources += ac->sources;	/* For the common part */
-
-				if (avc->to > ac->to)			/* `avc' longer than `ac' */
-					avc->to = ac->to;			/* Extra part added below */
-			} else {
-				/* Not case #2 */
-				avc->to = from;					/* Truncates `avc' */
-
-				/*
-				 * Insert the common part with added source counts.
-				 */
-
-				anew = dl_avail_chunk_new(from, to, ac->sources + avc->sources);
-				rbtree_insert(arbt, anew);
-
-				avc = rbtree_next_node(arbt, &node);
-				g_soft_assert(avc == anew);		/* The chunk we just inserted */
-			}
-
-			/* Handle rightmost part of cases #2 and #3 */
-
-			if (avc_to > to) {
-				anew = dl_avail_chunk_new(to, avc_to, sources);
-				rbtree_insert(arbt, anew);
-
-				avc = rbtree_next_node(arbt, &node);
-				g_soft_assert(avc == anew);
-
-				break;		/* We've consumed the whole `ac' */
-			}
-
-			from = to;
-		}
-	} while (from < ac->to);
-}
-
-/**
- * Recompute rarest chunk information based on all the available sources.
- */
-static void
-fi_update_rarest_chunks(fileinfo_t *fi)
-{
-	pslist_t *sl;
-	rbtree_t *rbt, *arbt;
-	rbtree_iter_t *iter;
-	size_t sources;
-	const void *item;
-
-	if (!fi->file_size_known)
-		return;
-
-	if (GNET_PROPERTY(fileinfo_debug) > 5)
-		g_debug("%s(): updating available for %s", G_STRFUNC, fi->pathname);
-
-	/*
-	 * The following comments highlight the important steps needed to compute
-	 * the list of chunks available for the file with, for each chunk, the
-	 * amount of source that can serve it.
-	 *
-	 * We have the following scenario, depicting the chunks offered:
-	 *
-	 * Source #1:    [-A--]   [---B--]       [--C---]
-	 * Source #2:    [-----------------D-----------------] (whole file)
-	 * Source #3:          [------E------]      [---F----]
-	 * Source #4:    [-----------------G-----------------] (whole file)
-	 *
-	 * We want to build:
-	 *
-	 * Available:    [=a==][b][==c===][d=][e][f][=g=][=h=]
-	 * # of sources:   3    3     4    3   2  3   4    3
-	 *
-	 * The rarest chunk is "e" (2 sources only provide that range) so this is
-	 * the part of the file that needs to be downloaded first.
-	 *
-	 * To compute this, we loop over all the "alive" sources we know about
-	 * for a file and for which we have chunk availability information.
-	 *
-	 * Each of the chunks (A, B, C, D, etc..) is inserted into a red-black tree
-	 * whose ordering function is based on the chunk starting offset, then the
-	 * length of the chunk (smallest length is smaller).
-	 * When a chunk is already present, we increase its availability count:
-	 * for instance, chunks D and G are identical according to our ordering
-	 * function, hence when G is inserted, we simply increase the availability
-	 * from 1 to 2.
-	 */
-
-	rbt = rbtree_create(fi_avail_cmp);
-	sources = 0;
-
-	PSLIST_FOREACH(fi->sources, sl) {
-		const download_t *d = sl->data;
-
-		download_check(d);
-		g_assert(fi == d->file_info);
-
-		sources++;
-
-		if (!fi->use_swarming || !(d->flags & DL_F_PARTIAL)) {
-			/* Whole range available */
-			fi_count_source(rbt, 0, fi->size);
-		} else if (NULL == d->ranges) {
-			/* Partial file with no known ranges, ignore */
-			continue;
-		} else {
-			const http_range_t *r;
-
-			HTTP_RANGE_FOREACH(d->ranges, r) {
-				fi_count_source(rbt, r->start, r->end + 1);
-			}
-		}
-	}
-
-	if (GNET_PROPERTY(fileinfo_debug) > 5) {
-		g_debug("- collected %zu range%s out of %zu source%s:",
-			rbtree_count(rbt), plural(rbtree_count(rbt)),
-			sources, plural(sources));
-
-		iter = rbtree_iter_new(rbt);
-		while (rbtree_iter_next(iter, &item)) {
-			const struct dl_avail_chunk *ac = item;		/* Chunk offered */
-			g_debug("   [%s, %s] (%.2f%%) %zu source%s",
-				filesize_to_string(ac->from), filesize_to_string2(ac->to),
-				100.0 * (ac->to - ac->from) / (0 == fi->size ? 1 : fi->size),
-				ac->sources, plural(ac->sources));
-		}
-		rbtree_iter_release(&iter);
-	}
-
-	/*
-	 * All the unique chunks are in the red-black tree, we can iterate in order
-	 * (so our visiting order will be A, D, E, B, etc..) and create the list
-	 * of chunks representing the available regions and the amount of times they
-	 * are offered (list of chunks a, b, c, d etc...).
-	 *
-	 * In our example, starting with "A" we get:
-	 *
-	 *     [--A-]
-	 *     [====]
-	 *        1
-	 *
-	 * because chunk "A" is present once. Then we process "D" so the list now
-	 * becomes:
-	 *
-	 *     [----------------D------------------]
-	 *     [====][=============================]
-	 *        3                  2
-	 *
-	 * because "A" and "D" overlap so the "A" part is available twice but the
-	 * count associated to "D" was 2 (chunks "D" and "G" are equal).  Then we
-	 * process "E" and we further split the second chunk in our list:
-	 *
-	 *           [------E------]
-	 *     [====][=============][==============]
-	 *        3         3                2
-	 *
-	 * Encountering "B"
-	 *
-	 *              [---B--]
-	 *     [====][=][======][==][==============]
-	 *       3    3    4     3          2
-	 *
-	 * we further split the chunk, counting one more occurrence for the region
-	 * covered by "B".
-	 *
-	 * This list is also held in a red-black tree during construction, to
-	 * optimize lookups, but here we have only non-overlapping chunks
-	 * so we use a different comparison function.  The red-black tree will
-	 * be linearized into an embedded list at the end.
-	 */
-
-	file_info_available_free(fi);		/* Discard previous computation */
-
-	arbt = rbtree_create(fi_overlap_cmp);
-	iter = rbtree_iter_new(rbt);
-
-	while (rbtree_iter_next(iter, &item)) {
-		const struct dl_avail_chunk *ac = item;		/* Chunk offered */
-
-		fi_update_available_forward(arbt, ac);
-	}
-
-	rbtree_iter_release(&iter);
-
-	if (GNET_PROPERTY(fileinfo_debug) > 5) {
-		filesize_t available = 0;
-
-		iter = rbtree_iter_new(arbt);
-
-		g_debug("- identified %zu available range%s over file:",
-			rbtree_count(arbt), plural(rbtree_count(arbt)));
-
-		while (rbtree_iter_next(iter, &item)) {
-			const struct dl_avail_chunk *avc = item;
-
-			dl_avail_chunk_check(avc);
-
-			g_debug("   [%s, %s] %zu source%s",
-				filesize_to_string(avc->from), filesize_to_string2(avc->to),
-				avc->sources, plural(avc->sources));
-
-			available += avc->to - avc->from;	/* For logging */
-		}
-
-		g_soft_assert_log(available <= fi->size,
-			"available=%s, fi->size=%s",
-			filesize_to_string(available), filesize_to_string2(fi->size));
-
-		g_debug("=> %s out of %s bytes available (%.2f%%)",
-			filesize_to_string(available), filesize_to_string2(fi->size),
-			100.0 * available / fi->size);
-
-		rbtree_iter_release(&iter);
-	}
-
-	/*
-	 * In the end, we can dispose of the red-black trees and need only to keep
-	 * the list of chunks available along with their availability count.
-	 */
-
-	rbtree_discard(rbt, dl_avail_chunk_free);
-	rbtree_free_null(&rbt);
-
-	iter = rbtree_iter_new(arbt);
-
-	while (rbtree_iter_next(iter, &item)) {
-		struct dl_avail_chunk *avc = deconstify_pointer(item);
-
-		dl_avail_chunk_check(avc);
-		eslist_append(&fi->available, avc);
-	}
-
-	rbtree_iter_release(&iter);
-	rbtree_free_null(&arbt);	/* Its items are now listed in fi->available */
-
-	/*
-	 * Sort the list so that the rarest chunks come first.
-	 *
-	 * Note that when there are no partial sources, there is only one available
-	 * chunk in the list: the chunk representing the whole file.
-	 */
-
-	eslist_sort(&fi->available, fi_avail_source_cmp);
-}
-
 /**
  * Callback for updates to ranges available on the network.
  *
@@ -8067,11 +8378,11 @@ fi_update_seen_on_network(gnet_src_t srcid)
 	file_info_check(fi);
 
 	/*
-	 * We have new range information probably, so we need to recompute
-	 * the rarest chunks.
+	 * We have new range information probably, so we need to update the
+	 * availability counts used to pick the rarest chunks.
 	 */
 
-	fi_update_rarest_chunks(fi);
+	fi_avail_update(fi, d);
 
 	if (GNET_PROPERTY(fileinfo_debug) > 5)
 		g_debug("%s(): updating ranges for %s", G_STRFUNC, fi->pathname);
@@ -8396,6 +8707,8 @@ file_info_init(void)
 						HASH_KEY_FIXED, GUID_RAW_SIZE);
 	fi_by_outname  = hikset_create(offsetof(fileinfo_t, pathname),
 						HASH_KEY_STRING, 0);
+	fi_journal_pending = hikset_create(offsetof(fileinfo_t, guid),
+						HASH_KEY_FIXED, GUID_RAW_SIZE);
 
     fi_handle_map = idtable_new(32);
 
@@ -125,7 +125,6 @@
 #include "lib/hikset.h"
 #include "lib/host_addr.h"
 #include "lib/hset.h"
-#include "lib/htable.h"
 #include "lib/listener.h"
 #include "lib/misc.h"			/* For vlint_decode() and dump_hex() */
 #include "lib/nid.h"
@@ -133,6 +132,7 @@
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/ripening.h"
+#include "lib/rpctab.h"
 #include "lib/stacktrace.h"
 #include "lib/str.h"			/* For str_private() */
 #include "lib/stringify.h"
@@ -161,6 +161,7 @@
 #define GUESS_SYNC_PERIOD		(60 * 1000)		/**< 1 minute, in ms */
 #define GUESS_MAX_ULTRAPEERS	50000	/**< Query stops after that many acks */
 #define GUESS_RPC_LIFETIME		35000	/**< 35 seconds, in ms */
+#define GUESS_RPC_PERIOD		1000	/**< RPC timeout granularity, in ms */
 #define GUESS_G2_RPC_TIMEOUT	900		/**< 900 seconds (15 minutes!) */
 #define GUESS_FIND_DELAY		5000	/**< in ms, UDP queue flush grace */
 #define GUESS_ALPHA				5		/**< Level of query concurrency */
@@ -260,7 +261,6 @@ struct guess_rpc {
 	const guid_t *muid;				/**< MUIG of the message sent (atom) */
 	const gnet_host_t *host;		/**< Host we sent message to (atom) */
 	guess_rpc_cb_t cb;				/**< Callback routine to invoke */
-	cevent_t *timeout;				/**< Callout queue timeout event */
 	struct guess_pmsg_info *pmi;	/**< Meta information about message sent */
 	const g2_tree_t *t;				/**< Parsed G2 tree (for G2 RPCs only) */
 	unsigned hops;					/**< Hop count at RPC issue time */
@@ -299,31 +299,6 @@ guess_pmsg_info_check(const struct guess_pmsg_info * const pmi)
 	g_assert(GUESS_PMI_MAGIC == pmi->magic);
 }
 
-/**
- * Key used to register RPCs sent to ultrapeers: we send a query, we expect
- * a Pong acknowledging the query.
- *
- * Because we want to use the same MUID for all the query messages sent by
- * a GUESS query (to let other servents spot duplicates, e.g. leaves attached
- * to several ultrapeers and receiving the GUESS query through multiple routes
- * thanks to our iteration), we cannot just use the MUID as the RPC key.
- *
- * We can't use MUID + IP:port (of the destination) either because there is no
- * guarantee the reply will come back on the port to which we sent the message,
- * due to possible port forwarding on their side or remapping on the way out.
- *
- * Therefore, we use the MUID + IP of the destination, which imposes us an
- * internal limit: we cannot query multiple servents on the same IP address
- * in a short period of time (the RPC timeout period).  In practice, this is
- * not going to be a problem, although of course we need to make sure we handle
- * the situation on our side and avoid querying multiple servents on the same
- * IP whilst there are pending RPCs to this IP.
- */
-struct guess_rpc_key {
-	const struct guid *muid;
-	host_addr_t addr;
-};
-
 /**
  * DBM wrapper to associate a host with its Query Key and other information.
  */
@@ -411,7 +386,6 @@ guess_qk_rpc_check(const struct guess_qk_rpc * const ctx)
 
 static hevset_t *gqueries;				/**< Running GUESS queries */
 static hikset_t *gmuid;					/**< MUIDs of active queries */
-static htable_t *pending;				/**< Pending pong acknowledges */
 static hash_list_t *link_cache;			/**< GUESS "link cache" */
 static hash_list_t *load_pending;		/**< Queries waiting for DBMW loading */
 static hash_list_t *alive_cache;		/**< Cache of zero-timeout hosts */
@@ -430,6 +404,28 @@ static uint64 guess_target_bw;			/**< Outgoing b/w target for period */
 static int guess_alpha = GUESS_ALPHA;	/**< Concurrency query parameter */
 static time_t guess_qk_threshtime;		/**< Stamp threshold for query keys */
 
+/**
+ * Pending RPCs sent to ultrapeers: we send a query, we expect a Pong
+ * acknowledging the query.
+ *
+ * Because we want to use the same MUID for all the query messages sent by
+ * a GUESS query (to let other servents spot duplicates, e.g. leaves attached
+ * to several ultrapeers and receiving the GUESS query through multiple routes
+ * thanks to our iteration), we cannot just use the MUID as the RPC key.
+ *
+ * We can't use MUID + IP:port (of the destination) either because there is no
+ * guarantee the reply will come back on the port to which we sent the message,
+ * due to possible port forwarding on their side or remapping on the way out.
+ *
+ * Therefore, we use the MUID + IP of the destination, which imposes us an
+ * internal limit: we cannot query multiple servents on the same IP address
+ * in a short period of time (the RPC timeout period).  In practice, this is
+ * not going to be a problem, although of course we need to make sure we handle
+ * the situation on our side and avoid querying multiple servents on the same
+ * IP whilst there are pending RPCs to this IP.
+ */
+static rpctab_t *pending;
+
 static void guess_discovery_enable(void);
 static void guess_iterate(guess_t *gq);
 static bool guess_send(guess_t *gq, const gnet_host_t *host);
@@ -767,54 +763,6 @@ free_qkdata(void *valptr, size_t len)
 	WFREE_NULL(qk->query_key, qk->length);
 }
 
-/**
- * Hash function for a GUESS RPC key.
- */
-static unsigned
-guess_rpc_key_hash(const void *key)
-{
-	const struct guess_rpc_key *k = key;
-
-	return guid_hash(k->muid) ^ host_addr_hash(k->addr);
-}
-
-/**
- * Equality function for a GUESS RPC key.
- */
-static int
-guess_rpc_key_eq(const void *a, const void *b)
-{
-	const struct guess_rpc_key *ka = a, *kb = b;
-
-	return guid_eq(ka->muid, kb->muid) && host_addr_equiv(ka->addr, kb->addr);
-}
-
-/**
- * Allocate a GUESS RPC key.
- */
-static struct guess_rpc_key *
-guess_rpc_key_alloc(
-	const struct guid *muid, const gnet_host_t *host)
-{
-	struct guess_rpc_key *k;
-
-	WALLOC(k);
-	k->muid = atom_guid_get(muid);
-	k->addr = gnet_host_get_addr(host);
-
-	return k;
-}
-
-/**
- * Free a GUESS RPC key.
- */
-static void
-guess_rpc_key_free(struct guess_rpc_key *k)
-{
-	atom_guid_free_null(&k->muid);
-	WFREE(k);
-}
-
 /**
  * @return human-readable parallelism mode
  */
@@ -903,7 +851,6 @@ guess_rpc_destroy(struct guess_rpc *grp)
 
 	atom_guid_free_null(&grp->muid);
 	atom_host_free_null(&grp->host);
-	cq_cancel(&grp->timeout);
 	grp->magic = 0;
 	WFREE(grp);
 }
@@ -914,23 +861,13 @@ guess_rpc_destroy(struct guess_rpc *grp)
 static void
 guess_rpc_remove(const struct guess_rpc *grp)
 {
-	const void *orig_key;
 	void *value;
-	struct guess_rpc_key key;
-	bool found;
 
 	guess_rpc_check(grp);
 
-	key.muid = grp->muid;
-	key.addr = gnet_host_get_addr(grp->host);
-
-	found = htable_lookup_extended(pending, &key, &orig_key, &value);
+	value = rpctab_remove(pending, grp->muid, gnet_host_get_addr(grp->host));
 
-	g_assert(found);
 	g_assert(value == grp);
-
-	htable_remove(pending, &key);
-	guess_rpc_key_free(deconstify_pointer(orig_key));
 }
 
 /**
@@ -949,16 +886,12 @@ guess_rpc_free(struct guess_rpc *grp)
 static void
 guess_rpc_cancel(guess_t *gq, const gnet_host_t *host)
 {
-	struct guess_rpc_key key;
 	struct guess_rpc *grp;
 
 	guess_check(gq);
 	g_assert(host != NULL);
 
-	key.muid = gq->muid;
-	key.addr = gnet_host_get_addr(host);
-
-	grp = htable_lookup(pending, &key);
+	grp = rpctab_lookup(pending, gq->muid, gnet_host_get_addr(host));
 	guess_rpc_free(grp);
 
 	g_assert(gq->rpc_pending > 0);
@@ -982,19 +915,19 @@ guess_rpc_cancel(guess_t *gq, const gnet_host_t *host)
 }
 
 /**
- * RPC timeout function.
+ * RPC timeout function, invoked once the RPC has been removed from the
+ * table of pending RPCs.
  */
 static void
-guess_rpc_timeout(cqueue_t *cq, void *obj)
+guess_rpc_timeout(void *value, void *unused_data)
 {
-	struct guess_rpc *grp = obj;
+	struct guess_rpc *grp = value;
 	guess_t *gq;
 
 	guess_rpc_check(grp);
+	(void) unused_data;
 
-	cq_zero(cq, &grp->timeout);
 	gq = guess_is_alive(grp->gid);
-	guess_rpc_remove(grp);				/* Remove before invoking callback */
 	if (gq != NULL)
 		(*grp->cb)(grp, NULL, gq);		/* Timeout */
 	guess_rpc_destroy(grp);
@@ -1019,20 +952,15 @@ guess_rpc_register(const gnet_host_t *host, const guid_t *muid, bool g2,
 	struct nid gid, guess_rpc_cb_t cb, time_t *earliest)
 {
 	struct guess_rpc *grp;
-	struct guess_rpc_key key;
-	struct guess_rpc_key *k;
+	host_addr_t addr = gnet_host_get_addr(host);
 	time_delta_t delay;
 
-	key.muid = muid;
-	key.addr = gnet_host_get_addr(host);
-
-	grp = htable_lookup(pending, &key);
+	grp = rpctab_lookup(pending, muid, addr);
 
 	if (grp != NULL) {
 		guess_rpc_check(grp);
-		g_assert(grp->timeout != NULL);
 
-		delay = cq_remaining(grp->timeout) / 1000;	/* Seconds */
+		delay = rpctab_remaining(pending, muid, addr) / 1000;	/* Seconds */
 		*earliest = time_advance(tm_time(), delay);
 
 		if (GNET_PROPERTY(guess_client_debug) > 1) {
@@ -1067,10 +995,9 @@ guess_rpc_register(const gnet_host_t *host, const guid_t *muid, bool g2,
 	grp->muid = atom_guid_get(muid);
 	grp->gid = gid;
 	grp->cb = cb;
-	grp->timeout = cq_main_insert(GUESS_RPC_LIFETIME, guess_rpc_timeout, grp);
 
-	k = guess_rpc_key_alloc(muid, host);
-	htable_insert(pending, k, grp);
+	if (!rpctab_insert(pending, muid, addr, grp, GUESS_RPC_LIFETIME))
+		g_assert_not_reached();		/* Checked above */
 
 	return grp;		/* OK, RPC can be issued */
 }
@@ -1084,16 +1011,15 @@ guess_rpc_register(const gnet_host_t *host, const guid_t *muid, bool g2,
 bool
 guess_rpc_handle(gnutella_node_t *n)
 {
-	struct guess_rpc_key key;
+	const guid_t *muid;
 	struct guess_rpc *grp;
 	guess_t *gq;
 
 	g_assert(!NODE_TALKS_G2(n));
 
-	key.muid = gnutella_header_get_muid(&n->header);
-	key.addr = n->addr;
+	muid = gnutella_header_get_muid(&n->header);
 
-	grp = htable_lookup(pending, &key);
+	grp = rpctab_lookup(pending, muid, n->addr);
 	if (NULL == grp)
 		return FALSE;
 
@@ -1113,7 +1039,7 @@ guess_rpc_handle(gnutella_node_t *n)
 			if (GNET_PROPERTY(guess_client_debug)) {
 				g_warning("GUESS QUERY[%s] got RPC reply for #%s from %s "
 					"but message to %s still unsent?",
-					nid_to_string(&gq->gid), guid_hex_str(key.muid),
+					nid_to_string(&gq->gid), guid_hex_str(muid),
 					node_infostr(n), gnet_host_to_string(grp->pmi->host));
 			}
 			return FALSE;		/* Don't handle message */
@@ -2478,7 +2404,7 @@ guess_late_qa(const gnutella_node_t *n, const g2_tree_t *t, const guid_t *muid)
 static void
 guess_g2_rpc_handle(const gnutella_node_t *n, const g2_tree_t *t, void *unused)
 {
-	struct guess_rpc_key key;
+	const guid_t *muid;
 	struct guess_rpc *grp;
 	guess_t *gq;
 	enum g2_msg type;
@@ -2561,16 +2487,15 @@ guess_g2_rpc_handle(const gnutella_node_t *n, const g2_tree_t *t, void *unused)
 		return;
 	}
 
-	key.muid = payload;
-	key.addr = n->addr;
-	grp = htable_lookup(pending, &key);
+	muid = payload;
+	grp = rpctab_lookup(pending, muid, n->addr);
 
 	/*
 	 * If the GUESS RPC has expired, deal with the /QA as a late arrival.
 	 */
 
 	if (NULL == grp) {
-		guess_late_qa(n, t, key.muid);
+		guess_late_qa(n, t, muid);
 		return;
 	}
 
@@ -2587,7 +2512,7 @@ guess_g2_rpc_handle(const gnutella_node_t *n, const g2_tree_t *t, void *unused)
 			if (GNET_PROPERTY(guess_client_debug)) {
 				g_warning("GUESS QUERY[%s] got RPC reply for #%s from %s "
 					"but message to %s still unsent?",
-					nid_to_string(&gq->gid), guid_hex_str(key.muid),
+					nid_to_string(&gq->gid), guid_hex_str(muid),
 					node_infostr(n), gnet_host_to_string(grp->pmi->host));
 			}
 			return;		/* Don't handle message */
@@ -5870,6 +5795,7 @@ guess_init(void)
 		gnet_host_hash, gnet_host_equal, FALSE);
 
 	dbmw_set_map_cache(db_qkdata, GUESS_QK_MAP_CACHE_SIZE);
+	dbmw_set_map_mmap(db_qkdata, TRUE);		/* Read-mostly database */
 
 	guess_cache_init(&guess_02_cache);
 	guess_cache_init(&guess_g2_cache);
@@ -5894,7 +5820,7 @@ guess_init(void)
 	link_cache = hash_list_new(gnet_host_hash, gnet_host_equal);
 	alive_cache = hash_list_new(gnet_host_hash, gnet_host_equal);
 	load_pending = hash_list_new(pointer_hash, NULL);
-	pending = htable_create_any(guess_rpc_key_hash, NULL, guess_rpc_key_eq);
+	pending = rpctab_make(GUESS_RPC_PERIOD, guess_rpc_timeout, NULL);
 	guess_qk_reqs = aging_make(GUESS_QK_FREQ,
 		gnet_host_hash, gnet_host_equal, gnet_host_free_atom2);
 	guess_alien = aging_make(GUESS_ALIEN_FREQ,
@@ -5928,11 +5854,10 @@ guess_free_query(void *value, void *unused_data)
  * Free RPC callback descriptor.
  */
 static void
-guess_rpc_free_kv(const void *key, void *val, void *unused_x)
+guess_rpc_free_kv(void *val, void *unused_x)
 {
 	(void) unused_x;
 
-	guess_rpc_key_free(deconstify_pointer(key));
 	guess_rpc_destroy(val);
 }
 
@@ -5957,10 +5882,10 @@ guess_close(void)
 	guess_cache_free(&guess_g2_cache);
 
 	hevset_foreach(gqueries, guess_free_query, NULL);
-	htable_foreach(pending, guess_rpc_free_kv, NULL);
+	rpctab_foreach(pending, guess_rpc_free_kv, NULL);
 	hevset_free_null(&gqueries);
 	hikset_free_null(&gmuid);
-	htable_free_null(&pending);
+	rpctab_free_null(&pending);
 	aging_destroy(&guess_qk_reqs);
 	aging_destroy(&guess_alien);
 	aging_destroy(&guess_old_muids);
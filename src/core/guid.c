@@ -852,6 +852,8 @@ guid_init(void)
 		db_guid_base, kv, packing, 1,
 		guid_hash, guid_eq, FALSE);
 
+	dbmw_set_map_wal(db_guid, TRUE);		/* Frequently updated database */
+
 	guid_prune_old();
 
 	guid_prune_ev = cq_periodic_main_add(
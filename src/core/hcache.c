@@ -96,6 +96,7 @@
  */
 typedef struct hostcache_entry {
     hcache_type_t type;				/**< Hostcache which contains this host */
+    uint          slot;				/**< Index in the hostcache host array */
     time_t        time_added;		/**< Time when entry was added */
 } hostcache_entry_t;
 
@@ -105,6 +106,11 @@ static const void *no_metadata;
 
 /**
  * A hostcache table.
+ *
+ * Hosts are kept in a list, newest first, which is used to expire and prune
+ * the oldest entries.  They are also kept in a compact array, in no specific
+ * order, so that we can pick hosts at random in constant time and scan them
+ * quickly.  The position of each host in the array is held in its metadata.
  */
 typedef struct hostcache {
 	const char		*name;		        /**< Name of the cache */
@@ -114,6 +120,9 @@ typedef struct hostcache {
     bool        	addr_only;			/**< Use IP only, port always 0 */
     bool			dirty;     	      	/**< If updated since last disk flush */
     hash_list_t *   hostlist;           /**< Host list: IP/Port  */
+	const gnet_host_t **hosts;			/**< Host array, for sampling */
+	uint			hosts_count;		/**< Amount of hosts in array */
+	uint			hosts_capacity;		/**< Allocated array slots */
 
     uint			hits;               /**< Hits to the cache */
     uint			misses;             /**< Misses to the cache */
@@ -122,6 +131,8 @@ typedef struct hostcache {
     int            mass_update;         /**< If a mass update is in progess */
 } hostcache_t;
 
+#define HCACHE_ARRAY_MIN	64			/**< Minimum host array capacity */
+
 static hostcache_t *caches[HCACHE_MAX];
 static cperiodic_t *hcache_save_ev;
 static cperiodic_t *hcache_timer_ev;
@@ -513,6 +524,128 @@ hcache_node_is_bad(const host_addr_t addr)
     }
 }
 
+/**
+ * Record host in the host array of the hostcache.
+ */
+static void
+hcache_array_add(hostcache_t *hc, const gnet_host_t *host,
+	hostcache_entry_t *hce)
+{
+	g_assert(hce != NULL && hce != NO_METADATA);
+
+	if (hc->hosts_count == hc->hosts_capacity) {
+		uint n = MAX(HCACHE_ARRAY_MIN, 2 * hc->hosts_capacity);
+
+		WREALLOC_ARRAY(hc->hosts, hc->hosts_capacity, n);
+		hc->hosts_capacity = n;
+	}
+
+	hce->slot = hc->hosts_count;
+	hc->hosts[hc->hosts_count++] = host;
+}
+
+/**
+ * Remove host from the host array of the hostcache.
+ *
+ * The last host of the array is moved into the freed slot.
+ */
+static void
+hcache_array_remove(hostcache_t *hc, const gnet_host_t *host,
+	const hostcache_entry_t *hce)
+{
+	uint slot;
+
+	g_assert(hce != NULL && hce != NO_METADATA);
+	g_assert(hce->slot < hc->hosts_count);
+	g_assert(host == hc->hosts[hce->slot]);
+
+	slot = hce->slot;
+
+	if (slot != --hc->hosts_count) {
+		const gnet_host_t *last = hc->hosts[hc->hosts_count];
+		hostcache_entry_t *lce = hcache_get_metadata(hc->class, last);
+
+		g_assert(lce != NULL && lce != NO_METADATA);
+
+		hc->hosts[slot] = last;
+		lce->slot = slot;
+	}
+
+	/*
+	 * Shrink the array when it becomes mostly empty, to release memory
+	 * after the cache was emptied.
+	 */
+
+	if (
+		hc->hosts_capacity > HCACHE_ARRAY_MIN &&
+		hc->hosts_count < hc->hosts_capacity / 4
+	) {
+		uint n = hc->hosts_capacity / 2;
+
+		WREALLOC_ARRAY(hc->hosts, hc->hosts_capacity, n);
+		hc->hosts_capacity = n;
+	}
+}
+
+/**
+ * Pick a host at random in the hostcache.
+ *
+ * @return a host from the cache, NULL if it is empty.
+ */
+static gnet_host_t *
+hcache_array_random(const hostcache_t *hc)
+{
+	if (0 == hc->hosts_count)
+		return NULL;
+
+	return deconstify_pointer(hc->hosts[random_value(hc->hosts_count - 1)]);
+}
+
+/**
+ * Fill `hosts' with at most `hcount' distinct hosts picked at random in
+ * the hostcache, skipping those already present in the `seen' set.
+ *
+ * @return amount of hosts filled.
+ */
+static int
+hcache_array_sample(const hostcache_t *hc, hset_t *seen,
+	gnet_host_t *hosts, int hcount)
+{
+	uint n = hc->hosts_count, j;
+	bool sample = UNSIGNED(hcount) < n;
+	int i = 0;
+
+	/*
+	 * When there are more hosts than needed, use Floyd's algorithm to pick
+	 * exactly `hcount' distinct slots: at each step we pick a slot among
+	 * the first j + 1 ones, and if it was already picked, slot j is used,
+	 * which cannot have been picked yet.
+	 *
+	 * Otherwise, take all the hosts.
+	 */
+
+	for (j = sample ? n - hcount : 0; j < n && i < hcount; j++) {
+		const gnet_host_t *h = hc->hosts[sample ? random_value(j) : j];
+
+		if (hset_contains(seen, h))
+			h = hc->hosts[j];
+
+		if (hset_contains(seen, h))
+			continue;
+
+		/*
+		 * Cannot do a struct copy, the host atom may be shorter than
+		 * the structure when holding an IPv4 address.
+		 */
+
+		gnet_host_copy(&hosts[i], h);
+		hset_insert(seen, &hosts[i]);
+		i++;
+	}
+
+	return i;
+}
+
 /**
  * Move entries from one hostcache to another. This only works if the
  * target hostcache is empty.
@@ -535,6 +668,17 @@ hcache_move_entries(hostcache_t *to, hostcache_t *from)
     to->hostlist = from->hostlist;
     from->hostlist = hash_list_new(NULL, NULL);
 
+	/*
+	 * The host array moves along, so slots recorded in metadata stay valid.
+	 */
+
+	WFREE_ARRAY_NULL(to->hosts, to->hosts_capacity);
+	to->hosts = from->hosts;
+	to->hosts_count = from->hosts_count;
+	to->hosts_capacity = from->hosts_capacity;
+	from->hosts = NULL;
+	from->hosts_count = from->hosts_capacity = 0;
+
     /*
      * Make sure that after switching hce->list points to the new
      * list HL_CAUGHT
@@ -610,6 +754,8 @@ hcache_unlink_host(hostcache_t *hc, gnet_host_t *host)
 	orig_key = hash_list_remove(hc->hostlist, host);
 	g_assert(orig_key);
 
+	hcache_array_remove(hc, host, hcache_get_metadata(hc->class, host));
+
     if (hc->mass_update == 0)
 		gnet_prop_decr_guint32(hc->hosts_in_catcher);
 
@@ -975,12 +1121,14 @@ hcache_add_internal(hcache_type_t type, time_t added,
 
 		orig_key = hash_list_remove(caches[hce->type]->hostlist, host);
 		g_assert(orig_key);
+		hcache_array_remove(caches[hce->type], host, hce);
 
 		if (caches[hce->type]->mass_update == 0) {
 			gnet_prop_decr_guint32(caches[hce->type]->hosts_in_catcher);
 		}
 
 		hash_list_prepend(hc->hostlist, host);
+		hcache_array_add(hc, host, hce);
 		caches[hce->type]->dirty = hc->dirty = TRUE;
 
 		hce->type = type;
@@ -1019,18 +1167,16 @@ hcache_add_internal(hcache_type_t type, time_t added,
 		host_atom = atom_host_get(&packed);
 	}
 
-	hcache_ht_add(type, host_atom);
+	hce = hcache_ht_add(type, host_atom);
 
 	/*
-	 * We prepend to the list instead of appending because the day
-	 * we switch it as HCACHE_FRESH_XXX, we'll start reading from there,
-	 * in effect using the most recent hosts we know about.
-	 *
-	 * Furthermore, hcache_expire() depends on the fact that new entries are
-	 * added to the beginning of the list
+	 * We prepend to the list instead of appending because hcache_expire()
+	 * and hcache_prune() depend on the fact that new entries are added to
+	 * the beginning of the list, the oldest ones being at the tail.
 	 */
 
 	hash_list_prepend(hc->hostlist, host_atom);
+	hcache_array_add(hc, host_atom, hce);
 
     hc->misses++;
 	hc->dirty = TRUE;
@@ -1339,8 +1485,13 @@ hcache_expire_cache(hostcache_t *hc, time_t now)
      * or we find one which is not expired, in which case we know that
      * all the following are also not expired, because the list is
      * sorted by time_added
+	 *
+	 * Expired hosts are removed as a batch: the amount of hosts in the
+	 * cache is only propagated once we are done.
 	 */
 
+	start_mass_update(hc);
+
     while (NULL != (h = hash_list_tail(hc->hostlist))) {
         hostcache_entry_t *hce = hcache_get_metadata(hc->class, h);
 
@@ -1355,6 +1506,8 @@ hcache_expire_cache(hostcache_t *hc, time_t now)
         }
     }
 
+	stop_mass_update(hc);
+
     return expire_count;
 }
 
@@ -1480,8 +1633,8 @@ hcache_prune(hcache_type_t type)
 
 /**
  * Fill `hosts', an array of `hcount' hosts already allocated with at most
- * `hcount' hosts from out caught list, without removing those hosts from
- * the list.
+ * `hcount' hosts picked at random from our caught list, without removing
+ * those hosts from the list.
  *
  * @param net		network preference (for HOST_ULTRA and HOST_GUESS)
  * @param type		type of host to fill in
@@ -1499,7 +1652,6 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 	hostcache_t *hc2 = NULL;
 	hset_t *seen_host =
 		hset_create_any(gnet_host_hash, gnet_host_hash2, gnet_host_equal);
-	hash_list_iter_t *iter;
 
     switch (type) {
     case HOST_ANY:
@@ -1579,59 +1731,22 @@ hcache_fill_caught_array(host_net_t net, host_type_t type,
 
 	/*
 	 * We first try to fill IPv6 addresses, or IPv4 if they only want that.
+	 *
+	 * Hosts are picked at random so that the hosts we advertise vary even
+	 * when the cache does not change much.
 	 */
 
-	iter = hash_list_iterator(hc->hostlist);
-	for (i = 0; i < hcount; i++) {
-		gnet_host_t *h;
-
-		h = hash_list_iter_next(iter);
-		if (NULL == h)
-			break;
-
-		if (hset_contains(seen_host, h))
-			continue;
-
-		/*
-		 * Cannot do a struct copy, the host atom may be shorter than
-		 * the structure when holding an IPv4 address.
-		 */
-
-		gnet_host_copy(&hosts[i], h);
-
-		hset_insert(seen_host, &hosts[i]);
-	}
-	hash_list_iter_release(&iter);
+	i = hcache_array_sample(hc, seen_host, hosts, hcount);
 
 	/*
-	 * If we have an alternate cache and if we're missing entries, iterate
-	 * once again to fill up the vector.
+	 * If we have an alternate cache and if we're missing entries, sample
+	 * it as well to fill up the vector.
 	 */
 
 	if (NULL == hc2 || i == hcount)
 		goto done;
 
-	iter = hash_list_iterator(hc2->hostlist);
-	for (/* empty */; i < hcount; i++) {
-		gnet_host_t *h;
-
-		h = hash_list_iter_next(iter);
-		if (NULL == h)
-			break;
-
-		if (hset_contains(seen_host, h))
-			continue;
-
-		/*
-		 * Cannot do a struct copy, the host atom may be shorter than
-		 * the structure when holding an IPv4 address.
-		 */
-
-		gnet_host_copy(&hosts[i], h);
-
-		hset_insert(seen_host, &hosts[i]);
-	}
-	hash_list_iter_release(&iter);
+	i += hcache_array_sample(hc2, seen_host, &hosts[i], hcount - i);
 
 done:
 	hset_free_null(&seen_host);	/* Keys point into vector */
@@ -1648,9 +1763,9 @@ done:
 bool
 hcache_find_nearby(host_type_t type, host_addr_t *addr, uint16 *port)
 {
-	gnet_host_t *h;
+	gnet_host_t *h = NULL;
 	hostcache_t *hc = NULL;
-	hash_list_iter_t *iter;
+	uint i;
 
     switch (type) {
     case HOST_ANY:
@@ -1678,17 +1793,16 @@ hcache_find_nearby(host_type_t type, host_addr_t *addr, uint16 *port)
 	if (!hc)
         g_error("%s: unknown host type: %d", G_STRFUNC, type);
 
-	/* iterate through whole list */
+	/* scan the whole host array */
 
-	iter = hash_list_iterator(hc->hostlist);
-	while (NULL != (h = hash_list_iter_next(iter))) {
-		if (host_is_nearby(gnet_host_get_addr(h))) {
+	for (i = 0; i < hc->hosts_count; i++) {
+		if (host_is_nearby(gnet_host_get_addr(hc->hosts[i]))) {
+			h = deconstify_pointer(hc->hosts[i]);
             *addr = gnet_host_get_addr(h);
             *port = gnet_host_get_port(h);
 			break;
 		}
 	}
-	hash_list_iter_release(&iter);
 
 	if (h) {
 		hcache_unlink_host(hc, h);
@@ -1811,7 +1925,13 @@ hcache_get_caught(host_type_t type, host_addr_t *addr, uint16 *port)
 	)
 		return TRUE;
 
-	h = hash_list_head(hc->hostlist);
+	/*
+	 * Pick a host at random, so that concurrent connection attempts are
+	 * spread over the whole cache instead of all going to the hosts we
+	 * learnt about last.
+	 */
+
+	h = hcache_array_random(hc);
 	if (h) {
 		*addr = gnet_host_get_addr(h);
 		*port = gnet_host_get_port(h);
@@ -1863,8 +1983,10 @@ hcache_free_null(hostcache_t **hc_ptr)
 
     g_assert(hc != NULL);
     g_assert(hash_list_length(hc->hostlist) == 0);
+	g_assert(0 == hc->hosts_count);
 
 	hash_list_free(&hc->hostlist);
+	WFREE_ARRAY_NULL(hc->hosts, hc->hosts_capacity);
 	WFREE(hc);
 	*hc_ptr = NULL;
 }
@@ -1160,6 +1160,8 @@ hostiles_init(void)
 		db_spam_base, kv, packing, SPAM_DB_CACHE_SIZE,
 		gnet_host_hash, gnet_host_equal, FALSE);
 
+	dbmw_set_map_mmap(db_spam, TRUE);		/* Read-mostly database */
+
 	hostiles_spam_prune_old();
 
 	hostiles_spam_prune_ev = cq_periodic_main_add(
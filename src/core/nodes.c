@@ -129,6 +129,7 @@
 #include "lib/parse.h"
 #include "lib/pattern.h"
 #include "lib/pmsg.h"
+#include "lib/pow2.h"
 #include "lib/pslist.h"
 #include "lib/random.h"
 #include "lib/sequence.h"
@@ -206,6 +207,11 @@
 
 #define NODE_G2_MIN_DATASIZE	1000	/**< Minimum n->data size for G2 */
 
+#define NODE_TIMER_SLOTS		16		/**< Timing wheel slots (power of 2) */
+#define NODE_TIMER_MAX_DELAY	5		/**< Max secs between two node checks */
+
+#define NODE_TIMER_SLOT(t)		((ulong) (t) & (NODE_TIMER_SLOTS - 1))
+
 const char *start_rfc822_date;			/**< RFC822 format of start_time */
 
 static pslist_t *sl_nodes;
@@ -233,6 +239,13 @@ static cpattern_t *pat_impp;
 static cpattern_t *pat_lmup;
 static cpattern_t *pat_f2ft_1;
 
+/*
+ * Timing wheel used by node_timer(): each node is linked in the slot
+ * corresponding to the second at which it must next be checked.
+ */
+static elist_t node_wheel[NODE_TIMER_SLOTS];
+static time_t node_wheel_last;		/**< Last second processed */
+
 static const char gtkg_vendor[]  = "gtk-gnutella/";
 static const char APP_G2[]       = "application/x-gnutella2";
 static const char APP_GNUTELLA[] = "application/x-gnutella-packets";
@@ -1377,336 +1390,516 @@ node_missing_vmsg(gnutella_node_t *n)
 }
 
 /**
- * Periodic node heartbeat timer.
+ * Compute when node should be checked next by node_timer(), given the
+ * state it is in.
+ *
+ * Deadlines are derived from the timeouts monitored by node_timer_check(),
+ * but conditions that can arise without the node being rescheduled, such
+ * as accumulating weird messages or entering flow-control, are only seen
+ * at the next check, hence we never wait more than NODE_TIMER_MAX_DELAY.
+ *
+ * @return the time at which the node must be checked.
  */
-void
-node_timer(time_t now)
+static time_t
+node_timer_next(const gnutella_node_t *n, time_t now)
 {
-	const pslist_t *sl;
+	time_t due = now + NODE_TIMER_MAX_DELAY;
+
+#define NODE_DUE(t) G_STMT_START {		\
+	time_t t_ = (t);					\
+	if (delta_time(t_, due) < 0)		\
+		due = t_;						\
+} G_STMT_END
 
 	/*
-	 * Asynchronously react to current peermode change.
-	 * See comment in node_set_current_peermode().
+	 * Conditions we need to monitor every second.
 	 */
 
-	if (peermode.changed) {
-		peermode.changed = FALSE;
-		node_set_current_peermode(peermode.new);
+	if (
+		(n->flags & NODE_F_BYE_SENT) ||
+		n->qrt_update != NULL ||
+		(n->searchq != NULL && sq_count(n->searchq) != 0)
+	)
+		return now + 1;
+
+	if (!(in_shutdown || GNET_PROPERTY(stop_host_get))) {
+		if (n->status == GTA_NODE_REMOVING) {
+			NODE_DUE(n->last_update +
+				GNET_PROPERTY(entry_removal_timeout) + 1);
+		} else if (NODE_IS_CONNECTING(n)) {
+			NODE_DUE(n->last_update +
+				GNET_PROPERTY(node_connecting_timeout) + 1);
+		} else if (n->status == GTA_NODE_SHUTDOWN) {
+			NODE_DUE(n->shutdown_date + n->shutdown_delay + 1);
+		} else if (settings_is_ultra() && NODE_IS_ULTRA(n)) {
+			if (NODE_MQUEUE_COUNT(n)) {
+				NODE_DUE(n->last_tx +
+					GNET_PROPERTY(node_connected_timeout) + 1);
+			}
+			if (NODE_IN_TX_FLOW_CONTROL(n)) {
+				NODE_DUE(n->tx_flowc_date +
+					GNET_PROPERTY(node_tx_flowc_timeout) + 1);
+			}
+		}
 	}
 
-	for (sl = sl_nodes; NULL != sl; /* empty */ ) {
-		gnutella_node_t *n = sl->data;
+	if (n->status == GTA_NODE_CONNECTED) {
+		if (
+			GNET_PROPERTY(node_connected_timeout) > 2*NODE_TSYNC_CHECK &&
+			(n->attrs & NODE_A_TIME_SYNC) &&
+			!(n->flags & NODE_F_TSYNC_WAIT)
+		) {
+			NODE_DUE(MIN(n->last_tx, n->last_rx) +
+				GNET_PROPERTY(node_connected_timeout) - NODE_TSYNC_CHECK + 1);
+		}
 
-		/*
-		 * NB:	As the list `sl_nodes' might be modified, the next
-		 * 		link has to be before any changes might apply!
-		 */
+		if (NODE_IS_ESTABLISHED(n)) {
+			NODE_DUE(n->last_rx + n->alive_period + 1);
+		}
 
-		sl = pslist_next(sl);
-		node_tls_refresh(n);
+		if (n->rxfc != NULL) {
+			NODE_DUE(n->rxfc->start_half_period +
+				NODE_RX_FC_HALF_PERIOD + 1);
+		}
 
-		/*
-		 * Check that we get the expected vendor message description
-		 * within a reasonable time.
-		 */
+		NODE_DUE(n->last_qrt_move + NODE_QRT_MOVE_FREQ);
+	}
 
-		if (
-			(n->flags & NODE_F_EXPECT_VMSG) &&
-			n->received > NODE_RX_VMSG_THRESH
-		) {
-			node_missing_vmsg(n);
-		}
+	if (n->qrelayed != NULL) {
+		NODE_DUE(n->qrelayed_created +
+			GNET_PROPERTY(node_queries_half_life));
+	}
 
-		/*
-		 * If we're sending a BYE message, check whether the whole TX
-		 * stack finally flushed.
-		 */
+#undef NODE_DUE
 
-		if (n->flags & NODE_F_BYE_SENT) {
-			g_assert(n->outq);
+	return delta_time(due, now) > 0 ? due : now + 1;
+}
 
-			if (in_shutdown)
-				mq_flush(n->outq); 	/* Callout queue halted during shutdown */
+/**
+ * Remove node from the timing wheel, if scheduled.
+ */
+static void
+node_timer_unschedule(gnutella_node_t *n)
+{
+	if (n->timer_due != 0) {
+		elist_link_remove(&node_wheel[NODE_TIMER_SLOT(n->timer_due)],
+			&n->timer_lk);
+		n->timer_due = 0;
+	}
+}
 
-			if (mq_pending(n->outq) == 0)
-				node_bye_sent(n);
-		}
+/**
+ * Schedule node to be checked by node_timer() at the given time.
+ */
+static void
+node_timer_schedule(gnutella_node_t *n, time_t due)
+{
+	g_assert(due != 0);
 
-		/*
-		 * No timeout during shutdowns, or when `stop_host_get' is set.
-		 */
+	node_timer_unschedule(n);
+	n->timer_due = due;
+	elist_link_append(&node_wheel[NODE_TIMER_SLOT(due)], &n->timer_lk);
+}
 
-		if (!(in_shutdown || GNET_PROPERTY(stop_host_get))) {
-			if (n->status == GTA_NODE_REMOVING) {
-				if (
-					delta_time(now, n->last_update) >
-						(time_delta_t) GNET_PROPERTY(entry_removal_timeout)
-				) {
-					node_real_remove(n);
-					continue;
-				}
-			} else if (NODE_IS_CONNECTING(n)) {
-				if (
-					delta_time(now, n->last_update) >
-						(time_delta_t) GNET_PROPERTY(node_connecting_timeout)
-				) {
-					node_send_udp_ping(n);
-					node_record_connect_failure(n->addr, n->port);
-					node_remove(n, _("Timeout"));
+/**
+ * Make sure node is checked at the next node_timer() run, when it reached
+ * a state that needs to be monitored every second.
+ */
+static void
+node_timer_wakeup(gnutella_node_t *n)
+{
+	time_t next = tm_time() + 1;
+
+	if (n->timer_due != 0 && delta_time(n->timer_due, next) > 0)
+		node_timer_schedule(n, next);
+}
+
+/**
+ * Check node for timeouts and other periodic housekeeping.
+ *
+ * @return when node must be checked next, 0 if it was physically removed.
+ */
+static time_t
+node_timer_check(gnutella_node_t *n, time_t now)
+{
+	node_tls_refresh(n);
+
+	/*
+	 * Check that we get the expected vendor message description
+	 * within a reasonable time.
+	 */
+
+	if (
+		(n->flags & NODE_F_EXPECT_VMSG) &&
+		n->received > NODE_RX_VMSG_THRESH
+	) {
+		node_missing_vmsg(n);
+	}
+
+	/*
+	 * If we're sending a BYE message, check whether the whole TX
+	 * stack finally flushed.
+	 */
+
+	if (n->flags & NODE_F_BYE_SENT) {
+		g_assert(n->outq);
+
+		if (in_shutdown)
+			mq_flush(n->outq); 	/* Callout queue halted during shutdown */
+
+		if (mq_pending(n->outq) == 0)
+			node_bye_sent(n);
+	}
+
+	/*
+	 * No timeout during shutdowns, or when `stop_host_get' is set.
+	 */
+
+	if (!(in_shutdown || GNET_PROPERTY(stop_host_get))) {
+		if (n->status == GTA_NODE_REMOVING) {
+			if (
+				delta_time(now, n->last_update) >
+					(time_delta_t) GNET_PROPERTY(entry_removal_timeout)
+			) {
+				node_real_remove(n);
+				return 0;
+			}
+		} else if (NODE_IS_CONNECTING(n)) {
+			if (
+				delta_time(now, n->last_update) >
+					(time_delta_t) GNET_PROPERTY(node_connecting_timeout)
+			) {
+				node_send_udp_ping(n);
+				node_record_connect_failure(n->addr, n->port);
+				node_remove(n, _("Timeout"));
                     hcache_add(HCACHE_TIMEOUT, n->addr, 0, "timeout");
-					continue;
-				}
-			} else if (n->status == GTA_NODE_SHUTDOWN) {
-				if (delta_time(now, n->shutdown_date) > n->shutdown_delay) {
-					char reason[1024];
+				return now + 1;
+			}
+		} else if (n->status == GTA_NODE_SHUTDOWN) {
+			if (delta_time(now, n->shutdown_date) > n->shutdown_delay) {
+				char reason[1024];
 
-					cstr_bcpy(ARYLEN(reason), n->error_str);
-					node_remove(n, _("Shutdown (%s)"), reason);
-					continue;
-				}
-			} else if (settings_is_ultra() && NODE_IS_ULTRA(n)) {
-				time_delta_t quiet = delta_time(now, n->last_tx);
+				cstr_bcpy(ARYLEN(reason), n->error_str);
+				node_remove(n, _("Shutdown (%s)"), reason);
+				return now + 1;
+			}
+		} else if (settings_is_ultra() && NODE_IS_ULTRA(n)) {
+			time_delta_t quiet = delta_time(now, n->last_tx);
 
-				/*
-				 * Ultra node connected to another ultra node.
-				 *
-				 * There is no longer any flow-control or activity
-				 * timeout between an ultra node and a leaf, as long
-				 * as they reply to eachother alive pings.
-				 *		--RAM, 11/12/2003
-				 */
+			/*
+			 * Ultra node connected to another ultra node.
+			 *
+			 * There is no longer any flow-control or activity
+			 * timeout between an ultra node and a leaf, as long
+			 * as they reply to eachother alive pings.
+			 *		--RAM, 11/12/2003
+			 */
 
-				if (
-					quiet >
-						(time_delta_t) GNET_PROPERTY(node_connected_timeout) &&
-					NODE_MQUEUE_COUNT(n)
-				) {
-					if (GNET_PROPERTY(node_debug) > 2 && n->outq != NULL)
-						g_debug("NODE activity timeout, %s", mq_info(n->outq));
+			if (
+				quiet >
+					(time_delta_t) GNET_PROPERTY(node_connected_timeout) &&
+				NODE_MQUEUE_COUNT(n)
+			) {
+				if (GNET_PROPERTY(node_debug) > 2 && n->outq != NULL)
+					g_debug("NODE activity timeout, %s", mq_info(n->outq));
 
                     hcache_add(HCACHE_TIMEOUT, n->addr, 0,
                         "activity timeout");
-					node_bye_if_writable(n, 405, "Activity timeout (%d sec%s)",
-						GNET_PROPERTY(node_connected_timeout),
-						plural(GNET_PROPERTY(node_connected_timeout)));
-					continue;
-				} else if (
-					NODE_IN_TX_FLOW_CONTROL(n) &&
-					delta_time(now, n->tx_flowc_date) >
-						(time_delta_t) GNET_PROPERTY(node_tx_flowc_timeout)
-				) {
-					if (GNET_PROPERTY(node_debug) > 2 && n->outq != NULL)
-						g_debug("NODE flow-controlled, %s", mq_info(n->outq));
+				node_bye_if_writable(n, 405, "Activity timeout (%d sec%s)",
+					GNET_PROPERTY(node_connected_timeout),
+					plural(GNET_PROPERTY(node_connected_timeout)));
+				return now + 1;
+			} else if (
+				NODE_IN_TX_FLOW_CONTROL(n) &&
+				delta_time(now, n->tx_flowc_date) >
+					(time_delta_t) GNET_PROPERTY(node_tx_flowc_timeout)
+			) {
+				if (GNET_PROPERTY(node_debug) > 2 && n->outq != NULL)
+					g_debug("NODE flow-controlled, %s", mq_info(n->outq));
 
                     hcache_add(HCACHE_UNSTABLE, n->addr, 0,
                         "flow-controlled too long");
-					node_bye(n, 405, "Flow-controlled for too long (%d sec%s)",
-						GNET_PROPERTY(node_tx_flowc_timeout),
-						plural(GNET_PROPERTY(node_tx_flowc_timeout)));
-					continue;
-				}
+				node_bye(n, 405, "Flow-controlled for too long (%d sec%s)",
+					GNET_PROPERTY(node_tx_flowc_timeout),
+					plural(GNET_PROPERTY(node_tx_flowc_timeout)));
+				return now + 1;
 			}
 		}
+	}
 
-		if (n->searchq != NULL)
-			sq_process(n->searchq, now);
+	if (n->searchq != NULL)
+		sq_process(n->searchq, now);
+
+	/*
+	 * Sanity checks for connected nodes.
+	 */
+
+	if (n->status == GTA_NODE_CONNECTED) {
+		time_delta_t tx_quiet = delta_time(now, n->last_tx);
+		time_delta_t rx_quiet = delta_time(now, n->last_rx);
+
+		if (n->n_weird >= MAX_WEIRD_MSG) {
+			g_message("removing %s due to security violation",
+				node_infostr(n));
+			ban_record(n->addr,
+				"IP with Gnutella security violations");
+			hostiles_dynamic_add(n->addr, "Gnutella security violations",
+				HSTL_WEIRD_MSG);
+			node_bye_if_writable(n, 412, "Security violation");
+			return now + 1;
+		}
+
+		if (hostiles_is_bad(n->addr)) {
+			hostiles_flags_t flags = hostiles_check(n->addr);
+			g_message("removing %s, as dynamically found hostile peer (%s)",
+				node_infostr(n), hostiles_flags_to_string(flags));
+			node_bye_if_writable(n, 415, "Hostile Peer");
+			return now + 1;
+		}
 
 		/*
-		 * Sanity checks for connected nodes.
+		 * If quiet period is nearing timeout and node supports
+		 * time-sync, send them one if none is pending.
 		 */
 
-		if (n->status == GTA_NODE_CONNECTED) {
-			time_delta_t tx_quiet = delta_time(now, n->last_tx);
-			time_delta_t rx_quiet = delta_time(now, n->last_rx);
-
-			if (n->n_weird >= MAX_WEIRD_MSG) {
-				g_message("removing %s due to security violation",
-					node_infostr(n));
-				ban_record(n->addr,
-					"IP with Gnutella security violations");
-				hostiles_dynamic_add(n->addr, "Gnutella security violations",
-					HSTL_WEIRD_MSG);
-				node_bye_if_writable(n, 412, "Security violation");
-				continue;
-			}
+		if (
+			GNET_PROPERTY(node_connected_timeout) > 2*NODE_TSYNC_CHECK &&
+			MAX(tx_quiet, rx_quiet) >
+				(time_delta_t) GNET_PROPERTY(node_connected_timeout) -
+								NODE_TSYNC_CHECK &&
+			(n->attrs & NODE_A_TIME_SYNC) &&
+			!(n->flags & NODE_F_TSYNC_WAIT)
+		) {
+			node_tsync_tcp(n);
+			n->flags |= NODE_F_TSYNC_WAIT;
+		}
 
-			if (hostiles_is_bad(n->addr)) {
-				hostiles_flags_t flags = hostiles_check(n->addr);
-				g_message("removing %s, as dynamically found hostile peer (%s)",
-					node_infostr(n), hostiles_flags_to_string(flags));
-				node_bye_if_writable(n, 415, "Hostile Peer");
-				continue;
-			}
+		/*
+		 * Only send "alive" pings if we have not received anything
+		 * for a while and if some time has elapsed since our last
+		 * attempt to send such a ping.
+		 *		--RAM, 01/11/2003
+		 */
+
+		if (
+			NODE_IS_ESTABLISHED(n) &&
+			delta_time(now, n->last_rx) > n->alive_period
+		) {
+			uint32 last;
+			uint32 avg;
+			time_delta_t period;
 
 			/*
-			 * If quiet period is nearing timeout and node supports
-			 * time-sync, send them one if none is pending.
+			 * Take the round-trip time of the ping/pongs as a base for
+			 * computing the time we should space our pings.  Indeed,
+			 * if the round-trip is 90s (taking an extreme example) due
+			 * to queuing and TCP/IP clogging and we send pings every 20
+			 * seconds, we will have sent 4 before getting a chance to see
+			 * any reply back!
+			 *		-RAM, 01/11/2003
 			 */
 
+			alive_get_roundtrip_ms(n->alive_pings, &avg, &last);
+			last = MAX(avg, last) / 1000;	/* Convert ms to seconds */
+			period = MAX(n->alive_period, (time_delta_t) last);
+
+			if (NODE_IS_TRANSIENT(n))
+				period *= ALIVE_TRANSIENT;
+
 			if (
-				GNET_PROPERTY(node_connected_timeout) > 2*NODE_TSYNC_CHECK &&
-				MAX(tx_quiet, rx_quiet) >
-					(time_delta_t) GNET_PROPERTY(node_connected_timeout) -
-									NODE_TSYNC_CHECK &&
-				(n->attrs & NODE_A_TIME_SYNC) &&
-				!(n->flags & NODE_F_TSYNC_WAIT)
+				alive_elapsed(n->alive_pings) > period &&
+				!alive_send_ping(n->alive_pings)
 			) {
-				node_tsync_tcp(n);
-				n->flags |= NODE_F_TSYNC_WAIT;
+				node_bye(n, 406, "No reply to alive pings");
+				return now + 1;
 			}
+		}
 
-			/*
-			 * Only send "alive" pings if we have not received anything
-			 * for a while and if some time has elapsed since our last
-			 * attempt to send such a ping.
-			 *		--RAM, 01/11/2003
-			 */
+		/*
+		 * Check whether we need to send more QRT patch updates.
+		 */
+
+		if (n->qrt_update != NULL) {
+			g_assert(NODE_IS_CONNECTED(n));
+			node_send_patch_step(n);
+			if (!NODE_IS_CONNECTED(n))
+				return now + 1;
+		}
+
+		/*
+		 * Check RX flow control.
+		 */
+
+		if (n->rxfc != NULL) {
+			struct node_rxfc_mon *rxfc = n->rxfc;
 
 			if (
-				NODE_IS_ESTABLISHED(n) &&
-				delta_time(now, n->last_rx) > n->alive_period
+				delta_time(now, rxfc->start_half_period)
+					> NODE_RX_FC_HALF_PERIOD
 			) {
-				uint32 last;
-				uint32 avg;
-				time_delta_t period;
+				time_delta_t total;
+				double fc_ratio;
+				uint32 max_ratio;
 
 				/*
-				 * Take the round-trip time of the ping/pongs as a base for
-				 * computing the time we should space our pings.  Indeed,
-				 * if the round-trip is 90s (taking an extreme example) due
-				 * to queuing and TCP/IP clogging and we send pings every 20
-				 * seconds, we will have sent 4 before getting a chance to see
-				 * any reply back!
-				 *		-RAM, 01/11/2003
+				 * If we're a leaf node, we allow the ultrapeer to flow
+				 * control our incoming connection for 95% of the time.
+				 * Being flow controlled means we're not getting that much
+				 * queries, and we can't send ours, but as long as we have
+				 * a non-null window to send our queries, that's fine.
 				 */
 
-				alive_get_roundtrip_ms(n->alive_pings, &avg, &last);
-				last = MAX(avg, last) / 1000;	/* Convert ms to seconds */
-				period = MAX(n->alive_period, (time_delta_t) last);
+				max_ratio = settings_is_leaf() ?
+					95 : GNET_PROPERTY(node_rx_flowc_ratio);
 
-				if (NODE_IS_TRANSIENT(n))
-					period *= ALIVE_TRANSIENT;
-
-				if (
-					alive_elapsed(n->alive_pings) > period &&
-					!alive_send_ping(n->alive_pings)
-				) {
-					node_bye(n, 406, "No reply to alive pings");
-					continue;
+				if (rxfc->fc_start) {		/* In flow control */
+					rxfc->fc_accumulator += delta_time(now, rxfc->fc_start);
+					rxfc->fc_start = now;
 				}
-			}
 
-			/*
-			 * Check whether we need to send more QRT patch updates.
-			 */
+				rxfc->fc_accumulator =
+					MIN(rxfc->fc_accumulator, NODE_RX_FC_HALF_PERIOD);
 
-			if (n->qrt_update != NULL) {
-				g_assert(NODE_IS_CONNECTED(n));
-				node_send_patch_step(n);
-				if (!NODE_IS_CONNECTED(n))
-					continue;
-			}
+				total = rxfc->fc_accumulator + rxfc->fc_last_half;
 
-			/*
-			 * Check RX flow control.
-			 */
+				/* New period begins */
+				rxfc->fc_last_half = rxfc->fc_accumulator;
+				rxfc->fc_accumulator = 0;
+				rxfc->start_half_period = now;
 
-			if (n->rxfc != NULL) {
-				struct node_rxfc_mon *rxfc = n->rxfc;
+				fc_ratio = (double) total / (2.0 * NODE_RX_FC_HALF_PERIOD);
+				fc_ratio *= 100.0;
 
-				if (
-					delta_time(now, rxfc->start_half_period)
-						> NODE_RX_FC_HALF_PERIOD
-				) {
-					time_delta_t total;
-					double fc_ratio;
-					uint32 max_ratio;
+				if ((uint32) fc_ratio > max_ratio) {
+					node_bye(n, 405,
+						"Remotely flow-controlled too often "
+						"(%.2f%% > %d%% of time)", fc_ratio, max_ratio);
+					return now + 1;
+				}
 
-					/*
-					 * If we're a leaf node, we allow the ultrapeer to flow
-					 * control our incoming connection for 95% of the time.
-					 * Being flow controlled means we're not getting that much
-					 * queries, and we can't send ours, but as long as we have
-					 * a non-null window to send our queries, that's fine.
-					 */
+				/* Dispose of monitoring if we're not flow-controlled */
+				if (total == 0) {
+					WFREE(n->rxfc);
+					n->rxfc = NULL;
+				}
+			}
+		}
 
-					max_ratio = settings_is_leaf() ?
-						95 : GNET_PROPERTY(node_rx_flowc_ratio);
+		/*
+		 * Periodically look at whether we can move around the
+		 * query tables in the VM space.
+		 */
 
-					if (rxfc->fc_start) {		/* In flow control */
-						rxfc->fc_accumulator += delta_time(now, rxfc->fc_start);
-						rxfc->fc_start = now;
-					}
+		if (delta_time(now, n->last_qrt_move) >= NODE_QRT_MOVE_FREQ) {
+			n->last_qrt_move = now;
 
-					rxfc->fc_accumulator =
-						MIN(rxfc->fc_accumulator, NODE_RX_FC_HALF_PERIOD);
+			if (n->sent_query_table != NULL)
+				qrt_arena_relocate(n->sent_query_table);
 
-					total = rxfc->fc_accumulator + rxfc->fc_last_half;
+			if (n->recv_query_table != NULL)
+				qrt_arena_relocate(n->recv_query_table);
+		}
 
-					/* New period begins */
-					rxfc->fc_last_half = rxfc->fc_accumulator;
-					rxfc->fc_accumulator = 0;
-					rxfc->start_half_period = now;
+	}
 
-					fc_ratio = (double) total / (2.0 * NODE_RX_FC_HALF_PERIOD);
-					fc_ratio *= 100.0;
+	/*
+	 * Rotate `qrelayed' on a regular basis into `qrelayed_old' and
+	 * dispose of previous `qrelayed_old'.
+	 */
 
-					if ((uint32) fc_ratio > max_ratio) {
-						node_bye(n, 405,
-							"Remotely flow-controlled too often "
-							"(%.2f%% > %d%% of time)", fc_ratio, max_ratio);
-						continue;
-					}
+	if (
+		n->qrelayed != NULL &&
+		delta_time(now, n->qrelayed_created) >=
+			(time_delta_t) GNET_PROPERTY(node_queries_half_life)
+	) {
+		hset_t *new;
 
-					/* Dispose of monitoring if we're not flow-controlled */
-					if (total == 0) {
-						WFREE(n->rxfc);
-						n->rxfc = NULL;
-					}
-				}
-			}
+		if (n->qrelayed_old != NULL) {
+			new = n->qrelayed_old;
+			string_table_clear(hset_cast_to_hash(new));
+		} else
+			new = hset_create(HASH_KEY_STRING, 0);
 
-			/*
-			 * Periodically look at whether we can move around the
-			 * query tables in the VM space.
-			 */
+		n->qrelayed_old = n->qrelayed;
+		n->qrelayed = new;
+		n->qrelayed_created = now;
+	}
 
-			if (delta_time(now, n->last_qrt_move) >= NODE_QRT_MOVE_FREQ) {
-				n->last_qrt_move = now;
+	return node_timer_next(n, now);
+}
 
-				if (n->sent_query_table != NULL)
-					qrt_arena_relocate(n->sent_query_table);
+/**
+ * Check the nodes whose deadline expired, scheduled in wheel slot.
+ */
+static void
+node_timer_run_slot(elist_t *slot, time_t now)
+{
+	size_t count = elist_count(slot);
 
-				if (n->recv_query_table != NULL)
-					qrt_arena_relocate(n->recv_query_table);
-			}
+	/*
+	 * Nodes are taken from the head of the slot list, one at a time, since
+	 * checking a node can cause other nodes to be removed.  Nodes that are
+	 * not due yet are put back at the tail.
+	 */
 
+	while (count-- != 0) {
+		gnutella_node_t *n = elist_head(slot);
+		time_t due;
+
+		if (NULL == n)
+			break;
+
+		node_check(n);
+
+		if (delta_time(n->timer_due, now) > 0) {
+			elist_link_remove(slot, &n->timer_lk);
+			elist_link_append(slot, &n->timer_lk);
+			continue;
 		}
 
-		/*
-		 * Rotate `qrelayed' on a regular basis into `qrelayed_old' and
-		 * dispose of previous `qrelayed_old'.
-		 */
+		node_timer_unschedule(n);
+		due = node_timer_check(n, now);
 
-		if (
-			n->qrelayed != NULL &&
-			delta_time(now, n->qrelayed_created) >=
-				(time_delta_t) GNET_PROPERTY(node_queries_half_life)
-		) {
-			hset_t *new;
+		if (due != 0)
+			node_timer_schedule(n, due);
+	}
+}
 
-			if (n->qrelayed_old != NULL) {
-				new = n->qrelayed_old;
-				string_table_clear(hset_cast_to_hash(new));
-			} else
-				new = hset_create(HASH_KEY_STRING, 0);
+/**
+ * Periodic node heartbeat timer.
+ *
+ * Only the nodes with an expiring deadline are checked: they are kept in a
+ * timing wheel with one-second slots.
+ */
+void
+node_timer(time_t now)
+{
+	time_t t;
 
-			n->qrelayed_old = n->qrelayed;
-			n->qrelayed = new;
-			n->qrelayed_created = now;
-		}
+	/*
+	 * Asynchronously react to current peermode change.
+	 * See comment in node_set_current_peermode().
+	 */
+
+	if (peermode.changed) {
+		peermode.changed = FALSE;
+		node_set_current_peermode(peermode.new);
 	}
 
+	/*
+	 * Run all the slots for the seconds elapsed since the last run, at most
+	 * one full turn of the wheel.
+	 */
+
+	t = 0 == node_wheel_last ? now : node_wheel_last + 1;
+	if (delta_time(now, t) >= NODE_TIMER_SLOTS)
+		t = now - (NODE_TIMER_SLOTS - 1);
+
+	for (/* empty */; delta_time(now, t) >= 0; t++)
+		node_timer_run_slot(&node_wheel[NODE_TIMER_SLOT(t)], now);
+
+	node_wheel_last = now;
+
 	sq_process(sq_global_queue(), now);
 }
 
@@ -1738,8 +1931,13 @@ void G_COLD
 node_init(void)
 {
 	time_t now = clock_loc2gmt(tm_time());
+	size_t i;
 
 	STATIC_ASSERT(23 == sizeof(gnutella_header_t));
+	STATIC_ASSERT(IS_POWER_OF_2(NODE_TIMER_SLOTS));
+
+	for (i = 0; i < N_ITEMS(node_wheel); i++)
+		elist_init(&node_wheel[i], offsetof(gnutella_node_t, timer_lk));
 
 	no_metadata = deconstify_pointer(vmm_trap_page());
 	rxbuf_init();
@@ -2132,6 +2330,7 @@ node_real_remove(gnutella_node_t *n)
 
 	sl_nodes = pslist_remove(sl_nodes, n);
 	hikset_remove(nodes_by_id, NODE_ID(n));
+	node_timer_unschedule(n);
 
 	/*
 	 * Now that the node was removed from the list of known nodes, we
@@ -3197,6 +3396,7 @@ node_bye_v(gnutella_node_t *n, int code, const char *reason, va_list ap)
 				code, n->error_str, node_infostr(n));
 
 		n->flags |= NODE_F_BYE_SENT;
+		node_timer_wakeup(n);
 
 		node_shutdown_mode(n, SHUTDOWN_GRACE_DELAY);
 	}
@@ -8732,6 +8932,7 @@ node_add_internal(struct gnutella_socket *s, const host_addr_t addr,
 	 */
 
 	sl_nodes = pslist_prepend(sl_nodes, n);
+	node_timer_schedule(n, tm_time() + 1);
 
 	if (n->status != GTA_NODE_REMOVING) {
 		node_ht_connected_nodes_add(n);
@@ -11456,6 +11657,7 @@ node_send_qrt(gnutella_node_t *n, struct routing_table *query_table)
 	g_assert(n->qrt_update == NULL);
 
 	n->qrt_update = qrt_update_create(n, n->sent_query_table);
+	node_timer_wakeup(n);
 	if (n->sent_query_table) {
 		qrt_unref(n->sent_query_table);
 	}
@@ -52,6 +52,7 @@
 #include "if/dht/routing.h"
 
 #include "lib/cq.h"
+#include "lib/elist.h"
 #include "lib/header.h"
 #include "lib/hset.h"
 #include "lib/htable.h"
@@ -187,6 +188,8 @@ typedef struct gnutella_node {
 	time_t leaf_flowc_start;	/**< Time when leaf flow-controlled queries */
 	time_t last_qrt_move;		/**< Time when we last attempted a QRT move */
 	time_delta_t shutdown_delay; /**< How long we can stay in shutdown mode */
+	time_t timer_due;			/**< When node_timer() checks it, 0 if never */
+	link_t timer_lk;			/**< Links node in the node_timer() wheel */
 
 	const char *remove_msg;		/**< Reason of removing */
 
@@ -77,6 +77,7 @@
 #include "lib/parse.h"
 #include "lib/plist.h"
 #include "lib/pslist.h"
+#include "lib/slotq.h"
 #include "lib/stats.h"
 #include "lib/str.h"
 #include "lib/stringify.h"
@@ -172,24 +173,33 @@ enum parq_ul_queue_magic {
 	PARQ_UL_QUEUE_MAGIC = 0x7dbab331
 };
 
+/**
+ * Counters attached to the entries of a queue, summed in queue order.
+ */
+enum parq_ul_counter {
+	PARQ_UL_RELATIVE = 0,	/**< Flags entries in the relative list */
+	PARQ_UL_SLOT_TIME,		/**< Estimated slot times, yields ETAs */
+	PARQ_UL_UPLOADING,		/**< Flags entries having an upload slot */
+
+	PARQ_UL_COUNTERS
+};
+
 /**
  * Holds status of current queue.
  */
 struct parq_ul_queue {
 	enum parq_ul_queue_magic magic;
-	plist_t *by_position;		/**< Queued items sorted on position. Newest is
-								 added to the end. */
-	hash_list_t *by_rel_pos;	/**< Queued items sorted by relative position */
+	slotq_t *by_position;		/**< Queued items, by order of arrival */
 	hash_list_t *by_date_dead;	/**< Dead items sorted on last update */
 	statx_t *slot_stats;		/**< Slot kept-time statistics */
 	int by_position_length;	/**< Number of items in "by_position" */
+	int by_rel_pos_length;	/**< Number of items in "by_rel_pos" */
 
 	int num;				/**< Queue number */
 	int active_uploads;
 	int active_queued_cnt;	/**< Number of actively queued entries */
 	int alive;				/**< Amount of alive entries */
 	int frozen;				/**< Subset of alive entries that are frozen */
-	unsigned recompute:1;	/**< Flagged as requiring update of internal data */
 	unsigned active:1;		/**< Set to false when the number of upload slots
 								 was decreased but the queue still contained
 								 queued items. This queue shall be removed when
@@ -226,11 +236,12 @@ enum parq_ul_magic {
 struct parq_ul_queued {
 	enum parq_ul_magic magic;			/**< Magic number */
 	uint32 flags;			/**< Operating flags */
-	uint position;			/**< Current position in the queue */
-	uint relative_position; /**< Relative position in the queue, if 'not alive'
-								  uploads are taken into account */
+	uint slot;				/**< Slot in the queue, by order of arrival */
+	uint relative_saved;	/**< Relative position when removed from the
+								 relative list, 0 when granted a regular slot */
 	uint eta;				/**< Expected time in seconds till an upload slot is
-							     reached, this is a relative timestamp */
+							     reached, saved when leaving relative list */
+	uint slot_time;			/**< Estimated slot time, accounted in queue */
 
 	time_t expire;			/**< Time when the queue position will be lost */
 	time_t retry;			/**< Time when the first retry-after is expected */
@@ -278,6 +289,7 @@ struct parq_ul_queued {
 	unsigned had_slot:1;		/**< Whether we granted a slot to that entry */
 	unsigned is_alive:1;		/**< Whether client is still requesting file */
 	unsigned supports_parq:1;	/**< Is downloader PARQ-aware? */
+	unsigned relative:1;		/**< Whether listed in the relative list */
 };
 
 static inline void
@@ -1420,36 +1432,70 @@ parq_estimated_slot_time(const struct parq_ul_queued *puq)
 }
 
 /**
- * Updates the ETA of all queued items in the given queue.
+ * @return the absolute position of the entry in its queue.
  */
-static void
-parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
+static inline uint
+parq_ul_position(const struct parq_ul_queued *puq)
+{
+	return slotq_position(puq->queue->by_position, puq);
+}
+
+/**
+ * @return the relative position of the entry in its queue, which is its
+ * rank in the relative list, or the rank it had when it was last removed
+ * from that list (0 if it was granted a regular slot).
+ */
+static inline uint
+parq_ul_relative_position(const struct parq_ul_queued *puq)
+{
+	if (!puq->relative)
+		return puq->relative_saved;
+
+	return slotq_prefix(puq->queue->by_position, puq, PARQ_UL_RELATIVE);
+}
+
+/**
+ * @return the entry at the given (1-based) relative position in the queue.
+ */
+static struct parq_ul_queued *
+parq_ul_relative_nth(const struct parq_ul_queue *q, uint rel)
+{
+	struct parq_ul_queued *puq;
+
+	g_assert(rel != 0 && rel <= UNSIGNED(q->by_rel_pos_length));
+
+	puq = slotq_select(q->by_position, PARQ_UL_RELATIVE, rel);
+	parq_ul_queued_check(puq);
+	g_assert(puq->relative);
+
+	return puq;
+}
+
+/**
+ * Compute the ETA of the first entry in the relative list of the queue.
+ */
+static uint
+parq_upload_start_eta(const struct parq_ul_queue *q)
 {
 	plist_t *l;
 	uint eta = 0;
-	uint avg_bps;
-	time_delta_t running_time = delta_time(tm_time(), parq_start);
-	hash_list_iter_t *iter;
-
-	avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
-	avg_bps = MAX(1024, avg_bps);		/* Assume at least 1 KiB/s */
-	if (GNET_PROPERTY(parq_optimistic))
-		avg_bps = MAX(avg_bps, GNET_PROPERTY(bw_http_out));
 
-	if (which_ul_queue->active_uploads) {
+	if (
+		q->active_uploads &&
+		slotq_total(q->by_position, PARQ_UL_UPLOADING) != 0
+	) {
 		/*
 		 * Current queue has an upload slot. Use this one for a start ETA.
 		 * Locate the first active upload in this queue.
 		 */
 
-		PLIST_FOREACH(which_ul_queue->by_position, l) {
-			struct parq_ul_queued *puq = l->data;
+		struct parq_ul_queued *puq =
+			slotq_select(q->by_position, PARQ_UL_UPLOADING, 1);
 
-			if (puq->has_slot) {		/* Recompute ETA */
-				eta += parq_estimated_slot_time(puq);
-				break;
-			}
-		}
+		parq_ul_queued_check(puq);
+		g_assert(puq->has_slot);
+
+		eta = parq_estimated_slot_time(puq);
 	}
 
 	if (eta == 0 && GNET_PROPERTY(ul_running) > GNET_PROPERTY(max_uploads)) {
@@ -1460,98 +1506,91 @@ parq_upload_update_eta(struct parq_ul_queue *which_ul_queue)
 		 * as the ETA can't be calculated correctly anymore.
 		 */
 
-		eta = parq_probable_slot_time(which_ul_queue);
+		eta = parq_probable_slot_time(q);
 
 		for (l = ul_parqs; l && 0 == eta; l = plist_next(l)) {
-			struct parq_ul_queue *q = l->data;
+			struct parq_ul_queue *uq = l->data;
 
-			eta = parq_probable_slot_time(q);
+			eta = parq_probable_slot_time(uq);
 		}
 
 		if (eta == 0 && GNET_PROPERTY(parq_debug))
 			g_warning("[PARQ UL] Was unable to calculate an accurate ETA");
 	}
 
-	iter = hash_list_iterator(which_ul_queue->by_rel_pos);
+	return eta;
+}
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
+/**
+ * @return the ETA of the entry.
+ *
+ * The ETA of an entry in the relative list is the start ETA of its queue
+ * plus the estimated slot times of the entries waiting before it, which are
+ * counted along the queue and summed in O(log n).
+ */
+static uint
+parq_ul_eta(const struct parq_ul_queued *puq)
+{
+	const struct parq_ul_queue *q = puq->queue;
+	int64 eta;
 
-		g_assert(puq->is_alive);
+	if (!puq->relative)
+		return puq->eta;
 
-		puq->eta = eta;
+	eta = parq_upload_start_eta(q) - puq->slot_time +
+		slotq_prefix(q->by_position, puq, PARQ_UL_SLOT_TIME);
 
-		if (puq->has_slot)
-			continue;			/* Skip already uploading uploads */
+	/*
+	 * For the first "max_uploads" entries, we use the normal computation.
+	 * For entries further away, we further compute the average time it
+	 * would take to move to a runnable slot based on global removal rate
+	 * from all the queues.
+	 */
 
-		/*
-		 * Recalculate ETA of queued slots
-		 *
-		 * For the first "max_uploads" ones, we use the normal computation.
-		 * For slots further away, we further compute the average time it
-		 * would take to move to a runnable slot based on global removal
-		 * rate from all the queues.
-		 */
+	if (!puq->has_slot) {
+		uint rel = parq_ul_relative_position(puq);
 
-		if (puq->relative_position > GNET_PROPERTY(max_uploads)) {
+		if (rel > GNET_PROPERTY(max_uploads)) {
+			time_delta_t running_time = delta_time(tm_time(), parq_start);
 			time_delta_t per_slot = running_time / MAX(1, parq_slots_removed);
-			uint cheap_eta = puq->relative_position * per_slot;
+			int64 cheap_eta = (int64) rel * per_slot;
 
 			if (cheap_eta < eta)
-				puq->eta = cheap_eta;
+				eta = cheap_eta;
 		}
-
-		eta += parq_estimated_slot_time(puq);
 	}
 
-	hash_list_iter_release(&iter);
+	return MIN(eta, MAX_INT_VAL(uint));
 }
 
 /**
- * Decreases the position of all queued items after the given queued item.
+ * Update the counters of the entry its queue uses to derive ETAs, after a
+ * change in its state or in its estimated slot time.
+ *
+ * Only the entries waiting in the relative list delay the ones after them.
  */
 static void
-parq_upload_decrease_all_after(struct parq_ul_queued *puq)
+parq_upload_update_slot_time(struct parq_ul_queued *puq)
 {
-	plist_t *l;
-	int pos_cnt = 0;	/* Used for assertion */
-
-	g_assert(puq != NULL);
-	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_position_length > 0);
-
-	l = plist_find(puq->queue->by_position, puq);
-	pos_cnt = ((struct parq_ul_queued *) l->data)->position;
-
-	l = plist_next(l);	/* Decrease _after_ current parq */
+	struct parq_ul_queue *q = puq->queue;
+	uint slot_time = 0;
+	int64 flag;
 
-	/*
-	 * Cycle through list and decrease all positions by one. Position should
-	 * never reach 0 which would mean the queued item is currently uploading
-	 */
-	for (;	l; l = plist_next(l)) {
-		struct parq_ul_queued *p = l->data;
+	if (puq->relative && !puq->has_slot)
+		slot_time = parq_estimated_slot_time(puq);
 
-		g_assert(p != NULL);
-		g_assert(p->position > 1);
-		g_assert(p->position - 1 == UNSIGNED(pos_cnt));
-
-		p->position--;
-		pos_cnt++;
+	if (slot_time != puq->slot_time) {
+		slotq_add(q->by_position, puq, PARQ_UL_SLOT_TIME,
+			(int64) slot_time - (int64) puq->slot_time);
+		puq->slot_time = slot_time;
 	}
-}
 
-/**
- * Function used to keep the relative position list sorted by absolute
- * queue positions, which refer to the order of arrival in the queue.
- */
-static int
-parq_ul_rel_pos_cmp(const void *a, const void *b)
-{
-	const struct parq_ul_queued *as = a, *bs = b;
+	flag = slotq_value(q->by_position, puq, PARQ_UL_UPLOADING);
 
-	return CMP(as->position, bs->position);
+	if (flag != (puq->has_slot ? 1 : 0)) {
+		slotq_add(q->by_position, puq, PARQ_UL_UPLOADING,
+			puq->has_slot ? +1 : -1);
+	}
 }
 
 /**
@@ -1563,90 +1602,67 @@ parq_upload_insert_relative(struct parq_ul_queued *puq)
 	parq_ul_queued_check(puq);
 
 	g_assert(!(puq->flags & PARQ_UL_FROZEN));
+	g_assert(!puq->relative);
 
-	puq->relative_position = 0;
-	hash_list_insert_sorted(puq->queue->by_rel_pos, puq, parq_ul_rel_pos_cmp);
+	slotq_add(puq->queue->by_position, puq, PARQ_UL_RELATIVE, +1);
+	puq->relative = TRUE;
+	puq->queue->by_rel_pos_length++;
+	parq_upload_update_slot_time(puq);
 }
 
 /**
  * Remove item from relative position list.
+ *
+ * The entry keeps the relative position it had in the list.
  */
 static inline void
 parq_upload_remove_relative(struct parq_ul_queued *puq)
 {
 	parq_ul_queued_check(puq);
 
-	hash_list_remove(puq->queue->by_rel_pos, puq);
+	if (puq->relative) {
+		struct parq_ul_queue *q = puq->queue;
+
+		puq->relative_saved = parq_ul_relative_position(puq);
+		puq->eta = parq_ul_eta(puq);
+		slotq_add(q->by_position, puq, PARQ_UL_RELATIVE, -1);
+		puq->relative = FALSE;
+		g_assert(q->by_rel_pos_length > 0);
+		q->by_rel_pos_length--;
+		parq_upload_update_slot_time(puq);
+	}
+
 	parq_slots_removed++;
 }
 
 /**
- * Recomputes all absolute positions of given queue.
- *
- * @param q		the queue for which we wish to recompute position
+ * Append entry at the end of the queue.
  */
 static void
-parq_upload_recompute_positions(struct parq_ul_queue *q)
+parq_upload_append_slot(struct parq_ul_queue *q, struct parq_ul_queued *puq)
 {
-	uint pos = 0;
-	uint prev_pos = 0;
-	plist_t *l;
-
 	parq_ul_queue_check(q);
+	parq_ul_queued_check(puq);
 
-	PLIST_FOREACH(q->by_position, l) {
-		struct parq_ul_queued *puq = l->data;
-
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(puq->position > prev_pos,	/* Was sorted by construction */
-			"pos=%u,, prev=%u", puq->position, prev_pos);
-
-		prev_pos = puq->position;
-		puq->position = ++pos;
-	}
-
-	g_assert(pos <= UNSIGNED(q->by_position_length));
+	slotq_append(q->by_position, puq);
+	q->by_position_length++;
 }
 
 /**
- * Recomputes all relative positions of given queue.
- *
- * @param q		the queue for which we wish to recompute position
+ * Remove entry from the queue, freeing its slot.
  */
 static void
-parq_upload_recompute_relative_positions(struct parq_ul_queue *q)
+parq_upload_remove_slot(struct parq_ul_queue *q, struct parq_ul_queued *puq)
 {
-	uint rel = 0;
-	uint prev_rel = 0;
-	uint prev_pos = 0;
-	hash_list_iter_t *iter;
-
 	parq_ul_queue_check(q);
+	parq_ul_queued_check(puq);
+	g_assert(!puq->relative);
+	g_assert(0 == puq->slot_time);
 
-	iter = hash_list_iterator(q->by_rel_pos);
-
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
-
-		parq_ul_queued_check(puq);
-		g_assert(puq->queue == q);
-		g_assert_log(
-			0 == puq->relative_position || puq->relative_position > prev_rel,
-			"rel=%u, prev=%u", puq->relative_position, prev_rel);
-		g_assert_log(puq->position > prev_pos,			/* Was sorted */
-			"pos=%u, prev=%u", puq->position, prev_pos);
-
-		if (puq->relative_position != 0)
-			prev_rel = puq->relative_position;
-		prev_pos = puq->position;
-		puq->relative_position = ++rel;
-	}
-
-	hash_list_iter_release(&iter);
+	slotq_remove(q->by_position, puq);
 
-	g_assert(rel <= UNSIGNED(q->by_position_length));
-	g_assert(hash_list_length(q->by_rel_pos) == rel);
+	g_assert(q->by_position_length > 0);
+	q->by_position_length--;
 }
 
 /**
@@ -1692,7 +1708,6 @@ parq_upload_free(struct parq_ul_queued *puq)
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->queue != NULL);
 	g_assert(puq->queue->by_position_length > 0);
-	g_assert(puq->queue->by_position != NULL);
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->total > 0);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
@@ -1700,8 +1715,6 @@ parq_upload_free(struct parq_ul_queued *puq)
 	if (puq->u != NULL)
 		puq->u->parq_ul = NULL;
 
-	parq_upload_decrease_all_after(puq);
-
 	if (puq->flags & PARQ_UL_QUEUE)
 		hash_list_remove(ul_parq_queue, puq);
 
@@ -1732,35 +1745,18 @@ parq_upload_free(struct parq_ul_queued *puq)
 		hash_list_remove(puq->queue->by_date_dead, puq);
 	}
 
-	/* Remove the current queued item from all lists */
-	puq->queue->by_position = plist_remove(puq->queue->by_position, puq);
+	/*
+	 * Remove the current queued item from all lists.  The positions and
+	 * the ETAs of the following entries are derived from the slots.
+	 */
 
 	parq_upload_remove_relative(puq);
+	parq_upload_remove_slot(puq->queue, puq);
 
 	hikset_remove(ul_all_parq_by_addr_and_name, puq->addr_and_name);
 	htable_remove(ul_all_parq_by_id, &puq->id);
 
 	g_assert(!hash_list_contains(puq->queue->by_date_dead, puq));
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
-
-	/*
-	 * Queued upload is now removed from all lists. So queue size can be
-	 * safely decreased and new ETAs can be calculated.
-	 */
-	g_assert(puq->queue->by_position_length > 0);
-	puq->queue->by_position_length--;
-
-	/*
-	 * Don't update ETA on shutdown, we don't need this information, so speed
-	 * up the shutdown process. Also it is better not doing so as on shutdown
-	 * not all entries are removed the 'correct' way, we just want to free
-	 * the memory
-	 */
-	if (!parq_shutdown) {
-		parq_upload_recompute_positions(puq->queue);
-		parq_upload_recompute_relative_positions(puq->queue);
-		parq_upload_update_eta(puq->queue);
-	}
 
 	/* Free the memory used by the current queued item */
 	HFREE_NULL(puq->addr_and_name);
@@ -1783,7 +1779,7 @@ static uint32
 parq_ul_calc_retry(struct parq_ul_queued *puq)
 {
 	int result = PARQ_TIMER_BY_POS +
-		(puq->relative_position - 1) * (PARQ_TIMER_BY_POS / 2);
+		(parq_ul_relative_position(puq) - 1) * (PARQ_TIMER_BY_POS / 2);
 
 	if (GNET_PROPERTY(parq_optimistic)) {
 		struct parq_ul_queued *puq_prev = NULL;
@@ -1792,7 +1788,12 @@ parq_ul_calc_retry(struct parq_ul_queued *puq)
 		avg_bps = bsched_avg_bps(BSCHED_BWS_OUT);
 		avg_bps = MAX(1, avg_bps);
 
-		puq_prev = hash_list_previous(puq->queue->by_rel_pos, puq);
+		if (puq->relative) {
+			uint rel = parq_ul_relative_position(puq);
+
+			if (rel > 1)
+				puq_prev = parq_ul_relative_nth(puq->queue, rel - 1);
+		}
 
 		if (puq_prev != NULL && puq_prev->has_slot) {
 			int fast_result =
@@ -1823,7 +1824,8 @@ parq_upload_new_queue(void)
 	queue->magic = PARQ_UL_QUEUE_MAGIC;
 	queue->active = TRUE;
 	queue->slot_stats = statx_make();
-	queue->by_rel_pos = hash_list_new(NULL, NULL);
+	queue->by_position = slotq_make(
+		offsetof(struct parq_ul_queued, slot), PARQ_UL_COUNTERS);
 	queue->by_date_dead = hash_list_new(NULL, NULL);
 
 	ul_parqs = plist_append(ul_parqs, queue);
@@ -1921,10 +1923,7 @@ parq_upload_create(struct upload *u)
 {
 	time_t now = tm_time();
 	struct parq_ul_queued *puq = NULL;
-	struct parq_ul_queued *prev_puq = NULL;
 	struct parq_ul_queue *q = NULL;
-	uint eta = 0;
-	uint rel_pos = 1;
 
 	upload_check(u);
 	g_assert(ul_all_parq_by_addr_and_name != NULL);
@@ -1933,27 +1932,6 @@ parq_upload_create(struct upload *u)
 	q = parq_upload_which_queue(u);
 	g_assert(q != NULL);
 
-	/* Locate the last alive queued item so we can calculate the ETA */
-	prev_puq = hash_list_tail(q->by_rel_pos);
-
-	if (prev_puq != NULL) {
-		parq_ul_queued_check(prev_puq);
-		g_assert(prev_puq->is_alive);	/* Must be to belong to that list */
-
-		rel_pos = prev_puq->relative_position + 1;
-
-		eta = prev_puq->eta;
-
-		if (GNET_PROPERTY(max_uploads) <= 0) {
-			eta = (uint) -1;
-		} else {
-			eta += parq_estimated_slot_time(prev_puq);
-		}
-	}
-
-	/* Will append item to the list */
-	g_assert(hash_list_length(q->by_rel_pos) + 1 == rel_pos);
-
 	/* Create new parq_upload item */
 	WALLOC0(puq);
 	puq->magic = PARQ_UL_MAGIC;
@@ -1969,9 +1947,6 @@ parq_upload_create(struct upload *u)
 	g_assert(puq->addr_and_name != NULL);
 
 	/* Fill puq structure */
-	puq->position = q->by_position_length + 1;
-	puq->relative_position = rel_pos;
-	puq->eta = eta;
 	puq->enter = now;
 	puq->updated = now;
 	puq->file_size = u->file_size;
@@ -2003,17 +1978,16 @@ parq_upload_create(struct upload *u)
 	/* Save into hash table so we can find the current parq ul later */
 	htable_insert(ul_all_parq_by_id, &puq->id, puq);
 
-	q->by_position_length++;
-	q->by_position = plist_append(q->by_position, puq);
-
-	hash_list_append(puq->queue->by_rel_pos, puq);
+	/* Append item at the end of the queue and of the relative list */
+	parq_upload_append_slot(q, puq);
+	parq_upload_insert_relative(puq);
 
 	if (GNET_PROPERTY(parq_debug) > 3) {
 		g_debug("PARQ UL Q %d/%zd (%3d[%3d]/%3d): New: %s \"%s\"; ID=\"%s\"",
 			puq->queue->num,
 			plist_length(ul_parqs),
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_relative_position(puq),
 			puq->queue->by_position_length,
 			host_addr_to_string(puq->remote_addr),
 			puq->name,
@@ -2040,16 +2014,12 @@ parq_upload_create(struct upload *u)
 	puq->by_addr->list = plist_prepend(puq->by_addr->list, puq);
 
 	g_assert(puq != NULL);
-	g_assert(puq->position > 0);
 	g_assert(puq->addr_and_name != NULL);
 	g_assert(puq->name != NULL);
 	g_assert(puq->queue != NULL);
-	g_assert(puq->queue->by_position != NULL);
-	g_assert(puq->queue->by_rel_pos != NULL);
-	g_assert(puq->queue->by_position->data != NULL);
-	g_assert(puq->relative_position > 0);
-	g_assert(puq->relative_position <=
-		UNSIGNED(puq->queue->by_position_length));
+	g_assert(puq->relative);
+	g_assert(UNSIGNED(q->by_position_length) == parq_ul_position(puq));
+	g_assert(UNSIGNED(q->by_rel_pos_length) == parq_ul_relative_position(puq));
 	g_assert(puq->by_addr != NULL);
 	g_assert(puq->by_addr->uploading <= puq->by_addr->total);
 
@@ -2097,7 +2067,7 @@ parq_upload_free_queue(struct parq_ul_queue *queue)
 	ul_parqs_cnt--;
 
 	/* Free memory */
-	hash_list_free(&queue->by_rel_pos);
+	slotq_free_null(&queue->by_position);
 	hash_list_free(&queue->by_date_dead);
 	statx_free(queue->slot_stats);
 	queue->magic = 0;
@@ -2214,8 +2184,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"not PARQ-aware, not sending QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_relative_position(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2232,8 +2202,8 @@ parq_upload_register_send_queue(struct parq_ul_queued *puq)
 				"no valid address to send QUEUE: %s '%s'",
 				  puq->queue->num,
 				  ul_parqs_cnt,
-				  puq->position,
-				  puq->relative_position,
+				  parq_ul_position(puq),
+				  parq_ul_relative_position(puq),
 				  puq->queue->by_position_length,
 				  host_addr_to_string(puq->remote_addr),
 				  puq->name
@@ -2305,8 +2275,8 @@ parq_upload_send_queue(struct parq_ul_queued *puq)
 			"Sending QUEUE #%d to %s for ID=%s: '%s'",
 			puq->queue->num,
 			ul_parqs_cnt,
-			puq->position,
-			puq->relative_position,
+			parq_ul_position(puq),
+			parq_ul_relative_position(puq),
 			puq->queue->by_position_length,
 			puq->queue_sent,
 			host_addr_port_to_string(puq->addr, puq->port),
@@ -2505,88 +2475,104 @@ parq_dead_timer(void *unused_udata)
 }
 
 /**
- * Periodic scanning of the alive queued entries.
- *
- * @param now		current time
- * @param q			the queue to scan
- * @param rlp		holds pointer to the single list of items to remove
+ * Context for parq_upload_queue_timer_entry().
+ */
+struct parq_timer_scan {
+	time_t now;					/**< Current time */
+	pslist_t *to_remove;		/**< Items to remove */
+};
+
+/**
+ * Periodic scanning of a queued entry, invoked by slotq_foreach().
  */
 static void
-parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
+parq_upload_queue_timer_entry(void *data, void *udata)
 {
-	hash_list_iter_t *iter;
-	pslist_t *to_remove = *rlp;
+	struct parq_ul_queued *puq = data;
+	struct parq_timer_scan *ts = udata;
+	time_t now = ts->now;
+	time_delta_t grace;
 
-	iter = hash_list_iterator(q->by_rel_pos);
+	if (!puq->relative)
+		return;			/* Only scan entries in the relative list */
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
-		time_delta_t grace;
+	if (
+		puq->expire <= now &&
+		!puq->has_slot &&
+		!(puq->flags & (PARQ_UL_QUEUE|PARQ_UL_NOQUEUE)) &&
+		delta_time(puq->send_next_queue, now) < 0 &&
+		puq->queue_sent < MAX_QUEUE &&
+		puq->queue_refused < MAX_QUEUE_REFUSED &&
+		GNET_PROPERTY(max_uploads) > 0 &&
+		!ban_is_banned(BAN_CAT_SOCKET, puq->remote_addr)
+	)
+		parq_upload_register_send_queue(puq);
 
-		g_assert(puq != NULL);
+	/*
+	 * Even if the upload is flagged with PARQ_UL_QUEUE to indicate that
+	 * we are planning to send it a QUEUE callback at some point, it is
+	 * possible that we may be waiting a very long time before being able
+	 * to send the QUEUE message back, due to outgoing bandwidth shortage,
+	 * or because there are many uploads from the same host and we throttle
+	 * QUEUE sending to avoid hammering the remote host.
+	 *
+	 * To free up the slot they are using, we let them expire nonetheless,
+	 * after PARQ_QUEUE_GRACE_TIME extra time.  They will be moved to the
+	 * "dead" queue, where we will continue to schedule QUEUE callbacks.
+	 * However, they can be dropped from the "dead" queue as soon as we
+	 * run out of PARQ slots.
+	 *
+	 *		--RAM, 2013-08-30
+	 */
+
+	grace = PARQ_GRACE_TIME +
+		((puq->flags & PARQ_UL_QUEUE) ? PARQ_QUEUE_GRACE_TIME : 0);
+
+	if (
+		puq->is_alive &&
+		delta_time(now, puq->expire) > grace &&
+		!puq->has_slot
+	) {
+		if (GNET_PROPERTY(parq_debug) > 3)
+			g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d): "
+				"Timeout: ID=%s %s '%s'",
+				puq->queue->num,
+				ul_parqs_cnt,
+				parq_ul_position(puq),
+				parq_ul_relative_position(puq),
+				puq->queue->by_position_length,
+				guid_hex_str(&puq->id),
+				host_addr_to_string(puq->remote_addr),
+				puq->name);
 
-		if (
-			puq->expire <= now &&
-			!puq->has_slot &&
-			!(puq->flags & (PARQ_UL_QUEUE|PARQ_UL_NOQUEUE)) &&
-			delta_time(puq->send_next_queue, now) < 0 &&
-			puq->queue_sent < MAX_QUEUE &&
-			puq->queue_refused < MAX_QUEUE_REFUSED &&
-			GNET_PROPERTY(max_uploads) > 0 &&
-			!ban_is_banned(BAN_CAT_SOCKET, puq->remote_addr)
-		)
-			parq_upload_register_send_queue(puq);
 
 		/*
-		 * Even if the upload is flagged with PARQ_UL_QUEUE to indicate that
-		 * we are planning to send it a QUEUE callback at some point, it is
-		 * possible that we may be waiting a very long time before being able
-		 * to send the QUEUE message back, due to outgoing bandwidth shortage,
-		 * or because there are many uploads from the same host and we throttle
-		 * QUEUE sending to avoid hammering the remote host.
-		 *
-		 * To free up the slot they are using, we let them expire nonetheless,
-		 * after PARQ_QUEUE_GRACE_TIME extra time.  They will be moved to the
-		 * "dead" queue, where we will continue to schedule QUEUE callbacks.
-		 * However, they can be dropped from the "dead" queue as soon as we
-		 * run out of PARQ slots.
-		 *
-		 *		--RAM, 2013-08-30
+		 * Mark for removal. Can't remove now as we are still using the
+		 * ul_parq_by_position linked list. (prepend is probably the
+		 * fastest function)
 		 */
+		ts->to_remove = pslist_prepend(ts->to_remove, puq);
+	}
+}
 
-		grace = PARQ_GRACE_TIME +
-			((puq->flags & PARQ_UL_QUEUE) ? PARQ_QUEUE_GRACE_TIME : 0);
+/**
+ * Periodic scanning of the alive queued entries.
+ *
+ * @param now		current time
+ * @param q			the queue to scan
+ * @param rlp		holds pointer to the single list of items to remove
+ */
+static void
+parq_upload_queue_timer(time_t now, struct parq_ul_queue *q, pslist_t **rlp)
+{
+	struct parq_timer_scan ts;
 
-		if (
-			puq->is_alive &&
-			delta_time(now, puq->expire) > grace &&
-			!puq->has_slot
-		) {
-			if (GNET_PROPERTY(parq_debug) > 3)
-				g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d): "
-					"Timeout: ID=%s %s '%s'",
-					puq->queue->num,
-					ul_parqs_cnt,
-					puq->position,
-					puq->relative_position,
-					puq->queue->by_position_length,
-					guid_hex_str(&puq->id),
-					host_addr_to_string(puq->remote_addr),
-					puq->name);
+	ts.now = now;
+	ts.to_remove = *rlp;
 
+	slotq_foreach(q->by_position, parq_upload_queue_timer_entry, &ts);
 
-			/*
-			 * Mark for removal. Can't remove now as we are still using the
-			 * ul_parq_by_position linked list. (prepend is probably the
-			 * fastest function)
-			 */
-			to_remove = pslist_prepend(to_remove, puq);
-		}
-	}
-
-	hash_list_iter_release(&iter);
-
-	*rlp = to_remove;
+	*rlp = ts.to_remove;
 }
 
 /*
@@ -2742,7 +2728,6 @@ parq_upload_timer(time_t now)
 			parq_upload_frozen_clear(puq);
 
 		parq_upload_remove_relative(puq);
-		puq->queue->recompute = TRUE;	/* Defer costly recomputations */
 
 		if (enable_real_passive && parq_still_sharing(puq)) {
 			hash_list_append(puq->queue->by_date_dead, puq);
@@ -2750,20 +2735,6 @@ parq_upload_timer(time_t now)
 			parq_upload_free(puq);
 	}
 
-	/*
-	 * Recompute data only for the queues in which we removed items --RAM.
-	 */
-
-	PLIST_FOREACH(ul_parqs, queues) {
-		struct parq_ul_queue *q = queues->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			parq_upload_update_eta(q);
-			q->recompute = FALSE;
-		}
-	}
-
 	pslist_free_null(&to_remove);
 
 	/*
@@ -3011,11 +2982,10 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 					uqx->is_alive ? "alive" : "dead",
 					guid_hex_str(&uqx->id), uqx->queue->num,
 					host_addr_to_string(puq->by_addr->addr),
-					uqx->relative_position);
+					parq_ul_relative_position(uqx));
 
 			parq_upload_remove_relative(uqx);
 			parq_upload_frozen_set(uqx);
-			uqx->queue->recompute = TRUE;	/* Defer update */
 			extra++;
 		}
 
@@ -3028,19 +2998,6 @@ parq_upload_freeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), frozen);
 
 	g_assert(puq->by_addr->frozen == frozen);
-
-	/*
-	 * Recompute data only for the queues in which we removed items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3065,10 +3022,7 @@ parq_upload_unfreeze_one(struct parq_ul_queued *puq)
 
 	parq_upload_frozen_clear(puq);
 
-	g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
-
 	parq_upload_insert_relative(puq);
-	parq_upload_recompute_relative_positions(puq->queue);
 }
 
 /**
@@ -3099,7 +3053,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			parq_upload_frozen_clear(uqx);
 			if (uqx->is_alive) {
 				parq_upload_insert_relative(uqx);
-				uqx->queue->recompute = TRUE;		/* Defer update */
 				inserted++;
 			}
 
@@ -3119,19 +3072,6 @@ parq_upload_unfreeze_all(struct parq_ul_queued *puq)
 			host_addr_to_string(puq->by_addr->addr), inserted);
 
 	g_assert(0 == puq->by_addr->frozen);
-
-	/*
-	 * Recompute data only for the queues in which we inserted items.
-	 */
-
-	PLIST_FOREACH(ul_parqs, l) {
-		struct parq_ul_queue *q = l->data;
-
-		if (q->recompute) {
-			parq_upload_recompute_relative_positions(q);
-			q->recompute = FALSE;
-		}
-	}
 }
 
 /**
@@ -3142,41 +3082,29 @@ static void
 parq_ul_dump_earlier(struct parq_ul_queued *item)
 {
 	struct parq_ul_queue *q;
-	hash_list_iter_t *iter;
-	unsigned old_relative = 0;
+	uint rel, last;
 
 	parq_ul_queued_check(item);
 
 	q = item->queue;
 	parq_ul_queue_check(q);
 
-	iter = hash_list_iterator(q->by_rel_pos);
+	last = parq_ul_relative_position(item);
+	last = MIN(last, GNET_PROPERTY(max_uploads) + 1);
+	last = MIN(last, UNSIGNED(q->by_rel_pos_length) + 1);
 
-	while (hash_list_iter_has_next(iter)) {
-		struct parq_ul_queued *puq = hash_list_iter_next(iter);
-
-		parq_ul_queued_check(puq);
-		g_assert_log(puq->relative_position > old_relative,
-			"relative=%u, old=%u", puq->relative_position, old_relative);
-		old_relative = puq->relative_position;
-
-		if (
-			puq->relative_position >= item->relative_position ||
-			puq->relative_position > GNET_PROPERTY(max_uploads)
-		)
-			break;
+	for (rel = 1; rel < last; rel++) {
+		struct parq_ul_queued *puq = parq_ul_relative_nth(q, rel);
 
 		g_debug("[PARQ UL] Q#%d pos=%u, rel=%u, slot<has=%s had=%s> updated=%s"
 			" active=%s, quick=%s, alive=%s, flags=0x%x, ID=%s, expire=%s ",
-			q->num, puq->position, puq->relative_position,
+			q->num, parq_ul_position(puq), rel,
 			puq->has_slot ? "y" : "n", puq->had_slot ? "y" : "n",
 			compact_time(delta_time(tm_time(), puq->updated)),
 			puq->active_queued ? "y" : "n", puq->quick ? "y" : "n",
 			puq->is_alive ? "y" : "n", puq->flags, guid_hex_str(&puq->id),
 			timestamp_utc_to_string(puq->expire));
 	}
-
-	hash_list_iter_release(&iter);
 }
 
 /**
@@ -3289,7 +3217,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 	 * already downloading something in another queue.
 	 */
 
-	if (puq->relative_position <= UNSIGNED(slots_free)) {
+	if (parq_ul_relative_position(puq) <= UNSIGNED(slots_free)) {
 		if (GNET_PROPERTY(parq_debug))
 			g_debug("[PARQ UL] [#%d] allowing %supload \"%s\" from %s (%s), "
 				"relative pos = %u [%s]",
@@ -3299,7 +3227,7 @@ parq_upload_continue(struct parq_ul_queued *puq)
 				host_addr_port_to_string(
 					puq->u->socket->addr, puq->u->socket->port),
 				upload_vendor_str(puq->u),
-				puq->relative_position, guid_hex_str(&puq->id));
+				parq_ul_relative_position(puq), guid_hex_str(&puq->id));
 
 		return TRUE;
 	}
@@ -3310,8 +3238,8 @@ parq_upload_continue(struct parq_ul_queued *puq)
 			puq->queue->num, puq->u->name,
 			host_addr_port_to_string(
 				puq->u->socket->addr, puq->u->socket->port),
-			upload_vendor_str(puq->u), puq->position,
-			puq->relative_position);
+			upload_vendor_str(puq->u), parq_ul_position(puq),
+			parq_ul_relative_position(puq));
 
 		if (GNET_PROPERTY(parq_debug) > 5)
 			parq_ul_dump_earlier(puq);
@@ -3463,8 +3391,8 @@ parq_upload_get(struct upload *u, const header_t *header)
 				"ETA: %s Added: %s '%s' %s",
 				puq->queue->num,
 				ul_parqs_cnt,
-				puq->position,
-				puq->relative_position,
+				parq_ul_position(puq),
+				parq_ul_relative_position(puq),
 				puq->queue->by_position_length,
 				short_time_ascii(parq_upload_lookup_eta(u)),
 				host_addr_to_string(puq->remote_addr),
@@ -3530,14 +3458,11 @@ parq_upload_get(struct upload *u, const header_t *header)
 		puq->queue->alive++;
 		puq->is_alive = TRUE;
 		g_assert(puq->queue->alive > 0);
-		g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
+		g_assert(!puq->relative);
 
 		/* Re-insert in the relative position list, unless entry is frozen */
-		if (!(puq->flags & PARQ_UL_FROZEN)) {
+		if (!(puq->flags & PARQ_UL_FROZEN))
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
-			parq_upload_update_eta(puq->queue);
-		}
 	}
 
 	buf = header_get(header, "X-Queue");
@@ -3698,8 +3623,10 @@ parq_upload_update_downloaded(const struct upload *u)
 
 	puq = handle_to_queued(u->parq_ul);
 
-	if (u->downloaded <= puq->file_size)
+	if (u->downloaded <= puq->file_size) {
 		puq->downloaded = u->downloaded;
+		parq_upload_update_slot_time(puq);
+	}
 }
 
 /**
@@ -3720,6 +3647,7 @@ parq_upload_request(struct upload *u)
 
 	puq->chunk_size = u->skip > u->end ? 0 : u->end - u->skip + 1;
 	puq->updated = now;
+	parq_upload_update_slot_time(puq);		/* Refresh estimate */
 	puq->retry = time_advance(now, parq_ul_calc_retry(puq));
 
 	g_assert(delta_time(puq->retry, now) >= 0);
@@ -3788,11 +3716,11 @@ parq_upload_request(struct upload *u)
 
 	if (puq->has_slot) {
 		if (!puq->quick) {
-			g_assert(puq->relative_position == 0);
+			g_assert(parq_ul_relative_position(puq) == 0);
 			return TRUE;			/* Has regular slot */
 		}
 		if (parq_upload_quick_continue(puq)) {
-			g_assert(puq->relative_position > 0);
+			g_assert(parq_ul_relative_position(puq) > 0);
 			return TRUE;			/* Has quick slot */
 		}
 		if (GNET_PROPERTY(parq_debug))
@@ -3826,10 +3754,11 @@ parq_upload_request(struct upload *u)
 		 *		--RAM, 2007-08-17
 		 */
 
-		g_assert(puq->relative_position > 0);	/* Was a quick slot */
+		g_assert(parq_ul_relative_position(puq) > 0);	/* Was a quick slot */
 
 		puq->by_addr->uploading--;
 		puq->has_slot = FALSE;
+		parq_upload_update_slot_time(puq);
 		parq_upload_unfreeze_all(puq);	/* Allow others to compete */
 	}
 
@@ -3868,7 +3797,7 @@ parq_upload_request(struct upload *u)
 			if (puq->flags & PARQ_UL_FROZEN)
 				puq->active_queued = FALSE;
 			else if (
-				puq->relative_position <=
+				parq_ul_relative_position(puq) <=
 				1 + UNSIGNED(free_upload_slots(puq->queue)) / 2
 			)
 				u->status = GTA_UL_QUEUED;	/* Maintain active queuing */
@@ -3887,7 +3816,7 @@ parq_upload_request(struct upload *u)
 					"switching from active to passive for %s (%s)",
 					puq->queue->num, guid_hex_str(&puq->id),
 					fd_avail_status_string(fds),
-					puq->relative_position, u->push ? "y" : "n",
+					parq_ul_relative_position(puq), u->push ? "y" : "n",
 					(puq->flags & PARQ_UL_FROZEN) ? "y" : "n",
 					host_addr_port_to_string(u->socket->addr, u->socket->port),
 					upload_vendor_str(u));
@@ -3929,7 +3858,7 @@ parq_upload_request(struct upload *u)
 		queueable = GNET_PROPERTY(sys_nofile) * 4 / 5 >
 			max_fd_used + (MIN_ALWAYS_QUEUE * GNET_PROPERTY(max_uploads));
 
-		if (puq->relative_position <= MIN_ALWAYS_QUEUE)
+		if (parq_ul_relative_position(puq) <= MIN_ALWAYS_QUEUE)
 			queueable = TRUE;
 
 		/*
@@ -3955,8 +3884,8 @@ parq_upload_request(struct upload *u)
 		}
 
 		if (
-			(u->push && puq->relative_position <= max_slot) ||
-			(queueable && puq->relative_position <=
+			(u->push && parq_ul_relative_position(puq) <= max_slot) ||
+			(queueable && parq_ul_relative_position(puq) <=
 				UNSIGNED(free_upload_slots(puq->queue)) + MIN_UPLOAD_ASLOT)
 		) {
 			if ((puq->flags & PARQ_UL_FROZEN) && !activeable) {
@@ -4011,7 +3940,8 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	if (GNET_PROPERTY(parq_debug) > 2) {
 		g_debug("PARQ UL [#%d] upload pos=%d rel=%d (%s, %s, %s) "
 			"is now busy [%s]",
-			puq->queue->num, puq->position, puq->relative_position,
+			puq->queue->num,
+			parq_ul_position(puq), parq_ul_relative_position(puq),
 			puq->active_queued ? "active" : "passive",
 			puq->has_slot ? "with slot" : "no slot yet",
 			puq->quick ? "quick" : "regular",
@@ -4035,11 +3965,10 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	 *		--RAM, 2007-08-16
 	 */
 
-	if (!puq->quick && puq->relative_position) {
+	if (!puq->quick && parq_ul_relative_position(puq)) {
 		parq_upload_remove_relative(puq);
-		parq_upload_recompute_relative_positions(puq->queue);
 
-		puq->relative_position = 0;		/* Signals: has regular slot */
+		puq->relative_saved = 0;		/* Signals: has regular slot */
 		puq->had_slot = TRUE;			/* Had a regular slot */
 		puq->queue->active_uploads++;	/* Account active in queue */
 	}
@@ -4058,6 +3987,7 @@ parq_upload_busy(struct upload *u, struct parq_ul_queued *handle)
 	puq->has_slot = TRUE;
 	puq->by_addr->uploading++;
 	puq->slot_granted = tm_time();
+	parq_upload_update_slot_time(puq);
 }
 
 void
@@ -4231,7 +4161,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 	 */
 
 	if (puq->has_slot) {
-		hash_list_iter_t *iter;
+		uint rel;
 
 		if (GNET_PROPERTY(parq_debug) > 2)
 			g_debug("PARQ UL: [#%d] [%s] Freed an upload slot%s",
@@ -4249,12 +4179,9 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 		 * Tell next waiting upload that a slot is available, using QUEUE
 		 */
 
-		iter = hash_list_iterator(puq->queue->by_rel_pos);
-
-		while (hash_list_iter_has_next(iter)) {
-			struct parq_ul_queued *puq_next = hash_list_iter_next(iter);
-
-			parq_ul_queued_check(puq_next);
+		for (rel = 1; rel <= UNSIGNED(puq->queue->by_rel_pos_length); rel++) {
+			struct parq_ul_queued *puq_next =
+				parq_ul_relative_nth(puq->queue, rel);
 
 			if (puq_next->has_slot)
 				continue;
@@ -4277,13 +4204,11 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			break;
 		}
 
-		hash_list_iter_release(&iter);
-
 		/*
 		 * Put back in queue until it expires.
 		 */
 
-		if (0 == puq->relative_position) {
+		if (0 == parq_ul_relative_position(puq)) {
 			puq->queue->active_uploads--;
 			puq->expire = time_advance(now, GUARDING_TIME);
 
@@ -4296,10 +4221,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 			if (puq->had_slot)
 				puq->flags |= PARQ_UL_NOQUEUE;
 
-			g_assert(!hash_list_contains(puq->queue->by_rel_pos, puq));
-
 			parq_upload_insert_relative(puq);
-			parq_upload_recompute_relative_positions(puq->queue);
 		}
 
 		parq_upload_unfreeze_all(puq);	/* Allow others to compete */
@@ -4379,6 +4301,7 @@ parq_upload_remove(struct upload *u, bool was_sending, bool was_running)
 done:
 	puq->has_slot = FALSE;
 	puq->slot_granted = 0;
+	parq_upload_update_slot_time(puq);
 
 	return FALSE;
 }
@@ -4404,12 +4327,12 @@ parq_upload_add_old_queue_header(char *buf, size_t size,
 	if (small_reply) {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, min_poll, max_poll);
+				parq_ul_relative_position(puq), min_poll, max_poll);
 	} else {
 		len = str_bprintf(buf, size,
 				"X-Queue: position=%d, length=%d, "
 				"limit=%d, pollMin=%u, pollMax=%u\r\n",
-				puq->relative_position, puq->queue->by_position_length,
+				parq_ul_relative_position(puq), puq->queue->by_position_length,
 				1, min_poll, max_poll);
 	}
 	if (len >= size || (len > 0 && '\n' != buf[len - 1])) {
@@ -4445,7 +4368,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 		puq->flags |= PARQ_UL_ID_SENT;
 
 		len = concat_strings(&buf[rw], size,
-			"; position=", uint32_to_string(puq->relative_position),
+			"; position=", uint32_to_string(parq_ul_relative_position(puq)),
 			NULL_PTR);
 
 		if (len < size) {
@@ -4467,7 +4390,7 @@ parq_upload_add_x_queued_header(char *buf, size_t size,
 						rw += len;
 						size -= len;
 						len = concat_strings(&buf[rw], size,
-							"; ETA=", uint32_to_string(puq->eta),
+							"; ETA=", uint32_to_string(parq_ul_eta(puq)),
 							NULL_PTR);
 						if (len < size) {
 							rw += len;
@@ -4636,7 +4559,7 @@ parq_upload_lookup_position(const struct upload *u)
 	puq = parq_upload_find(u);
 
 	if (puq != NULL) {
-		return puq->relative_position;
+		return parq_ul_relative_position(puq);
 	} else {
 		return (uint) -1;
 	}
@@ -4668,7 +4591,7 @@ parq_upload_lookup_eta(const struct upload *u)
 
 	/* If puq == NULL the current upload isn't queued and ETA is unknown */
 	if (puq != NULL)
-		return puq->eta;
+		return parq_ul_eta(puq);
 	else
 		return (uint) -1;
 }
@@ -4887,8 +4810,8 @@ parq_store(void *data, void *file_ptr)
 		g_debug("PARQ UL Q %d/%d (%3d[%3d]/%3d): Saving %s: '%s' - %s '%s'",
 			  puq->queue->num,
 			  ul_parqs_cnt,
-			  puq->position,
-			  puq->relative_position,
+			  parq_ul_position(puq),
+			  parq_ul_relative_position(puq),
 			  puq->queue->by_position_length,
 			  puq->supports_parq ? "PARQ" : "slot",
 			  guid_hex_str(&puq->id),
@@ -4915,7 +4838,7 @@ parq_store(void *data, void *file_ptr)
 		"IP: %s\n"
 		,
 		puq->queue->num,
-		puq->position,
+		parq_ul_position(puq),
 		enter_buf,
 		expire,
 		guid_hex_str(&puq->id),
@@ -4980,7 +4903,7 @@ parq_upload_save_queue(void)
 	) {
 		struct parq_ul_queue *queue = queues->data;
 
-		PLIST_FOREACH_CALL_DATA(queue->by_position, parq_store, f);
+		slotq_foreach(queue->by_position, parq_store, f);
 	}
 
 	file_config_close(f, &fp);
@@ -5396,8 +5319,8 @@ parq_upload_load_queue(void)
 					"restored: %s%s '%s'",
 					puq->queue->num,
 					ul_parqs_cnt,
-					puq->position,
-				 	puq->relative_position,
+					parq_ul_position(puq),
+				 	parq_ul_relative_position(puq),
 					puq->queue->by_position_length,
 					short_time_ascii(parq_upload_lookup_eta(fake_upload)),
 					host_addr_to_string(puq->remote_addr),
@@ -5488,6 +5411,20 @@ parq_init(void)
 		parq_save_timer, NULL);
 }
 
+/**
+ * Collect queued entry for removal, invoked by slotq_foreach().
+ */
+static void
+parq_upload_collect(void *data, void *udata)
+{
+	struct parq_ul_queued *puq = data;
+	pslist_t **to_remove = udata;
+
+	puq->by_addr->uploading = 0;
+
+	*to_remove = pslist_prepend(*to_remove, puq);
+}
+
 /**
  * Saves any queueing information and frees all memory used by PARQ.
  */
@@ -5524,16 +5461,7 @@ parq_close_pre(void)
 	for (queues = ul_parqs; queues != NULL; queues = queues->next) {
 		struct parq_ul_queue *queue = queues->data;
 
-		PLIST_FOREACH(queue->by_position, dl) {
-			struct parq_ul_queued *puq = dl->data;
-
-			if (puq == NULL)
-				break;
-
-			puq->by_addr->uploading = 0;
-
-			to_remove = pslist_prepend(to_remove, puq);
-		}
+		slotq_foreach(queue->by_position, parq_upload_collect, &to_remove);
 
 		to_removeq = pslist_prepend(to_removeq, queue);
 	}
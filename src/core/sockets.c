@@ -283,6 +283,30 @@ socket_evt_fd(struct gnutella_socket *s)
 	return fd;
 }
 
+/**
+ * Input event handler for sockets on which zero-copy transmissions were made.
+ *
+ * The kernel reports completions of zero-copy transmissions as an error
+ * condition on the socket, long after the I/O source that sent the data was
+ * removed when the connection is kept alive.  These must not be taken as a
+ * connection failure by the handler installed on the socket.
+ */
+static void
+socket_zerocopy_event(void *data, int source, inputevt_cond_t cond)
+{
+	struct gnutella_socket *s = data;
+
+	socket_check(s);
+
+	if ((cond & INPUT_EVENT_EXCEPTION) && !bio_zerocopy_exception(&s->wio)) {
+		cond &= ~(uint) INPUT_EVENT_EXCEPTION;
+		if (INPUT_EVENT_NONE == cond)
+			return;
+	}
+
+	(*s->tls.cb_handler)(s->tls.cb_data, source, cond);
+}
+
 /**
  * Install handler callback when an input condition is satisfied on the socket.
  *
@@ -319,7 +343,10 @@ socket_evt_set(struct gnutella_socket *s,
 			G_STRFUNC, fd, inputevt_cond_to_string(cond),
 			stacktrace_function_name(handler));
 	}
-	s->gdk_tag = inputevt_add(fd, cond, handler, data);
+	if G_UNLIKELY(bio_zerocopy_enabled(&s->wio))
+		s->gdk_tag = inputevt_add(fd, cond, socket_zerocopy_event, s);
+	else
+		s->gdk_tag = inputevt_add(fd, cond, handler, data);
 	g_assert(0 != s->gdk_tag);
 
 	if ((INPUT_EVENT_R & cond) && s->pos != 0)
@@ -1614,6 +1641,8 @@ socket_free(struct gnutella_socket *s)
 
 		entropy_harvest_single(VARLEN(s->file_desc));
 
+		bio_zerocopy_close(&s->wio);
+
 		if (compat_socket_close(s->file_desc)) {
 			g_warning("%s: close(%d) failed: %m", G_STRFUNC, s->file_desc);
 		}
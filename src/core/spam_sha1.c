@@ -105,7 +105,7 @@ spam_lut_create(void)
 
 		path = make_pathname(settings_gnet_db_dir(), db_spambase);
 		dm = dbmap_create_sdbm(SHA1_RAW_SIZE, NULL, spam_sha1_what, path,
-			O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+			O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR, 0);
 		HFREE_NULL(path);
 
 		if (NULL == dm) {
@@ -164,10 +164,12 @@ spam_sha1_sync(void)
 		/*
 		 * Now that loading is finished, we can wrap the dbmap to use some
 		 * amount of high-level caching, and therefore reduce the amount
-		 * of low-level caching done.
+		 * of low-level caching done.  Since the database is now only
+		 * going to be read, its pages can be accessed in place.
 		 */
 
 		dbmap_set_cachesize(dm, SPAM_DB_RUN_CACHESIZE);
+		dbmap_set_mmap(dm, TRUE);
 		sha1_lut.d.dw = dbmw_create(dm, spam_sha1_what,
 			0, 0,
 			NULL, NULL, NULL,
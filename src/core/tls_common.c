@@ -60,6 +60,23 @@
 #define USE_TLS_PUSHV
 #endif
 
+/*
+ * Kernel TLS offloading requires gnutls_record_get_state() to export the
+ * session keys, which appeared in GnuTLS 3.4.
+ */
+#if HAS_TLS(3, 4) && defined(I_LINUX_TLS)
+#include <linux/tls.h>
+#ifdef TLS_TX
+#define USE_KTLS
+#ifndef SOL_TLS
+#define SOL_TLS		282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP		31
+#endif
+#endif	/* TLS_TX */
+#endif	/* TLS >= 3.4 && I_LINUX_TLS */
+
 #include "tls_common.h"
 
 #include "features.h"
@@ -105,6 +122,7 @@ struct tls_context {
 		gnutls_anon_client_credentials_t client;
 	} cred;
 	const struct gnutella_socket *s;
+	bool ktls_tx;		/**< Kernel encrypts outgoing records */
 };
 
 static gnutls_certificate_credentials_t cert_cred;
@@ -809,6 +827,173 @@ tls_log_audit(gnutls_session_t session, const char *message)
 }
 #endif	/* TLS >= 3.0 */
 
+#ifdef USE_KTLS
+/**
+ * Fill kernel crypto information for an AES-GCM cipher of given bit size.
+ *
+ * In TLS 1.2 the explicit nonce sent with each record is the sequence number.
+ */
+#define TLS_KTLS_GCM(ci, bits) G_STMT_START {							\
+	const size_t salt_len = TLS_CIPHER_AES_GCM_##bits##_SALT_SIZE;		\
+	const size_t iv_len = TLS_CIPHER_AES_GCM_##bits##_IV_SIZE;			\
+																		\
+	if (																\
+		key.size != TLS_CIPHER_AES_GCM_##bits##_KEY_SIZE ||				\
+		iv.size < salt_len												\
+	)																	\
+		goto unsupported;												\
+	(ci).info.version = TLS_1_2_VERSION;								\
+	(ci).info.cipher_type = TLS_CIPHER_AES_GCM_##bits;					\
+	memcpy((ci).salt, iv.data, salt_len);								\
+	memcpy((ci).iv, seq, iv_len);										\
+	memcpy((ci).rec_seq, seq, TLS_CIPHER_AES_GCM_##bits##_REC_SEQ_SIZE);	\
+	memcpy((ci).key, key.data, TLS_CIPHER_AES_GCM_##bits##_KEY_SIZE);	\
+	len = sizeof (ci);													\
+} G_STMT_END
+
+/**
+ * Hand the encryption of outgoing records over to the kernel.
+ *
+ * This must be called right after the handshake completed, before any
+ * application data was sent through GnuTLS: the kernel continues with the
+ * write sequence number and keys we export from the session.  From then on,
+ * plain write() or sendfile() calls on the socket emit TLS records, which is
+ * what lets TLS uploads use the zero-copy path.
+ *
+ * Reception is left to GnuTLS, since the remote host can still send us
+ * non-data records (alerts, session tickets) that the kernel would not
+ * handle transparently.
+ *
+ * Only TLS 1.2 sessions are offloaded.  In TLS 1.3, GnuTLS answers a
+ * KeyUpdate from the remote host and sends alerts by itself, through its
+ * own push function: these records would be encrypted a second time by the
+ * kernel, and the kernel would keep using the old keys.
+ *
+ * @return TRUE if the kernel now encrypts outgoing data.
+ */
+static bool
+tls_ktls_enable_tx(struct gnutella_socket *s)
+{
+	gnutls_session_t session = tls_socket_get_session(s);
+	gnutls_datum_t iv, key;
+	uchar seq[8];
+	union {
+		struct tls12_crypto_info_aes_gcm_128 gcm128;
+#ifdef TLS_CIPHER_AES_GCM_256
+		struct tls12_crypto_info_aes_gcm_256 gcm256;
+#endif
+	} ci;
+	socklen_t len = 0;
+	const char *what = "unsupported cipher";
+
+	if (GNUTLS_TLS1_2 != gnutls_protocol_get_version(session)) {
+		what = "unsupported protocol";
+		goto unsupported;
+	}
+
+	if (gnutls_record_get_state(session, FALSE, NULL, &iv, &key, seq) < 0) {
+		what = "cannot export keys";
+		goto unsupported;
+	}
+
+	ZERO(&ci);
+
+	switch (gnutls_cipher_get(session)) {
+	case GNUTLS_CIPHER_AES_128_GCM:
+		TLS_KTLS_GCM(ci.gcm128, 128);
+		break;
+#ifdef TLS_CIPHER_AES_GCM_256
+	case GNUTLS_CIPHER_AES_256_GCM:
+		TLS_KTLS_GCM(ci.gcm256, 256);
+		break;
+#endif
+	default:
+		goto unsupported;
+	}
+
+	if (-1 == setsockopt(s->file_desc, IPPROTO_TCP, TCP_ULP, "tls", 4)) {
+		what = "TCP_ULP";
+		goto failed;
+	}
+
+	if (-1 == setsockopt(s->file_desc, SOL_TLS, TLS_TX, &ci, len)) {
+		/*
+		 * The "tls" upper layer protocol is now attached but inactive: the
+		 * socket still behaves as a plain one and GnuTLS keeps encrypting.
+		 */
+		what = "TLS_TX";
+		goto failed;
+	}
+
+	ZERO(&ci);		/* Do not leave key material lying around */
+
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): kernel TLS enabled for %s on fd=%d",
+			G_STRFUNC, host_addr_port_to_string(s->addr, s->port),
+			s->file_desc);
+	}
+
+	return TRUE;
+
+failed:
+	ZERO(&ci);
+	if (GNET_PROPERTY(tls_debug) > 1) {
+		g_debug("%s(): cannot enable kernel TLS for %s on fd=%d: %s: %m",
+			G_STRFUNC, host_addr_port_to_string(s->addr, s->port),
+			s->file_desc, what);
+	}
+	return FALSE;
+
+unsupported:
+	if (GNET_PROPERTY(tls_debug) > 2) {
+		g_debug("%s(): no kernel TLS for %s on fd=%d: %s",
+			G_STRFUNC, host_addr_port_to_string(s->addr, s->port),
+			s->file_desc, what);
+	}
+	return FALSE;
+}
+
+#undef TLS_KTLS_GCM
+
+/**
+ * Send TLS close_notify alert through the kernel.
+ *
+ * Once the kernel encrypts outgoing records, gnutls_bye() can no longer be
+ * used: the alert record type has to be given to the kernel as ancillary
+ * data so that it builds the proper record.
+ */
+static void
+tls_ktls_bye(struct gnutella_socket *s)
+{
+	static const uchar alert[2] = { 1, 0 };	/* warning, close_notify */
+	char cbuf[CMSG_SPACE(sizeof(uchar))];
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	iovec_t iov;
+
+	ZERO(&msg);
+	ZERO(&cbuf);
+	iovec_set(&iov, deconstify_pointer(alert), sizeof alert);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof cbuf;
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_TLS;
+	cmsg->cmsg_type = TLS_SET_RECORD_TYPE;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(uchar));
+	*(uchar *) CMSG_DATA(cmsg) = 21;		/* Alert record type */
+
+	if (-1 == sendmsg(s->file_desc, &msg, 0) && GNET_PROPERTY(tls_debug)) {
+		if (!is_temporary_error(errno) && EPIPE != errno) {
+			g_warning("%s(): sendmsg(fd=%d) failed: %m",
+				G_STRFUNC, s->file_desc);
+		}
+	}
+}
+#endif	/* USE_KTLS */
+
 /**
  * @return	TLS_HANDSHAKE_ERROR if the TLS handshake failed.
  *			TLS_HANDSHAKE_RETRY if the handshake is incomplete; thus
@@ -854,6 +1039,10 @@ tls_handshake(struct gnutella_socket *s)
 			tls_print_session_info(s->addr, s->port, session,
 				SOCK_CONN_INCOMING == s->direction);
 		}
+#ifdef USE_KTLS
+		if (GNET_PROPERTY(tls_kernel_offload))
+			s->tls.ctx->ktls_tx = tls_ktls_enable_tx(s);
+#endif
 		tls_signal_pending(s);
 		return TLS_HANDSHAKE_FINISHED;
 	case GNUTLS_E_AGAIN:
@@ -1383,6 +1572,59 @@ tls_readv(struct wrap_io *wio, iovec_t *iov, int iovcnt)
 	return done > 0 ? done : ret;
 }
 
+#ifdef USE_KTLS
+static ssize_t
+tls_ktls_write(struct wrap_io *wio, const void *buf, size_t size)
+{
+	struct gnutella_socket *s = wio->ctx;
+	ssize_t ret;
+	int saved_errno;
+
+	socket_check(s);
+	g_assert(socket_uses_tls(s));
+	g_assert(s->tls.ctx->ktls_tx);
+	g_assert(NULL != buf);
+	g_assert(size_is_positive(size));
+
+	ret = s_write(s->file_desc, buf, size);
+	saved_errno = errno;
+	if ((ssize_t) -1 == ret) {
+		if (ECONNRESET == saved_errno || EPIPE == saved_errno)
+			socket_connection_reset(s);
+	} else if (s->gdk_tag) {
+		tls_socket_evt_change(s, INPUT_EVENT_WX);
+	}
+	tls_transport_debug(G_STRFUNC, s, size, ret);
+	errno = saved_errno;
+	return ret;
+}
+
+static ssize_t
+tls_ktls_writev(struct wrap_io *wio, const iovec_t *iov, int iovcnt)
+{
+	struct gnutella_socket *s = wio->ctx;
+	ssize_t ret;
+	int saved_errno;
+
+	socket_check(s);
+	g_assert(socket_uses_tls(s));
+	g_assert(s->tls.ctx->ktls_tx);
+	g_assert(iovcnt > 0);
+
+	ret = s_writev(s->file_desc, iov, iovcnt);
+	saved_errno = errno;
+	if ((ssize_t) -1 == ret) {
+		if (ECONNRESET == saved_errno || EPIPE == saved_errno)
+			socket_connection_reset(s);
+	} else if (s->gdk_tag) {
+		tls_socket_evt_change(s, INPUT_EVENT_WX);
+	}
+	tls_transport_debug(G_STRFUNC, s, iov_calculate_size(iov, iovcnt), ret);
+	errno = saved_errno;
+	return ret;
+}
+#endif	/* USE_KTLS */
+
 static ssize_t
 tls_no_sendto(struct wrap_io *unused_wio, const gnet_host_t *unused_to,
 	const void *unused_buf, size_t unused_size)
@@ -1406,6 +1648,32 @@ tls_wio_link(struct gnutella_socket *s)
 	s->wio.readv = tls_readv;
 	s->wio.sendto = tls_no_sendto;
 	s->wio.flush = tls_flush;
+
+#ifdef USE_KTLS
+	/*
+	 * When the kernel encrypts outgoing records, data must be written
+	 * directly to the socket, bypassing GnuTLS.
+	 */
+
+	if (s->tls.ctx != NULL && s->tls.ctx->ktls_tx) {
+		s->wio.write = tls_ktls_write;
+		s->wio.writev = tls_ktls_writev;
+	}
+#endif
+}
+
+/**
+ * Is the encryption of outgoing data for this TLS socket done by the kernel?
+ *
+ * When it is, data can be written to the socket file descriptor without
+ * going through the TLS layer, and in particular with sendfile().
+ */
+bool
+tls_kernel_offloaded(const struct gnutella_socket *s)
+{
+	socket_check(s);
+
+	return socket_uses_tls(s) && s->tls.ctx != NULL && s->tls.ctx->ktls_tx;
 }
 
 void
@@ -1424,6 +1692,13 @@ tls_bye(struct gnutella_socket *s)
 		g_warning("%s(): tls_flush(fd=%d) failed", G_STRFUNC, s->file_desc);
 	}
 
+#ifdef USE_KTLS
+	if (s->tls.ctx->ktls_tx) {
+		tls_ktls_bye(s);
+		return;
+	}
+#endif
+
 	ret = gnutls_bye(s->tls.ctx->session,
 			SOCK_CONN_INCOMING != s->direction
 				? GNUTLS_SHUT_WR : GNUTLS_SHUT_RDWR);
@@ -1603,6 +1878,13 @@ tls_wio_link(struct gnutella_socket *s)
 	g_assert_not_reached();
 }
 
+bool
+tls_kernel_offloaded(const struct gnutella_socket *s)
+{
+	socket_check(s);
+	return FALSE;
+}
+
 void
 tls_global_init(void)
 {
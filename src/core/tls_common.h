@@ -51,6 +51,7 @@ enum tls_handshake_result tls_handshake(struct gnutella_socket *);
 void tls_bye(struct gnutella_socket *);
 void tls_free(struct gnutella_socket *);
 void tls_wio_link(struct gnutella_socket *);
+bool tls_kernel_offloaded(const struct gnutella_socket *);
 
 bool tls_enabled(void);
 void tls_global_init(void);
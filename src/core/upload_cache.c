@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Shared block cache for uploaded file data.
+ *
+ * When uploads cannot use sendfile(), for instance because the connection
+ * is using TLS, each upload reads the file data into its own buffer.  Popular
+ * files are often requested by several hosts at the same time, and each of
+ * these uploads would then read the same data from the disk.
+ *
+ * This cache keeps the most recently read blocks of complete shared files,
+ * keyed by their SHA1 and block-aligned offset, so that concurrent uploads
+ * of the same file share their disk reads.  The amount of memory used is
+ * bounded by the "upload_cache_size" property, least recently used blocks
+ * being evicted first.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "upload_cache.h"
+
+#include "gnet_stats.h"
+
+#include "if/gnet_property.h"
+#include "if/gnet_property_priv.h"
+
+#include "lib/atoms.h"
+#include "lib/file_object.h"
+#include "lib/halloc.h"
+#include "lib/hashing.h"
+#include "lib/hashlist.h"
+#include "lib/htable.h"
+#include "lib/walloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#define UPLOAD_CACHE_BLOCK	(64 * 1024)		/**< Size of cached blocks */
+
+/**
+ * Cache key.
+ */
+struct upload_cache_key {
+	const struct sha1 *sha1;	/**< SHA1 of the file (atom) */
+	filesize_t offset;			/**< Block-aligned offset within file */
+};
+
+enum upload_cache_block_magic { UPLOAD_CACHE_BLOCK_MAGIC = 0x4f1b0a3d };
+
+/**
+ * A cached block of file data.
+ */
+struct upload_cache_block {
+	struct upload_cache_key key;	/**< Embedded key, must be first */
+	enum upload_cache_block_magic magic;
+	size_t len;						/**< Amount of data held */
+	char *data;						/**< The data (UPLOAD_CACHE_BLOCK bytes) */
+};
+
+static inline void
+upload_cache_block_check(const struct upload_cache_block * const ucb)
+{
+	g_assert(ucb != NULL);
+	g_assert(UPLOAD_CACHE_BLOCK_MAGIC == ucb->magic);
+}
+
+/**
+ * Cached blocks, the least recently used at the head.
+ */
+static hash_list_t *upload_cache;
+
+/**
+ * Amount of active uploads for each SHA1 (atom), as registered through
+ * upload_cache_attach().
+ */
+static htable_t *upload_cache_users;
+
+static uint
+upload_cache_key_hash(const void *key)
+{
+	const struct upload_cache_key *k = key;
+
+	return sha1_hash(k->sha1) ^ u32_hash(k->offset / UPLOAD_CACHE_BLOCK);
+}
+
+static bool
+upload_cache_key_eq(const void *a, const void *b)
+{
+	const struct upload_cache_key *ka = a, *kb = b;
+
+	return ka->offset == kb->offset && sha1_eq(ka->sha1, kb->sha1);
+}
+
+/**
+ * Free cached block.
+ */
+static void
+upload_cache_block_free(struct upload_cache_block *ucb)
+{
+	upload_cache_block_check(ucb);
+
+	atom_sha1_free_null(&ucb->key.sha1);
+	HFREE_NULL(ucb->data);
+	ucb->magic = 0;
+	WFREE(ucb);
+}
+
+/**
+ * Evict the least recently used blocks until we hold at most `max' blocks.
+ */
+static void
+upload_cache_trim(size_t max)
+{
+	size_t evicted = 0;
+
+	while (hash_list_length(upload_cache) > max) {
+		struct upload_cache_block *ucb = hash_list_remove_head(upload_cache);
+
+		upload_cache_block_free(ucb);
+		evicted++;
+	}
+
+	if (evicted != 0) {
+		gnet_stats_count_general(GNR_UPLOAD_CACHE_EVICTIONS, evicted);
+		gnet_stats_set_general(GNR_UPLOAD_CACHE_BLOCKS,
+			hash_list_length(upload_cache));
+	}
+}
+
+/**
+ * @return the maximum amount of blocks we can hold in the cache.
+ */
+static size_t
+upload_cache_max_blocks(void)
+{
+	uint64 max = GNET_PROPERTY(upload_cache_size) * (uint64) 1024;
+
+	return max / UPLOAD_CACHE_BLOCK;
+}
+
+/**
+ * Register an active upload of a complete file.
+ *
+ * @param sha1		the SHA1 of the file
+ *
+ * @return a SHA1 atom, to be given back to upload_cache_detach().
+ */
+const struct sha1 *
+upload_cache_attach(const struct sha1 *sha1)
+{
+	const struct sha1 *key;
+	uint n;
+
+	key = atom_sha1_get(sha1);
+	n = pointer_to_uint(htable_lookup(upload_cache_users, key));
+	g_assert(n < MAX_INT_VAL(uint));
+	htable_insert(upload_cache_users, key, uint_to_pointer(n + 1));
+
+	return key;
+}
+
+/**
+ * Unregister an active upload, nullifying the SHA1 atom pointer.
+ */
+void
+upload_cache_detach(const struct sha1 **sha1_ptr)
+{
+	const struct sha1 *key = *sha1_ptr;
+
+	if (key != NULL) {
+		uint n = pointer_to_uint(htable_lookup(upload_cache_users, key));
+
+		g_assert(n != 0);
+
+		if (n > 1)
+			htable_insert(upload_cache_users, key, uint_to_pointer(n - 1));
+		else
+			htable_remove(upload_cache_users, key);
+
+		atom_sha1_free_null(sha1_ptr);
+	}
+}
+
+/**
+ * Read data from a shared file, through the cache.
+ *
+ * Blocks are only cached when several uploads of the file are active, as
+ * registered through upload_cache_attach(): a lone upload reads its data
+ * directly into the supplied buffer.
+ *
+ * This behaves like file_object_pread() but may return less data than
+ * requested, since it only returns data from the block containing `offset'.
+ * Callers are expected to come back for the remaining data.
+ *
+ * The file must be complete: its data can no longer change for the given
+ * SHA1.  Partial files must be read directly.
+ *
+ * @param sha1		the SHA1 of the file (atom), NULL if unknown
+ * @param size		the size of the file
+ * @param fo		the file object to read from
+ * @param data		where data are copied
+ * @param len		amount of data wanted
+ * @param offset	offset in the file of the data wanted
+ *
+ * @return the amount of bytes read, 0 on EOF, -1 on error with errno set.
+ */
+ssize_t
+upload_cache_pread(const struct sha1 *sha1, filesize_t size,
+	const struct file_object *fo, void *data, size_t len, filesize_t offset)
+{
+	struct upload_cache_key key;
+	struct upload_cache_block *ucb;
+	size_t max, blen, start;
+	ssize_t r;
+
+	max = upload_cache_max_blocks();
+
+	if (
+		NULL == sha1 || 0 == max || offset >= size ||
+		pointer_to_uint(htable_lookup(upload_cache_users, sha1)) < 2
+	) {
+		if G_UNLIKELY(upload_cache != NULL && 0 == max)
+			upload_cache_trim(0);
+		return file_object_pread(fo, data, len, offset);
+	}
+
+	key.sha1 = sha1;
+	key.offset = offset - offset % UPLOAD_CACHE_BLOCK;
+	start = offset - key.offset;
+
+	ucb = hash_list_lookup(upload_cache, &key);
+
+	if (ucb != NULL) {
+		upload_cache_block_check(ucb);
+		gnet_stats_inc_general(GNR_UPLOAD_CACHE_HITS);
+		hash_list_moveto_tail(upload_cache, ucb);
+		goto copy;
+	}
+
+	/*
+	 * Cache miss: read the whole block containing the offset.
+	 */
+
+	gnet_stats_inc_general(GNR_UPLOAD_CACHE_MISSES);
+
+	blen = MIN(size - key.offset, UPLOAD_CACHE_BLOCK);
+
+	WALLOC0(ucb);
+	ucb->magic = UPLOAD_CACHE_BLOCK_MAGIC;
+	ucb->data = halloc(UPLOAD_CACHE_BLOCK);
+
+	r = file_object_pread(fo, ucb->data, blen, key.offset);
+
+	if ((ssize_t) -1 == r || (size_t) r <= start) {
+		int saved_errno = errno;
+
+		upload_cache_block_free(ucb);
+		errno = saved_errno;
+		return (ssize_t) -1 == r ? r : 0;
+	}
+
+	ucb->len = r;
+
+	/*
+	 * Do not cache short reads: the file changed on disk and will be
+	 * re-indexed, we do not want to serve truncated blocks later.
+	 */
+
+	if ((size_t) r != blen) {
+		len = MIN(len, ucb->len - start);
+		memcpy(data, &ucb->data[start], len);
+		upload_cache_block_free(ucb);
+		return len;
+	}
+
+	ucb->key.sha1 = atom_sha1_get(sha1);
+	ucb->key.offset = key.offset;
+
+	upload_cache_trim(max - 1);
+	hash_list_append(upload_cache, ucb);
+	gnet_stats_set_general(GNR_UPLOAD_CACHE_BLOCKS,
+		hash_list_length(upload_cache));
+
+copy:
+	g_assert(start < ucb->len);
+
+	len = MIN(len, ucb->len - start);
+	memcpy(data, &ucb->data[start], len);
+
+	return len;
+}
+
+/**
+ * Initialize the upload cache.
+ */
+void G_COLD
+upload_cache_init(void)
+{
+	upload_cache = hash_list_new(upload_cache_key_hash, upload_cache_key_eq);
+	upload_cache_users = htable_create(HASH_KEY_FIXED, SHA1_RAW_SIZE);
+}
+
+static void
+upload_cache_free_block(void *data, void *unused_udata)
+{
+	(void) unused_udata;
+
+	upload_cache_block_free(data);
+}
+
+/**
+ * Release all the cached blocks.
+ */
+void G_COLD
+upload_cache_close(void)
+{
+	hash_list_foreach(upload_cache, upload_cache_free_block, NULL);
+	hash_list_free(&upload_cache);
+	htable_free_null(&upload_cache_users);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup core
+ * @file
+ *
+ * Shared block cache for uploaded file data.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _core_upload_cache_h_
+#define _core_upload_cache_h_
+
+#include "common.h"
+
+struct sha1;
+struct file_object;
+
+/*
+ * Public interface.
+ */
+
+void upload_cache_init(void);
+void upload_cache_close(void);
+
+const struct sha1 *upload_cache_attach(const struct sha1 *sha1);
+void upload_cache_detach(const struct sha1 **sha1_ptr);
+
+ssize_t upload_cache_pread(const struct sha1 *sha1, filesize_t size,
+	const struct file_object *fo, void *data, size_t len, filesize_t offset);
+
+#endif /* _core_upload_cache_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
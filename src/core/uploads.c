@@ -61,10 +61,12 @@
 #include "sockets.h"
 #include "spam.h"
 #include "thex_upload.h"
+#include "tls_common.h"
 #include "tth_cache.h"
 #include "ipp_cache.h"
 #include "tx_deflate.h"
 #include "tx_link.h"		/* for callback structures */
+#include "upload_cache.h"
 #include "upload_stats.h"
 #include "uploads.h"
 #include "verify_tth.h"
@@ -103,6 +105,7 @@
 #include "lib/listener.h"
 #include "lib/misc.h"			/* For english_strerror() */
 #include "lib/parse.h"
+#include "lib/pmsg.h"
 #include "lib/product.h"
 #include "lib/pslist.h"
 #include "lib/str.h"
@@ -469,7 +472,13 @@ use_sendfile(struct upload *u)
 {
 	upload_check(u);
 #if defined(HAS_MMAP) || defined(HAS_SENDFILE)
-	return !sendfile_failed && !socket_uses_tls(u->socket);
+	/*
+	 * TLS connections can only use sendfile() when the kernel does the
+	 * encryption of the outgoing records.
+	 */
+
+	return !sendfile_failed && (
+		!socket_uses_tls(u->socket) || tls_kernel_offloaded(u->socket));
 #else
 	return FALSE;
 #endif /* USE_MMAP || HAS_SENDFILE */
@@ -1384,6 +1393,45 @@ upload_real_remove(void)
 }
 #endif /* UNUSED */
 
+/**
+ * Allocate the I/O buffer of the upload.
+ *
+ * The buffer is held in a data block so that zero-copy transmissions can
+ * keep it referenced until the kernel is done with the data.
+ */
+static void
+upload_buffer_alloc(struct upload *u)
+{
+	g_assert(NULL == u->buf_db);
+
+	u->buf_size = READ_BUF_SIZE;
+	u->buf_db = pdata_new(u->buf_size);
+	u->buffer = pdata_start(u->buf_db);
+}
+
+/**
+ * Release the I/O buffer of the upload.
+ */
+static void
+upload_buffer_free(struct upload *u)
+{
+	if (u->buf_db != NULL) {
+		pdata_unref(u->buf_db);
+		u->buf_db = NULL;
+	}
+	u->buffer = NULL;
+}
+
+/**
+ * Release the file being uploaded, if any.
+ */
+static void
+upload_file_release(struct upload *u)
+{
+	upload_cache_detach(&u->cache_sha1);
+	file_object_release(&u->file);
+}
+
 static void
 upload_free_resources(struct upload *u)
 {
@@ -1392,7 +1440,7 @@ upload_free_resources(struct upload *u)
 	parq_upload_upload_got_freed(u);
 
 	atom_str_free_null(&u->name);
-	file_object_release(&u->file);
+	upload_file_release(u);
 
 #ifdef HAS_MMAP
 	if (u->sendfile_ctx.map) {
@@ -1404,7 +1452,7 @@ upload_free_resources(struct upload *u)
 	}
 #endif /* HAS_MMAP */
 
-	HFREE_NULL(u->buffer);
+	upload_buffer_free(u);
 	if (u->io_opaque) {				/* I/O data */
 		io_free(u->io_opaque);
 		g_assert(u->io_opaque == NULL);
@@ -1475,6 +1523,7 @@ upload_clone(struct upload *u)
 	cu->bio = NULL;						/* Recreated on each transfer */
 	cu->sf = NULL;						/* File re-opened each time */
 	cu->file = NULL;					/* File re-opened each time */
+	cu->cache_sha1 = NULL;				/* Attached with the file */
 	cu->sendfile_ctx.map = NULL;		/* File re-opened each time */
 	cu->accounted = FALSE;
 	cu->browse_host = FALSE;
@@ -1513,6 +1562,7 @@ upload_clone(struct upload *u)
 
 	u->socket = NULL;
 	u->buffer = NULL;
+	u->buf_db = NULL;
 	u->sha1 = NULL;
 	u->guid = NULL;
 	u->thex = NULL;
@@ -2692,7 +2742,7 @@ upload_wait_new_request(struct upload *u)
 	 * File will be re-opened each time a new request is made.
 	 */
 
-	file_object_release(&u->file);	/* expect_http_header() expects this */
+	upload_file_release(u);		/* expect_http_header() expects this */
  	socket_tos_normal(u->socket);
 	expect_http_header(u, GTA_UL_EXPECTING);
 }
@@ -4836,6 +4886,16 @@ upload_request_for_shared_file(struct upload *u, const header_t *header)
 		return FALSE;
 	}
 
+	/*
+	 * Concurrent uploads of the same complete file share their disk reads
+	 * through the block cache, which needs to know how many are active.
+	 */
+
+	if (NULL == u->file_info && u->sha1 != NULL && !u->head_only) {
+		g_assert(NULL == u->cache_sha1);
+		u->cache_sha1 = upload_cache_attach(u->sha1);
+	}
+
 	if (!u->head_only)
 		parq_upload_busy(u, u->parq_ul);
 
@@ -5969,10 +6029,8 @@ upload_request(struct upload *u, header_t *header)
 		u->bpos = 0;
 		u->bsize = 0;
 
-		if (u->buffer == NULL) {
-			u->buf_size = READ_BUF_SIZE;
-			u->buffer = halloc(u->buf_size);
-		}
+		if (u->buffer == NULL)
+			upload_buffer_alloc(u);
 	}
 
 	/*
@@ -6104,10 +6162,8 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 		 * If sendfile() failed on a different connection meanwhile
 		 * u->buffer is still NULL for this connection.
 		 */
-		if (sendfile_failed && NULL == u->buffer) {
-			u->buf_size = READ_BUF_SIZE;
-			u->buffer = halloc(u->buf_size);
-		}
+		if (sendfile_failed && NULL == u->buffer)
+			upload_buffer_alloc(u);
 
 		/*
 	 	 * If the buffer position reached the size, then we need to read
@@ -6119,7 +6175,25 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 
 			g_assert(u->buffer != NULL);
 			g_assert(u->buf_size > 0);
-			ret = file_object_pread(u->file, u->buffer, u->buf_size, u->pos);
+
+			/*
+			 * If the buffer is still referenced by a zero-copy transmission
+			 * the kernel has not completed yet, we cannot overwrite it.
+			 */
+
+			if (!pdata_is_writable(u->buf_db)) {
+				upload_buffer_free(u);
+				upload_buffer_alloc(u);
+			}
+
+			/*
+			 * Complete files go through the shared block cache so that
+			 * concurrent uploads of popular files share their disk reads.
+			 * Partial files are read directly since their data can change.
+			 */
+
+			ret = upload_cache_pread(u->cache_sha1,
+					u->file_size, u->file, u->buffer, u->buf_size, u->pos);
 			if ((ssize_t) -1 == ret) {
 				upload_remove(u, N_("File read error: %s"), g_strerror(errno));
 				return;
@@ -6138,7 +6212,17 @@ upload_writable(void *obj, int unused_source, inputevt_cond_t cond)
 
 		g_assert(available > 0 && available <= INT_MAX);
 
-		written = bio_write(u->bio, &u->buffer[u->bpos], available);
+		/*
+		 * Large writes on plain connections can be transmitted by the
+		 * kernel directly from our buffer.
+		 */
+
+		if (socket_uses_tls(u->socket)) {
+			written = bio_write(u->bio, &u->buffer[u->bpos], available);
+		} else {
+			written = bio_write_zerocopy(u->bio, u->buf_db,
+				&u->buffer[u->bpos], available);
+		}
 	}
 
 	if ((ssize_t) -1 == written) {
@@ -6436,6 +6520,8 @@ upload_init(void)
 
 	stall_wd = wd_make("upload stalling",
 		IO_STALL_WATCH, upload_no_more_stalling, NULL, FALSE);
+
+	upload_cache_init();
 }
 
 /**
@@ -6466,6 +6552,7 @@ upload_close(void)
 	wd_free_null(&stall_wd);
 	pattern_free_null(&pat_http);
 	pattern_free_null(&pat_applewebkit);
+	upload_cache_close();
 }
 
 gnet_upload_info_t *
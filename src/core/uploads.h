@@ -77,6 +77,7 @@ struct upload {
 	struct special_upload *special;	/**< For special ops like browsing */
 	const char *name;
 	const struct sha1 *sha1;		/**< SHA1 of requested file */
+	const struct sha1 *cache_sha1;	/**< SHA1 attached to upload cache */
 	struct shared_file *thex;		/**< THEX owner we're uploading */
 	struct bio_source *bio;			/**< Bandwidth-limited source */
 	struct sendfile_ctx sendfile_ctx;
@@ -93,6 +94,7 @@ struct upload {
 	uint special_flags;				/**< Flags used for special uploads */
 
 	char *buffer;
+	struct pdata *buf_db;			/**< Data block holding the buffer */
 	int bpos;
 	int bsize;
 	int buf_size;
@@ -1622,6 +1622,8 @@ keys_init(void)
 	dbstore_kv_t kv = { KUID_RAW_SIZE, NULL, sizeof(struct keydata), 0 };
 	dbstore_packing_t packing =
 		{ serialize_keydata, deserialize_keydata, NULL };
+	dbstore_open_t open_db = GNET_PROPERTY(dht_storage_log) ?
+		dbstore_open_log : dbstore_open;
 
 	g_assert(NULL == keys_periodic_ev);
 	g_assert(NULL == keys);
@@ -1634,10 +1636,12 @@ keys_init(void)
 		offsetof(struct keyinfo, kuid), HASH_KEY_FIXED, KUID_RAW_SIZE);
 	install_periodic_kball(KBALL_FIRST);
 
-	db_keydata = dbstore_open(db_keywhat, settings_dht_db_dir(), db_keybase,
+	db_keydata = (*open_db)(db_keywhat, settings_dht_db_dir(), db_keybase,
 		kv, packing, KEYS_DB_CACHE_SIZE, kuid_hash, kuid_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
 
+	dbmw_set_map_mmap(db_keydata, TRUE);	/* Read-mostly database */
+
 	for (i = 0; i < N_ITEMS(decimation_factor); i++)
 		decimation_factor[i] = pow(KEYS_DECIMATION_BASE, i);
 
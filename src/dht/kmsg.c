@@ -432,6 +432,149 @@ kmsg_deserialize_contact(bstr_t *bs)
 	return knode_new(&kuid, 0, addr, port, vcode, major, minor);
 }
 
+/**
+ * Create a node from a contact decoded out of a message.
+ *
+ * This is only necessary for contacts which must outlive the message.
+ *
+ * @return new node with a reference count of 1.
+ */
+knode_t *
+kmsg_contact_to_knode(const kmsg_contact_t *c)
+{
+	g_assert(c != NULL);
+
+	return knode_new(c->id, 0, c->addr, c->port, c->vcode, c->major, c->minor);
+}
+
+/**
+ * Validate a contact held in a message.
+ *
+ * @param p		start of the contact
+ * @param end	first byte beyond the message
+ *
+ * @return pointer to the next contact, NULL if the contact is truncated
+ * or badly formed.
+ */
+static const char *
+kmsg_contact_validate(const char *p, const char *end)
+{
+	uint8 alen;
+
+	/* Vendor code (4), major (1), minor (1), KUID, then address length */
+
+	if (ptr_diff(end, p) < 6 + KUID_RAW_SIZE + 1)
+		return NULL;
+
+	p += 6 + KUID_RAW_SIZE;
+	alen = peek_u8(p++);
+
+	if (alen != 4 && alen != 16)
+		return NULL;
+
+	if (ptr_diff(end, p) < UNSIGNED(alen) + 2)	/* Address and port */
+		return NULL;
+
+	return p + alen + 2;
+}
+
+/**
+ * Parse a FIND_NODE response payload, validating all the contacts it holds
+ * without decoding nor allocating anything.
+ *
+ * The security token and the contacts can then be accessed through the
+ * view, which refers to the payload and is therefore only valid as long
+ * as the payload is.
+ *
+ * @param nv		the view to fill
+ * @param payload	start of the message payload
+ * @param len		length of the payload
+ *
+ * @return NULL if OK, the reason why the payload is invalid otherwise.
+ * When a contact is invalid, nv->left is the amount of contacts that
+ * could not be validated.
+ */
+const char *
+kmsg_nodes_parse(kmsg_nodes_t *nv, const void *payload, size_t len)
+{
+	const char *p = payload;
+	const char *end = const_ptr_add_offset(payload, len);
+	uint8 i;
+
+	g_assert(nv != NULL);
+	g_assert(payload != NULL || 0 == len);
+
+	ZERO(nv);
+
+	if (ptr_diff(end, p) < 1)
+		return "cannot read security token length";
+
+	nv->toklen = peek_u8(p++);
+	nv->token = p;
+
+	if (ptr_diff(end, p) < nv->toklen)
+		return "cannot read security token";
+
+	p += nv->toklen;
+
+	if (ptr_diff(end, p) < 1)
+		return "cannot read amount of contacts";
+
+	nv->contacts = nv->left = peek_u8(p++);
+	nv->next = p;
+
+	for (i = 0; i < nv->contacts; i++) {
+		p = kmsg_contact_validate(p, end);
+		if (NULL == p) {
+			nv->left = nv->contacts - i;
+			return "cannot parse contact";
+		}
+	}
+
+	nv->trailing = ptr_diff(end, p);
+
+	return NULL;
+}
+
+/**
+ * Decode next contact from a validated view.
+ *
+ * @param nv		the view, filled by kmsg_nodes_parse()
+ * @param c			where the decoded contact is written
+ *
+ * @return TRUE if a contact was decoded, FALSE when all were iterated over.
+ */
+bool
+kmsg_nodes_next(kmsg_nodes_t *nv, kmsg_contact_t *c)
+{
+	const char *p;
+	uint8 alen;
+
+	g_assert(nv != NULL);
+	g_assert(c != NULL);
+
+	if (0 == nv->left)
+		return FALSE;
+
+	p = nv->next;
+
+	c->vcode.u32 = peek_be32(p);
+	c->major = peek_u8(&p[4]);
+	c->minor = peek_u8(&p[5]);
+	c->id = (const kuid_t *) &p[6];
+	p += 6 + KUID_RAW_SIZE;
+
+	alen = peek_u8(p++);
+	c->addr = 4 == alen ? host_addr_peek_ipv4(p) : host_addr_peek_ipv6(p);
+	p += alen;
+	c->port = peek_be16(p);		/* Port is big-endian in Kademlia */
+
+	nv->next = p + 2;
+	nv->left--;
+
+	return TRUE;
+}
+
 /**
  * Send a pong message back to the host who sent the ping.
  */
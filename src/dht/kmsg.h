@@ -49,6 +49,33 @@
 #include "lib/pmsg.h"
 #include "lib/host_addr.h"
 
+/**
+ * A contact decoded from a message, without allocating any memory.
+ *
+ * The KUID points into the message and is therefore only valid whilst
+ * the message is being processed.
+ */
+typedef struct kmsg_contact {
+	const kuid_t *id;			/**< KUID, within the message */
+	host_addr_t addr;			/**< Address of contact */
+	vendor_code_t vcode;		/**< Vendor code */
+	uint16 port;				/**< Port of contact */
+	uint8 major;				/**< Major version */
+	uint8 minor;				/**< Minor version */
+} kmsg_contact_t;
+
+/**
+ * A validated view of a FIND_NODE response, referring to the message data.
+ */
+typedef struct kmsg_nodes {
+	const void *token;			/**< Security token, within the message */
+	const char *next;			/**< Next contact to decode */
+	size_t trailing;			/**< Amount of trailing unparsed bytes */
+	uint8 toklen;				/**< Length of security token */
+	uint8 contacts;				/**< Amount of contacts */
+	uint8 left;					/**< Amount of contacts not decoded yet */
+} kmsg_nodes_t;
+
 /*
  * Public interface.
  */
@@ -66,6 +93,10 @@ void kmsg_send_mb(knode_t *kn, pmsg_t *mb);
 
 void kmsg_serialize_contact(pmsg_t *mb, const knode_t *kn);
 knode_t *kmsg_deserialize_contact(bstr_t *bs);
+knode_t *kmsg_contact_to_knode(const kmsg_contact_t *c);
+
+const char *kmsg_nodes_parse(kmsg_nodes_t *nv, const void *payload, size_t len);
+bool kmsg_nodes_next(kmsg_nodes_t *nv, kmsg_contact_t *c);
 dht_value_t *kmsg_deserialize_dht_value(bstr_t *bs);
 
 void kmsg_init(void);
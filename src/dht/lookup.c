@@ -124,6 +124,13 @@ static double log2_frequency[KDA_K][KDA_K];
  */
 static htable_t *nlookups;
 
+/**
+ * Table of running node and value lookups that new identical lookups can
+ * follow, indexed by target KUID.  Each entry is the list of the lookups
+ * for that target, since they can be of different types.
+ */
+static htable_t *coalescing;
+
 static void lookup_iterate(nlookup_t *nl);
 static void lookup_value_free(nlookup_t *nl, bool free_vvec);
 static void lookup_value_iterate(nlookup_t *nl);
@@ -231,9 +238,13 @@ struct nlookup {
 	int bw_outgoing;			/**< Amount of outgoing bandwidth used */
 	int bw_incoming;			/**< Amount of incoming bandwidth used */
 	int udp_drops;				/**< Amount of UDP packet drops */
+	int node_replies;			/**< Amount of parsed FIND_NODE replies */
+	double node_cpu;			/**< CPU time spent parsing them */
 	tm_t start;					/**< Start time */
 	uint32 hops;				/**< Amount of hops in lookup so far */
 	uint32 flags;				/**< Operating flags */
+	nlookup_t *leader;			/**< Lookup we follow, if coalesced */
+	pslist_t *followers;		/**< Coalesced lookups sharing our results */
 	/*
 	 * XXX -- hack alert!
 	 *
@@ -269,6 +280,8 @@ struct nlookup {
 #define NL_F_PASV_PROTECT	(1U << 5)	/**< Passive protection triggered */
 #define NL_F_ACTV_PROTECT	(1U << 6)	/**< Active protection triggered */
 #define NL_F_KBALL_CHECK	(1U << 7)	/**< Checked kball probability */
+#define NL_F_FOLLOWER		(1U << 8)	/**< Follows another lookup */
+#define NL_F_COALESCING		(1U << 9)	/**< Can be followed by others */
 
 static inline void
 lookup_check(const nlookup_t *nl)
@@ -409,6 +422,150 @@ free_token(void *unused_key, void *value, void *unused_u)
 	lookup_token_free(ltok, TRUE);
 }
 
+/**
+ * Remove lookup from the table of lookups that can be followed.
+ *
+ * This is done as soon as the lookup starts delivering its results, so that
+ * new lookups launched from the callbacks start afresh.
+ */
+static void
+lookup_coalesce_remove(nlookup_t *nl)
+{
+	pslist_t *sl;
+
+	lookup_check(nl);
+
+	if (!(nl->flags & NL_F_COALESCING))
+		return;
+
+	sl = htable_lookup(coalescing, nl->kuid);
+	g_assert(sl != NULL);
+
+	/*
+	 * KUID atoms are shared, so all the lookups in the list use the
+	 * same key pointer.
+	 */
+
+	sl = pslist_remove(sl, nl);
+	if (NULL == sl)
+		htable_remove(coalescing, nl->kuid);
+	else
+		htable_insert(coalescing, nl->kuid, sl);
+
+	nl->flags &= ~NL_F_COALESCING;
+}
+
+/**
+ * Destroy a lookup following another one.
+ */
+static void
+lookup_follower_free(nlookup_t *nl)
+{
+	lookup_check(nl);
+	g_assert(nl->flags & NL_F_FOLLOWER);
+
+	if (nl->leader != NULL) {
+		lookup_check(nl->leader);
+		nl->leader->followers = pslist_remove(nl->leader->followers, nl);
+	}
+
+	kuid_atom_free_null(&nl->kuid);
+	nl->magic = 0;
+	WFREE(nl);
+}
+
+/**
+ * Record lookup as a candidate leader for identical lookups started while
+ * it is running.
+ */
+static void
+lookup_coalesce_add(nlookup_t *nl)
+{
+	pslist_t *sl;
+
+	lookup_check(nl);
+	g_assert(!(nl->flags & (NL_F_COALESCING | NL_F_FOLLOWER)));
+
+	sl = htable_lookup(coalescing, nl->kuid);
+	sl = pslist_prepend(sl, nl);
+	htable_insert(coalescing, nl->kuid, sl);
+
+	nl->flags |= NL_F_COALESCING;
+}
+
+/**
+ * Find a running lookup of the same type for the same target.
+ *
+ * @param kuid		the target KUID
+ * @param type		the lookup type
+ * @param vtype		the value type, for value lookups
+ *
+ * @return the lookup to follow, NULL if none.
+ */
+static nlookup_t *
+lookup_coalesce_find(const kuid_t *kuid,
+	lookup_type_t type, dht_value_type_t vtype)
+{
+	pslist_t *sl;
+
+	if (!GNET_PROPERTY(dht_lookup_coalesce))
+		return NULL;
+
+	PSLIST_FOREACH(htable_lookup(coalescing, kuid), sl) {
+		nlookup_t *nl = sl->data;
+
+		lookup_check(nl);
+
+		if (nl->type != type)
+			continue;
+		if (LOOKUP_VALUE == type && nl->u.fv.vtype != vtype)
+			continue;
+
+		return nl;
+	}
+
+	return NULL;
+}
+
+/**
+ * Create a lookup following an identical running one, whose results will
+ * be handed to us as well.
+ *
+ * @param leader	the running lookup
+ * @param error		callback to invoke on error
+ * @param arg		opaque callback argument
+ */
+static nlookup_t *
+lookup_follow(nlookup_t *leader, lookup_cb_err_t error, void *arg)
+{
+	nlookup_t *nl;
+
+	lookup_check(leader);
+	g_assert(leader->flags & NL_F_COALESCING);
+
+	WALLOC0(nl);
+	nl->magic = NLOOKUP_MAGIC;
+	nl->kuid = kuid_get_atom(leader->kuid);
+	nl->type = leader->type;
+	nl->lid = lookup_id_create();
+	nl->err = error;
+	nl->arg = arg;
+	nl->flags = NL_F_FOLLOWER;
+	nl->leader = leader;
+	tm_now_exact(&nl->start);
+
+	leader->followers = pslist_append(leader->followers, nl);
+	gnet_stats_inc_general(GNR_DHT_COALESCED_LOOKUPS);
+
+	if (GNET_PROPERTY(dht_lookup_debug) > 1) {
+		g_debug("DHT LOOKUP[%s] %s lookup for %s follows LOOKUP[%s]",
+			nid_to_string(&nl->lid), lookup_type_to_string(nl),
+			kuid_to_hex_string(nl->kuid), nid_to_string2(&leader->lid));
+	}
+
+	return nl;
+}
+
 /**
  * Destroy a KUID lookup.
  */
@@ -417,6 +574,21 @@ lookup_free(nlookup_t *nl)
 {
 	lookup_check(nl);
 
+	if (nl->flags & NL_F_FOLLOWER) {
+		lookup_follower_free(nl);
+		return;
+	}
+
+	lookup_coalesce_remove(nl);
+
+	while (nl->followers != NULL) {
+		nlookup_t *fl = nl->followers->data;
+
+		fl->leader = NULL;
+		nl->followers = pslist_remove(nl->followers, fl);
+		lookup_follower_free(fl);
+	}
+
 	if (lookup_is_fetching(nl))
 		lookup_value_free(nl, TRUE);
 
@@ -693,12 +865,19 @@ log_patricia_dump(nlookup_t *nl, patricia_t *pt, const char *what, uint level)
  * Log final statistics.
  */
 static void
-lookup_final_stats(const nlookup_t *nl)
+lookup_final_stats(nlookup_t *nl)
 {
 	tm_t end;					/* End time */
+	pslist_t *sl;
 
 	lookup_check(nl);
 
+	/*
+	 * Results are about to be delivered: identical lookups launched from
+	 * now on must not follow this one.
+	 */
+
+	lookup_coalesce_remove(nl);
 	tm_now_exact(&end);
 
 	if (GNET_PROPERTY(dht_lookup_debug) > 1 || GNET_PROPERTY(dht_debug) > 1)
@@ -710,6 +889,14 @@ lookup_final_stats(const nlookup_t *nl)
 			nl->bw_incoming, nl->bw_outgoing,
 			nl->rpc_replies, plural_y(nl->rpc_replies));
 
+	if (nl->node_replies != 0) {
+		g_debug("DHT LOOKUP[%s] parsed %d FIND_NODE repl%s, "
+			"%g usecs CPU per message",
+			nid_to_string(&nl->lid), nl->node_replies,
+			plural_y(nl->node_replies),
+			nl->node_cpu * 1e6 / nl->node_replies);
+	}
+
 	/*
 	 * Optional statistics callback, added via lookup_ctrl_stats() after
 	 * successful lookup creation.
@@ -727,6 +914,43 @@ lookup_final_stats(const nlookup_t *nl)
 
 		(*nl->stats)(nl->kuid, &stats, nl->arg);
 	}
+
+	/*
+	 * Followers did not generate any traffic on their own.
+	 */
+
+	PSLIST_FOREACH(nl->followers, sl) {
+		nlookup_t *fl = sl->data;
+
+		lookup_check(fl);
+
+		if (fl->stats) {
+			struct lookup_stats stats;
+
+			ZERO(&stats);
+			stats.elapsed = tm_elapsed_f(&end, &fl->start);
+
+			(*fl->stats)(fl->kuid, &stats, fl->arg);
+		}
+	}
+}
+
+/**
+ * Notify followers of lookup about an error.
+ */
+static void
+lookup_followers_error(const nlookup_t *nl, lookup_error_t error)
+{
+	pslist_t *sl;
+
+	PSLIST_FOREACH(nl->followers, sl) {
+		nlookup_t *fl = sl->data;
+
+		lookup_check(fl);
+
+		if (fl->err)
+			(*fl->err)(fl->kuid, error, fl->arg);
+	}
 }
 
 /**
@@ -749,6 +973,7 @@ lookup_abort(nlookup_t *nl, lookup_error_t error)
 	if (nl->err)
 		(*nl->err)(nl->kuid, error, nl->arg);
 
+	lookup_followers_error(nl, error);
 	lookup_free(nl);
 }
 
@@ -789,16 +1014,43 @@ lookup_terminate(nlookup_t *nl)
 	case LOOKUP_NODE:
 		{
 			size_t path_len = patricia_count(nl->path);
-			if (path_len > 0 && nl->u.fn.ok) {
-				lookup_rs_t *rs = lookup_create_results(nl);
+			lookup_error_t error = 0 == path_len ? LOOKUP_E_EMPTY_PATH :
+				path_len < UNSIGNED(nl->amount) ? LOOKUP_E_PARTIAL :
+				LOOKUP_E_OK;
+			lookup_rs_t *rs = NULL;
+			bool wanted = NULL != nl->u.fn.ok;
+			pslist_t *sl;
+
+			PSLIST_FOREACH(nl->followers, sl) {
+				const nlookup_t *fl = sl->data;
+				wanted = wanted || NULL != fl->u.fn.ok;
+			}
+
+			/*
+			 * Followers get the same results as the lookup they follow.
+			 */
+
+			if (path_len > 0 && wanted)
+				rs = lookup_create_results(nl);
+
+			if (rs != NULL && nl->u.fn.ok)
 				(*nl->u.fn.ok)(nl->kuid, rs, nl->arg);
-				lookup_result_free(rs);	/* Allow them to take a reference */
-			} else if (nl->err) {
-				(*nl->err)(nl->kuid,
-					0 == path_len ? LOOKUP_E_EMPTY_PATH :
-					path_len < UNSIGNED(nl->amount) ? LOOKUP_E_PARTIAL :
-					LOOKUP_E_OK, nl->arg);
+			else if (nl->err)
+				(*nl->err)(nl->kuid, error, nl->arg);
+
+			PSLIST_FOREACH(nl->followers, sl) {
+				nlookup_t *fl = sl->data;
+
+				lookup_check(fl);
+
+				if (rs != NULL && fl->u.fn.ok)
+					(*fl->u.fn.ok)(fl->kuid, rs, fl->arg);
+				else if (fl->err)
+					(*fl->err)(fl->kuid, error, fl->arg);
 			}
+
+			if (rs != NULL)
+				lookup_result_free(rs);	/* Allow them to take a reference */
 		}
 		break;
 	case LOOKUP_REFRESH:		/* Handled through lookup_abort() above */
@@ -880,10 +1132,10 @@ lookup_value_terminate(nlookup_t *nl,
 {
 	lookup_val_rs_t *rs;
 	size_t count;
+	pslist_t *sl;
 
 	lookup_check(nl);
 	g_assert(LOOKUP_VALUE == nl->type);
-	g_assert(nl->u.fv.ok);
 	g_assert(NULL == nl->u.fv.fv);
 
 	if (GNET_PROPERTY(dht_lookup_debug) > 2)
@@ -964,7 +1216,20 @@ lookup_value_terminate(nlookup_t *nl,
 
 	rs = lookup_create_value_results(load, vvec, vcnt);
 
-	(*nl->u.fv.ok)(nl->kuid, rs, nl->arg);
+	/*
+	 * The callback is cleared when the lookup was cancelled whilst being
+	 * followed by other lookups.
+	 */
+
+	if (nl->u.fv.ok)
+		(*nl->u.fv.ok)(nl->kuid, rs, nl->arg);
+
+	PSLIST_FOREACH(nl->followers, sl) {
+		nlookup_t *fl = sl->data;
+
+		lookup_check(fl);
+		(*fl->u.fv.ok)(fl->kuid, rs, fl->arg);
+	}
 
 	lookup_free_value_results(rs);
 
@@ -2958,13 +3223,13 @@ lookup_handle_reply(
 	nlookup_t *nl, const knode_t *kn,
 	const char *payload, size_t len, uint32 hop)
 {
-	bstr_t *bs;
+	kmsg_nodes_t nv;
+	kmsg_contact_t c;
 	sectoken_remote_t *token = NULL;
 	const char *reason;
 	char msg[256];
 	char unsafe[80];
 	int n = 0;
-	uint8 contacts;
 	size_t unsafe_len;
 
 	lookup_check(nl);
@@ -2981,69 +3246,72 @@ lookup_handle_reply(
 		 	hop, knode_to_string(kn));
 	}
 
-	bs = bstr_open(payload, len, GNET_PROPERTY(dht_debug) ? BSTR_F_ERROR : 0);
-
 	/*
-	 * Decompile first field: security token.
+	 * Validate the whole message first: contacts are then decoded straight
+	 * from the payload, and we only create nodes for the contacts we may
+	 * have to keep.
 	 */
 
-	if (LOOKUP_REFRESH == nl->type) {
-		uint8 tlen;
-
-		/*
-		 * Token is not required when doing a refresh lookup since we are
-		 * not going to store anything in the DHT.  Just skip over it.
-		 */
+	reason = kmsg_nodes_parse(&nv, payload, len);
 
-		if (!bstr_read_u8(bs, &tlen))
-			goto bad_token;
-		if (!bstr_skip(bs, tlen))
-			goto bad_token;
-	} else {
-		uint8 tlen;
-
-		/*
-		 * The security token of all the items in the lookup path is
-		 * remembered in case we need to issue a STORE request in one of
-		 * the nodes.
-		 */
-
-		if (!bstr_read_u8(bs, &tlen))
-			goto bad_token;
-
-		token = sectoken_remote_alloc(tlen);
-
-		if (tlen > 0 && !bstr_read(bs, token->v, tlen))
-			goto bad_token;
+	if (reason != NULL) {
+		if (nv.left != 0 && GNET_PROPERTY(dht_debug)) {
+			str_bprintf(ARYLEN(msg), "%s #%d",
+				reason, nv.contacts - nv.left + 1);
+			reason = msg;
+		}
+		goto bad;
 	}
 
 	/*
-	 * Decompile DHT contacts.
+	 * The security token of all the items in the lookup path is remembered
+	 * in case we need to issue a STORE request in one of the nodes.
+	 *
+	 * Token is not required when doing a refresh lookup since we are
+	 * not going to store anything in the DHT.
 	 */
 
-	if (!bstr_read_u8(bs, &contacts)) {
-		reason = "cannot read amount of contacts";
-		goto bad;
+	if (LOOKUP_REFRESH != nl->type) {
+		token = sectoken_remote_alloc(nv.toklen);
+		if (nv.toklen > 0)
+			memcpy(token->v, nv.token, nv.toklen);
 	}
 
-	while (contacts--) {
-		knode_t *cn = kmsg_deserialize_contact(bs);
+	/*
+	 * Process DHT contacts.
+	 */
+
+	while (kmsg_nodes_next(&nv, &c)) {
+		knode_t *cn;
 		knode_t *xn;
 
 		n++;
 		msg[0] = '\0';
 
-		if (NULL == cn) {
-			if (GNET_PROPERTY(dht_lookup_debug))
-				str_bprintf(ARYLEN(msg), "cannot parse contact #%d", n);
-			reason = msg;
-			goto bad;
+		/*
+		 * Skip contact if it bears our KUID, or if it is already part of
+		 * our lookup path: there is no need to create a node for these.
+		 */
+
+		if (kuid_eq(get_our_kuid(), c.id)) {
+			if (GNET_PROPERTY(dht_lookup_debug)) {
+				str_bprintf(ARYLEN(msg), "%s bears our KUID",
+					host_addr_port_to_string(c.addr, c.port));
+			}
+			goto ignore;
+		}
+
+		if (patricia_contains(nl->path, c.id)) {
+			if (GNET_PROPERTY(dht_lookup_debug)) {
+				str_bprintf(ARYLEN(msg), "%s is already in our path",
+					kuid_to_hex_string(c.id));
+			}
+			goto ignore;
 		}
 
 		/*
 		 * Got a valid contact, but skip it if we already queried it or if
 		 * it is already part of our (unqueried as of yet) shortlist.
-		 * Also skip it if it bears our KUID!
 		 *
 		 * NB: We mostly don't care if we are skipping contacts due to KUID
 		 * collisions (especially already queried nodes) because there is
@@ -3052,12 +3320,7 @@ lookup_handle_reply(
 		 * get a message from them).
 		 */
 
-		if (kuid_eq(get_our_kuid(), cn->id)) {
-			if (GNET_PROPERTY(dht_lookup_debug)) {
-				str_bprintf(ARYLEN(msg), "%s bears our KUID", knode_to_string(cn));
-			}
-			goto skip;
-		}
+		cn = kmsg_contact_to_knode(&c);
 
 		/*
 		 * Protect against Sybil attacks. no need to keep a contact that
@@ -3259,6 +3522,12 @@ lookup_handle_reply(
 				n, msg);
 
 		knode_free(cn);
+		continue;
+
+	ignore:
+		if (GNET_PROPERTY(dht_lookup_debug) > 4)
+			g_debug("DHT LOOKUP[%s] ignoring contact #%d: %s",
+				nid_to_string(&nl->lid), n, msg);
 	}
 
 	/*
@@ -3267,8 +3536,8 @@ lookup_handle_reply(
 	 * advertised amount of contacts was wrong.
 	 */
 
-	if (bstr_unread_size(bs) && GNET_PROPERTY(dht_lookup_debug)) {
-		size_t unparsed = bstr_unread_size(bs);
+	if (nv.trailing != 0 && GNET_PROPERTY(dht_lookup_debug)) {
+		size_t unparsed = nv.trailing;
 		g_warning("DHT LOOKUP[%s] the FIND_NODE_RESPONSE payload (%lu byte%s) "
 			"from %s has %lu byte%s of unparsed trailing data (ignored)",
 			 nid_to_string(&nl->lid),
@@ -3352,13 +3621,8 @@ lookup_handle_reply(
 done:
 	if (token != NULL)
 		sectoken_remote_free(token, TRUE);
-	bstr_free(&bs);
 	return TRUE;
 
-bad_token:
-	reason = "cannot decompile security token";
-	/* FALL THROUGH */
-
 bad:
 	/*
 	 * The message was badly formed.
@@ -3366,13 +3630,9 @@ bad:
 
 	if (GNET_PROPERTY(dht_debug))
 		g_warning("DHT improper FIND_NODE_RESPONSE payload (%zu byte%s) "
-			"from %s: %s: %s",
-			 len, plural(len), knode_to_string(kn),
-			 reason, bstr_error(bs));
+			"from %s: %s",
+			 len, plural(len), knode_to_string(kn), reason);
 
-	if (token != NULL)
-		sectoken_remote_free(token, TRUE);
-	bstr_free(&bs);
 	return FALSE;
 }
 
@@ -3663,8 +3923,23 @@ lk_handle_reply(void *obj, const knode_t *kn,
 
 	g_assert(KDA_MSG_FIND_NODE_RESPONSE == function);
 
-	if (!lookup_handle_reply(nl, kn, payload, len, hop))
+	/*
+	 * Measure CPU time spent processing the reply when debugging, since
+	 * we only report it in the final statistics.
+	 */
+
+	if (GNET_PROPERTY(dht_lookup_debug) > 1) {
+		double start = tm_cputime(NULL, NULL);
+		bool ok = lookup_handle_reply(nl, kn, payload, len, hop);
+
+		nl->node_cpu += tm_cputime(NULL, NULL) - start;
+		nl->node_replies++;
+
+		if (!ok)
+			return TRUE;	/* Iterate */
+	} else if (!lookup_handle_reply(nl, kn, payload, len, hop)) {
 		return TRUE;	/* Iterate */
+	}
 
 	/*
 	 * If we are in a loose parallelism mode and the amount of items in
@@ -4299,6 +4574,25 @@ lookup_cancel(nlookup_t *nl, bool callback)
 	if (callback && nl->err)
 		(*nl->err)(nl->kuid, LOOKUP_E_CANCELLED, nl->arg);
 
+	/*
+	 * When other lookups follow this one, keep running on their behalf
+	 * but forget about our own caller.
+	 */
+
+	if (nl->followers != NULL && !(nl->flags & NL_F_DONT_REMOVE)) {
+		nl->err = NULL;
+		nl->stats = NULL;
+		nl->arg = NULL;
+		if (LOOKUP_VALUE == nl->type)
+			nl->u.fv.ok = NULL;
+		else
+			nl->u.fn.ok = NULL;
+		return;
+	}
+
+	if (callback)
+		lookup_followers_error(nl, LOOKUP_E_CANCELLED);
+
 	lookup_free(nl);
 }
 
@@ -4335,6 +4629,13 @@ lookup_find_node(
 
 	g_assert(kuid);
 
+	nl = lookup_coalesce_find(kuid, LOOKUP_NODE, DHT_VT_ANY);
+	if (nl != NULL) {
+		nl = lookup_follow(nl, error, arg);
+		nl->u.fn.ok = ok;
+		return nl;
+	}
+
 	nl = lookup_create(kuid, LOOKUP_NODE, error, arg);
 	nl->amount = KDA_K;
 	nl->u.fn.ok = ok;
@@ -4345,6 +4646,7 @@ lookup_find_node(
 		return NULL;
 	}
 
+	lookup_coalesce_add(nl);
 	lookup_async_iterate(nl);
 	return nl;
 }
@@ -4368,6 +4670,13 @@ lookup_store_nodes(
 
 	g_assert(kuid);
 
+	nl = lookup_coalesce_find(kuid, LOOKUP_STORE, DHT_VT_ANY);
+	if (nl != NULL) {
+		nl = lookup_follow(nl, error, arg);
+		nl->u.fn.ok = ok;
+		return nl;
+	}
+
 	nl = lookup_create(kuid, LOOKUP_STORE, error, arg);
 	nl->amount = KDA_K;
 	nl->u.fn.ok = ok;
@@ -4378,6 +4687,7 @@ lookup_store_nodes(
 		return NULL;
 	}
 
+	lookup_coalesce_add(nl);
 	lookup_async_iterate(nl);
 	return nl;
 }
@@ -4510,6 +4820,14 @@ lookup_find_value(
 	g_assert(kuid);
 	g_assert(ok);		/* Pointless to request a value without this */
 
+	nl = lookup_coalesce_find(kuid, LOOKUP_VALUE, type);
+	if (nl != NULL) {
+		nl = lookup_follow(nl, error, arg);
+		nl->u.fv.ok = ok;
+		nl->u.fv.vtype = type;
+		return nl;
+	}
+
 	nl = lookup_create(kuid, LOOKUP_VALUE, error, arg);
 	nl->amount = KDA_K;
 	nl->u.fv.ok = ok;
@@ -4521,6 +4839,8 @@ lookup_find_value(
 		return NULL;
 	}
 
+	lookup_coalesce_add(nl);
+
 	/*
 	 * We need to check whether our node already holds the key they
 	 * are looking for.  However, we cannot synchronously call the callbacks.
@@ -5053,6 +5373,7 @@ lookup_init(void)
 	size_t i;
 
 	nlookups = htable_create_any(nid_hash, nid_hash2, nid_equal);
+	coalescing = htable_create_any(kuid_hash, NULL, kuid_eq);
 
 	/*
 	 * Build lower triangular matrix of all possible log2(frequency).
@@ -5124,6 +5445,7 @@ lookup_close(bool exiting)
 {
 	htable_foreach(nlookups, free_lookup, &exiting);
 	htable_free_null(&nlookups);
+	htable_free_null(&coalescing);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
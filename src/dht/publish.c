@@ -169,6 +169,7 @@
 #define PB_MAX_MSG_RETRY	3		/* Max # of timeouts per message */
 #define PB_MAX_TIMEOUTS		7		/* Max # of timeouts per publish */
 #define PB_MAX_FULL			3		/* Terminate after so many "key full" */
+#define PB_VALUE_PARALLELISM	KDA_ALPHA	/* Concurrent STORE to roots */
 
 #define PB_OFFLOAD_MAX_LIFETIME		600000	/* 10 minutes, in ms */
 #define PB_VALUE_MAX_LIFETIME		240000	/* 4 minutes, in ms */
@@ -241,7 +242,7 @@ struct publish {
 			uint16 *status;		/**< STORE status codes */
 			publish_cb_t cb;	/**< Completion callback */
 			void *arg;			/**< Additional callback argument */
-			size_t idx;			/**< Current node index we're publishing to */
+			size_t idx;			/**< Next node index we're publishing to */
 			unsigned full;		/**< Nodes that reported key being full */
 		} v;
 	} target;					/**< STORE targets */
@@ -557,24 +558,36 @@ publish_terminate(publish_t *pb, publish_error_t code)
 			}
 		}
 
-		/*
-		 * For initial STORE requests, we need to flag all the nodes in the
-		 * path which we did not consider, so that subsequent background
-		 * attempts, if any, do not try to STORE in these nodes which were
-		 * outside the set of k-closest neighbours at the time of the initial
-		 * publish.
-		 */
-
-		if (!(pb->flags & PB_F_BACKGROUND)) {
+		{
 			size_t max = pb->target.v.rs->path_len;
 			size_t i;
 
-			for (i = pb->target.v.idx; i < max; i++) {
-				/* Sets non-retryable status code */
-				pb->target.v.status[i] = STORE_SC_OUT_OF_RANGE;
+			/*
+			 * Roots still being contacted when we stop are considered
+			 * as having timed out.
+			 */
+
+			for (i = 0; i < max; i++) {
+				if (STORE_SC_PENDING == pb->target.v.status[i])
+					pb->target.v.status[i] = STORE_SC_TIMEOUT;
 			}
 
-			publish_roots_update(pb);	/* Remove timeouting nodes */
+			/*
+			 * For initial STORE requests, we need to flag all the nodes in
+			 * the path which we did not consider, so that subsequent
+			 * background attempts, if any, do not try to STORE in these nodes
+			 * which were outside the set of k-closest neighbours at the time
+			 * of the initial publish.
+			 */
+
+			if (!(pb->flags & PB_F_BACKGROUND)) {
+				for (i = pb->target.v.idx; i < max; i++) {
+					/* Sets non-retryable status code */
+					pb->target.v.status[i] = STORE_SC_OUT_OF_RANGE;
+				}
+
+				publish_roots_update(pb);	/* Remove timeouting nodes */
+			}
 		}
 		break;
 	case PUBLISH_OFFLOAD:
@@ -1307,16 +1320,29 @@ pb_msg_dropped(void *obj, knode_t *unused_kn, pmsg_t *mb)
 }
 
 static void
-pb_rpc_cancelled(void *obj, uint32 unused_udata)
+pb_rpc_cancelled(void *obj, uint32 udata)
 {
 	publish_t *pb = obj;
 
 	publish_check(pb);
-	(void) unused_udata;
 
 	pb->rpc_pending--;
 
-	g_assert(0 == pb->rpc_pending);
+	g_assert(PUBLISH_VALUE == pb->type || 0 == pb->rpc_pending);
+
+	/*
+	 * For value publishing, the udata is the index of the root in the path.
+	 * Since the STORE was not sent, make sure we come back to that root.
+	 */
+
+	if (PUBLISH_VALUE == pb->type) {
+		size_t idx = udata;
+
+		g_assert(idx < pb->target.v.rs->path_len);
+
+		pb->target.v.status[idx] = 0;
+		pb->target.v.idx = MIN(pb->target.v.idx, idx);
+	}
 
 	/*
 	 * If we're sending synchronously when the RPC is cancelled, it means
@@ -1340,10 +1366,12 @@ pb_rpc_cancelled(void *obj, uint32 unused_udata)
 		/*
 		 * Either it's a cache publishing with less that the max amount of
 		 * UDP drops, or it's a value publishing, where we want to try until
-		 * we fully publish or we expire.
+		 * we fully publish or we expire.  Value publishing can have several
+		 * STORE requests pending, so iteration may already be delayed.
 		 */
 
-		publish_delay(pb);	/* Delay iteration to let UDP queue flush */
+		if (!(pb->flags & PB_F_DELAYED))
+			publish_delay(pb);	/* Delay iteration to let UDP queue flush */
 	}
 }
 
@@ -1476,12 +1504,11 @@ iterate:
 
 static void
 pb_value_handling_rpc(void *obj, enum dht_rpc_ret type,
-	const knode_t *kn, uint32 unused_udata)
+	const knode_t *kn, uint32 udata)
 {
 	publish_t *pb = obj;
 
 	publish_check(pb);
-	(void) unused_udata;
 
 	g_assert(PUBLISH_VALUE == pb->type);
 	g_assert(pb->rpc_pending > 0);
@@ -1491,15 +1518,7 @@ pb_value_handling_rpc(void *obj, enum dht_rpc_ret type,
 
 	pb->rpc_pending--;
 
-	/*
-	 * Timeout or not, we move to the next node.
-	 *
-	 * We do not simply increment pb->target.v.idx because we want to skip
-	 * any node already flagged as having been stored to (in a previous
-	 * publish run).
-	 */
-
-	pb->target.v.idx = publish_value_next_unstored(pb, pb->target.v.idx + 1);
+	g_assert(udata < pb->target.v.rs->path_len);
 
 	/*
 	 * On timeout, we invalidate the token cache for the node because
@@ -1519,29 +1538,30 @@ pb_value_handle_reply(void *obj, const knode_t *kn,
 	kda_msg_t function, const char *payload, size_t len, uint32 udata)
 {
 	publish_t *pb = obj;
-	uint32 hop = udata;
+	size_t idx = udata;
 	uint16 code;
 	bool can_iterate = TRUE;
 
 	publish_check(pb);
 	g_assert(PUBLISH_VALUE == pb->type);
+	g_assert(idx < pb->target.v.rs->path_len);
 
 	pb->bw_incoming += len + KDA_HEADER_SIZE;	/* The hell with header ext */
 
 	/*
-	 * If reply comes for an earlier hop, it means we timed-out the RPC before
-	 * the reply could come back.
+	 * If the root is no longer flagged as pending, it means we timed-out
+	 * the RPC before the reply could come back.
 	 *
 	 * We're not going to iterate if we get a late reply, but still we
 	 * want to process the message to see whether the value was published
 	 * or not.
 	 */
 
-	if (pb->hops != hop) {
+	if (pb->target.v.status[idx] != STORE_SC_PENDING) {
 		if (GNET_PROPERTY(dht_publish_debug)) {
 			g_debug("DHT PUBLISH[%s] at hop %u, "
-				"got late STORE RPC reply from hop %u by %s",
-				nid_to_string(&pb->pid), pb->hops, hop,
+				"got late STORE RPC reply for root #%zu by %s",
+				nid_to_string(&pb->pid), pb->hops, idx + 1,
 				knode_to_string(kn));
 		}
 		can_iterate = FALSE;	/* Do not iterate */
@@ -1555,7 +1575,7 @@ pb_value_handle_reply(void *obj, const knode_t *kn,
 	if (function != KDA_MSG_STORE_RESPONSE) {
 		if (GNET_PROPERTY(dht_publish_debug)) {
 			g_warning("DHT PUBLISH[%s] hop %u got unexpected %s reply from %s",
-				nid_to_string(&pb->pid), hop, kmsg_name(function),
+				nid_to_string(&pb->pid), pb->hops, kmsg_name(function),
 				knode_to_string(kn));
 		}
 		pb->rpc_bad++;
@@ -1570,7 +1590,7 @@ pb_value_handle_reply(void *obj, const knode_t *kn,
 	if (kn->flags & (KNODE_F_FIREWALLED | KNODE_F_SHUTDOWNING)) {
 		if (GNET_PROPERTY(dht_publish_debug)) {
 			g_warning("DHT PUBLISH[%s] hop %u got %s from to-be-ignored %s%s%s",
-				nid_to_string(&pb->pid), hop, kmsg_name(function),
+				nid_to_string(&pb->pid), pb->hops, kmsg_name(function),
 				(kn->flags & KNODE_F_FIREWALLED) ? "firewalled " : "",
 				(kn->flags & KNODE_F_SHUTDOWNING) ? "shutdowning " : "",
 				knode_to_string(kn));
@@ -1632,7 +1652,7 @@ pb_iterate(void *obj, enum dht_rpc_ret unused_type, uint32 unused_data)
 	(void) unused_type;
 	(void) unused_data;
 
-	g_assert(0 == pb->rpc_pending);
+	g_assert(PUBLISH_VALUE == pb->type || 0 == pb->rpc_pending);
 
 	publish_iterate(pb);
 }
@@ -1655,7 +1675,7 @@ static struct revent_ops publish_cache_ops = {
 
 static struct revent_ops publish_value_ops = {
 	"PUBLISH",				/* name */
-	"at hop ",				/* udata is the iteration count */
+	"to root #",			/* udata is the root index in the path */
 	GNET_PROPERTY_PTR(dht_publish_debug),	/* debug */
 	publish_is_alive,						/* is_alive */
 	/* message free routine callbacks (shared by cache and value publishes) */
@@ -1879,11 +1899,12 @@ publish_offload_iterate(publish_t *pb)
  * Send specified message to target.
  */
 static void
-publish_value_send(publish_t *pb, knode_t *kn, pmsg_t *mb)
+publish_value_send(publish_t *pb, size_t idx, knode_t *kn, pmsg_t *mb)
 {
 	publish_check(pb);
 	knode_check(kn);
 	g_assert(PUBLISH_VALUE == pb->type);
+	g_assert(STORE_SC_PENDING == pb->target.v.status[idx]);
 
 	/*
 	 * In order to detect synchronous UDP drops, we set the PB_F_SENDING
@@ -1900,88 +1921,127 @@ publish_value_send(publish_t *pb, knode_t *kn, pmsg_t *mb)
 		g_debug("DHT PUBLISH[%s] hop %u sending STORE (%d bytes) "
 			"to node #%u/%u: %s",
 			nid_to_string(&pb->pid), pb->hops, pmsg_size(mb),
-			(unsigned) pb->target.v.idx + 1,
+			(unsigned) idx + 1,
 			(unsigned) pb->target.v.rs->path_len,
 			knode_to_string(kn));
 	}
 
-	revent_store(kn, mb, pb->pid, &publish_value_ops, pb->hops);
+	revent_store(kn, mb, pb->pid, &publish_value_ops, idx);
 
 	pb->flags &= ~PB_F_SENDING;
 }
 
 /**
  * Main iteration control for value publishing.
+ *
+ * Up to PB_VALUE_PARALLELISM STORE requests are kept in flight to the
+ * successive roots, without ever having more pending requests than the
+ * amount of replies we still need to get.
  */
 static void
 publish_value_iterate(publish_t *pb)
 {
-	pmsg_t *mb;
-	pslist_t *sl;
-	lookup_rc_t *rc;
-
 	publish_check(pb);
 	g_assert(PUBLISH_VALUE == pb->type);
 
-	/*
-	 * If we have no more messages to send, we're done.
-	 *
-	 * NB: it is possible to have pb->cnt == 0 when a background publishing
-	 * is requested but none of the previous STORE status indicated that
-	 * we could re-attempt a new STORE request.
-	 */
+	for (;;) {
+		pmsg_t *mb;
+		pslist_t *sl;
+		lookup_rc_t *rc;
+		size_t idx;
 
-	if (
-		pb->target.v.idx >= pb->target.v.rs->path_len ||	/* No more nodes */
-		pb->rpc_replies >= pb->cnt					/* Reached count target */
-	) {
-		publish_terminate(pb,
-			(pb->rpc_replies || 0 == pb->cnt) ? PUBLISH_E_OK : PUBLISH_E_NONE);
-		return;
-	}
+		/*
+		 * If we have no more messages to send, we're done.
+		 *
+		 * NB: it is possible to have pb->cnt == 0 when a background publishing
+		 * is requested but none of the previous STORE status indicated that
+		 * we could re-attempt a new STORE request.
+		 */
 
-	/*
-	 * Build message to send to next node.
-	 */
+		if (
+			pb->rpc_replies >= pb->cnt ||			/* Reached count target */
+			(
+				pb->target.v.idx >= pb->target.v.rs->path_len &&
+				0 == pb->rpc_pending				/* No more nodes */
+			)
+		) {
+			publish_terminate(pb,
+				(pb->rpc_replies || 0 == pb->cnt) ?
+					PUBLISH_E_OK : PUBLISH_E_NONE);
+			return;
+		}
 
-	g_assert(size_is_non_negative(pb->target.v.idx));
-	g_assert(pb->target.v.idx < pb->target.v.rs->path_len);
+		/*
+		 * Wait for pending replies if we cannot issue a new request.
+		 */
 
-	rc = &pb->target.v.rs->path[pb->target.v.idx];
+		if (
+			pb->target.v.idx >= pb->target.v.rs->path_len ||
+			pb->rpc_pending >= PB_VALUE_PARALLELISM ||
+			pb->rpc_replies + pb->rpc_pending >= pb->cnt
+		)
+			return;
 
-	if (GNET_PROPERTY(dht_publish_debug) > 4) {
-		char buf[80];
-		bin_to_hex_buf(rc->token, rc->token_len, ARYLEN(buf));
-		g_debug("DHT PUBLISH[%s] at root %u/%u, "
-			"using %u-byte token \"%s\" for %s",
-			nid_to_string(&pb->pid),
-			(unsigned) pb->target.v.idx + 1,
-			(unsigned) pb->target.v.rs->path_len,
-			rc->token_len, buf, knode_to_string(rc->kn));
-	}
+		/*
+		 * Build message to send to next node.
+		 */
 
-	sl = kmsg_build_store(rc->token, rc->token_len, &pb->target.v.value, 1);
+		idx = pb->target.v.idx;
 
-	g_assert(sl != NULL);
-	g_assert(pslist_length(sl) == 1);
+		g_assert(size_is_non_negative(idx));
+		g_assert(idx < pb->target.v.rs->path_len);
 
-	mb = sl->data;
-	pslist_free(sl);
+		rc = &pb->target.v.rs->path[idx];
 
-	/*
-	 * Send message to node.
-	 */
+		if (GNET_PROPERTY(dht_publish_debug) > 4) {
+			char buf[80];
+			bin_to_hex_buf(rc->token, rc->token_len, ARYLEN(buf));
+			g_debug("DHT PUBLISH[%s] at root %u/%u, "
+				"using %u-byte token \"%s\" for %s",
+				nid_to_string(&pb->pid),
+				(unsigned) idx + 1,
+				(unsigned) pb->target.v.rs->path_len,
+				rc->token_len, buf, knode_to_string(rc->kn));
+		}
 
-	pb->flags &= ~PB_F_UDP_DROP;		/* To detect synchronous drops */
-	publish_value_send(pb, rc->kn, mb);
-	pmsg_free(mb);
+		sl = kmsg_build_store(rc->token, rc->token_len,
+				&pb->target.v.value, 1);
 
-	/*
-	 * If we got hit by synchronous dropping, delay further iteration.
-	 */
+		g_assert(sl != NULL);
+		g_assert(pslist_length(sl) == 1);
 
-	if (pb->flags & PB_F_UDP_DROP)
-		publish_delay(pb);
+		mb = sl->data;
+		pslist_free(sl);
+
+		/*
+		 * Move to the next node before sending, since a synchronous drop
+		 * will bring us back to this one.
+		 *
+		 * We do not simply increment pb->target.v.idx because we want to
+		 * skip any node already flagged as having been stored to (in a
+		 * previous publish run).
+		 */
+
+		pb->target.v.status[idx] = STORE_SC_PENDING;
+		pb->target.v.idx = publish_value_next_unstored(pb, idx + 1);
+
+		/*
+		 * Send message to node.
+		 */
+
+		pb->flags &= ~PB_F_UDP_DROP;		/* To detect synchronous drops */
+		publish_value_send(pb, idx, rc->kn, mb);
+		pmsg_free(mb);
+
+		/*
+		 * If we got hit by synchronous dropping, delay further iteration.
+		 */
+
+		if (pb->flags & PB_F_UDP_DROP) {
+			publish_delay(pb);
+			return;
+		}
+	}
 }
 
 /**
@@ -1997,6 +2057,14 @@ publish_iterate(publish_t *pb)
 		return;
 	}
 
+	/*
+	 * When several STORE requests are pending, a reply can come whilst
+	 * we are delayed: the delay expiration will resume iterating.
+	 */
+
+	if (pb->flags & PB_F_DELAYED)
+		return;
+
 	/*
 	 * If a delay was requested, schedule us back in the future.
 	 */
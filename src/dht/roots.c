@@ -1121,6 +1121,8 @@ roots_init(void)
 		{ serialize_rootdata, deserialize_rootdata, NULL };
 	dbstore_packing_t contact_packing =
 		{ serialize_contact, deserialize_contact, free_contact };
+	dbstore_open_t open_db = GNET_PROPERTY(dht_storage_log) ?
+		dbstore_open_log : dbstore_open;
 
 	g_assert(NULL == roots_cq);
 	g_assert(NULL == roots);
@@ -1130,12 +1132,12 @@ roots_init(void)
 	roots_cq = cq_main_submake("roots", ROOTS_CALLOUT);
 	roots = patricia_create(KUID_RAW_BITSIZE);
 
-	db_rootdata = dbstore_open(db_rootdata_what, settings_dht_db_dir(),
+	db_rootdata = (*open_db)(db_rootdata_what, settings_dht_db_dir(),
 		db_rootdata_base, root_kv, root_packing,
 		ROOTKEYS_DB_CACHE_SIZE, kuid_hash, kuid_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
 
-	db_contact = dbstore_open(db_contact_what, settings_dht_db_dir(),
+	db_contact = (*open_db)(db_contact_what, settings_dht_db_dir(),
 		db_contact_base, contact_kv, contact_packing,
 		CONTACT_DB_CACHE_SIZE, uint64_mem_hash, uint64_mem_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
@@ -107,6 +107,7 @@
 #include "lib/tokenizer.h"
 #include "lib/vendors.h"
 #include "lib/walloc.h"
+#include "lib/xclosest.h"
 
 #include "lib/override.h"		/* Must be the last header included */
 
@@ -264,6 +265,7 @@ static enum dht_bootsteps old_boot_status = DHT_BOOT_NONE;
 static struct kbucket *root = NULL;	/**< The root of the routing table tree. */
 static kuid_t *our_kuid;			/**< Our own KUID (atom) */
 static struct kstats stats;			/**< Statistics on the routing table */
+static xclosest_t *good_nodes;		/**< Flat snapshot of all good nodes */
 
 static const char dht_route_file[] = "dht_nodes";
 static const char dht_route_what[] = "the DHT routing table";
@@ -679,9 +681,16 @@ list_maxsize_for(knode_status_t status)
 
 /**
  * Update statistics for status change.
+ *
+ * Good nodes entering or leaving the routing table are also recorded in
+ * the flat snapshot used to quickly find the closest alive nodes.
+ *
+ * @param kn		the node whose status changes
+ * @param status	the status being entered (delta > 0) or left (delta < 0)
+ * @param delta		+1 or -1
  */
 static inline void
-list_update_stats(knode_status_t status, int delta)
+list_update_stats(const knode_t *kn, knode_status_t status, int delta)
 {
 	switch (status) {
 	case KNODE_GOOD:
@@ -689,6 +698,10 @@ list_update_stats(knode_status_t status, int delta)
 		gnet_stats_count_general(GNR_DHT_ROUTING_GOOD_NODES, delta);
 		if (delta)
 			stats.dirty = TRUE;
+		if (delta > 0)
+			xclosest_add(good_nodes, kn->id->v, kn);
+		else if (delta < 0)
+			xclosest_remove(good_nodes, kn);
 		break;
 	case KNODE_STALE:
 		stats.stale += delta;
@@ -857,7 +870,7 @@ forget_node(knode_t *kn)
 	g_assert(kn->status != KNODE_UNKNOWN);
 	g_assert(kn->refcnt > 0);
 
-	list_update_stats(kn->status, -1);		/* Node leaving routing table */
+	list_update_stats(kn, kn->status, -1);		/* Node leaving routing table */
 	kn->flags &= ~KNODE_F_ALIVE;
 	kn->status = KNODE_UNKNOWN;
 	knode_free(kn);
@@ -879,7 +892,7 @@ forget_merged_node(knode_t *kn)
 	g_assert(kn->status != KNODE_UNKNOWN);
 	g_assert(kn->refcnt > 0);
 
-	list_update_stats(kn->status, -1);		/* Node leaving routing table */
+	list_update_stats(kn, kn->status, -1);		/* Node leaving routing table */
 	kn->flags &= ~KNODE_F_ALIVE;
 
 	/*
@@ -1605,6 +1618,7 @@ dht_initialize(bool post_init)
 	stats.lookdata = statx_make_nodata();
 	stats.netdata = statx_make_nodata();
 	c_class = acct_net_create();
+	good_nodes = xclosest_make(KUID_RAW_BITSIZE);
 
 	g_assert(0 == stats.good);
 
@@ -2103,7 +2117,7 @@ add_node(struct kbucket *kb, knode_t *kn, knode_status_t status)
 
 	kn->status = status;
 	add_node_internal(kb, kn, status, TRUE);
-	list_update_stats(status, +1);
+	list_update_stats(kn, status, +1);
 }
 
 /**
@@ -2285,7 +2299,7 @@ promote_pending_node(struct kbucket *kb)
 				knode_still_alive_probability(selected) * 100.0);
 
 		hash_list_remove(kb->nodes->pending, selected);
-		list_update_stats(KNODE_PENDING, -1);
+		list_update_stats(selected, KNODE_PENDING, -1);
 
 		/*
 		 * If there's only one reference to this node, attempt to move
@@ -2303,7 +2317,7 @@ promote_pending_node(struct kbucket *kb)
 
 		selected->status = KNODE_GOOD;
 		hash_list_insert_sorted(kb->nodes->good, selected, knode_seen_cmp);
-		list_update_stats(KNODE_GOOD, +1);
+		list_update_stats(selected, KNODE_GOOD, +1);
 
 		/*
 		 * If we haven't heard about the selected pending node for a while,
@@ -2546,7 +2560,7 @@ dht_set_node_status(knode_t *kn, knode_status_t new)
 	hl = list_for(kb, old);
 	if (!hash_list_remove(hl, tkn))
 		g_error("node %s not in its routing table list", knode_to_string(tkn));
-	list_update_stats(old, -1);
+	list_update_stats(tkn, old, -1);
 
 	tkn->status = new;
 	hl = list_for(kb, new);
@@ -2578,8 +2592,8 @@ dht_set_node_status(knode_t *kn, knode_status_t new)
 
 			removed->status = KNODE_PENDING;
 			hash_list_append(kb->nodes->pending, removed);
-			list_update_stats(new, -1);
-			list_update_stats(KNODE_PENDING, +1);
+			list_update_stats(removed, new, -1);
+			list_update_stats(removed, KNODE_PENDING, +1);
 
 			if (GNET_PROPERTY(dht_debug))
 				g_debug("DHT switched %s node %s at %s to pending in %s",
@@ -2609,7 +2623,7 @@ dht_set_node_status(knode_t *kn, knode_status_t new)
 
 	tkn = move_node(kb, tkn);
 	hash_list_append(hl, tkn);
-	list_update_stats(new, +1);
+	list_update_stats(tkn, new, +1);
 
 	/*
 	 * If moving a node out of the good list, move the node at the tail of
@@ -4611,6 +4625,25 @@ recursively_fill_closest_from(
 	return added;
 }
 
+/**
+ * Snapshot selection filter: keep alive nodes, other than the excluded one.
+ *
+ * @param value		the candidate good node
+ * @param data		the KUID to exclude (NULL if no exclusion)
+ */
+static bool
+fill_closest_alive(const void *value, void *data)
+{
+	const knode_t *kn = value;
+	const kuid_t *exclude = data;
+
+	knode_check(kn);
+	g_assert(KNODE_GOOD == kn->status);
+
+	return (kn->flags & KNODE_F_ALIVE) &&
+		(NULL == exclude || !kuid_eq(kn->id, exclude));
+}
+
 /**
  * Fill the supplied vector `kvec' whose size is `kcnt' with the knodes
  * that are the closest neighbours in the Kademlia space from a given KUID.
@@ -4637,6 +4670,24 @@ dht_fill_closest(
 	g_assert(kcnt > 0);
 	g_assert(kvec);
 
+	/*
+	 * When we only want alive nodes, which is the case when answering
+	 * FIND_NODE and FIND_VALUE requests, select them from the flat snapshot
+	 * of good nodes, which avoids walking the routing table and sorting
+	 * the nodes of each bucket we visit.
+	 *
+	 * If there are not enough alive good nodes, fall back to the bucket
+	 * walk, which can complete the answer with recently seen pending nodes.
+	 */
+
+	if (alive) {
+		added = xclosest_select(good_nodes, id->v, (void **) kvec, kcnt,
+			fill_closest_alive, deconstify_pointer(exclude));
+
+		if (added == kcnt)
+			goto done;
+	}
+
 	/*
 	 * Start by filling from hosts in the k-bucket of the ID.
 	 */
@@ -4670,6 +4721,7 @@ dht_fill_closest(
 		g_assert(kcnt >= 0);
 	}
 
+done:
 	if (GNET_PROPERTY(dht_debug) > 15) {
 		g_debug("DHT found %d/%d %s nodes (excluding %s) closest to %s",
 			added, wanted, alive ? "alive" : "known",
@@ -4931,6 +4983,7 @@ dht_close(bool exiting)
 
 	recursively_apply(root, dht_free_bucket, NULL);
 	root = NULL;
+	xclosest_free_null(&good_nodes);
 	kuid_atom_free_null(&our_kuid);
 
 	for (i = 0; i < K_REGIONS; i++) {
@@ -49,8 +49,9 @@
 #include "lib/atoms.h"
 #include "lib/cq.h"
 #include "lib/gnet_host.h"
-#include "lib/hikset.h"
 #include "lib/host_addr.h"
+#include "lib/pslist.h"
+#include "lib/rpctab.h"
 #include "lib/stacktrace.h"		/* For stacktrace_function_name() */
 #include "lib/stringify.h"
 #include "lib/tm.h"
@@ -61,6 +62,7 @@
 
 #define DHT_RPC_RECENT_KEEP	(5*60)	/* 5 minutes */
 #define DHT_RPC_LINGER_MS	15000 	/* ms, 15 seconds */
+#define DHT_RPC_PERIOD_MS	250		/* ms, timeout granularity */
 
 enum rpc_cb_magic { RPC_CB_MAGIC = 0x74c8b10U };
 
@@ -78,7 +80,6 @@ struct rpc_cb {
 	uint32 flags;				/**< Control flags */
 	dht_rpc_cb_t cb;			/**< Callback routine to invoke */
 	void *arg;					/**< Additional opaque argument */
-	cevent_t *timeout;			/**< Callout queue timeout event */
 	unsigned lingering:1;		/**< RPC was cancelled / timed out */
 };
 
@@ -90,7 +91,15 @@ rpc_cb_check(const struct rpc_cb * const rcb)
 	g_assert(NULL != rcb->muid);
 }
 
-static hikset_t *pending;		/**< Pending RPC (GUID -> rpc_cb) */
+/**
+ * Pending RPCs, indexed by MUID.
+ *
+ * Replies can come from another address than the one to which we sent
+ * the RPC, hence entries are keyed with a zero address.
+ */
+static rpctab_t *pending;
+
+static void rpc_expired(void *value, void *unused_data);
 
 /**
  * Table recording the mappings between a KUID and an IP:port, as validated
@@ -262,40 +271,38 @@ dht_rpc_init(void)
 {
 	g_assert(NULL == pending);
 
-	pending = hikset_create(
-		offsetof(struct rpc_cb, muid), HASH_KEY_FIXED, GUID_RAW_SIZE);
+	pending = rpctab_make(DHT_RPC_PERIOD_MS, rpc_expired, NULL);
 
 	rpc_recent = aging_make(DHT_RPC_RECENT_KEEP,
 		kuid_hash, kuid_eq, rpc_free_kuid_addr);
 }
 
 /**
- * Free the callback waiting indication.
+ * Destroy the callback waiting indication, once out of the pending table.
  */
 static void
-rpc_cb_free(struct rpc_cb *rcb, bool in_shutdown)
+rpc_cb_destroy(struct rpc_cb *rcb)
 {
 	rpc_cb_check(rcb);
 
-	if (in_shutdown) {
-		/* Lingering RPCs have already invoked their callback */
-		if (!rcb->lingering) {
-			knode_rpc_dec(rcb->kn);
-			if (rcb->cb != NULL) {
-				(*rcb->cb)(DHT_RPC_TIMEOUT,
-					rcb->kn, NULL, 0, NULL, 0, rcb->arg);
-			}
-		}
-	} else {
-		hikset_remove(pending, rcb->muid);
-	}
 	atom_guid_free_null(&rcb->muid);
 	knode_free(rcb->kn);
-	cq_cancel(&rcb->timeout);
 	rcb->magic = 0;
 	WFREE(rcb);
 }
 
+/**
+ * Free the callback waiting indication.
+ */
+static void
+rpc_cb_free(struct rpc_cb *rcb)
+{
+	rpc_cb_check(rcb);
+
+	rpctab_remove(pending, rcb->muid, zero_host_addr);
+	rpc_cb_destroy(rcb);
+}
+
 /**
  * Compute a suitable timeout for the RPC call, in milliseconds, based
  * on the average RTT we have measured in the past for that node and the
@@ -332,25 +339,6 @@ rpc_delay(const knode_t *kn)
 	return MIN(timeout, DHT_RPC_MAXDELAY);
 }
 
-/**
- * End of RPC lingering time (callout queue callback).
- */
-static void
-rpc_lingered(cqueue_t *cq, void *obj)
-{
-	struct rpc_cb *rcb = obj;
-
-	rpc_cb_check(rcb);
-
-	if (GNET_PROPERTY(dht_rpc_debug) > 5) {
-		g_debug("DHT RPC %s #%s finished lingering",
-			op_to_string(rcb->op), guid_to_string(rcb->muid));
-	}
-
-	cq_zero(cq, &rcb->timeout);
-	rpc_cb_free(rcb, FALSE);
-}
-
 /**
  * Signal an RPC operation timeout by invoking callback, if any.
  */
@@ -359,6 +347,22 @@ rpc_timeout(struct rpc_cb *rcb)
 {
 	dht_node_timed_out(rcb->kn);
 
+	/*
+	 * Linger for a while to see how many "late" replies we get.
+	 *
+	 * The RPC is no longer in the pending table when it expired or when
+	 * we got a reply from the wrong node, so put it back.
+	 */
+
+	if (
+		!rpctab_reschedule(pending, rcb->muid, zero_host_addr,
+			DHT_RPC_LINGER_MS) &&
+		!rpctab_insert(pending, rcb->muid, zero_host_addr, rcb,
+			DHT_RPC_LINGER_MS)
+	) {
+		g_assert_not_reached();		/* MUIDs are unique */
+	}
+
 	/*
 	 * Invoke user callback, if any configured, to signify operation timed out.
 	 * The amount of pending RPCs is decreased before invoking the callback.
@@ -380,32 +384,53 @@ rpc_timeout(struct rpc_cb *rcb)
 		}
 	}
 
-	/*
-	 * Linger for a while to see how many "late" replies we get.
-	 */
-
-	g_assert(NULL == rcb->timeout);
-
-	rcb->timeout = cq_main_insert(DHT_RPC_LINGER_MS, rpc_lingered, rcb);
 	rcb->lingering = TRUE;
 }
 
 /**
- * Generic RPC operation timeout (callout queue callback).
+ * Pending RPC expiration callback, invoked when the RPC timed out or when
+ * it has finished lingering.
+ *
+ * The RPC has already been removed from the pending table.
  */
 static void
-rpc_timed_out(cqueue_t *cq, void *obj)
+rpc_expired(void *value, void *unused_data)
 {
-	struct rpc_cb *rcb = obj;
+	struct rpc_cb *rcb = value;
 
 	rpc_cb_check(rcb);
+	(void) unused_data;
 
-	gnet_stats_inc_general(GNR_DHT_RPC_TIMED_OUT);
-	cq_zero(cq, &rcb->timeout);
+	if (rcb->lingering) {
+		if (GNET_PROPERTY(dht_rpc_debug) > 5) {
+			g_debug("DHT RPC %s #%s finished lingering",
+				op_to_string(rcb->op), guid_to_string(rcb->muid));
+		}
+		rpc_cb_destroy(rcb);
+		return;
+	}
 
+	gnet_stats_inc_general(GNR_DHT_RPC_TIMED_OUT);
 	rpc_timeout(rcb);
 }
 
+/**
+ * Allocate a MUID not used by any pending RPC.
+ *
+ * @return a new unique MUID atom.
+ */
+static const guid_t *
+rpc_unique_muid(void)
+{
+	guid_t muid;
+
+	do {
+		guid_random_muid(&muid);
+	} while (rpctab_contains(pending, &muid, zero_host_addr));
+
+	return atom_guid_get(&muid);
+}
+
 /**
  * Generic RPC call preparation:
  *
@@ -440,16 +465,17 @@ rpc_call_prepare(
 	rcb->op = op;
 	rcb->kn = knode_refcnt_inc(kn);
 	rcb->flags = flags;
-	rcb->muid = guid_unique_atom(pending, TRUE);
+	rcb->muid = rpc_unique_muid();
 	rcb->addr = kn->addr;
 	rcb->port = kn->port;
-	rcb->timeout = cq_main_insert(delay, rpc_timed_out, rcb);
 	rcb->cb = cb;
 	rcb->arg = arg;
 	tm_now_exact(&rcb->start);	/* To measure RTT when we get the reply */
 	knode_rpc_inc(kn);
 
-	hikset_insert_key(pending, &rcb->muid);
+	if (!rpctab_insert(pending, rcb->muid, zero_host_addr, rcb, delay))
+		g_assert_not_reached();		/* MUID is unique */
+
 	gnet_stats_inc_general(GNR_DHT_RPC_MSG_PREPARED);
 
 	if (GNET_PROPERTY(dht_rpc_debug) > 4) {
@@ -472,14 +498,14 @@ dht_rpc_timeout(const guid_t *muid)
 {
 	struct rpc_cb *rcb;
 
-	rcb = hikset_lookup(pending, muid);
+	rcb = rpctab_lookup(pending, muid, zero_host_addr);
 	if (NULL == rcb)
 		return FALSE;
 
 	rpc_cb_check(rcb);
 
 	if (rcb->lingering) {
-		cq_expire(rcb->timeout);
+		rpc_cb_free(rcb);	/* Stop lingering */
 		return FALSE;		/* Already timed out since we're lingering */
 	}
 
@@ -490,7 +516,6 @@ dht_rpc_timeout(const guid_t *muid)
 	}
 
 	gnet_stats_inc_general(GNR_DHT_RPC_MSG_CANCELLED);
-	cq_cancel(&rcb->timeout);
 	rpc_timeout(rcb);
 
 	return TRUE;
@@ -509,14 +534,14 @@ dht_rpc_cancel(const guid_t *muid)
 {
 	struct rpc_cb *rcb;
 
-	rcb = hikset_lookup(pending, muid);
+	rcb = rpctab_lookup(pending, muid, zero_host_addr);
 	if (NULL == rcb)
 		return FALSE;
 
 	rpc_cb_check(rcb);
 
 	if (rcb->lingering) {
-		cq_expire(rcb->timeout);
+		rpc_cb_free(rcb);	/* Stop lingering */
 		return FALSE;		/* Already timed out since we're lingering */
 	}
 
@@ -529,7 +554,7 @@ dht_rpc_cancel(const guid_t *muid)
 
 	gnet_stats_inc_general(GNR_DHT_RPC_MSG_CANCELLED);
 	knode_rpc_dec(rcb->kn);
-	rpc_cb_free(rcb, FALSE);
+	rpc_cb_free(rcb);
 	return TRUE;
 }
 
@@ -544,14 +569,14 @@ dht_rpc_cancel_if_no_callback(const guid_t *muid)
 {
 	struct rpc_cb *rcb;
 
-	rcb = hikset_lookup(pending, muid);
+	rcb = rpctab_lookup(pending, muid, zero_host_addr);
 	if (NULL == rcb)
 		return FALSE;
 
 	rpc_cb_check(rcb);
 
 	if (rcb->lingering) {
-		cq_expire(rcb->timeout);
+		rpc_cb_free(rcb);	/* Stop lingering */
 		return FALSE;		/* Already timed out since we're lingering */
 	}
 
@@ -563,7 +588,7 @@ dht_rpc_cancel_if_no_callback(const guid_t *muid)
 		}
 
 		knode_rpc_dec(rcb->kn);
-		rpc_cb_free(rcb, FALSE);
+		rpc_cb_free(rcb);
 		return TRUE;
 	}
 
@@ -582,7 +607,7 @@ dht_rpc_info(const guid_t *muid, host_addr_t *addr, uint16 *port)
 	struct rpc_cb *rcb;
 	knode_t *rn;
 
-	rcb = hikset_lookup(pending, muid);
+	rcb = rpctab_lookup(pending, muid, zero_host_addr);
 	if (NULL == rcb)
 		return FALSE;
 
@@ -637,10 +662,19 @@ dht_rpc_answer(const guid_t *muid,
 	struct rpc_cb *rcb;
 	tm_t now;
 	knode_t *rn;		/* Node to which we sent the RPC */
+	int remaining = 0;
 
 	knode_check(kn);
 
-	rcb = hikset_lookup(pending, muid);
+	if (GNET_PROPERTY(dht_rpc_debug) > 2)
+		remaining = rpctab_remaining(pending, muid, zero_host_addr);
+
+	/*
+	 * Removing the RPC from the pending table makes us the owner of the
+	 * descriptor: it can no longer expire whilst we process the reply.
+	 */
+
+	rcb = rpctab_remove(pending, muid, zero_host_addr);
 	if (NULL == rcb)
 		return FALSE;
 
@@ -650,8 +684,7 @@ dht_rpc_answer(const guid_t *muid,
 		g_debug("DHT RPC got %sanswer to %s #%s sent to %s, timeout in %s ms",
 			rcb->lingering ? "late " : "",
 			op_to_string(rcb->op), guid_to_string(rcb->muid),
-			knode_to_string(rcb->kn),
-			cq_time_to_string(cq_remaining(rcb->timeout)));
+			knode_to_string(rcb->kn), cq_time_to_string(remaining));
 	}
 
 	/*
@@ -680,12 +713,10 @@ dht_rpc_answer(const guid_t *muid,
 			kn->rtt += (tm_elapsed_ms(&now, &rcb->start) >> 1) - (kn->rtt >> 1);
 		}
 
-		cq_expire(rcb->timeout);		/* Will free up `rcb' */
+		rpc_cb_destroy(rcb);		/* Stop lingering */
 		return FALSE;
 	}
 
-	cq_cancel(&rcb->timeout);	/* This is an RPC timeout, not a lingering */
-
 	/*
 	 * The node that was registered during the creation of the RPC was
 	 * ref-counted and must be the one given back to client callbacks.
@@ -735,7 +766,6 @@ dht_rpc_answer(const guid_t *muid,
 
 		stable_replace(rn, kn);			/* KUID of rn was changed */
 		dht_remove_node(rn);			/* Remove obsolete entry from routing */
-		cq_cancel(&rcb->timeout);
 		rpc_timeout(rcb);				/* Invoke user callback if any */
 
 		return FALSE;	/* RPC was sent to wrong node, ignore */
@@ -823,7 +853,7 @@ dht_rpc_answer(const guid_t *muid,
 		(*rcb->cb)(DHT_RPC_REPLY, rn, n, function, payload, len, rcb->arg);
 	}
 
-	rpc_cb_free(rcb, FALSE);		/* Got a reply, no need to linger */
+	rpc_cb_destroy(rcb);			/* Got a reply, no need to linger */
 	return TRUE;
 }
 
@@ -981,20 +1011,17 @@ dht_rpc_store(knode_t *kn, pmsg_t *mb,
 }
 
 /**
- * Free the RPC callback descriptor held in the hash table at shutdown time.
+ * Collect the MUIDs of pending RPCs at shutdown time.
  */
 static void
-rpc_free_kv(void *val, void *unused_x)
+rpc_collect_muid(void *val, void *data)
 {
-	(void) unused_x;
+	struct rpc_cb *rcb = val;
+	pslist_t **muids = data;
 
-	/*
-	 * Do NOT remove item from the hash (we're iterating over it).
-	 * However, do invoke the timeout callback if any, so that they may
-	 * clean up the resources they kept around to handle the RPC reply.
-	 */
+	rpc_cb_check(rcb);
 
-	rpc_cb_free(val, TRUE);
+	*muids = pslist_prepend_const(*muids, atom_guid_get(rcb->muid));
 }
 
 /**
@@ -1003,8 +1030,41 @@ rpc_free_kv(void *val, void *unused_x)
 void
 dht_rpc_close(void)
 {
-	hikset_foreach(pending, rpc_free_kv, NULL);
-	hikset_free_null(&pending);
+	pslist_t *muids = NULL, *sl;
+
+	/*
+	 * We cannot invoke callbacks whilst iterating over the pending table,
+	 * since it is locked, and they could cancel other RPCs.  Hence collect
+	 * all the MUIDs first, then free each RPC still present.
+	 */
+
+	rpctab_foreach(pending, rpc_collect_muid, &muids);
+
+	PSLIST_FOREACH(muids, sl) {
+		const guid_t *muid = sl->data;
+		struct rpc_cb *rcb = rpctab_remove(pending, muid, zero_host_addr);
+
+		/*
+		 * Invoke the timeout callback if any, so that they may clean up
+		 * the resources they kept around to handle the RPC reply.
+		 * Lingering RPCs have already invoked their callback.
+		 */
+
+		if (rcb != NULL) {
+			if (!rcb->lingering) {
+				knode_rpc_dec(rcb->kn);
+				if (rcb->cb != NULL) {
+					(*rcb->cb)(DHT_RPC_TIMEOUT,
+						rcb->kn, NULL, 0, NULL, 0, rcb->arg);
+				}
+			}
+			rpc_cb_destroy(rcb);
+		}
+		atom_guid_free(muid);
+	}
+
+	pslist_free_null(&muids);
+	rpctab_free_null(&pending);
 	aging_destroy(&rpc_recent);
 }
 
@@ -127,6 +127,7 @@
 
 #define VALUES_DB_CACHE_SIZE 1024	/**< Amount of values to keep cached */
 #define RAW_DB_CACHE_SIZE	 512	/**< Amount of raw data to keep cached */
+#define RAW_DB_PAGE_SIZE	8192	/**< SDBM page size for raw data */
 
 /**
  * Information about a value that is stored to disk and not kept in memory.
@@ -2093,11 +2094,14 @@ values_init(void)
 {
 	dbstore_kv_t value_kv =
 		{ sizeof(uint64), NULL, sizeof(struct valuedata), 0 };
-	dbstore_kv_t raw_kv		= { sizeof(uint64), NULL, DHT_VALUE_MAX_LEN, 0 };
+	dbstore_kv_t raw_kv		=
+		{ sizeof(uint64), NULL, DHT_VALUE_MAX_LEN, 0, RAW_DB_PAGE_SIZE };
 	dbstore_kv_t expired_kv	= { 2 * KUID_RAW_SIZE, NULL, 0, 0 };
 	dbstore_packing_t value_packing =
 		{ serialize_valuedata, deserialize_valuedata, NULL };
 	dbstore_packing_t no_packing = { NULL, NULL, NULL };
+	dbstore_open_t open_db = GNET_PROPERTY(dht_storage_log) ?
+		dbstore_open_log : dbstore_open;
 
 	g_assert(NULL == db_valuedata);
 	g_assert(NULL == db_rawdata);
@@ -2107,12 +2111,12 @@ values_init(void)
 	g_assert(NULL == expired);
 	g_assert(NULL == values_expire_ev);
 
-	db_valuedata = dbstore_open(db_valwhat, settings_dht_db_dir(),
+	db_valuedata = (*open_db)(db_valwhat, settings_dht_db_dir(),
 		db_valbase, value_kv, value_packing, VALUES_DB_CACHE_SIZE,
 		uint64_mem_hash, uint64_mem_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
 
-	db_rawdata = dbstore_open(db_rawwhat, settings_dht_db_dir(), db_rawbase,
+	db_rawdata = (*open_db)(db_rawwhat, settings_dht_db_dir(), db_rawbase,
 		raw_kv, no_packing, RAW_DB_CACHE_SIZE, uint64_mem_hash, uint64_mem_eq,
 		GNET_PROPERTY(dht_storage_in_memory));
 
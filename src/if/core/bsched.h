@@ -25,6 +25,7 @@
 #define _if_core_bsched_h_
 
 #include "if/core/wrap.h"	/* For wrap_io_t */
+#include "lib/elist.h"		/* For link_t */
 #include "lib/inputevt.h"	/* For inputevt_handler_t */
 
 typedef struct bsched bsched_t;
@@ -69,6 +70,12 @@ typedef struct bio_source {
 	int64 bw_last_bps;				/**< B/w used last period (bps) */
 	int64 bw_fast_ema;				/**< Fast EMA of actual bandwidth used */
 	int64  bw_slow_ema;				/**< Slow EMA of actual bandwidth used */
+	uint32 timeslice;				/**< Scheduler timeslice of bw_actual */
+	uint32 active_gen;				/**< Scheduler generation when active */
+	link_t lk;						/**< Link in scheduler sources */
+	link_t evlk;					/**< Link in idle or listening sources */
+	struct bio_zerocopy *zc;		/**< Zero-copy transmission state */
+	struct bsched_peer *peer;		/**< Peer traffic class, NULL if none */
 } bio_source_t;
 
 /*
@@ -77,10 +84,11 @@ typedef struct bio_source {
 
 #define BIO_F_READ			(1 << 0)	/**< Reading source */
 #define BIO_F_WRITE			(1 << 1)	/**< Writing source */
-#define BIO_F_ACTIVE		(1 << 2)	/**< Source active since b/w scheduled */
-#define BIO_F_USED			(1 << 3)	/**< Source used this period */
+#define BIO_F_IDLE			(1 << 2)	/**< Callback idle, not listening */
+#define BIO_F_USED			(1 << 3)	/**< Source used during its timeslice */
 #define BIO_F_FAVOUR		(1 << 4)	/**< Try to favour source this period */
 #define BIO_F_PASSIVE		(1 << 5)	/**< Don't insert source for events */
+#define BIO_F_LISTENING		(1 << 6)	/**< Callback listening for events */
 
 #define BIO_F_RW			(BIO_F_READ|BIO_F_WRITE)
 
@@ -94,8 +102,8 @@ typedef struct bio_source {
  */
 #define BS_BW_MAX		(INT64_CONST(1) << 42)
 
-#define bio_bps(b)		((b)->bw_last_bps)
-#define bio_avg_bps(b)	((b)->bw_slow_ema >> BIO_EMA_SHIFT)
+int64 bio_bps(bio_source_t *bio);
+int64 bio_avg_bps(bio_source_t *bio);
 
 #endif /* _if_core_bsched_h_ */
 
@@ -25,6 +25,8 @@
 #ifndef _if_core_downloads_h_
 #define _if_core_downloads_h_
 
+#include "lib/bit_array.h"
+#include "lib/erbtree.h"
 #include "lib/event.h"			/* For frequency_t */
 #include "lib/hashlist.h"
 #include "lib/htable.h"
@@ -105,6 +107,10 @@ struct dl_server {
 	unsigned latency;		/**< HTTP latency, in ms (EMA) */
 	uint32 attrs;
 	uint16 country;			/**< Country of origin -- encoded ISO3166 */
+	uint8 failures;			/**< Consecutive failures, for scheduling */
+	unsigned sched_due:1;	/**< Due for a retry, in the score tree */
+	uint64 sched_score;		/**< Scheduling score, when due for a retry */
+	rbnode_t sched_node;	/**< Embedded scheduling tree node */
 };
 
 static inline bool
@@ -199,6 +205,7 @@ struct dl_pipeline {
 	struct dl_chunk chunk;			/**< Requested chunk */
 	pmsg_t *req;					/**< Partially sent HTTP request */
 	pmsg_t *extra;					/**< Extra data received */
+	struct dl_pipeline *next;		/**< Next pipelined request, sent later */
 };
 
 static inline void
@@ -236,7 +243,7 @@ struct download {
 	struct dl_chunk chunk;		/**< Requested chunk */
 	filesize_t pos;				/**< Current file data writing position */
 
-	struct dl_pipeline *pipeline;	/**< If non-NULL: pipelined HTTP request */
+	struct dl_pipeline *pipeline;	/**< If non-NULL: pipelined HTTP requests */
 
 	struct gnutella_socket *socket;
 	struct file_object *out_file;	/**< downloaded file */
@@ -255,6 +262,8 @@ struct download {
 	uint32 retries;
 	uint32 timeout_delay;
 	uint32 served_reqs;			/**< Amount of served requests on connection */
+	uint32 pipelined_reqs;		/**< Served requests that were pipelined */
+	uint32 pipelined_ahead;		/**< Sum of requests pipelined at each reply */
 	uint32 mismatches;			/**< Amount of resuming data mismatches */
 	uint32 header_read_eof;		/**< EOF errors with empty headers */
 	uint32 data_timeouts;		/**< # of timeouts after getting headers */
@@ -268,6 +277,7 @@ struct download {
 
 	http_rangeset_t *ranges;	/**< PFSP -- known set of ranges, or NULL */
 	filesize_t ranges_size;		/**< PFSP -- size of remotely available data */
+	bit_array_t *avail;			/**< PFSP -- slices counted as offered */
 	filesize_t sinkleft;		/**< Amount of data left to sink */
 
 	uint32 flags;
@@ -279,6 +289,7 @@ struct download {
 	unsigned got_giv:1;			/**< Whether initiated from GIV reception */
 	unsigned unavailable:1;		/**< Set on Timout, Push route lost */
 	unsigned tls_upgraded:1;	/**< Was successfully upgraded to TLS */
+	unsigned avail_whole:1;		/**< Counted as offering the whole file */
 
 	struct cproxy *cproxy;		/**< Push proxy being used currently */
 	struct parq_dl_queued *parq_dl;	/**< Queuing status */
@@ -370,6 +381,21 @@ enum {
 #define download_buffered(d)	((d)->buffers == NULL ? 0 : (d)->buffers->held)
 #define download_pipelining(d)	((d)->pipeline != NULL)
 
+/**
+ * @return the amount of pipelined HTTP requests of the download.
+ */
+static inline uint
+download_pipeline_depth(const struct download *d)
+{
+	const struct dl_pipeline *dp;
+	uint n = 0;
+
+	for (dp = d->pipeline; dp != NULL; dp = dp->next)
+		n++;
+
+	return n;
+}
+
 /*
  * Set of http_range_t objects, telling us about the available ranges
  * on the remote size, in case the file is partial.
@@ -26,7 +26,7 @@
 
 #include "common.h"
 
-#include "lib/eslist.h"
+#include "lib/chunkset.h"
 #include "lib/http_range.h"
 #include "lib/path.h"
 #include "lib/pslist.h"
@@ -171,8 +171,12 @@ typedef struct dl_file_info {
 	filesize_t done;		/**< Total number of bytes completed (flushed) */
 	filesize_t buffered;	/**< Amount of buffered data (unflushed) */
 	filesize_t uploaded;	/**< Amount of bytes uploaded */
-	eslist_t chunklist;		/**< List of ranges within file */
-	eslist_t available;		/**< List of ranges available, with source count */
+	chunkset_t chunks;		/**< Ranges within file, indexed by offset */
+	uint32 *avail;			/**< Partial sources offering each slice */
+	size_t avail_slices;	/**< Amount of slices in `avail' */
+	uint32 avail_whole;		/**< Sources offering the whole file */
+	uint32 avail_partial;	/**< Partial sources counted in `avail' */
+	uint8 avail_shift;		/**< Slices are 2^avail_shift bytes long */
 	http_rangeset_t *seen_on_network;  /**< Ranges available on network */
 	uint32 generation;		/**< Generation number, incremented on disk update */
 	struct shared_file *sf;	/**< When PFSP-server is enabled, share this file */
@@ -108,6 +108,7 @@ typedef enum {
 #define STORE_SC_EXPIRED		14U	/**< Value has already expired */
 #define STORE_SC_DB_IO			15U	/**< Database I/O error */
 
+#define STORE_SC_PENDING		65532U	/**< Internal: STORE in progress */
 #define STORE_SC_OUT_OF_RANGE	65533U	/**< Internal: out of k-closest set */
 #define STORE_SC_FIREWALLED		65534U	/**< Internal: node is firewalled */
 #define STORE_SC_TIMEOUT		65535U	/**< Internal: STORE timed-out */
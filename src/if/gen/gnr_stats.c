@@ -1,5 +1,5 @@
 /*
- * Generated on Wed Aug  8 14:55:47 2018 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 00:47:25 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -312,6 +312,13 @@ static const char *stats_symbols[] = {
 	"parq_queue_sending_attempts",
 	"parq_queue_sent",
 	"parq_queue_follow_ups",
+	"upload_cache_hits",
+	"upload_cache_misses",
+	"upload_cache_evictions",
+	"upload_cache_blocks",
+	"zerocopy_bytes",
+	"zerocopy_copied_bytes",
+	"zerocopy_pinned_buffers",
 	"sha1_verifications",
 	"tth_verifications",
 	"qhit_seeding_of_orphan",
@@ -420,6 +427,7 @@ static const char *stats_symbols[] = {
 	"dht_sha1_data_type_collisions",
 	"dht_passively_protected_lookup_path",
 	"dht_actively_protected_lookup_path",
+	"dht_coalesced_lookups",
 	"dht_alt_loc_lookups",
 	"dht_push_proxy_lookups",
 	"dht_successful_alt_loc_lookups",
@@ -747,6 +755,13 @@ static const char *stats_text[] = {
 	N_("PARQ QUEUE sending attempts"),
 	N_("PARQ QUEUE messages sent"),
 	N_("PARQ QUEUE follow-up requests received"),
+	N_("Upload block cache hits"),
+	N_("Upload block cache misses"),
+	N_("Upload block cache evictions"),
+	N_("Upload block cache blocks held"),
+	N_("Bytes sent without copy (MSG_ZEROCOPY)"),
+	N_("Bytes sent with MSG_ZEROCOPY but copied by kernel"),
+	N_("Buffers pinned until zero-copy transmission"),
 	N_("Launched SHA-1 file verifications"),
 	N_("Launched TTH file verifications"),
 	N_("Re-seeding of orphan downloads through query hits"),
@@ -855,6 +870,7 @@ static const char *stats_text[] = {
 	N_("DHT SHA1 data type collisions"),
 	N_("DHT lookup path passively protected against attack"),
 	N_("DHT lookup path actively protected against attack"),
+	N_("DHT lookups coalesced with an identical running lookup"),
 	N_("DHT alt-loc lookups issued"),
 	N_("DHT push-proxy lookups issued"),
 	N_("DHT successful alt-loc lookups"),
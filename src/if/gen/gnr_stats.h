@@ -1,5 +1,5 @@
 /*
- * Generated on Wed Aug  8 14:55:47 2018 by enum-msg.pl -- DO NOT EDIT
+ * Generated on Mon Oct 19 00:47:25 2026 by enum-msg.pl -- DO NOT EDIT
  *
  * Command: ../../../scripts/enum-msg.pl stats.lst
  */
@@ -8,7 +8,7 @@
 #define _if_gen_gnr_stats_h_
 
 /*
- * Enum count: 414
+ * Enum count: 422
  */
 typedef enum {
 	GNR_ROUTING_ERRORS = 0,
@@ -308,6 +308,13 @@ typedef enum {
 	GNR_PARQ_QUEUE_SENDING_ATTEMPTS,
 	GNR_PARQ_QUEUE_SENT,
 	GNR_PARQ_QUEUE_FOLLOW_UPS,
+	GNR_UPLOAD_CACHE_HITS,
+	GNR_UPLOAD_CACHE_MISSES,
+	GNR_UPLOAD_CACHE_EVICTIONS,
+	GNR_UPLOAD_CACHE_BLOCKS,
+	GNR_ZEROCOPY_BYTES,
+	GNR_ZEROCOPY_COPIED_BYTES,
+	GNR_ZEROCOPY_PINNED_BUFFERS,
 	GNR_SHA1_VERIFICATIONS,
 	GNR_TTH_VERIFICATIONS,
 	GNR_QHIT_SEEDING_OF_ORPHAN,
@@ -416,6 +423,7 @@ typedef enum {
 	GNR_DHT_SHA1_DATA_TYPE_COLLISIONS,
 	GNR_DHT_PASSIVELY_PROTECTED_LOOKUP_PATH,
 	GNR_DHT_ACTIVELY_PROTECTED_LOOKUP_PATH,
+	GNR_DHT_COALESCED_LOOKUPS,
 	GNR_DHT_ALT_LOC_LOOKUPS,
 	GNR_DHT_PUSH_PROXY_LOOKUPS,
 	GNR_DHT_SUCCESSFUL_ALT_LOC_LOOKUPS,
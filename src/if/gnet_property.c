@@ -1132,6 +1132,22 @@ gboolean gnet_property_variable_lock_sleep_trace     = FALSE;
 static const gboolean gnet_property_variable_lock_sleep_trace_default = FALSE;
 gboolean gnet_property_variable_running_topless     = FALSE;
 static const gboolean gnet_property_variable_running_topless_default = FALSE;
+guint32  gnet_property_variable_dl_pipeline_chunk_factor     = 4;
+static const guint32  gnet_property_variable_dl_pipeline_chunk_factor_default = 4;
+guint32  gnet_property_variable_upload_cache_size     = 8192;
+static const guint32  gnet_property_variable_upload_cache_size_default = 8192;
+gboolean gnet_property_variable_tls_kernel_offload     = TRUE;
+static const gboolean gnet_property_variable_tls_kernel_offload_default = TRUE;
+guint32  gnet_property_variable_zerocopy_min_size     = 16384;
+static const guint32  gnet_property_variable_zerocopy_min_size_default = 16384;
+gboolean gnet_property_variable_bsched_htb     = TRUE;
+static const gboolean gnet_property_variable_bsched_htb_default = TRUE;
+gboolean gnet_property_variable_dht_storage_log     = FALSE;
+static const gboolean gnet_property_variable_dht_storage_log_default = FALSE;
+gboolean gnet_property_variable_dht_lookup_coalesce     = TRUE;
+static const gboolean gnet_property_variable_dht_lookup_coalesce_default = TRUE;
+guint32  gnet_property_variable_dl_pipeline_depth     = 2;
+static const guint32  gnet_property_variable_dl_pipeline_depth_default = 2;
 
 static prop_set_t *gnet_property;
 
@@ -11397,6 +11413,170 @@ gnet_prop_init(void) {
     gnet_property->props[487].data.boolean.def   = (void *) &gnet_property_variable_running_topless_default;
     gnet_property->props[487].data.boolean.value = (void *) &gnet_property_variable_running_topless;
 
+
+    /*
+     * PROP_DL_PIPELINE_CHUNK_FACTOR:
+     *
+     * General data:
+     */
+    gnet_property->props[488].name = "dl_pipeline_chunk_factor";
+    gnet_property->props[488].desc = _("Amount of round-trips worth of data to keep requested ahead of reception when HTTP pipelining is enabled.  A new request is pipelined when the data still expected from the source would take less than that many HTTP round-trips to come at its measured throughput, and chunks are sized so that dl_pipeline_depth requests cover that amount of data.");
+    gnet_property->props[488].ev_changed = event_new("dl_pipeline_chunk_factor_changed");
+    gnet_property->props[488].save = TRUE;
+    gnet_property->props[488].internal = FALSE;
+    gnet_property->props[488].vector_size = 1;
+	mutex_init(&gnet_property->props[488].lock);
+
+    /* Type specific data: */
+    gnet_property->props[488].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[488].data.guint32.def   = (void *) &gnet_property_variable_dl_pipeline_chunk_factor_default;
+    gnet_property->props[488].data.guint32.value = (void *) &gnet_property_variable_dl_pipeline_chunk_factor;
+    gnet_property->props[488].data.guint32.choices = NULL;
+    gnet_property->props[488].data.guint32.max   = 16;
+    gnet_property->props[488].data.guint32.min   = 1;
+
+
+    /*
+     * PROP_UPLOAD_CACHE_SIZE:
+     *
+     * General data:
+     */
+    gnet_property->props[489].name = "upload_cache_size";
+    gnet_property->props[489].desc = _("Maximum amount of memory, in KiB, used to cache blocks of shared file data read for uploads that cannot use sendfile(), so that concurrent uploads of popular files share their disk reads.  Use 0 to disable the cache.");
+    gnet_property->props[489].ev_changed = event_new("upload_cache_size_changed");
+    gnet_property->props[489].save = TRUE;
+    gnet_property->props[489].internal = FALSE;
+    gnet_property->props[489].vector_size = 1;
+	mutex_init(&gnet_property->props[489].lock);
+
+    /* Type specific data: */
+    gnet_property->props[489].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[489].data.guint32.def   = (void *) &gnet_property_variable_upload_cache_size_default;
+    gnet_property->props[489].data.guint32.value = (void *) &gnet_property_variable_upload_cache_size;
+    gnet_property->props[489].data.guint32.choices = NULL;
+    gnet_property->props[489].data.guint32.max   = 1048576;
+    gnet_property->props[489].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_TLS_KERNEL_OFFLOAD:
+     *
+     * General data:
+     */
+    gnet_property->props[490].name = "tls_kernel_offload";
+    gnet_property->props[490].desc = _("Whether to hand encryption of outgoing TLS records over to the kernel when it supports it (Linux kernel TLS), so that TLS uploads can still use sendfile() and avoid copying file data through user space.");
+    gnet_property->props[490].ev_changed = event_new("tls_kernel_offload_changed");
+    gnet_property->props[490].save = TRUE;
+    gnet_property->props[490].internal = FALSE;
+    gnet_property->props[490].vector_size = 1;
+	mutex_init(&gnet_property->props[490].lock);
+
+    /* Type specific data: */
+    gnet_property->props[490].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[490].data.boolean.def   = (void *) &gnet_property_variable_tls_kernel_offload_default;
+    gnet_property->props[490].data.boolean.value = (void *) &gnet_property_variable_tls_kernel_offload;
+
+
+    /*
+     * PROP_ZEROCOPY_MIN_SIZE:
+     *
+     * General data:
+     */
+    gnet_property->props[491].name = "zerocopy_min_size";
+    gnet_property->props[491].desc = _("Minimum amount of data, in bytes, that uploads must write at once for the kernel to transmit it directly from our buffers (MSG_ZEROCOPY) instead of copying it.  Zero-copy only pays off for large writes.  Use 0 to disable.");
+    gnet_property->props[491].ev_changed = event_new("zerocopy_min_size_changed");
+    gnet_property->props[491].save = TRUE;
+    gnet_property->props[491].internal = FALSE;
+    gnet_property->props[491].vector_size = 1;
+	mutex_init(&gnet_property->props[491].lock);
+
+    /* Type specific data: */
+    gnet_property->props[491].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[491].data.guint32.def   = (void *) &gnet_property_variable_zerocopy_min_size_default;
+    gnet_property->props[491].data.guint32.value = (void *) &gnet_property_variable_zerocopy_min_size;
+    gnet_property->props[491].data.guint32.choices = NULL;
+    gnet_property->props[491].data.guint32.max   = 1048576;
+    gnet_property->props[491].data.guint32.min   = 0;
+
+
+    /*
+     * PROP_BSCHED_HTB:
+     *
+     * General data:
+     */
+    gnet_property->props[492].name = "bsched_htb";
+    gnet_property->props[492].desc = _("Whether to distribute bandwidth among I/O sources using hierarchical token buckets, with per-network and per-host fair shares, instead of the legacy per-slot allocation.");
+    gnet_property->props[492].ev_changed = event_new("bsched_htb_changed");
+    gnet_property->props[492].save = TRUE;
+    gnet_property->props[492].internal = FALSE;
+    gnet_property->props[492].vector_size = 1;
+	mutex_init(&gnet_property->props[492].lock);
+
+    /* Type specific data: */
+    gnet_property->props[492].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[492].data.boolean.def   = (void *) &gnet_property_variable_bsched_htb_default;
+    gnet_property->props[492].data.boolean.value = (void *) &gnet_property_variable_bsched_htb;
+
+
+    /*
+     * PROP_DHT_STORAGE_LOG:
+     *
+     * General data:
+     */
+    gnet_property->props[493].name = "dht_storage_log";
+    gnet_property->props[493].desc = _("If TRUE, DHT values, keys and roots are stored in append-only log segments instead of SDBM databases, which are not migrated.  Ignored when DHT storage uses memory.");
+    gnet_property->props[493].ev_changed = event_new("dht_storage_log_changed");
+    gnet_property->props[493].save = TRUE;
+    gnet_property->props[493].internal = FALSE;
+    gnet_property->props[493].vector_size = 1;
+	mutex_init(&gnet_property->props[493].lock);
+
+    /* Type specific data: */
+    gnet_property->props[493].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[493].data.boolean.def   = (void *) &gnet_property_variable_dht_storage_log_default;
+    gnet_property->props[493].data.boolean.value = (void *) &gnet_property_variable_dht_storage_log;
+
+
+    /*
+     * PROP_DHT_LOOKUP_COALESCE:
+     *
+     * General data:
+     */
+    gnet_property->props[494].name = "dht_lookup_coalesce";
+    gnet_property->props[494].desc = _("Whether DHT node and value lookups for a target already being looked up should share the running lookup instead of starting a new one.");
+    gnet_property->props[494].ev_changed = event_new("dht_lookup_coalesce_changed");
+    gnet_property->props[494].save = TRUE;
+    gnet_property->props[494].internal = FALSE;
+    gnet_property->props[494].vector_size = 1;
+	mutex_init(&gnet_property->props[494].lock);
+
+    /* Type specific data: */
+    gnet_property->props[494].type               = PROP_TYPE_BOOLEAN;
+    gnet_property->props[494].data.boolean.def   = (void *) &gnet_property_variable_dht_lookup_coalesce_default;
+    gnet_property->props[494].data.boolean.value = (void *) &gnet_property_variable_dht_lookup_coalesce;
+
+
+    /*
+     * PROP_DL_PIPELINE_DEPTH:
+     *
+     * General data:
+     */
+    gnet_property->props[495].name = "dl_pipeline_depth";
+    gnet_property->props[495].desc = _("Maximum amount of HTTP requests pipelined on a download connection ahead of the one being received.  Deeper pipelines allow smaller chunks to be requested from high-latency sources without leaving the link idle between requests.  More than one request is only pipelined to servers which already replied correctly to a pipelined request.");
+    gnet_property->props[495].ev_changed = event_new("dl_pipeline_depth_changed");
+    gnet_property->props[495].save = TRUE;
+    gnet_property->props[495].internal = FALSE;
+    gnet_property->props[495].vector_size = 1;
+	mutex_init(&gnet_property->props[495].lock);
+
+    /* Type specific data: */
+    gnet_property->props[495].type               = PROP_TYPE_GUINT32;
+    gnet_property->props[495].data.guint32.def   = (void *) &gnet_property_variable_dl_pipeline_depth_default;
+    gnet_property->props[495].data.guint32.value = (void *) &gnet_property_variable_dl_pipeline_depth;
+    gnet_property->props[495].data.guint32.choices = NULL;
+    gnet_property->props[495].data.guint32.max   = 8;
+    gnet_property->props[495].data.guint32.min   = 1;
+
     gnet_property->by_name = htable_create(HASH_KEY_STRING, 0);
     for (n = 0; n < GNET_PROPERTY_NUM; n ++) {
         htable_insert(gnet_property->by_name,
@@ -524,6 +524,14 @@ typedef enum {
     PROP_LOCK_CONTENTION_TRACE,
     PROP_LOCK_SLEEP_TRACE,
     PROP_RUNNING_TOPLESS,
+    PROP_DL_PIPELINE_CHUNK_FACTOR,
+    PROP_UPLOAD_CACHE_SIZE,
+    PROP_TLS_KERNEL_OFFLOAD,
+    PROP_ZEROCOPY_MIN_SIZE,
+    PROP_BSCHED_HTB,
+    PROP_DHT_STORAGE_LOG,
+    PROP_DHT_LOOKUP_COALESCE,
+    PROP_DL_PIPELINE_DEPTH,
     GNET_PROPERTY_END
 } gnet_property_t;
 
@@ -538,6 +538,14 @@ extern const gboolean gnet_property_variable_inputevt_trace;
 extern const gboolean gnet_property_variable_lock_contention_trace;
 extern const gboolean gnet_property_variable_lock_sleep_trace;
 extern const gboolean gnet_property_variable_running_topless;
+extern const guint32  gnet_property_variable_dl_pipeline_chunk_factor;
+extern const guint32  gnet_property_variable_upload_cache_size;
+extern const gboolean gnet_property_variable_tls_kernel_offload;
+extern const guint32  gnet_property_variable_zerocopy_min_size;
+extern const gboolean gnet_property_variable_bsched_htb;
+extern const gboolean gnet_property_variable_dht_storage_log;
+extern const gboolean gnet_property_variable_dht_lookup_coalesce;
+extern const guint32  gnet_property_variable_dl_pipeline_depth;
 
 
 prop_set_t *gnet_prop_init(void);
@@ -0,0 +1,686 @@
+/*
+ * chunk-test -- chunk reservation tests and benchmark.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A file is described by a list of contiguous chunks which are either empty,
+ * busy (reserved by a download) or done, as in the core's fileinfo.c.
+ * Downloads reserve a range at some offset, taken from the first hole at or
+ * after that offset, and later complete it, coalescing adjacent done chunks.
+ *
+ * The same random sequence of reservations and completions is replayed
+ * on the chunk sets fileinfo.c uses, where chunks are indexed by offset,
+ * and on a plain list where chunks are located by scanning, as fileinfo.c
+ * used to do.  The list is also the reference the chunk set is checked
+ * against.
+ */
+
+#include "common.h"
+
+#include "lib/chunkset.h"
+#include "lib/eslist.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stacktrace.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/walloc.h"
+
+#define DLMAX		1024		/* Maximum amount of concurrent downloads */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+enum fchunk_status {
+	FCHUNK_EMPTY = 0,
+	FCHUNK_BUSY,
+	FCHUNK_DONE
+};
+
+/**
+ * A chunk from the chunk set.
+ */
+struct fchunk {
+	enum fchunk_status status;
+	chunk_t range;					/**< Range, hole if status is EMPTY */
+};
+
+/**
+ * A chunk from the plain list.
+ */
+struct lchunk {
+	uint64 from;					/**< Range start (byte included) */
+	uint64 to;						/**< Range end (byte EXCLUDED) */
+	enum fchunk_status status;
+	slink_t lk;						/**< Embedded one-way link */
+};
+
+/**
+ * Operations on a chunk container covering a whole file.
+ */
+struct chunk_ops {
+	void (*init)(uint64 size);
+	uint64 (*reserve)(uint64 pos, uint64 len, uint64 *end);
+	void (*complete)(uint64 start, size_t step);
+	size_t (*count)(void);
+	void (*check)(size_t step);
+	void (*free)(void);
+};
+
+/**
+ * Outcome of a run.
+ */
+struct chunk_run {
+	size_t reserved;				/**< Amount of reservations */
+	size_t completed;				/**< Amount of completions */
+	size_t chunks;					/**< Maximum amount of chunks seen */
+	uint32 signature;				/**< Hash of the reserved ranges */
+	double elapsed;					/**< Time taken */
+};
+
+static chunkset_t fchunks;
+static eslist_t lchunks;
+static uint64 file_size;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-d downloads] [-l length] [-n size] [-R seed]\n"
+		"  -d : sets amount of concurrent downloads (max %d)\n"
+		"  -h : prints this help message\n"
+		"  -l : sets maximum length of a reservation\n"
+		"  -n : sets file size\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -V : verbose mode\n"
+		, getprogname(), DLMAX);
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, size_t step)
+{
+	printf("%s failed at step #%zu\n", what, step);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static struct fchunk *
+fchunk_alloc(enum fchunk_status status)
+{
+	struct fchunk *fc;
+
+	WALLOC0(fc);
+	fc->status = status;
+
+	return fc;
+}
+
+static void
+fchunk_init(uint64 size)
+{
+	struct fchunk *fc;
+
+	chunkset_init(&fchunks, offsetof(struct fchunk, range));
+
+	fc = fchunk_alloc(FCHUNK_EMPTY);
+	fc->range.from = 0;
+	fc->range.to = size;
+	fc->range.hole = TRUE;
+	chunkset_append(&fchunks, fc);
+}
+
+static void
+fchunk_free(void)
+{
+	chunkset_wfree(&fchunks, sizeof(struct fchunk));
+}
+
+static size_t
+fchunk_count(void)
+{
+	return chunkset_count(&fchunks);
+}
+
+static void
+fchunk_set_status(struct fchunk *fc, enum fchunk_status status)
+{
+	chunkset_set_hole(&fchunks, fc, FCHUNK_EMPTY == status);
+	fc->status = status;
+}
+
+/**
+ * Split chunk at `offset', returning the new upper chunk.
+ */
+static struct fchunk *
+fchunk_split(struct fchunk *fc, uint64 offset)
+{
+	struct fchunk *nfc = fchunk_alloc(fc->status);
+
+	chunkset_split(&fchunks, fc, offset, nfc);
+	return nfc;
+}
+
+/**
+ * Merge the chunk following `fc' into it.
+ */
+static void
+fchunk_merge_next(struct fchunk *fc)
+{
+	struct fchunk *nfc = chunkset_merge_next(&fchunks, fc);
+
+	WFREE(nfc);
+}
+
+/**
+ * Reserve at most `len' bytes from the first hole at or after `pos',
+ * wrapping around to the first hole of the file when there is none.
+ *
+ * @return the starting offset of the reserved range, or (uint64) -1 when
+ * the file has no hole left.
+ */
+static uint64
+fchunk_reserve(uint64 pos, uint64 len, uint64 *end)
+{
+	struct fchunk *fc;
+	uint64 start;
+
+	/*
+	 * There are at most two chunks per pending reservation between
+	 * two holes, so the walk is bounded by the amount of downloads.
+	 */
+
+	for (
+		fc = chunkset_lookup(&fchunks, pos);
+		fc != NULL && FCHUNK_EMPTY != fc->status;
+		fc = chunkset_next(&fchunks, fc)
+	)
+		/* empty */;
+
+	if (NULL == fc)
+		fc = chunkset_hole_first(&fchunks);
+
+	if (NULL == fc)
+		return (uint64) -1;
+
+	start = MAX(fc->range.from, pos);
+	if (start >= fc->range.to)
+		start = fc->range.from;			/* Wrapped around */
+
+	if (start > fc->range.from)
+		fc = fchunk_split(fc, start);
+
+	if (fc->range.to - start > len)
+		fchunk_split(fc, start + len);
+
+	fchunk_set_status(fc, FCHUNK_BUSY);
+	*end = fc->range.to;
+
+	return start;
+}
+
+/**
+ * Complete the reservation starting at `start', coalescing done chunks.
+ */
+static void
+fchunk_complete(uint64 start, size_t step)
+{
+	struct fchunk *fc, *pfc, *nfc;
+
+	fc = chunkset_lookup(&fchunks, start);
+
+	if (NULL == fc || fc->range.from != start || FCHUNK_BUSY != fc->status)
+		test_abort("completion lookup", step);
+
+	fchunk_set_status(fc, FCHUNK_DONE);
+
+	nfc = chunkset_next(&fchunks, fc);
+	if (nfc != NULL && FCHUNK_DONE == nfc->status)
+		fchunk_merge_next(fc);
+
+	pfc = chunkset_prev(&fchunks, fc);
+	if (pfc != NULL && FCHUNK_DONE == pfc->status)
+		fchunk_merge_next(pfc);
+}
+
+/**
+ * Check the chunk set consistency.
+ */
+static void
+fchunk_check(size_t step)
+{
+	const struct fchunk *fc;
+
+	if (!chunkset_check(&fchunks))
+		test_abort("chunk set consistency", step);
+
+	CHUNKSET_FOREACH(&fchunks, fc) {
+		if (fc->range.hole != (FCHUNK_EMPTY == fc->status))
+			test_abort("hole status", step);
+	}
+}
+
+static struct lchunk *
+lchunk_alloc(uint64 from, uint64 to, enum fchunk_status status)
+{
+	struct lchunk *lc;
+
+	WALLOC0(lc);
+	lc->from = from;
+	lc->to = to;
+	lc->status = status;
+
+	return lc;
+}
+
+static void
+lchunk_init(uint64 size)
+{
+	eslist_init(&lchunks, offsetof(struct lchunk, lk));
+	eslist_append(&lchunks, lchunk_alloc(0, size, FCHUNK_EMPTY));
+}
+
+static void
+lchunk_free(void)
+{
+	eslist_wfree(&lchunks, sizeof(struct lchunk));
+}
+
+static size_t
+lchunk_count(void)
+{
+	return eslist_count(&lchunks);
+}
+
+/**
+ * Split chunk at `offset', returning the new upper chunk.
+ */
+static struct lchunk *
+lchunk_split(struct lchunk *lc, uint64 offset)
+{
+	struct lchunk *nlc = lchunk_alloc(offset, lc->to, lc->status);
+
+	lc->to = offset;
+	eslist_insert_after(&lchunks, lc, nlc);
+
+	return nlc;
+}
+
+/**
+ * Merge the chunk following `lc' into it.
+ */
+static void
+lchunk_merge_next(struct lchunk *lc)
+{
+	struct lchunk *nlc = eslist_remove_after(&lchunks, lc);
+
+	lc->to = nlc->to;
+	WFREE(nlc);
+}
+
+/**
+ * Same as fchunk_reserve(), scanning the list.
+ */
+static uint64
+lchunk_reserve(uint64 pos, uint64 len, uint64 *end)
+{
+	struct lchunk *lc, *first = NULL;
+	uint64 start;
+
+	ESLIST_FOREACH_DATA(&lchunks, lc) {
+		if (FCHUNK_EMPTY != lc->status)
+			continue;
+		if (NULL == first)
+			first = lc;
+		if (lc->to > pos)
+			break;
+	}
+
+	if (NULL == lc)
+		lc = first;
+
+	if (NULL == lc)
+		return (uint64) -1;
+
+	start = MAX(lc->from, pos);
+	if (start >= lc->to)
+		start = lc->from;			/* Wrapped around */
+
+	if (start > lc->from)
+		lc = lchunk_split(lc, start);
+
+	if (lc->to - start > len)
+		lchunk_split(lc, start + len);
+
+	lc->status = FCHUNK_BUSY;
+	*end = lc->to;
+
+	return start;
+}
+
+/**
+ * Same as fchunk_complete(), scanning the list.
+ */
+static void
+lchunk_complete(uint64 start, size_t step)
+{
+	struct lchunk *lc, *plc = NULL, *nlc;
+
+	ESLIST_FOREACH_DATA(&lchunks, lc) {
+		if (lc->to > start)
+			break;
+		plc = lc;
+	}
+
+	if (NULL == lc || lc->from != start || FCHUNK_BUSY != lc->status)
+		test_abort("completion lookup", step);
+
+	lc->status = FCHUNK_DONE;
+
+	nlc = eslist_next_data(&lchunks, lc);
+	if (nlc != NULL && FCHUNK_DONE == nlc->status)
+		lchunk_merge_next(lc);
+
+	if (plc != NULL && FCHUNK_DONE == plc->status)
+		lchunk_merge_next(plc);
+}
+
+/**
+ * Check that the chunks cover the whole file and are coalesced.
+ */
+static void
+lchunk_check(size_t step)
+{
+	const struct lchunk *lc, *plc = NULL;
+
+	ESLIST_FOREACH_DATA(&lchunks, lc) {
+		if (lc->from != (NULL == plc ? 0 : plc->to) || lc->from >= lc->to)
+			test_abort("chunk contiguity", step);
+		if (
+			plc != NULL &&
+			FCHUNK_DONE == lc->status && FCHUNK_DONE == plc->status
+		)
+			test_abort("chunk coalescing", step);
+		plc = lc;
+	}
+
+	if (NULL == plc || plc->to != file_size)
+		test_abort("chunk coverage", step);
+}
+
+static const struct chunk_ops fchunk_ops = {
+	fchunk_init,
+	fchunk_reserve,
+	fchunk_complete,
+	fchunk_count,
+	fchunk_check,
+	fchunk_free,
+};
+
+static const struct chunk_ops lchunk_ops = {
+	lchunk_init,
+	lchunk_reserve,
+	lchunk_complete,
+	lchunk_count,
+	lchunk_check,
+	lchunk_free,
+};
+
+static double
+elapsed(const tm_t *start, double ustart)
+{
+	tm_t end;
+	double uend;
+
+	tm_cputime(&uend, NULL);
+	tm_now_exact(&end);
+
+	return ustart == uend ? tm_elapsed_f(&end, start) : uend - ustart;
+}
+
+/**
+ * Download the whole file, with at most `downloads' pending reservations
+ * of at most `len' bytes each, at random offsets.
+ */
+static void
+chunk_run(struct chunk_run *cr, const struct chunk_ops *ops,
+	size_t downloads, uint64 len)
+{
+	uint64 pending[DLMAX];
+	size_t n = 0, step = 0;
+	tm_t start;
+	double ustart;
+
+	ZERO(cr);
+	ops->init(file_size);
+	rand31_set_seed(initial_seed);
+
+	tm_now_exact(&start);
+	tm_cputime(&ustart, NULL);
+
+	for (;;) {
+		uint64 from = (uint64) -1, to = 0;
+
+		step++;
+
+		if (n < downloads && (0 == n || 0 == rand31_value(1))) {
+			uint64 pos = rand31_value(MIN(file_size - 1, INT_MAX));
+			uint64 l = 1 + rand31_value(len - 1);
+
+			from = ops->reserve(pos, l, &to);
+			if ((uint64) -1 != from) {
+				pending[n++] = from;
+				cr->reserved++;
+				cr->signature = cr->signature * 31 + (from ^ (to << 7));
+			}
+		}
+
+		if ((uint64) -1 == from) {
+			size_t i;
+
+			if (0 == n)
+				break;			/* File complete */
+
+			i = rand31_value(n - 1);
+			ops->complete(pending[i], step);
+			pending[i] = pending[--n];
+			cr->completed++;
+		}
+
+		cr->chunks = MAX(cr->chunks, ops->count());
+	}
+
+	cr->elapsed = elapsed(&start, ustart);
+
+	ops->check(step);
+	if (1 != ops->count())
+		test_abort("final coalescing", step);
+
+	ops->free();
+}
+
+/**
+ * Check that the chunk set holds the same chunks as the list.
+ */
+static void
+chunk_compare(size_t step)
+{
+	const struct fchunk *fc;
+	const struct lchunk *lc = eslist_head(&lchunks);
+
+	CHUNKSET_FOREACH(&fchunks, fc) {
+		if (
+			NULL == lc || lc->from != fc->range.from ||
+			lc->to != fc->range.to || lc->status != fc->status
+		)
+			test_abort("chunk set contents", step);
+		lc = eslist_next_data(&lchunks, lc);
+	}
+
+	if (lc != NULL)
+		test_abort("chunk set coverage", step);
+}
+
+/**
+ * Replay the same random sequence on the chunk set and on the list, checking
+ * at each step that they hold the same chunks.
+ */
+static void
+chunk_verify(size_t downloads, uint64 len, size_t steps)
+{
+	uint64 pending[DLMAX];
+	size_t n = 0, step;
+
+	fchunk_init(file_size);
+	lchunk_init(file_size);
+
+	for (step = 1; step <= steps; step++) {
+		uint64 from = (uint64) -1, to = 0;
+
+		if (n < downloads && (0 == n || 0 == rand31_value(1))) {
+			uint64 pos = rand31_value(MIN(file_size - 1, INT_MAX));
+			uint64 l = 1 + rand31_value(len - 1);
+			uint64 lto = 0;
+
+			from = fchunk_reserve(pos, l, &to);
+			if (from != lchunk_reserve(pos, l, &lto) || to != lto)
+				test_abort("reservation", step);
+			if ((uint64) -1 != from)
+				pending[n++] = from;
+		}
+
+		if ((uint64) -1 == from) {
+			size_t i;
+
+			if (0 == n)
+				break;			/* File complete */
+
+			i = rand31_value(n - 1);
+			fchunk_complete(pending[i], step);
+			lchunk_complete(pending[i], step);
+			pending[i] = pending[--n];
+		}
+
+		lchunk_check(step);
+		fchunk_check(step);
+		chunk_compare(step);
+	}
+
+	fchunk_free();
+	lchunk_free();
+}
+
+static void
+chunk_test(size_t downloads, uint64 len)
+{
+	struct chunk_run scan, tree;
+
+	chunk_verify(downloads, len, 4096);
+
+	chunk_run(&scan, &lchunk_ops, downloads, len);
+	chunk_run(&tree, &fchunk_ops, downloads, len);
+
+	if (
+		scan.reserved != tree.reserved ||
+		scan.completed != tree.completed ||
+		scan.chunks != tree.chunks
+	)
+		test_abort("run statistics", 0);
+
+	if (scan.signature != tree.signature)
+		test_abort("reservation sequence", 0);
+
+	if (verbose_mode) {
+		printf("chunk: %zu reservations over %s bytes, up to %zu chunks\n",
+			tree.reserved, uint64_to_string(file_size), tree.chunks);
+		printf("chunk: list scan: %.3f s\n", scan.elapsed);
+		printf("chunk: chunk set: %.3f s\n", tree.elapsed);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	uint64 size = 200000;
+	uint64 len = 64;
+	size_t downloads = 32;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "d:hl:n:R:V";
+
+	progstart(argc, argv);
+	stacktrace_init(argv[0], FALSE);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'd':			/* amount of concurrent downloads */
+			downloads = atol(optarg);
+			break;
+		case 'l':			/* maximum reservation length */
+			len = atol(optarg);
+			break;
+		case 'n':			/* file size */
+			size = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if (
+		(argc -= optind) != 0 || 0 == size || 0 == len ||
+		0 == downloads || downloads > DLMAX
+	)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	file_size = size;
+	chunk_test(downloads, len);
+
+	printf("All tests passed.\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sets of contiguous file chunks, indexed by offset.
+ *
+ * A file being downloaded is described by a list of contiguous chunks, which
+ * are split and merged as ranges are reserved and filled.  Since a large file
+ * fetched from many sources can end up being split into thousands of chunks,
+ * they are also indexed by file offset in a red-black tree, and the holes in
+ * another one, so that we do not have to linearily scan the list to locate a
+ * position or find something to fill.  Chunks never overlap, hence offset
+ * ranges make suitable keys for both trees.
+ *
+ * The chunk_t structure is embedded in the user items, at the offset given
+ * when initializing the set, and all the routines here deal with user items.
+ * Linking chunks and changing their hole status must go through this
+ * interface to keep the indices in sync.  The bounds of a linked chunk can
+ * only be changed in place if it does not end up overlapping other chunks.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "chunkset.h"
+
+#include "walloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+/**
+ * @return the chunk embedded in user item.
+ */
+static inline chunk_t *
+chunkset_chunk(const chunkset_t *cs, const void *item)
+{
+	return deconstify_pointer(const_ptr_add_offset(item, cs->offset));
+}
+
+/**
+ * @return the user item embedding chunk, NULL if chunk is NULL.
+ */
+static inline void *
+chunkset_item(const chunkset_t *cs, const chunk_t *c)
+{
+	if (NULL == c)
+		return NULL;
+
+	return deconstify_pointer(const_ptr_add_offset(c, -cs->offset));
+}
+
+/**
+ * Compares two chunks so that two chunks are equal when they overlap.
+ */
+static int
+chunkset_overlap_cmp(const void *a, const void *b)
+{
+	const chunk_t *ca = a, *cb = b;
+
+	if (ca->to <= cb->from)			/* `to' is NOT part of the chunk range */
+		return -1;
+
+	if (cb->to <= ca->from)
+		return +1;
+
+	return 0;		/* Overlapping chunks are equal */
+}
+
+/**
+ * Initialize empty chunk set.
+ *
+ * @param cs		the chunk set to initialize
+ * @param offset	offset of the embedded chunk_t in the user items
+ */
+void
+chunkset_init(chunkset_t *cs, size_t offset)
+{
+	g_assert(cs != NULL);
+
+	eslist_init(&cs->list, offsetof(chunk_t, lk));
+	erbtree_init(&cs->tree, chunkset_overlap_cmp, offsetof(chunk_t, node));
+	erbtree_init(&cs->holes, chunkset_overlap_cmp, offsetof(chunk_t, hnode));
+	cs->offset = offset;
+}
+
+/**
+ * Forget about all the chunks, which are not freed.
+ */
+void
+chunkset_clear(chunkset_t *cs)
+{
+	erbtree_clear(&cs->holes);
+	erbtree_clear(&cs->tree);
+	eslist_clear(&cs->list);
+}
+
+/**
+ * Free all the user items, which were allocated with walloc() and are
+ * ``size'' bytes long, leaving an empty chunk set.
+ */
+void
+chunkset_wfree(chunkset_t *cs, size_t size)
+{
+	chunk_t *c;
+
+	erbtree_clear(&cs->holes);
+	erbtree_clear(&cs->tree);
+
+	while (NULL != (c = eslist_shift(&cs->list)))
+		wfree(chunkset_item(cs, c), size);
+}
+
+/**
+ * Check that chunks are contiguous from offset 0 and that indices agree.
+ *
+ * This is an O(n) operation, only meant for assertions.
+ *
+ * @return TRUE if chunk set is consistent.
+ */
+bool
+chunkset_check(const chunkset_t *cs)
+{
+	const chunk_t *c;
+	filesize_t last = 0;
+	size_t holes = 0;
+
+	if (erbtree_count(&cs->tree) != eslist_count(&cs->list))
+		return FALSE;
+
+	ESLIST_FOREACH_DATA(&cs->list, c) {
+		if (last != c->from || c->from >= c->to)
+			return FALSE;
+		if (c->hole)
+			holes++;
+		last = c->to;
+	}
+
+	return erbtree_count(&cs->holes) == holes;
+}
+
+/**
+ * @return amount of chunks in the set.
+ */
+size_t
+chunkset_count(const chunkset_t *cs)
+{
+	return eslist_count(&cs->list);
+}
+
+/**
+ * @return amount of holes in the set.
+ */
+size_t
+chunkset_hole_count(const chunkset_t *cs)
+{
+	return erbtree_count(&cs->holes);
+}
+
+/**
+ * @return the first chunk, NULL if the set is empty.
+ */
+void *
+chunkset_head(const chunkset_t *cs)
+{
+	return chunkset_item(cs, eslist_head(&cs->list));
+}
+
+/**
+ * @return the last chunk, NULL if the set is empty.
+ */
+void *
+chunkset_tail(const chunkset_t *cs)
+{
+	return chunkset_item(cs, eslist_tail(&cs->list));
+}
+
+/**
+ * @return the chunk following ``item'', NULL if none.
+ */
+void *
+chunkset_next(const chunkset_t *cs, const void *item)
+{
+	return chunkset_item(cs,
+		eslist_next_data(&cs->list, chunkset_chunk(cs, item)));
+}
+
+/**
+ * @return the chunk preceding ``item'', NULL if none.
+ */
+void *
+chunkset_prev(const chunkset_t *cs, const void *item)
+{
+	const chunk_t *c = chunkset_chunk(cs, item);
+
+	return chunkset_item(cs, erbtree_data(&cs->tree, erbtree_prev(&c->node)));
+}
+
+/**
+ * @return the chunk containing the byte at offset ``pos'', NULL if none.
+ */
+void *
+chunkset_lookup(const chunkset_t *cs, filesize_t pos)
+{
+	chunk_t key;
+
+	key.from = pos;
+	key.to = pos + 1;
+
+	return chunkset_item(cs, erbtree_lookup(&cs->tree, &key));
+}
+
+/**
+ * @return the first hole, NULL if none.
+ */
+void *
+chunkset_hole_first(const chunkset_t *cs)
+{
+	return chunkset_item(cs, erbtree_head(&cs->holes));
+}
+
+/**
+ * @return the last hole, NULL if none.
+ */
+void *
+chunkset_hole_last(const chunkset_t *cs)
+{
+	return chunkset_item(cs, erbtree_tail(&cs->holes));
+}
+
+/**
+ * @return the hole following hole ``item'', NULL if none.
+ */
+void *
+chunkset_hole_next(const chunkset_t *cs, const void *item)
+{
+	const chunk_t *c = chunkset_chunk(cs, item);
+
+	g_assert(c->hole);
+
+	return chunkset_item(cs,
+		erbtree_data(&cs->holes, erbtree_next(&c->hnode)));
+}
+
+/**
+ * @return the hole preceding hole ``item'', NULL if none.
+ */
+void *
+chunkset_hole_prev(const chunkset_t *cs, const void *item)
+{
+	const chunk_t *c = chunkset_chunk(cs, item);
+
+	g_assert(c->hole);
+
+	return chunkset_item(cs,
+		erbtree_data(&cs->holes, erbtree_prev(&c->hnode)));
+}
+
+/**
+ * Index chunk that was just linked into the list.
+ */
+static void
+chunkset_index(chunkset_t *cs, chunk_t *c)
+{
+	void *old;
+
+	g_assert(c->from < c->to);
+
+	old = erbtree_insert(&cs->tree, &c->node);
+	g_assert(NULL == old);		/* Chunks never overlap */
+
+	if (c->hole) {
+		old = erbtree_insert(&cs->holes, &c->hnode);
+		g_assert(NULL == old);
+	}
+}
+
+/**
+ * Append chunk at the end of the set.
+ *
+ * The `from', `to' and `hole' fields of the embedded chunk must be set, and
+ * its links cleared.
+ */
+void
+chunkset_append(chunkset_t *cs, void *item)
+{
+	chunk_t *c = chunkset_chunk(cs, item), *last;
+
+	last = eslist_tail(&cs->list);
+	g_assert(NULL == last || last->to == c->from);
+
+	eslist_append(&cs->list, c);
+	chunkset_index(cs, c);
+}
+
+/**
+ * Insert new chunk ``nitem'' right after ``item'', which it must follow.
+ */
+void
+chunkset_insert_after(chunkset_t *cs, void *item, void *nitem)
+{
+	chunk_t *c = chunkset_chunk(cs, item), *nc = chunkset_chunk(cs, nitem);
+
+	g_assert(c->to == nc->from);
+
+	eslist_insert_after(&cs->list, c, nc);
+	chunkset_index(cs, nc);
+}
+
+/**
+ * Remove the chunk following ``item''.
+ *
+ * @return the removed chunk, which the caller must free.
+ */
+void *
+chunkset_remove_after(chunkset_t *cs, void *item)
+{
+	chunk_t *nc;
+
+	nc = eslist_remove_after(&cs->list, chunkset_chunk(cs, item));
+	g_assert(nc != NULL);
+
+	erbtree_remove(&cs->tree, &nc->node);
+	if (nc->hole)
+		erbtree_remove(&cs->holes, &nc->hnode);
+
+	return chunkset_item(cs, nc);
+}
+
+/**
+ * Flag chunk as being a hole or not.
+ */
+void
+chunkset_set_hole(chunkset_t *cs, void *item, bool hole)
+{
+	chunk_t *c = chunkset_chunk(cs, item);
+
+	if (c->hole == hole)
+		return;
+
+	if (c->hole) {
+		erbtree_remove(&cs->holes, &c->hnode);
+	} else {
+		void *old = erbtree_insert(&cs->holes, &c->hnode);
+		g_assert(NULL == old);
+	}
+
+	c->hole = hole;
+}
+
+/**
+ * Split chunk at the given offset.
+ *
+ * The chunk [from, to[ becomes [from, offset[ and the new chunk ``nitem'',
+ * whose links must be cleared, becomes [offset, to[, inserted right after
+ * it and bearing the same hole status.  The caller copies the other fields
+ * of the user item.
+ */
+void
+chunkset_split(chunkset_t *cs, void *item, filesize_t offset, void *nitem)
+{
+	chunk_t *c = chunkset_chunk(cs, item), *nc = chunkset_chunk(cs, nitem);
+
+	g_assert(offset > c->from && offset < c->to);
+
+	nc->from = offset;
+	nc->to = c->to;
+	nc->hole = c->hole;
+
+	c->to = offset;
+	chunkset_insert_after(cs, item, nitem);
+}
+
+/**
+ * Merge the chunk following ``item'' into ``item''.
+ *
+ * Both chunks must bear the same hole status.
+ *
+ * @return the merged chunk, removed from the set, which the caller must free.
+ */
+void *
+chunkset_merge_next(chunkset_t *cs, void *item)
+{
+	chunk_t *c = chunkset_chunk(cs, item), *nc;
+	void *nitem;
+
+	nitem = chunkset_remove_after(cs, item);
+	nc = chunkset_chunk(cs, nitem);
+
+	g_assert(c->to == nc->from);
+	g_assert(c->hole == nc->hole);
+
+	c->to = nc->to;
+	return nitem;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
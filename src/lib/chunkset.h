@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Sets of contiguous file chunks, indexed by offset.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _chunkset_h_
+#define _chunkset_h_
+
+#include "common.h"
+
+#include "erbtree.h"
+#include "eslist.h"
+
+/**
+ * A chunk, embedded in the user structure describing it.
+ *
+ * The `to' field is the first byte past the range, so it is NOT part of the
+ * chunk.  Chunks that are still to be filled are "holes".
+ */
+typedef struct chunk {
+	filesize_t from;			/**< Range offset start (byte included) */
+	filesize_t to;				/**< Range offset end (byte EXCLUDED) */
+	slink_t lk;					/**< Embedded one-way link */
+	rbnode_t node;				/**< Embedded node in the chunk tree */
+	rbnode_t hnode;				/**< Node in the holes tree, if a hole */
+	bool hole;					/**< Whether chunk is a hole */
+} chunk_t;
+
+/**
+ * A chunk set, made of non-overlapping chunks linked by increasing offsets.
+ *
+ * Chunks are also indexed by offset in a red-black tree, and the holes in
+ * another one, so that locating a position or a hole is O(log n).
+ */
+typedef struct chunkset {
+	eslist_t list;				/**< All chunks, by increasing offsets */
+	erbtree_t tree;				/**< Same chunks, indexed by offset */
+	erbtree_t holes;			/**< The holes, indexed by offset */
+	size_t offset;				/**< Offset of the chunk in user items */
+} chunkset_t;
+
+/*
+ * Public interface.
+ */
+
+void chunkset_init(chunkset_t *cs, size_t offset);
+void chunkset_clear(chunkset_t *cs);
+void chunkset_wfree(chunkset_t *cs, size_t size);
+bool chunkset_check(const chunkset_t *cs);
+
+size_t chunkset_count(const chunkset_t *cs);
+size_t chunkset_hole_count(const chunkset_t *cs);
+
+void *chunkset_head(const chunkset_t *cs);
+void *chunkset_tail(const chunkset_t *cs);
+void *chunkset_next(const chunkset_t *cs, const void *item);
+void *chunkset_prev(const chunkset_t *cs, const void *item);
+void *chunkset_lookup(const chunkset_t *cs, filesize_t pos);
+
+void *chunkset_hole_first(const chunkset_t *cs);
+void *chunkset_hole_last(const chunkset_t *cs);
+void *chunkset_hole_next(const chunkset_t *cs, const void *item);
+void *chunkset_hole_prev(const chunkset_t *cs, const void *item);
+
+void chunkset_append(chunkset_t *cs, void *item);
+void chunkset_insert_after(chunkset_t *cs, void *item, void *nitem);
+void *chunkset_remove_after(chunkset_t *cs, void *item);
+void chunkset_set_hole(chunkset_t *cs, void *item, bool hole);
+void chunkset_split(chunkset_t *cs, void *item, filesize_t offset, void *nitem);
+void *chunkset_merge_next(chunkset_t *cs, void *item);
+
+#define CHUNKSET_FOREACH(cs, item) \
+	for ((item) = chunkset_head(cs); NULL != (item); \
+		(item) = chunkset_next((cs), (item)))
+
+#endif	/* _chunkset_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,324 @@
+/*
+ * cq-test -- callout queue tests and benchmark.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/cq.h"
+#include "lib/misc.h"
+#include "lib/mtwist.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/random.h"
+#include "lib/stacktrace.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+#define STEP		25		/* Virtual ms per heartbeat, as the main queue */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+static mt_state_t *initial_state;
+
+/**
+ * A timer slot, which can hold a pending event.
+ */
+struct slot {
+	cevent_t *ev;			/* Pending event, NULL if none */
+	cq_time_t due;			/* When event is expected to trigger */
+	size_t idx;				/* Slot index */
+};
+
+/**
+ * Simulation state.
+ */
+struct run {
+	struct slot *slots;		/* Timer slots */
+	size_t count;			/* Amount of slots */
+	cq_time_t now;			/* Current virtual time */
+	size_t fired;			/* Amount of events triggered */
+	uint64 checksum;		/* Order-independent trace of the run */
+	mt_state_t *mts;		/* Private random number generator */
+};
+
+static struct run *current_run;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c churn] [-n events] [-s steps] [-R seed]\n"
+		"  -c : sets amount of timer operations per step\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of timer slots\n"
+		"  -s : sets amount of %d ms steps to simulate\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -V : verbose mode\n"
+		, getprogname(), STEP);
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, uint64 got, uint64 expected)
+{
+	printf("%s failed: got %'" PRIu64 ", expected %'" PRIu64 "\n",
+		what, got, expected);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+/**
+ * Random number generator of the current run.
+ *
+ * The global rand31 stream cannot be used: the hash tables consume it,
+ * and the two queues do not use them the same way.
+ */
+static uint32
+run_rand(void)
+{
+	return mts_rand(current_run->mts);
+}
+
+/**
+ * @return uniformly distributed random number in the [0, max] range.
+ */
+static uint32
+run_value(uint32 max)
+{
+	return random_upto(run_rand, max);
+}
+
+/**
+ * Pick a timeout delay, in ms.
+ *
+ * Most timers are short-lived RPC timeouts, some are longer lookup or
+ * aging timeouts, and a few span hours.
+ */
+static int
+random_delay(void)
+{
+	uint32 p = run_value(99);
+
+	if (p < 70)
+		return 1000 + run_value(29 * 1000);
+	else if (p < 95)
+		return 30 * 1000 + run_value(570 * 1000);
+	else
+		return 600 * 1000 + run_value(7200 * 1000);
+}
+
+static void
+slot_expired(cqueue_t *cq, void *data)
+{
+	struct slot *s = data;
+	struct run *r = current_run;
+
+	if (r->now < s->due)
+		test_abort("early trigger", r->now, s->due);
+	if (r->now - s->due >= STEP)
+		test_abort("late trigger", r->now, s->due);
+
+	cq_zero(cq, &s->ev);
+	r->fired++;
+	r->checksum += (s->idx + 1) * r->now;
+}
+
+static void
+slot_insert(cqueue_t *cq, struct run *r, struct slot *s)
+{
+	int delay = random_delay();
+
+	s->due = r->now + delay;
+	s->ev = cq_insert(cq, delay, slot_expired, s);
+}
+
+/**
+ * Simulate timer churn on the callout queue.
+ *
+ * Each step, random slots are picked: empty ones get a new timer, and
+ * pending timers are cancelled or rescheduled, as RPCs get their replies
+ * or aging entries get refreshed.
+ *
+ * @return time spent, in seconds.
+ */
+static double
+cq_test_run(cqueue_t *cq, struct run *r, size_t churn, size_t steps)
+{
+	tm_t start, end;
+	double ustart, uend;
+	size_t i;
+
+	r->mts = mt_state_clone(initial_state);	/* Same sequence for all runs */
+	current_run = r;
+
+	/*
+	 * Run the queue once before inserting anything, so that it records
+	 * our thread as the one running it: inserted events are then regular.
+	 */
+
+	cq_advance(cq, 0);
+
+	tm_now_exact(&start);
+	tm_cputime(&ustart, NULL);
+
+	for (i = 0; i < r->count; i++)
+		slot_insert(cq, r, &r->slots[i]);
+
+	for (i = 0; i < steps; i++) {
+		size_t j;
+
+		for (j = 0; j < churn; j++) {
+			struct slot *s = &r->slots[run_value(r->count - 1)];
+			uint32 p = run_value(9);
+
+			if (NULL == s->ev) {
+				slot_insert(cq, r, s);
+			} else if (p < 6) {
+				cq_cancel(&s->ev);
+			} else if (p < 9) {
+				int delay = random_delay();
+				s->due = r->now + delay;
+				cq_resched(s->ev, delay);
+			}
+		}
+
+		r->now += STEP;
+		cq_advance(cq, STEP);
+
+		if (0 == i % (1000 / STEP))
+			r->checksum += (uint64) cq_delay(cq) * i;
+	}
+
+	tm_cputime(&uend, NULL);
+	tm_now_exact(&end);
+
+	mt_state_free_null(&r->mts);
+
+	return ustart == uend ? tm_elapsed_f(&end, &start) : uend - ustart;
+}
+
+static void
+cq_test_compare(size_t count, size_t churn, size_t steps)
+{
+	struct run hashed, wheel;
+	cqueue_t *cq;
+	double th, tw;
+	size_t i;
+
+	ZERO(&hashed);
+	ZERO(&wheel);
+
+	hashed.count = wheel.count = count;
+	XMALLOC0_ARRAY(hashed.slots, count);
+	XMALLOC0_ARRAY(wheel.slots, count);
+	for (i = 0; i < count; i++)
+		hashed.slots[i].idx = wheel.slots[i].idx = i;
+
+	cq = cq_make_hashed("hashed", 0, STEP);
+	th = cq_test_run(cq, &hashed, churn, steps);
+	cq_free_null(&cq);
+
+	cq = cq_make("wheel", 0, STEP);
+	tw = cq_test_run(cq, &wheel, churn, steps);
+	cq_free_null(&cq);
+
+	if (wheel.fired != hashed.fired)
+		test_abort("fired events", wheel.fired, hashed.fired);
+	if (wheel.checksum != hashed.checksum)
+		test_abort("checksum", wheel.checksum, hashed.checksum);
+
+	if (verbose_mode) {
+		printf("cq: %zu timers, %zu ops/step, %zu steps, %zu fired\n",
+			count, churn, steps, wheel.fired);
+		printf("cq: hashed list:  %.3f s\n", th);
+		printf("cq: timing wheel: %.3f s\n", tw);
+	}
+
+	XFREE_NULL(hashed.slots);
+	XFREE_NULL(wheel.slots);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 100000;
+	size_t churn = 200;
+	size_t steps = 20000;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "c:hn:R:s:V";
+
+	progstart(argc, argv);
+	stacktrace_init(argv[0], FALSE);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of operations per step */
+			churn = atol(optarg);
+			break;
+		case 'n':			/* amount of timer slots */
+			count = atol(optarg);
+			break;
+		case 's':			/* amount of steps */
+			steps = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || 0 == count)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+	initial_state = mt_state_new(rand31_u32);
+
+	cq_test_compare(count, churn, steps);
+
+	mt_state_free_null(&initial_state);
+
+	printf("All tests passed.\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
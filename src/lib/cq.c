@@ -82,6 +82,7 @@ struct cevent {
 	cq_time_t ce_time;			/**< Absolute trigger time (virtual cq time) */
 	struct cevent *ce_bnext;	/**< Next item in hash bucket */
 	struct cevent *ce_bprev;	/**< Prev item in hash bucket */
+	struct chash *ce_bucket;	/**< Bucket where event is linked */
 	cqueue_t *ce_cq;			/**< Callout queue where event is registered */
 	cq_service_t ce_fn;			/**< Callback routine */
 	void *ce_arg;				/**< Argument to pass to said callback */
@@ -154,6 +155,17 @@ cevent_is_extended(const cevent_t *ce)
  * yet-to-come messages, or whatever. We don't care, and we don't want to care.
  * The notion of "current time" is simply given by calling cq_clock() at
  * regular intervals and giving it the "elasped time" since the last call.
+ *
+ * The hashed list is only used by queues created with cq_make_hashed().
+ * By default, events are kept in a hierarchical timing wheel instead: the
+ * cq_hash array is then split into CQ_WHEEL_LEVELS wheels of CQ_WHEEL_SLOTS
+ * unsorted buckets each.  The first wheel holds the events due within the
+ * next CQ_WHEEL_SLOTS ticks, one bucket per tick, and each upper wheel covers
+ * CQ_WHEEL_SLOTS times the range of the previous one.  Whenever the first
+ * wheel completes a turn, the next bucket of the upper wheel is "cascaded",
+ * i.e. its events are redistributed in the lower wheels.  Insertion and
+ * removal are O(1), and cq_clock() only looks at the buckets for the ticks
+ * that elapsed, plus the occasional cascading.
  */
 
 struct chash {
@@ -183,7 +195,9 @@ struct cqueue {
 	int cq_items;				/**< Amount of recorded events */
 	int cq_last_bucket;			/**< Last bucket slot we were at */
 	int cq_period;				/**< Regular callout period, in ms */
+	cq_time_t cq_wheel_tick;	/**< Timing wheel tick being processed */
 	uint8 cq_call_extended;		/**< Is cq_call an extended event? */
+	uint8 cq_wheel;				/**< Are events kept in a timing wheel? */
 	time_t cq_last_idle;		/**< Last time we ran the idle callbacks */
 	mutex_t cq_lock;			/**< Thread-safety for queue changes */
 	mutex_t cq_idle_lock;		/**< Protects idle callbacks */
@@ -210,6 +224,22 @@ cqueue_check(const struct cqueue * const cq)
 #define EV_HASH(x) (((x) >> 5) & HASH_MASK)
 #define EV_OVER(x) (((x) >> 5) & ~HASH_MASK)
 
+/*
+ * The timing wheel uses the same time resolution as the hashed list: one
+ * tick is 32 units.  With 4 levels of 64 slots, the wheel spans 2^24 ticks,
+ * which is about 6 days when time is measured in milliseconds.  Events
+ * scheduled further away are parked in the farthest slot of the upper wheel
+ * and will be moved down by cascading.
+ */
+#define CQ_WHEEL_BITS	6
+#define CQ_WHEEL_SLOTS	(1 << CQ_WHEEL_BITS)	/**< Slots per wheel */
+#define CQ_WHEEL_MASK	(CQ_WHEEL_SLOTS - 1)
+#define CQ_WHEEL_LEVELS	4
+#define CQ_WHEEL_SIZE	(CQ_WHEEL_LEVELS * CQ_WHEEL_SLOTS)
+#define CQ_WHEEL_RANGE	((cq_time_t) 1 << (CQ_WHEEL_LEVELS * CQ_WHEEL_BITS))
+
+#define CQ_TICK(x)		((x) >> 5)
+
 /**
  * Locking of the callout queue for short period of time, in sections that
  * do not encompass memory allocation or do not call other routines that may
@@ -291,11 +321,13 @@ cq_main_thread_id(void)
  * @param name		queue name, for logging
  * @param now		virtual current time -- use 0 if not important
  * @param period	period between heartbeats, in ms
+ * @param wheel		whether to use a timing wheel instead of the hash list
  *
  * @return the initialized object
  */
 static cqueue_t *
-cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
+cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period,
+	bool wheel)
 {
 	/*
 	 * The cq_hash hash list is used to speed up insert/delete operations.
@@ -303,9 +335,14 @@ cq_initialize(cqueue_t *cq, const char *name, cq_time_t now, int period)
 
 	cq->cq_magic = CQUEUE_MAGIC;
 	cq->cq_name = atom_str_get(name);
-	XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
+	cq->cq_wheel = booleanize(wheel);
+	if (wheel)
+		XMALLOC0_ARRAY(cq->cq_hash, CQ_WHEEL_SIZE);
+	else
+		XMALLOC0_ARRAY(cq->cq_hash, HASH_SIZE);
 	cq->cq_time = now;
 	cq->cq_last_bucket = EV_HASH(now);
+	cq->cq_wheel_tick = CQ_TICK(now);
 	cq->cq_period = period;
 	cq->cq_stid = THREAD_INVALID_ID;
 	mutex_init(&cq->cq_lock);
@@ -332,7 +369,32 @@ cq_make(const char *name, cq_time_t now, int period)
 	cqueue_t *cq;
 
 	WALLOC0(cq);
-	cq_initialize(cq, name, now, period);
+	cq_initialize(cq, name, now, period, TRUE);
+	cq_vars_add(cq);
+
+	return cq;
+}
+
+/**
+ * Create a new callout queue object, keeping events in a hash list sorted
+ * by trigger time instead of a timing wheel.
+ *
+ * This was the original implementation, which is kept mostly to be able
+ * to benchmark it against the timing wheel.
+ *
+ * @param name		queue name, for logging
+ * @param now		virtual current time -- use 0 if not important
+ * @param period	period between heartbeats, in ms
+ *
+ * @return a new callout queue
+ */
+cqueue_t *
+cq_make_hashed(const char *name, cq_time_t now, int period)
+{
+	cqueue_t *cq;
+
+	WALLOC0(cq);
+	cq_initialize(cq, name, now, period, FALSE);
 	cq_vars_add(cq);
 
 	return cq;
@@ -452,68 +514,45 @@ ev_free(cevent_t *ev)
 }
 
 /**
- * Link event into the callout queue.
+ * Append event at the tail of the bucket list.
  */
-static void
-ev_link(cevent_t *ev)
+static inline void
+chash_append(struct chash *ch, cevent_t *ev)
 {
-	struct chash *ch;		/* Hashing bucket */
-	cq_time_t trigger;		/* Trigger time */
-	cevent_t *hev;			/* To loop through the hash bucket */
-	cqueue_t *cq;
-
-	cevent_check(ev);
+	ev->ce_bucket = ch;
+	ev->ce_bnext = NULL;
+	ev->ce_bprev = ch->ch_tail;
 
-	cq = ev->ce_cq;
-	cqueue_check(cq);
-	g_assert(ev->ce_time > cq->cq_time || cq->cq_current);
-	assert_mutex_is_owned(&cq->cq_lock);
-
-	trigger = ev->ce_time;
-	cq->cq_items++;
-
-	/*
-	 * Important corner case: we may be rescheduling an event BEFORE
-	 * the current clock time, in which case we must insert the event
-	 * in the current bucket, so it gets fired during the current
-	 * cq_clock() run.
-	 */
+	if (NULL == ch->ch_tail) {
+		g_assert(NULL == ch->ch_head);
+		ch->ch_head = ev;
+	} else {
+		ch->ch_tail->ce_bnext = ev;
+	}
 
-	if (trigger <= cq->cq_time)
-		ch = cq->cq_current;
-	else
-		ch = &cq->cq_hash[EV_HASH(trigger)];
+	ch->ch_tail = ev;
+}
 
-	g_assert(ch);
+/**
+ * Insert event in the bucket list, keeping events sorted by trigger time.
+ */
+static void
+chash_insert(struct chash *ch, cevent_t *ev)
+{
+	cq_time_t trigger = ev->ce_time;
+	cevent_t *hev;
 
 	/*
-	 * If bucket is empty, the event is the new head.
+	 * If bucket is empty, or if item is larger than the tail, insert at
+	 * the end right away.
 	 */
 
-	if (ch->ch_head == NULL) {
-		g_assert(ch->ch_tail == NULL);
-		ch->ch_tail = ch->ch_head = ev;
-		ev->ce_bnext = ev->ce_bprev = NULL;
+	if (NULL == ch->ch_tail || trigger >= ch->ch_tail->ce_time) {
+		chash_append(ch, ev);
 		return;
 	}
 
-	g_assert(ch->ch_tail);
-
-	/*
-	 * If item is larger than the tail, insert at the end right away.
-	 */
-
-	hev = ch->ch_tail;
-
-	g_assert(hev->ce_bnext == NULL);
-
-	if (trigger >= hev->ce_time) {
-		hev->ce_bnext = ev;
-		ev->ce_bnext = NULL;
-		ev->ce_bprev = hev;
-		ch->ch_tail = ev;
-		return;
-	}
+	ev->ce_bucket = ch;
 
 	/*
 	 * If item is smaller than the head...
@@ -549,25 +588,14 @@ ev_link(cevent_t *ev)
 }
 
 /**
- * Unlink event from callout queue.
+ * Remove event from the bucket list where it is linked.
  */
-static void
-ev_unlink(cevent_t *ev)
+static inline void
+chash_remove(cevent_t *ev)
 {
-	struct chash *ch;			/* Hashing bucket */
-	cqueue_t *cq;
+	struct chash *ch = ev->ce_bucket;
 
-	cevent_check(ev);
-	cq = ev->ce_cq;
-	cqueue_check(cq);
-	assert_mutex_is_owned(&cq->cq_lock);
-
-	ch = &cq->cq_hash[EV_HASH(ev->ce_time)];
-	cq->cq_items--;
-
-	/*
-	 * Unlinking the item is straigthforward, unlike insertion!
-	 */
+	g_assert(ch != NULL);
 
 	if (ch->ch_head == ev)
 		ch->ch_head = ev->ce_bnext;
@@ -579,10 +607,102 @@ ev_unlink(cevent_t *ev)
 	if (ev->ce_bnext)
 		ev->ce_bnext->ce_bprev = ev->ce_bprev;
 
+	ev->ce_bucket = NULL;
+
 	g_assert(ch->ch_head == NULL || ch->ch_head->ce_bprev == NULL);
 	g_assert(ch->ch_tail == NULL || ch->ch_tail->ce_bnext == NULL);
 }
 
+/**
+ * Compute the timing wheel bucket where an event must be linked.
+ *
+ * @param cq		the callout queue
+ * @param trigger	the event trigger time
+ *
+ * @return the bucket for the event.
+ */
+static struct chash *
+cq_wheel_bucket(const cqueue_t *cq, cq_time_t trigger)
+{
+	cq_time_t base = cq->cq_wheel_tick;
+	cq_time_t tick = MAX(CQ_TICK(trigger), base);
+	cq_time_t delta = tick - base;
+	uint level = 0, shift = 0;
+
+	/*
+	 * Events too far away in the future are parked in the farthest slot,
+	 * they will be moved down as the wheel turns.
+	 */
+
+	if G_UNLIKELY(delta >= CQ_WHEEL_RANGE) {
+		tick = base + CQ_WHEEL_RANGE - 1;
+		delta = CQ_WHEEL_RANGE - 1;
+	}
+
+	while (delta >= ((cq_time_t) CQ_WHEEL_SLOTS << shift)) {
+		level++;
+		shift += CQ_WHEEL_BITS;
+	}
+
+	g_assert(level < CQ_WHEEL_LEVELS);
+
+	return &cq->cq_hash[level * CQ_WHEEL_SLOTS +
+		((tick >> shift) & CQ_WHEEL_MASK)];
+}
+
+/**
+ * Link event into the callout queue.
+ */
+static void
+ev_link(cevent_t *ev)
+{
+	cq_time_t trigger;		/* Trigger time */
+	cqueue_t *cq;
+
+	cevent_check(ev);
+
+	cq = ev->ce_cq;
+	cqueue_check(cq);
+	g_assert(ev->ce_time > cq->cq_time || cq->cq_current);
+	assert_mutex_is_owned(&cq->cq_lock);
+
+	trigger = ev->ce_time;
+	cq->cq_items++;
+
+	/*
+	 * Important corner case: we may be rescheduling an event BEFORE
+	 * the current clock time, in which case we must insert the event
+	 * in the current bucket, so it gets fired during the current
+	 * cq_clock() run.
+	 */
+
+	if (trigger <= cq->cq_time) {
+		g_assert(cq->cq_current != NULL);
+		chash_insert(cq->cq_current, ev);
+	} else if (cq->cq_wheel) {
+		chash_append(cq_wheel_bucket(cq, trigger), ev);
+	} else {
+		chash_insert(&cq->cq_hash[EV_HASH(trigger)], ev);
+	}
+}
+
+/**
+ * Unlink event from callout queue.
+ */
+static void
+ev_unlink(cevent_t *ev)
+{
+	cqueue_t *cq;
+
+	cevent_check(ev);
+	cq = ev->ce_cq;
+	cqueue_check(cq);
+	assert_mutex_is_owned(&cq->cq_lock);
+
+	cq->cq_items--;
+	chash_remove(ev);
+}
+
 /**
  * Internal initialization and insertion of event in the callout queue.
  *
@@ -1128,6 +1248,109 @@ cq_replace(cevent_t *ev, cq_service_t fn, void *arg)
 	return TRUE;
 }
 
+/**
+ * Cascade events from the upper wheels, as the first wheel starts a new turn.
+ */
+static void
+cq_wheel_cascade(cqueue_t *cq)
+{
+	cq_time_t tick = cq->cq_wheel_tick;
+	uint level;
+
+	g_assert(0 == (tick & CQ_WHEEL_MASK));
+
+	for (level = 1; level < CQ_WHEEL_LEVELS; level++) {
+		uint idx = (tick >> (level * CQ_WHEEL_BITS)) & CQ_WHEEL_MASK;
+		struct chash *ch = &cq->cq_hash[level * CQ_WHEEL_SLOTS + idx];
+		cevent_t *ev;
+
+		while (NULL != (ev = ch->ch_head)) {
+			chash_remove(ev);
+			chash_append(cq_wheel_bucket(cq, ev->ce_time), ev);
+		}
+
+		/*
+		 * Only move to the next level when this one is also starting a
+		 * new turn.
+		 */
+
+		if (idx != 0)
+			break;
+	}
+}
+
+/**
+ * Turn the timing wheel up to the current time, firing expired events.
+ *
+ * @param cq		the callout queue
+ * @param now		the current time
+ *
+ * @return the amount of events triggered.
+ */
+static size_t
+cq_wheel_clock(cqueue_t *cq, cq_time_t now)
+{
+	struct chash expired = { NULL, NULL };
+	cq_time_t last = CQ_TICK(now);
+	size_t processed = 0;
+
+	/*
+	 * Expired events are moved from their wheel bucket to the `expired'
+	 * list, which becomes the "current" bucket where events rescheduled
+	 * before the current clock time are inserted.
+	 */
+
+	cq->cq_current = &expired;
+
+	/*
+	 * Fast path: no need to visit empty buckets when there are no events.
+	 */
+
+	if (0 == cq->cq_items)
+		cq->cq_wheel_tick = last;
+
+	for (;;) {
+		cq_time_t tick = cq->cq_wheel_tick;
+		struct chash *ch;
+		cevent_t *ev, *next;
+
+		if (0 == (tick & CQ_WHEEL_MASK))
+			cq_wheel_cascade(cq);
+
+		/*
+		 * The bucket for the last tick can hold events that are not due yet,
+		 * since the tick covers 32 time units.  All the others have expired.
+		 */
+
+		ch = &cq->cq_hash[tick & CQ_WHEEL_MASK];
+
+		for (ev = ch->ch_head; ev != NULL; ev = next) {
+			next = ev->ce_bnext;
+			if (ev->ce_time <= now) {
+				chash_remove(ev);
+				chash_insert(&expired, ev);
+			}
+		}
+
+		while (NULL != (ev = expired.ch_head)) {
+			cq_expire_internal(cq, ev);
+			processed++;
+		}
+
+		/*
+		 * Callbacks may have recursively turned the wheel further, hence
+		 * we re-read cq_wheel_tick at each iteration.
+		 */
+
+		if (cq->cq_wheel_tick >= last)
+			break;
+
+		cq->cq_wheel_tick++;
+	}
+
+	return processed;
+}
+
 /**
  * The heartbeat of our callout queue.
  *
@@ -1180,6 +1403,11 @@ cq_clock(cqueue_t *cq, int elapsed)
 	cq->cq_time += elapsed;
 	now = cq->cq_time;
 
+	if (cq->cq_wheel) {
+		processed = cq_wheel_clock(cq, now);
+		goto done;
+	}
+
 	bucket = cq->cq_last_bucket;		/* Bucket we traversed last time */
 	ch = &cq->cq_hash[bucket];
 	last_bucket = EV_HASH(now);			/* Last bucket to traverse now */
@@ -1284,6 +1512,65 @@ done:
 	return processed;		/* Do not count idle events */
 }
 
+/**
+ * Compute delay until the next event registered in the timing wheel.
+ *
+ * @param cq		the callout queue (locked)
+ * @param scanned	where the amount of scanned buckets is written
+ *
+ * @return the "virtual time" delay until the next registered event.
+ */
+static int
+cq_wheel_delay(const cqueue_t *cq, int *scanned)
+{
+	cq_time_t next = MAX_INT_VAL(cq_time_t);
+	uint level;
+	int n = 0;
+
+	/*
+	 * Within each wheel, buckets are ordered by increasing trigger time
+	 * from the current position, so the first non-empty bucket holds the
+	 * earliest events of that wheel.  For the upper wheels, the bucket at
+	 * the current position was already cascaded and can only hold events
+	 * scheduled one full turn ahead, so it comes last.
+	 *
+	 * We need to look at all the wheels though, since an event in an
+	 * upper wheel can expire before one in a lower wheel.
+	 */
+
+	for (level = 0; level < CQ_WHEEL_LEVELS; level++) {
+		uint shift = level * CQ_WHEEL_BITS;
+		uint start = (cq->cq_wheel_tick >> shift) & CQ_WHEEL_MASK;
+		uint i;
+
+		if (level != 0)
+			start++;
+
+		for (i = 0; i < CQ_WHEEL_SLOTS; i++) {
+			const struct chash *ch = &cq->cq_hash[
+				level * CQ_WHEEL_SLOTS + ((start + i) & CQ_WHEEL_MASK)];
+			const cevent_t *ev;
+
+			n++;
+
+			if (NULL == ch->ch_head)
+				continue;
+
+			for (ev = ch->ch_head; ev != NULL; ev = ev->ce_bnext)
+				next = MIN(next, ev->ce_time);
+
+			break;
+		}
+	}
+
+	*scanned = n;
+
+	if (next <= cq->cq_time)
+		return 0;
+
+	return MIN(next - cq->cq_time, (cq_time_t) MAX_INT_VAL(int));
+}
+
 /**
  * Compute delay until the next registered event, expressed in units of the
  * callout queue "virtual time".
@@ -1315,33 +1602,37 @@ cq_delay(const cqueue_t *cq)
 	last_bucket = cq->cq_last_bucket;	/* Last bucket scanned */
 	now = cq->cq_time;
 
-	for (i = 0; i < HASH_SIZE; i++) {
-		int b = (last_bucket + i) & HASH_MASK;
-		struct chash *ch = &cq->cq_hash[b];
-		cevent_t *ev = ch->ch_head;
-		int edelay;
-
-		/*
-		 * If the delay we have so far is not too large (does not overflow
-		 * the size of the hashing array) and we have moved away from the
-		 * last scanned bucket by an amount that is large-enough, we know
-		 * we cannot find a smaller delay ahead in the buckets.
-		 */
-
-		if (!EV_OVER(delay) && i > EV_HASH(delay))
-			break;
-
-		if (NULL == ev)
-			continue;
-
-		edelay = ev->ce_time - now;
+	if (cq->cq_wheel) {
+		delay = cq_wheel_delay(cq, &i);
+	} else {
+		for (i = 0; i < HASH_SIZE; i++) {
+			int b = (last_bucket + i) & HASH_MASK;
+			struct chash *ch = &cq->cq_hash[b];
+			cevent_t *ev = ch->ch_head;
+			int edelay;
+
+			/*
+			 * If the delay we have so far is not too large (does not overflow
+			 * the size of the hashing array) and we have moved away from the
+			 * last scanned bucket by an amount that is large-enough, we know
+			 * we cannot find a smaller delay ahead in the buckets.
+			 */
+
+			if (!EV_OVER(delay) && i > EV_HASH(delay))
+				break;
+
+			if (NULL == ev)
+				continue;
+
+			edelay = ev->ce_time - now;
+
+			if G_UNLIKELY(edelay <= 0) {
+				delay = 0;
+				break;
+			}
 
-		if G_UNLIKELY(edelay <= 0) {
-			delay = 0;
-			break;
+			delay = MIN(delay, edelay);
 		}
-
-		delay = MIN(delay, edelay);
 	}
 
 	/*
@@ -1484,6 +1775,38 @@ cq_heartbeat(cqueue_t *cq)
 	return triggered;
 }
 
+/**
+ * Advance the virtual time of the callout queue, firing expired events.
+ *
+ * This is meant for queues whose notion of time is not driven by
+ * cq_heartbeat(), for instance because it is not measured in milliseconds.
+ * Like cq_heartbeat(), it must always be called from the same thread.
+ *
+ * @param cq		the callout queue
+ * @param elapsed	the elapsed virtual time since last call
+ *
+ * @return the amount of triggered events.
+ */
+size_t
+cq_advance(cqueue_t *cq, int elapsed)
+{
+	uint stid = thread_small_id();
+
+	cqueue_check(cq);
+	g_assert(elapsed >= 0);
+
+	CQ_LOCK(cq);
+
+	if G_UNLIKELY(THREAD_INVALID_ID == cq->cq_stid)
+		cq->cq_stid = stid;
+
+	g_assert_log(stid == cq->cq_stid,
+		"%s(): callout queue \"%s\" used to run from %s, called from %s",
+		G_STRFUNC, cq->cq_name, thread_id_name(cq->cq_stid), thread_name());
+
+	return cq_clock(cq, elapsed);	/* Will release the lock */
+}
+
 /**
  * Convenience routine: insert event in the main callout queue.
  *
@@ -1816,7 +2139,7 @@ cq_submake(const char *name, cqueue_t *parent, int period)
 	struct csubqueue *csq;
 
 	WALLOC0(csq);
-	cq_initialize(&csq->sub_cq, name, parent->cq_time, period);
+	cq_initialize(&csq->sub_cq, name, parent->cq_time, period, TRUE);
 	csq->sub_cq.cq_magic = CSUBQUEUE_MAGIC;
 	csq->sub_cq.cq_stid = parent->cq_stid;	/* Runs out of same thread */
 
@@ -2260,7 +2583,7 @@ cq_free(cqueue_t *cq)
 {
 	cevent_t *ev;
 	cevent_t *ev_next;
-	int i;
+	int i, buckets;
 	struct chash *ch;
 
 	cqueue_check(cq);
@@ -2274,7 +2597,9 @@ cq_free(cqueue_t *cq)
 
 	mutex_lock(&cq->cq_lock);
 
-	for (ch = cq->cq_hash, i = 0; i < HASH_SIZE; i++, ch++) {
+	buckets = cq->cq_wheel ? CQ_WHEEL_SIZE : HASH_SIZE;
+
+	for (ch = cq->cq_hash, i = 0; i < buckets; i++, ch++) {
 		for (ev = ch->ch_head; ev; ev = ev_next) {
 			ev_next = ev->ce_bnext;
 			ev_free(ev);
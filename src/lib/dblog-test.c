@@ -0,0 +1,387 @@
+/*
+ * dblog-test -- log-structured store tests.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/dblog.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/hashing.h"
+#include "lib/hstrfn.h"
+#include "lib/path.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stacktrace.h"
+#include "lib/xmalloc.h"
+
+#define VALUE_MAX	2048		/* Maximum value length */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+static char *base;
+
+/**
+ * Reference copy of what the store should hold for a key.
+ */
+struct item {
+	uint32 key;
+	uint32 gen;					/* Generation, to vary values */
+	size_t len;					/* Value length */
+	bool present;				/* Whether key is in the store */
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hkV] [-n keys] [-o ops] [-R seed] [path]\n"
+		"  -h : prints this help message\n"
+		"  -k : keep segment files at the end\n"
+		"  -n : sets amount of keys\n"
+		"  -o : sets amount of operations per round\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -V : verbose mode\n"
+		"Segments are created from path, \"dblog-test\" by default\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, size_t round, uint32 key)
+{
+	printf("%s failed in round #%zu for key %u\n", what, round, key);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+/**
+ * Fill value for item, derived from its key and generation.
+ */
+static void
+fill_value(const struct item *it, char *buf)
+{
+	size_t i;
+	uint32 x = it->key * 31 + it->gen;
+
+	for (i = 0; i < it->len; i++) {
+		x = x * 1103515245 + 12345;
+		buf[i] = x >> 16;
+	}
+}
+
+static uint
+key_hash(const void *key)
+{
+	return u32_hash(*(const uint32 *) key);
+}
+
+static bool
+key_eq(const void *a, const void *b)
+{
+	return *(const uint32 *) a == *(const uint32 *) b;
+}
+
+static dblog_t *
+open_log(int flags)
+{
+	dblog_t *dl;
+
+	dl = dblog_open(base, flags, S_IRUSR | S_IWUSR,
+			key_hash, key_eq);
+
+	if (NULL == dl)
+		s_error("cannot open log \"%s\": %m", base);
+
+	return dl;
+}
+
+/**
+ * Check store contents against the reference.
+ */
+static void
+check(dblog_t *dl, const struct item *items, size_t count, size_t round)
+{
+	char expected[VALUE_MAX];
+	size_t i, n = 0;
+
+	for (i = 0; i < count; i++) {
+		const struct item *it = &items[i];
+		size_t len;
+		void *v;
+
+		v = dblog_fetch(dl, &it->key, &len);
+
+		if (!it->present) {
+			if (v != NULL || dblog_exists(dl, &it->key))
+				test_abort("absence", round, it->key);
+			continue;
+		}
+
+		n++;
+
+		if (NULL == v)
+			test_abort("fetch", round, it->key);
+		if (len != it->len)
+			test_abort("length", round, it->key);
+
+		fill_value(it, expected);
+		if (0 != memcmp(v, expected, len))
+			test_abort("value", round, it->key);
+	}
+
+	if (n != dblog_count(dl))
+		test_abort("count", round, dblog_count(dl));
+}
+
+/**
+ * Apply random updates and deletions.
+ */
+static void
+mutate(dblog_t *dl, struct item *items, size_t count, size_t ops,
+	size_t round)
+{
+	char buf[VALUE_MAX];
+	size_t i;
+
+	for (i = 0; i < ops; i++) {
+		struct item *it = &items[rand31_value(count - 1)];
+		bool existed;
+
+		if (it->present && 0 == rand31_value(2)) {
+			if (!dblog_delete(dl, &it->key, &existed))
+				test_abort("delete", round, it->key);
+			if (!existed)
+				test_abort("delete existence", round, it->key);
+			it->present = FALSE;
+		} else {
+			it->gen++;
+			it->len = rand31_value(
+				0 == rand31_value(100) ? VALUE_MAX : VALUE_MAX / 16);
+			fill_value(it, buf);
+			if (!dblog_store(dl, &it->key, sizeof it->key,
+					buf, it->len, &existed))
+				test_abort("store", round, it->key);
+			if (existed != it->present)
+				test_abort("store existence", round, it->key);
+			it->present = TRUE;
+		}
+	}
+}
+
+static bool
+remove_odd(const void *key, size_t klen, void *value, size_t vlen, void *arg)
+{
+	struct item *items = arg;
+	uint32 k = *(const uint32 *) key;
+
+	(void) value;
+	(void) vlen;
+
+	if (klen != sizeof k || items[k].len != vlen)
+		test_abort("iteration", 0, k);
+
+	if (0 == (k & 1))
+		return FALSE;
+
+	items[k].present = FALSE;
+	return TRUE;
+}
+
+/**
+ * Append garbage to the last segment, as if we had crashed while writing.
+ */
+static void
+tear_tail(void)
+{
+	char *path = NULL;
+	uint32 id;
+	int fd;
+
+	/*
+	 * Older segments may have been compacted away, hence the bounded loop.
+	 */
+
+	for (id = 1; id <= 1000; id++) {
+		char *next = h_strdup_printf("%s.%08u%s", base, id, DBLOG_SEGFEXT);
+
+		if (file_exists(next)) {
+			HFREE_NULL(path);
+			path = next;
+		} else {
+			HFREE_NULL(next);
+		}
+	}
+
+	if (NULL == path)
+		return;
+
+	fd = open(path, O_WRONLY | O_APPEND);
+	if (fd >= 0) {
+		static const char junk[] = "\x12\x34\x56\x78\x01\x00\x04\x00\x00";
+
+		if (-1 == write(fd, junk, sizeof junk - 1))
+			s_error("cannot append to \"%s\": %m", path);
+		close(fd);
+	}
+
+	HFREE_NULL(path);
+}
+
+static void
+dblog_test(size_t count, size_t ops)
+{
+	struct item *items;
+	dblog_t *dl;
+	size_t i, round;
+
+	XMALLOC0_ARRAY(items, count);
+	for (i = 0; i < count; i++)
+		items[i].key = i;
+
+	dl = open_log(O_CREAT | O_TRUNC | O_RDWR);
+	dblog_set_wdelay(dl, TRUE);
+
+	for (round = 1; round <= 8; round++) {
+		mutate(dl, items, count, ops, round);
+		check(dl, items, count, round);
+
+		if (verbose_mode)
+			printf("round #%zu: %zu keys\n", round, dblog_count(dl));
+
+		switch (round % 4) {
+		case 0:
+			/* Crash after syncing, leaving a torn record behind */
+			dblog_sync(dl);
+			dblog_set_volatile(dl, FALSE);
+			dblog_close(dl);
+			tear_tail();
+			dl = open_log(O_RDWR);
+			break;
+		case 1:
+			if (!dblog_rebuild(dl))
+				test_abort("rebuild", round, 0);
+			break;
+		case 2:
+			dblog_close(dl);
+			dl = open_log(O_RDWR);
+			dblog_set_wdelay(dl, TRUE);
+			break;
+		case 3:
+			if (-1 == dblog_sync(dl))
+				test_abort("sync", round, 0);
+			break;
+		}
+
+		check(dl, items, count, round);
+	}
+
+	dblog_foreach_remove(dl, remove_odd, items);
+	check(dl, items, count, 0);
+
+	dblog_close(dl);
+	dl = open_log(O_RDWR);
+	check(dl, items, count, 0);
+
+	if (!dblog_clear(dl) || dblog_count(dl) != 0)
+		test_abort("clear", 0, dblog_count(dl));
+
+	dblog_close(dl);
+	XFREE_NULL(items);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 10000;
+	size_t ops = 50000;
+	unsigned rseed = 0;
+	bool keep = FALSE;
+	int c;
+	const char options[] = "hkn:o:R:V";
+
+	progstart(argc, argv);
+	stacktrace_init(argv[0], FALSE);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'k':			/* keep segment files */
+			keep = TRUE;
+			break;
+		case 'n':			/* amount of keys */
+			count = atol(optarg);
+			break;
+		case 'o':			/* amount of operations */
+			ops = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) > 1 || 0 == count)
+		usage();
+
+	argv += optind;
+	/*
+	 * The file layer only opens absolute paths.
+	 */
+
+	base = absolute_pathname(1 == argc ? argv[0] : "dblog-test");
+	if (NULL == base)
+		s_error("cannot determine absolute path of log base");
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	dblog_test(count, ops);
+
+	if (!keep)
+		dblog_unlink(base);
+
+	HFREE_NULL(base);
+
+	printf("All tests passed.\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,1447 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Log-structured key/value store.
+ *
+ * Records are only ever appended to the last of a series of segment files,
+ * named after the base path with an increasing sequence number.  Updating
+ * a key appends a new record, deleting it appends a "tombstone" record, so
+ * that each operation costs a sequential write, buffered until the next
+ * synchronization when deferred writes are enabled.
+ *
+ * All the keys are kept in memory, in an index giving the location of the
+ * latest record for each key.  Values are read back from the segments when
+ * fetched.
+ *
+ * Superseded records are garbage.  Once at least half of a segment is made
+ * of garbage, which happens as stored data expire and get deleted, the live
+ * records it still holds are copied at the end of the log and the segment
+ * is removed.
+ *
+ * Each record is protected by a CRC.  When opening the store, segments are
+ * replayed in sequence to rebuild the index, and a torn record at the end
+ * of the last segment, left by a crash in the middle of a write, is simply
+ * discarded.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "dblog.h"
+
+#include "array_util.h"
+#include "compat_pio.h"
+#include "crc.h"
+#include "endian.h"
+#include "fd.h"
+#include "file.h"
+#include "halloc.h"
+#include "hstrfn.h"
+#include "htable.h"
+#include "misc.h"				/* For is_strprefix() */
+#include "parse.h"
+#include "path.h"
+#include "stringify.h"			/* For plural() */
+#include "walloc.h"
+#include "xmalloc.h"
+#include "xsort.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define DBLOG_SEG_MAGIC		0x64626c31U		/**< "dbl1", heads segments */
+#define DBLOG_SEG_HEAD		4				/**< Size of segment header */
+#define DBLOG_SEG_SIZE		(4 * 1024 * 1024)	/**< Segment roll-over size */
+#define DBLOG_WBUF_SIZE		(64 * 1024)		/**< Write buffer size */
+#define DBLOG_REC_HEAD		11				/**< Size of record header */
+#define DBLOG_KEY_MAX		MAX_INT_VAL(uint16)
+#define DBLOG_GARBAGE		2		/**< Compact when half is garbage */
+
+#define DBLOG_RECLEN(k,v)	(DBLOG_REC_HEAD + (k) + (v))
+
+/**
+ * Record types.
+ */
+enum dblog_rtype {
+	DBLOG_PUT = 1,			/**< Key and its value */
+	DBLOG_DEL = 2			/**< Key deletion (tombstone) */
+};
+
+/**
+ * A segment.
+ */
+struct dblog_seg {
+	uint32 id;				/**< Sequence number */
+	int fd;					/**< Opened file descriptor */
+	filesize_t size;		/**< Logical size, including buffered data */
+	filesize_t garbage;		/**< Bytes held by superseded records */
+};
+
+/**
+ * Index entry, locating the latest record for a key.
+ */
+struct dblog_entry {
+	void *key;				/**< Copy of the key (walloc-ed) */
+	uint32 seg;				/**< Segment ID */
+	uint32 offset;			/**< Offset of record within segment */
+	uint32 vlen;			/**< Length of value */
+	uint16 klen;			/**< Length of key */
+};
+
+enum dblog_magic { DBLOG_MAGIC = 0x3b7e09d4 };
+
+/**
+ * The log-structured store.
+ */
+struct dblog {
+	enum dblog_magic magic;
+	char *path;				/**< Base path of segments (halloc-ed) */
+	char *name;				/**< Name, for logging (halloc-ed, may be NULL) */
+	int mode;				/**< File permissions for new segments */
+	htable_t *index;		/**< Key -> struct dblog_entry */
+	struct dblog_seg *segs;	/**< Segments, by increasing ID */
+	size_t segcnt;			/**< Amount of segments */
+	char *wbuf;				/**< Write buffer, for the last segment */
+	size_t wlen;			/**< Amount of buffered bytes */
+	filesize_t wbase;		/**< Offset in last segment of buffered bytes */
+	char *rbuf;				/**< Buffer where fetched values are read */
+	size_t rsize;			/**< Size of read buffer */
+	unsigned wdelay:1;		/**< Whether writes are deferred */
+	unsigned is_volatile:1;	/**< Whether segments are removed on close */
+	unsigned ioerr:1;		/**< Whether we had an I/O error */
+};
+
+static inline void
+dblog_check(const struct dblog * const dl)
+{
+	g_assert(dl != NULL);
+	g_assert(DBLOG_MAGIC == dl->magic);
+}
+
+/**
+ * @return the name of the store, for logging.
+ */
+const char *
+dblog_name(const dblog_t *dl)
+{
+	dblog_check(dl);
+
+	return NULL == dl->name ? dl->path : dl->name;
+}
+
+/**
+ * Set the name of the store, for logging.
+ */
+void
+dblog_set_name(dblog_t *dl, const char *name)
+{
+	dblog_check(dl);
+
+	HFREE_NULL(dl->name);
+	dl->name = h_strdup(name);
+}
+
+/**
+ * @return the path of a segment, which must be freed with hfree().
+ */
+static char *
+dblog_seg_path(const char *path, uint32 id)
+{
+	return h_strdup_printf("%s.%08u%s", path, id, DBLOG_SEGFEXT);
+}
+
+/**
+ * @return the segment bearing the specified ID.
+ */
+static struct dblog_seg *
+dblog_seg_find(const dblog_t *dl, uint32 id)
+{
+	size_t lo = 0, hi = dl->segcnt;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		struct dblog_seg *seg = &dl->segs[mid];
+
+		if (seg->id == id)
+			return seg;
+		else if (seg->id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	g_assert_not_reached();
+	return NULL;
+}
+
+/**
+ * @return the last segment, where records are appended.
+ */
+static inline struct dblog_seg *
+dblog_seg_last(const dblog_t *dl)
+{
+	g_assert(dl->segcnt != 0);
+
+	return &dl->segs[dl->segcnt - 1];
+}
+
+/**
+ * Record an I/O error.
+ */
+static void
+dblog_ioerr(dblog_t *dl, const char *what, uint32 id)
+{
+	int saved_errno = errno;
+
+	dl->ioerr = TRUE;
+	s_warning("DBLOG \"%s\": cannot %s segment #%u: %m",
+		dblog_name(dl), what, id);
+	errno = saved_errno;
+}
+
+/**
+ * Count superseded record as garbage in its segment.
+ */
+static inline void
+dblog_garbage(dblog_t *dl, uint32 id, size_t len)
+{
+	struct dblog_seg *seg = dblog_seg_find(dl, id);
+
+	seg->garbage += len;
+	g_assert(seg->garbage <= seg->size);
+}
+
+/**
+ * Free index entry.
+ */
+static void
+dblog_entry_free(struct dblog_entry *e)
+{
+	wfree(e->key, e->klen);
+	WFREE(e);
+}
+
+/**
+ * Flush the write buffer to the last segment.
+ *
+ * @return 1 if data was flushed, 0 if there was nothing to flush, -1 on error.
+ */
+static int
+dblog_flush(dblog_t *dl)
+{
+	struct dblog_seg *seg;
+	ssize_t n;
+
+	if (0 == dl->wlen)
+		return 0;
+
+	seg = dblog_seg_last(dl);
+	n = compat_pwrite(seg->fd, dl->wbuf, dl->wlen, dl->wbase);
+
+	if (UNSIGNED(n) != dl->wlen) {
+		if (n >= 0)
+			errno = ENOSPC;
+		dblog_ioerr(dl, "write to", seg->id);
+		return -1;			/* Data remains buffered */
+	}
+
+	dl->wbase += dl->wlen;
+	dl->wlen = 0;
+
+	return 1;
+}
+
+/**
+ * Add segment to the list of known segments.
+ */
+static struct dblog_seg *
+dblog_seg_add(dblog_t *dl, uint32 id, int fd)
+{
+	struct dblog_seg *seg;
+
+	g_assert(0 == dl->segcnt || dblog_seg_last(dl)->id < id);
+
+	XREALLOC_ARRAY(dl->segs, dl->segcnt + 1);
+	seg = &dl->segs[dl->segcnt++];
+	ZERO(seg);
+	seg->id = id;
+	seg->fd = fd;
+
+	return seg;
+}
+
+/**
+ * Start a new segment, where subsequent records will be appended.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+dblog_roll(dblog_t *dl)
+{
+	struct dblog_seg *seg;
+	uint32 id;
+	char *path;
+	int fd;
+
+	if (-1 == dblog_flush(dl))
+		return FALSE;
+
+	id = 0 == dl->segcnt ? 1 : dblog_seg_last(dl)->id + 1;
+	path = dblog_seg_path(dl->path, id);
+	fd = file_create(path, O_RDWR | O_TRUNC, dl->mode);
+	HFREE_NULL(path);
+
+	if (-1 == fd) {
+		dl->ioerr = TRUE;
+		return FALSE;
+	}
+
+	seg = dblog_seg_add(dl, id, fd);
+
+	poke_be32(dl->wbuf, DBLOG_SEG_MAGIC);
+	dl->wbase = 0;
+	dl->wlen = DBLOG_SEG_HEAD;
+	seg->size = DBLOG_SEG_HEAD;
+
+	return TRUE;
+}
+
+/**
+ * Serialize record into the supplied buffer.
+ */
+static void
+dblog_encode(char *p, enum dblog_rtype type,
+	const void *key, size_t klen, const void *value, size_t vlen)
+{
+	char *q = p + 4;
+	size_t len = DBLOG_RECLEN(klen, vlen);
+
+	*q++ = type;
+	q = poke_be16(q, klen);
+	q = poke_be32(q, vlen);
+	q = mempcpy(q, key, klen);
+	if (vlen != 0)
+		q = mempcpy(q, value, vlen);
+
+	g_assert(ptr_diff(q, p) == len);
+
+	poke_be32(p, crc32_update(0, p + 4, len - 4));
+}
+
+/**
+ * Append record at the end of the log.
+ *
+ * @param dl		the store
+ * @param type		record type
+ * @param key		the key
+ * @param klen		key length
+ * @param value		the value (NULL for tombstones)
+ * @param vlen		value length
+ * @param id		where ID of segment holding the record is written
+ * @param offset	where offset of record within its segment is written
+ *
+ * @return TRUE if OK.
+ */
+static bool
+dblog_append(dblog_t *dl, enum dblog_rtype type,
+	const void *key, size_t klen, const void *value, size_t vlen,
+	uint32 *id, uint32 *offset)
+{
+	struct dblog_seg *seg = dblog_seg_last(dl);
+	size_t len = DBLOG_RECLEN(klen, vlen);
+
+	g_assert(klen != 0 && klen <= DBLOG_KEY_MAX);
+
+	if (seg->size >= DBLOG_SEG_SIZE) {
+		if (!dblog_roll(dl))
+			return FALSE;
+		seg = dblog_seg_last(dl);
+	}
+
+	if (dl->wlen + len > DBLOG_WBUF_SIZE && -1 == dblog_flush(dl))
+		return FALSE;
+
+	if G_UNLIKELY(len > DBLOG_WBUF_SIZE) {
+		char *p = xmalloc(len);
+		ssize_t n;
+
+		g_assert(0 == dl->wlen);
+
+		dblog_encode(p, type, key, klen, value, vlen);
+		n = compat_pwrite(seg->fd, p, len, dl->wbase);
+		xfree(p);
+
+		if (UNSIGNED(n) != len) {
+			if (n >= 0)
+				errno = ENOSPC;
+			dblog_ioerr(dl, "write to", seg->id);
+			return FALSE;
+		}
+
+		dl->wbase += len;
+	} else {
+		dblog_encode(&dl->wbuf[dl->wlen], type, key, klen, value, vlen);
+		dl->wlen += len;
+	}
+
+	*id = seg->id;
+	*offset = seg->size;
+	seg->size += len;
+
+	if (!dl->wdelay)
+		dblog_flush(dl);			/* Record remains buffered on error */
+
+	return TRUE;
+}
+
+/**
+ * Update index with the location of the latest record for key.
+ *
+ * The previous record for the key, if any, becomes garbage.
+ *
+ * @return whether the key already existed.
+ */
+static bool
+dblog_index_put(dblog_t *dl, const void *key, size_t klen, size_t vlen,
+	uint32 id, uint32 offset)
+{
+	struct dblog_entry *e = htable_lookup(dl->index, key);
+	bool existed = e != NULL;
+
+	if (existed) {
+		dblog_garbage(dl, e->seg, DBLOG_RECLEN(e->klen, e->vlen));
+	} else {
+		WALLOC(e);
+		e->key = wcopy(key, klen);
+		e->klen = klen;
+		htable_insert(dl->index, e->key, e);
+	}
+
+	e->seg = id;
+	e->offset = offset;
+	e->vlen = vlen;
+
+	return existed;
+}
+
+/**
+ * Remove key from the index, its latest record becoming garbage.
+ */
+static void
+dblog_index_remove(dblog_t *dl, struct dblog_entry *e)
+{
+	dblog_garbage(dl, e->seg, DBLOG_RECLEN(e->klen, e->vlen));
+	htable_remove(dl->index, e->key);
+	dblog_entry_free(e);
+}
+
+/**
+ * Read data from segment.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+dblog_read(dblog_t *dl, uint32 id, filesize_t offset, void *p, size_t len)
+{
+	struct dblog_seg *seg = dblog_seg_find(dl, id);
+	ssize_t n;
+
+	g_assert(offset + len <= seg->size);
+
+	/*
+	 * Records are buffered or written whole, so data lies either completely
+	 * in the write buffer or completely on disk.
+	 */
+
+	if (seg == dblog_seg_last(dl) && offset >= dl->wbase) {
+		memcpy(p, &dl->wbuf[offset - dl->wbase], len);
+		return TRUE;
+	}
+
+	n = compat_pread(seg->fd, p, len, offset);
+
+	if (UNSIGNED(n) != len) {
+		if (n >= 0)
+			errno = EIO;
+		dblog_ioerr(dl, "read from", id);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Read value associated with index entry in the read buffer.
+ *
+ * @return pointer to the value, NULL on error.
+ */
+static void *
+dblog_value(dblog_t *dl, const struct dblog_entry *e)
+{
+	if (e->vlen > dl->rsize) {
+		dl->rsize = e->vlen;
+		XREALLOC_ARRAY(dl->rbuf, dl->rsize);
+	}
+
+	if (0 == e->vlen)
+		return dl->rbuf;
+
+	if (!dblog_read(dl, e->seg, e->offset + DBLOG_REC_HEAD + e->klen,
+			dl->rbuf, e->vlen))
+		return NULL;
+
+	return dl->rbuf;
+}
+
+/**
+ * Load segment in memory.
+ *
+ * @param dl		the store
+ * @param seg		the segment
+ * @param size		where size of the returned buffer is written
+ *
+ * @return buffer holding the segment data, to free with xfree(), or NULL
+ * on error.
+ */
+static char *
+dblog_seg_load(dblog_t *dl, const struct dblog_seg *seg, size_t *size)
+{
+	filestat_t buf;
+	char *p;
+	ssize_t n;
+
+	if (-1 == fstat(seg->fd, &buf)) {
+		dblog_ioerr(dl, "stat", seg->id);
+		return NULL;
+	}
+
+	*size = buf.st_size;
+	p = xmalloc(MAX(1, *size));
+	n = compat_pread(seg->fd, p, *size, 0);
+
+	if (UNSIGNED(n) != *size) {
+		if (n >= 0)
+			errno = EIO;
+		dblog_ioerr(dl, "read", seg->id);
+		xfree(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+/**
+ * Decode record header.
+ *
+ * @param p			start of the record
+ * @param avail		amount of bytes available from the start of the record
+ * @param type		where record type is written
+ * @param klen		where key length is written
+ * @param vlen		where value length is written
+ *
+ * @return the length of the record, 0 if the record is invalid.
+ */
+static size_t
+dblog_decode(const char *p, size_t avail,
+	enum dblog_rtype *type, size_t *klen, size_t *vlen)
+{
+	size_t len;
+
+	if (avail < DBLOG_REC_HEAD)
+		return 0;
+
+	*type = (uchar) p[4];
+	*klen = peek_be16(&p[5]);
+	*vlen = peek_be32(&p[7]);
+
+	if (*type != DBLOG_PUT && *type != DBLOG_DEL)
+		return 0;
+	if (0 == *klen || (DBLOG_DEL == *type && *vlen != 0))
+		return 0;
+	if (*vlen > avail || DBLOG_RECLEN(*klen, *vlen) > avail)
+		return 0;
+
+	len = DBLOG_RECLEN(*klen, *vlen);
+
+	if (peek_be32(p) != crc32_update(0, p + 4, len - 4))
+		return 0;
+
+	return len;
+}
+
+/**
+ * Replay segment, updating the index.
+ *
+ * @param dl		the store
+ * @param seg		the segment to replay
+ * @param last		whether this is the last segment
+ *
+ * @return TRUE if OK.
+ */
+static bool
+dblog_replay(dblog_t *dl, struct dblog_seg *seg, bool last)
+{
+	size_t size, pos = DBLOG_SEG_HEAD;
+	char *p;
+
+	p = dblog_seg_load(dl, seg, &size);
+	if (NULL == p)
+		return FALSE;
+
+	if (size < DBLOG_SEG_HEAD || peek_be32(p) != DBLOG_SEG_MAGIC)
+		pos = 0;
+
+	seg->size = size;
+
+	while (pos != 0 && pos < size) {
+		enum dblog_rtype type;
+		size_t klen, vlen, len;
+		const char *key;
+
+		len = dblog_decode(&p[pos], size - pos, &type, &klen, &vlen);
+		if (0 == len)
+			break;
+
+		key = &p[pos + DBLOG_REC_HEAD];
+
+		if (DBLOG_PUT == type) {
+			dblog_index_put(dl, key, klen, vlen, seg->id, pos);
+		} else {
+			struct dblog_entry *e = htable_lookup(dl->index, key);
+
+			if (e != NULL)
+				dblog_index_remove(dl, e);
+			seg->garbage += len;
+		}
+
+		pos += len;
+	}
+
+	xfree(p);
+
+	if (pos == size)
+		return TRUE;
+
+	/*
+	 * A trailing invalid record in the last segment was being written when
+	 * we crashed, and can be discarded.  Elsewhere, the segment was damaged.
+	 */
+
+	if (pos != 0) {
+		s_warning("DBLOG \"%s\": discarding %zu trailing byte%s "
+			"in %ssegment #%u",
+			dblog_name(dl), size - pos, plural(size - pos),
+			last ? "last " : "", seg->id);
+	} else {
+		s_warning("DBLOG \"%s\": segment #%u is corrupted",
+			dblog_name(dl), seg->id);
+	}
+
+	if (!last) {
+		seg->garbage += size - pos;
+		return TRUE;
+	}
+
+	if (-1 == ftruncate(seg->fd, pos)) {
+		dblog_ioerr(dl, "truncate", seg->id);
+		return FALSE;
+	}
+
+	seg->size = pos;
+
+	if (0 == pos) {
+		poke_be32(dl->wbuf, DBLOG_SEG_MAGIC);
+		dl->wlen = DBLOG_SEG_HEAD;
+		seg->size = DBLOG_SEG_HEAD;
+	}
+
+	return TRUE;
+}
+
+static int
+dblog_id_cmp(const void *a, const void *b)
+{
+	const uint32 *x = a, *y = b;
+
+	return CMP(*x, *y);
+}
+
+/**
+ * List the existing segments for a store.
+ *
+ * @param path		base path of the store
+ * @param count		where the amount of segments is written
+ *
+ * @return sorted array of segment IDs, to free with xfree(), NULL if none.
+ */
+static uint32 *
+dblog_segments(const char *path, size_t *count)
+{
+	const char *base = filepath_basename(path);
+	char *dir = filepath_directory(path);
+	uint32 *ids = NULL;
+	size_t n = 0, size = 0;
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(NULL == dir ? "." : dir);
+	HFREE_NULL(dir);
+
+	if (NULL == d) {
+		*count = 0;
+		return NULL;
+	}
+
+	while (NULL != (de = readdir(d))) {
+		const char *p = is_strprefix(de->d_name, base);
+		const char *end;
+		uint32 id;
+		int error;
+
+		if (NULL == p || *p++ != '.')
+			continue;
+
+		id = parse_uint32(p, &end, 10, &error);
+		if (error || 0 == id || 0 != strcmp(end, DBLOG_SEGFEXT))
+			continue;
+
+		if (n == size) {
+			size = MAX(8, size * 2);
+			XREALLOC_ARRAY(ids, size);
+		}
+		ids[n++] = id;
+	}
+
+	closedir(d);
+
+	if (n > 1)
+		xqsort(ids, n, sizeof ids[0], dblog_id_cmp);
+
+	*count = n;
+	return ids;
+}
+
+/**
+ * Open the existing segments and rebuild the index from them.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+dblog_recover(dblog_t *dl)
+{
+	uint32 *ids;
+	size_t i, n;
+	bool ok = TRUE;
+
+	ids = dblog_segments(dl->path, &n);
+
+	for (i = 0; i < n && ok; i++) {
+		char *path = dblog_seg_path(dl->path, ids[i]);
+		int fd = file_open(path, O_RDWR, 0);
+
+		HFREE_NULL(path);
+
+		if (-1 == fd) {
+			ok = FALSE;
+			break;
+		}
+
+		ok = dblog_replay(dl, dblog_seg_add(dl, ids[i], fd), i == n - 1);
+	}
+
+	XFREE_NULL(ids);
+
+	if (ok && dl->segcnt != 0) {
+		struct dblog_seg *seg = dblog_seg_last(dl);
+
+		dl->wbase = seg->size - dl->wlen;
+	}
+
+	return ok;
+}
+
+/**
+ * Close all the segments, removing their files if requested.
+ */
+static void
+dblog_seg_close_all(dblog_t *dl, bool unlink_files)
+{
+	size_t i;
+
+	for (i = 0; i < dl->segcnt; i++) {
+		struct dblog_seg *seg = &dl->segs[i];
+
+		fd_close(&seg->fd);
+
+		if (unlink_files) {
+			char *path = dblog_seg_path(dl->path, seg->id);
+
+			if (-1 == unlink(path))
+				s_warning("DBLOG \"%s\": cannot unlink %s: %m",
+					dblog_name(dl), path);
+			HFREE_NULL(path);
+		}
+	}
+
+	XFREE_NULL(dl->segs);
+	dl->segcnt = 0;
+	dl->wlen = 0;
+	dl->wbase = 0;
+}
+
+static bool
+dblog_entry_free_kv(const void *unused_key, void *value, void *unused_data)
+{
+	(void) unused_key;
+	(void) unused_data;
+
+	dblog_entry_free(value);
+	return TRUE;
+}
+
+/**
+ * Free store.
+ */
+static void
+dblog_free(dblog_t *dl)
+{
+	dblog_check(dl);
+
+	htable_foreach_remove(dl->index, dblog_entry_free_kv, NULL);
+	htable_free_null(&dl->index);
+	XFREE_NULL(dl->segs);
+	XFREE_NULL(dl->wbuf);
+	XFREE_NULL(dl->rbuf);
+	HFREE_NULL(dl->path);
+	HFREE_NULL(dl->name);
+	dl->magic = 0;
+	WFREE(dl);
+}
+
+/**
+ * Open log-structured store, replaying its existing segments.
+ *
+ * @param path		base path of segment files
+ * @param flags		open() flags, O_CREAT and O_TRUNC being supported
+ * @param mode		file permissions for segments
+ * @param hash_func	key hash function
+ * @param eq_func	key equality function
+ *
+ * @return the opened store, NULL on error with errno set.
+ */
+dblog_t *
+dblog_open(const char *path, int flags, int mode,
+	hash_fn_t hash_func, eq_fn_t eq_func)
+{
+	dblog_t *dl;
+
+	g_assert(path != NULL);
+
+	crc_init();
+
+	if (flags & O_TRUNC)
+		dblog_unlink(path);
+
+	WALLOC0(dl);
+	dl->magic = DBLOG_MAGIC;
+	dl->path = h_strdup(path);
+	dl->mode = mode;
+	dl->index = htable_create_any(hash_func, NULL, eq_func);
+	dl->wbuf = xmalloc(DBLOG_WBUF_SIZE);
+	dl->rsize = 64;
+	dl->rbuf = xmalloc(dl->rsize);
+
+	if (!dblog_recover(dl))
+		goto failed;
+
+	if (0 == dl->segcnt) {
+		if (!(flags & O_CREAT)) {
+			errno = ENOENT;
+			goto failed;
+		}
+		if (!dblog_roll(dl))
+			goto failed;
+	}
+
+	return dl;
+
+failed:
+	{
+		int saved_errno = errno;
+
+		dblog_seg_close_all(dl, FALSE);
+		dblog_free(dl);
+		errno = saved_errno;
+	}
+	return NULL;
+}
+
+/**
+ * Close store, flushing pending data.
+ *
+ * Segments are removed if the store was marked volatile.
+ */
+void
+dblog_close(dblog_t *dl)
+{
+	dblog_check(dl);
+
+	if (!dl->is_volatile)
+		dblog_flush(dl);
+
+	dblog_seg_close_all(dl, dl->is_volatile);
+	dblog_free(dl);
+}
+
+/**
+ * Store value for key, replacing any existing value.
+ *
+ * @param dl		the store
+ * @param key		the key
+ * @param klen		key length
+ * @param value		the value
+ * @param vlen		value length
+ * @param existed	if non-NULL, written with whether key existed
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+dblog_store(dblog_t *dl, const void *key, size_t klen,
+	const void *value, size_t vlen, bool *existed)
+{
+	uint32 id, offset;
+	bool found;
+
+	dblog_check(dl);
+	g_assert(key != NULL);
+	g_assert(value != NULL || 0 == vlen);
+
+	if (!dblog_append(dl, DBLOG_PUT, key, klen, value, vlen, &id, &offset))
+		return FALSE;
+
+	found = dblog_index_put(dl, key, klen, vlen, id, offset);
+
+	if (existed != NULL)
+		*existed = found;
+
+	return TRUE;
+}
+
+/**
+ * Append tombstone for the key and remove it from the index.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+dblog_kill(dblog_t *dl, struct dblog_entry *e)
+{
+	uint32 id, offset;
+
+	if (!dblog_append(dl, DBLOG_DEL, e->key, e->klen, NULL, 0, &id, &offset))
+		return FALSE;
+
+	dblog_garbage(dl, id, DBLOG_RECLEN(e->klen, 0));
+	dblog_index_remove(dl, e);
+
+	return TRUE;
+}
+
+/**
+ * Delete key.
+ *
+ * @param dl		the store
+ * @param key		the key
+ * @param existed	if non-NULL, written with whether key existed
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+dblog_delete(dblog_t *dl, const void *key, bool *existed)
+{
+	struct dblog_entry *e;
+
+	dblog_check(dl);
+	g_assert(key != NULL);
+
+	e = htable_lookup(dl->index, key);
+
+	if (existed != NULL)
+		*existed = e != NULL;
+
+	return NULL == e ? TRUE : dblog_kill(dl, e);
+}
+
+/**
+ * @return whether key exists.
+ */
+bool
+dblog_exists(const dblog_t *dl, const void *key)
+{
+	dblog_check(dl);
+
+	return htable_contains(dl->index, key);
+}
+
+/**
+ * Fetch value associated with key.
+ *
+ * The returned value is only valid until the next operation on the store.
+ *
+ * @param dl		the store
+ * @param key		the key
+ * @param vlen		where value length is written
+ *
+ * @return the value, NULL if not found (errno set to 0) or on error.
+ */
+void *
+dblog_fetch(dblog_t *dl, const void *key, size_t *vlen)
+{
+	const struct dblog_entry *e;
+
+	dblog_check(dl);
+	g_assert(key != NULL);
+	g_assert(vlen != NULL);
+
+	e = htable_lookup(dl->index, key);
+
+	if (NULL == e) {
+		errno = 0;
+		*vlen = 0;
+		return NULL;
+	}
+
+	*vlen = e->vlen;
+	return dblog_value(dl, e);
+}
+
+/**
+ * @return amount of keys held.
+ */
+size_t
+dblog_count(const dblog_t *dl)
+{
+	dblog_check(dl);
+
+	return htable_count(dl->index);
+}
+
+struct dblog_foreach_ctx {
+	dblog_t *dl;
+	union {
+		dblog_cb_t cb;
+		dblog_cbr_t cbr;
+		dblog_key_cb_t kcb;
+	} u;
+	void *arg;
+	size_t removed;
+};
+
+static void
+dblog_foreach_trampoline(const void *key, void *value, void *data)
+{
+	struct dblog_foreach_ctx *ctx = data;
+	const struct dblog_entry *e = value;
+	void *v = dblog_value(ctx->dl, e);
+
+	if (v != NULL)
+		(*ctx->u.cb)(key, e->klen, v, e->vlen, ctx->arg);
+}
+
+/**
+ * Iterate over all the keys, invoking the callback on each of them with
+ * their value.
+ */
+void
+dblog_foreach(dblog_t *dl, dblog_cb_t cb, void *arg)
+{
+	struct dblog_foreach_ctx ctx;
+
+	dblog_check(dl);
+	g_assert(cb != NULL);
+
+	ctx.dl = dl;
+	ctx.u.cb = cb;
+	ctx.arg = arg;
+
+	htable_foreach(dl->index, dblog_foreach_trampoline, &ctx);
+}
+
+static void
+dblog_foreach_key_trampoline(const void *key, void *value, void *data)
+{
+	struct dblog_foreach_ctx *ctx = data;
+	const struct dblog_entry *e = value;
+
+	(*ctx->u.kcb)(key, e->klen, ctx->arg);
+}
+
+/**
+ * Iterate over all the keys, invoking the callback on each of them, without
+ * reading their values.
+ */
+void
+dblog_foreach_key(const dblog_t *dl, dblog_key_cb_t cb, void *arg)
+{
+	struct dblog_foreach_ctx ctx;
+
+	dblog_check(dl);
+	g_assert(cb != NULL);
+
+	ctx.dl = deconstify_pointer(dl);
+	ctx.u.kcb = cb;
+	ctx.arg = arg;
+
+	htable_foreach(dl->index, dblog_foreach_key_trampoline, &ctx);
+}
+
+static bool
+dblog_foreach_remove_trampoline(const void *key, void *value, void *data)
+{
+	struct dblog_foreach_ctx *ctx = data;
+	struct dblog_entry *e = value;
+	dblog_t *dl = ctx->dl;
+	uint32 id, offset;
+	void *v = dblog_value(dl, e);
+
+	if (NULL == v || !(*ctx->u.cbr)(key, e->klen, v, e->vlen, ctx->arg))
+		return FALSE;
+
+	if (!dblog_append(dl, DBLOG_DEL, e->key, e->klen, NULL, 0, &id, &offset))
+		return FALSE;
+
+	dblog_garbage(dl, id, DBLOG_RECLEN(e->klen, 0));
+	dblog_garbage(dl, e->seg, DBLOG_RECLEN(e->klen, e->vlen));
+	dblog_entry_free(e);
+	ctx->removed++;
+
+	return TRUE;
+}
+
+/**
+ * Iterate over all the keys, invoking the callback on each of them with
+ * their value, and removing the key when the callback returns TRUE.
+ *
+ * @return the amount of keys removed.
+ */
+size_t
+dblog_foreach_remove(dblog_t *dl, dblog_cbr_t cbr, void *arg)
+{
+	struct dblog_foreach_ctx ctx;
+
+	dblog_check(dl);
+	g_assert(cbr != NULL);
+
+	ctx.dl = dl;
+	ctx.u.cbr = cbr;
+	ctx.arg = arg;
+	ctx.removed = 0;
+
+	htable_foreach_remove(dl->index, dblog_foreach_remove_trampoline, &ctx);
+
+	return ctx.removed;
+}
+
+/**
+ * Compact segment by copying its live records at the end of the log, then
+ * remove it.
+ *
+ * Tombstones are kept as long as an older segment could still hold a
+ * record for the deleted key.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+dblog_compact(dblog_t *dl, uint32 id)
+{
+	struct dblog_seg *seg = dblog_seg_find(dl, id);
+	bool older = dl->segs[0].id < id;
+	size_t size, pos;
+	char *p, *path;
+
+	g_assert(seg != dblog_seg_last(dl));
+
+	p = dblog_seg_load(dl, seg, &size);
+	if (NULL == p)
+		return FALSE;
+
+	/*
+	 * Copying records can roll the log, and invalidate `seg'.
+	 */
+
+	for (pos = DBLOG_SEG_HEAD; pos < size; /* empty */) {
+		enum dblog_rtype type;
+		size_t klen, vlen, len;
+		const char *key, *value;
+		struct dblog_entry *e;
+		uint32 nid, offset;
+
+		len = dblog_decode(&p[pos], size - pos, &type, &klen, &vlen);
+		if (0 == len)
+			break;
+
+		key = &p[pos + DBLOG_REC_HEAD];
+		value = key + klen;
+		e = htable_lookup(dl->index, key);
+
+		if (DBLOG_PUT == type) {
+			if (e != NULL && e->seg == id && e->offset == pos) {
+				if (!dblog_append(dl, type, key, klen, value, vlen,
+						&nid, &offset))
+					goto failed;
+				e->seg = nid;
+				e->offset = offset;
+			}
+		} else if (NULL == e && older) {
+			if (!dblog_append(dl, type, key, klen, NULL, 0, &nid, &offset))
+				goto failed;
+			dblog_garbage(dl, nid, len);
+		}
+
+		pos += len;
+	}
+
+	xfree(p);
+
+	/*
+	 * Make sure copies are on disk before removing the segment.
+	 */
+
+	if (-1 == dblog_flush(dl))
+		return FALSE;
+
+	seg = dblog_seg_find(dl, id);
+	fd_close(&seg->fd);
+
+	path = dblog_seg_path(dl->path, id);
+	if (-1 == unlink(path)) {
+		s_warning("DBLOG \"%s\": cannot unlink %s: %m",
+			dblog_name(dl), path);
+	}
+	HFREE_NULL(path);
+
+	ARRAY_REMOVE_DEC(dl->segs, seg - dl->segs, dl->segcnt);
+
+	return TRUE;
+
+failed:
+	xfree(p);
+	return FALSE;
+}
+
+/**
+ * Compact segments holding too much garbage.
+ *
+ * The last segment, where records are appended, is never compacted.
+ *
+ * @param dl		the store
+ * @param max		maximum amount of segments to compact, 0 for all
+ *
+ * @return amount of compacted segments, -1 on error.
+ */
+static ssize_t
+dblog_compact_some(dblog_t *dl, size_t max)
+{
+	size_t n = 0;
+
+	while (0 == max || n < max) {
+		struct dblog_seg *best = NULL;
+		size_t i;
+
+		for (i = 0; i + 1 < dl->segcnt; i++) {
+			struct dblog_seg *seg = &dl->segs[i];
+
+			if (seg->garbage * DBLOG_GARBAGE < seg->size)
+				continue;
+
+			if (
+				NULL == best ||
+				seg->garbage * best->size > best->garbage * seg->size
+			)
+				best = seg;
+		}
+
+		if (NULL == best)
+			break;
+
+		if (!dblog_compact(dl, best->id))
+			return -1;
+
+		n++;
+	}
+
+	return n;
+}
+
+/**
+ * Synchronize store, flushing buffered records and compacting at most one
+ * segment.
+ *
+ * @return 1 if data was flushed, 0 if nothing was flushed, -1 on error.
+ */
+ssize_t
+dblog_sync(dblog_t *dl)
+{
+	int n;
+
+	dblog_check(dl);
+
+	n = dblog_flush(dl);
+	if (-1 == n)
+		return -1;
+
+	if (-1 == dblog_compact_some(dl, 1))
+		return -1;
+
+	return n;
+}
+
+/**
+ * Rebuild store, compacting all the segments holding too much garbage.
+ *
+ * @return TRUE if OK.
+ */
+bool
+dblog_rebuild(dblog_t *dl)
+{
+	dblog_check(dl);
+
+	if (-1 == dblog_flush(dl))
+		return FALSE;
+
+	return -1 != dblog_compact_some(dl, 0);
+}
+
+/**
+ * Remove all the keys, restarting from an empty segment.
+ *
+ * @return TRUE if OK.
+ */
+bool
+dblog_clear(dblog_t *dl)
+{
+	dblog_check(dl);
+
+	htable_foreach_remove(dl->index, dblog_entry_free_kv, NULL);
+	dblog_seg_close_all(dl, TRUE);
+	dl->ioerr = FALSE;
+
+	return dblog_roll(dl);
+}
+
+/**
+ * Turn deferred writes on or off.
+ */
+void
+dblog_set_wdelay(dblog_t *dl, bool on)
+{
+	dblog_check(dl);
+
+	dl->wdelay = booleanize(on);
+
+	if (!on)
+		dblog_flush(dl);
+}
+
+/**
+ * Set whether segments are to be removed when the store is closed.
+ */
+void
+dblog_set_volatile(dblog_t *dl, bool is_volatile)
+{
+	dblog_check(dl);
+
+	dl->is_volatile = booleanize(is_volatile);
+}
+
+/**
+ * @return whether an I/O error occurred.
+ */
+bool
+dblog_error(const dblog_t *dl)
+{
+	dblog_check(dl);
+
+	return dl->ioerr;
+}
+
+/**
+ * Rename all the segments of a store.
+ *
+ * @param old_path		old base path of the store
+ * @param new_path		new base path of the store
+ */
+void
+dblog_move(const char *old_path, const char *new_path)
+{
+	uint32 *ids;
+	size_t i, n;
+
+	ids = dblog_segments(old_path, &n);
+
+	for (i = 0; i < n; i++) {
+		char *old_file = dblog_seg_path(old_path, ids[i]);
+		char *new_file = dblog_seg_path(new_path, ids[i]);
+
+		if (-1 == rename(old_file, new_file)) {
+			s_carp("could not rename \"%s\" as \"%s\": %m",
+				old_file, new_file);
+		}
+
+		HFREE_NULL(old_file);
+		HFREE_NULL(new_file);
+	}
+
+	XFREE_NULL(ids);
+}
+
+/**
+ * Remove all the segments of a store.
+ *
+ * @param path		base path of the store
+ */
+void
+dblog_unlink(const char *path)
+{
+	uint32 *ids;
+	size_t i, n;
+
+	ids = dblog_segments(path, &n);
+
+	for (i = 0; i < n; i++) {
+		char *file = dblog_seg_path(path, ids[i]);
+
+		if (-1 == unlink(file))
+			s_carp("could not unlink \"%s\": %m", file);
+
+		HFREE_NULL(file);
+	}
+
+	XFREE_NULL(ids);
+}
+
+/* vi: set ts=4 sw=4 cindent: */
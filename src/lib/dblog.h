@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Log-structured key/value store.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _dblog_h_
+#define _dblog_h_
+
+#include "common.h"
+
+#define DBLOG_SEGFEXT	".seg"		/**< Extension of segment files */
+
+struct dblog;
+typedef struct dblog dblog_t;
+
+/**
+ * Iterator callbacks.
+ *
+ * The value is only valid during the callback.
+ */
+typedef void (*dblog_cb_t)(const void *key, size_t klen,
+	void *value, size_t vlen, void *arg);
+typedef bool (*dblog_cbr_t)(const void *key, size_t klen,
+	void *value, size_t vlen, void *arg);
+typedef void (*dblog_key_cb_t)(const void *key, size_t klen, void *arg);
+
+/*
+ * Public interface.
+ */
+
+dblog_t *dblog_open(const char *path, int flags, int mode,
+	hash_fn_t hash_func, eq_fn_t eq_func);
+void dblog_close(dblog_t *dl);
+void dblog_set_name(dblog_t *dl, const char *name);
+const char *dblog_name(const dblog_t *dl);
+
+bool dblog_store(dblog_t *dl, const void *key, size_t klen,
+	const void *value, size_t vlen, bool *existed);
+bool dblog_delete(dblog_t *dl, const void *key, bool *existed);
+bool dblog_exists(const dblog_t *dl, const void *key);
+void *dblog_fetch(dblog_t *dl, const void *key, size_t *vlen);
+size_t dblog_count(const dblog_t *dl);
+
+void dblog_foreach(dblog_t *dl, dblog_cb_t cb, void *arg);
+void dblog_foreach_key(const dblog_t *dl, dblog_key_cb_t cb, void *arg);
+size_t dblog_foreach_remove(dblog_t *dl, dblog_cbr_t cbr, void *arg);
+
+ssize_t dblog_sync(dblog_t *dl);
+bool dblog_rebuild(dblog_t *dl);
+bool dblog_clear(dblog_t *dl);
+void dblog_set_wdelay(dblog_t *dl, bool on);
+void dblog_set_volatile(dblog_t *dl, bool is_volatile);
+bool dblog_error(const dblog_t *dl);
+
+void dblog_move(const char *old_path, const char *new_path);
+void dblog_unlink(const char *path);
+
+#endif /* _dblog_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -48,6 +48,7 @@
 #include "dbmap.h"
 
 #include "bstr.h"
+#include "dblog.h"
 #include "debug.h"
 #include "map.h"
 #include "misc.h"				/* For english_strerror() */
@@ -77,8 +78,12 @@ struct dbmap {
 		struct {
 			DBM *sdbm;
 			time_t last_check;		/**< When we last checked keys */
+			long pagesize;			/**< Requested page size, 0 = default */
 			unsigned is_volatile:1;	/**< Whether DB can be discarded */
 		} s;
+		struct {
+			dblog_t *dblog;
+		} l;
 	} u;
 	size_t key_size;		/**< Constant width keys are a requirement */
 	dbmap_keylen_t key_len;	/**< Optional, computes serialized key length */
@@ -292,6 +297,32 @@ dbmap_sdbm_error_check(const dbmap_t *dm)
 	return FALSE;
 }
 
+/**
+ * Check whether last operation reported an I/O error in the log layer.
+ *
+ * @return TRUE on error
+ */
+static bool
+dbmap_log_error_check(const dbmap_t *dm, bool ok)
+{
+	dbmap_t *dmw = deconstify_pointer(dm);
+
+	dbmap_check(dm);
+	g_assert(DBMAP_LOG == dm->type);
+
+	if (!ok) {
+		dmw->ioerr = TRUE;
+		dmw->had_ioerr = TRUE;
+		dmw->error = errno;
+		return TRUE;
+	} else if (dm->ioerr) {
+		dmw->ioerr = FALSE;
+		dmw->error = 0;
+	}
+
+	return FALSE;
+}
+
 /**
  * Helper routine to count keys in an opened SDBM database.
  */
@@ -432,6 +463,22 @@ dbmap_type(const dbmap_t *dm)
 	return dm->type;
 }
 
+/**
+ * @return English name of the DB map type, for logging.
+ */
+const char *
+dbmap_type_to_string(enum dbmap_type type)
+{
+	switch (type) {
+	case DBMAP_MAP:		return "map";
+	case DBMAP_SDBM:	return "sdbm";
+	case DBMAP_LOG:		return "log";
+	case DBMAP_MAXTYPE:	break;
+	}
+
+	return "unknown";
+}
+
 /**
  * @return amount of items held in map
  */
@@ -443,6 +490,9 @@ dbmap_count(const dbmap_t *dm)
 	if (DBMAP_MAP == dm->type) {
 		size_t count = map_count(dm->u.m.map);
 		g_assert(dm->count == count);
+	} else if (DBMAP_LOG == dm->type) {
+		size_t count = dblog_count(dm->u.l.dblog);
+		g_assert(dm->count == count);
 	}
 
 	return dm->count;
@@ -495,12 +545,16 @@ dbmap_create_hash(size_t key_size, dbmap_keylen_t key_len,
  * @param path		path of the SDBM database
  * @param flags		opening flags
  * @param mode		file permissions
+ * @param pagesize	SDBM page size, 0 for the default
+ *
+ * The page size only applies when the database is created: an existing
+ * database is converted to it when it is rebuilt.
  *
  * @return the opened database, or NULL if an error occurred during opening.
  */
 dbmap_t *
 dbmap_create_sdbm(size_t ksize, dbmap_keylen_t klen,
-	const char *name, const char *path, int flags, int mode)
+	const char *name, const char *path, int flags, int mode, long pagesize)
 {
 	dbmap_t *dm;
 
@@ -511,7 +565,8 @@ dbmap_create_sdbm(size_t ksize, dbmap_keylen_t klen,
 	dm->type = DBMAP_SDBM;
 	dm->key_size = ksize;
 	dm->key_len = klen;
-	dm->u.s.sdbm = sdbm_open(path, flags, mode);
+	dm->u.s.sdbm = sdbm_open_pagesize(path, flags, mode, pagesize);
+	dm->u.s.pagesize = pagesize;
 
 	if (!dm->u.s.sdbm) {
 		WFREE(dm);
@@ -530,6 +585,55 @@ dbmap_create_sdbm(size_t ksize, dbmap_keylen_t klen,
 	return dm;
 }
 
+/**
+ * Create a DB map implemented as a log-structured store.
+ *
+ * When klen is NULL, ksize is the expected constant key length.
+ * When klen is not NULL, ksize is the expected maximum key length
+ * and the klen routine is used to compute the actual size of the key
+ * based on its serialized form.
+ *
+ * @param ksize		expected constant key length
+ * @param klen		optional, computes serialized key length
+ * @param name		name of the store, for logging (may be NULL)
+ * @param path		base path of the store segments
+ * @param flags		opening flags
+ * @param mode		file permissions
+ * @param hash_func	the hash function for keys
+ * @param eq_func	the key comparison function
+ *
+ * @return the opened store, or NULL if an error occurred during opening.
+ */
+dbmap_t *
+dbmap_create_log(size_t ksize, dbmap_keylen_t klen,
+	const char *name, const char *path, int flags, int mode,
+	hash_fn_t hash_func, eq_fn_t eq_func)
+{
+	dbmap_t *dm;
+	dblog_t *dl;
+
+	g_assert(ksize != 0);
+	g_assert(path);
+
+	dl = dblog_open(path, flags, mode, hash_func, eq_func);
+	if (NULL == dl)
+		return NULL;
+
+	if (name)
+		dblog_set_name(dl, name);
+
+	WALLOC0(dm);
+	dm->magic = DBMAP_MAGIC;
+	dm->type = DBMAP_LOG;
+	dm->key_size = ksize;
+	dm->key_len = klen;
+	dm->u.l.dblog = dl;
+	dm->count = dblog_count(dl);
+	dm->validated = TRUE;
+
+	return dm;
+}
+
 /**
  * Create a map out of an existing map.
  * Use dbmap_release() to discard the dbmap encapsulation.
@@ -679,6 +783,20 @@ dbmap_insert(dbmap_t *dm, const void *key, dbmap_datum_t value)
 				dm->count++;
 		}
 		break;
+	case DBMAP_LOG:
+		{
+			bool existed = FALSE;
+			bool ok;
+
+			errno = dm->error = 0;
+			ok = dblog_store(dm->u.l.dblog, key, dbmap_keylen(dm, key),
+				value.data, value.len, &existed);
+			if (dbmap_log_error_check(dm, ok))
+				return FALSE;
+			if (!existed)
+				dm->count++;
+		}
+		break;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -757,6 +875,21 @@ dbmap_remove(dbmap_t *dm, const void *key)
 			}
 		}
 		break;
+	case DBMAP_LOG:
+		{
+			bool existed = FALSE;
+			bool ok;
+
+			errno = dm->error = 0;
+			ok = dblog_delete(dm->u.l.dblog, key, &existed);
+			if (dbmap_log_error_check(dm, ok))
+				return FALSE;
+			if (existed) {
+				g_assert(dm->count);
+				dm->count--;
+			}
+		}
+		break;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -792,6 +925,8 @@ dbmap_contains(dbmap_t *dm, const void *key)
 			}
 			return 0 != ret;
 		}
+	case DBMAP_LOG:
+		return dblog_exists(dm->u.l.dblog, key);
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -839,6 +974,18 @@ dbmap_lookup(dbmap_t *dm, const void *key)
 			result.len = value.dsize;
 		}
 		break;
+	case DBMAP_LOG:
+		{
+			void *value;
+			size_t len;
+
+			errno = dm->error = 0;
+			value = dblog_fetch(dm->u.l.dblog, key, &len);
+			dbmap_log_error_check(dm, NULL != value || 0 == errno);
+			result.data = value;
+			result.len = len;
+		}
+		break;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -859,6 +1006,8 @@ dbmap_implementation(const dbmap_t *dm)
 		return dm->u.m.map;
 	case DBMAP_SDBM:
 		return dm->u.s.sdbm;
+	case DBMAP_LOG:
+		return dm->u.l.dblog;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -905,7 +1054,7 @@ free_kv(void *key, void *value, void *u)
  * Destroy a DB map.
  *
  * A memory-backed map is lost.
- * An SDBM-backed map is lost if marked volatile.
+ * An SDBM-backed or log-backed map is lost if marked volatile.
  */
 void
 dbmap_destroy(dbmap_t *dm)
@@ -920,6 +1069,9 @@ dbmap_destroy(dbmap_t *dm)
 	case DBMAP_SDBM:
 		sdbm_close(dm->u.s.sdbm);
 		break;
+	case DBMAP_LOG:
+		dblog_close(dm->u.l.dblog);
+		break;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -949,6 +1101,17 @@ insert_key(void *key, void *unused_value, void *u)
 	ctx->sl = pslist_prepend(ctx->sl, kdup);
 }
 
+/**
+ * Log iterator to insert a copy of the keys into a singly-linked list.
+ */
+static void
+insert_log_key(const void *key, size_t klen, void *u)
+{
+	pslist_t **sl = u;
+
+	*sl = pslist_prepend(*sl, wcopy(key, klen));
+}
+
 /**
  * Snapshot all the constant-width keys, returning them in a singly linked list.
  * To free the returned keys, use the dbmap_free_all_keys() helper.
@@ -993,6 +1156,9 @@ dbmap_all_keys(const dbmap_t *dm)
 			dbmap_sdbm_error_check(dm);
 		}
 		break;
+	case DBMAP_LOG:
+		dblog_foreach_key(dm->u.l.dblog, insert_log_key, &sl);
+		break;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1024,7 +1190,7 @@ struct foreach_ctx {
 		dbmap_cbr_t cbr;
 	} u;
 	void *arg;
-	const dbmap_t *dm;		/* Used only by SDBM iterators */
+	const dbmap_t *dm;		/* Used only by SDBM and log iterators */
 	size_t deleted;			/* Used only by SDBM removal iterators */
 };
 
@@ -1103,6 +1269,42 @@ dbmap_foreach_remove_sdbm(const datum key, const datum value, void *arg)
 	return to_remove;
 }
 
+/**
+ * Trampoline to invoke the log iterator and do the proper casts.
+ */
+static void
+dbmap_foreach_log(const void *key, size_t klen,
+	void *value, size_t vlen, void *arg)
+{
+	dbmap_datum_t d;
+	struct foreach_ctx *ctx = arg;
+
+	(void) klen;
+
+	d.data = value;
+	d.len  = vlen;
+
+	(*ctx->u.cb)(deconstify_pointer(key), &d, ctx->arg);
+}
+
+/**
+ * Trampoline to invoke the log iterator and do the proper casts.
+ */
+static bool
+dbmap_foreach_remove_log(const void *key, size_t klen,
+	void *value, size_t vlen, void *arg)
+{
+	dbmap_datum_t d;
+	struct foreach_ctx *ctx = arg;
+
+	(void) klen;
+
+	d.data = value;
+	d.len  = vlen;
+
+	return (*ctx->u.cbr)(deconstify_pointer(key), &d, ctx->arg);
+}
+
 /**
  * Reset count of items.
  *
@@ -1157,6 +1359,10 @@ dbmap_foreach(const dbmap_t *dm, dbmap_cb_t cb, void *arg)
 				dbmap_reset_count(dm, count);
 		}
 		break;
+	case DBMAP_LOG:
+		ctx.dm = dm;
+		dblog_foreach(dm->u.l.dblog, dbmap_foreach_log, &ctx);
+		break;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1205,6 +1411,17 @@ dbmap_foreach_remove(const dbmap_t *dm, dbmap_cbr_t cbr, void *arg)
 			deleted = ctx.deleted;
 		}
 		break;
+	case DBMAP_LOG:
+		{
+			dblog_t *dl = dm->u.l.dblog;
+
+			ctx.dm = dm;
+			deleted = dblog_foreach_remove(dl, dbmap_foreach_remove_log, &ctx);
+
+			dbmap_log_error_check(dm, !dblog_error(dl));
+			dbmap_reset_count(dm, dblog_count(dl));
+		}
+		break;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1222,13 +1439,13 @@ dbmap_store_entry(void *key, dbmap_datum_t *d, void *arg)
  * Store DB map to disk in an SDBM database, at the specified base.
  * Two files are created (using suffixes .pag and .dir).
  *
- * If the map was already backed by an SDBM database and ``inplace'' is TRUE,
- * then the map is simply persisted as such.  It is marked non-volatile as
- * a side effect.
+ * If the map was already backed by an SDBM database or a log-structured
+ * store and ``inplace'' is TRUE, then the map is simply persisted as such.
+ * It is marked non-volatile as a side effect.
  *
  * @param dm		the DB map to store
  * @param base		base path for the persistent database
- * @param inplace	if TRUE and map was an SDBM already, persist as itself
+ * @param inplace	if TRUE and map was already on disk, persist as itself
  *
  * @return TRUE on success.
  */
@@ -1253,11 +1470,17 @@ dbmap_store(dbmap_t *dm, const char *base, bool inplace)
 		/* FALL THROUGH */
 	}
 
+	if (inplace && DBMAP_LOG == dm->type) {
+		dbmap_set_volatile(dm, FALSE);
+		return -1 != dbmap_sync(dm);
+	}
+
 	if (NULL == base)
 		return FALSE;
 
 	ndm = dbmap_create_sdbm(dm->key_size, dm->key_len, NULL, base,
-		O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+		O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR,
+		DBMAP_SDBM == dm->type ? sdbm_pagesize(dm->u.s.sdbm) : 0);
 
 	if (!ndm) {
 		s_warning("SDBM \"%s\": cannot store to %s: %m",
@@ -1341,6 +1564,12 @@ dbmap_sync(dbmap_t *dm)
 		return 0;
 	case DBMAP_SDBM:
 		return sdbm_sync(dm->u.s.sdbm);
+	case DBMAP_LOG:
+		{
+			ssize_t n = dblog_sync(dm->u.l.dblog);
+			dbmap_log_error_check(dm, n != -1);
+			return n;
+		}
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1362,6 +1591,8 @@ dbmap_shrink(dbmap_t *dm)
 		return TRUE;
 	case DBMAP_SDBM:
 		return sdbm_shrink(dm->u.s.sdbm);
+	case DBMAP_LOG:
+		return TRUE;		/* Segments are compacted by dbmap_rebuild() */
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1371,6 +1602,10 @@ dbmap_shrink(dbmap_t *dm)
 
 /**
  * Attempt to rebuild the database (to compact it on disk).
+ *
+ * SDBM databases are also converted to the page size requested at creation
+ * time, if they were created with another one.
+ *
  * @return TRUE if no error occurred.
  */
 bool
@@ -1382,7 +1617,9 @@ dbmap_rebuild(dbmap_t *dm)
 	case DBMAP_MAP:
 		return TRUE;
 	case DBMAP_SDBM:
-		return 0 == sdbm_rebuild(dm->u.s.sdbm);
+		return 0 == sdbm_rebuild_pagesize(dm->u.s.sdbm, dm->u.s.pagesize);
+	case DBMAP_LOG:
+		return dblog_rebuild(dm->u.l.dblog);
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1411,6 +1648,13 @@ dbmap_clear(dbmap_t *dm)
 			return TRUE;
 		}
 		return FALSE;
+	case DBMAP_LOG:
+		if (dblog_clear(dm->u.l.dblog)) {
+			dm->ioerr = FALSE;
+			dm->count = 0;
+			return TRUE;
+		}
+		return FALSE;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1432,6 +1676,8 @@ dbmap_set_cachesize(dbmap_t *dm, long pages)
 		return 0;
 	case DBMAP_SDBM:
 		return sdbm_set_cache(dm->u.s.sdbm, pages);
+	case DBMAP_LOG:
+		return 0;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1453,6 +1699,9 @@ dbmap_set_deferred_writes(dbmap_t *dm, bool on)
 		return 0;
 	case DBMAP_SDBM:
 		return sdbm_set_wdelay(dm->u.s.sdbm, on);
+	case DBMAP_LOG:
+		dblog_set_wdelay(dm->u.l.dblog, on);
+		return 0;
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1475,6 +1724,61 @@ dbmap_set_volatile(dbmap_t *dm, bool is_volatile)
 	case DBMAP_SDBM:
 		dm->u.s.is_volatile = booleanize(is_volatile);
 		return sdbm_set_volatile(dm->u.s.sdbm, is_volatile);
+	case DBMAP_LOG:
+		dblog_set_volatile(dm->u.l.dblog, is_volatile);
+		return 0;
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return 0;
+}
+
+/**
+ * Turn in-place access of SDBM pages through a memory mapping on or off.
+ * @return 0 if OK, -1 on errors with errno set.
+ */
+int
+dbmap_set_mmap(dbmap_t *dm, bool on)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		/*
+		 * Pages modified in place cannot be logged ahead, and read-mostly
+		 * maps, for which the mapping is meant, have little use of a log.
+		 */
+		if (on && -1 == sdbm_set_wal(dm->u.s.sdbm, FALSE))
+			return -1;
+		return sdbm_set_mmap(dm->u.s.sdbm, on);
+	case DBMAP_LOG:
+		return 0;
+	case DBMAP_MAXTYPE:
+		g_assert_not_reached();
+	}
+
+	return 0;
+}
+
+/**
+ * Turn the SDBM write-ahead log on or off.
+ * @return 0 if OK, -1 on errors with errno set.
+ */
+int
+dbmap_set_wal(dbmap_t *dm, bool on)
+{
+	dbmap_check(dm);
+
+	switch (dm->type) {
+	case DBMAP_MAP:
+		return 0;
+	case DBMAP_SDBM:
+		return sdbm_set_wal(dm->u.s.sdbm, on);
+	case DBMAP_LOG:
+		return 0;		/* Already appending all its updates */
 	case DBMAP_MAXTYPE:
 		g_assert_not_reached();
 	}
@@ -1494,7 +1798,7 @@ dbmap_set_debugging(dbmap_t *dm, const dbg_config_t *dbg)
 
 	if (dbg_ds_debugging(dm->dbg, 1, DBG_DSF_DEBUGGING)) {
 		dbg_ds_log(dm->dbg, dm, "%s: attached with %s back-end (count=%zu)",
-			G_STRFUNC, DBMAP_SDBM == dm->type ? "sdbm" : "map", dm->count);
+			G_STRFUNC, dbmap_type_to_string(dm->type), dm->count);
 	}
 }
 
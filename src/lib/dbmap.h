@@ -45,6 +45,7 @@
 enum dbmap_type {
 	DBMAP_MAP = 0,			/* Map in memory */
 	DBMAP_SDBM,				/* SDBM database */
+	DBMAP_LOG,				/* Log-structured store */
 
 	DBMAP_MAXTYPE
 };
@@ -78,7 +79,10 @@ typedef bool (*dbmap_cbr_t)(void *key, dbmap_datum_t *value, void *u);
 dbmap_t *dbmap_create_hash(size_t ks, dbmap_keylen_t kl,
 	hash_fn_t hashf, eq_fn_t key_eqf);
 dbmap_t * dbmap_create_sdbm(size_t ks, dbmap_keylen_t kl, const char *name,
-	const char *path, int flags, int mode);
+	const char *path, int flags, int mode, long pagesize);
+dbmap_t *dbmap_create_log(size_t ks, dbmap_keylen_t kl, const char *name,
+	const char *path, int flags, int mode,
+	hash_fn_t hashf, eq_fn_t key_eqf);
 dbmap_t *dbmap_create_from_map(size_t ks, dbmap_keylen_t kl, map_t *map);
 dbmap_t *dbmap_create_from_sdbm(const char *name,
 	size_t ks, dbmap_keylen_t kl, DBM *sdbm);
@@ -101,6 +105,7 @@ dbmap_keylen_t dbmap_key_length(const dbmap_t *dm);
 bool dbmap_has_ioerr(const dbmap_t *dm);
 const char *dbmap_strerror(const dbmap_t *dm);
 enum dbmap_type dbmap_type(const dbmap_t *dm);
+const char *dbmap_type_to_string(enum dbmap_type type);
 size_t dbmap_count(const dbmap_t *dm);
 
 void dbmap_foreach(const dbmap_t *dm, dbmap_cb_t cb, void *arg);
@@ -124,6 +129,8 @@ ssize_t dbmap_sync(dbmap_t *dm);
 int dbmap_set_cachesize(dbmap_t *dm, long pages);
 int dbmap_set_deferred_writes(dbmap_t *dm, bool on);
 int dbmap_set_volatile(dbmap_t *dm, bool is_volatile);
+int dbmap_set_mmap(dbmap_t *dm, bool on);
+int dbmap_set_wal(dbmap_t *dm, bool on);
 void dbmap_set_debugging(dbmap_t *dm, const struct dbg_config *dbg);
 
 #endif	/* _dbmap_h_ */
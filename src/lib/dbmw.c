@@ -285,7 +285,7 @@ dbmw_create(dbmap_t *dm, const char *name,
 		s_debug("DBMW created \"%s\" with %s back-end "
 			"(max cached = %zu, key=%zu bytes, value=%zu bytes, "
 			"%zu max serialized)",
-			dw->name, dbmw_map_type(dw) == DBMAP_SDBM ? "sdbm" : "map",
+			dw->name, dbmap_type_to_string(dbmw_map_type(dw)),
 			dw->max_cached, dw->key_size, dw->value_size, dw->value_data_size);
 
 	return dw;
@@ -1317,7 +1317,7 @@ dbmw_destroy(dbmw_t *dw, bool close_map)
 		s_debug("DBMW destroying \"%s\" with %s back-end "
 			"(read cache hits = %.2f%% on %s request%s, "
 			"write cache hits = %.2f%% on %s request%s)",
-			dw->name, dbmw_map_type(dw) == DBMAP_SDBM ? "sdbm" : "map",
+			dw->name, dbmap_type_to_string(dbmw_map_type(dw)),
 			dw->r_hits * 100.0 / MAX(1, dw->r_access),
 			uint64_to_string(dw->r_access), plural(dw->r_access),
 			dw->w_hits * 100.0 / MAX(1, dw->w_access),
@@ -1328,7 +1328,7 @@ dbmw_destroy(dbmw_t *dw, bool close_map)
 		dbg_ds_log(dw->dbg, dw, "%s: with %s back-end "
 			"(read cache hits = %.2f%% on %s request%s, "
 			"write cache hits = %.2f%% on %s request%s)",
-			G_STRFUNC, dbmw_map_type(dw) == DBMAP_SDBM ? "sdbm" : "map",
+			G_STRFUNC, dbmap_type_to_string(dbmw_map_type(dw)),
 			dw->r_hits * 100.0 / MAX(1, dw->r_access),
 			uint64_to_string(dw->r_access), plural(dw->r_access),
 			dw->w_hits * 100.0 / MAX(1, dw->w_access),
@@ -1717,6 +1717,32 @@ dbmw_set_volatile(dbmw_t *dw, bool is_volatile)
 	return 0 == dbmap_set_volatile(dw->dm, is_volatile);
 }
 
+/**
+ * Turn in-place access of map pages through a memory mapping on or off.
+ *
+ * @return TRUE on success.
+ */
+bool
+dbmw_set_map_mmap(dbmw_t *dw, bool on)
+{
+	dbmw_check(dw);
+
+	return 0 == dbmap_set_mmap(dw->dm, on);
+}
+
+/**
+ * Turn the write-ahead log of the underlying map on or off.
+ *
+ * @return TRUE on success.
+ */
+bool
+dbmw_set_map_wal(dbmw_t *dw, bool on)
+{
+	dbmw_check(dw);
+
+	return 0 == dbmap_set_wal(dw->dm, on);
+}
+
 /**
  * Record debugging configuration.
  */
@@ -1731,7 +1757,7 @@ dbmw_set_debugging(dbmw_t *dw, const dbg_config_t *dbg)
 		dbg_ds_log(dw->dbg, dw, "%s: attached with %s back-end "
 			"(max cached = %zu, key=%zu bytes, value=%zu bytes, "
 			"%zu max serialized)", G_STRFUNC,
-			dbmw_map_type(dw) == DBMAP_SDBM ? "sdbm" : "map",
+			dbmap_type_to_string(dbmw_map_type(dw)),
 			dw->max_cached, dw->key_size, dw->value_size, dw->value_data_size);
 	}
 
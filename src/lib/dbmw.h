@@ -111,6 +111,8 @@ bool dbmw_has_ioerr(const dbmw_t *dw);
 const char *dbmw_name(const dbmw_t *dw);
 bool dbmw_set_map_cache(dbmw_t *dw, long pages);
 bool dbmw_set_volatile(dbmw_t *dw, bool is_volatile);
+bool dbmw_set_map_mmap(dbmw_t *dw, bool on);
+bool dbmw_set_map_wal(dbmw_t *dw, bool on);
 void dbmw_set_debugging(dbmw_t *dw, const struct dbg_config *dbg);
 bool dbmw_shrink(dbmw_t *dw);
 bool dbmw_rebuild(dbmw_t *dw);
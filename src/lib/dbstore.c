@@ -42,6 +42,7 @@
 #include "if/gnet_property_priv.h"
 
 #include "atoms.h"
+#include "dblog.h"
 #include "dbmap.h"
 #include "dbmw.h"
 #include "file.h"
@@ -66,7 +67,7 @@ dbstore_set_debug(unsigned level)
 }
 
 /**
- * Creates a disk database with an SDBM or memory map back-end.
+ * Creates a disk database with an SDBM, log-structured or memory map back-end.
  *
  * If we can't create the SDBM files on disk, we'll transparently use
  * an in-core version.
@@ -81,6 +82,7 @@ dbstore_set_debug(unsigned level)
  * @param hash_func			Key hash function
  * @param eq_func			Key equality test function
  * @param incore			If TRUE, use a RAM-only database
+ * @param logged			If TRUE, use a log-structured store instead of SDBM
  *
  * @return the DBMW wrapping object.
  */
@@ -88,7 +90,7 @@ static dbmw_t *
 dbstore_create_internal(const char *name, const char *dir, const char *base,
 	int flags, dbstore_kv_t kv, dbstore_packing_t packing,
 	size_t cache_size, hash_fn_t hash_func, eq_fn_t eq_func,
-	bool incore)
+	bool incore, bool logged)
 {
 	dbmap_t *dm;
 	dbmw_t *dw;
@@ -100,8 +102,13 @@ dbstore_create_internal(const char *name, const char *dir, const char *base,
 		g_assert(base != NULL);
 
 		path = make_pathname(dir, base);
-		dm = dbmap_create_sdbm(kv.key_size, kv.key_len,
-				name, path, flags, STORAGE_FILE_MODE);
+		if (logged) {
+			dm = dbmap_create_log(kv.key_size, kv.key_len,
+					name, path, flags, STORAGE_FILE_MODE, hash_func, eq_func);
+		} else {
+			dm = dbmap_create_sdbm(kv.key_size, kv.key_len,
+					name, path, flags, STORAGE_FILE_MODE, kv.page_size);
+		}
 
 		/*
 		 * For performance reasons, always use deferred writes.  Maps which
@@ -112,7 +119,8 @@ dbstore_create_internal(const char *name, const char *dir, const char *base,
 		if (dm != NULL) {
 			dbmap_set_deferred_writes(dm, TRUE);
 		} else {
-			s_warning("DBSTORE cannot open SDBM at %s for %s: %m", path, name);
+			s_warning("DBSTORE cannot open %s at %s for %s: %m",
+				logged ? "log" : "SDBM", path, name);
 		}
 		HFREE_NULL(path);
 	} else {
@@ -164,7 +172,7 @@ dbstore_create(const char *name, const char *dir, const char *base,
 	dbmw_t *dw;
 
 	dw = dbstore_create_internal(name, dir, base, O_CREAT | O_TRUNC | O_RDWR,
-			kv, packing, cache_size, hash_func, eq_func, incore);
+			kv, packing, cache_size, hash_func, eq_func, incore, FALSE);
 
 	dbmw_set_volatile(dw, TRUE);
 
@@ -199,7 +207,7 @@ dbstore_open(const char *name, const char *dir, const char *base,
 	dbmw_t *dw;
 
 	dw = dbstore_create_internal(name, dir, base, O_CREAT | O_RDWR,
-			kv, packing, cache_size, hash_func, eq_func, FALSE);
+			kv, packing, cache_size, hash_func, eq_func, FALSE, FALSE);
 
 	if (dw != NULL && dbstore_debug > 0) {
 		size_t count = dbmw_count(dw);
@@ -222,7 +230,7 @@ dbstore_open(const char *name, const char *dir, const char *base,
 		}
 
 		dram = dbstore_create_internal(name, NULL, NULL, 0,
-				kv, packing, cache_size, hash_func, eq_func, TRUE);
+				kv, packing, cache_size, hash_func, eq_func, TRUE, FALSE);
 
 		if (!dbmw_copy(dw, dram)) {
 			g_warning("DBSTORE could not load DBMW \"%s\" (%u key%s) from %s",
@@ -236,6 +244,54 @@ dbstore_open(const char *name, const char *dir, const char *base,
 	return dw;
 }
 
+/**
+ * Opens or create a disk database with a log-structured back-end.
+ *
+ * Updates are appended sequentially to segment files and only the keys
+ * are kept in memory.  This suits stores with many short-lived values,
+ * where SDBM would spend its time rewriting whole pages.
+ *
+ * If we can't access the log on disk, we'll transparently use an in-core
+ * version.  When RAM-only storage is requested, this is the same as
+ * dbstore_open(), since nothing needs to go to disk until we close.
+ *
+ * @param name				the name of the storage created, for logs
+ * @param dir				the directory where segment files will be put
+ * @param base				the base name of segment files
+ * @param kv				key/value description
+ * @param packing			key/value serialization description
+ * @param cache_size		Amount of items to cache (0 = no cache, 1 = default)
+ * @param hash_func			Key hash function
+ * @param eq_func			Key equality test function
+ * @param incore			If TRUE, load into a RAM-only database
+ *
+ * @return the DBMW wrapping object.
+ */
+dbmw_t *
+dbstore_open_log(const char *name, const char *dir, const char *base,
+	dbstore_kv_t kv, dbstore_packing_t packing,
+	size_t cache_size, hash_fn_t hash_func, eq_fn_t eq_func,
+	bool incore)
+{
+	dbmw_t *dw;
+
+	if (incore) {
+		return dbstore_open(name, dir, base, kv, packing,
+			cache_size, hash_func, eq_func, incore);
+	}
+
+	dw = dbstore_create_internal(name, dir, base, O_CREAT | O_RDWR,
+			kv, packing, cache_size, hash_func, eq_func, FALSE, TRUE);
+
+	if (dw != NULL && dbstore_debug > 0) {
+		size_t count = dbmw_count(dw);
+		g_debug("DBSTORE opened DBMW \"%s\" (%u key%s) from %s log",
+			dbmw_name(dw), (unsigned) count, plural(count), base);
+	}
+
+	return dw;
+}
+
 /**
  * Synchronize a DBMW database, flushing its SDBM cache.
  */
@@ -386,7 +442,7 @@ dbstore_move_file(const char *old_path, const char *new_path, const char *ext)
 }
 
 /**
- * Move SDBM files from "src" to "dst".
+ * Move SDBM files and log segments from "src" to "dst".
  *
  * @param src				the old directory where SDBM files where
  * @param dst				the new directory where SDBM files should be put
@@ -404,6 +460,7 @@ dbstore_move(const char *src, const char *dst, const char *base)
 	dbstore_move_file(old_path, new_path, DBM_DIRFEXT);
 	dbstore_move_file(old_path, new_path, DBM_PAGFEXT);
 	dbstore_move_file(old_path, new_path, DBM_DATFEXT);
+	dblog_move(old_path, new_path);
 
 	HFREE_NULL(old_path);
 	HFREE_NULL(new_path);
@@ -424,7 +481,7 @@ dbstore_unlink_file(const char *path, const char *ext)
 }
 
 /**
- * Remove SDBM files from "dir".
+ * Remove SDBM files and log segments from "dir".
  *
  * @param dir				the directory where SDBM files are stored
  * @param base				the base name of SDBM files
@@ -439,6 +496,7 @@ dbstore_unlink(const char *dir, const char *base)
 	dbstore_unlink_file(path, DBM_DIRFEXT);
 	dbstore_unlink_file(path, DBM_PAGFEXT);
 	dbstore_unlink_file(path, DBM_DATFEXT);
+	dblog_unlink(path);
 
 	HFREE_NULL(path);
 }
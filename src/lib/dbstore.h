@@ -52,6 +52,7 @@ typedef struct dbstore_kv {
 	dbmap_keylen_t key_len;		/**< Optional, computes serialized key length */
 	size_t value_size;			/**< Maximum value size, (bytes, structure) */
 	size_t value_data_size;		/**< Maximum value size, (bytes, serialized) */
+	long page_size;				/**< SDBM page size, 0 for the default */
 } dbstore_kv_t;
 
 /**
@@ -63,6 +64,15 @@ typedef struct dbstore_packing {
 	dbmw_free_t valfree;		/**< Free allocated deserialization data */
 } dbstore_packing_t;
 
+/**
+ * Signature of the routines opening a persistent database.
+ */
+typedef dbmw_t *(*dbstore_open_t)(const char *name,
+	const char *dir, const char *base,
+	dbstore_kv_t kv, dbstore_packing_t packing,
+	size_t cache_size, hash_fn_t hash_func, eq_fn_t eq_func,
+	bool incore);
+
 /*
  * Public interface.
  */
@@ -79,6 +89,11 @@ dbmw_t *dbstore_open(const char *name, const char *dir, const char *base,
 	size_t cache_size, hash_fn_t hash_func, eq_fn_t eq_func,
 	bool incore);
 
+dbmw_t *dbstore_open_log(const char *name, const char *dir, const char *base,
+	dbstore_kv_t kv, dbstore_packing_t packing,
+	size_t cache_size, hash_fn_t hash_func, eq_fn_t eq_func,
+	bool incore);
+
 void dbstore_sync(dbmw_t *dw);
 void dbstore_flush(dbmw_t *dw);
 void dbstore_sync_flush(dbmw_t *dw);
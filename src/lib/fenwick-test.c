@@ -0,0 +1,222 @@
+/*
+ * fenwick-test -- Fenwick tree tests.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/fenwick.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/xmalloc.h"
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c items] [-n loops] [-R seed]\n"
+		"  -c : sets item count to test\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of loops\n"
+		"  -R : seed for repeatable random key sequence\n"
+		"  -V : verbose mode\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, size_t i)
+{
+	printf("%s failed at index %zu\n", what, i);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+/**
+ * Check tree against the plain values it is supposed to hold.
+ */
+static void
+fenwick_verify(const fenwick_t *ft, const int64 *values, size_t n)
+{
+	int64 sum = 0;
+	size_t i;
+
+	if (fenwick_size(ft) != n)
+		test_abort("size", n);
+
+	for (i = 0; i < n; i++) {
+		sum += values[i];
+		if (fenwick_get(ft, i) != values[i])
+			test_abort("get", i);
+		if (fenwick_prefix(ft, i) != sum)
+			test_abort("prefix", i);
+	}
+
+	if (fenwick_total(ft) != sum)
+		test_abort("total", n);
+}
+
+/**
+ * Check order statistics on a tree holding only 0 or 1 values.
+ */
+static void
+fenwick_verify_select(const fenwick_t *ft, const int64 *values, size_t n)
+{
+	int64 rank = 0;
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (0 == values[i])
+			continue;
+		if (fenwick_select(ft, ++rank) != i)
+			test_abort("select", i);
+	}
+
+	if (fenwick_select(ft, rank + 1) != n)
+		test_abort("select past end", n);
+}
+
+static void
+fenwick_test(size_t n, size_t loops)
+{
+	fenwick_t *ft;
+	int64 *values;
+	size_t i, m;
+
+	XMALLOC0_ARRAY(values, 2 * n + 1);
+	ft = fenwick_make(n);
+
+	for (i = 0; i < loops; i++) {
+		size_t j = rand31_value(n - 1);
+		int64 delta = (int64) rand31_value(200) - 100;
+
+		values[j] += delta;
+		fenwick_add(ft, j, delta);
+	}
+
+	fenwick_verify(ft, values, n);
+
+	/*
+	 * Growing then shrinking must preserve values.
+	 */
+
+	fenwick_resize(ft, 2 * n + 1);
+	fenwick_verify(ft, values, 2 * n + 1);
+	m = n / 2 + 1;
+	fenwick_resize(ft, m);
+	fenwick_verify(ft, values, m);
+
+	/*
+	 * Order statistics, on presence flags.
+	 */
+
+	fenwick_clear(ft);
+	fenwick_resize(ft, n);
+
+	for (i = 0; i < n; i++) {
+		values[i] = rand31_value(1);
+		if (values[i] != 0)
+			fenwick_add(ft, i, 1);
+	}
+
+	fenwick_verify(ft, values, n);
+	fenwick_verify_select(ft, values, n);
+
+	for (i = 0; i < loops; i++) {
+		size_t j = rand31_value(n - 1);
+
+		fenwick_add(ft, j, values[j] != 0 ? -1 : +1);
+		values[j] = !values[j];
+	}
+
+	fenwick_verify(ft, values, n);
+	fenwick_verify_select(ft, values, n);
+
+	if (verbose_mode)
+		printf("fenwick: %zu items, %zu loops: OK\n", n, loops);
+
+	fenwick_free_null(&ft);
+	XFREE_NULL(values);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 5000;
+	size_t loops = 100000;
+	unsigned rseed = 0;
+	size_t n;
+	int c;
+	const char options[] = "c:hn:R:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of items */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || count < 2)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	for (n = 2; n <= count; n = n * 3 / 2 + 1)
+		fenwick_test(n, loops / 10 + 1);
+	fenwick_test(count, loops);
+	printf("All tests passed.\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
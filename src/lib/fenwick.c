@@ -0,0 +1,294 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Fenwick trees (binary indexed trees).
+ *
+ * A Fenwick tree holds an array of n values and maintains their prefix sums
+ * so that updating a value or computing the sum of the first i values are
+ * both O(log n) operations.
+ *
+ * When values are non-negative, the tree also supports order statistics in
+ * O(log n): fenwick_select() finds the first index at which the prefix sum
+ * reaches a given amount.  With values restricted to 0 or 1, flagging the
+ * presence of an item in a slot, this gives the rank of an item among the
+ * present ones (its prefix sum) and the item at a given rank (the selected
+ * slot), which is what ordered queues need to maintain positions without
+ * renumbering all the items following a removal.
+ *
+ * Indices given to the interface are 0-based.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "fenwick.h"
+
+#include "halloc.h"
+#include "pow2.h"
+#include "walloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+enum fenwick_magic { FENWICK_MAGIC = 0x3d1e27a5 };
+
+/**
+ * A Fenwick tree.
+ *
+ * The tree[] array is 1-based: tree[0] is unused and tree[i] holds the sum
+ * of the values in the range (i - lowbit(i), i].
+ */
+struct fenwick {
+	enum fenwick_magic magic;
+	size_t n;				/**< Amount of values held */
+	int64 *tree;			/**< Partial sums, n + 1 entries */
+};
+
+static inline void
+fenwick_check(const struct fenwick * const ft)
+{
+	g_assert(ft != NULL);
+	g_assert(FENWICK_MAGIC == ft->magic);
+	g_assert(ft->tree != NULL);
+}
+
+#define FENWICK_LOWBIT(i)	((i) & -(i))
+
+/**
+ * Create a new Fenwick tree holding n values, all initialized to 0.
+ *
+ * @param n		amount of values in the tree
+ *
+ * @return the new tree.
+ */
+fenwick_t *
+fenwick_make(size_t n)
+{
+	fenwick_t *ft;
+
+	WALLOC0(ft);
+	ft->magic = FENWICK_MAGIC;
+	ft->n = n;
+	HALLOC0_ARRAY(ft->tree, n + 1);
+
+	return ft;
+}
+
+/**
+ * Free Fenwick tree and nullify its pointer.
+ */
+void
+fenwick_free_null(fenwick_t **ft_ptr)
+{
+	fenwick_t *ft = *ft_ptr;
+
+	if (ft != NULL) {
+		fenwick_check(ft);
+		HFREE_NULL(ft->tree);
+		ft->magic = 0;
+		WFREE(ft);
+		*ft_ptr = NULL;
+	}
+}
+
+/**
+ * @return the amount of values held in the tree.
+ */
+size_t
+fenwick_size(const fenwick_t *ft)
+{
+	fenwick_check(ft);
+
+	return ft->n;
+}
+
+/**
+ * Reset all the values of the tree to 0.
+ */
+void
+fenwick_clear(fenwick_t *ft)
+{
+	fenwick_check(ft);
+
+	memset(ft->tree, 0, (ft->n + 1) * sizeof ft->tree[0]);
+}
+
+/**
+ * Resize the tree to hold n values.
+ *
+ * Existing values are preserved up to the new size, new values are set to 0.
+ * This is an O(n) operation.
+ */
+void
+fenwick_resize(fenwick_t *ft, size_t n)
+{
+	size_t i;
+
+	fenwick_check(ft);
+
+	if (n == ft->n)
+		return;
+
+	/*
+	 * Turn the partial sums back into plain values, reversing the linear
+	 * construction below, so that we can extend or truncate the array.
+	 */
+
+	for (i = ft->n; i != 0; i--) {
+		size_t j = i + FENWICK_LOWBIT(i);
+
+		if (j <= ft->n)
+			ft->tree[j] -= ft->tree[i];
+	}
+
+	HREALLOC_ARRAY(ft->tree, n + 1);
+
+	if (n > ft->n)
+		memset(&ft->tree[ft->n + 1], 0, (n - ft->n) * sizeof ft->tree[0]);
+
+	ft->n = n;
+
+	/*
+	 * Linear construction of the partial sums from the values.
+	 */
+
+	for (i = 1; i <= n; i++) {
+		size_t j = i + FENWICK_LOWBIT(i);
+
+		if (j <= n)
+			ft->tree[j] += ft->tree[i];
+	}
+}
+
+/**
+ * Add delta to the value at index i.
+ */
+void
+fenwick_add(fenwick_t *ft, size_t i, int64 delta)
+{
+	fenwick_check(ft);
+	g_assert_log(i < ft->n, "%s(): i=%zu, n=%zu", G_STRFUNC, i, ft->n);
+
+	for (i++; i <= ft->n; i += FENWICK_LOWBIT(i))
+		ft->tree[i] += delta;
+}
+
+/**
+ * @return the sum of the values at indices 0 to i, inclusive.
+ */
+int64
+fenwick_prefix(const fenwick_t *ft, size_t i)
+{
+	int64 sum = 0;
+
+	fenwick_check(ft);
+	g_assert_log(i < ft->n, "%s(): i=%zu, n=%zu", G_STRFUNC, i, ft->n);
+
+	for (i++; i != 0; i -= FENWICK_LOWBIT(i))
+		sum += ft->tree[i];
+
+	return sum;
+}
+
+/**
+ * @return the value at index i.
+ */
+int64
+fenwick_get(const fenwick_t *ft, size_t i)
+{
+	int64 value;
+	size_t stop;
+
+	fenwick_check(ft);
+	g_assert_log(i < ft->n, "%s(): i=%zu, n=%zu", G_STRFUNC, i, ft->n);
+
+	/*
+	 * The value is tree[i] minus the sums of the ranges it covers, which
+	 * are reached by walking down from i - 1 until we reach the start of
+	 * the range covered by tree[i].
+	 */
+
+	i++;
+	value = ft->tree[i];
+	stop = i - FENWICK_LOWBIT(i);
+
+	for (i--; i != stop; i -= FENWICK_LOWBIT(i))
+		value -= ft->tree[i];
+
+	return value;
+}
+
+/**
+ * @return the sum of all the values in the tree.
+ */
+int64
+fenwick_total(const fenwick_t *ft)
+{
+	fenwick_check(ft);
+
+	return 0 == ft->n ? 0 : fenwick_prefix(ft, ft->n - 1);
+}
+
+/**
+ * Find the smallest index at which the prefix sum reaches k.
+ *
+ * All the values in the tree must be non-negative for this to work, since
+ * we rely on the prefix sums being monotonically increasing.  When values
+ * are 0 or 1, this returns the index of the k-th present item.
+ *
+ * @param ft	the Fenwick tree
+ * @param k		the prefix sum to reach, must be positive
+ *
+ * @return the index, or the size of the tree if the total is less than k.
+ */
+size_t
+fenwick_select(const fenwick_t *ft, int64 k)
+{
+	size_t pos = 0, step;
+
+	fenwick_check(ft);
+	g_assert(k > 0);
+
+	if (0 == ft->n)
+		return 0;
+
+	step = (size_t) 1 << highest_bit_set64(ft->n);
+
+	for (/* empty */; step != 0; step >>= 1) {
+		size_t next = pos + step;
+
+		if (next <= ft->n && ft->tree[next] < k) {
+			pos = next;
+			k -= ft->tree[next];
+		}
+	}
+
+	return pos;		/* 1-based index of the match is pos + 1 */
+}
+
+/* vi: set ts=4 sw=4 cindent: */
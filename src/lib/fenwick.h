@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Fenwick trees (binary indexed trees).
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _fenwick_h_
+#define _fenwick_h_
+
+#include "common.h"
+
+struct fenwick;
+typedef struct fenwick fenwick_t;
+
+/*
+ * Public interface.
+ */
+
+fenwick_t *fenwick_make(size_t n);
+void fenwick_free_null(fenwick_t **ft_ptr);
+size_t fenwick_size(const fenwick_t *ft);
+void fenwick_resize(fenwick_t *ft, size_t n);
+void fenwick_clear(fenwick_t *ft);
+void fenwick_add(fenwick_t *ft, size_t i, int64 delta);
+int64 fenwick_prefix(const fenwick_t *ft, size_t i);
+int64 fenwick_get(const fenwick_t *ft, size_t i);
+int64 fenwick_total(const fenwick_t *ft);
+size_t fenwick_select(const fenwick_t *ft, int64 k);
+
+#endif	/* _fenwick_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,343 @@
+/*
+ * htb-test -- hierarchical token bucket tests.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/htb.h"
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/xmalloc.h"
+
+#define QUANTUM		10000
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-c classes] [-n periods] [-R seed]\n"
+		"  -c : sets amount of leaf classes for random test\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of periods for random test\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -V : verbose mode\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, int64 got, int64 expected)
+{
+	printf("%s failed: got %'" PRId64 ", expected %'" PRId64 "\n",
+		what, got, expected);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static void
+test_expect(const char *what, int64 got, int64 expected)
+{
+	if (got != expected)
+		test_abort(what, got, expected);
+}
+
+/**
+ * Consume as much as possible from class, up to `len'.
+ */
+static int64
+drain(htb_class_t *c, int64 len)
+{
+	int64 n = htb_available(c, len);
+
+	htb_consume(c, n);
+	return n;
+}
+
+/**
+ * Use all the tokens left to the class, regardless of the root.
+ */
+static void
+use_all(htb_class_t *c)
+{
+	htb_consume(c, MAX(0, htb_tokens(c)));
+}
+
+/**
+ * Leaves share the quantum evenly, and idle shares can be borrowed.
+ */
+static void
+htb_test_share(void)
+{
+	htb_class_t *root, *a, *b;
+
+	root = htb_root_make();
+	a = htb_class_make(root);
+	b = htb_class_make(root);
+
+	test_expect("children", htb_children(root), 2);
+
+	/* First period: nobody was active before, first comer gets it all */
+	htb_root_refill(root, QUANTUM);
+	test_expect("first period a", drain(a, QUANTUM), QUANTUM);
+	test_expect("first period b", drain(b, QUANTUM), 0);
+
+	/* Second period: both were active, b gets credit for being starved */
+	htb_root_refill(root, QUANTUM);
+	test_expect("fair a", htb_tokens(a), QUANTUM / 2);
+	test_expect("credit b", htb_tokens(b), QUANTUM);
+	test_expect("drain a", drain(a, QUANTUM), QUANTUM / 2);
+	test_expect("drain b", drain(b, QUANTUM), QUANTUM / 2);
+	test_expect("left b", htb_tokens(b), QUANTUM / 2);
+	test_expect("root empty", htb_tokens(root), 0);
+
+	/* Third period: b idle, its share can be borrowed by a */
+	htb_root_refill(root, QUANTUM);
+	test_expect("borrow a", drain(a, QUANTUM), QUANTUM);
+	test_expect("borrow b", drain(b, QUANTUM), 0);
+
+	htb_class_free_null(&a);
+	htb_class_free_null(&b);
+	test_expect("freed", htb_children(root), 0);
+	htb_class_free_null(&root);
+
+	if (verbose_mode)
+		printf("htb: fair share and borrowing: OK\n");
+}
+
+/**
+ * Unused tokens are carried over, up to one share, but never beyond what
+ * the root can give.
+ */
+static void
+htb_test_carry(void)
+{
+	htb_class_t *root, *a, *b;
+	int64 share = QUANTUM / 2, ta, tb, ua, ub;
+
+	root = htb_root_make();
+	a = htb_class_make(root);
+	b = htb_class_make(root);
+
+	htb_root_refill(root, QUANTUM);
+	use_all(a);
+	use_all(b);
+
+	/* Both active, each uses only a fraction of what it has */
+	htb_root_refill(root, QUANTUM);
+	ta = htb_tokens(a);
+	tb = htb_tokens(b);
+	test_expect("share a", ta, share);
+	test_expect("share b", tb, share);
+	ua = drain(a, share / 4);
+	ub = drain(b, share * 3 / 4);
+
+	htb_root_refill(root, QUANTUM);
+	test_expect("carry a", htb_tokens(a), share + (ta - ua));
+	test_expect("carry b", htb_tokens(b), share + (tb - ub));
+
+	/* Carry-over is capped at one share */
+	htb_root_refill(root, QUANTUM);
+	test_expect("cap a", htb_tokens(a), 2 * share);
+
+	/* And the root still limits what can be consumed */
+	test_expect("root limit a", drain(a, QUANTUM * 2), QUANTUM);
+	test_expect("root limit b", drain(b, QUANTUM), 0);
+	test_expect("overdraft a", htb_tokens(a), 2 * share - QUANTUM);
+
+	htb_class_free_null(&a);
+	htb_class_free_null(&b);
+	htb_class_free_null(&root);
+
+	if (verbose_mode)
+		printf("htb: carry-over: OK\n");
+}
+
+/**
+ * Sub-classes share their parent tokens, and their parent competes with
+ * its siblings.
+ */
+static void
+htb_test_hierarchy(void)
+{
+	htb_class_t *root, *net1, *net2, *h1, *h2, *h3;
+
+	root = htb_root_make();
+	net1 = htb_class_make(root);
+	net2 = htb_class_make(root);
+	h1 = htb_class_make(net1);
+	h2 = htb_class_make(net1);
+	h3 = htb_class_make(net2);
+
+	htb_root_refill(root, QUANTUM);
+	use_all(h1);
+	use_all(h2);
+	use_all(h3);
+
+	/* Two hosts in net1 share half of the bandwidth, h3 gets the other half */
+	htb_root_refill(root, QUANTUM);
+	htb_tokens(h1);
+	htb_tokens(h2);
+	htb_tokens(h3);
+	test_expect("h1", htb_available(h1, QUANTUM), QUANTUM / 4);
+	test_expect("h2", htb_available(h2, QUANTUM), QUANTUM / 4);
+	test_expect("h3", htb_available(h3, QUANTUM), QUANTUM / 2);
+
+	/* Once h3 has drained net2, h1 cannot borrow what h2 reserved */
+	test_expect("drain h3", drain(h3, QUANTUM), QUANTUM / 2);
+	test_expect("drain h1", drain(h1, QUANTUM), QUANTUM / 4);
+	test_expect("h2 left", htb_available(h2, QUANTUM), QUANTUM / 4);
+
+	/* Freeing h2 releases its reserved tokens to h1 */
+	htb_class_free_null(&h2);
+	test_expect("net1 children", htb_children(net1), 1);
+	test_expect("after free h1", drain(h1, QUANTUM), QUANTUM / 4);
+	test_expect("root drained", htb_tokens(root), 0);
+
+	htb_class_free_null(&h1);
+	htb_class_free_null(&h3);
+	htb_class_free_null(&net1);
+	htb_class_free_null(&net2);
+	htb_class_free_null(&root);
+
+	if (verbose_mode)
+		printf("htb: hierarchy: OK\n");
+}
+
+/**
+ * Random consumption never lets the root be overspent.
+ */
+static void
+htb_test_random(size_t count, size_t periods)
+{
+	htb_class_t *root, **nets, **leaves;
+	size_t i, nnets = count / 8 + 1;
+
+	XMALLOC0_ARRAY(nets, nnets);
+	XMALLOC0_ARRAY(leaves, count);
+
+	root = htb_root_make();
+	for (i = 0; i < nnets; i++)
+		nets[i] = htb_class_make(root);
+	for (i = 0; i < count; i++)
+		leaves[i] = htb_class_make(nets[rand31_value(nnets - 1)]);
+
+	for (i = 0; i < periods; i++) {
+		int64 quantum = rand31_value(QUANTUM * 10), used = 0;
+		size_t j;
+
+		htb_root_refill(root, quantum);
+
+		for (j = 0; j < count; j++) {
+			htb_class_t *c = leaves[rand31_value(count - 1)];
+			int64 want = rand31_value(QUANTUM);
+			int64 n = htb_available(c, want);
+
+			if (n < 0 || n > want)
+				test_abort("available bounds", n, want);
+
+			htb_consume(c, n);
+			used += n;
+		}
+
+		if (used > quantum)
+			test_abort("root overspent", used, quantum);
+
+		test_expect("root tokens", htb_tokens(root), quantum - used);
+	}
+
+	for (i = 0; i < count; i++)
+		htb_class_free_null(&leaves[i]);
+	for (i = 0; i < nnets; i++)
+		htb_class_free_null(&nets[i]);
+	htb_class_free_null(&root);
+
+	XFREE_NULL(nets);
+	XFREE_NULL(leaves);
+
+	if (verbose_mode)
+		printf("htb: %zu classes, %zu periods: OK\n", count, periods);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 500;
+	size_t periods = 1000;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "c:hn:R:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'c':			/* amount of classes */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of periods */
+			periods = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || count < 2)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	htb_test_share();
+	htb_test_carry();
+	htb_test_hierarchy();
+	htb_test_random(count, periods);
+
+	printf("All tests passed.\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
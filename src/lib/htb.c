@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Hierarchical token buckets.
+ *
+ * Classes are organized as a tree.  At the beginning of each period, the
+ * root class is given a quantum of tokens.  Each class then receives, the
+ * first time it is used during the period, a fair share of the tokens its
+ * parent received: the parent quantum divided by the amount of children
+ * that were active during the previous period (or the amount of children
+ * active so far during this period if larger).
+ *
+ * A class whose share is exhausted can borrow the tokens of its parent that
+ * were not handed out to active children, which is how bandwidth left unused
+ * by idle classes gets redistributed.  Unused tokens are carried over to the
+ * next period, up to one share, so that a class which could not use its
+ * share (for instance because the kernel flow-controlled it) gets some
+ * credit back.
+ *
+ * Refilling is done lazily, when classes are used, so starting a new period
+ * is O(1) and so are admission and consumption, for a bounded depth.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "htb.h"
+
+#include "walloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+enum htb_class_magic { HTB_CLASS_MAGIC = 0x1c8e5f27 };
+
+/**
+ * A traffic class.
+ */
+struct htb_class {
+	enum htb_class_magic magic;
+	struct htb_class *parent;	/**< Parent class, NULL for the root */
+	struct htb_class *root;		/**< Root of the hierarchy */
+	uint64 period;				/**< Period of last refill */
+	int64 tokens;				/**< Tokens left for period, can be negative */
+	int64 share;				/**< Fair share received at last refill */
+	int64 quantum;				/**< Tokens received at last refill */
+	int64 reserved;				/**< Unused tokens of refilled children */
+	uint children;				/**< Amount of child classes */
+	uint active;				/**< Children refilled this period */
+	uint active_last;			/**< Children refilled last period */
+};
+
+static inline void
+htb_class_check(const struct htb_class * const c)
+{
+	g_assert(c != NULL);
+	g_assert(HTB_CLASS_MAGIC == c->magic);
+}
+
+/**
+ * Create a new root class.
+ *
+ * The root class gets no tokens until htb_root_refill() is called.
+ */
+htb_class_t *
+htb_root_make(void)
+{
+	htb_class_t *c;
+
+	WALLOC0(c);
+	c->magic = HTB_CLASS_MAGIC;
+	c->root = c;
+
+	return c;
+}
+
+/**
+ * Create a new class, child of the given parent.
+ */
+htb_class_t *
+htb_class_make(htb_class_t *parent)
+{
+	htb_class_t *c;
+
+	htb_class_check(parent);
+
+	WALLOC0(c);
+	c->magic = HTB_CLASS_MAGIC;
+	c->parent = parent;
+	c->root = parent->root;
+	parent->children++;
+
+	return c;
+}
+
+/**
+ * Free class and nullify its pointer.
+ *
+ * The class must no longer have any children.
+ */
+void
+htb_class_free_null(htb_class_t **c_ptr)
+{
+	htb_class_t *c = *c_ptr;
+
+	if (c != NULL) {
+		htb_class_t *p = c->parent;
+
+		htb_class_check(c);
+		g_assert_log(0 == c->children,
+			"%s(): class still has %u children", G_STRFUNC, c->children);
+
+		/*
+		 * Release the unused tokens we reserved in our parent for this period.
+		 */
+
+		if (p != NULL) {
+			g_assert(p->children != 0);
+			p->children--;
+			if (c->period == c->root->period && c->tokens > 0)
+				p->reserved -= c->tokens;
+		}
+
+		c->magic = 0;
+		WFREE(c);
+		*c_ptr = NULL;
+	}
+}
+
+/**
+ * Begin a new period, giving a new quantum of tokens to the root class.
+ *
+ * Tokens left from the previous period are not carried over at the root
+ * level: they are lost.
+ */
+void
+htb_root_refill(htb_class_t *root, int64 quantum)
+{
+	htb_class_check(root);
+	g_assert(NULL == root->parent);
+	g_assert(quantum >= 0);
+
+	root->period++;
+	root->tokens = root->quantum = root->share = quantum;
+	root->reserved = 0;
+	root->active_last = root->active;
+	root->active = 0;
+}
+
+/**
+ * Refill class with its fair share if not already done for this period.
+ */
+static void
+htb_refresh(htb_class_t *c)
+{
+	htb_class_t *p = c->parent;
+	int64 carry;
+	uint n;
+
+	if (NULL == p || c->period == c->root->period)
+		return;
+
+	htb_refresh(p);
+
+	/*
+	 * Split the tokens our parent received among the children which were
+	 * active last period, and at least among all those active so far.
+	 */
+
+	n = MAX(p->active_last, p->active + 1);
+	c->share = p->quantum / n;
+
+	carry = c->tokens > 0 ? MIN(c->tokens, c->share) : 0;
+	c->tokens = c->quantum = c->share + carry;
+
+	c->period = c->root->period;
+	c->reserved = 0;
+	c->active_last = c->active;
+	c->active = 0;
+
+	p->active++;
+	p->reserved += c->tokens;
+}
+
+/**
+ * Compute how many tokens a class can use.
+ *
+ * The class can use its own tokens, and borrow from its parent the tokens
+ * that were not reserved by the other active children, recursively.  The
+ * amount is always limited by the tokens left at the root.
+ *
+ * @param c		the class wishing to consume tokens
+ * @param len	the amount of tokens wanted
+ *
+ * @return the amount of tokens that can be consumed, at most `len'.
+ */
+int64
+htb_available(htb_class_t *c, int64 len)
+{
+	int64 grant = len;
+	htb_class_t *x;
+
+	htb_class_check(c);
+	g_assert(len >= 0);
+
+	htb_refresh(c);
+
+	for (x = c; x->parent != NULL; x = x->parent) {
+		int64 own = MAX(0, x->tokens);
+
+		if (own < grant) {
+			const htb_class_t *p = x->parent;
+			int64 spare = p->tokens - p->reserved;
+
+			grant = MIN(grant, own + MAX(0, spare));
+		}
+	}
+
+	g_assert(x == c->root);
+
+	grant = MIN(grant, MAX(0, x->tokens));
+
+	return grant;
+}
+
+/**
+ * Record that a class consumed tokens.
+ *
+ * The amount is also taken from all the ancestors of the class.
+ */
+void
+htb_consume(htb_class_t *c, int64 amount)
+{
+	htb_class_t *x;
+
+	htb_class_check(c);
+	g_assert(amount >= 0);
+
+	htb_refresh(c);
+
+	for (x = c; x != NULL; x = x->parent) {
+		int64 before = MAX(0, x->tokens);
+
+		x->tokens -= amount;
+
+		if (x->parent != NULL)
+			x->parent->reserved -= before - MAX(0, x->tokens);
+	}
+}
+
+/**
+ * @return the amount of tokens left to the class for the current period.
+ */
+int64
+htb_tokens(htb_class_t *c)
+{
+	htb_class_check(c);
+
+	htb_refresh(c);
+	return c->tokens;
+}
+
+/**
+ * @return the amount of children of the class.
+ */
+uint
+htb_children(const htb_class_t *c)
+{
+	htb_class_check(c);
+
+	return c->children;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Hierarchical token buckets.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _htb_h_
+#define _htb_h_
+
+#include "common.h"
+
+struct htb_class;
+typedef struct htb_class htb_class_t;
+
+/*
+ * Public interface.
+ */
+
+htb_class_t *htb_root_make(void);
+htb_class_t *htb_class_make(htb_class_t *parent);
+void htb_class_free_null(htb_class_t **c_ptr);
+void htb_root_refill(htb_class_t *root, int64 quantum);
+int64 htb_available(htb_class_t *c, int64 len);
+void htb_consume(htb_class_t *c, int64 amount);
+int64 htb_tokens(htb_class_t *c);
+uint htb_children(const htb_class_t *c);
+
+#endif	/* _htb_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
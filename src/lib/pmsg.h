@@ -102,6 +102,16 @@ pdata_addref(pdata_t *pd)
 	pd->d_refcnt++;
 }
 
+/**
+ * @return whether the data buffer is not shared and can be written to.
+ */
+static inline bool
+pdata_is_writable(const pdata_t *pd)
+{
+	pdata_check(pd);
+	return 1 == pd->d_refcnt;
+}
+
 /*
  * A message block
  */
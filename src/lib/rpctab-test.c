@@ -0,0 +1,404 @@
+/*
+ * rpctab-test -- pending RPC table tests.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/atomic.h"
+#include "lib/endian.h"
+#include "lib/host_addr.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/rpctab.h"
+#include "lib/stacktrace.h"
+#include "lib/thread.h"
+#include "lib/xmalloc.h"
+
+#define PERIOD		100			/* Tick period, in ms */
+#define DELAY_MAX	10000		/* Maximum RPC delay, in ms */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+static uint now;				/* Ticks performed so far */
+
+/**
+ * Reference copy of an RPC registered in the table.
+ */
+struct rpc {
+	char muid[GUID_RAW_SIZE];
+	host_addr_t addr;
+	uint expire;				/* Tick at which RPC must expire */
+	bool present;				/* Whether RPC is in the table */
+	bool linger;				/* Re-insert on first expiration */
+	bool expired;				/* Whether expiration callback fired */
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-n count] [-R seed] [-t threads]\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of RPCs\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -t : sets amount of concurrent threads\n"
+		"  -V : verbose mode\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, size_t idx)
+{
+	printf("%s failed for RPC #%zu at tick %u\n", what, idx, now);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static inline const struct guid *
+rpc_muid(const struct rpc *r)
+{
+	return (const struct guid *) r->muid;
+}
+
+static struct rpc *rpcs;
+static rpctab_t *table;
+
+static void
+rpc_expired(void *value, void *unused_data)
+{
+	struct rpc *r = value;
+	size_t idx = r - rpcs;
+
+	(void) unused_data;
+
+	if (!r->present)
+		test_abort("spurious expiration", idx);
+	if (r->expire != now)
+		test_abort("expiration tick", idx);
+	if (rpctab_contains(table, rpc_muid(r), r->addr))
+		test_abort("removal before expiration", idx);
+
+	/*
+	 * Lingering RPCs are re-inserted from the callback, as the DHT does.
+	 */
+
+	if (r->linger) {
+		int delay = rand31_value(DELAY_MAX);
+
+		r->linger = FALSE;
+		if (!rpctab_insert(table, rpc_muid(r), r->addr, r, delay))
+			test_abort("re-insertion", idx);
+		r->expire = now + delay / PERIOD + 1;
+		return;
+	}
+
+	r->present = FALSE;
+	r->expired = TRUE;
+}
+
+static void
+rpc_count(void *value, void *data)
+{
+	struct rpc *r = value;
+	size_t *cnt = data;
+
+	if (!r->present)
+		test_abort("iteration", r - rpcs);
+
+	(*cnt)++;
+}
+
+/**
+ * Check table contents against the reference.
+ */
+static void
+check(size_t count)
+{
+	size_t i, n = 0, seen = 0;
+
+	for (i = 0; i < count; i++) {
+		struct rpc *r = &rpcs[i];
+		void *v = rpctab_lookup(table, rpc_muid(r), r->addr);
+		int remain;
+
+		if (!r->present) {
+			if (v != NULL)
+				test_abort("absence", i);
+			if (-1 != rpctab_remaining(table, rpc_muid(r), r->addr))
+				test_abort("absent remaining", i);
+			continue;
+		}
+
+		n++;
+
+		if (v != r)
+			test_abort("lookup", i);
+
+		remain = rpctab_remaining(table, rpc_muid(r), r->addr);
+		if (remain != (int) (r->expire - now) * PERIOD)
+			test_abort("remaining", i);
+	}
+
+	if (n != rpctab_count(table))
+		test_abort("count", n);
+
+	rpctab_foreach(table, rpc_count, &seen);
+	if (seen != n)
+		test_abort("foreach", seen);
+}
+
+static void
+rpctab_test(size_t count)
+{
+	size_t i, ticks = 0;
+
+	XMALLOC0_ARRAY(rpcs, count);
+	table = rpctab_make(PERIOD, rpc_expired, NULL);
+
+	/*
+	 * Odd RPCs share the MUID of the previous one but target another
+	 * address, some even ones using a zero address.
+	 */
+
+	for (i = 0; i < count; i++) {
+		struct rpc *r = &rpcs[i];
+		int delay = rand31_value(DELAY_MAX);
+
+		if (i & 1)
+			memcpy(r->muid, rpcs[i - 1].muid, sizeof r->muid);
+		else
+			rand31_bytes(r->muid, sizeof r->muid);
+
+		r->addr = (0 == (i & 1) && 0 == rand31_value(3)) ?
+			zero_host_addr : host_addr_get_ipv4(rand31_u32() | 1);
+		r->linger = 0 == rand31_value(4);
+
+		if (!rpctab_insert(table, rpc_muid(r), r->addr, r, delay))
+			test_abort("insertion", i);
+		if (rpctab_insert(table, rpc_muid(r), r->addr, r, delay))
+			test_abort("duplicate insertion", i);
+
+		r->present = TRUE;
+		r->expire = now + delay / PERIOD + 1;
+	}
+
+	check(count);
+
+	/*
+	 * Remove or reschedule some of the RPCs.
+	 */
+
+	for (i = 0; i < count; i++) {
+		struct rpc *r = &rpcs[i];
+
+		switch (rand31_value(5)) {
+		case 0:
+			if (rpctab_remove(table, rpc_muid(r), r->addr) != r)
+				test_abort("removal", i);
+			if (rpctab_remove(table, rpc_muid(r), r->addr) != NULL)
+				test_abort("second removal", i);
+			r->present = FALSE;
+			break;
+		case 1:
+			{
+				int delay = rand31_value(DELAY_MAX);
+
+				if (!rpctab_reschedule(table, rpc_muid(r), r->addr, delay))
+					test_abort("rescheduling", i);
+				r->expire = now + delay / PERIOD + 1;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	check(count);
+
+	/*
+	 * Run the clock until everything has expired.
+	 */
+
+	while (0 != rpctab_count(table)) {
+		now++;
+		rpctab_tick(table);
+		if (0 == (++ticks % 10))
+			check(count);
+		if (ticks > 3 * (DELAY_MAX / PERIOD))
+			test_abort("expiration", ticks);
+	}
+
+	check(count);
+
+	if (verbose_mode)
+		printf("%zu RPCs all expired after %zu ticks\n", count, ticks);
+
+	rpctab_free_null(&table);
+	XFREE_NULL(rpcs);
+}
+
+static uint thread_expired;
+
+static void
+thread_rpc_expired(void *value, void *unused_data)
+{
+	(void) value;
+	(void) unused_data;
+
+	atomic_uint_inc(&thread_expired);
+}
+
+/**
+ * Thread hammering the table concurrently with the other threads and
+ * with the main thread driving the clock.
+ *
+ * @return the amount of RPCs it was able to remove before they expired.
+ */
+static void *
+rpctab_thread(void *arg)
+{
+	size_t i, count = pointer_to_ulong(arg), removed = 0;
+	char muid[GUID_RAW_SIZE];
+	host_addr_t addr = host_addr_get_ipv4(thread_small_id() + 1);
+	static char value;
+
+	ZERO(&muid);
+
+	for (i = 0; i < count; i++) {
+		const struct guid *m = (const struct guid *) muid;
+
+		poke_be32(muid, i);
+
+		if (!rpctab_insert(table, m, addr, &value, rand31_value(PERIOD * 4)))
+			s_error("thread insertion failed for #%zu", i);
+
+		if (0 == (i & 1) && rpctab_remove(table, m, addr) != NULL)
+			removed++;
+	}
+
+	for (i = 0; i < count; i++) {
+		poke_be32(muid, i);
+		if (rpctab_remove(table, (const struct guid *) muid, addr) != NULL)
+			removed++;
+	}
+
+	return ulong_to_pointer(removed);
+}
+
+static void
+rpctab_thread_test(size_t count, size_t threads)
+{
+	size_t i, removed = 0;
+	uint *tid;
+
+	XMALLOC_ARRAY(tid, threads);
+	table = rpctab_make(PERIOD, thread_rpc_expired, NULL);
+
+	for (i = 0; i < threads; i++) {
+		tid[i] = thread_create(rpctab_thread, ulong_to_pointer(count),
+			THREAD_F_PANIC, 0);
+	}
+
+	for (i = 0; i < threads; i++) {
+		void *result;
+
+		while (0 != thread_join_try(tid[i], &result))
+			rpctab_tick(table);
+
+		removed += pointer_to_ulong(result);
+	}
+
+	if (removed + thread_expired != count * threads)
+		test_abort("concurrent accounting", removed + thread_expired);
+
+	if (0 != rpctab_count(table))
+		test_abort("concurrent count", rpctab_count(table));
+
+	if (verbose_mode) {
+		printf("%zu threads: %zu RPCs removed, %u expired\n",
+			threads, removed, thread_expired);
+	}
+
+	rpctab_free_null(&table);
+	XFREE_NULL(tid);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 20000;
+	size_t threads = 4;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "hn:R:t:V";
+
+	progstart(argc, argv);
+	stacktrace_init(argv[0], FALSE);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'n':			/* amount of RPCs */
+			count = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 't':			/* amount of threads */
+			threads = atol(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || count < 2)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	rpctab_test(count);
+	rpctab_thread_test(count, threads);
+
+	printf("All tests passed.\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Thread-safe table of pending RPCs, keyed by message ID and address.
+ *
+ * Both the DHT and GUESS layers keep track of the RPCs they issue, waiting
+ * for a reply bearing the same message ID or for a timeout.  This table
+ * gathers the bookkeeping they need in a form that can be accessed from
+ * any thread, so that replies can be matched wherever the UDP traffic is
+ * processed.
+ *
+ * The table is split into shards, selected from the message ID, each
+ * protected by its own spinlock: locks are only held for the duration of
+ * a hash table probe, and concurrent replies to different RPCs are very
+ * unlikely to contend.
+ *
+ * Timeouts are not handled by one callout queue event per RPC.  Instead,
+ * each shard maintains a timing wheel whose slots are processed by a single
+ * periodic event, every ``period'' ms.  Expired entries are batched out of
+ * their shard under the lock, then handed back to the user through the
+ * expiration callback once the lock has been released.  A timeout therefore
+ * never fires early, but can be late by at most one period.
+ *
+ * The table does not own the values, it merely hands them back.  It is up
+ * to the user to make sure a value returned by rpctab_lookup() is not freed
+ * concurrently by another thread.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "rpctab.h"
+
+#include "atomic.h"
+#include "atoms.h"			/* For guid_hash() and guid_eq() */
+#include "cq.h"
+#include "elist.h"
+#include "hashing.h"
+#include "hevset.h"
+#include "spinlock.h"
+#include "walloc.h"
+
+#include "override.h"		/* Must be the last header included */
+
+#define RPCTAB_SHARD_BITS	4
+#define RPCTAB_SHARDS		(1U << RPCTAB_SHARD_BITS)
+#define RPCTAB_SLOTS		64	/**< Timing wheel slots per shard */
+
+/**
+ * Key of an RPC: the message ID and the address of the remote host.
+ *
+ * Users who only match on the message ID supply a zero address.
+ */
+struct rpctab_key {
+	char muid[GUID_RAW_SIZE];	/**< Message ID */
+	host_addr_t addr;			/**< Address of remote host */
+};
+
+/**
+ * An RPC entry.
+ */
+struct rpctab_item {
+	struct rpctab_key key;		/**< Embedded key */
+	void *value;				/**< User value */
+	uint expire;				/**< Tick at which entry expires */
+	link_t lk;					/**< Link in timing wheel slot */
+};
+
+/**
+ * A shard of the table.
+ */
+struct rpctab_shard {
+	spinlock_t lock;					/**< Thread-safe lock */
+	hevset_t *items;					/**< Set of rpctab_item */
+	elist_t wheel[RPCTAB_SLOTS];		/**< Items by expiration slot */
+};
+
+enum rpctab_magic { RPCTAB_MAGIC = 0x4c0e7a91 };
+
+/**
+ * The RPC table.
+ */
+struct rpctab {
+	enum rpctab_magic magic;
+	int period;							/**< Tick period, in ms */
+	uint now;							/**< Current tick */
+	rpctab_expire_t expire;				/**< Expiration callback */
+	void *data;							/**< Callback argument */
+	cperiodic_t *tick_ev;				/**< Periodic wheel processing */
+	struct rpctab_shard shard[RPCTAB_SHARDS];
+};
+
+static inline void
+rpctab_check(const struct rpctab * const rt)
+{
+	g_assert(rt != NULL);
+	g_assert(RPCTAB_MAGIC == rt->magic);
+}
+
+/**
+ * Hash function for RPC keys.
+ */
+static uint
+rpctab_key_hash(const void *key)
+{
+	const struct rpctab_key *k = key;
+
+	return guid_hash(k->muid) ^ host_addr_hash(k->addr);
+}
+
+/**
+ * Equality function for RPC keys.
+ */
+static bool
+rpctab_key_eq(const void *a, const void *b)
+{
+	const struct rpctab_key *ka = a, *kb = b;
+
+	return guid_eq(ka->muid, kb->muid) && host_addr_equiv(ka->addr, kb->addr);
+}
+
+/**
+ * Fill RPC key.
+ */
+static inline void
+rpctab_key_fill(struct rpctab_key *k,
+	const struct guid *muid, const host_addr_t addr)
+{
+	memcpy(k->muid, muid, GUID_RAW_SIZE);
+	k->addr = addr;
+}
+
+/**
+ * @return the shard holding entries for the given message ID.
+ */
+static inline struct rpctab_shard *
+rpctab_shard(const rpctab_t *rt, const struct guid *muid)
+{
+	uint h = hashing_mix32(guid_hash(muid));
+
+	return deconstify_pointer(&rt->shard[h >> (32 - RPCTAB_SHARD_BITS)]);
+}
+
+/**
+ * Compute the tick at which an entry inserted now with the specified
+ * delay must expire.
+ */
+static inline uint
+rpctab_expire_tick(const rpctab_t *rt, int delay)
+{
+	g_assert(delay >= 0);
+
+	/*
+	 * The current tick is partially elapsed, hence the extra tick to
+	 * make sure we never expire entries before their delay.
+	 */
+
+	return atomic_uint_get(&rt->now) + delay / rt->period + 1;
+}
+
+/**
+ * Periodic callout processing the timing wheel.
+ */
+static bool
+rpctab_tick_ev(void *arg)
+{
+	rpctab_tick(arg);
+	return TRUE;		/* Keep calling */
+}
+
+/**
+ * Create a new RPC table.
+ *
+ * @param period	the timeout granularity, in ms
+ * @param expire	callback invoked on expired values
+ * @param data		additional callback argument
+ *
+ * @return a new RPC table.
+ */
+rpctab_t *
+rpctab_make(int period, rpctab_expire_t expire, void *data)
+{
+	rpctab_t *rt;
+	uint i, j;
+
+	g_assert(period > 0);
+	g_assert(expire != NULL);
+
+	WALLOC0(rt);
+	rt->magic = RPCTAB_MAGIC;
+	rt->period = period;
+	rt->expire = expire;
+	rt->data = data;
+
+	for (i = 0; i < N_ITEMS(rt->shard); i++) {
+		struct rpctab_shard *rs = &rt->shard[i];
+
+		spinlock_init(&rs->lock);
+		rs->items = hevset_create_any(offsetof(struct rpctab_item, key),
+			rpctab_key_hash, NULL, rpctab_key_eq);
+
+		for (j = 0; j < N_ITEMS(rs->wheel); j++)
+			elist_init(&rs->wheel[j], offsetof(struct rpctab_item, lk));
+	}
+
+	rt->tick_ev = cq_periodic_main_add(period, rpctab_tick_ev, rt);
+
+	return rt;
+}
+
+/**
+ * Free entry held in the table.
+ */
+static void
+rpctab_item_free(void *data, void *unused)
+{
+	struct rpctab_item *ri = data;
+
+	(void) unused;
+
+	WFREE(ri);
+}
+
+/**
+ * Destroy RPC table and nullify its pointer.
+ *
+ * Values still present in the table are not freed: users must iterate
+ * over the table with rpctab_foreach() beforehand if they need to.
+ */
+void
+rpctab_free_null(rpctab_t **rt_ptr)
+{
+	rpctab_t *rt = *rt_ptr;
+	uint i;
+
+	if (NULL == rt)
+		return;
+
+	rpctab_check(rt);
+
+	cq_periodic_remove(&rt->tick_ev);
+
+	for (i = 0; i < N_ITEMS(rt->shard); i++) {
+		struct rpctab_shard *rs = &rt->shard[i];
+
+		hevset_foreach(rs->items, rpctab_item_free, NULL);
+		hevset_free_null(&rs->items);
+		spinlock_destroy(&rs->lock);
+	}
+
+	rt->magic = 0;
+	WFREE(rt);
+	*rt_ptr = NULL;
+}
+
+/**
+ * Insert value in the table.
+ *
+ * @param rt		the RPC table
+ * @param muid		the message ID of the RPC
+ * @param addr		the remote address, or zero_host_addr
+ * @param value		the value to record
+ * @param delay		timeout delay, in ms
+ *
+ * @return TRUE if inserted, FALSE if the key was already present.
+ */
+bool
+rpctab_insert(rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr, void *value, int delay)
+{
+	struct rpctab_shard *rs;
+	struct rpctab_item *ri;
+
+	rpctab_check(rt);
+	g_assert(muid != NULL);
+	g_assert(value != NULL);
+
+	WALLOC0(ri);
+	rpctab_key_fill(&ri->key, muid, addr);
+	ri->value = value;
+	ri->expire = rpctab_expire_tick(rt, delay);
+
+	rs = rpctab_shard(rt, muid);
+
+	spinlock(&rs->lock);
+
+	if (hevset_contains(rs->items, &ri->key)) {
+		spinunlock(&rs->lock);
+		WFREE(ri);
+		return FALSE;
+	}
+
+	hevset_insert(rs->items, ri);
+	elist_link_append(&rs->wheel[ri->expire % RPCTAB_SLOTS], &ri->lk);
+
+	spinunlock(&rs->lock);
+
+	return TRUE;
+}
+
+/**
+ * Lookup value in the table.
+ *
+ * @return the value registered for the key, NULL if not found.
+ */
+void *
+rpctab_lookup(const rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr)
+{
+	struct rpctab_shard *rs;
+	struct rpctab_item *ri;
+	struct rpctab_key key;
+	void *value;
+
+	rpctab_check(rt);
+
+	rpctab_key_fill(&key, muid, addr);
+	rs = rpctab_shard(rt, muid);
+
+	spinlock(&rs->lock);
+	ri = hevset_lookup(rs->items, &key);
+	value = NULL == ri ? NULL : ri->value;
+	spinunlock(&rs->lock);
+
+	return value;
+}
+
+/**
+ * @return whether the key is present in the table.
+ */
+bool
+rpctab_contains(const rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr)
+{
+	return NULL != rpctab_lookup(rt, muid, addr);
+}
+
+/**
+ * Remove key from the table.
+ *
+ * @return the value that was registered for the key, NULL if not found.
+ */
+void *
+rpctab_remove(rpctab_t *rt, const struct guid *muid, const host_addr_t addr)
+{
+	struct rpctab_shard *rs;
+	struct rpctab_item *ri;
+	struct rpctab_key key;
+	void *value = NULL;
+
+	rpctab_check(rt);
+
+	rpctab_key_fill(&key, muid, addr);
+	rs = rpctab_shard(rt, muid);
+
+	spinlock(&rs->lock);
+
+	ri = hevset_lookup(rs->items, &key);
+	if (ri != NULL) {
+		hevset_remove(rs->items, &key);
+		elist_link_remove(&rs->wheel[ri->expire % RPCTAB_SLOTS], &ri->lk);
+		value = ri->value;
+	}
+
+	spinunlock(&rs->lock);
+
+	if (ri != NULL)
+		WFREE(ri);
+
+	return value;
+}
+
+/**
+ * Reschedule the timeout of an existing entry.
+ *
+ * @param rt		the RPC table
+ * @param muid		the message ID of the RPC
+ * @param addr		the remote address, or zero_host_addr
+ * @param delay		new timeout delay, in ms, starting now
+ *
+ * @return TRUE if the entry was found and rescheduled.
+ */
+bool
+rpctab_reschedule(rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr, int delay)
+{
+	struct rpctab_shard *rs;
+	struct rpctab_item *ri;
+	struct rpctab_key key;
+
+	rpctab_check(rt);
+
+	rpctab_key_fill(&key, muid, addr);
+	rs = rpctab_shard(rt, muid);
+
+	spinlock(&rs->lock);
+
+	ri = hevset_lookup(rs->items, &key);
+	if (ri != NULL) {
+		elist_link_remove(&rs->wheel[ri->expire % RPCTAB_SLOTS], &ri->lk);
+		ri->expire = rpctab_expire_tick(rt, delay);
+		elist_link_append(&rs->wheel[ri->expire % RPCTAB_SLOTS], &ri->lk);
+	}
+
+	spinunlock(&rs->lock);
+
+	return ri != NULL;
+}
+
+/**
+ * @return amount of ms before the entry expires, -1 if not found.
+ */
+int
+rpctab_remaining(const rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr)
+{
+	struct rpctab_shard *rs;
+	struct rpctab_item *ri;
+	struct rpctab_key key;
+	int ticks = -1;
+
+	rpctab_check(rt);
+
+	rpctab_key_fill(&key, muid, addr);
+	rs = rpctab_shard(rt, muid);
+
+	spinlock(&rs->lock);
+	ri = hevset_lookup(rs->items, &key);
+	if (ri != NULL)
+		ticks = MAX(0, (int) (ri->expire - atomic_uint_get(&rt->now)));
+	spinunlock(&rs->lock);
+
+	return ticks < 0 ? -1 : ticks * rt->period;
+}
+
+/**
+ * @return amount of entries in the table.
+ */
+size_t
+rpctab_count(const rpctab_t *rt)
+{
+	size_t i, count = 0;
+
+	rpctab_check(rt);
+
+	for (i = 0; i < N_ITEMS(rt->shard); i++) {
+		struct rpctab_shard *rs = deconstify_pointer(&rt->shard[i]);
+
+		spinlock(&rs->lock);
+		count += hevset_count(rs->items);
+		spinunlock(&rs->lock);
+	}
+
+	return count;
+}
+
+struct rpctab_foreach_ctx {
+	data_fn_t cb;
+	void *data;
+};
+
+static void
+rpctab_foreach_item(void *data, void *udata)
+{
+	struct rpctab_item *ri = data;
+	struct rpctab_foreach_ctx *ctx = udata;
+
+	(*ctx->cb)(ri->value, ctx->data);
+}
+
+/**
+ * Iterate over all the values held in the table.
+ *
+ * The shard being traversed is locked, so the callback must not attempt
+ * to modify the table.
+ */
+void
+rpctab_foreach(const rpctab_t *rt, data_fn_t cb, void *data)
+{
+	struct rpctab_foreach_ctx ctx;
+	size_t i;
+
+	rpctab_check(rt);
+
+	ctx.cb = cb;
+	ctx.data = data;
+
+	for (i = 0; i < N_ITEMS(rt->shard); i++) {
+		struct rpctab_shard *rs = deconstify_pointer(&rt->shard[i]);
+
+		spinlock(&rs->lock);
+		hevset_foreach(rs->items, rpctab_foreach_item, &ctx);
+		spinunlock(&rs->lock);
+	}
+}
+
+/**
+ * Advance the clock of the table by one tick, expiring all the entries
+ * whose timeout has been reached.
+ *
+ * This is normally invoked by the periodic event installed at creation
+ * time and is only exported to let tests drive the clock.
+ *
+ * @return the amount of expired entries.
+ */
+size_t
+rpctab_tick(rpctab_t *rt)
+{
+	elist_t expired = ELIST_INIT(offsetof(struct rpctab_item, lk));
+	struct rpctab_item *ri;
+	size_t i, count;
+	uint now;
+
+	rpctab_check(rt);
+
+	atomic_uint_inc(&rt->now);
+	now = atomic_uint_get(&rt->now);
+
+	/*
+	 * Collect expired entries from each shard in turn, without invoking
+	 * any callback whilst holding the shard lock.
+	 */
+
+	for (i = 0; i < N_ITEMS(rt->shard); i++) {
+		struct rpctab_shard *rs = &rt->shard[i];
+		elist_t *slot = &rs->wheel[now % RPCTAB_SLOTS];
+		link_t *lk, *next;
+
+		spinlock(&rs->lock);
+
+		for (lk = elist_first(slot); lk != NULL; lk = next) {
+			ri = elist_data(slot, lk);
+			next = elist_next(lk);
+
+			/*
+			 * Entries scheduled more than one wheel revolution ahead
+			 * remain in their slot until their tick comes.
+			 */
+
+			if ((int) (ri->expire - now) > 0)
+				continue;
+
+			elist_link_remove(slot, lk);
+			hevset_remove(rs->items, &ri->key);
+			elist_link_append(&expired, lk);
+		}
+
+		spinunlock(&rs->lock);
+	}
+
+	count = elist_count(&expired);
+
+	while (NULL != (ri = elist_shift(&expired))) {
+		void *value = ri->value;
+
+		WFREE(ri);
+		(*rt->expire)(value, rt->data);
+	}
+
+	return count;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Thread-safe table of pending RPCs, keyed by message ID and address.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _rpctab_h_
+#define _rpctab_h_
+
+#include "common.h"
+
+#include "host_addr.h"
+
+struct guid;
+
+typedef struct rpctab rpctab_t;
+
+/**
+ * Expiration callback.
+ *
+ * The value has already been removed from the table when this is invoked,
+ * and no lock is held: the callback is free to re-insert it.
+ */
+typedef void (*rpctab_expire_t)(void *value, void *data);
+
+/*
+ * Public interface.
+ */
+
+rpctab_t *rpctab_make(int period, rpctab_expire_t expire, void *data);
+void rpctab_free_null(rpctab_t **rt_ptr);
+
+bool rpctab_insert(rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr, void *value, int delay);
+void *rpctab_lookup(const rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr);
+bool rpctab_contains(const rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr);
+void *rpctab_remove(rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr);
+bool rpctab_reschedule(rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr, int delay);
+int rpctab_remaining(const rpctab_t *rt,
+	const struct guid *muid, const host_addr_t addr);
+
+size_t rpctab_count(const rpctab_t *rt);
+void rpctab_foreach(const rpctab_t *rt, data_fn_t cb, void *data);
+size_t rpctab_tick(rpctab_t *rt);
+
+#endif /* _rpctab_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,443 @@
+/*
+ * slotq-test -- slotted queue tests and PARQ queue churn benchmarking.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/slotq.h"
+#include "lib/stringify.h"
+#include "lib/tm.h"
+#include "lib/xmalloc.h"
+
+/*
+ * Counters attached to the queued entries, as in PARQ upload queues.
+ */
+enum {
+	Q_RELATIVE = 0,			/* Entry is in the relative subset */
+	Q_SLOT_TIME,			/* Estimated slot time of the entry */
+	Q_COUNTERS
+};
+
+#define Q_SLOT_TIME_MAX	600	/* Maximum slot time, in seconds */
+
+struct qentry {
+	uint slot;				/* Slot in the queue, managed by slotq */
+	uint slot_time;			/* Estimated slot time, for the linear model */
+	size_t position;		/* Linear model: stored position */
+	int64 eta;				/* Linear model: stored ETA */
+	bool relative;
+};
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hbV] [-c items] [-n loops] [-R seed]\n"
+		"  -b : benchmark queue churn (linear renumbering vs. slotq)\n"
+		"  -c : sets item count to test\n"
+		"  -h : prints this help message\n"
+		"  -n : sets amount of loops\n"
+		"  -R : seed for repeatable random key sequence\n"
+		"  -V : verbose mode\n"
+		, getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, size_t i)
+{
+	printf("%s failed at index %zu\n", what, i);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static struct qentry *
+qentry_make(void)
+{
+	struct qentry *e;
+
+	XMALLOC0(e);
+	return e;
+}
+
+struct foreach_ctx {
+	struct qentry **entries;
+	size_t i;
+};
+
+static void
+slotq_verify_item(void *data, void *udata)
+{
+	struct foreach_ctx *ctx = udata;
+
+	if (ctx->entries[ctx->i] != data)
+		test_abort("foreach", ctx->i);
+	ctx->i++;
+}
+
+/**
+ * Check queue against the plain array of entries it is supposed to hold,
+ * in queue order.
+ */
+static void
+slotq_verify(const slotq_t *sq, struct qentry **entries, size_t count)
+{
+	struct foreach_ctx ctx;
+	int64 rel = 0, time = 0;
+	size_t i;
+
+	if (slotq_count(sq) != count)
+		test_abort("count", count);
+
+	for (i = 0; i < count; i++) {
+		struct qentry *e = entries[i];
+
+		rel += e->relative ? 1 : 0;
+		time += e->slot_time;
+
+		if (slotq_position(sq, e) != i + 1)
+			test_abort("position", i);
+		if (slotq_nth(sq, i + 1) != e)
+			test_abort("nth", i);
+		if (slotq_value(sq, e, Q_RELATIVE) != (e->relative ? 1 : 0))
+			test_abort("value relative", i);
+		if (slotq_value(sq, e, Q_SLOT_TIME) != e->slot_time)
+			test_abort("value slot time", i);
+		if (slotq_prefix(sq, e, Q_RELATIVE) != rel)
+			test_abort("prefix relative", i);
+		if (slotq_prefix(sq, e, Q_SLOT_TIME) != time)
+			test_abort("prefix slot time", i);
+		if (e->relative && slotq_select(sq, Q_RELATIVE, rel) != e)
+			test_abort("select", i);
+	}
+
+	if (slotq_total(sq, Q_RELATIVE) != rel)
+		test_abort("total relative", count);
+	if (slotq_total(sq, Q_SLOT_TIME) != time)
+		test_abort("total slot time", count);
+	if (slotq_select(sq, Q_RELATIVE, rel + 1) != NULL)
+		test_abort("select past end", count);
+
+	ctx.entries = entries;
+	ctx.i = 0;
+	slotq_foreach(sq, slotq_verify_item, &ctx);
+
+	if (ctx.i != count)
+		test_abort("foreach count", count);
+}
+
+/**
+ * Run random operations on a queue of up to n entries, checking it against
+ * a plain array regularly.
+ */
+static void
+slotq_test(size_t n, size_t loops)
+{
+	slotq_t *sq;
+	struct qentry **entries;
+	size_t i, count = 0;
+
+	XMALLOC0_ARRAY(entries, n);
+	sq = slotq_make(offsetof(struct qentry, slot), Q_COUNTERS);
+
+	for (i = 0; i < loops; i++) {
+		int op = rand31_value(4);
+		struct qentry *e;
+
+		if (0 == count || (op <= 1 && count < n)) {
+			e = qentry_make();
+			entries[count++] = e;
+			slotq_append(sq, e);
+		} else {
+			size_t j = rand31_value(count - 1);
+
+			e = entries[j];
+
+			switch (op) {
+			case 0:
+			case 1:
+			case 4:
+				slotq_remove(sq, e);
+				memmove(&entries[j], &entries[j + 1],
+					(count - j - 1) * sizeof entries[0]);
+				count--;
+				XFREE_NULL(e);
+				break;
+			case 2:
+				slotq_add(sq, e, Q_RELATIVE, e->relative ? -1 : +1);
+				e->relative = !e->relative;
+				break;
+			case 3:
+				{
+					uint t = rand31_value(Q_SLOT_TIME_MAX);
+
+					slotq_add(sq, e, Q_SLOT_TIME,
+						(int64) t - (int64) e->slot_time);
+					e->slot_time = t;
+				}
+				break;
+			}
+		}
+
+		if (0 == i % (n / 4 + 1))
+			slotq_verify(sq, entries, count);
+	}
+
+	slotq_verify(sq, entries, count);
+
+	/*
+	 * Draining the queue must leave it usable.
+	 */
+
+	while (count != 0) {
+		struct qentry *e = entries[--count];
+		slotq_remove(sq, e);
+		XFREE_NULL(e);
+	}
+
+	slotq_verify(sq, entries, 0);
+	entries[count++] = qentry_make();
+	slotq_append(sq, entries[0]);
+	slotq_verify(sq, entries, count);
+	slotq_remove(sq, entries[0]);
+	XFREE_NULL(entries[0]);
+
+	if (verbose_mode)
+		printf("slotq: %zu items, %zu loops: OK\n", n, loops);
+
+	slotq_free_null(&sq);
+	XFREE_NULL(entries);
+}
+
+/*
+ * Queue churn benchmark.
+ *
+ * This replays what happens in PARQ upload queues: entries are appended at
+ * the end of the queue with an estimated slot time, random entries leave
+ * the queue, and we need the position and the ETA of entries, the ETA being
+ * the sum of the slot times of the entries up to the considered one.
+ *
+ * The linear way stores positions and ETAs in the entries, and all the
+ * entries following a removed one need to be renumbered and have their ETA
+ * updated.  The slotq way is what PARQ does: positions and ETAs are prefix
+ * sums read on demand from the queue.
+ *
+ * Both runs use the same random sequence and must compute the same checksum.
+ */
+
+static double
+churn_linear(size_t n, size_t loops, uint64 *checksum)
+{
+	struct qentry **queue;
+	tm_t start, end;
+	size_t i, j;
+	int64 eta = 0;
+
+	XMALLOC0_ARRAY(queue, n);
+
+	for (i = 0; i < n; i++) {
+		struct qentry *e = qentry_make();
+
+		e->slot_time = rand31_value(Q_SLOT_TIME_MAX);
+		e->position = i + 1;
+		e->eta = eta += e->slot_time;
+		queue[i] = e;
+	}
+
+	*checksum = 0;
+	tm_now_exact(&start);
+
+	for (i = 0; i < loops; i++) {
+		size_t r = rand31_value(n - 1);
+		struct qentry *e = queue[r], *q;
+
+		/* Entry leaves: renumber all the following ones */
+		for (j = r + 1; j < n; j++) {
+			q = queue[j];
+			q->position--;
+			q->eta -= e->slot_time;
+			queue[j - 1] = q;
+		}
+
+		/* New entry arrives at the end of the queue */
+		e->slot_time = rand31_value(Q_SLOT_TIME_MAX);
+		e->position = n;
+		e->eta = queue[n - 2]->eta + e->slot_time;
+		queue[n - 1] = e;
+
+		q = queue[rand31_value(n - 1)];
+		*checksum += q->position + q->eta;
+	}
+
+	tm_now_exact(&end);
+
+	for (i = 0; i < n; i++)
+		XFREE_NULL(queue[i]);
+	XFREE_NULL(queue);
+
+	return tm_elapsed_f(&end, &start);
+}
+
+static double
+churn_slotq(size_t n, size_t loops, uint64 *checksum)
+{
+	slotq_t *sq;
+	struct qentry *e;
+	tm_t start, end;
+	size_t i;
+
+	sq = slotq_make(offsetof(struct qentry, slot), Q_COUNTERS);
+
+	for (i = 0; i < n; i++) {
+		e = qentry_make();
+		slotq_append(sq, e);
+		slotq_add(sq, e, Q_SLOT_TIME, rand31_value(Q_SLOT_TIME_MAX));
+	}
+
+	*checksum = 0;
+	tm_now_exact(&start);
+
+	for (i = 0; i < loops; i++) {
+		e = slotq_nth(sq, rand31_value(n - 1) + 1);
+
+		/* Entry leaves, its counters are withdrawn with it */
+		slotq_remove(sq, e);
+
+		/* New entry arrives at the end of the queue */
+		slotq_append(sq, e);
+		slotq_add(sq, e, Q_SLOT_TIME, rand31_value(Q_SLOT_TIME_MAX));
+
+		e = slotq_nth(sq, rand31_value(n - 1) + 1);
+		*checksum += slotq_position(sq, e) +
+			slotq_prefix(sq, e, Q_SLOT_TIME);
+	}
+
+	tm_now_exact(&end);
+
+	while (0 != slotq_count(sq)) {
+		e = slotq_nth(sq, 1);
+		slotq_remove(sq, e);
+		XFREE_NULL(e);
+	}
+	slotq_free_null(&sq);
+
+	return tm_elapsed_f(&end, &start);
+}
+
+static void
+churn_benchmark(size_t n, size_t loops)
+{
+	double linear, slotq;
+	uint64 lsum, ssum;
+	unsigned seed = rand31_current_seed();
+
+	linear = churn_linear(n, loops, &lsum);
+	rand31_set_seed(seed);
+	slotq = churn_slotq(n, loops, &ssum);
+
+	if (lsum != ssum) {
+		printf("checksum mismatch: linear=%s, slotq=%s\n",
+			uint64_to_string(lsum), uint64_to_string2(ssum));
+		test_abort("churn", loops);
+	}
+
+	printf("queue of %zu items, %zu departures:\n", n, loops);
+	printf("  linear: %.3f secs (%.3f us per departure)\n",
+		linear, linear * 1e6 / loops);
+	printf("  slotq:  %.3f secs (%.3f us per departure)\n",
+		slotq, slotq * 1e6 / loops);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	bool bflag = FALSE;
+	size_t count = 5000;
+	size_t loops = 100000;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "bc:hn:R:V";
+
+	progstart(argc, argv);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'b':			/* benchmark */
+			bflag = TRUE;
+			break;
+		case 'c':			/* amount of items */
+			count = atol(optarg);
+			break;
+		case 'n':			/* amount of loops */
+			loops = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || count < 2)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	if (bflag) {
+		churn_benchmark(count, loops);
+	} else {
+		size_t n;
+
+		for (n = 2; n <= count; n = n * 3 / 2 + 1)
+			slotq_test(n, loops / 10 + 1);
+		slotq_test(count, loops);
+		printf("All tests passed.\n");
+	}
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
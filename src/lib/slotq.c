@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Slotted queues, keeping items in their order of arrival.
+ *
+ * Each item is given a slot when it is appended to the queue, at the end of
+ * an array, and keeps it until it leaves the queue: removing an item does not
+ * renumber the ones after it.  The slot number is stored in the item itself,
+ * as an unsigned integer at the offset given when creating the queue.
+ *
+ * A Fenwick tree flags the used slots, yielding the position of an item and
+ * the item at a given position in O(log n).  Additional Fenwick trees hold
+ * counters attached to the items, summed in queue order: the prefix sum of a
+ * counter tells how much the items up to a given one account for, and
+ * counters restricted to 0 or 1 define ordered subsets of the queue.
+ *
+ * When the end of the array is reached, the slots are compacted, and the
+ * array is enlarged if it is still more than half full.  This is an O(n)
+ * operation, but it is only required after n / 2 appended items or more.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "slotq.h"
+
+#include "fenwick.h"
+#include "halloc.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define SLOTQ_MIN_SLOTS	64		/**< Initial size of the slot array */
+
+enum slotq_magic { SLOTQ_MAGIC = 0x1b6e49d3 };
+
+/**
+ * A slotted queue.
+ */
+struct slotq {
+	enum slotq_magic magic;
+	void **slots;				/**< Items, by order of arrival */
+	fenwick_t *used;			/**< Flags used slots, yields positions */
+	fenwick_t **counters;		/**< Counters attached to the items */
+	size_t offset;				/**< Offset of the slot number in items */
+	size_t size;				/**< Allocated size of "slots" */
+	size_t next;				/**< Next free slot, at the end */
+	size_t count;				/**< Amount of items in the queue */
+	uint ncounters;				/**< Amount of counters */
+};
+
+static inline void
+slotq_check(const struct slotq * const sq)
+{
+	g_assert(sq != NULL);
+	g_assert(SLOTQ_MAGIC == sq->magic);
+}
+
+/**
+ * @return pointer to the slot number of the item.
+ */
+static inline uint *
+slotq_slot_ptr(const slotq_t *sq, const void *item)
+{
+	return ptr_add_offset(deconstify_pointer(item), sq->offset);
+}
+
+/**
+ * @return the slot of an item held in the queue.
+ */
+static inline size_t
+slotq_slot(const slotq_t *sq, const void *item)
+{
+	uint slot = *slotq_slot_ptr(sq, item);
+
+	g_assert_log(slot < sq->next && sq->slots[slot] == item,
+		"%s(): item %p not in queue %p (slot %u)",
+		G_STRFUNC, item, sq, slot);
+
+	return slot;
+}
+
+/**
+ * Create a new slotted queue.
+ *
+ * @param offset	offset of the "uint" slot number within the items
+ * @param counters	amount of counters to attach to each item
+ *
+ * @return the new queue, to be freed with slotq_free_null().
+ */
+slotq_t *
+slotq_make(size_t offset, uint counters)
+{
+	slotq_t *sq;
+	uint i;
+
+	WALLOC0(sq);
+	sq->magic = SLOTQ_MAGIC;
+	sq->offset = offset;
+	sq->size = SLOTQ_MIN_SLOTS;
+	sq->ncounters = counters;
+	HALLOC0_ARRAY(sq->slots, sq->size);
+	sq->used = fenwick_make(sq->size);
+
+	if (counters != 0) {
+		HALLOC_ARRAY(sq->counters, counters);
+		for (i = 0; i < counters; i++)
+			sq->counters[i] = fenwick_make(sq->size);
+	}
+
+	return sq;
+}
+
+/**
+ * Free slotted queue and nullify its pointer.
+ *
+ * The items still held in the queue are not freed.
+ */
+void
+slotq_free_null(slotq_t **sq_ptr)
+{
+	slotq_t *sq = *sq_ptr;
+
+	if (sq != NULL) {
+		uint i;
+
+		slotq_check(sq);
+
+		for (i = 0; i < sq->ncounters; i++)
+			fenwick_free_null(&sq->counters[i]);
+
+		HFREE_NULL(sq->counters);
+		fenwick_free_null(&sq->used);
+		HFREE_NULL(sq->slots);
+		sq->magic = 0;
+		WFREE(sq);
+		*sq_ptr = NULL;
+	}
+}
+
+/**
+ * @return the amount of items held in the queue.
+ */
+size_t
+slotq_count(const slotq_t *sq)
+{
+	slotq_check(sq);
+
+	return sq->count;
+}
+
+/**
+ * Compact the slots, renumbering items in their order of arrival, and
+ * enlarge the slot array if it is still more than half full.
+ */
+static void
+slotq_compact(slotq_t *sq)
+{
+	int64 *values = NULL;
+	size_t i, j;
+	uint c;
+
+	/*
+	 * Save the counters of the items, in queue order, before we clear the
+	 * trees: they will be set back at the new slots.
+	 */
+
+	if (sq->ncounters != 0) {
+		XMALLOC_ARRAY(values, sq->count * sq->ncounters);
+
+		for (i = j = 0; i < sq->next; i++) {
+			if (NULL == sq->slots[i])
+				continue;
+			for (c = 0; c < sq->ncounters; c++)
+				values[j++] = fenwick_get(sq->counters[c], i);
+		}
+	}
+
+	fenwick_clear(sq->used);
+	for (c = 0; c < sq->ncounters; c++)
+		fenwick_clear(sq->counters[c]);
+
+	for (i = j = 0; i < sq->next; i++) {
+		void *item = sq->slots[i];
+
+		if (NULL == item)
+			continue;
+
+		sq->slots[i] = NULL;
+		sq->slots[j] = item;
+		*slotq_slot_ptr(sq, item) = j;
+		fenwick_add(sq->used, j, +1);
+
+		for (c = 0; c < sq->ncounters; c++) {
+			int64 v = values[j * sq->ncounters + c];
+
+			if (v != 0)
+				fenwick_add(sq->counters[c], j, v);
+		}
+		j++;
+	}
+
+	g_assert(j == sq->count);
+
+	XFREE_NULL(values);
+	sq->next = j;
+
+	if (j >= sq->size / 2) {
+		size_t n = sq->size * 2;
+
+		HREALLOC_ARRAY(sq->slots, n);
+		memset(&sq->slots[sq->size], 0, (n - sq->size) * sizeof sq->slots[0]);
+		fenwick_resize(sq->used, n);
+		for (c = 0; c < sq->ncounters; c++)
+			fenwick_resize(sq->counters[c], n);
+		sq->size = n;
+	}
+}
+
+/**
+ * Append item at the end of the queue, with all its counters set to 0.
+ */
+void
+slotq_append(slotq_t *sq, void *item)
+{
+	slotq_check(sq);
+	g_assert(item != NULL);
+
+	if (sq->next == sq->size)
+		slotq_compact(sq);
+
+	g_assert(sq->next < sq->size);
+	g_assert(sq->next <= MAX_INT_VAL(uint));
+
+	*slotq_slot_ptr(sq, item) = sq->next;
+	sq->slots[sq->next] = item;
+	fenwick_add(sq->used, sq->next, +1);
+	sq->next++;
+	sq->count++;
+}
+
+/**
+ * Remove item from the queue, freeing its slot.
+ */
+void
+slotq_remove(slotq_t *sq, void *item)
+{
+	size_t slot;
+	uint c;
+
+	slotq_check(sq);
+
+	slot = slotq_slot(sq, item);
+
+	for (c = 0; c < sq->ncounters; c++) {
+		int64 v = fenwick_get(sq->counters[c], slot);
+
+		if (v != 0)
+			fenwick_add(sq->counters[c], slot, -v);
+	}
+
+	sq->slots[slot] = NULL;
+	fenwick_add(sq->used, slot, -1);
+
+	g_assert(sq->count > 0);
+
+	/*
+	 * When the queue becomes empty, we can reuse all the slots.
+	 */
+
+	if (0 == --sq->count)
+		sq->next = 0;
+}
+
+/**
+ * @return the 1-based position of the item in the queue.
+ */
+size_t
+slotq_position(const slotq_t *sq, const void *item)
+{
+	slotq_check(sq);
+
+	return fenwick_prefix(sq->used, slotq_slot(sq, item));
+}
+
+/**
+ * @return the item at the given 1-based position in the queue.
+ */
+void *
+slotq_nth(const slotq_t *sq, size_t n)
+{
+	size_t slot;
+
+	slotq_check(sq);
+	g_assert(n != 0 && n <= sq->count);
+
+	slot = fenwick_select(sq->used, n);
+	g_assert(slot < sq->next);
+
+	return sq->slots[slot];
+}
+
+/**
+ * Add delta to the counter c of the item.
+ */
+void
+slotq_add(slotq_t *sq, const void *item, uint c, int64 delta)
+{
+	slotq_check(sq);
+	g_assert(c < sq->ncounters);
+
+	fenwick_add(sq->counters[c], slotq_slot(sq, item), delta);
+}
+
+/**
+ * @return the value of the counter c of the item.
+ */
+int64
+slotq_value(const slotq_t *sq, const void *item, uint c)
+{
+	slotq_check(sq);
+	g_assert(c < sq->ncounters);
+
+	return fenwick_get(sq->counters[c], slotq_slot(sq, item));
+}
+
+/**
+ * @return the sum of the counter c over the items up to the given one,
+ * inclusive, in queue order.
+ */
+int64
+slotq_prefix(const slotq_t *sq, const void *item, uint c)
+{
+	slotq_check(sq);
+	g_assert(c < sq->ncounters);
+
+	return fenwick_prefix(sq->counters[c], slotq_slot(sq, item));
+}
+
+/**
+ * @return the sum of the counter c over all the items.
+ */
+int64
+slotq_total(const slotq_t *sq, uint c)
+{
+	slotq_check(sq);
+	g_assert(c < sq->ncounters);
+
+	return fenwick_total(sq->counters[c]);
+}
+
+/**
+ * Find the first item at which the sum of the counter c, in queue order,
+ * reaches k.  The counter must not be negative for any item.
+ *
+ * When the counter flags a subset of the items, this returns the k-th item
+ * of the subset.
+ *
+ * @return the item, NULL if the total of the counter is less than k.
+ */
+void *
+slotq_select(const slotq_t *sq, uint c, int64 k)
+{
+	size_t slot;
+
+	slotq_check(sq);
+	g_assert(c < sq->ncounters);
+
+	slot = fenwick_select(sq->counters[c], k);
+
+	return slot < sq->next ? sq->slots[slot] : NULL;
+}
+
+/**
+ * Iterate over the items in queue order.
+ *
+ * The callback must not append or remove items.
+ */
+void
+slotq_foreach(const slotq_t *sq, data_fn_t cb, void *data)
+{
+	size_t i;
+
+	slotq_check(sq);
+
+	for (i = 0; i < sq->next; i++) {
+		void *item = sq->slots[i];
+
+		if (item != NULL)
+			(*cb)(item, data);
+	}
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Slotted queues, keeping items in their order of arrival.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _slotq_h_
+#define _slotq_h_
+
+#include "common.h"
+
+struct slotq;
+typedef struct slotq slotq_t;
+
+/*
+ * Public interface.
+ */
+
+slotq_t *slotq_make(size_t offset, uint counters);
+void slotq_free_null(slotq_t **sq_ptr);
+size_t slotq_count(const slotq_t *sq);
+void slotq_append(slotq_t *sq, void *item);
+void slotq_remove(slotq_t *sq, void *item);
+size_t slotq_position(const slotq_t *sq, const void *item);
+void *slotq_nth(const slotq_t *sq, size_t n);
+void slotq_add(slotq_t *sq, const void *item, uint c, int64 delta);
+int64 slotq_value(const slotq_t *sq, const void *item, uint c);
+int64 slotq_prefix(const slotq_t *sq, const void *item, uint c);
+int64 slotq_total(const slotq_t *sq, uint c);
+void *slotq_select(const slotq_t *sq, uint c, int64 k);
+void slotq_foreach(const slotq_t *sq, data_fn_t cb, void *data);
+
+#endif	/* _slotq_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
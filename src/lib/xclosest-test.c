@@ -0,0 +1,323 @@
+/*
+ * xclosest-test -- XOR-closest selection tests and benchmark.
+ *
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. Neither the name of the authors nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "common.h"
+
+#include "lib/misc.h"
+#include "lib/patricia.h"
+#include "lib/progname.h"
+#include "lib/rand31.h"
+#include "lib/stacktrace.h"
+#include "lib/tm.h"
+#include "lib/xclosest.h"
+#include "lib/xmalloc.h"
+
+#define KEYBITS		160			/* Kademlia KUID size */
+#define KEYLEN		(KEYBITS / 8)
+#define KMAX		256			/* Maximum amount of closest values */
+
+static bool verbose_mode;
+static unsigned initial_seed;
+
+/**
+ * A key, and the value we associate with it.
+ */
+struct item {
+	uint8 key[KEYLEN];
+	bool present;			/* Whether item is in the sets */
+};
+
+static void G_NORETURN
+usage(void)
+{
+	fprintf(stderr,
+		"Usage: %s [-hV] [-k closest] [-n keys] [-q queries] [-R seed]\n"
+		"  -h : prints this help message\n"
+		"  -k : sets amount of closest values to select (max %d)\n"
+		"  -n : sets amount of keys\n"
+		"  -q : sets amount of queries\n"
+		"  -R : seed for repeatable random sequence\n"
+		"  -V : verbose mode\n"
+		, getprogname(), KMAX);
+	exit(EXIT_FAILURE);
+}
+
+static void G_NORETURN
+test_abort(const char *what, size_t query, size_t rank)
+{
+	printf("%s failed on query #%zu at rank %zu\n", what, query, rank);
+	printf("use '-R %u' to reproduce problem.\n", initial_seed);
+	abort();
+}
+
+static void
+random_key(uint8 *key)
+{
+	size_t i;
+
+	for (i = 0; i < KEYLEN; i++)
+		key[i] = rand31_value(255);
+}
+
+/**
+ * Filter used to exercise selection callbacks: only even items qualify.
+ */
+static bool
+xclosest_test_even(const void *value, void *data)
+{
+	const struct item *items = data;
+
+	return 0 == (((const struct item *) value - items) & 1);
+}
+
+/**
+ * Select the closest items to the target by walking the PATRICIA trie.
+ *
+ * @return amount of items filled in the vector.
+ */
+static size_t
+trie_select(patricia_t *pt, const uint8 *target,
+	void **vec, size_t vcnt, struct item *items, bool even)
+{
+	patricia_iter_t *iter;
+	void *value;
+	size_t n = 0;
+
+	iter = patricia_metric_iterator_lazy(pt, target, TRUE);
+
+	while (n < vcnt && patricia_iter_next(iter, NULL, NULL, &value)) {
+		if (even && !xclosest_test_even(value, items))
+			continue;
+		vec[n++] = value;
+	}
+
+	patricia_iterator_release(&iter);
+	return n;
+}
+
+static double
+elapsed(const tm_t *start, double ustart)
+{
+	tm_t end;
+	double uend;
+
+	tm_cputime(&uend, NULL);
+	tm_now_exact(&end);
+
+	return ustart == uend ? tm_elapsed_f(&end, start) : uend - ustart;
+}
+
+/**
+ * Check selections against the trie, with and without a filter.
+ */
+static void
+xclosest_test_check(xclosest_t *xc, patricia_t *pt,
+	struct item *items, size_t k, size_t queries, size_t round)
+{
+	void *v1[KMAX], *v2[KMAX];
+	size_t q;
+
+	for (q = 0; q < queries; q++) {
+		uint8 target[KEYLEN];
+		bool even = 0 == q % 4;
+		size_t n1, n2, i;
+
+		random_key(target);
+
+		n1 = xclosest_select(xc, target, v1, k,
+				even ? xclosest_test_even : NULL, items);
+		n2 = trie_select(pt, target, v2, k, items, even);
+
+		if (n1 != n2)
+			test_abort("selection count", round * queries + q, MIN(n1, n2));
+
+		for (i = 0; i < n1; i++) {
+			if (v1[i] != v2[i])
+				test_abort("selection order", round * queries + q, i);
+		}
+	}
+}
+
+/**
+ * Time selections, without any filter.
+ */
+static void
+xclosest_test_timing(xclosest_t *xc, patricia_t *pt,
+	struct item *items, size_t k, size_t queries)
+{
+	void *vec[KMAX];
+	uint8 *targets;
+	tm_t start;
+	double ustart, tx, tp;
+	size_t q;
+
+	XMALLOC_ARRAY(targets, queries * KEYLEN);
+	for (q = 0; q < queries; q++)
+		random_key(&targets[q * KEYLEN]);
+
+	tm_now_exact(&start);
+	tm_cputime(&ustart, NULL);
+	for (q = 0; q < queries; q++)
+		xclosest_select(xc, &targets[q * KEYLEN], vec, k, NULL, NULL);
+	tx = elapsed(&start, ustart);
+
+	tm_now_exact(&start);
+	tm_cputime(&ustart, NULL);
+	for (q = 0; q < queries; q++)
+		trie_select(pt, &targets[q * KEYLEN], vec, k, items, FALSE);
+	tp = elapsed(&start, ustart);
+
+	if (verbose_mode) {
+		printf("xclosest: %zu keys, %zu queries for %zu closest\n",
+			xclosest_count(xc), queries, k);
+		printf("xclosest: PATRICIA walk:  %.3f s\n", tp);
+		printf("xclosest: flat selection: %.3f s\n", tx);
+	}
+
+	XFREE_NULL(targets);
+}
+
+static void
+xclosest_test(size_t count, size_t k, size_t queries)
+{
+	struct item *items;
+	xclosest_t *xc;
+	patricia_t *pt;
+	size_t i, round;
+
+	XMALLOC0_ARRAY(items, count);
+
+	xc = xclosest_make(KEYBITS);
+	pt = patricia_create(KEYBITS);
+
+	for (i = 0; i < count; i++) {
+		struct item *it = &items[i];
+
+		random_key(it->key);
+		if (patricia_contains(pt, it->key))
+			continue;		/* Duplicate key, highly unlikely */
+		xclosest_add(xc, it->key, it);
+		patricia_insert(pt, it->key, it);
+		it->present = TRUE;
+	}
+
+	xclosest_test_check(xc, pt, items, k, queries, 0);
+	xclosest_test_timing(xc, pt, items, k, queries);
+
+	/*
+	 * Churn: remove and add back random items, then check again.
+	 */
+
+	for (round = 1; round <= 4; round++) {
+		for (i = 0; i < count / 2; i++) {
+			struct item *it = &items[rand31_value(count - 1)];
+
+			if (it->present) {
+				if (!xclosest_remove(xc, it))
+					test_abort("removal", 0, it - items);
+				patricia_remove(pt, it->key);
+				it->present = FALSE;
+			} else if (!patricia_contains(pt, it->key)) {
+				xclosest_add(xc, it->key, it);
+				patricia_insert(pt, it->key, it);
+				it->present = TRUE;
+			}
+		}
+
+		if (xclosest_count(xc) != patricia_count(pt))
+			test_abort("count", 0, xclosest_count(xc));
+
+		xclosest_test_check(xc, pt, items, k, queries / 10, round);
+	}
+
+	xclosest_clear(xc);
+	if (xclosest_count(xc) != 0 || xclosest_contains(xc, &items[0]))
+		test_abort("clear", 0, xclosest_count(xc));
+
+	xclosest_free_null(&xc);
+	patricia_destroy(pt);
+	XFREE_NULL(items);
+}
+
+int
+main(int argc, char **argv)
+{
+	extern int optind;
+	extern char *optarg;
+	size_t count = 10000;
+	size_t k = 20;
+	size_t queries = 10000;
+	unsigned rseed = 0;
+	int c;
+	const char options[] = "hk:n:q:R:V";
+
+	progstart(argc, argv);
+	stacktrace_init(argv[0], FALSE);
+
+	while ((c = getopt(argc, argv, options)) != EOF) {
+		switch (c) {
+		case 'k':			/* amount of closest values */
+			k = atol(optarg);
+			break;
+		case 'n':			/* amount of keys */
+			count = atol(optarg);
+			break;
+		case 'q':			/* amount of queries */
+			queries = atol(optarg);
+			break;
+		case 'R':			/* randomize in a repeatable way */
+			rseed = atoi(optarg);
+			break;
+		case 'V':			/* verbose mode */
+			verbose_mode = TRUE;
+			break;
+		case 'h':			/* show help */
+		default:
+			usage();
+			break;
+		}
+	}
+
+	if ((argc -= optind) != 0 || 0 == count || 0 == k || k > KMAX)
+		usage();
+
+	rand31_set_seed(rseed);
+	initial_seed = rand31_current_seed();
+
+	xclosest_test(count, k, queries);
+
+	printf("All tests passed.\n");
+
+	return 0;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,470 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Flat snapshot of keys for XOR-closest selection.
+ *
+ * This structure records a set of (key, value) tuples, where keys are
+ * fixed-size bit strings, and is able to select the values whose keys are
+ * the closest to a given target under the XOR metric, as used by Kademlia.
+ *
+ * Keys are split into 32-bit lanes, converted to native endianness so that
+ * comparing distances lane by lane is the same as comparing the XOR-ed keys
+ * byte by byte.  Each lane is stored in its own contiguous array, so that
+ * the distance on the leading lane can be computed for a whole block of
+ * entries in a tight loop that the compiler can vectorize.  Since the
+ * leading 32 bits almost always decide whether an entry can be part of the
+ * result, the other lanes are rarely looked at.
+ *
+ * Selection keeps a bounded max-heap of the best candidates seen so far,
+ * hence it is O(n log k) for n entries and k requested values, without
+ * any memory allocation for small k.
+ *
+ * Values must be unique: they are indexed so that removal is O(1), the last
+ * entry being moved into the slot of the removed one.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "xclosest.h"
+
+#include "endian.h"
+#include "htable.h"
+#include "pow2.h"
+#include "walloc.h"
+#include "xmalloc.h"
+
+#include "override.h"			/* Must be the last header included */
+
+#define XCLOSEST_MAX_LANES	8		/**< Up to 256-bit keys */
+#define XCLOSEST_BLOCK		64		/**< Entries per bulk distance pass */
+#define XCLOSEST_HEAP		64		/**< Heap size held on the stack */
+#define XCLOSEST_MIN		XCLOSEST_BLOCK	/**< Initial capacity */
+
+enum xclosest_magic { XCLOSEST_MAGIC = 0x7d3ac15e };
+
+/**
+ * The flat snapshot.
+ */
+struct xclosest {
+	enum xclosest_magic magic;
+	uint lanes;					/**< Amount of 32-bit lanes in keys */
+	size_t count;				/**< Amount of entries */
+	size_t capacity;			/**< Allocated entries, multiple of a block */
+	uint32 *lane[XCLOSEST_MAX_LANES];	/**< Key lanes, one array per lane */
+	const void **values;		/**< Values, parallel to the lanes */
+	htable_t *index;			/**< Maps a value to its index + 1 */
+};
+
+static inline void
+xclosest_check(const struct xclosest * const xc)
+{
+	g_assert(xc != NULL);
+	g_assert(XCLOSEST_MAGIC == xc->magic);
+}
+
+/**
+ * Create a new snapshot.
+ *
+ * @param keybits		size of keys in bits, must be a multiple of 32
+ *
+ * @return a new empty snapshot.
+ */
+xclosest_t *
+xclosest_make(size_t keybits)
+{
+	xclosest_t *xc;
+
+	g_assert(keybits != 0);
+	g_assert(0 == keybits % 32);
+	g_assert(keybits / 32 <= XCLOSEST_MAX_LANES);
+
+	WALLOC0(xc);
+	xc->magic = XCLOSEST_MAGIC;
+	xc->lanes = keybits / 32;
+	xc->index = htable_create(HASH_KEY_SELF, 0);
+
+	return xc;
+}
+
+/**
+ * Free snapshot and nullify its pointer.
+ */
+void
+xclosest_free_null(xclosest_t **xc_ptr)
+{
+	xclosest_t *xc = *xc_ptr;
+
+	if (xc != NULL) {
+		uint i;
+
+		xclosest_check(xc);
+
+		for (i = 0; i < xc->lanes; i++)
+			XFREE_NULL(xc->lane[i]);
+		XFREE_NULL(xc->values);
+		htable_free_null(&xc->index);
+		xc->magic = 0;
+		WFREE(xc);
+		*xc_ptr = NULL;
+	}
+}
+
+/**
+ * @return amount of entries held in the snapshot.
+ */
+size_t
+xclosest_count(const xclosest_t *xc)
+{
+	xclosest_check(xc);
+
+	return xc->count;
+}
+
+/**
+ * @return whether value is held in the snapshot.
+ */
+bool
+xclosest_contains(const xclosest_t *xc, const void *value)
+{
+	xclosest_check(xc);
+
+	return htable_contains(xc->index, value);
+}
+
+/**
+ * Remove all the entries from the snapshot.
+ */
+void
+xclosest_clear(xclosest_t *xc)
+{
+	xclosest_check(xc);
+
+	htable_clear(xc->index);
+	xc->count = 0;
+}
+
+/**
+ * Add key to the snapshot.
+ *
+ * @param xc		the snapshot
+ * @param key		the key, which is copied
+ * @param value		the value associated with the key, must be unique
+ */
+void
+xclosest_add(xclosest_t *xc, const void *key, const void *value)
+{
+	const char *p = key;
+	size_t idx;
+	uint i;
+
+	xclosest_check(xc);
+	g_assert(key != NULL);
+	g_assert(!htable_contains(xc->index, value));
+
+	if G_UNLIKELY(xc->count == xc->capacity) {
+		xc->capacity = MAX(XCLOSEST_MIN, xc->capacity * 2);
+
+		for (i = 0; i < xc->lanes; i++)
+			XREALLOC_ARRAY(xc->lane[i], xc->capacity);
+		XREALLOC_ARRAY(xc->values, xc->capacity);
+	}
+
+	idx = xc->count++;
+
+	for (i = 0; i < xc->lanes; i++)
+		xc->lane[i][idx] = peek_be32(&p[i * 4]);
+
+	xc->values[idx] = value;
+	htable_insert(xc->index, value, size_to_pointer(idx + 1));
+}
+
+/**
+ * Remove value from the snapshot.
+ *
+ * @return TRUE if value was found and removed.
+ */
+bool
+xclosest_remove(xclosest_t *xc, const void *value)
+{
+	size_t idx, last;
+	void *v;
+
+	xclosest_check(xc);
+
+	v = htable_lookup(xc->index, value);
+	if (NULL == v)
+		return FALSE;
+
+	idx = pointer_to_size(v) - 1;
+	last = --xc->count;
+
+	g_assert(idx <= last);
+	g_assert(xc->values[idx] == value);
+
+	htable_remove(xc->index, value);
+
+	if (idx != last) {
+		uint i;
+
+		for (i = 0; i < xc->lanes; i++)
+			xc->lane[i][idx] = xc->lane[i][last];
+
+		xc->values[idx] = xc->values[last];
+		htable_insert(xc->index, xc->values[idx], size_to_pointer(idx + 1));
+	}
+
+	/*
+	 * Shrink arrays when they become mostly empty.
+	 */
+
+	if G_UNLIKELY(
+		xc->capacity > XCLOSEST_MIN && xc->count < xc->capacity / 4
+	) {
+		uint i;
+
+		xc->capacity /= 2;
+
+		for (i = 0; i < xc->lanes; i++)
+			XREALLOC_ARRAY(xc->lane[i], xc->capacity);
+		XREALLOC_ARRAY(xc->values, xc->capacity);
+	}
+
+	return TRUE;
+}
+
+/**
+ * A selection candidate.
+ */
+struct xclosest_cand {
+	uint32 d;				/**< Distance on the leading lane */
+	size_t e;				/**< Entry index */
+};
+
+/**
+ * Compare distances of two candidates to the target.
+ *
+ * @return -1, 0 or +1 depending on whether candidate `a' is closer, at the
+ * same distance or further away than candidate `b'.
+ */
+static inline int
+xclosest_cmp(const xclosest_t *xc, const uint32 *target,
+	const struct xclosest_cand *a, const struct xclosest_cand *b)
+{
+	uint i;
+
+	if G_LIKELY(a->d != b->d)
+		return a->d < b->d ? -1 : +1;
+
+	for (i = 1; i < xc->lanes; i++) {
+		uint32 da = xc->lane[i][a->e] ^ target[i];
+		uint32 db = xc->lane[i][b->e] ^ target[i];
+
+		if (da != db)
+			return da < db ? -1 : +1;
+	}
+
+	return 0;
+}
+
+/**
+ * Restore max-heap property from the root, after it was replaced.
+ */
+static void
+xclosest_sift_down(const xclosest_t *xc, const uint32 *target,
+	struct xclosest_cand *heap, size_t n)
+{
+	struct xclosest_cand c = heap[0];
+	size_t i = 0;
+
+	for (;;) {
+		size_t l = 2 * i + 1, r = l + 1, m;
+
+		if (l >= n)
+			break;
+
+		m = (r < n && xclosest_cmp(xc, target, &heap[r], &heap[l]) > 0) ?
+			r : l;
+
+		if (xclosest_cmp(xc, target, &heap[m], &c) <= 0)
+			break;
+
+		heap[i] = heap[m];
+		i = m;
+	}
+
+	heap[i] = c;
+}
+
+/**
+ * Restore max-heap property from the last item, after it was appended.
+ */
+static void
+xclosest_sift_up(const xclosest_t *xc, const uint32 *target,
+	struct xclosest_cand *heap, size_t n)
+{
+	struct xclosest_cand c = heap[n - 1];
+	size_t i = n - 1;
+
+	while (i != 0) {
+		size_t p = (i - 1) / 2;
+
+		if (xclosest_cmp(xc, target, &c, &heap[p]) <= 0)
+			break;
+
+		heap[i] = heap[p];
+		i = p;
+	}
+
+	heap[i] = c;
+}
+
+/**
+ * Compute mask of the bits above the leading bit of the bound.
+ *
+ * Any distance sharing a bit with that mask is larger than the bound.
+ */
+static inline uint32
+xclosest_mask(uint32 bound)
+{
+	if G_UNLIKELY(0 == bound)
+		return MAX_INT_VAL(uint32);
+
+	return ~(MAX_INT_VAL(uint32) >> clz(bound));
+}
+
+/**
+ * Fill the supplied vector with the values whose keys are the closest to
+ * the target, by increasing distance.
+ *
+ * @param xc		the snapshot
+ * @param target	the target key
+ * @param vec		vector where values are written
+ * @param vcnt		size of vector
+ * @param accept	optional filter, called only on candidate values
+ * @param data		additional argument for the filter
+ *
+ * @return the amount of values written to the vector.
+ */
+size_t
+xclosest_select(const xclosest_t *xc, const void *target,
+	void **vec, size_t vcnt, xclosest_accept_t accept, void *data)
+{
+	const char *p = target;
+	uint32 t[XCLOSEST_MAX_LANES];
+	struct xclosest_cand hbuf[XCLOSEST_HEAP], *heap = hbuf;
+	size_t n = 0, base, i;
+	uint32 bound = MAX_INT_VAL(uint32), mask = 0;
+
+	xclosest_check(xc);
+	g_assert(target != NULL);
+	g_assert(vec != NULL);
+
+	if G_UNLIKELY(0 == vcnt || 0 == xc->count)
+		return 0;
+
+	for (i = 0; i < xc->lanes; i++)
+		t[i] = peek_be32(&p[i * 4]);
+
+	if G_UNLIKELY(vcnt > N_ITEMS(hbuf))
+		XMALLOC_ARRAY(heap, vcnt);
+
+	/*
+	 * The heap root is the furthest of the selected candidates, and `bound'
+	 * is its distance on the leading lane once the heap is full: entries
+	 * further away on that lane cannot be selected.
+	 */
+
+	for (base = 0; base < xc->count; base += XCLOSEST_BLOCK) {
+		const uint32 *lane = &xc->lane[0][base];
+		size_t j, cnt = MIN(XCLOSEST_BLOCK, xc->count - base);
+		uint32 hits = 0;
+
+		/*
+		 * Count entries in the block that have no bit set above the leading
+		 * bit of the bound: others are further away and can be skipped.
+		 * Capacity being a multiple of the block size, we can always scan a
+		 * whole block, the slots past the last entry causing at worst a
+		 * useless look at the entries.
+		 */
+
+		for (j = 0; j < XCLOSEST_BLOCK; j++)
+			hits += 0 == ((lane[j] ^ t[0]) & mask);
+
+		if G_LIKELY(0 == hits)
+			continue;
+
+		for (j = 0; j < cnt; j++) {
+			struct xclosest_cand c;
+
+			c.d = lane[j] ^ t[0];
+
+			if G_LIKELY(c.d > bound)
+				continue;
+
+			c.e = base + j;
+
+			if (n == vcnt && xclosest_cmp(xc, t, &c, &heap[0]) >= 0)
+				continue;
+
+			if (accept != NULL && !(*accept)(xc->values[c.e], data))
+				continue;
+
+			if (n < vcnt) {
+				heap[n++] = c;
+				xclosest_sift_up(xc, t, heap, n);
+				if (n < vcnt)
+					continue;
+			} else {
+				heap[0] = c;
+				xclosest_sift_down(xc, t, heap, n);
+			}
+
+			bound = heap[0].d;
+			mask = xclosest_mask(bound);
+		}
+	}
+
+	/*
+	 * Empty the heap, furthest first, filling the vector from its end.
+	 */
+
+	for (i = n; i != 0; i--) {
+		vec[i - 1] = deconstify_pointer(xc->values[heap[0].e]);
+		heap[0] = heap[i - 1];
+		xclosest_sift_down(xc, t, heap, i - 1);
+	}
+
+	if (heap != hbuf)
+		xfree(heap);
+
+	return n;
+}
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026, agent
+ *
+ *----------------------------------------------------------------------
+ * This file is part of gtk-gnutella.
+ *
+ *  gtk-gnutella is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  gtk-gnutella is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with gtk-gnutella; if not, write to the Free Software
+ *  Foundation, Inc.:
+ *      59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *----------------------------------------------------------------------
+ */
+
+/**
+ * @ingroup lib
+ * @file
+ *
+ * Flat snapshot of keys for XOR-closest selection.
+ *
+ * @author agent
+ * @date 2026
+ */
+
+#ifndef _xclosest_h_
+#define _xclosest_h_
+
+#include "common.h"
+
+struct xclosest;
+typedef struct xclosest xclosest_t;
+
+/**
+ * Selection filter, telling whether value can be part of the result.
+ *
+ * @param value		the value associated with a candidate key
+ * @param data		user-supplied data
+ *
+ * @return TRUE if value is acceptable.
+ */
+typedef bool (*xclosest_accept_t)(const void *value, void *data);
+
+/*
+ * Public interface.
+ */
+
+xclosest_t *xclosest_make(size_t keybits);
+void xclosest_free_null(xclosest_t **xc_ptr);
+void xclosest_add(xclosest_t *xc, const void *key, const void *value);
+bool xclosest_remove(xclosest_t *xc, const void *value);
+bool xclosest_contains(const xclosest_t *xc, const void *value);
+size_t xclosest_count(const xclosest_t *xc);
+void xclosest_clear(xclosest_t *xc);
+size_t xclosest_select(const xclosest_t *xc, const void *target,
+	void **vec, size_t vcnt, xclosest_accept_t accept, void *data);
+
+#endif	/* _xclosest_h_ */
+
+/* vi: set ts=4 sw=4 cindent: */
@@ -22,9 +22,12 @@
 
 /**
  * Check page sanity.
+ *
+ * @param pag		the page to check
+ * @param pagsize	the size of the page, in bytes
  */
 bool
-sdbm_chkpage(const char *pag)
+sdbm_chkpage(const char *pag, size_t pagsize)
 {
 	unsigned n;
 	unsigned off;
@@ -32,12 +35,14 @@ sdbm_chkpage(const char *pag)
 
 	/*
 	 * This static assertion makes sure that the leading bit of the shorts
-	 * used for storing offsets will always remain clear with the current
+	 * used for storing offsets will always remain clear with the largest
 	 * DBM page size, so that it can safely be used as a marker to flag
 	 * big keys/values.
 	 */
 
-	STATIC_ASSERT(DBM_PBLKSIZ < 0x8000);
+	STATIC_ASSERT(DBM_PBLKSIZ_MAX < 0x8000);
+
+	g_assert(pagsize <= DBM_PBLKSIZ_MAX);
 
 	/*
 	 * number of entries should be something reasonable,
@@ -45,7 +50,7 @@ sdbm_chkpage(const char *pag)
 	 * this could be made more rigorous.
 	 */
 
-	if G_UNLIKELY((n = ino[0]) > INO_MAX)
+	if G_UNLIKELY((n = ino[0]) > INO_MAX(pagsize))
 		return FALSE;
 
 	if G_UNLIKELY(n & 0x1)
@@ -53,7 +58,7 @@ sdbm_chkpage(const char *pag)
 
 	if (n > 0) {
 		unsigned ino_end = (n + 1) * sizeof(unsigned short);
-		off = DBM_PBLKSIZ;
+		off = pagsize;
 		for (ino++; n > 0; ino += 2) {
 			unsigned short koff = poffset(ino[0]);
 			unsigned short voff = poffset(ino[1]);
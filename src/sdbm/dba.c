@@ -18,6 +18,7 @@ void bdump(int);
 static bool summary_only;
 static bool filled_only;
 static bool on_tty;
+static long pagsize = DBM_PBLKSIZ;
 
 static void G_NORETURN
 usage(void)
@@ -72,7 +73,7 @@ main(int argc, char **argv)
 		int datf;
 		char *name;
 		int n;
-		long npag;
+		long npag, hdr;
 		filestat_t buf;
 
 		name = (char *) malloc((n = strlen(p)) + sizeof(DBM_PAGFEXT));
@@ -88,7 +89,16 @@ main(int argc, char **argv)
 		if (-1 == fstat(pagf, &buf))
 			oops("cannot fstat opened %s", name);
 
-		npag = buf.st_size / DBM_PBLKSIZ;
+		if (-1 == (hdr = sdbm_pagfile_header(pagf)))
+			oops("invalid header in %s", name);
+
+		if (hdr != 0) {
+			pagsize = hdr;		/* Header occupies the first page */
+			if ((fileoffset_t) -1 == lseek(pagf, hdr, SEEK_SET))
+				oops("seek failed in %s", name);
+		}
+
+		npag = (buf.st_size - (hdr != 0 ? hdr : 0)) / pagsize;
 		sdump(pagf, npag);
 		free(name);
 
@@ -137,7 +147,7 @@ pagestat(char *pag,
 			printf("no entries.\n");
 	} else {
 		unsigned i;
-		unsigned off = DBM_PBLKSIZ;
+		unsigned off = pagsize;
 
 		for (i = 1; i < n; i+= 2) {
 			unsigned short koff = offset(ino[i]);
@@ -155,9 +165,9 @@ pagestat(char *pag,
 		if (!summary_only) {
 			printf("%3d entr%-3s, %2d%% used, keys %3d, values %3d, free %3d%s",
 				n / 2, plural_y(n / 2),
-				((DBM_PBLKSIZ - pfree) * 100) / DBM_PBLKSIZ,
+				(int) (((pagsize - pfree) * 100) / pagsize),
 				keysize, valsize, pfree,
-				(DBM_PBLKSIZ - pfree) / (n/2) * (1+n/2) > DBM_PBLKSIZ ?
+				(pagsize - pfree) / (n/2) * (1+n/2) > pagsize ?
 					" (LOW)" : "");
 
 			if (lk != 0) printf(" (LKEY %d)", lk);
@@ -191,12 +201,12 @@ sdump(int pagf, long npag)
 	int e;
 	int bad = 0;
 	unsigned ksize = 0, vsize = 0;
-	char pag[DBM_PBLKSIZ];
+	static char pag[DBM_PBLKSIZ_MAX];
 
-	while ((b = read(pagf, pag, DBM_PBLKSIZ)) > 0) {
+	while ((b = read(pagf, pag, pagsize)) > 0) {
 		int lk, lv;
 		unsigned ks, vs;
-		bool is_bad = !sdbm_chkpage(pag);
+		bool is_bad = !sdbm_chkpage(pag, pagsize);
 		bool is_empty = page_is_empty(pag);
 
 		if (summary_only && 0 == n % 1000) show_progress(n, npag);
@@ -224,8 +234,8 @@ sdump(int pagf, long npag)
 	}
 
 	if (b == 0) {
-		printf("%d page%s (%d hole%s):  %d entr%s\n",
-			n, plural(n), o, plural(o), t, plural_y(t));
+		printf("%d page%s of %ld bytes (%d hole%s):  %d entr%s\n",
+			n, plural(n), pagsize, o, plural(o), t, plural_y(t));
 		if (bad != 0) printf("%d bad page%s\n", bad, plural(bad));
 		printf("keys: %u byte%s, values: %u byte%s\n",
 			ksize, plural(ksize), vsize, plural(vsize));
@@ -56,6 +56,11 @@ static bool unlink_db;
 static bool all_keys;
 static bool large_keys, large_values, common_head_tail;
 static bool loose_delete;
+static bool mmapped;
+static bool logged;
+static bool crash;
+static long pagesize;
+static long large_value_len = DBM_PBLKSIZ;
 static bool async_rebuild, async_rebuild_launched;
 static int async_thread = -1;
 
@@ -68,8 +73,8 @@ static void G_NORETURN
 usage(void)
 {
 	fprintf(stderr,
-		"Usage: %s [-abdeiklprstvwyABCDEKSTUVX] [-R seed] [-c pages]\n"
-		"       dbname [count]\n"
+		"Usage: %s [-abdeiklprstvwyzABCDEKMSTUVWX] [-R seed] [-c pages]\n"
+		"       [-L length] [-P pagesize] dbname [count]\n"
 		"  -a : rebuild the database asynchronously whilst testing\n"
 		"  -b : rebuild the database\n"
 		"  -c : set LRU cache size\n"
@@ -86,17 +91,22 @@ usage(void)
 		"  -w : perform a write test\n"
 		"  -x : exit with 0 (OK) status if DB has specified amount of keys\n"
 		"  -y : show runtime thread stats at the end\n"
+		"  -z : exit without closing the database after the write test\n"
 		"  -A : traverse all keys when loosely iterating\n"
 		"  -B : rebuild the database before testing\n"
 		"  -C : count database items\n"
 		"  -D : enable LRU cache write delay\n"
 		"  -E : empty existing database on write test\n"
 		"  -K : use large keys with common head/tail parts\n"
+		"  -L : length of large values (implies -v)\n"
+		"  -M : access pages in place through a memory mapping\n"
+		"  -P : page size of new database, or to convert to with -B\n"
 		"  -R : seed for repeatable random key sequence\n"
 		"  -S : shrink database before testing\n"
 		"  -T : make database handle thread-safe\n"
 		"  -U : unlink database at the end\n"
 		"  -V : consider database as volatile\n"
+		"  -W : log dirty pages in a write-ahead log\n"
 		"  -X : delete first \"count\" keys during -l test\n",
 		getprogname());
 	exit(EXIT_FAILURE);
@@ -125,7 +135,7 @@ open_db(const char *name, bool writeable, long cache, int wflags)
 	if (WR_EMPTY == (wflags & (WR_EMPTY|WR_DELETING)))
 		flags |= O_TRUNC;
 
-	db = sdbm_open(name, flags, 0777);
+	db = sdbm_open_pagesize(name, flags, 0777, pagesize);
 	if (NULL == db) {
 		oops("error opening database \"%s\" in %s mode",
 			name, writeable ? "writing" : "reading");
@@ -147,6 +157,10 @@ open_db(const char *name, bool writeable, long cache, int wflags)
 		oops("error %sabling write delay for \"%s\"",
 			(wflags & WR_DELAY) ? "en" : "dis", name);
 	}
+	if (mmapped && -1 == sdbm_set_mmap(db, TRUE))
+		oops("error enabling memory mapping for \"%s\"", name);
+	if (logged && (flags & O_RDWR) && -1 == sdbm_set_wal(db, TRUE))
+		oops("error enabling write-ahead log for \"%s\"", name);
 	if (shrink)
 		sdbm_shrink(db);
 
@@ -161,7 +175,7 @@ open_db(const char *name, bool writeable, long cache, int wflags)
 		tm_t start, end;
 		printf("Rebuilding database...\n");
 		tm_now_exact(&start);
-		if (-1 == sdbm_rebuild(db)) {
+		if (-1 == sdbm_rebuild_pagesize(db, pagesize)) {
 			oops("error rebuilding \"%s\"", name);
 		}
 		tm_now_exact(&end);
@@ -356,7 +370,7 @@ write_db(const char *name, long count, long cache, int wflags, tm_t *done)
 			} else {
 				ZERO(&valbuf);
 				memcpy(valbuf, key.dptr, NORMAL_KEY_LEN);
-				val.dsize = sizeof valbuf;
+				val.dsize = large_value_len;
 				val.dptr = valbuf;
 			}
 		} else {
@@ -369,6 +383,17 @@ write_db(const char *name, long count, long cache, int wflags, tm_t *done)
 
 	show_done(done);
 
+	/*
+	 * Simulate a crash: the dirty pages are lost, and the database must be
+	 * recovered from what was written so far, along with its log if any.
+	 */
+
+	if (crash) {
+		printf("Exiting without closing the database.\n");
+		fflush(stdout);
+		_exit(EXIT_SUCCESS);
+	}
+
 	sdbm_close(db);
 }
 
@@ -659,7 +684,7 @@ main(int argc, char **argv)
 	const char *name;
 	long count;
 	long cache = 0;
-	const char options[] = "aAbBc:CdDeEiklKprR:sStTUvVwxXy";
+	const char options[] = "aAbBc:CdDeEiklKL:MpP:rR:sStTUvVwWxXyz";
 
 	progstart(argc, argv);
 
@@ -706,10 +731,20 @@ main(int argc, char **argv)
 			large_keys++;
 			common_head_tail++;
 			break;
+		case 'L':			/* length of large values */
+			large_value_len = atol(optarg);
+			large_values++;
+			break;
+		case 'M':			/* access pages through memory mapping */
+			mmapped++;
+			break;
 		case 'l':			/* loose iteration (implies -T) */
 			lflag++;
 			thread_safe++;
 			break;
+		case 'P':			/* page size */
+			pagesize = atol(optarg);
+			break;
 		case 'p':			/* show test progress */
 			progress++;
 			break;
@@ -745,6 +780,9 @@ main(int argc, char **argv)
 		case 'w':			/* write test */
 			wflag++;
 			break;
+		case 'W':			/* write-ahead log */
+			logged++;
+			break;
 		case 'x':			/* count items, report if matching user value */
 			xflag++;
 			break;
@@ -754,6 +792,9 @@ main(int argc, char **argv)
 		case 'y':			/* show thread stats */
 			stats++;
 			break;
+		case 'z':			/* crash after write test */
+			crash = TRUE;
+			break;
 		default:
 			usage();
 			break;
@@ -822,7 +863,12 @@ main(int argc, char **argv)
 			common_head_tail ? " with zeroed first and last 4 bytes" : "");
 
 	if (large_values)
-		printf("Will be using large values.\n");
+		printf("Will be using large values (%ld bytes).\n", large_value_len);
+
+	if (large_value_len < NORMAL_KEY_LEN || large_value_len > DBM_PBLKSIZ) {
+		oops("large value length must be between %d and %d (is %ld)",
+			NORMAL_KEY_LEN, DBM_PBLKSIZ, large_value_len);
+	}
 
 	if (cache < 0)
 		oops("cache must be positive (is %ld)", cache);
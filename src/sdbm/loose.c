@@ -24,6 +24,7 @@
 #include "lib/log.h"
 #include "lib/pow2.h"
 #include "lib/qlock.h"
+#include "lib/rwlock.h"
 #include "lib/stringify.h"
 #include "lib/thread.h"
 #include "lib/tm.h"
@@ -76,12 +77,13 @@ struct loose_vars {
  * Deleted pair at index n in vector: need to update some of the offsets to
  * account for the removal of that pair.
  *
+ * @param db	the database
  * @param pv	the pair vector
  * @param pcnt	the amount of valid entries in the vector
  * @param n		the index within the vector of the removed entry
  */
 static void
-loose_deleted(struct sdbm_pair *pv, int pcnt, int n)
+loose_deleted(const DBM *db, struct sdbm_pair *pv, int pcnt, int n)
 {
 	uint removed;
 	int i;
@@ -111,8 +113,8 @@ loose_deleted(struct sdbm_pair *pv, int pcnt, int n)
 		p->koff += removed;		/* Move towards end of page */
 		p->voff += removed;
 
-		g_assert(p->koff + p->klen <= DBM_PBLKSIZ);
-		g_assert(p->voff + p->vlen <= DBM_PBLKSIZ);
+		g_assert(p->koff + p->klen <= db->pblksiz);
+		g_assert(p->voff + p->vlen <= db->pblksiz);
 	}
 }
 
@@ -309,7 +311,7 @@ restart:
 					 */
 
 					if G_LIKELY(n != cur_cnt - 1) {
-						loose_deleted(pv, cur_cnt, n);
+						loose_deleted(v->db, pv, cur_cnt, n);
 						cur_cnt--;		/* One less pair to process */
 						n--;			/* Stay at same index in next loop */
 						deleted = TRUE;	/* In case we restart below */
@@ -474,7 +476,7 @@ loose_iterate(DBM *db, struct loose_type *type, void *arg, int flags,
 
 	tm_now_exact(&last_check);
 
-	for (b = 0; OFF_PAG(b) <= pagtail; b++) {
+	for (b = 0; OFF_PAG(db, b) <= pagtail; b++) {
 		ulong mstamp;
 		const char *pag = lru_wire(db, b, &mstamp);
 
@@ -18,6 +18,7 @@
 #include "lru.h"
 #include "pair.h"				/* For sdbm_page_dump() */
 #include "private.h"
+#include "wal.h"
 
 #include "lib/atomic.h"
 #include "lib/compat_pio.h"
@@ -47,6 +48,12 @@ enum sdbm_lru_magic { SDBM_LRU_MAGIC = 0x6a6daa37 };
  * When the SDBM layer wires pages, they are put in the `wired' list and
  * can no longer be reclaimed, regardless of the configured amount of
  * cached pages, until they are un-wired.
+ *
+ * When memory-mapping is enabled, pages of the .pag file are accessed in
+ * place through `map' and are not held in the cache, unless they are wired
+ * or cannot be safely accessed through the mapping: empty pages (which can
+ * be file holes) and pages lying past the end of the file.  A cached copy
+ * of a page always supersedes its mapped image.
  */
 struct lru_cache {
 	enum sdbm_lru_magic magic;	/* Magic number */
@@ -67,6 +74,13 @@ struct lru_cache {
 	unsigned long cp_mod_wired;	/* Stats: cached pages modified whilst wired */
 	unsigned long cp_dirtied;	/* Stats: cached pages marked dirty */
 	unsigned long cp_flushed;	/* Stats: cached pages flushed */
+#ifdef MMAP
+	char *map;					/* Mapped .pag file, NULL if not mapped */
+	long mpages;				/* Amount of pages accessible in the map */
+	uint8 mmapped;				/* Whether pages are accessed in place */
+	unsigned long mhits;		/* Stats: pages accessed in place */
+	unsigned long mgrowths;		/* Stats: mapped file growths noticed */
+#endif
 };
 
 static inline void
@@ -89,6 +103,10 @@ enum sdbm_lru_cpage_magic { SDBM_LRU_CPAGE_MAGIC = 0x22015b77 };
  * Wiring a page lets the application make sure that page is held in the cache
  * and monitored for changes through its `mstamp' field, which is atomically
  * incremented each time a wired page is changed.
+ *
+ * Concurrent readers cannot move the pages they access to the head of the
+ * LRU list, so they flag them as `referenced' instead, giving these pages
+ * a second chance when they reach the tail of the list.
  */
 struct lru_cpage {
 	enum sdbm_lru_cpage_magic magic;	/* Magic number */
@@ -96,6 +114,7 @@ struct lru_cpage {
 	uint wired:1;						/* Wired page, do not reuse */
 	uint was_cached:1;					/* Was in LRU list before being wired */
 	uint invalid:1;						/* Wired page was invalidated */
+	uint8 referenced;					/* Read by a concurrent lookup */
 	int wirecnt;						/* Amount of wiring done for page */
 	ulong mstamp;						/* Modification stamp (counter) */
 	long numpag;						/* Cache key: page number within DB */
@@ -105,7 +124,7 @@ struct lru_cpage {
 };
 
 #define LRU_EMBEDDED_OFFSET		offsetof(struct lru_cpage, page)
-#define LRU_CPAGE_LEN			(DBM_PBLKSIZ + LRU_EMBEDDED_OFFSET)
+#define LRU_CPAGE_LEN(d)		((d)->pblksiz + LRU_EMBEDDED_OFFSET)
 
 static inline void
 sdbm_lru_cpage_check(const struct lru_cpage * const c)
@@ -135,7 +154,7 @@ sdbm_lru_cpage_alloc(DBM *db)
 
 	sdbm_check(db);
 
-	cp = walloc(LRU_CPAGE_LEN);
+	cp = walloc(LRU_CPAGE_LEN(db));
 	ZERO(cp);
 	cp->magic = SDBM_LRU_CPAGE_MAGIC;
 	cp->db = db;
@@ -159,15 +178,16 @@ sdbm_lru_cpage_free(struct lru_cpage *cp)
 
 	{
 		DBM *db = cp->db;
+		size_t len = LRU_CPAGE_LEN(db);
 
 		sdbm_check(db);
 		sdbm_lru_check(db->cache);
 
 		db->cache->cp_freed++;
-	}
 
-	ZERO(cp);
-	wfree(cp, LRU_CPAGE_LEN);
+		ZERO(cp);
+		wfree(cp, len);
+	}
 }
 
 /**
@@ -203,6 +223,184 @@ sdbm_lru_cpage_get(const DBM *db, const char *pag, bool safe)
 	return deconstify_pointer(cp);
 }
 
+#ifdef MMAP
+#define MMAP_LEN	MMAP_SIZE
+
+/**
+ * @return the maximum amount of pages we can access in place.
+ */
+static inline long
+lru_map_pages(const DBM *db)
+{
+	return (MMAP_LEN - db->pagoff) / db->pblksiz;
+}
+
+/**
+ * @return whether page address lies within the mapped .pag file.
+ */
+static inline bool
+lru_is_mapped(const struct lru_cache *cache, const char *pag)
+{
+	return cache->map != NULL && pag >= cache->map &&
+		pag < cache->map + MMAP_LEN;
+}
+
+/**
+ * Map the .pag file in memory.
+ *
+ * We map MMAP_SIZE bytes at once, regardless of the current file size, so
+ * that the address of a page never changes as the file grows through splits.
+ * Only the amount of pages we allow access to is extended as the file grows,
+ * since referencing the map past the end of the file would raise a SIGBUS.
+ *
+ * @return TRUE if the file could be mapped.
+ */
+static bool
+lru_map(DBM *db)
+{
+	struct lru_cache *cache = db->cache;
+	int prot = PROT_READ;
+	void *p;
+
+	g_assert(NULL == cache->map);
+
+	if (!(db->flags & DBM_RDONLY))
+		prot |= PROT_WRITE;
+
+	p = vmm_mmap(NULL, MMAP_LEN, prot, MAP_SHARED, db->pagf, 0);
+
+	if G_UNLIKELY(MAP_FAILED == p) {
+		s_warning("sdbm: \"%s\": cannot map .pag file, using LRU cache: %m",
+			sdbm_name(db));
+		cache->mmapped = FALSE;
+		return FALSE;
+	}
+
+	cache->map = p;
+	cache->mpages = 0;
+
+	return TRUE;
+}
+
+/**
+ * Unmap the .pag file, if mapped.
+ */
+static void
+lru_unmap(struct lru_cache *cache)
+{
+	if (cache->map != NULL) {
+		vmm_munmap(cache->map, MMAP_LEN);
+		cache->map = NULL;
+		cache->mpages = 0;
+	}
+}
+
+/**
+ * Get the address of a page within the mapped .pag file.
+ *
+ * Empty pages are not accessed in place: they could be holes in the file,
+ * and writing to them through the map would require the kernel to allocate
+ * disk blocks, raising a SIGBUS instead of an I/O error when the disk is
+ * full.  Corrupted pages are not either, leaving readpag() to deal with them.
+ *
+ * @param db		the database
+ * @param num		the page number
+ * @param grow		whether to look for file growth when page is not mapped
+ *
+ * @return page address in the map, NULL if the page must be cached instead.
+ */
+static char *
+lru_mapped_page(DBM *db, long num, bool grow)
+{
+	struct lru_cache *cache = db->cache;
+	const unsigned short *ino;
+	char *pag;
+
+	if (!cache->mmapped || num >= lru_map_pages(db))
+		return NULL;
+
+	if G_UNLIKELY(NULL == cache->map && !lru_map(db))
+		return NULL;
+
+	if (num >= cache->mpages) {
+		filestat_t buf;
+		long pages;
+
+		if (!grow || -1 == fstat(db->pagf, &buf))
+			return NULL;
+
+		/*
+		 * The file may have grown through splits since we last looked.
+		 */
+
+		pages = buf.st_size <= db->pagoff ? 0 :
+			MIN((buf.st_size - db->pagoff) / db->pblksiz, lru_map_pages(db));
+
+		if (pages > cache->mpages) {
+			cache->mpages = pages;
+			cache->mgrowths++;
+		}
+
+		if (num >= cache->mpages)
+			return NULL;
+	}
+
+	pag = cache->map + OFF_PAG(db, num);
+	ino = (const unsigned short *) pag;
+
+	if (0 == ino[0] || !sdbm_chkpage(pag, db->pblksiz))
+		return NULL;
+
+	return pag;
+}
+
+/**
+ * Mark current page, which is accessed in place, as dirty.
+ *
+ * The page already lies in the kernel buffers, so there is nothing to write
+ * back: we only need to synchronize it to disk when ``force'' is TRUE.
+ *
+ * @return TRUE on success.
+ */
+static bool
+lru_dirty_mapped(DBM *db, bool force)
+{
+	char *pag = db->pagbuf;
+
+	/*
+	 * Same check as flushpag(), but we must not clear the page since
+	 * this would also clear it on disk.
+	 */
+
+	if G_UNLIKELY(!sdbm_chkpage(pag, db->pblksiz)) {
+		sdbm_page_dump(db, pag, db->pagbno);
+		s_error("SDBM internal page corruption for %s\"%s\" (refcnt=%d)",
+			sdbm_is_thread_safe(db) ? "thread-safe " :"", sdbm_name(db),
+			sdbm_refcnt(db));
+	}
+
+	db->cache->cp_dirtied++;
+
+	if G_UNLIKELY(force) {
+		const void *start = vmm_page_start(pag);
+		const void *end = vmm_page_next(pag + db->pblksiz - 1);
+		size_t len = ptr_diff(end, start);
+
+		if (-1 == msync(deconstify_pointer(start), len, MS_SYNC)) {
+			s_warning("sdbm: \"%s\": cannot sync page #%ld: %m",
+				sdbm_name(db), db->pagbno);
+			ioerr(db, TRUE);
+			db->flush_errors++;
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+#else	/* !MMAP */
+#define lru_is_mapped(c,p)	FALSE
+#endif	/* MMAP */
+
 /**
  * Setup allocated LRU page cache.
  */
@@ -240,6 +438,9 @@ free_cached_page(void *data, void *unused)
 static void
 free_cache(struct lru_cache *cache)
 {
+#ifdef MMAP
+	lru_unmap(cache);
+#endif
 	hevset_foreach(cache->pagnum, free_cached_page, NULL);
 	hevset_free_null(&cache->pagnum);
 	elist_discard(&cache->lru);
@@ -264,9 +465,25 @@ init_cache(DBM *db, uint pages, bool wdelay)
 	setup_cache(cache, pages, wdelay);
 	db->cache = cache;
 
+#ifdef THREADS
+	if (db->lock != NULL)
+		lru_thread_safe(db);
+#endif
+
 	return 0;		/* Always OK */
 }
 
+/**
+ * Allow concurrent lookups of cached pages through lru_peek_page().
+ */
+void
+lru_thread_safe(DBM *db)
+{
+	sdbm_lru_check(db->cache);
+
+	hevset_thread_safe(db->cache->pagnum);
+}
+
 /**
  * Initialize the LRU page cache with default values.
  */
@@ -306,6 +523,30 @@ log_lrustats(DBM *db)
 		sdbm_name(db), cache->cp_wired, cache->cp_mod_wired);
 	s_info("sdbm: \"%s\" LRU pages dirtied = %lu, flushed = %lu",
 		sdbm_name(db), cache->cp_dirtied, cache->cp_flushed);
+#ifdef MMAP
+	if (cache->mmapped) {
+		s_info("sdbm: \"%s\" mapped pages = %ld, "
+			"accessed in place = %lu, file growths = %lu",
+			sdbm_name(db), cache->mpages, cache->mhits, cache->mgrowths);
+	}
+#endif
+}
+
+/**
+ * @return amount of wired pages in the cache.
+ */
+size_t
+lru_wired_count(const DBM *db)
+{
+	const struct lru_cache *cache = db->cache;
+
+	if (NULL == cache)
+		return 0;
+
+	sdbm_lru_check(cache);
+	assert_sdbm_locked(db);
+
+	return elist_count(&cache->wired);
 }
 
 /**
@@ -327,6 +568,14 @@ lru_page_log(const DBM *db, const char *pag)
 	sdbm_lru_check(cache);
 	assert_sdbm_locked(db);
 
+#ifdef MMAP
+	if (lru_is_mapped(cache, pag)) {
+		s_info("sdbm: \"%s\": %p is mapped: page #%ld", sdbm_name(db), pag,
+			(long) ((ptr_diff(pag, cache->map) - db->pagoff) / db->pblksiz));
+		return;
+	}
+#endif
+
 	cp = sdbm_lru_cpage_get(db, pag, TRUE);
 
 	if (NULL == cp) {
@@ -403,13 +652,24 @@ flush_dirtypag(const DBM *db)
 	sdbm_lru_check(cache);
 	assert_sdbm_locked(db);
 
+#ifdef WAL
+	/*
+	 * With a write-ahead log, the dirty pages are first committed to the
+	 * log as a single batch, after which they can be written in place
+	 * without having to wait for the data to reach the disk.
+	 */
+
+	if (db->wal != NULL && !wal_commit(deconstify_pointer(db)))
+		return -1;
+#endif
+
 	ELIST_FOREACH_DATA(&cache->lru, cp) {
 		sdbm_lru_cpage_valid(cp, db);
 		if (!flush_cpage(cp, &amount, &saved_errno))
 			break;
 	}
 
-	if (saved_errno != 0) {
+	if (0 == saved_errno) {
 		ELIST_FOREACH_DATA(&cache->wired, cp) {
 			sdbm_lru_cpage_valid(cp, db);
 			if (!flush_cpage(cp, &amount, &saved_errno))
@@ -417,14 +677,103 @@ flush_dirtypag(const DBM *db)
 		}
 	}
 
+#ifdef MMAP
+	/*
+	 * Initiate the write-back of pages modified in place.  We do not wait
+	 * for its completion, as we do not for the cached pages we flushed.
+	 */
+
+	if (cache->map != NULL && 0 == saved_errno) {
+		if (-1 == msync(cache->map, OFF_PAG(db, cache->mpages), MS_ASYNC))
+			saved_errno = errno;
+	}
+#endif
+
 	if (saved_errno != 0) {
 		errno = saved_errno;
 		return -1;
 	}
 
+#ifdef WAL
+	if (db->wal != NULL && !wal_checkpoint(deconstify_pointer(db), FALSE))
+		return -1;
+#endif
+
 	return amount;
 }
 
+/**
+ * Write back cached page to disk before evicting it from the cache.
+ *
+ * With a write-ahead log, the page cannot be written in place before its
+ * image is durably logged: all the dirty pages are committed as one batch
+ * and written back, leaving clean pages for the following evictions.
+ *
+ * @return TRUE on success.
+ */
+static bool
+evictbuf(struct lru_cpage *cp)
+{
+#ifdef WAL
+	if (cp->db->wal != NULL)
+		return -1 != flush_dirtypag(cp->db) && !cp->dirty;
+#endif
+
+	return writebuf(cp);
+}
+
+/**
+ * Iterate over all the dirty cached pages, in no particular order.
+ *
+ * @param db		the database
+ * @param cb		callback to invoke on each dirty page, may be NULL
+ * @param arg		additional callback argument
+ *
+ * @return the amount of dirty pages.
+ */
+size_t
+lru_foreach_dirty(const DBM *db, lru_dirty_cb_t cb, void *arg)
+{
+	const struct lru_cache *cache = db->cache;
+	struct lru_cpage *cp;
+	size_t n = 0;
+
+	if G_UNLIKELY(NULL == cache)
+		return 0;
+
+	sdbm_lru_check(cache);
+	assert_sdbm_locked(db);
+
+	ELIST_FOREACH_DATA(&cache->lru, cp) {
+		sdbm_lru_cpage_valid(cp, db);
+		if (cp->dirty) {
+			if (cb != NULL)
+				(*cb)(cp->numpag, cp->page, arg);
+			n++;
+		}
+	}
+
+	ELIST_FOREACH_DATA(&cache->wired, cp) {
+		sdbm_lru_cpage_valid(cp, db);
+		if (cp->dirty) {
+			if (cb != NULL)
+				(*cb)(cp->numpag, cp->page, arg);
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * @return whether writes to cached pages are deferred.
+ */
+static inline bool
+lru_write_deferred(const DBM *db)
+{
+	return db->cache->write_deferred || sdbm_has_wal(db);
+}
+
 /*
  * @return the configured max amount of pages in cache, 0 for no cache.
  */
@@ -563,10 +912,10 @@ setcache(DBM *db, uint pages)
 	 * provided it is not already wired..
 	 *
 	 * Note that db->pagbuf MUST be a cached page since caching was on,
-	 * provided that db->pagbno is valid.
+	 * provided that db->pagbno is valid and the page is not mapped.
 	 */
 
-	if (db->pagbno != -1) {
+	if (db->pagbno != -1 && !lru_is_mapped(cache, db->pagbuf)) {
 		struct lru_cpage *cp = sdbm_lru_cpage_get(db, db->pagbuf, TRUE);
 
 		g_assert_log(cp != NULL,
@@ -645,6 +994,66 @@ getwdelay(const DBM *db)
 	return cache != NULL && cache->write_deferred;
 }
 
+/**
+ * Turn in-place access of pages through a memory mapping on or off.
+ *
+ * The .pag file is only mapped on the next page access, and pages are
+ * still cached in the LRU when they cannot be safely accessed in place.
+ *
+ * @return -1 on error with errno set, 0 if OK.
+ */
+int
+setmmap(DBM *db, bool on)
+{
+#ifdef MMAP
+	struct lru_cache *cache = db->cache;
+
+	if (NULL == cache) {
+		if (-1 == init_cache(db, LRU_PAGES, FALSE))
+			return -1;
+		cache = db->cache;
+	}
+
+	sdbm_lru_check(cache);
+	assert_sdbm_locked(db);
+
+	if (on == cache->mmapped)
+		return 0;
+
+	if (!on) {
+		if (lru_is_mapped(cache, db->pagbuf)) {
+			db->pagbno = -1;		/* Address becoming invalid */
+			db->pagbuf = NULL;
+		}
+		lru_unmap(cache);		/* Changes are kept by the kernel */
+	}
+
+	cache->mmapped = booleanize(on);
+	return 0;
+#else
+	(void) db;
+	(void) on;
+	errno = ENOTSUP;
+	return -1;
+#endif	/* MMAP */
+}
+
+/**
+ * @return whether pages are accessed in place through a memory mapping.
+ */
+bool
+getmmap(const DBM *db)
+{
+#ifdef MMAP
+	const struct lru_cache *cache = db->cache;
+
+	return cache != NULL && cache->mmapped;
+#else
+	(void) db;
+	return FALSE;
+#endif
+}
+
 /**
  * Close (i.e. free) the LRU page cache.
  *
@@ -673,7 +1082,12 @@ lru_close(DBM *db)
 void
 modifypag(const DBM *db, const char *pag)
 {
-	struct lru_cpage *cp = sdbm_lru_cpage_get(db, pag, FALSE);
+	struct lru_cpage *cp;
+
+	if (lru_is_mapped(db->cache, pag))
+		return;			/* Wired pages are never accessed in place */
+
+	cp = sdbm_lru_cpage_get(db, pag, FALSE);
 
 	g_assert_log(cp != NULL,		/* Page must be cached */
 		"%s(): sdbm \"%s\": %p not in LRU cache (pagbuf=%p, pabgno=%ld)",
@@ -751,6 +1165,14 @@ lru_wire(DBM *db, long num, ulong *mstamp)
 		}
 		cp->numpag = num;
 		hevset_insert(cache->pagnum, cp);
+
+		/*
+		 * If the current page was accessed in place, it must now be accessed
+		 * through its wired copy so that changes to it are tracked.
+		 */
+
+		if (db->pagbno == num && lru_is_mapped(cache, db->pagbuf))
+			db->pagbuf = cp->page;
 	}
 
 	g_assert(cp->wired);
@@ -826,7 +1248,7 @@ lru_unwire(DBM *db, const char *pag)
 
 			sdbm_lru_cpage_valid(old, db);
 
-			if (old->dirty && writebuf(old)) {
+			if (old->dirty && evictbuf(old)) {
 				if (db->pagbno == old->numpag)
 					db->pagbno = -1;
 				elist_remove(&cache->lru, old);
@@ -852,8 +1274,20 @@ freepage:
 	 * Unwired page not kept in the cache.
 	 */
 
-	if (cp->dirty)
+	if (cp->dirty) {
+#ifdef WAL
+		/*
+		 * The page is no longer listed, so its image must be committed
+		 * explicitly along with the dirty pages.
+		 */
+
+		if (db->wal != NULL) {
+			if (wal_commit_page(db, cp->numpag, cp->page))
+				writebuf(cp);
+		} else
+#endif
 		writebuf(cp);
+	}
 
 	if (db->pagbno == cp->numpag) {
 		db->pagbuf = NULL;		/* Reference to cp->page becoming invalid */
@@ -880,14 +1314,22 @@ freepage:
 /**
  * Mark current page as dirty.
  * If there are no deferred writes, the page is immediately flushed to disk.
- * If ``force'' is TRUE, we also ignore deferred writes and flush the page.
+ * If ``force'' is TRUE, we also ignore deferred writes and flush the page,
+ * which with a write-ahead log means committing it.
  * @return TRUE on success.
  */
 bool
 dirtypag(DBM *db, bool force)
 {
 	struct lru_cache *cache = db->cache;
-	struct lru_cpage *cp = sdbm_lru_cpage_get(db, db->pagbuf, FALSE);
+	struct lru_cpage *cp;
+
+#ifdef MMAP
+	if (lru_is_mapped(cache, db->pagbuf))
+		return lru_dirty_mapped(db, force);
+#endif
+
+	cp = sdbm_lru_cpage_get(db, db->pagbuf, FALSE);
 
 	g_assert_log(cp != NULL,		/* Page must be cached */
 		"%s(): sdbm \"%s\": %p not in LRU cache (pabgno=%ld)",
@@ -898,7 +1340,7 @@ dirtypag(DBM *db, bool force)
 
 	cache->cp_dirtied++;
 
-	if (cache->write_deferred && !force) {
+	if ((cache->write_deferred || sdbm_has_wal(db)) && !force) {
 		if (cp->dirty)
 			cache->whits++;		/* Was already dirty -> write cache hit */
 		else
@@ -907,6 +1349,19 @@ dirtypag(DBM *db, bool force)
 		return TRUE;
 	}
 
+#ifdef WAL
+	/*
+	 * With a write-ahead log, forcing the page means committing it, along
+	 * with the other dirty pages and the dir block, which is durable once
+	 * the log is synchronized.
+	 */
+
+	if (sdbm_has_wal(db)) {
+		cp->dirty = TRUE;
+		return -1 != flush_dirtypag(db);
+	}
+#endif
+
 	/*
 	 * Flush current page to the disk.  If they are forcing the flush,
 	 * make sure we ask the kernel to synchronize the data as well.
@@ -949,17 +1404,30 @@ getcpage(DBM *db, long num)
 		elist_prepend(&cache->lru, cp);
 	} else {
 		bool had_ioerr = booleanize(db->flags & DBM_IOERR_W);
+		size_t n;
 
 		/*
 		 * We need to evict the least-recently used page from the cache to be
 		 * able to reuse its entry.
+		 *
+		 * Pages read by concurrent lookups since they were last moved in the
+		 * list are given a second chance first, and so is the current page,
+		 * which makroom() can still be splitting when it caches the new page.
 		 */
 
+		for (n = elist_count(&cache->lru); n != 0; n--) {
+			cp = elist_tail(&cache->lru);
+			if G_LIKELY(!cp->referenced && cp->numpag != db->pagbno)
+				break;
+			cp->referenced = FALSE;
+			elist_moveto_head(&cache->lru, cp);
+		}
+
 		cp = elist_tail(&cache->lru);
 
 		sdbm_lru_cpage_valid(cp, db);
 
-		if (cp->dirty && !writebuf(cp)) {
+		if (cp->dirty && !evictbuf(cp)) {
 			bool slot_found = FALSE;
 
 			/*
@@ -1060,6 +1528,52 @@ lru_cached_page(DBM *db, long num)
 	return NULL == cp ? NULL : cp->page;
 }
 
+/**
+ * Get the address of a page that can be read without any I/O, leaving the
+ * cache untouched: pages held in the cache or accessed in place.
+ *
+ * This is meant for concurrent readers, which hold the database latch in
+ * shared mode and therefore cannot modify the cache.
+ *
+ * @param db		the database
+ * @param num		the page number in the DB
+ *
+ * @return page address if readily available, NULL otherwise.
+ */
+const char *
+lru_peek_page(const DBM *db, long num)
+{
+	const struct lru_cache *cache = db->cache;
+	struct lru_cpage *cp;
+
+	g_assert(num >= 0);
+
+	if G_UNLIKELY(NULL == cache)
+		return NULL;
+
+	sdbm_lru_check(cache);
+
+	cp = hevset_lookup(cache->pagnum, &num);
+
+	if (cp != NULL) {
+		sdbm_lru_cpage_valid(cp, db);
+		cp->referenced = TRUE;
+		return cp->page;
+	}
+
+#ifdef MMAP
+	if (cache->mmapped && cache->map != NULL && num < cache->mpages) {
+		const char *pag = cache->map + OFF_PAG(db, num);
+		const unsigned short *ino = (const unsigned short *) pag;
+
+		if (ino[0] != 0 && sdbm_chkpage(pag, db->pblksiz))
+			return pag;
+	}
+#endif	/* MMAP */
+
+	return NULL;
+}
+
 static bool
 lru_discard_page(void *data, void *udata)
 {
@@ -1098,7 +1612,7 @@ lru_discard_wired_page(struct lru_cpage *cp, long bno)
 		ATOMIC_INC(&cp->mstamp);
 		cp->dirty = FALSE;
 		cp->invalid = TRUE;
-		memset(cp->page, 0, DBM_PBLKSIZ);
+		memset(cp->page, 0, cp->db->pblksiz);
 
 		sdbm_lru_check(cp->db->cache);
 		cp->db->cache->cp_discarded++;
@@ -1125,6 +1639,19 @@ lru_discard(DBM *db, long bno)
 		lru_discard_wired_page(cp, bno);
 	}
 
+#ifdef MMAP
+	/*
+	 * Pages past the new end of the file can no longer be accessed in place.
+	 * When the whole file is discarded, it may also be replaced by a rebuilt
+	 * one, so we drop the mapping, to be re-established on the next access.
+	 */
+
+	if (0 == bno)
+		lru_unmap(cache);
+	else
+		cache->mpages = MIN(cache->mpages, bno);
+#endif
+
 	if (db->pagbno >= bno)
 		db->pagbno = -1;		/* We discarded that old page */
 }
@@ -1204,7 +1731,7 @@ lru_tail_offset(const DBM *db)
 			bno = MAX(bno, cp->numpag);
 	}
 
-	return OFF_PAG(bno + 1);
+	return -1 == bno ? 0 : OFF_PAG(db, bno + 1);
 }
 
 /**
@@ -1230,6 +1757,44 @@ readbuf(DBM *db, long num, bool *loaded)
 
 	cp = hevset_lookup(cache->pagnum, &num);
 
+#ifdef MMAP
+	if (cache->mmapped) {
+		char *pag = NULL;
+
+		/*
+		 * A page that had to be cached whilst it could not be accessed
+		 * in place is flushed and released as soon as it can be.
+		 */
+
+		if (NULL == cp) {
+			pag = lru_mapped_page(db, num, TRUE);
+		} else if (
+			!cp->wired && num < cache->mpages &&
+			(!cp->dirty || evictbuf(cp))
+		) {
+			pag = lru_mapped_page(db, num, FALSE);
+
+			if (pag != NULL) {
+				bool found;
+
+				sdbm_lru_cpage_valid(cp, db);
+				elist_remove(&cache->lru, cp);
+				found = hevset_remove(cache->pagnum, &num);
+				g_assert(found);
+				sdbm_lru_cpage_free(cp);
+			}
+		}
+
+		if (pag != NULL) {
+			cache->mhits++;
+			db->pagbuf = pag;
+			if (loaded != NULL)
+				*loaded = TRUE;
+			return TRUE;
+		}
+	}
+#endif	/* MMAP */
+
 	if (cp != NULL) {
 		sdbm_lru_cpage_valid(cp, db);
 
@@ -1324,20 +1889,20 @@ cachepag(DBM *db, char *pag, long num)
 		 * Supersede cached page with new page created by makroom().
 		 */
 
-		memmove(cpag, pag, DBM_PBLKSIZ);
+		memmove(cpag, pag, db->pblksiz);
 
-		if (cache->write_deferred) {
+		if (lru_write_deferred(db)) {
 			cp->dirty = TRUE;
 		} else {
 			cp->dirty = !flushpag(db, pag, num);
 		}
 		return TRUE;
-	} else if (cache->write_deferred) {
+	} else if (lru_write_deferred(db)) {
 		cp = getcpage(db, num);
 		if (NULL == cp)
 			return FALSE;
 
-		memmove(cp->page, pag, DBM_PBLKSIZ);
+		memmove(cp->page, pag, db->pblksiz);
 		cp->dirty = TRUE;
 		return TRUE;
 	} else {
@@ -1355,10 +1920,10 @@ cachepag(DBM *db, char *pag, long num)
 static bool
 lru_chkpage(DBM *db, char *pag, long num)
 {
-	if G_UNLIKELY(!sdbm_chkpage(pag)) {
+	if G_UNLIKELY(!sdbm_chkpage(pag, db->pblksiz)) {
 		s_critical("sdbm: \"%s\": corrupted page #%ld, clearing",
 			sdbm_name(db), num);
-		memset(pag, 0, DBM_PBLKSIZ);
+		memset(pag, 0, db->pblksiz);
 		db->bad_pages++;
 		return FALSE;
 	}
@@ -1388,14 +1953,14 @@ readpag(DBM *db, char *pag, long num)
 	 */
 
 	db->pagread++;
-	got = compat_pread(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num));
+	got = compat_pread(db->pagf, pag, db->pblksiz, OFF_PAG(db, num));
 	if G_UNLIKELY(got < 0) {
 		s_critical("sdbm: \"%s\": cannot read page #%ld: %m",
 			sdbm_name(db), num);
 		ioerr(db, FALSE);
 		return FALSE;
 	}
-	if G_UNLIKELY(got < DBM_PBLKSIZ) {
+	if G_UNLIKELY(got < db->pblksiz) {
 		if (got > 0) {
 			s_critical("sdbm: \"%s\": partial read (%u bytes) of page #%ld",
 				sdbm_name(db), (unsigned) got, num);
@@ -1417,7 +1982,7 @@ readpag(DBM *db, char *pag, long num)
 				sdbm_name(db), num, n, plural(n));
 		}
 
-		memset(pag, 0, DBM_PBLKSIZ);
+		memset(pag, 0, db->pblksiz);
 	}
 
 	(void) lru_chkpage(db, pag, num);
@@ -1453,9 +2018,9 @@ flushpag(DBM *db, char *pag, long num)
 	}
 
 	db->pagwrite++;
-	w = compat_pwrite(db->pagf, pag, DBM_PBLKSIZ, OFF_PAG(num));
+	w = compat_pwrite(db->pagf, pag, db->pblksiz, OFF_PAG(db, num));
 
-	if (w < 0 || w != DBM_PBLKSIZ) {
+	if (w < 0 || w != db->pblksiz) {
 		if (w < 0) {
 			if G_UNLIKELY(db->flags & DBM_RDONLY)
 				errno = EPERM;		/* Instead of EBADF on linux */
@@ -2,6 +2,7 @@
 #define delpair sdbm__delpair
 #define duppair sdbm__duppair
 #define exipair sdbm__exipair
+#define peekpair sdbm__peekpair
 #define fitpair sdbm__fitpair
 #define getnkey sdbm__getnkey
 #define getnval sdbm__getnval
@@ -18,7 +19,7 @@
 #define readpairv sdbm__readpairv
 
 #define INO(p)		((unsigned short *) (p))
-#define INO_MAX		(DBM_PBLKSIZ / sizeof(unsigned short) - 1)
+#define INO_MAX(s)	((s) / sizeof(unsigned short) - 1)
 
 #define BIG_FLAG	(1 << 15)
 #define BIG_MASK	(BIG_FLAG - 1)
@@ -67,6 +68,7 @@ extern bool fitpair(const DBM *, const char *, size_t);
 extern bool putpair(DBM *, char *, datum, datum);
 extern datum getpair(DBM *, char *, datum);
 extern bool exipair(DBM *, const char *, datum);
+extern int peekpair(const DBM *, const char *, datum, datum *);
 extern bool delpair(DBM *, char *, datum);
 extern bool delnpair(DBM *, char *, int);
 extern bool delipair(DBM *, char *, int, bool);
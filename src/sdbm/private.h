@@ -6,7 +6,9 @@
 
 struct DBMBIG;
 struct qlock;			/* Avoid including "qlock.h" here */
+struct rwlock;			/* Avoid including "rwlock.h" here */
 struct lru_cache;
+struct DBMWAL;
 
 enum sdbm_magic { SDBM_MAGIC = 0x1dac340e };
 
@@ -24,13 +26,18 @@ struct DBM {
 	struct DBMBIG *big;	/* big key/value data management */
 	char *datname;		/* file name for .dat (created only when needed) */
 #endif
-	char *pagbuf;		/* page file block buffer (size: DBM_PBLKSIZ) */
+#ifdef WAL
+	struct DBMWAL *wal;	/* write-ahead log, NULL if not enabled */
+	char *walname;		/* file name for .wal */
+#endif
+	char *pagbuf;		/* page file block buffer (size: pblksiz) */
 	char *dirbuf;		/* directory file block buffer (size: DBM_DBLKSIZ) */
 #ifdef LRU
 	struct lru_cache *cache;	/* LRU page cache */
 #endif
 #ifdef THREADS
 	struct qlock *lock;	/* thread-safe lock at the API level */
+	struct rwlock *latch;	/* shared by readers, taken with `lock' */
 	int refcnt;			/* reference count */
 #endif
 	struct DBM *rdb;	/* if non-NULL, concurrent DB rebuild in progress */
@@ -40,6 +47,9 @@ struct DBM {
 	long hmask;			/* current hash mask */
 	long blkptr;		/* current block for nextkey */
 	long pagbno;		/* current page in pagbuf */
+	long pblksiz;		/* size of a page within the ".pag" file */
+	long pairmax;		/* maximum size of a key/value pair in a page */
+	long pagoff;		/* offset of page #0 (size of .pag header, if any) */
 	long dirbno;		/* current block in dirbuf */
 	long delta;			/* algebraic count of pairs added (deleted if <0) */
 	int dirf;			/* directory file descriptor */
@@ -79,11 +89,17 @@ struct DBM {
 #ifdef THREADS
 	struct dbm_returns *returned;	/* per-thread returned values */
 	uint iterid;		/* thread small ID for iterating */
+	uint shared_lookups;	/* stats: lookups done with shared latch */
+	uint shared_retries;	/* stats: shared lookups retried exclusively */
 #endif
 };
 
 /*
  * Thread-safety macros.
+ *
+ * Holding the database lock also means holding the latch in exclusive mode,
+ * so that lookups made with the latch held in shared mode, which do not
+ * take the lock, never see the database being modified.
  */
 
 #ifdef THREADS
@@ -92,26 +108,32 @@ struct DBM {
 	if G_UNLIKELY((s)->lock != NULL) { 			\
 		DBM *ws = deconstify_pointer(s);		\
 		qlock_lock(ws->lock);					\
+		rwlock_wlock(ws->latch);				\
 	}											\
 } G_STMT_END
 
 #define sdbm_synchronize_yield(s) G_STMT_START {\
 	if G_UNLIKELY((s)->lock != NULL) { 			\
 		DBM *ws = deconstify_pointer(s);		\
+		rwlock_wunlock(ws->latch);				\
 		qlock_rotate(ws->lock);					\
+		rwlock_wlock(ws->latch);				\
 	}											\
 } G_STMT_END
 
 #define sdbm_unsynchronize(s) G_STMT_START {	\
 	if G_UNLIKELY((s)->lock != NULL) { 			\
 		DBM *ws = deconstify_pointer(s);		\
+		rwlock_wunlock(ws->latch);				\
 		qlock_unlock(ws->lock);					\
 	}											\
 } G_STMT_END
 
 #define sdbm_return(s, v) G_STMT_START {		\
-	if G_UNLIKELY((s)->lock != NULL) 			\
+	if G_UNLIKELY((s)->lock != NULL) { 			\
+		rwlock_wunlock((s)->latch);				\
 		qlock_unlock((s)->lock);				\
+	}											\
 	return v;									\
 } G_STMT_END
 
@@ -119,6 +141,7 @@ struct DBM {
 	datum *rv = &(v);							\
 	if G_UNLIKELY((s)->lock != NULL) { 			\
 		rv = sdbm_thread_datum((s), &(v));		\
+		rwlock_wunlock((s)->latch);				\
 		qlock_unlock((s)->lock);				\
 	}											\
 	return *rv;									\
@@ -149,9 +172,9 @@ sdbm_check(const DBM * const db)
 }
 
 static inline long
-OFF_PAG(unsigned long off)
+OFF_PAG(const DBM *db, unsigned long off)
 {
-	return off * DBM_PBLKSIZ;
+	return db->pagoff + off * db->pblksiz;
 }
 
 static inline long
@@ -160,6 +183,17 @@ OFF_DIR(unsigned long off)
 	return off * DBM_DBLKSIZ;
 }
 
+static inline bool
+sdbm_has_wal(const DBM *db)
+{
+#ifdef WAL
+	return db->wal != NULL;
+#else
+	(void) db;
+	return FALSE;
+#endif
+}
+
 static inline void
 ioerr(DBM *db, bool on_write)
 {
@@ -19,12 +19,14 @@
 #include "big.h"
 #include "lru.h"
 #include "tmp.h"
+#include "wal.h"
 
 #include "lib/halloc.h"
 #include "lib/hstrfn.h"
 #include "lib/log.h"
 #include "lib/qlock.h"
 #include "lib/random.h"
+#include "lib/rwlock.h"
 #include "lib/str.h"
 
 #include "lib/override.h"		/* Must be the last header included */
@@ -110,6 +112,7 @@ sdbm_replace_descriptor(DBM *db, DBM *ndb)
 {
 	char *dirname, *pagname, *datname;
 	int error = 0;
+	bool logged = sdbm_has_wal(db);
 
 	assert_sdbm_locked(db);
 
@@ -142,6 +145,7 @@ sdbm_replace_descriptor(DBM *db, DBM *ndb)
 	g_assert(NULL == ndb->lock);		/* Since `ndb' was not thread-safe */
 	g_assert(NULL == ndb->returned);
 	ndb->lock = db->lock;
+	ndb->latch = db->latch;
 	ndb->returned = db->returned;
 	ndb->refcnt = db->refcnt;
 #endif
@@ -160,6 +164,7 @@ sdbm_replace_descriptor(DBM *db, DBM *ndb)
 	db->pagbno = -1;							/* Restarting, no cached data */
 #ifdef THREADS
 	ndb->lock = NULL;							/* was copied over */
+	ndb->latch = NULL;
 	ndb->returned = NULL;
 #endif
 
@@ -171,6 +176,20 @@ sdbm_replace_descriptor(DBM *db, DBM *ndb)
 	if (-1 == sdbm_rename_files(db, dirname, pagname, datname))
 		error = errno;
 
+#ifdef WAL
+	/*
+	 * The new database was built without a write-ahead log, since it is
+	 * fully synchronized above.  Resume logging if the old one had it.
+	 */
+
+	if (0 == error && logged && -1 == wal_open(db)) {
+		s_warning("sdbm: \"%s\": cannot re-create write-ahead log: %m",
+			sdbm_name(db));
+	}
+#else
+	(void) logged;
+#endif
+
 	HFREE_NULL(dirname);
 	HFREE_NULL(pagname);
 	HFREE_NULL(datname);
@@ -222,11 +241,12 @@ rebuild_copy(const datum key, const datum value, void *arg)
  *
  * @param db		the database to rebuild
  * @param async		TRUE if rebuild happens concurrently
+ * @param pagesize	page size of the rebuilt database, 0 to keep current one
  *
  * @return 0 if OK, -1 on failure.
  */
 static int
-sdbm_rebuild_internal(DBM *db, bool async)
+sdbm_rebuild_internal(DBM *db, bool async, long pagesize)
 {
 	DBM *ndb;
 	char ext[11];
@@ -242,6 +262,21 @@ sdbm_rebuild_internal(DBM *db, bool async)
 	if (!sdbm_can_rebuild(db, async))
 		goto failed;		/* errno was already set */
 
+	if (0 == pagesize)
+		pagesize = db->pblksiz;
+
+#ifdef LRU
+	/*
+	 * Wired pages are kept in the cache across the rebuild, which is only
+	 * possible when the page size does not change.
+	 */
+
+	if (pagesize != db->pblksiz && 0 != lru_wired_count(db)) {
+		errno = EBUSY;		/* Loose iteration in progress */
+		goto failed;
+	}
+#endif
+
 	str_bprintf(ARYLEN(ext), ".%08x%c", random_u32(), async ? '~' : '\0');
 	dirname = h_strconcat(db->dirname, ext, NULL_PTR);
 	pagname = h_strconcat(db->pagname, ext, NULL_PTR);
@@ -265,8 +300,8 @@ sdbm_rebuild_internal(DBM *db, bool async)
 	 * has been done and we are ready to replace the old descriptor.
 	 */
 
-	ndb = sdbm_prep(dirname, pagname, datname,
-		O_WRONLY | O_CREAT | O_EXCL, db->openmode);
+	ndb = sdbm_prep_pagesize(dirname, pagname, datname,
+		O_WRONLY | O_CREAT | O_EXCL, db->openmode, pagesize);
 
 	if (NULL == ndb) {
 		error = errno;
@@ -415,7 +450,24 @@ failed:
 int
 sdbm_rebuild(DBM *db)
 {
-	return sdbm_rebuild_internal(db, FALSE);
+	return sdbm_rebuild_internal(db, FALSE, 0);
+}
+
+/**
+ * Rebuild database from scratch, converting it to the specified page size.
+ *
+ * This is the only way to change the page size of an existing database,
+ * which is otherwise the one it was created with.
+ *
+ * @param db		the database to rebuild
+ * @param pagesize	the new page size, 0 meaning the current page size
+ *
+ * @return 0 if OK, -1 on failure.
+ */
+int
+sdbm_rebuild_pagesize(DBM *db, long pagesize)
+{
+	return sdbm_rebuild_internal(db, FALSE, pagesize);
 }
 
 /**
@@ -439,7 +491,7 @@ sdbm_rebuild_async(DBM *db)
 
 	sdbm_warn_if_not_separate(db, G_STRFUNC);
 
-	return sdbm_rebuild_internal(db, TRUE);
+	return sdbm_rebuild_internal(db, TRUE, 0);
 }
 
 /* vi: set ts=4 sw=4 cindent: */
@@ -15,12 +15,14 @@
 #include "lru.h"
 #include "big.h"
 #include "tmp.h"
+#include "wal.h"
 #include "private.h"
 
 #include "lib/atomic.h"
 #include "lib/compat_misc.h"
 #include "lib/compat_pio.h"
 #include "lib/debug.h"
+#include "lib/endian.h"
 #include "lib/fd.h"
 #include "lib/file.h"
 #include "lib/halloc.h"
@@ -29,6 +31,7 @@
 #include "lib/misc.h"
 #include "lib/pow2.h"
 #include "lib/qlock.h"
+#include "lib/rwlock.h"
 #include "lib/stringify.h"
 #include "lib/thread.h"
 #include "lib/vmm.h"
@@ -39,6 +42,17 @@
 
 #define SDBM_COUNT_PAGES	128	/* Amount of pages read by sdbm_count() */
 
+/*
+ * Header of .pag files whose pages are not DBM_PBLKSIZ bytes long, which
+ * fills the whole first page-sized block of the file.  The leading bytes of
+ * the magic string are odd so that it can never be mistaken for a valid
+ * page by older versions: the amount of offsets on a page is always even.
+ */
+#define SDBM_PAGHDR_MAGIC	"\177\177SDBM\r\n"	/* Magic string (8 bytes) */
+#define SDBM_PAGHDR_MLEN	(sizeof(SDBM_PAGHDR_MAGIC) - 1)
+#define SDBM_PAGHDR_VERSION	1		/* Version of the header, BE32 */
+#define SDBM_PAGHDR_LEN		(SDBM_PAGHDR_MLEN + 8)	/* Magic + version + size */
+
 const datum nullitem = {0, 0};
 
 /*
@@ -47,18 +61,21 @@ const datum nullitem = {0, 0};
 static bool getdbit(DBM *, long);
 static bool setdbit(DBM *, long);
 static bool getpage(DBM *, long);
+#ifdef THREADS
+static long peekpageb(const DBM *, long);
+#endif
 static datum getnext(DBM *);
 static bool makroom(DBM *, long, size_t);
 static void validpage(DBM *, long);
 
 static inline int
-bad(const datum item)
+bad(const DBM *db, const datum item)
 {
 #ifdef BIGDATA
 	return NULL == item.dptr ||
-		(item.dsize > DBM_PAIRMAX && bigkey_length(item.dsize) > DBM_PAIRMAX);
+		(item.dsize > db->pairmax && bigkey_length(item.dsize) > db->pairmax);
 #else
-	return NULL == item.dptr || item.dsize > DBM_PAIRMAX;
+	return NULL == item.dptr || item.dsize > db->pairmax;
 #endif
 }
 
@@ -83,11 +100,17 @@ static const long masks[] = {
  * Can the key/value pair of the given size fit, and how much room do we
  * need for it in the page?
  *
+ * @param pairmax		the maximum size of a pair in the page
+ * @param key_size		the size of the key
+ * @param value_size	the size of the value
+ * @param needed		if non-NULL, written with the room needed in the page
+ *
  * @return FALSE if it will not fit, TRUE if it fits with the required
  * page size filled in ``needed'', if not NULL.
  */
 static bool
-sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
+sdbm_storage_needs(size_t pairmax,
+	size_t key_size, size_t value_size, size_t *needed)
 {
 #ifdef BIGDATA
 	/*
@@ -95,7 +118,7 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 	 *
 	 * Instead of just checking:
 	 *
-	 *		key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= value_size
+	 *		key_size <= pairmax && pairmax - key_size >= value_size
 	 *
 	 * which would only indicate whether the expanded key and value can
 	 * fit in the page we look at whether the sum of key + value sizes is
@@ -108,9 +131,9 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 	 */
 
 	if (
-		key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= value_size &&
+		key_size <= pairmax && pairmax - key_size >= value_size &&
 		(
-			key_size + value_size < DBM_PAIRMAX / 2 ||
+			key_size + value_size < pairmax / 2 ||
 			value_size < DBM_BBLKSIZ / 2
 		)
 	) {
@@ -130,10 +153,10 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 
 		vl = bigval_length(value_size);
 
-		if (vl >= DBM_PAIRMAX)		/* Cannot store by indirection anyway */
+		if (vl >= pairmax)		/* Cannot store by indirection anyway */
 			return FALSE;
 
-		if (key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= vl) {
+		if (key_size <= pairmax && pairmax - key_size >= vl) {
 			/* Will expand the key but store the value in the .dat file */
 			if (needed != NULL)
 				*needed = key_size + vl;
@@ -148,12 +171,12 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 
 		if (needed != NULL)
 			*needed = kl + vl;
-		return kl <= DBM_PAIRMAX && DBM_PAIRMAX - kl >= vl;
+		return kl <= pairmax && pairmax - kl >= vl;
 	}
 #else	/* !BIGDATA */
 	if (needed != NULL)
 		*needed = key_size + value_size;
-	return key_size <= DBM_PAIRMAX && DBM_PAIRMAX - key_size >= value_size;
+	return key_size <= pairmax && pairmax - key_size >= value_size;
 #endif
 }
 
@@ -163,20 +186,26 @@ sdbm_storage_needs(size_t key_size, size_t value_size, size_t *needed)
 bool
 sdbm_is_storable(size_t key_size, size_t value_size)
 {
-	return sdbm_storage_needs(key_size, value_size, NULL);
+	return sdbm_storage_needs(DBM_PAIRMAX, key_size, value_size, NULL);
 }
 
 /**
- * Open database with specified flags and mode (like open() arguments).
+ * Open database with specified flags and mode (like open() arguments),
+ * creating it with the given page size if it does not exist yet.
+ *
+ * The page size of an existing database is the one it was created with,
+ * the `pagesize' argument being ignored: use sdbm_rebuild_pagesize() to
+ * convert a database to another page size.
  *
  * @param file		the basename to use for deriving .pag, .dir and .dat names
  * @param flags		open() flags
  * @param mode		open() mode
+ * @param pagesize	size of .pag pages for new databases, 0 for the default
  *
  * @return the created database, or NULL on error with errno set.
  */
 DBM *
-sdbm_open(const char *file, int flags, int mode)
+sdbm_open_pagesize(const char *file, int flags, int mode, long pagesize)
 {
 	DBM *db = NULL;
 	char *dirname = NULL;
@@ -206,7 +235,7 @@ sdbm_open(const char *file, int flags, int mode)
 	}
 #endif
 
-	db = sdbm_prep(dirname, pagname, datname, flags, mode);
+	db = sdbm_prep_pagesize(dirname, pagname, datname, flags, mode, pagesize);
 
 	/* FALL THROUGH */
 
@@ -218,6 +247,21 @@ error:
 	return db;
 }
 
+/**
+ * Open database with specified flags and mode (like open() arguments).
+ *
+ * @param file		the basename to use for deriving .pag, .dir and .dat names
+ * @param flags		open() flags
+ * @param mode		open() mode
+ *
+ * @return the created database, or NULL on error with errno set.
+ */
+DBM *
+sdbm_open(const char *file, int flags, int mode)
+{
+	return sdbm_open_pagesize(file, flags, mode, DBM_PBLKSIZ);
+}
+
 static inline DBM *
 sdbm_alloc(void)
 {
@@ -314,6 +358,147 @@ sdbm_name(const DBM *db)
 	return db->name;
 }
 
+/**
+ * @return whether the page size is supported for .pag files.
+ */
+static inline bool
+sdbm_pagesize_is_valid(long size)
+{
+	return size >= DBM_PBLKSIZ && size <= DBM_PBLKSIZ_MAX &&
+		IS_POWER_OF_2(size);
+}
+
+/**
+ * Read the header of a .pag file.
+ *
+ * @param fd		the opened .pag file
+ *
+ * @return the page size recorded in the header, 0 if there is no header
+ * (the file then holds DBM_PBLKSIZ pages), -1 on error with errno set.
+ */
+long
+sdbm_pagfile_header(int fd)
+{
+	char hdr[SDBM_PAGHDR_LEN];
+	ssize_t r;
+	long size;
+
+	r = compat_pread(fd, hdr, sizeof hdr, 0);
+
+	if G_UNLIKELY(-1 == r)
+		return -1;
+
+	if (
+		r != sizeof hdr ||
+		0 != memcmp(hdr, SDBM_PAGHDR_MAGIC, SDBM_PAGHDR_MLEN)
+	)
+		return 0;		/* Legacy file, no header */
+
+	size = peek_be32(&hdr[SDBM_PAGHDR_MLEN + 4]);
+
+	if G_UNLIKELY(
+		SDBM_PAGHDR_VERSION != peek_be32(&hdr[SDBM_PAGHDR_MLEN]) ||
+		!sdbm_pagesize_is_valid(size)
+	) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return size;
+}
+
+/**
+ * Write the header of the .pag file, recording the page size.
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+static bool
+sdbm_pagfile_write_header(DBM *db)
+{
+	char *hdr;
+	ssize_t w;
+
+	hdr = walloc0(db->pblksiz);
+	memcpy(hdr, SDBM_PAGHDR_MAGIC, SDBM_PAGHDR_MLEN);
+	poke_be32(&hdr[SDBM_PAGHDR_MLEN], SDBM_PAGHDR_VERSION);
+	poke_be32(&hdr[SDBM_PAGHDR_MLEN + 4], db->pblksiz);
+
+	w = compat_pwrite(db->pagf, hdr, db->pblksiz, 0);
+	wfree(hdr, db->pblksiz);
+
+	if G_UNLIKELY(w != db->pblksiz) {
+		if (w >= 0)
+			errno = EIO;	/* Partial write */
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Record the page size of the database.
+ */
+static void
+sdbm_set_pagesize(DBM *db, long size)
+{
+	g_assert(sdbm_pagesize_is_valid(size));
+
+	db->pblksiz = size;
+	db->pairmax = size - DBM_PAGOVER;
+	db->pagoff = DBM_PBLKSIZ == size ? 0 : size;	/* Header size */
+}
+
+/**
+ * Determine the page size of the opened .pag file.
+ *
+ * Only files with non-default page sizes have a header, so that databases
+ * with DBM_PBLKSIZ pages remain readable by older versions.  An empty .pag
+ * file opened for writing is given the requested page size.
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+static bool
+sdbm_pagfile_setup(DBM *db, long pagesize)
+{
+	long size;
+
+	size = sdbm_pagfile_header(db->pagf);
+
+	if G_UNLIKELY(-1 == size)
+		return FALSE;
+
+	if (0 == size) {
+		filestat_t buf;
+
+		if (-1 == fstat(db->pagf, &buf))
+			return FALSE;
+
+		if (
+			0 == buf.st_size && DBM_PBLKSIZ != pagesize &&
+			!(db->flags & DBM_RDONLY)
+		) {
+			sdbm_set_pagesize(db, pagesize);
+			return sdbm_pagfile_write_header(db);
+		}
+
+		size = DBM_PBLKSIZ;
+	}
+
+	sdbm_set_pagesize(db, size);
+	return TRUE;
+}
+
+/**
+ * @return the size of the pages within the .pag file.
+ */
+long
+sdbm_pagesize(const DBM *db)
+{
+	sdbm_check(db);
+
+	return db->pblksiz;
+}
+
 /**
  * Open database with specified files, flags and mode (like open() arguments).
  *
@@ -331,10 +516,42 @@ sdbm_name(const DBM *db)
 DBM *
 sdbm_prep(const char *dirname, const char *pagname,
 	const char *datname, int flags, int mode)
+{
+	return sdbm_prep_pagesize(dirname, pagname, datname,
+		flags, mode, DBM_PBLKSIZ);
+}
+
+/**
+ * Open database with specified files, flags and mode (like open() arguments),
+ * creating it with the given page size if it does not exist yet.
+ *
+ * If the `datname' argument is NULL, large keys/values are disabled for
+ * this database.
+ *
+ * @param dirname	the file to use for .dir
+ * @param pagname	the file to use for .pag
+ * @param datname	if not-NULL, the file to use for .dat (big keys/values)
+ * @param flags		open() flags
+ * @param mode		open() mode
+ * @param pagesize	size of .pag pages for new databases, 0 for the default
+ *
+ * @return the created database, or NULL on error with errno set.
+ */
+DBM *
+sdbm_prep_pagesize(const char *dirname, const char *pagname,
+	const char *datname, int flags, int mode, long pagesize)
 {
 	DBM *db;
 	filestat_t dstat;
 
+	if (0 == pagesize)
+		pagesize = DBM_PBLKSIZ;
+
+	if (!sdbm_pagesize_is_valid(pagesize)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
 	if (
 		(db = sdbm_alloc()) == NULL ||
 		(db->dirbuf = walloc(DBM_DBLKSIZ)) == NULL
@@ -343,18 +560,6 @@ sdbm_prep(const char *dirname, const char *pagname,
 		goto error;
 	}
 
-	/*
-	 * If configured to use the LRU cache, then db->pagbuf will point to
-	 * pages allocated in the cache, so it need not be allocated separately.
-	 */
-
-#ifndef LRU
-	if ((db->pagbuf = walloc(DBM_PBLKSIZ)) == NULL) {
-		errno = ENOMEM;
-		goto error;
-	}
-#endif
-
 	/*
 	 * adjust user flags so that WRONLY becomes RDWR,
 	 * as required by this package. Also set our internal
@@ -394,6 +599,27 @@ sdbm_prep(const char *dirname, const char *pagname,
 				db->maxbno = dstat.st_size * BYTESIZ;
 
 				memset(db->dirbuf, 0, DBM_DBLKSIZ);
+
+				/*
+				 * The page size is known once the .pag file is opened.
+				 */
+
+				if (!sdbm_pagfile_setup(db, pagesize))
+					goto error;
+
+				/*
+				 * If configured to use the LRU cache, then db->pagbuf will
+				 * point to pages allocated in the cache, so it need not be
+				 * allocated separately.
+				 */
+
+#ifndef LRU
+				if ((db->pagbuf = walloc(db->pblksiz)) == NULL) {
+					errno = ENOMEM;
+					goto error;
+				}
+#endif
+
 				goto success;
 			}
 		}
@@ -430,6 +656,17 @@ success:
 	db->openflags = flags;
 	db->openmode = mode;
 
+#ifdef WAL
+	/*
+	 * Replay the write-ahead log left over by a crash, if any.
+	 */
+
+	db->walname = wal_name(pagname);
+
+	if (!wal_recover(db, booleanize(flags & O_TRUNC)))
+		goto error;
+#endif
+
 	/*
 	 * We expect a random access pattern on the files.
 	 */
@@ -451,6 +688,9 @@ success:
  * Mark newly created database as being thread-safe.
  *
  * This will make all external operations on the database thread-safe.
+ * Lookups through sdbm_fetch() and sdbm_exists() can then be conducted
+ * in parallel by several threads when they only involve data already held
+ * in memory.
  */
 void
 sdbm_thread_safe(DBM *db)
@@ -460,7 +700,14 @@ sdbm_thread_safe(DBM *db)
 
 	WALLOC0(db->lock);
 	qlock_recursive_init(db->lock);
+	WALLOC0(db->latch);
+	rwlock_init(db->latch);
 	XMALLOC0_ARRAY(db->returned, THREAD_MAX);
+
+#ifdef LRU
+	if (db->cache != NULL)
+		lru_thread_safe(db);
+#endif
 }
 
 /**
@@ -480,6 +727,7 @@ sdbm_lock(DBM *db)
 		"%s(): SDBM \"%s\" not marked thread-safe", G_STRFUNC, sdbm_name(db));
 
 	qlock_lock(db->lock);
+	rwlock_wlock(db->latch);
 }
 
 /*
@@ -495,6 +743,7 @@ sdbm_unlock(DBM *db)
 	g_assert_log(db->lock != NULL,
 		"%s(): SDBM \"%s\" not marked thread-safe", G_STRFUNC, sdbm_name(db));
 
+	rwlock_wunlock(db->latch);
 	qlock_unlock(db->lock);
 }
 
@@ -730,6 +979,12 @@ log_sdbmstats(DBM *db)
 	s_info("sdbm: \"%s\" inplace value writes = %.2f%% on %lu occurence%s",
 		sdbm_name(db), db->repl_inplace * 100.0 / MAX(db->repl_stores, 1),
 		db->repl_stores, plural(db->repl_stores));
+#ifdef THREADS
+	if (db->lock != NULL) {
+		s_info("sdbm: \"%s\" shared lookups = %u (retried exclusively %u)",
+			sdbm_name(db), db->shared_lookups, db->shared_retries);
+	}
+#endif
 }
 
 static void
@@ -872,13 +1127,15 @@ flush_dirbuf(DBM *db)
 
 	/*
 	 * The bitmap forest is a critical part, make sure the kernel flushes
-	 * it immediately to disk.
+	 * it immediately to disk, unless it was already committed to the
+	 * write-ahead log.
 	 */
 
 #ifdef LRU
 	if (DBM_DBLKSIZ == w) {
 		db->dirbuf_dirty = FALSE;
-		fd_fdatasync(db->dirf);
+		if (!sdbm_has_wal(db))
+			fd_fdatasync(db->dirf);
 		return TRUE;
 	}
 #endif
@@ -895,6 +1152,28 @@ flush_dirbuf(DBM *db)
 	return TRUE;
 }
 
+#ifdef WAL
+/**
+ * Write back all the dirty pages and the dirty dir block, then discard
+ * the write-ahead log.
+ *
+ * @return TRUE on success.
+ */
+static bool
+sdbm_wal_flush(DBM *db)
+{
+	assert_sdbm_locked(db);
+
+	if (-1 == flush_dirtypag(db))
+		return FALSE;
+
+	if (db->dirbuf_dirty && !flush_dirbuf(db))
+		return FALSE;
+
+	return wal_checkpoint(db, TRUE);
+}
+#endif	/* WAL */
+
 static void
 sdbm_unlink_file(const char *name, const char *path)
 {
@@ -923,11 +1202,15 @@ sdbm_close_internal(DBM *db, bool clearfiles, bool destroy)
 		G_STRFUNC, db->refcnt, destroy ? 'y' : 'n');
 #endif
 
+#ifdef WAL
+	wal_close(db, clearfiles);
+#endif
+
 #ifdef LRU
 	if (is_valid_fd(db->pagf))
 		lru_close(db);
 #else
-	WFREE_NULL(db->pagbuf, DBM_PBLKSIZ);
+	WFREE_NULL(db->pagbuf, db->pblksiz);
 #endif	/* LRU */
 
 	WFREE_NULL(db->dirbuf, DBM_DBLKSIZ);
@@ -966,9 +1249,14 @@ sdbm_close_internal(DBM *db, bool clearfiles, bool destroy)
 #ifdef BIGDATA
 	HFREE_NULL(db->datname);
 #endif
+#ifdef WAL
+	HFREE_NULL(db->walname);
+#endif
 
 	if (destroy) {
 		if (db->lock != NULL) {
+			rwlock_destroy(db->latch);
+			WFREE(db->latch);
 			qlock_destroy(db->lock);
 			WFREE(db->lock);
 		}
@@ -1098,15 +1386,89 @@ sdbm_close(DBM *db)
 	}													\
 } G_STMT_END
 
+#ifdef THREADS
+/**
+ * Look for key in a thread-safe database whilst only holding the latch in
+ * shared mode, letting concurrent lookups proceed in parallel.
+ *
+ * Only data already in memory are accessed, and nothing is modified: the
+ * current directory block and the pages held in the LRU cache or accessed
+ * in place.  When anything else is needed (I/O, big keys or values), the
+ * lookup is abandoned and must be conducted under the database lock.
+ *
+ * @param db		the database
+ * @param key		the key to look for
+ * @param vp		if non-NULL, where the thread-private value is returned
+ *
+ * @return 1 if the key was found, 0 if it was not, -1 if the lookup has to
+ * be retried with the database locked.
+ */
+static int
+sdbm_shared_lookup(DBM *db, datum key, datum *vp)
+{
+	const char *pag = NULL;
+	long pagb;
+	datum value;
+	int found = -1;
+
+	rwlock_rlock(db->latch);
+
+	if G_UNLIKELY(db->flags & (DBM_BROKEN | DBM_ITERATING))
+		goto done;
+
+	pagb = peekpageb(db, exhash(key));
+
+	if G_UNLIKELY(-1 == pagb)
+		goto done;
+
+	if (pagb == db->pagbno)
+		pag = db->pagbuf;
+#ifdef LRU
+	else
+		pag = lru_peek_page(db, pagb);
+#endif
+
+	if (NULL == pag)
+		goto done;
+
+	found = peekpair(db, pag, key, NULL == vp ? NULL : &value);
+
+	if (1 == found && vp != NULL)
+		*vp = *sdbm_thread_datum(db, &value);
+
+	/* FALL THROUGH */
+
+done:
+	rwlock_runlock(db->latch);
+
+	if G_UNLIKELY(-1 == found)
+		atomic_uint_inc(&db->shared_retries);
+	else
+		atomic_uint_inc(&db->shared_lookups);
+
+	return found;
+}
+#endif	/* THREADS */
+
 datum
 sdbm_fetch(DBM *db, datum key)
 {
-	if G_UNLIKELY(db == NULL || bad(key)) {
+	if G_UNLIKELY(db == NULL || bad(db, key)) {
 		errno = EINVAL;
 		return nullitem;
 	}
 	sdbm_check(db);
 
+#ifdef THREADS
+	if (db->latch != NULL) {
+		datum value;
+		int found = sdbm_shared_lookup(db, key, &value);
+
+		if (found >= 0)
+			return found ? value : nullitem;
+	}
+#endif
+
 	sdbm_synchronize(db);
 
 	if G_UNLIKELY(db->flags & DBM_BROKEN) {
@@ -1134,12 +1496,21 @@ null:
 int
 sdbm_exists(DBM *db, datum key)
 {
-	if G_UNLIKELY(db == NULL || bad(key)) {
+	if G_UNLIKELY(db == NULL || bad(db, key)) {
 		errno = EINVAL;
 		return -1;
 	}
 	sdbm_check(db);
 
+#ifdef THREADS
+	if (db->latch != NULL) {
+		int found = sdbm_shared_lookup(db, key, NULL);
+
+		if (found >= 0)
+			return found;
+	}
+#endif
+
 	sdbm_synchronize(db);
 
 	if G_UNLIKELY(db->flags & DBM_BROKEN) {
@@ -1167,7 +1538,7 @@ sdbm_delete(DBM *db, datum key)
 {
 	int status = -1;
 
-	if G_UNLIKELY(db == NULL || bad(key)) {
+	if G_UNLIKELY(db == NULL || bad(db, key)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1249,7 +1620,7 @@ storepair(DBM *db, datum key, datum val, int flags, bool *existed)
 	if G_UNLIKELY(0 == val.dsize) {
 		val.dptr = "";
 	}
-	if G_UNLIKELY(db == NULL || bad(key) || bad(val)) {
+	if G_UNLIKELY(db == NULL || bad(db, key) || bad(db, val)) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1270,7 +1641,9 @@ storepair(DBM *db, datum key, datum val, int flags, bool *existed)
 	 * is the pair too big (or too small) for this database ?
 	 */
 
-	if G_UNLIKELY(!sdbm_storage_needs(key.dsize, val.dsize, &need)) {
+	if G_UNLIKELY(
+		!sdbm_storage_needs(db->pairmax, key.dsize, val.dsize, &need)
+	) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -1422,19 +1795,19 @@ sdbm_replace(DBM *db, datum key, datum val, bool *existed)
 }
 
 /*
- * makroom - make room by splitting the overfull page
+ * makroom_pages - make room by splitting the overfull page
  * this routine will attempt to make room for DBM_SPLTMAX times before
  * giving up.
+ *
+ * The `twin' and `cur' buffers are scratch pages supplied by makroom().
  */
 static bool
-makroom(DBM *db, long int hash, size_t need)
+makroom_pages(DBM *db, long int hash, size_t need, char *twin, char *cur)
 {
 	long newp;
-	char twin[DBM_PBLKSIZ];
-	char cur[DBM_PBLKSIZ];
 	char *pag = db->pagbuf;
 	long curbno;
-	char *New = (char *) twin;
+	char *New = twin;
 	int smax = DBM_SPLTMAX;
 
 	assert_sdbm_locked(db);
@@ -1442,13 +1815,29 @@ makroom(DBM *db, long int hash, size_t need)
 	do {
 		bool fits;		/* Can we fit new pair in the split page? */
 
+#ifdef WAL
+		/*
+		 * With a write-ahead log, the new page is cached when the incoming
+		 * pair remains in the current page, which can evict a dirty page
+		 * and therefore commit all the dirty pages.  Commit them before the
+		 * split, or the current page could be committed without the pairs
+		 * moved to the new page, which a crash would then lose.
+		 */
+
+		if (
+			sdbm_has_wal(db) && 0 == (hash & (db->hmask + 1)) &&
+			-1 == flush_dirtypag(db)
+		)
+			goto aborted;
+#endif
+
 		/*
 		 * Copy the page we're about to split.  In case there is an error
 		 * flushing the new page to disk, we'll be able to undo the split
 		 * operation and restore the database to a consistent disk image.
 		 */
 
-		memcpy(cur, pag, DBM_PBLKSIZ);
+		memcpy(cur, pag, db->pblksiz);
 		curbno = db->pagbno;
 
 		/*
@@ -1481,7 +1870,7 @@ makroom(DBM *db, long int hash, size_t need)
 
 #ifdef DOSISH		/* DOS-behaviour -- filesystem holes not supported */
 		{
-			static const char zer[DBM_PBLKSIZ];
+			static const char zer[DBM_PBLKSIZ_MAX];
 			long oldtail;
 
 			/*
@@ -1490,12 +1879,12 @@ makroom(DBM *db, long int hash, size_t need)
 			 */
 
 			oldtail = lseek(db->pagf, 0L, SEEK_END);
-			while (OFF_PAG(newp) > oldtail) {
+			while (OFF_PAG(db, newp) > oldtail) {
 				if (lseek(db->pagf, 0L, SEEK_END) < 0 ||
-				    write(db->pagf, zer, DBM_PBLKSIZ) < 0) {
+				    write(db->pagf, zer, db->pblksiz) < 0) {
 					return FALSE;
 				}
-				oldtail += DBM_PBLKSIZ;
+				oldtail += db->pblksiz;
 			}
 		}
 #endif	/* DOSISH */
@@ -1509,7 +1898,7 @@ makroom(DBM *db, long int hash, size_t need)
 
 #ifdef LRU
 			if G_UNLIKELY(!force_flush_pagbuf(db, !db->is_volatile)) {
-				memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+				memcpy(pag, cur, db->pblksiz);	/* Undo split */
 				db->spl_errors++;
 				goto aborted;
 			}
@@ -1526,7 +1915,7 @@ makroom(DBM *db, long int hash, size_t need)
 					/* Restore page address of the page we tried to split */
 					if (!readbuf(db, curbno, NULL))
 						g_assert_not_reached();
-					memcpy(db->pagbuf, cur, DBM_PBLKSIZ);	/* Undo split */
+					memcpy(db->pagbuf, cur, db->pblksiz);	/* Undo split */
 					db->pagbno = curbno;
 					db->spl_errors++;
 					goto aborted;
@@ -1537,7 +1926,7 @@ makroom(DBM *db, long int hash, size_t need)
 			pag = db->pagbuf;		/* Must refresh pointer to current page */
 #else
 			if G_UNLIKELY(!flush_pagbuf(db)) {
-				memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+				memcpy(pag, cur, db->pblksiz);	/* Undo split */
 				db->spl_errors++;
 				goto aborted;
 			}
@@ -1550,10 +1939,12 @@ makroom(DBM *db, long int hash, size_t need)
 			 */
 
 			db->pagbno = newp;
-			memcpy(pag, New, DBM_PBLKSIZ);
+			memcpy(pag, New, db->pblksiz);
 		}
 #ifdef LRU
-		else if (db->is_volatile) {
+		else if (
+			db->is_volatile || (sdbm_has_wal(db) && getcache(db) > 1)
+		) {
 			/*
 			 * Incoming pair is located in the old page, and we need to
 			 * persist the new page, which is no longer needed for the
@@ -1564,10 +1955,14 @@ makroom(DBM *db, long int hash, size_t need)
 			 * cache it instead.  It will be written to disk immediately
 			 * if deferred writes have been turned off despite the DB being
 			 * volatile.
+			 *
+			 * With a write-ahead log, the page is cached so that it can be
+			 * committed together with the split page, unless caching it
+			 * would evict the page being split.
 			 */
 
 			if G_UNLIKELY(!cachepag(db, New, newp)) {
-				memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+				memcpy(pag, cur, db->pblksiz);	/* Undo split */
 				db->spl_errors++;
 				goto aborted;
 			}
@@ -1575,12 +1970,12 @@ makroom(DBM *db, long int hash, size_t need)
 #endif	/* LRU */
 		else if G_UNLIKELY((
 			db->pagwrite++,
-			compat_pwrite(db->pagf, New, DBM_PBLKSIZ, OFF_PAG(newp)) < 0)
+			compat_pwrite(db->pagf, New, db->pblksiz, OFF_PAG(db, newp)) < 0)
 		) {
 			s_warning("sdbm: \"%s\": cannot flush new page #%ld: %m",
 				sdbm_name(db), newp);
 			ioerr(db, TRUE);
-			memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+			memcpy(pag, cur, db->pblksiz);	/* Undo split */
 			db->spl_errors++;
 			goto aborted;
 		}
@@ -1693,7 +2088,7 @@ restore:
 #endif
 
 		db->pagbno = curbno;
-		memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+		memcpy(pag, cur, db->pblksiz);	/* Undo split */
 
 #ifdef LRU
 		if (!force_flush_pagbuf(db, !db->is_volatile))
@@ -1724,8 +2119,10 @@ restore:
 		g_assert(db->pagbno != newp);
 		lru_invalidate(db, newp);	/* We're about to commit a newer version */
 #endif
-		memset(New, 0, DBM_PBLKSIZ);
-		if (compat_pwrite(db->pagf, New, DBM_PBLKSIZ, OFF_PAG(newp)) < 0) {
+		memset(New, 0, db->pblksiz);
+		if (
+			compat_pwrite(db->pagf, New, db->pblksiz, OFF_PAG(db, newp)) < 0
+		) {
 			s_critical("sdbm: \"%s\": cannot zero-back new split page #%ld: %m",
 				sdbm_name(db), newp);
 			ioerr(db, TRUE);
@@ -1733,7 +2130,7 @@ restore:
 			db->spl_corrupt++;
 		}
 
-		memcpy(pag, cur, DBM_PBLKSIZ);	/* Undo split */
+		memcpy(pag, cur, db->pblksiz);	/* Undo split */
 	}
 
 	/* FALL THROUGH */
@@ -1743,6 +2140,31 @@ aborted:
 	return FALSE;
 }
 
+/*
+ * makroom - make room by splitting the overfull page
+ *
+ * Scratch pages are taken from the stack for the default page size, but
+ * larger pages would use too much of the thread stacks and are allocated.
+ */
+static bool
+makroom(DBM *db, long int hash, size_t need)
+{
+	char *buf;
+	bool ok;
+
+	if G_LIKELY(db->pblksiz <= DBM_PBLKSIZ) {
+		char pages[2 * DBM_PBLKSIZ];
+
+		return makroom_pages(db, hash, need, pages, pages + DBM_PBLKSIZ);
+	}
+
+	buf = walloc(2 * db->pblksiz);
+	ok = makroom_pages(db, hash, need, buf, buf + db->pblksiz);
+	wfree(buf, 2 * db->pblksiz);
+
+	return ok;
+}
+
 static datum
 iteration_done(DBM *db, bool completed)
 {
@@ -1917,7 +2339,11 @@ sdbm_firstkey(DBM *db)
 	 * Start at page 0, skipping any page we can't read.
 	 */
 
-	for (db->blkptr = 0; OFF_PAG(db->blkptr) <= db->pagtail; db->blkptr++) {
+	for (
+		db->blkptr = 0;
+		OFF_PAG(db, db->blkptr) <= db->pagtail;
+		db->blkptr++
+	) {
 		db->keyptr = 0;
 		if (fetch_pagbuf(db, db->blkptr)) {
 			if (db->flags & DBM_KEYCHECK)
@@ -2068,6 +2494,38 @@ getpageb(DBM *db, long int hash, bool update)
 	return hash & hmask;
 }
 
+#ifdef THREADS
+/**
+ * Compute the page number where a key hashing to the specified hash would lie
+ * using only the directory block currently held in memory, leaving the
+ * DB context untouched.
+ *
+ * @return the page number, -1 if another directory block would be needed.
+ */
+static long
+peekpageb(const DBM *db, long int hash)
+{
+	int hbit;
+	long dbit;
+
+	dbit = 0;
+	hbit = 0;
+	while (dbit < db->maxbno) {
+		long c = dbit / BYTESIZ;
+
+		if G_UNLIKELY(c / DBM_DBLKSIZ != db->dirbno)
+			return -1;
+
+		if (0 == (db->dirbuf[c % DBM_DBLKSIZ] & (1 << dbit % BYTESIZ)))
+			break;
+
+		dbit = 2 * dbit + ((hash & (1 << hbit++)) ? 2 : 1);
+	}
+
+	return hash & masks[hbit];
+}
+#endif	/* THREADS */
+
 /**
  * Fetch page where a key hashing to the specified hash would lie.
  * Update current hash bit and hash mask as a side effect.
@@ -2169,8 +2627,17 @@ fetch_dirbuf(DBM *db, long dirb)
 		ssize_t got;
 
 #ifdef LRU
-		if (db->dirbuf_dirty && !flush_dirbuf(db))
-			return FALSE;
+		if (db->dirbuf_dirty) {
+			/*
+			 * With a write-ahead log, the dir block must be committed
+			 * along with the pages it refers to before being written.
+			 */
+
+			if (sdbm_has_wal(db) && -1 == flush_dirtypag(db))
+				return FALSE;
+			if (!flush_dirbuf(db))
+				return FALSE;
+		}
 #endif
 
 		db->dirread++;
@@ -2235,7 +2702,7 @@ setdbit(DBM *db, long int dbit)
 
 #ifdef LRU
 	db->dirbuf_dirty = TRUE;
-	if (db->is_volatile) {
+	if (db->is_volatile || sdbm_has_wal(db)) {
 		db->dirwdelayed++;
 	} else
 #endif
@@ -2281,7 +2748,7 @@ getnext(DBM *db)
 		db->keyptr = 0;
 		db->blkptr++;
 
-		if G_UNLIKELY(OFF_PAG(db->blkptr) > db->pagtail)
+		if G_UNLIKELY(OFF_PAG(db, db->blkptr) > db->pagtail)
 			break;
 		else if G_UNLIKELY(!fetch_pagbuf(db, db->blkptr))
 			goto next_page;		/* Skip faulty page */
@@ -2590,6 +3057,11 @@ sdbm_sync(DBM *db)
 		npag++;
 #endif
 
+#ifdef WAL
+	if G_UNLIKELY(!wal_checkpoint(db, FALSE))
+		npag = (ssize_t) -1;
+#endif
+
 done:
 	sdbm_return(db, npag);
 }
@@ -2657,12 +3129,12 @@ sdbm_count(const DBM *db)
 	}
 #endif
 
-	if (-1 == seek_to_filepos(db->pagf, 0)) {
+	if (-1 == seek_to_filepos(db->pagf, OFF_PAG(db, 0))) {
 		count = (ssize_t) -1;
 		goto done;
 	}
 
-	len = SDBM_COUNT_PAGES * DBM_PBLKSIZ;
+	len = SDBM_COUNT_PAGES * db->pblksiz;
 	buf = vmm_alloc(len);
 	compat_fadvise_sequential(db->pagf, 0, 0);
 
@@ -2679,11 +3151,11 @@ sdbm_count(const DBM *db)
 			goto abort;
 		}
 
-		n = r / DBM_PBLKSIZ;		/* Amount of pages fully read */
+		n = r / db->pblksiz;		/* Amount of pages fully read */
 		finished = n != SDBM_COUNT_PAGES;
 
-		for (pag = buf; n != 0; n--, pag = ptr_add_offset(pag, DBM_PBLKSIZ)) {
-			if (sdbm_chkpage(pag))
+		for (pag = buf; n != 0; n--, pag = ptr_add_offset(pag, db->pblksiz)) {
+			if (sdbm_chkpage(pag, db->pblksiz))
 				count += paircount(pag);
 		}
 
@@ -2733,6 +3205,16 @@ sdbm_shrink(DBM *db)
 			G_STRFUNC, sdbm_name(db));
 	}
 
+#ifdef WAL
+	/*
+	 * Pages and dir blocks are going to be changed in place: the log must
+	 * not hold older images that would be replayed over them.
+	 */
+
+	if (sdbm_has_wal(db) && !sdbm_wal_flush(db))
+		goto error;
+#endif
+
 	/*
 	 * Look how many full pages we need in the .pag file by remembering the
 	 * page block number after the last non-empty page we saw.
@@ -2740,7 +3222,7 @@ sdbm_shrink(DBM *db)
 
 	paglen = buf.st_size;
 
-	while ((offset = OFF_PAG(bno)) < paglen) {
+	while ((offset = OFF_PAG(db, bno)) < paglen) {
 		unsigned short count;
 		int r;
 
@@ -2779,7 +3261,7 @@ sdbm_shrink(DBM *db)
 		bno++;
 	}
 
-	offset = OFF_PAG(truncate_bno);
+	offset = OFF_PAG(db, truncate_bno);
 
 	if (offset < paglen) {
 		if (-1 == ftruncate(db->pagf, offset))
@@ -2913,7 +3395,7 @@ sdbm_rename_files(DBM *db,
 	const char *dirname, const char *pagname, const char *datname)
 {
 	int openflags, error = 0, status;
-	bool dat_opened, dat_reopened;
+	bool dat_opened, dat_reopened, logged = FALSE;
 
 	if G_UNLIKELY(db == NULL) {
 		errno = EINVAL;
@@ -2947,8 +3429,20 @@ sdbm_rename_files(DBM *db,
 	 *
 	 * If any of the rename fails or we cannot re-open the new file, then
 	 * we undo the renaming and try to reopen the original files.
+	 *
+	 * The write-ahead log, however, is emptied and closed: it will be
+	 * re-created under its new name.
 	 */
 
+#ifdef WAL
+	if (sdbm_has_wal(db)) {
+		if (!sdbm_wal_flush(db))
+			goto error;
+		wal_close(db, FALSE);
+		logged = TRUE;
+	}
+#endif
+
 	fd_forget_and_close(&db->dirf);
 	fd_forget_and_close(&db->pagf);
 
@@ -3013,6 +3507,11 @@ rename_ok:
 	db->pagname = h_strdup(pagname);
 	db->datname = h_strdup(datname);
 
+#ifdef WAL
+	HFREE_NULL(db->walname);
+	db->walname = wal_name(pagname);
+#endif
+
 	/* FALL THROUGH */
 
 emergency_restore:
@@ -3040,7 +3539,17 @@ emergency_restore:
 	if (!dat_reopened) {
 		error = errno;
 		db->flags |= DBM_BROKEN;
+		goto done;
+	}
+
+#ifdef WAL
+	if (logged && -1 == wal_open(db)) {
+		s_warning("sdbm: \"%s\": cannot re-create write-ahead log: %m",
+			sdbm_name(db));
 	}
+#else
+	(void) logged;
+#endif
 
 	/* FALL THROUGH */
 
@@ -3173,8 +3682,8 @@ sdbm_clear(DBM *db)
 	if G_UNLIKELY(db->rdb != NULL)
 		sdbm_clear(db->rdb);		/* Also clear rebuilt DB */
 	db->delta = 0;
-	if G_UNLIKELY(-1 == ftruncate(db->pagf, 0))
-		goto error;
+	if G_UNLIKELY(-1 == ftruncate(db->pagf, OFF_PAG(db, 0)))
+		goto error;		/* Keeps the .pag header, if any */
 	db->pagbno = -1;
 	db->pagtail = 0L;
 	if G_UNLIKELY(-1 == ftruncate(db->dirf, 0))
@@ -3187,6 +3696,11 @@ sdbm_clear(DBM *db)
 	db->keyptr = 0;
 #ifdef LRU
 	lru_discard(db, 0);
+	db->dirbuf_dirty = FALSE;
+#endif
+#ifdef WAL
+	if G_UNLIKELY(!wal_checkpoint(db, TRUE))
+		goto error;
 #endif
 	sdbm_clearerr(db);
 #ifdef BIGDATA
@@ -3293,6 +3807,134 @@ sdbm_set_wdelay(DBM *db, bool on)
 	sdbm_return(db, result);
 }
 
+/**
+ * @return whether pages are accessed in place through a memory mapping.
+ */
+bool
+sdbm_get_mmap(const DBM *db)
+{
+	bool mapped;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef LRU
+	mapped = getmmap(db);
+#else
+	mapped = FALSE;
+#endif
+
+	sdbm_return(db, mapped);
+}
+
+/**
+ * Turn in-place access of pages through a memory mapping on or off.
+ *
+ * This avoids copying pages into the LRU cache, and the associated system
+ * calls, which is mostly interesting for read-mostly databases.  Pages
+ * modified in place are written back by the kernel, and sdbm_sync()
+ * initiates their write-back.
+ *
+ * @return 0 if OK, -1 on error with errno set (ENOTSUP when not supported).
+ */
+int
+sdbm_set_mmap(DBM *db, bool on)
+{
+	int result;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef LRU
+	if (on && sdbm_has_wal(db)) {
+		errno = EBUSY;
+		result = -1;
+	} else {
+		result = setmmap(db, on);
+	}
+#else
+	(void) on;
+	errno = ENOTSUP;
+	result = -1;
+#endif
+
+	sdbm_return(db, result);
+}
+
+/**
+ * @return whether dirty pages are logged ahead of being written in place.
+ */
+bool
+sdbm_get_wal(const DBM *db)
+{
+	bool logged;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+	logged = sdbm_has_wal(db);
+	sdbm_return(db, logged);
+}
+
+/**
+ * Turn the write-ahead log on or off.
+ *
+ * When on, writes are deferred and dirty pages are committed to a log by
+ * batches, with a single synchronous write, before being written in place.
+ * Many small updates therefore cost one sequential append to the log, and
+ * the database can be recovered by replaying the log after a crash.
+ *
+ * Volatile databases, which are rebuilt from scratch each time they are
+ * opened, cannot be logged.
+ *
+ * @return 0 if OK, -1 on error with errno set (ENOTSUP when not supported).
+ */
+int
+sdbm_set_wal(DBM *db, bool on)
+{
+	int result = 0;
+
+	sdbm_check(db);
+
+	sdbm_synchronize(db);
+
+#ifdef WAL
+	if (on == sdbm_has_wal(db))
+		goto done;
+
+	if (on) {
+		if G_UNLIKELY(db->flags & DBM_RDONLY) {
+			errno = EPERM;
+			result = -1;
+		} else if G_UNLIKELY(db->is_volatile) {
+			errno = EINVAL;		/* Nothing to recover */
+			result = -1;
+		} else if G_UNLIKELY(getmmap(db)) {
+			errno = EBUSY;		/* Pages modified in place cannot be logged */
+			result = -1;
+		} else {
+			if G_UNLIKELY(NULL == db->cache)
+				lru_init(db);
+			result = wal_open(db);
+		}
+	} else if (sdbm_wal_flush(db)) {
+		wal_close(db, FALSE);
+	} else {
+		result = -1;
+	}
+
+done:
+#else
+	(void) on;
+	errno = ENOTSUP;
+	result = -1;
+#endif	/* WAL */
+
+	sdbm_return(db, result);
+}
+
 /**
  * @return whether database was flagged as "volatile".
  */
@@ -3317,7 +3959,8 @@ sdbm_is_volatile(const DBM *db)
 /**
  * Set whether database is volatile (rebuilt from scratch each time it is
  * opened, so disk consistency is not so much an issue).
- * As a convenience, also turns delayed writes on if the argument is TRUE.
+ * As a convenience, also turns delayed writes on if the argument is TRUE,
+ * and the write-ahead log off.
  */
 int
 sdbm_set_volatile(DBM *db, bool yes)
@@ -3331,6 +3974,14 @@ sdbm_set_volatile(DBM *db, bool yes)
 #ifdef LRU
 	db->is_volatile = yes;
 	result = yes ? setwdelay(db, TRUE) : 0;
+#ifdef WAL
+	if (yes && sdbm_has_wal(db)) {
+		if (sdbm_wal_flush(db))
+			wal_close(db, FALSE);
+		else
+			result = -1;
+	}
+#endif
 #else
 	(void) yes;
 	result = 0;
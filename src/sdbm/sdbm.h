@@ -9,13 +9,16 @@
 #define _sdbm_h_
 
 #define DBM_DBLKSIZ 4096		/* size of a page within ".dir" files */
-#define DBM_PBLKSIZ 1024		/* size of a page within ".pag" files */
+#define DBM_PBLKSIZ 1024		/* default size of a page within ".pag" files */
+#define DBM_PBLKSIZ_MAX 16384	/* maximum size of a page within ".pag" files */
 #define DBM_BBLKSIZ 1024		/* size of a page within ".dat" files */
 #define DBM_PAIRMAX 1008		/* arbitrary on DBM_PBLKSIZ-N */
+#define DBM_PAGOVER	(DBM_PBLKSIZ - DBM_PAIRMAX)	/* page overhead for pairs */
 #define DBM_SPLTMAX	10			/* maximum allowed splits for an insertion */
 #define DBM_DIRFEXT	".dir"
 #define DBM_PAGFEXT	".pag"
 #define DBM_DATFEXT	".dat"		/* for large keys or values */
+#define DBM_WALFEXT	".wal"		/* write-ahead log */
 
 typedef struct DBM DBM;
 
@@ -74,6 +77,10 @@ int sdbm_exists(DBM *, datum);
  * other
  */
 DBM *sdbm_prep(const char *, const char *, const char *, int, int);
+DBM *sdbm_open_pagesize(const char *, int, int, long);
+DBM *sdbm_prep_pagesize(const char *, const char *, const char *,
+	int, int, long);
+long sdbm_pagesize(const DBM *) G_PURE;
 long sdbm_hash(const char *, size_t) G_PURE;
 bool sdbm_rdonly(const DBM *);
 bool sdbm_error(const DBM *);
@@ -89,6 +96,10 @@ int sdbm_set_cache(DBM *db, long pages);
 long sdbm_get_cache(const DBM *) G_PURE;
 int sdbm_set_wdelay(DBM *db, bool on);
 bool sdbm_get_wdelay(const DBM *) G_PURE;
+int sdbm_set_mmap(DBM *db, bool on);
+bool sdbm_get_mmap(const DBM *) G_PURE;
+int sdbm_set_wal(DBM *db, bool on);
+bool sdbm_get_wal(const DBM *) G_PURE;
 int sdbm_set_volatile(DBM *db, bool yes);
 bool sdbm_is_volatile(const DBM *) G_PURE;
 bool sdbm_shrink(DBM *db);
@@ -101,6 +112,7 @@ int sdbm_rename(DBM *, const char *);
 int sdbm_rename_files(DBM *, const char *, const char *, const char *);
 int sdbm_rebuild(DBM *);
 int sdbm_rebuild_async(DBM *);
+int sdbm_rebuild_pagesize(DBM *, long);
 size_t sdbm_foreach(DBM *db, int flags, sdbm_cb_t cb, void *arg);
 size_t sdbm_foreach_remove(DBM *db, int flags, sdbm_cbr_t cb, void *arg);
 
@@ -120,7 +132,8 @@ int sdbm_refcnt(const DBM *db);
  * Internal routines with clean semantics that can be used by user code.
  * These are not documented.
  */
-bool sdbm_chkpage(const char *);
+bool sdbm_chkpage(const char *, size_t);
+long sdbm_pagfile_header(int);
 void sdbm_warn_if_not_separate(const DBM *db, const char *caller);
 
 /*
@@ -16,6 +16,20 @@
 #define BIGDATA			/* can store large keys/values */
 #define THREADS			/* thread-safe */
 
+#if defined(LRU) && defined(HAS_MMAP)
+#define MMAP			/* can access pages in place, via mmap() */
+#if PTRSIZE >= 8
+#define MMAP_SIZE	(1L << 30)	/* max .pag size accessed in place (1 GiB) */
+#else
+#define MMAP_SIZE	(1L << 24)	/* max .pag size accessed in place (16 MiB) */
+#endif
+#endif
+
+#ifdef LRU
+#define WAL				/* can log dirty pages ahead of writing them */
+#define WAL_CHECKPOINT	(4 * 1024 * 1024)	/* log size triggering checkpoint */
+#endif
+
 /*
  * misc
  */
@@ -0,0 +1,666 @@
+/*
+ * sdbm - ndbm work-alike hashed database library
+ *
+ * Write-ahead log of dirty pages.
+ * author: agent <agent@local>
+ * status: public domain.
+ *
+ * @ingroup sdbm
+ * @file
+ * @author agent
+ * @date 2026
+ */
+
+#include "common.h"
+
+#include "sdbm.h"
+#include "tune.h"
+#include "private.h"
+#include "lru.h"
+#include "wal.h"
+
+#include "lib/compat_pio.h"
+#include "lib/crc.h"
+#include "lib/debug.h"
+#include "lib/endian.h"
+#include "lib/fd.h"
+#include "lib/file.h"
+#include "lib/halloc.h"
+#include "lib/log.h"
+#include "lib/misc.h"			/* For english_strerror() */
+#include "lib/qlock.h"
+#include "lib/str.h"
+#include "lib/stringify.h"		/* For plural() */
+#include "lib/walloc.h"
+#include "lib/xmalloc.h"
+
+#include "lib/override.h"		/* Must be the last header included */
+
+#ifdef WAL
+
+/*
+ * The write-ahead log is a sequence of records, each made of:
+ *
+ *   CRC32 (4 bytes, big-endian) of the remaining of the record
+ *   type (1 byte)
+ *   number (4 bytes, big-endian)
+ *   data length (2 bytes, big-endian)
+ *   data
+ *
+ * Page and directory block images are logged by batches: the images of all
+ * the dirty pages, and of the dirty directory block if any, are followed by
+ * a commit record whose number is the amount of images in the batch.  The
+ * whole batch is appended with a single write and synchronized with a single
+ * fdatasync(), after which the pages can be written in place, lazily.
+ *
+ * Upon recovery, only complete batches are replayed: a batch that was being
+ * appended when we crashed has no valid commit record and is ignored, the
+ * pages it held having never been written in place.
+ *
+ * No page or dir block is written in place before its image has been
+ * committed: evicting a dirty page, or reading another dir block whilst the
+ * current one is dirty, first commits all the dirty pages and the dir block
+ * as a batch.  Replaying committed batches in order therefore brings back
+ * the images that were written in place, or newer ones.  The only pages
+ * written directly are new split pages, which no committed dir block can
+ * reference yet.
+ */
+
+#define WAL_REC_HEAD	11		/* CRC, type, number, data length */
+
+enum wal_rtype {
+	WAL_PAGE = 1,				/* Image of a .pag page */
+	WAL_DIR = 2,				/* Image of a .dir block */
+	WAL_COMMIT = 3				/* End of batch, with amount of images */
+};
+
+enum sdbm_wal_magic { SDBM_WAL_MAGIC = 0x5a3c6d21 };
+
+/**
+ * The write-ahead log descriptor.
+ */
+struct DBMWAL {
+	enum sdbm_wal_magic magic;
+	int fd;						/* Opened log file */
+	fileoffset_t size;			/* Current size of the log */
+	char *buf;					/* Buffer where batches are assembled */
+	size_t buflen;				/* Length of data held in buffer */
+	size_t bufsize;				/* Allocated size of buffer */
+	ulong commits;				/* Stats: amount of batches committed */
+	ulong images;				/* Stats: amount of images logged */
+	ulong checkpoints;			/* Stats: amount of checkpoints done */
+};
+
+static inline void
+sdbm_wal_check(const struct DBMWAL * const wal)
+{
+	g_assert(wal != NULL);
+	g_assert(SDBM_WAL_MAGIC == wal->magic);
+}
+
+/**
+ * Derive the filename to use for the write-ahead log.
+ *
+ * This is based on the .pag filename.  If that file bears the ".pag"
+ * extension, it is simply replaced by a ".wal".  Otherwise, we use the
+ * .pag filename and append the ".wal" suffix to it.
+ *
+ * @param pagname	the .pag filename
+ *
+ * @return a new string to be freed via hfree().
+ */
+char *
+wal_name(const char *pagname)
+{
+	str_t *s = str_new_from(pagname);
+	size_t i;
+
+	if (STR_HAS_SUFFIX(s, DBM_PAGFEXT, &i)) {
+		str_replace(s, i, STR_CONST_LEN(DBM_PAGFEXT), DBM_WALFEXT);
+	} else {
+		str_cat_len(s, DBM_WALFEXT, CONST_STRLEN(DBM_WALFEXT));
+	}
+
+	return str_s2c_null(&s);
+}
+
+/**
+ * Append record to the batch being assembled.
+ */
+static void
+wal_append(struct DBMWAL *wal, enum wal_rtype type, ulong num,
+	const char *data, size_t len)
+{
+	size_t reclen = WAL_REC_HEAD + len;
+	char *p, *q;
+
+	g_assert(len <= MAX_INT_VAL(uint16));
+
+	if (wal->buflen + reclen > wal->bufsize) {
+		wal->bufsize = MAX(wal->bufsize * 2, wal->buflen + reclen);
+		wal->buf = hrealloc(wal->buf, wal->bufsize);
+	}
+
+	p = &wal->buf[wal->buflen];
+	q = p + 4;
+	*q++ = type;
+	q = poke_be32(q, num);
+	q = poke_be16(q, len);
+	if (len != 0)
+		q = mempcpy(q, data, len);
+
+	g_assert(ptr_diff(q, p) == reclen);
+
+	poke_be32(p, crc32_update(0, p + 4, reclen - 4));
+	wal->buflen += reclen;
+}
+
+/**
+ * Log dirty page, invoked by lru_foreach_dirty().
+ */
+static void
+wal_log_page(long num, const char *pag, void *arg)
+{
+	DBM *db = arg;
+
+	wal_append(db->wal, WAL_PAGE, num, pag, db->pblksiz);
+}
+
+/**
+ * Decode record header.
+ *
+ * @param p			start of the record
+ * @param avail		amount of bytes available from the start of the record
+ * @param type		where record type is written
+ * @param num		where record number is written
+ *
+ * @return the length of the record, 0 if the record is invalid.
+ */
+static size_t
+wal_decode(const char *p, size_t avail, enum wal_rtype *type, ulong *num)
+{
+	size_t len;
+
+	if (avail < WAL_REC_HEAD)
+		return 0;
+
+	*type = (uchar) p[4];
+	*num = peek_be32(&p[5]);
+	len = WAL_REC_HEAD + peek_be16(&p[9]);
+
+	if (*type != WAL_PAGE && *type != WAL_DIR && *type != WAL_COMMIT)
+		return 0;
+	if (len > avail)
+		return 0;
+	if (peek_be32(p) != crc32_update(0, p + 4, len - 4))
+		return 0;
+
+	return len;
+}
+
+/**
+ * Scan the log, validating its records.
+ *
+ * @param db		the database
+ * @param p			the log data
+ * @param size		the log size
+ * @param images	where the amount of committed images is written
+ *
+ * @return the length of the committed part of the log.
+ */
+static size_t
+wal_scan(const DBM *db, const char *p, size_t size, size_t *images)
+{
+	size_t pos = 0, committed = 0, count = 0;
+
+	*images = 0;
+
+	while (pos < size) {
+		enum wal_rtype type;
+		size_t len;
+		ulong num;
+
+		len = wal_decode(&p[pos], size - pos, &type, &num);
+		if (0 == len)
+			break;
+
+		switch (type) {
+		case WAL_PAGE:
+			if (len != UNSIGNED(WAL_REC_HEAD + db->pblksiz))
+				goto done;
+			count++;
+			break;
+		case WAL_DIR:
+			if (len != WAL_REC_HEAD + DBM_DBLKSIZ)
+				goto done;
+			count++;
+			break;
+		case WAL_COMMIT:
+			if (num != count)
+				goto done;
+			*images += count;
+			count = 0;
+			committed = pos + len;
+			break;
+		}
+
+		pos += len;
+	}
+
+done:
+	if (committed != size) {
+		s_warning("sdbm: \"%s\": discarding %zu trailing byte%s "
+			"in write-ahead log",
+			sdbm_name(db), size - committed, plural(size - committed));
+	}
+
+	return committed;
+}
+
+/**
+ * Replay the committed part of the log in the .pag and .dir files.
+ *
+ * @return TRUE if OK.
+ */
+static bool
+wal_replay(DBM *db, const char *p, size_t size)
+{
+	size_t pos = 0;
+
+	while (pos < size) {
+		enum wal_rtype type;
+		size_t len;
+		ulong num;
+		ssize_t w = 0;
+
+		len = wal_decode(&p[pos], size - pos, &type, &num);
+		g_assert(len != 0);		/* Was validated by wal_scan() */
+
+		switch (type) {
+		case WAL_PAGE:
+			w = compat_pwrite(db->pagf, &p[pos + WAL_REC_HEAD],
+				db->pblksiz, OFF_PAG(db, num));
+			break;
+		case WAL_DIR:
+			w = compat_pwrite(db->dirf, &p[pos + WAL_REC_HEAD],
+				DBM_DBLKSIZ, OFF_DIR(num));
+			break;
+		case WAL_COMMIT:
+			w = 0;
+			break;
+		}
+
+		if G_UNLIKELY(UNSIGNED(w) != len - WAL_REC_HEAD) {
+			s_warning("sdbm: \"%s\": cannot replay %s #%lu: %s",
+				sdbm_name(db), WAL_PAGE == type ? "page" : "dir block", num,
+				-1 == w ? english_strerror(errno) : "Partial write");
+			return FALSE;
+		}
+
+		pos += len;
+	}
+
+	if (-1 == fd_fdatasync(db->pagf) || -1 == fd_fdatasync(db->dirf)) {
+		s_warning("sdbm: \"%s\": cannot sync replayed data: %m",
+			sdbm_name(db));
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Recover database from its write-ahead log, if any, as we are opening it.
+ *
+ * All the committed batches are written back in place, then the log is
+ * removed.  When the database is opened read-only, the log is left intact
+ * for the next read-write opening.
+ *
+ * @param db		the database, whose .pag and .dir files are opened
+ * @param discard	whether the database is truncated and the log discarded
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+wal_recover(DBM *db, bool discard)
+{
+	filestat_t buf;
+	size_t size, committed, images;
+	char *p = NULL;
+	ssize_t r;
+	int fd;
+
+	g_assert(db->walname != NULL);
+
+	if (discard && !(db->flags & DBM_RDONLY)) {
+		if (-1 == unlink(db->walname) && ENOENT != errno) {
+			s_warning("sdbm: \"%s\": cannot unlink \"%s\": %m",
+				sdbm_name(db), db->walname);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	if (!file_exists(db->walname))
+		return TRUE;		/* No log, database was properly closed */
+
+	fd = file_open(db->walname, O_RDONLY, 0);
+	if (-1 == fd)
+		goto error;
+
+	if (-1 == fstat(fd, &buf))
+		goto error;
+
+	size = buf.st_size;
+
+	if (db->flags & DBM_RDONLY) {
+		if (size != 0) {
+			s_warning("sdbm: \"%s\": opened read-only, "
+				"not replaying %zu-byte write-ahead log",
+				sdbm_name(db), size);
+		}
+		fd_forget_and_close(&fd);
+		return TRUE;
+	}
+
+	if (0 == size)
+		goto clear;
+
+	p = xmalloc(size);
+	r = compat_pread(fd, p, size, 0);
+
+	if (UNSIGNED(r) != size) {
+		if (r >= 0)
+			errno = EIO;
+		goto error;
+	}
+
+	committed = wal_scan(db, p, size, &images);
+
+	if (!wal_replay(db, p, committed))
+		goto error;
+
+	s_info("sdbm: \"%s\": replayed %zu image%s from write-ahead log",
+		sdbm_name(db), images, plural(images));
+
+	/*
+	 * The .dir file may have grown whilst replaying.
+	 */
+
+	if (-1 == fstat(db->dirf, &buf))
+		goto error;
+
+	db->dirbno = (0 == buf.st_size) ? 0 : -1;
+	db->maxbno = buf.st_size * BYTESIZ;
+
+	/* FALL THROUGH */
+
+clear:
+	XFREE_NULL(p);
+	fd_forget_and_close(&fd);
+
+	if (-1 == unlink(db->walname)) {
+		s_warning("sdbm: \"%s\": cannot unlink \"%s\": %m",
+			sdbm_name(db), db->walname);
+		return FALSE;
+	}
+
+	return TRUE;
+
+error:
+	s_warning("sdbm: \"%s\": cannot recover from \"%s\": %m",
+		sdbm_name(db), db->walname);
+	XFREE_NULL(p);
+	fd_forget_and_close(&fd);
+	return FALSE;
+}
+
+/**
+ * Start logging dirty pages ahead of writing them in place.
+ *
+ * @return 0 if OK, -1 on error with errno set.
+ */
+int
+wal_open(DBM *db)
+{
+	struct DBMWAL *wal;
+	int fd;
+
+	g_assert(NULL == db->wal);
+	g_assert(db->walname != NULL);
+
+	/*
+	 * Any log left over was replayed when the database was opened.
+	 */
+
+	fd = file_open(db->walname, O_CREAT | O_RDWR | O_TRUNC, db->openmode);
+	if (-1 == fd)
+		return -1;
+
+	WALLOC0(wal);
+	wal->magic = SDBM_WAL_MAGIC;
+	wal->fd = fd;
+	db->wal = wal;
+
+	return 0;
+}
+
+/**
+ * Commit all the dirty pages, and the dirty directory block, to the log
+ * as a single batch.
+ *
+ * @param db		the database
+ * @param num		number of an extra page to commit, -1 if none
+ * @param pag		image of the extra page, which is no longer cached
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+static bool
+wal_commit_batch(DBM *db, long num, const char *pag)
+{
+	struct DBMWAL *wal = db->wal;
+	size_t n;
+	ssize_t w;
+
+	sdbm_wal_check(wal);
+	assert_sdbm_locked(db);
+
+	wal->buflen = 0;
+	n = lru_foreach_dirty(db, wal_log_page, db);
+
+	if (num >= 0) {
+		wal_log_page(num, pag, db);
+		n++;
+	}
+
+	if (db->dirbuf_dirty && db->dirbno >= 0) {
+		wal_append(wal, WAL_DIR, db->dirbno, db->dirbuf, DBM_DBLKSIZ);
+		n++;
+	}
+
+	if (0 == n)
+		return TRUE;
+
+	wal_append(wal, WAL_COMMIT, n, NULL, 0);
+
+	w = compat_pwrite(wal->fd, wal->buf, wal->buflen, wal->size);
+
+	if G_UNLIKELY(UNSIGNED(w) != wal->buflen || -1 == fd_fdatasync(wal->fd)) {
+		if (w >= 0 && UNSIGNED(w) != wal->buflen)
+			errno = EIO;
+		s_warning("sdbm: \"%s\": cannot commit %zu image%s to log: %m",
+			sdbm_name(db), n, plural(n));
+
+		/*
+		 * Drop the partial batch, which would be ignored on recovery anyway,
+		 * so that the next commit is not appended after garbage.
+		 */
+
+		if (-1 == ftruncate(wal->fd, wal->size)) {
+			s_warning("sdbm: \"%s\": cannot truncate \"%s\": %m",
+				sdbm_name(db), db->walname);
+		}
+		ioerr(db, TRUE);
+		return FALSE;
+	}
+
+	wal->size += wal->buflen;
+	wal->commits++;
+	wal->images += n;
+
+	return TRUE;
+}
+
+/**
+ * Commit all the dirty pages, and the dirty directory block, to the log
+ * as a single batch.
+ *
+ * Once this returns successfully, the logged images can be written in place
+ * without further synchronization.
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+wal_commit(DBM *db)
+{
+	return wal_commit_batch(db, -1, NULL);
+}
+
+/**
+ * Commit all the dirty pages, and the dirty directory block, along with the
+ * image of a dirty page that was removed from the cache and which is about
+ * to be written in place.
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+wal_commit_page(DBM *db, long num, const char *pag)
+{
+	g_assert(num >= 0);
+
+	return wal_commit_batch(db, num, pag);
+}
+
+/**
+ * Discard the log once all the images it holds have been written in place.
+ *
+ * This requires that there be no dirty page left, otherwise the log is kept:
+ * a dirty page could have been logged by a previous batch and not written
+ * in place yet.
+ *
+ * @param db		the database
+ * @param force		if FALSE, only discard the log when it has grown enough
+ *
+ * @return TRUE if OK, FALSE on error with errno set.
+ */
+bool
+wal_checkpoint(DBM *db, bool force)
+{
+	struct DBMWAL *wal = db->wal;
+
+	if (NULL == wal)
+		return TRUE;
+
+	sdbm_wal_check(wal);
+	assert_sdbm_locked(db);
+
+	if (0 == wal->size || (!force && wal->size < WAL_CHECKPOINT))
+		return TRUE;
+
+	if (0 != lru_foreach_dirty(db, NULL, NULL))
+		return TRUE;
+
+	/*
+	 * With all the pages written in place, the dirty dir block can be
+	 * written as well: it must not hold checkpoints back when the pages
+	 * are flushed before it is.
+	 */
+
+	if (db->dirbuf_dirty && db->dirbno >= 0) {
+		ssize_t w;
+
+		db->dirwrite++;
+		w = compat_pwrite(db->dirf, db->dirbuf, DBM_DBLKSIZ,
+			OFF_DIR(db->dirbno));
+
+		if G_UNLIKELY(w != DBM_DBLKSIZ) {
+			if (w >= 0)
+				errno = EIO;
+			s_warning("sdbm: \"%s\": cannot flush dir block #%ld: %m",
+				sdbm_name(db), db->dirbno);
+			ioerr(db, TRUE);
+			return FALSE;
+		}
+
+		db->dirbuf_dirty = FALSE;
+	}
+
+	if (-1 == fd_fdatasync(db->pagf) || -1 == fd_fdatasync(db->dirf)) {
+		s_warning("sdbm: \"%s\": cannot sync before checkpoint: %m",
+			sdbm_name(db));
+		ioerr(db, TRUE);
+		return FALSE;
+	}
+
+	if (-1 == ftruncate(wal->fd, 0)) {
+		s_warning("sdbm: \"%s\": cannot truncate \"%s\": %m",
+			sdbm_name(db), db->walname);
+		ioerr(db, TRUE);
+		return FALSE;
+	}
+
+	wal->size = 0;
+	wal->checkpoints++;
+
+	return TRUE;
+}
+
+/**
+ * Stop logging dirty pages.
+ *
+ * Unless the database files are to be removed, the log is checkpointed and
+ * removed, provided all the logged images could be written in place:
+ * otherwise, it is kept for recovery.
+ *
+ * @param db			the database
+ * @param clearfiles	whether the database files are being removed
+ */
+void
+wal_close(DBM *db, bool clearfiles)
+{
+	struct DBMWAL *wal = db->wal;
+
+	if (NULL == wal)
+		return;
+
+	sdbm_wal_check(wal);
+
+	if (!clearfiles)
+		(void) wal_checkpoint(db, TRUE);
+
+	if (clearfiles || 0 == wal->size) {
+		if (-1 == unlink(db->walname) && ENOENT != errno) {
+			s_warning("sdbm: \"%s\": cannot unlink \"%s\": %m",
+				sdbm_name(db), db->walname);
+		}
+	} else {
+		s_warning("sdbm: \"%s\": keeping %zu-byte write-ahead log",
+			sdbm_name(db), (size_t) wal->size);
+	}
+
+	if (common_stats) {
+		s_info("sdbm: \"%s\" WAL commits = %lu, images = %lu, "
+			"checkpoints = %lu",
+			sdbm_name(db), wal->commits, wal->images, wal->checkpoints);
+	}
+
+	fd_forget_and_close(&wal->fd);
+	HFREE_NULL(wal->buf);
+	wal->magic = 0;
+	WFREE(wal);
+	db->wal = NULL;
+}
+
+#endif	/* WAL */
+
+/* vi: set ts=4 sw=4 cindent: */
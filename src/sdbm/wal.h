@@ -0,0 +1,18 @@
+/* Mini EMBED (wal.c) */
+#define wal_name sdbm__wal_name
+#define wal_recover sdbm__wal_recover
+#define wal_open sdbm__wal_open
+#define wal_close sdbm__wal_close
+#define wal_commit sdbm__wal_commit
+#define wal_commit_page sdbm__wal_commit_page
+#define wal_checkpoint sdbm__wal_checkpoint
+
+char *wal_name(const char *);
+bool wal_recover(DBM *, bool);
+int wal_open(DBM *);
+void wal_close(DBM *, bool);
+bool wal_commit(DBM *);
+bool wal_commit_page(DBM *, long, const char *);
+bool wal_checkpoint(DBM *, bool);
+
+/* vi: set ts=4 sw=4 cindent: */
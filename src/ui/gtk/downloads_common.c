@@ -645,13 +645,29 @@ downloads_gui_status_string(const struct download *d)
 				rw += str_bprintf(ARYPOSLEN(tmpstr, rw),
 					" #%u", d->served_reqs + 1);
 
+			/*
+			 * Show the achieved pipeline occupancy: how many of the
+			 * requests served on this connection had been pipelined, and
+			 * how many requests were outstanding on average when their
+			 * reply came.
+			 */
+
+			if (d->pipelined_reqs)
+				rw += str_bprintf(ARYPOSLEN(tmpstr, rw),
+					" [%u%% %s, %.1f %s]",
+					d->pipelined_reqs * 100 / (d->served_reqs + 1),
+					_("pipelined"),
+					d->pipelined_ahead / (double) d->pipelined_reqs,
+					_("deep"));
+
 			if (GTA_DL_IGNORING == d->status)
 				rw += str_bprintf(ARYPOSLEN(tmpstr, rw), " (%s)", _("ignoring"));
 
 			status = tmpstr;
 
 			/*
-			 * Show status of pipelined HTTP request, if any.
+			 * Show status of the first pipelined HTTP request, if any, and
+			 * how many more were pipelined after it.
 			 */
 
 			if (d->pipeline != NULL) {
@@ -667,7 +683,14 @@ downloads_gui_status_string(const struct download *d)
 				}
 
 				rw += str_bprintf(ARYPOSLEN(tmpstr, rw),
-					" {%s: %s}", state, downloads_gui_pipeline_range_string(d));
+					" {%s: %s", state, downloads_gui_pipeline_range_string(d));
+
+				if (dp->next != NULL) {
+					rw += str_bprintf(ARYPOSLEN(tmpstr, rw),
+						", +%u", download_pipeline_depth(d) - 1);
+				}
+
+				rw += str_bprintf(ARYPOSLEN(tmpstr, rw), "}");
 			}
 		} else {
 			status = _("Awaiting data");